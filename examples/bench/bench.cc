@@ -0,0 +1,571 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "build/build_config.h"
+
+#if defined(OS_POSIX)
+#include <arpa/inet.h>
+#endif
+
+#include "base/strings/string_number_conversions.h"
+#include "tin/all.h"
+#include "tin/sync/rwmutex.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/threadpoll.h"
+#include "tin/runtime/timer/timer_queue.h"
+#include "tin/util/hash.h"
+
+// microbenchmarks of the runtime primitives. every benchmark is run with
+// a growing number of iterations until it takes kBenchTimeNs, like go
+// test -bench, and reports ns per op. without a procs argument the binary
+// runs itself once per 1, 2, 4 .. NumberOfProcessors procs, the runtime
+// can not change its P count once started.
+
+namespace {
+
+const int64 kBenchTimeNs = 500 * tin::kMillisecond;
+const int64 kMaxIterations = 1000000000;
+
+int bench_procs = 1;
+const char* bench_filter = NULL;
+
+typedef void (*BenchFunc)(int64 n);
+
+// runs body on bench_procs greenlets, splitting n ops between them.
+typedef void (*WorkerFunc)(int64 n, void* arg);
+
+void RunWorker(WorkerFunc body, int64 n, void* arg, tin::WaitGroup* wg) {
+  body(n, arg);
+  wg->Done();
+}
+
+void RunParallel(int64 n, WorkerFunc body, void* arg) {
+  tin::WaitGroup wg(bench_procs);
+  for (int i = 0; i < bench_procs; i++) {
+    int64 share = n / bench_procs + (i < n % bench_procs ? 1 : 0);
+    tin::Spawn(&RunWorker, body, share, arg, &wg);
+  }
+  wg.Wait();
+}
+
+// spawn/exit: one op is a greenlet spawned, run and exited.
+void Done(tin::WaitGroup* wg) {
+  wg->Done();
+}
+
+void SpawnExitWorker(int64 n, void* arg) {
+  tin::WaitGroup wg(static_cast<int>(n));
+  for (int64 i = 0; i < n; i++)
+    tin::Spawn(&Done, &wg);
+  wg.Wait();
+}
+
+void BenchSpawnExit(int64 n) {
+  RunParallel(n, SpawnExitWorker, NULL);
+}
+
+// steal: one spawner, one op is a greenlet doing a little work. every P
+// but the spawner's only gets work by stealing, so the owner pushing to
+// its runq races the stealers taking from it.
+void Spin(tin::WaitGroup* wg) {
+  volatile int sink = 0;
+  for (int i = 0; i < 256; i++)
+    sink = sink + i;
+  wg->Done();
+}
+
+void BenchSteal(int64 n) {
+  tin::WaitGroup wg(static_cast<int>(n));
+  for (int64 i = 0; i < n; i++)
+    tin::Spawn(&Spin, &wg);
+  wg.Wait();
+}
+
+// context switch: one op is a Sched of each of two greenlets, so two
+// switches through SwitchG when they share a P.
+void YieldLoop(int64 n, tin::WaitGroup* wg) {
+  for (int64 i = 0; i < n; i++)
+    tin::Sched();
+  wg->Done();
+}
+
+void BenchYield(int64 n) {
+  tin::WaitGroup wg(2);
+  tin::Spawn(&YieldLoop, n, &wg);
+  tin::Spawn(&YieldLoop, n, &wg);
+  wg.Wait();
+}
+
+// channel ping-pong: one op is a round trip over two unbuffered channels.
+void Pong(tin::Channel<int>* ping, tin::Channel<int>* pong) {
+  int v = 0;
+  while (ping->Pop(&v))
+    pong->Push(v);
+}
+
+void BenchChanPingPong(int64 n) {
+  tin::Chan<int> ping = tin::MakeChan<int>(0);
+  tin::Chan<int> pong = tin::MakeChan<int>(0);
+  tin::Spawn(&Pong, ping.get(), pong.get());
+  int v = 0;
+  for (int64 i = 0; i < n; i++) {
+    ping->Push(static_cast<int>(i));
+    pong->Pop(&v);
+  }
+  ping->Close();
+}
+
+// channel fan-in: bench_procs producers, one consumer, one op is an item.
+void FanInWorker(int64 n, void* arg) {
+  tin::Channel<int>* ch = static_cast<tin::Channel<int>*>(arg);
+  for (int64 i = 0; i < n; i++)
+    ch->Push(static_cast<int>(i));
+}
+
+void FanIn(int64 n, tin::Channel<int>* ch, tin::WaitGroup* wg) {
+  RunParallel(n, FanInWorker, ch);
+  wg->Done();
+}
+
+void BenchChanFanIn(int64 n) {
+  tin::Chan<int> ch = tin::MakeChan<int>(tin::kDefaultChanSize);
+  tin::WaitGroup wg(1);
+  tin::Spawn(&FanIn, n, ch.get(), &wg);
+  int v = 0;
+  for (int64 i = 0; i < n; i++)
+    ch->Pop(&v);
+  wg.Wait();
+}
+
+// mutex: bench_procs greenlets on one Mutex, one op is a Lock/Unlock.
+struct Shared {
+  tin::Mutex mu;
+  tin::RWMutex rw;
+  tin::WaitGroup wg;
+  int64 value;
+};
+
+void MutexWorker(int64 n, void* arg) {
+  Shared* s = static_cast<Shared*>(arg);
+  for (int64 i = 0; i < n; i++) {
+    s->mu.Lock();
+    s->value++;
+    s->mu.Unlock();
+  }
+}
+
+void BenchMutex(int64 n) {
+  Shared s;
+  s.value = 0;
+  RunParallel(n, MutexWorker, &s);
+}
+
+// rwmutex: nine RLock/RUnlock to one Lock/Unlock.
+void RWMutexWorker(int64 n, void* arg) {
+  Shared* s = static_cast<Shared*>(arg);
+  for (int64 i = 0; i < n; i++) {
+    if (i % 10 == 0) {
+      s->rw.Lock();
+      s->value++;
+      s->rw.Unlock();
+    } else {
+      s->rw.RLock();
+      int64 v = s->value;
+      s->rw.RUnlock();
+      (void)v;
+    }
+  }
+}
+
+void BenchRWMutex(int64 n) {
+  Shared s;
+  s.value = 0;
+  RunParallel(n, RWMutexWorker, &s);
+}
+
+// waitgroup: bench_procs greenlets on one WaitGroup, one op is an Add(1)
+// and a Done.
+void WaitGroupWorker(int64 n, void* arg) {
+  Shared* s = static_cast<Shared*>(arg);
+  for (int64 i = 0; i < n; i++) {
+    s->wg.Add(1);
+    s->wg.Done();
+  }
+}
+
+void BenchWaitGroup(int64 n) {
+  Shared s;
+  s.value = 0;
+  RunParallel(n, WaitGroupWorker, &s);
+  s.wg.Wait();
+}
+
+// NanoSleep: one op is a 1us sleep, mostly timer and wakeup overhead.
+void NanoSleepWorker(int64 n, void* arg) {
+  for (int64 i = 0; i < n; i++)
+    tin::NanoSleep(tin::kMicrosecond);
+}
+
+void BenchNanoSleep(int64 n) {
+  RunParallel(n, NanoSleepWorker, NULL);
+}
+
+// timer churn: one op is a timer added and deleted before it fires, like
+// a deadline that is met.
+void NopTimer(void* arg, uintptr_t seq) {
+}
+
+void TimerChurnWorker(int64 n, void* arg) {
+  tin::runtime::Timer t;
+  t.f = NopTimer;
+  for (int64 i = 0; i < n; i++) {
+    t.when = tin::MonoNow() + tin::kSecond;
+    tin::runtime::timer_q->AddTimer(&t);
+    tin::runtime::timer_q->DelTimer(&t);
+  }
+}
+
+void BenchTimerChurn(int64 n) {
+  RunParallel(n, TimerChurnWorker, NULL);
+}
+
+// ThreadPoll: one op is an empty work run on the pool and the greenlet
+// resumed.
+class NopWork : public tin::runtime::GletWork {
+ public:
+  NopWork() { }
+  virtual ~NopWork() { }
+
+  virtual void Run() {
+    Finalize();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(NopWork);
+};
+
+void ThreadPollWorker(int64 n, void* arg) {
+  for (int64 i = 0; i < n; i++) {
+    NopWork work;
+    tin::runtime::SubmitGletWork(&work);
+  }
+}
+
+void BenchThreadPoll(int64 n) {
+  RunParallel(n, ThreadPollWorker, NULL);
+}
+
+// ip literals: one op is a parse or a format of one of these. the _string
+// one allocates like IPAddress::ToString(), the _libc ones are the
+// inet_pton/inet_ntop baseline.
+const char* const kIPLiterals[] = {
+  "10.0.0.1", "192.168.100.254", "2001:db8::8a2e:370:7334", "::1",
+  "fe80::21b:21ff:fe3c:a1f2", "::ffff:10.1.2.3",
+};
+
+void IPParseWorker(int64 n, void* arg) {
+  tin::net::IPAddress address;
+  size_t lens[arraysize(kIPLiterals)];
+  for (size_t i = 0; i < arraysize(kIPLiterals); i++)
+    lens[i] = strlen(kIPLiterals[i]);
+  for (int64 i = 0; i < n; i++) {
+    size_t k = i % arraysize(kIPLiterals);
+    if (!address.AssignFromIPLiteral(
+            base::StringPiece(kIPLiterals[k], lens[k]))) {
+      abort();
+    }
+  }
+}
+
+void BenchIPParse(int64 n) {
+  RunParallel(n, IPParseWorker, NULL);
+}
+
+tin::net::IPAddress ParsedLiteral(size_t k) {
+  tin::net::IPAddress address;
+  if (!address.AssignFromIPLiteral(kIPLiterals[k]))
+    abort();
+  return address;
+}
+
+void IPFormatWorker(int64 n, void* arg) {
+  tin::net::IPAddress addresses[arraysize(kIPLiterals)];
+  for (size_t i = 0; i < arraysize(kIPLiterals); i++)
+    addresses[i] = ParsedLiteral(i);
+  char buf[tin::net::IPAddress::kMaxLiteralSize];
+  size_t total = 0;
+  for (int64 i = 0; i < n; i++)
+    total += addresses[i % arraysize(kIPLiterals)].ToString(buf, sizeof(buf));
+  if (total == 0 && n != 0)
+    abort();
+}
+
+void BenchIPFormat(int64 n) {
+  RunParallel(n, IPFormatWorker, NULL);
+}
+
+void IPFormatStringWorker(int64 n, void* arg) {
+  tin::net::IPAddress addresses[arraysize(kIPLiterals)];
+  for (size_t i = 0; i < arraysize(kIPLiterals); i++)
+    addresses[i] = ParsedLiteral(i);
+  size_t total = 0;
+  for (int64 i = 0; i < n; i++)
+    total += addresses[i % arraysize(kIPLiterals)].ToString().size();
+  if (total == 0 && n != 0)
+    abort();
+}
+
+void BenchIPFormatString(int64 n) {
+  RunParallel(n, IPFormatStringWorker, NULL);
+}
+
+#if defined(OS_POSIX)
+void IPParseLibcWorker(int64 n, void* arg) {
+  unsigned char bytes[16];
+  for (int64 i = 0; i < n; i++) {
+    const char* literal = kIPLiterals[i % arraysize(kIPLiterals)];
+    int af = strchr(literal, ':') != NULL ? AF_INET6 : AF_INET;
+    if (inet_pton(af, literal, bytes) != 1)
+      abort();
+  }
+}
+
+void BenchIPParseLibc(int64 n) {
+  RunParallel(n, IPParseLibcWorker, NULL);
+}
+
+void IPFormatLibcWorker(int64 n, void* arg) {
+  tin::net::IPAddress addresses[arraysize(kIPLiterals)];
+  for (size_t i = 0; i < arraysize(kIPLiterals); i++)
+    addresses[i] = ParsedLiteral(i);
+  char buf[INET6_ADDRSTRLEN];
+  for (int64 i = 0; i < n; i++) {
+    const tin::net::IPAddress& a = addresses[i % arraysize(kIPLiterals)];
+    if (inet_ntop(a.IsIPv4() ? AF_INET : AF_INET6, a.bytes().data(), buf,
+                  sizeof(buf)) == NULL) {
+      abort();
+    }
+  }
+}
+
+void BenchIPFormatLibc(int64 n) {
+  RunParallel(n, IPFormatLibcWorker, NULL);
+}
+#endif
+
+// checksums and hashes: one op is a Crc32c or a Hash64 of a 4KB frame or
+// a 16 byte key. the _table one is the portable crc, fnv1a the hash the
+// concurrent map used before.
+const int kHashFrameSize = 4096;
+const int kHashKeySize = 16;
+
+struct HashInput {
+  HashInput() {
+    for (int i = 0; i < kHashFrameSize; i++)
+      data[i] = static_cast<char>(i * 131 + 7);
+  }
+  char data[kHashFrameSize];
+};
+
+void Crc32cWorker(int64 n, void* arg) {
+  HashInput input;
+  uint32 crc = 0;
+  for (int64 i = 0; i < n; i++)
+    crc = tin::Crc32cExtend(crc, input.data, kHashFrameSize);
+  if (crc == 0 && n == 1)
+    abort();
+}
+
+void BenchCrc32c(int64 n) {
+  RunParallel(n, Crc32cWorker, NULL);
+}
+
+void Crc32cTableWorker(int64 n, void* arg) {
+  HashInput input;
+  uint32 crc = 0;
+  for (int64 i = 0; i < n; i++)
+    crc = tin::internal::Crc32cPortable(crc, input.data, kHashFrameSize);
+  if (crc == 0 && n == 1)
+    abort();
+}
+
+void BenchCrc32cTable(int64 n) {
+  RunParallel(n, Crc32cTableWorker, NULL);
+}
+
+void Hash64Worker(int64 n, void* arg) {
+  HashInput input;
+  int size = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+  uint64 h = 0;
+  for (int64 i = 0; i < n; i++)
+    h = tin::Hash64(input.data, size, h);
+  if (h == 0 && n == 1)
+    abort();
+}
+
+void BenchHash64Key(int64 n) {
+  RunParallel(n, Hash64Worker, reinterpret_cast<void*>(kHashKeySize));
+}
+
+void BenchHash64Frame(int64 n) {
+  RunParallel(n, Hash64Worker, reinterpret_cast<void*>(kHashFrameSize));
+}
+
+void Fnv1aWorker(int64 n, void* arg) {
+  HashInput input;
+  uint64 h = 0;
+  for (int64 i = 0; i < n; i++) {
+    h ^= GG_UINT64_C(14695981039346656037);
+    for (int k = 0; k < kHashKeySize; k++) {
+      h ^= static_cast<uint8>(input.data[k]);
+      h *= GG_UINT64_C(1099511628211);
+    }
+  }
+  if (h == 0 && n == 1)
+    abort();
+}
+
+void BenchFnv1aKey(int64 n) {
+  RunParallel(n, Fnv1aWorker, NULL);
+}
+
+// cmap_find_string: one op is a Find of one of 1024 session id like keys.
+const int kMapKeys = 1024;
+
+struct StringMap {
+  StringMap() {
+    for (int i = 0; i < kMapKeys; i++) {
+      keys[i] = "session-" + base::IntToString(i * 7919);
+      map.Insert(keys[i], i);
+    }
+  }
+  tin::ConcurrentMap<std::string, int> map;
+  std::string keys[kMapKeys];
+};
+
+void MapFindWorker(int64 n, void* arg) {
+  StringMap* m = static_cast<StringMap*>(arg);
+  int value = 0;
+  for (int64 i = 0; i < n; i++) {
+    if (!m->map.Find(m->keys[i % kMapKeys], &value))
+      abort();
+  }
+}
+
+void BenchMapFindString(int64 n) {
+  StringMap m;
+  RunParallel(n, MapFindWorker, &m);
+}
+
+struct Bench {
+  const char* name;
+  BenchFunc fn;
+};
+
+const Bench kBenches[] = {
+  {"spawn_exit", BenchSpawnExit},
+  {"yield", BenchYield},
+  {"chan_pingpong", BenchChanPingPong},
+  {"chan_fanin", BenchChanFanIn},
+  {"mutex", BenchMutex},
+  {"rwmutex", BenchRWMutex},
+  {"waitgroup", BenchWaitGroup},
+  {"nanosleep", BenchNanoSleep},
+  {"timer_churn", BenchTimerChurn},
+  {"threadpoll", BenchThreadPoll},
+  {"ip_parse", BenchIPParse},
+  {"ip_format", BenchIPFormat},
+  {"ip_format_string", BenchIPFormatString},
+#if defined(OS_POSIX)
+  {"ip_parse_libc", BenchIPParseLibc},
+  {"ip_format_libc", BenchIPFormatLibc},
+#endif
+  {"crc32c_4k", BenchCrc32c},
+  {"crc32c_4k_table", BenchCrc32cTable},
+  {"hash64_16", BenchHash64Key},
+  {"hash64_4k", BenchHash64Frame},
+  {"fnv1a_16", BenchFnv1aKey},
+  {"cmap_find_string", BenchMapFindString},
+};
+
+int64 RunOnce(BenchFunc fn, int64 n) {
+  int64 start = tin::MonoNow();
+  fn(n);
+  return tin::MonoNow() - start;
+}
+
+void RunBench(const Bench& bench) {
+  // warm up stacks, Ms and free lists.
+  RunOnce(bench.fn, 1);
+  int64 n = 1;
+  int64 elapsed = RunOnce(bench.fn, n);
+  while (elapsed < kBenchTimeNs && n < kMaxIterations) {
+    // aim 20% past the bench time, grow at most 100x at once.
+    int64 next = n * 100;
+    if (elapsed > 0)
+      next = n * kBenchTimeNs / elapsed * 6 / 5;
+    if (next > n * 100)
+      next = n * 100;
+    if (next <= n)
+      next = n + 1;
+    n = next;
+    elapsed = RunOnce(bench.fn, n);
+  }
+  printf("%-16s procs=%-3d %12lld %12.1f ns/op\n", bench.name, bench_procs,
+         static_cast<long long>(n), static_cast<double>(elapsed) / n);
+  fflush(stdout);
+}
+
+int TinMain(int argc, char** argv) {
+  for (size_t i = 0; i < arraysize(kBenches); i++) {
+    if (bench_filter != NULL &&
+        strstr(kBenches[i].name, bench_filter) == NULL) {
+      continue;
+    }
+    RunBench(kBenches[i]);
+  }
+  return 0;
+}
+
+// runs this binary once per procs count.
+int RunAllProcs(const char* self) {
+  int ncpu = base::SysInfo::NumberOfProcessors();
+  for (int procs = 1; ; procs *= 2) {
+    if (procs > ncpu)
+      procs = ncpu;
+    std::string cmd = std::string("\"") + self + "\" " +
+                      base::IntToString(procs);
+    if (bench_filter != NULL)
+      cmd += std::string(" ") + bench_filter;
+    if (system(cmd.c_str()) != 0)
+      return 1;
+    if (procs == ncpu)
+      break;
+  }
+  return 0;
+}
+
+}  // namespace
+
+// usage: tin_bench [procs [filter]], filter is a substring of the names,
+// procs 0 runs every procs count.
+int main(int argc, char** argv) {
+  if (argc > 2)
+    bench_filter = argv[2];
+  if (argc < 2 || atoi(argv[1]) <= 0)
+    return RunAllProcs(argv[0]);
+  bench_procs = atoi(argv[1]);
+
+  tin::Initialize();
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+
+  tin::Config config = tin::DefaultConfig();
+  config.SetMaxProcs(bench_procs);
+  tin::PowerOn(TinMain, argc, argv, &config);
+  tin::WaitForPowerOff();
+  tin::Deinitialize();
+  return 0;
+}
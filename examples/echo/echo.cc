@@ -1,5 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "base/strings/string_number_conversions.h"
 #include "tin/all.h"
 
+// usage:
+//   echo [--port=2222] [--stats=seconds]
+//     echo server, prints RuntimeStats deltas every stats seconds.
+//   echo --client [--host=127.0.0.1] [--port=2222] [--conns=64]
+//        [--greenlets=8] [--depth=1] [--size=64] [--rate=0]
+//        [--duration=10]
+//     load generator, conns connections are split over greenlets, every
+//     connection has depth requests of size bytes in flight. rate is the
+//     total requests per second, 0 sends the next batch as soon as the
+//     last one is echoed back (closed loop).
+
+// value of --name=value, or def.
+int64 FlagValue(int argc, char** argv, const char* name, int64 def) {
+  size_t len = strlen(name);
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--", 2) == 0 && strncmp(arg + 2, name, len) == 0 &&
+        arg[2 + len] == '=') {
+      int64 value = 0;
+      if (base::StringToInt64(arg + 3 + len, &value))
+        return value;
+    }
+  }
+  return def;
+}
+
+const char* FlagString(int argc, char** argv, const char* name,
+                       const char* def) {
+  size_t len = strlen(name);
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--", 2) == 0 && strncmp(arg + 2, name, len) == 0) {
+      if (arg[2 + len] == '=')
+        return arg + 3 + len;
+      if (arg[2 + len] == '\0')
+        return "";
+    }
+  }
+  return def;
+}
+
+// bytes the handlers read, bumped on every P at once, and connections
+// accepted.
+tin::ShardedCounter echoed_bytes("echo.bytes");
+tin::ShardedCounter echo_conns("echo.conns");
+
 // case 0
 void HandleClient0(tin::net::TcpConn conn) {
   // Set TCP Read Write buffer.
@@ -15,6 +68,8 @@ void HandleClient0(tin::net::TcpConn conn) {
   conn->SetDeadline(kRWDeadline);
   while (true) {
     int n = conn->Read(buf.get(), kIOBufferSize);
+    if (n > 0)
+      echoed_bytes.Add(n);
     int err = tin::GetErrorCode();
     if (n > 0) {
       conn->SetReadDeadline(kRWDeadline);
@@ -62,6 +117,8 @@ void HandleClient1(tin::net::TcpConn conn) {
   conn->SetDeadline(kRWDeadline);
   while (true) {
     int n = conn->Read(buf.get(), kIOBufferSize);
+    if (n > 0)
+      echoed_bytes.Add(n);
     int err = tin::GetErrorCode();
     if (n > 0) {
       int64 now = tin::MonoNow();
@@ -122,6 +179,8 @@ void HandleClient2(tin::net::TcpConn conn) {
   conn->SetDeadline(kRWDeadline);
   while (true) {
     int n = conn->Read(buf.get(), kIOBufferSize);
+    if (n > 0)
+      echoed_bytes.Add(n);
     int err = tin::GetErrorCode();
     if (n > 0) {
       // update last recv time.
@@ -181,9 +240,46 @@ void HandleClient2(tin::net::TcpConn conn) {
   conn->Close();
 }
 
+// closes the connections of case 3 after 20 seconds without io.
+tin::net::IdleReaper* idle_reaper = NULL;
+
+// case 3, no deadline at all, idle_reaper closes the connection.
+void HandleClient3(tin::net::TcpConn conn) {
+  conn->SetReadBuffer(64 * 1024);
+  conn->SetWriteBuffer(64 * 1024);
+  conn->SetIdleReaper(idle_reaper);
+
+  const int kIOBufferSize = 4 * 1024;
+  scoped_ptr<char[]> buf(new char[kIOBufferSize]);
+  while (true) {
+    int n = conn->Read(buf.get(), kIOBufferSize);
+    if (n > 0)
+      echoed_bytes.Add(n);
+    int err = tin::GetErrorCode();
+    if (err != 0) {
+      VLOG(1) << "Read failed due to: " << tin::GetErrorStr();
+      if (err == TIN_EOF) {
+        if (n > 0) {
+          conn->Write(buf.get(), n);
+        }
+        conn->CloseWrite();
+        tin::NanoSleep(500 * tin::kMillisecond);
+      }
+      break;
+    }
+    conn->Write(buf.get(), n);
+    if (tin::GetErrorCode() != 0) {
+      VLOG(1) << "Write failed due to " << tin::GetErrorStr();
+      break;
+    }
+  }
+  conn->Close();
+}
+
 void Dispatch(tin::net::TcpConn conn, const int64 id) {
   conn->SetNoDelay(true);
-  const int kNumModes = 3;
+  echo_conns.Inc();
+  const int kNumModes = 4;
   int64 which = id % kNumModes;
   switch (which) {
   case 0: {
@@ -198,21 +294,58 @@ void Dispatch(tin::net::TcpConn conn, const int64 id) {
     tin::Spawn(&HandleClient2, conn);
     break;
   }
+  case 3: {
+    tin::Spawn(&HandleClient3, conn);
+    break;
+  }
   break;
   default:
     break;
   }
 }
 
-int TinMain(int argc, char** argv) {
-  const uint16 kPort = 2222;
+// server side, what the runtime did during the last interval.
+void ReportStats(int64 interval) {
+  tin::RuntimeStats last;
+  tin::ReadRuntimeStats(&last);
+  while (true) {
+    tin::NanoSleep(interval);
+    tin::RuntimeStats now;
+    tin::ReadRuntimeStats(&now);
+    printf("stats: live %lld runq %d/%d idle_procs %d ms %d/%d/%d "
+           "spawns %llu steals %llu parks %llu netpoll %llu handoffs %llu\n",
+           static_cast<long long>(now.live_greenlets), now.global_runq,
+           now.local_runq, now.idle_procs, now.spinning_ms, now.idle_ms,
+           now.ms,
+           static_cast<unsigned long long>(now.spawns - last.spawns),
+           static_cast<unsigned long long>(now.steals - last.steals),
+           static_cast<unsigned long long>(now.parks - last.parks),
+           static_cast<unsigned long long>(
+               now.netpoll_ready - last.netpoll_ready),
+           static_cast<unsigned long long>(
+               now.syscall_handoffs - last.syscall_handoffs));
+    tin::ShardedCounterValue counters[16];
+    int n = std::min(tin::GetShardedCounters(counters, 16), 16);
+    for (int i = 0; i < n; i++) {
+      printf("stats: %s %lld\n", counters[i].name,
+             static_cast<long long>(counters[i].value));
+    }
+    fflush(stdout);
+    last = now;
+  }
+}
+
+int RunServer(uint16 port, int64 stats_interval) {
   bool use_ipv6 = false;
   tin::net::TCPListener listener =
-    tin::net::ListenTcp(use_ipv6 ? "0:0:0:0:0:0:0:0" : "0.0.0.0", kPort);
+    tin::net::ListenTcp(use_ipv6 ? "0:0:0:0:0:0:0:0" : "0.0.0.0", port);
   if (tin::GetErrorCode() != 0) {
     LOG(FATAL) << "Listen failed due to " << tin::GetErrorStr();
   }
-  LOG(INFO) << "echo server is listening on port: " << kPort;
+  LOG(INFO) << "echo server is listening on port: " << port;
+  if (stats_interval > 0)
+    tin::Spawn(&ReportStats, stats_interval);
+  idle_reaper = new tin::net::IdleReaper(20 * tin::kSecond);
   int64 id = 0;
   while (true) {
     tin::net::TcpConn conn = listener->Accept();
@@ -226,6 +359,204 @@ int TinMain(int argc, char** argv) {
   return 0;
 }
 
+struct LoadOptions {
+  const char* host;
+  uint16 port;
+  int conns;
+  int greenlets;
+  int depth;
+  int size;
+  int64 rate;
+  int64 duration;
+};
+
+// latencies in SchedLatencyStats buckets, to reuse its percentiles.
+class LatencyRecorder {
+ public:
+  LatencyRecorder() {
+    memset(&stats_, 0, sizeof(stats_));
+    for (int i = 0; i < tin::kSchedLatencyBuckets; i++)
+      lower_[i] = tin::SchedLatencyBucketLower(i);
+  }
+
+  void Record(int64 ns) {
+    int i = static_cast<int>(
+        std::upper_bound(lower_, lower_ + tin::kSchedLatencyBuckets, ns) -
+        lower_) - 1;
+    stats_.buckets[i < 0 ? 0 : i]++;
+    stats_.count++;
+    stats_.sum_ns += ns;
+    if (static_cast<uint64>(ns) > stats_.max_ns)
+      stats_.max_ns = ns;
+  }
+
+  void Merge(const LatencyRecorder& other) {
+    for (int i = 0; i < tin::kSchedLatencyBuckets; i++)
+      stats_.buckets[i] += other.stats_.buckets[i];
+    stats_.count += other.stats_.count;
+    stats_.sum_ns += other.stats_.sum_ns;
+    if (other.stats_.max_ns > stats_.max_ns)
+      stats_.max_ns = other.stats_.max_ns;
+  }
+
+  const tin::SchedLatencyStats& stats() const {
+    return stats_;
+  }
+
+ private:
+  tin::SchedLatencyStats stats_;
+  int64 lower_[tin::kSchedLatencyBuckets];
+  DISALLOW_COPY_AND_ASSIGN(LatencyRecorder);
+};
+
+struct LoadWorker {
+  LoadWorker()
+    : requests(0)
+    , errors(0) {
+  }
+
+  std::vector<tin::net::TcpConn> conns;
+  LatencyRecorder latency;
+  int64 requests;
+  int64 errors;
+};
+
+// reads n requests echoed back on conn, sent at sent_at.
+bool ReadEchoes(tin::net::TcpConn conn, char* buf, int size, int n,
+                int64 sent_at, LatencyRecorder* latency) {
+  int64 want = static_cast<int64>(size) * n;
+  int64 got = 0;
+  int done = 0;
+  while (got < want) {
+    int chunk = static_cast<int>(std::min<int64>(want - got, 64 * 1024));
+    int r = conn->Read(buf, chunk);
+    if (r > 0)
+      got += r;
+    if (tin::GetErrorCode() != 0 && got < want)
+      return false;
+    int64 now = tin::MonoNow();
+    for (; done < n && got >= static_cast<int64>(size) * (done + 1); done++)
+      latency->Record(now - sent_at);
+  }
+  return true;
+}
+
+void RunLoad(const LoadOptions* opts, LoadWorker* worker,
+             tin::WaitGroup* wg) {
+  int depth = opts->depth;
+  std::vector<char> payload(static_cast<size_t>(opts->size) * depth, 'x');
+  std::vector<char> buf(64 * 1024);
+  int64 end = tin::MonoNow() + opts->duration;
+  // open loop, every greenlet sends a batch on all its connections per
+  // interval. latencies count from when the batch was due, so a slow
+  // server is not hidden by sending less.
+  int64 interval = 0;
+  if (opts->rate > 0) {
+    interval = static_cast<int64>(worker->conns.size()) * depth *
+               opts->greenlets * tin::kSecond / opts->rate;
+  }
+  int64 due = tin::MonoNow();
+  while (!worker->conns.empty() && tin::MonoNow() < end) {
+    int64 sent_at = tin::MonoNow();
+    if (interval > 0) {
+      if (due > sent_at)
+        tin::NanoSleep(due - sent_at);
+      sent_at = due;
+      due += interval;
+    }
+    for (size_t i = 0; i < worker->conns.size(); i++) {
+      worker->conns[i]->Write(&payload[0], static_cast<int>(payload.size()));
+      if (tin::GetErrorCode() != 0)
+        worker->errors++;
+    }
+    for (size_t i = 0; i < worker->conns.size(); i++) {
+      if (ReadEchoes(worker->conns[i], &buf[0], opts->size, depth, sent_at,
+                     &worker->latency)) {
+        worker->requests += depth;
+      } else {
+        worker->errors++;
+      }
+    }
+  }
+  for (size_t i = 0; i < worker->conns.size(); i++)
+    worker->conns[i]->Close();
+  wg->Done();
+}
+
+int RunClient(const LoadOptions& opts) {
+  std::vector<LoadWorker*> workers;
+  for (int i = 0; i < opts.greenlets; i++)
+    workers.push_back(new LoadWorker);
+  for (int i = 0; i < opts.conns; i++) {
+    tin::net::TcpConn conn = tin::net::DialTcp(opts.host, opts.port);
+    if (tin::GetErrorCode() != 0) {
+      LOG(ERROR) << "Dial failed due to " << tin::GetErrorStr();
+      for (int j = 0; j < opts.greenlets; j++)
+        delete workers[j];
+      return 1;
+    }
+    conn->SetNoDelay(true);
+    workers[i % opts.greenlets]->conns.push_back(conn);
+  }
+
+  int64 start = tin::MonoNow();
+  tin::WaitGroup wg(opts.greenlets);
+  for (int i = 0; i < opts.greenlets; i++)
+    tin::Spawn(&RunLoad, &opts, workers[i], &wg);
+  wg.Wait();
+  int64 elapsed = tin::MonoNow() - start;
+
+  LatencyRecorder latency;
+  int64 requests = 0;
+  int64 errors = 0;
+  for (int i = 0; i < opts.greenlets; i++) {
+    latency.Merge(workers[i]->latency);
+    requests += workers[i]->requests;
+    errors += workers[i]->errors;
+    delete workers[i];
+  }
+  double seconds = static_cast<double>(elapsed) / tin::kSecond;
+  printf("%lld requests in %.2fs, %lld errors\n",
+         static_cast<long long>(requests), seconds,
+         static_cast<long long>(errors));
+  printf("throughput: %.0f req/s, %.2f MB/s\n", requests / seconds,
+         requests * opts.size / seconds / (1024 * 1024));
+  const tin::SchedLatencyStats& s = latency.stats();
+  const double kUs = tin::kMicrosecond;
+  printf("latency us: p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+         tin::SchedLatencyPercentile(s, 0.5) / kUs,
+         tin::SchedLatencyPercentile(s, 0.9) / kUs,
+         tin::SchedLatencyPercentile(s, 0.99) / kUs,
+         tin::SchedLatencyPercentile(s, 0.999) / kUs, s.max_ns / kUs);
+  // the process exits right after TinMain returns.
+  fflush(stdout);
+  return 0;
+}
+
+int TinMain(int argc, char** argv) {
+  uint16 port = static_cast<uint16>(FlagValue(argc, argv, "port", 2222));
+  if (FlagString(argc, argv, "client", NULL) == NULL)
+    return RunServer(port, FlagValue(argc, argv, "stats", 0) * tin::kSecond);
+
+  LoadOptions opts;
+  opts.host = FlagString(argc, argv, "host", "127.0.0.1");
+  opts.port = port;
+  opts.conns = static_cast<int>(FlagValue(argc, argv, "conns", 64));
+  opts.greenlets = static_cast<int>(FlagValue(argc, argv, "greenlets", 8));
+  opts.depth = static_cast<int>(FlagValue(argc, argv, "depth", 1));
+  opts.size = static_cast<int>(FlagValue(argc, argv, "size", 64));
+  opts.rate = FlagValue(argc, argv, "rate", 0);
+  opts.duration = FlagValue(argc, argv, "duration", 10) * tin::kSecond;
+  if (opts.conns <= 0 || opts.greenlets <= 0 || opts.depth <= 0 ||
+      opts.size <= 0) {
+    LOG(ERROR) << "conns, greenlets, depth and size must be positive";
+    return 1;
+  }
+  if (opts.greenlets > opts.conns)
+    opts.greenlets = opts.conns;
+  return RunClient(opts);
+}
+
 int main(int argc, char** argv) {
   tin::Initialize();
 
@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "build/build_config.h"
+
+#if defined(OS_POSIX)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "base/strings/string_number_conversions.h"
+#include "tin/all.h"
+
+// usage:
+//   idle_conns [--conns=10000] [--active=100] [--rate=100] [--size=64]
+//              [--idle=10] [--port=2223] [--stack=0] [--deadline=0]
+//              [--buffered]
+//
+// how tin scales with connection count. one process opens conns loopback
+// connections to its own echo server, spread over 127.0.0.x so a million
+// of them do not run out of ephemeral ports. the server runs a greenlet
+// per connection, the client side keeps just the connection. then
+//   - RSS, stack and buffer bytes per connection once all are open,
+//   - netpoll readies and M wakeups per second while all sit idle for
+//     idle seconds,
+//   - latency percentiles of active connections sending rate requests
+//     of size bytes per second each amid the idle ones, for idle seconds
+//     again,
+//   - timers pending, one per server connection with --deadline=seconds.
+// stack is the server greenlet stack in bytes, 0 for the default. the
+// server reads with ReadPooled and holds no buffer while idle, unless
+// --buffered gives every connection a 4KB buffer of its own. raise
+// net.ipv4.ip_local_port_range and fs.nr_open for a million.
+
+namespace {
+
+// below the default linux range of ephemeral ports.
+const int kConnsPerAlias = 25000;
+const int kDialers = 64;
+const int kBufferSize = 4 * 1024;
+
+struct Options {
+  int conns;
+  int active;
+  int64 rate;
+  int size;
+  int64 idle;
+  uint16 port;
+  int stack;
+  int64 deadline;
+  bool buffered;
+};
+
+Options opts;
+int32 accepted = 0;
+
+// value of --name=value, or def.
+int64 FlagValue(int argc, char** argv, const char* name, int64 def) {
+  size_t len = strlen(name);
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strncmp(arg, "--", 2) == 0 && strncmp(arg + 2, name, len) == 0 &&
+        arg[2 + len] == '=') {
+      int64 value = 0;
+      if (base::StringToInt64(arg + 3 + len, &value))
+        return value;
+    }
+  }
+  return def;
+}
+
+bool FlagSet(int argc, char** argv, const char* name) {
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) == 0 && strcmp(argv[i] + 2, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+// resident bytes of the process, 0 where unknown.
+int64 ResidentBytes() {
+#if defined(OS_LINUX)
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f == NULL)
+    return 0;
+  long long pages = 0;
+  long long resident = 0;
+  int n = fscanf(f, "%lld %lld", &pages, &resident);
+  fclose(f);
+  return n == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+  return 0;
+#endif
+}
+
+// two descriptors per connection, both ends live here.
+void RaiseFdLimit(int conns) {
+#if defined(OS_POSIX)
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+    return;
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  if (rl.rlim_cur < static_cast<rlim_t>(conns) * 2 + 64) {
+    LOG(WARNING) << "fd limit " << rl.rlim_cur << " is below "
+                 << conns * 2 << ", dials will fail";
+  }
+#endif
+}
+
+void ServePooled(tin::net::TcpConn conn) {
+  while (true) {
+    if (opts.deadline > 0)
+      conn->SetReadDeadline(opts.deadline);
+    tin::io::IOBufChain chain = conn->ReadPooled();
+    if (tin::GetErrorCode() != 0)
+      break;
+    conn->WriteChain(chain);
+    if (tin::GetErrorCode() != 0)
+      break;
+  }
+  conn->Close();
+}
+
+void ServeBuffered(tin::net::TcpConn conn) {
+  scoped_ptr<char[]> buf(new char[kBufferSize]);
+  while (true) {
+    if (opts.deadline > 0)
+      conn->SetReadDeadline(opts.deadline);
+    int n = conn->Read(buf.get(), kBufferSize);
+    if (tin::GetErrorCode() != 0)
+      break;
+    conn->Write(buf.get(), n);
+    if (tin::GetErrorCode() != 0)
+      break;
+  }
+  conn->Close();
+}
+
+void AcceptLoop(tin::net::TCPListener listener) {
+  tin::SpawnOptions spawn(opts.stack, "idle_server");
+  while (true) {
+    tin::net::TcpConn conn = listener->Accept();
+    if (tin::GetErrorCode() != 0) {
+      LOG(WARNING) << "Accept failed due to " << tin::GetErrorStr();
+      continue;
+    }
+    conn->SetNoDelay(true);
+    if (opts.buffered)
+      tin::DoSpawn(spawn, base::Bind(&ServeBuffered, conn));
+    else
+      tin::DoSpawn(spawn, base::Bind(&ServePooled, conn));
+    tin::atomic::Inc32(&accepted, 1);
+  }
+}
+
+void Dial(int first, std::vector<tin::net::TcpConn>* conns,
+          tin::WaitGroup* wg) {
+  for (int i = first; i < opts.conns; i += kDialers) {
+    std::string host =
+        "127.0.0." + base::IntToString(1 + i / kConnsPerAlias);
+    (*conns)[i] = tin::net::DialTcp(host, opts.port);
+    if (tin::GetErrorCode() != 0) {
+      LOG(ERROR) << "Dial " << host << " failed due to "
+                 << tin::GetErrorStr();
+      (*conns)[i] = tin::net::TcpConn();
+      break;
+    }
+  }
+  wg->Done();
+}
+
+// latencies in SchedLatencyStats buckets, to reuse its percentiles.
+class LatencyRecorder {
+ public:
+  LatencyRecorder() {
+    memset(&stats_, 0, sizeof(stats_));
+    for (int i = 0; i < tin::kSchedLatencyBuckets; i++)
+      lower_[i] = tin::SchedLatencyBucketLower(i);
+  }
+
+  void Record(int64 ns) {
+    int i = static_cast<int>(
+        std::upper_bound(lower_, lower_ + tin::kSchedLatencyBuckets, ns) -
+        lower_) - 1;
+    stats_.buckets[i < 0 ? 0 : i]++;
+    stats_.count++;
+    stats_.sum_ns += ns;
+    if (static_cast<uint64>(ns) > stats_.max_ns)
+      stats_.max_ns = ns;
+  }
+
+  void Merge(const LatencyRecorder& other) {
+    for (int i = 0; i < tin::kSchedLatencyBuckets; i++)
+      stats_.buckets[i] += other.stats_.buckets[i];
+    stats_.count += other.stats_.count;
+    stats_.sum_ns += other.stats_.sum_ns;
+    if (other.stats_.max_ns > stats_.max_ns)
+      stats_.max_ns = other.stats_.max_ns;
+  }
+
+  const tin::SchedLatencyStats& stats() const {
+    return stats_;
+  }
+
+ private:
+  tin::SchedLatencyStats stats_;
+  int64 lower_[tin::kSchedLatencyBuckets];
+  DISALLOW_COPY_AND_ASSIGN(LatencyRecorder);
+};
+
+// open loop, latencies count from when a request was due.
+void RunActive(tin::net::TcpConn conn, int64 end, LatencyRecorder* latency,
+               tin::WaitGroup* wg) {
+  std::vector<char> payload(opts.size, 'x');
+  std::vector<char> buf(opts.size);
+  int64 interval = tin::kSecond / opts.rate;
+  int64 due = tin::MonoNow();
+  while (due < end) {
+    int64 now = tin::MonoNow();
+    if (due > now)
+      tin::NanoSleep(due - now);
+    conn->Write(&payload[0], opts.size);
+    if (tin::GetErrorCode() != 0)
+      break;
+    int got = 0;
+    while (got < opts.size) {
+      int n = conn->Read(&buf[got], opts.size - got);
+      if (tin::GetErrorCode() != 0)
+        break;
+      got += n;
+    }
+    if (got < opts.size)
+      break;
+    latency->Record(tin::MonoNow() - due);
+    due += interval;
+  }
+  wg->Done();
+}
+
+double PerConn(int64 bytes, int conns) {
+  return conns > 0 ? static_cast<double>(bytes) / conns : 0;
+}
+
+int TinMain(int argc, char** argv) {
+  opts.conns = static_cast<int>(FlagValue(argc, argv, "conns", 10000));
+  opts.active = static_cast<int>(FlagValue(argc, argv, "active", 100));
+  opts.rate = FlagValue(argc, argv, "rate", 100);
+  opts.size = static_cast<int>(FlagValue(argc, argv, "size", 64));
+  opts.idle = FlagValue(argc, argv, "idle", 10) * tin::kSecond;
+  opts.port = static_cast<uint16>(FlagValue(argc, argv, "port", 2223));
+  opts.stack = static_cast<int>(FlagValue(argc, argv, "stack", 0));
+  opts.deadline = FlagValue(argc, argv, "deadline", 0) * tin::kSecond;
+  opts.buffered = FlagSet(argc, argv, "buffered");
+  if (opts.conns <= 0 || opts.rate <= 0 || opts.size <= 0) {
+    LOG(ERROR) << "conns, rate and size must be positive";
+    return 1;
+  }
+  opts.active = std::min(std::max(opts.active, 0), opts.conns);
+  RaiseFdLimit(opts.conns);
+
+  tin::net::TCPListener listener =
+    tin::net::ListenTcp("0.0.0.0", opts.port, 65535);
+  if (tin::GetErrorCode() != 0) {
+    LOG(ERROR) << "Listen failed due to " << tin::GetErrorStr();
+    return 1;
+  }
+  tin::RuntimeStats before;
+  tin::ReadRuntimeStats(&before);
+  int64 rss_before = ResidentBytes();
+  tin::Spawn(&AcceptLoop, listener);
+
+  // open.
+  int64 start = tin::MonoNow();
+  std::vector<tin::net::TcpConn> conns(opts.conns);
+  tin::WaitGroup dialed(kDialers);
+  for (int i = 0; i < kDialers; i++)
+    tin::Spawn(&Dial, i, &conns, &dialed);
+  dialed.Wait();
+  int open = 0;
+  for (int i = 0; i < opts.conns; i++) {
+    if (conns[i].get() != NULL)
+      open++;
+  }
+  while (tin::atomic::acquire_load32(&accepted) < open)
+    tin::NanoSleep(10 * tin::kMillisecond);
+  // the servers park in their first read.
+  tin::NanoSleep(tin::kSecond);
+  printf("opened %d of %d connections in %.2fs\n", open, opts.conns,
+         static_cast<double>(tin::MonoNow() - start) / tin::kSecond);
+
+  tin::RuntimeStats opened;
+  tin::ReadRuntimeStats(&opened);
+  int64 rss = ResidentBytes() - rss_before;
+  int64 stack = opened.stack_bytes - before.stack_bytes;
+  int64 buffers = opts.buffered ? static_cast<int64>(open) * kBufferSize : 0;
+  printf("per connection bytes: rss %.0f stack %.0f buffer %.0f "
+         "other %.0f\n", PerConn(rss, open), PerConn(stack, open),
+         PerConn(buffers, open), PerConn(rss - stack - buffers, open));
+  printf("live greenlets %lld timers %d\n",
+         static_cast<long long>(opened.live_greenlets), opened.timers);
+
+  // idle.
+  tin::MSpinStats spin_before;
+  tin::GetMSpinStats(&spin_before);
+  tin::NanoSleep(opts.idle);
+  tin::RuntimeStats idled;
+  tin::ReadRuntimeStats(&idled);
+  tin::MSpinStats spin_after;
+  tin::GetMSpinStats(&spin_after);
+  double seconds = static_cast<double>(opts.idle) / tin::kSecond;
+  printf("idle per second: netpoll readies %.1f M wakeups %.1f parks %.1f\n",
+         (idled.netpoll_ready - opened.netpoll_ready) / seconds,
+         (spin_after.wakeups - spin_before.wakeups) / seconds,
+         (idled.parks - opened.parks) / seconds);
+
+  // active subset.
+  std::vector<LatencyRecorder*> recorders;
+  tin::WaitGroup done(0);
+  int64 end = tin::MonoNow() + opts.idle;
+  for (int i = 0; i < opts.conns && static_cast<int>(recorders.size()) <
+       opts.active; i++) {
+    if (conns[i].get() == NULL)
+      continue;
+    recorders.push_back(new LatencyRecorder);
+    done.Add(1);
+    tin::Spawn(&RunActive, conns[i], end, recorders.back(), &done);
+  }
+  done.Wait();
+  LatencyRecorder latency;
+  for (size_t i = 0; i < recorders.size(); i++) {
+    latency.Merge(*recorders[i]);
+    delete recorders[i];
+  }
+  const tin::SchedLatencyStats& s = latency.stats();
+  const double kUs = tin::kMicrosecond;
+  printf("active %d x %lld req/s, latency us: p50 %.1f p99 %.1f "
+         "p99.9 %.1f max %.1f\n", static_cast<int>(recorders.size()),
+         static_cast<long long>(opts.rate),
+         tin::SchedLatencyPercentile(s, 0.5) / kUs,
+         tin::SchedLatencyPercentile(s, 0.99) / kUs,
+         tin::SchedLatencyPercentile(s, 0.999) / kUs, s.max_ns / kUs);
+  // the process exits right after TinMain returns.
+  fflush(stdout);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  tin::Initialize();
+  logging::SetMinLogLevel(logging::LOG_WARNING);
+
+  tin::Config config = tin::DefaultConfig();
+  config.SetMaxProcs(base::SysInfo::NumberOfProcessors());
+  tin::PowerOn(TinMain, argc, argv, &config);
+  tin::WaitForPowerOff();
+  tin::Deinitialize();
+  return 0;
+}
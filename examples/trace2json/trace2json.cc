@@ -0,0 +1,16 @@
+#include <stdio.h>
+
+#include "tin/all.h"
+
+// converts a file written by tin::StartTrace for chrome://tracing.
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s <trace> <json>\n", argv[0]);
+    return 2;
+  }
+  if (!tin::ConvertTraceToJson(argv[1], argv[2])) {
+    fprintf(stderr, "failed to convert %s\n", argv[1]);
+    return 1;
+  }
+  return 0;
+}
@@ -23,15 +23,46 @@
 #include "tin/time/time.h"
 #include "tin/communication/chan.h"
 #include "tin/io/ioutil.h"
+#include "tin/io/mapped_file.h"
+#include "tin/io/file_appender.h"
+#include "tin/io/compress.h"
 #include "tin/net/resolve.h"
+#include "tin/net/dns_client.h"
 #include "tin/net/dialer.h"
+#include "tin/net/conn_pool.h"
+#include "tin/net/server.h"
+#include "tin/net/idle_reaper.h"
+#if defined(TIN_TLS)
+#include "tin/net/tls_conn.h"
+#endif
+#include "tin/net/udp_conn.h"
+#include "tin/net/unix_conn.h"
+#include "tin/net/handover.h"
+#include "tin/communication/shm_chan.h"
 #include "tin/net/netfd.h"
 #include "tin/sync/atomic_flag.h"
 #include "tin/sync/atomic.h"
 #include "tin/sync/mutex.h"
 #include "tin/sync/wait_group.h"
+#include "tin/sync/weighted_semaphore.h"
+#include "tin/sync/rate_limiter.h"
+#include "tin/sync/task_group.h"
+#include "tin/sync/executor.h"
+#include "tin/sync/stackless.h"
+#include "tin/sync/future.h"
+#include "tin/sync/concurrent_map.h"
+#include "tin/sync/cache.h"
+#include "tin/sync/sharded_counter.h"
+#include "tin/sync/parallel.h"
 #include "tin/runtime/spawn.h"
+#include "tin/runtime/blocking.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/trace.h"
+#include "tin/runtime/profiler.h"
+#include "tin/runtime/greenlet_dump.h"
+#include "tin/runtime/greenlet_local.h"
+#include "tin/runtime/arena.h"
+#include "tin/runtime/deadline.h"
 
 #include "tin/tin.h"
 
@@ -2,24 +2,110 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
 #include <algorithm>
 
+#include "build/build_config.h"
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TIN_BUFIO_SSE2 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TIN_BUFIO_NEON 1
+#endif
+
 #include "base/logging.h"
+#include "base/stl_util.h"
 #include "tin/error/error.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/buffer_pool.h"
 #include "tin/bufio/bufio.h"
 
 namespace {
 // const int kMinReadBufferSize = 16;
 const int kMaxConsecutiveEmptyReads = 100;
+// grow the reader buffer after this many fills in a row filled it up.
+const int kGrowAfterFullFills = 4;
+
+const uint8* FindByte(const uint8* first, const uint8* last, uint8 c) {
+  if (first >= last)
+    return last;
+  // libc memchr is vectorized on every platform we ship.
+  const void* p = memchr(first, c, last - first);
+  return p != NULL ? static_cast<const uint8*>(p) : last;
+}
+
+#if defined(TIN_BUFIO_SSE2)
+inline int CountTrailingZeros(int mask) {
+#if defined(_MSC_VER)
+  unsigned long index = 0;
+  _BitScanForward(&index, static_cast<unsigned long>(mask));
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+// first byte in [first, last) equal to any of delims.
+const uint8* FindAnyByte(const uint8* first, const uint8* last,
+                         const uint8* delims, int ndelims) {
+#if defined(TIN_BUFIO_SSE2)
+  while (last - first >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+    __m128i hit = _mm_setzero_si128();
+    for (int i = 0; i < ndelims; ++i) {
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(
+          static_cast<char>(delims[i]))));
+    }
+    int mask = _mm_movemask_epi8(hit);
+    if (mask != 0) {
+      return first + CountTrailingZeros(mask);
+    }
+    first += 16;
+  }
+#elif defined(TIN_BUFIO_NEON)
+  while (last - first >= 16) {
+    uint8x16_t chunk = vld1q_u8(first);
+    uint8x16_t hit = vdupq_n_u8(0);
+    for (int i = 0; i < ndelims; ++i) {
+      hit = vorrq_u8(hit, vceqq_u8(chunk, vdupq_n_u8(delims[i])));
+    }
+    // narrow each byte to 4 bits so the 16 lanes fit in 64 bits.
+    uint64 mask = vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+    if (mask != 0) {
+      return first + (__builtin_ctzll(mask) >> 2);
+    }
+    first += 16;
+  }
+#endif
+  for (; first < last; ++first) {
+    for (int i = 0; i < ndelims; ++i) {
+      if (*first == delims[i])
+        return first;
+    }
+  }
+  return last;
 }
 
+}  // namespace
+
 namespace tin {
 namespace bufio {
 
 Reader::Reader(tin::io::Reader* rd, size_t size)
-  : storage_(new uint8[size])
+  : storage_(NULL)
   , storage_size_(static_cast<int>(size))
+  , storage_capacity_(0)
+  , min_size_(static_cast<int>(size))
+  , max_size_(std::max(static_cast<int>(size), kMaxReaderBufSize))
+  , full_fills_(0)
   , read_idx_(0)
   , write_idx_(0)
   , err_(0)
@@ -28,7 +114,154 @@ Reader::Reader(tin::io::Reader* rd, size_t size)
 }
 
 Reader::~Reader() {
-  delete [] storage_;
+  tin::runtime::BufferFree(reinterpret_cast<char*>(storage_),
+                           storage_capacity_);
+}
+
+bool Reader::ReleaseIdle() {
+  if (storage_ == NULL || !empty()) {
+    return storage_ == NULL;
+  }
+  tin::runtime::BufferFree(reinterpret_cast<char*>(storage_),
+                           storage_capacity_);
+  storage_ = NULL;
+  storage_capacity_ = 0;
+  storage_size_ = min_size_;
+  full_fills_ = 0;
+  read_idx_ = 0;
+  write_idx_ = 0;
+  last_byte_ = -1;
+  return true;
+}
+
+void Reader::SetSizeLimits(int min_size, int max_size) {
+  DCHECK_GT(min_size, 0);
+  DCHECK_GE(max_size, min_size);
+  min_size_ = min_size;
+  max_size_ = max_size;
+  if (storage_ == NULL) {
+    storage_size_ = min_size;
+  }
+}
+
+void Reader::Grow() {
+  int new_size = std::min(storage_size_ * 4, max_size_);
+  int new_capacity = 0;
+  uint8* new_storage = reinterpret_cast<uint8*>(
+      tin::runtime::BufferAlloc(new_size, &new_capacity));
+  std::memcpy(new_storage, begin(), buffered());
+  write_idx_ -= read_idx_;
+  read_idx_ = 0;
+  tin::runtime::BufferFree(reinterpret_cast<char*>(storage_),
+                           storage_capacity_);
+  storage_ = new_storage;
+  storage_capacity_ = new_capacity;
+  storage_size_ = new_size;
+  full_fills_ = 0;
+}
+
+int Reader::ReadInto(void* buf, int nbytes) {
+  uint8* p = static_cast<uint8*>(buf);
+  int n = std::min(buffered(), nbytes);
+  if (n > 0) {
+    std::memcpy(p, begin(), n);
+    read_idx_ += n;
+  }
+  while (n < nbytes && err_ == 0) {
+    int left = nbytes - n;
+    if (empty() && left >= storage_size_) {
+      int nn = rd_->Read(p + n, left);
+      DCHECK_GE(nn, 0);
+      n += nn;
+      err_ = tin::GetErrorCode();
+      continue;
+    }
+    Fill();
+    int nn = std::min(buffered(), left);
+    std::memcpy(p + n, begin(), nn);
+    read_idx_ += nn;
+    n += nn;
+  }
+  if (n > 0) {
+    last_byte_ = p[n - 1];
+  }
+  int err = n == nbytes ? 0 : ReadErr();
+  if (n > 0 && err == TIN_EOF) {
+    err = TIN_UNEXPECTED_EOF;
+  }
+  tin::SetErrorCode(err);
+  return n;
+}
+
+int Reader::ReadChain(int nbytes, tin::io::IOBufChain* chain) {
+  int n = std::min(buffered(), nbytes);
+  if (n > 0) {
+    chain->Append(begin(), n);
+    read_idx_ += n;
+  }
+  while (n < nbytes && err_ == 0) {
+    char* ptr = NULL;
+    int len = 0;
+    chain->GetWritableTail(std::min(nbytes - n, kDefaultReaderBufSize),
+                           &ptr, &len);
+    int nn = rd_->Read(ptr, std::min(len, nbytes - n));
+    DCHECK_GE(nn, 0);
+    chain->CommitTail(nn);
+    n += nn;
+    err_ = tin::GetErrorCode();
+  }
+  last_byte_ = -1;
+  int err = n == nbytes ? 0 : ReadErr();
+  if (n > 0 && err == TIN_EOF) {
+    err = TIN_UNEXPECTED_EOF;
+  }
+  tin::SetErrorCode(err);
+  return n;
+}
+
+int Reader::Discard(int nbytes) {
+  int n = 0;
+  while (true) {
+    int skip = std::min(buffered(), nbytes - n);
+    read_idx_ += skip;
+    n += skip;
+    if (n == nbytes || err_ != 0) {
+      break;
+    }
+    Fill();
+  }
+  last_byte_ = -1;
+  int err = n == nbytes ? 0 : ReadErr();
+  tin::SetErrorCode(err);
+  return n;
+}
+
+int64 Reader::WriteTo(tin::io::Writer* wr) {
+  int64 total = 0;
+  int err = 0;
+  while (true) {
+    if (!empty()) {
+      int n = wr->Write(begin(), buffered());
+      DCHECK_GE(n, 0);
+      read_idx_ += n;
+      total += n;
+      err = tin::GetErrorCode();
+      if (err != 0) {
+        break;
+      }
+    }
+    if (err_ != 0) {
+      err = ReadErr();
+      if (err == TIN_EOF) {
+        err = 0;
+      }
+      break;
+    }
+    Fill();
+  }
+  last_byte_ = -1;
+  tin::SetErrorCode(err);
+  return total;
 }
 
 int Reader::Read(void* buf, int buf_size) {
@@ -85,6 +318,14 @@ void Reader::Reset(tin::io::Reader* rd) {
 }
 
 void Reader::Fill() {
+  if (storage_ == NULL) {
+    storage_ = reinterpret_cast<uint8*>(
+        tin::runtime::BufferAlloc(storage_size_, &storage_capacity_));
+  } else if (full_fills_ >= kGrowAfterFullFills &&
+             storage_size_ < max_size_) {
+    // bulk transfer, fewer larger reads.
+    Grow();
+  }
   if (read_idx_ > 0) {
     std::memmove(storage_, begin(), buffered());
     write_idx_ -= read_idx_;
@@ -95,12 +336,17 @@ void Reader::Fill() {
   }
 
   // Read new data: try a limited number of times.
-  for (int i = kMaxConsecutiveEmptyReads; i > 0; i++) {
-    int n = rd_->Read(end(), free());
+  for (int i = kMaxConsecutiveEmptyReads; i > 0; i--) {
+    int room = free();
+    int n = rd_->Read(end(), room);
     if (n < 0) {
       LOG(FATAL) << "bufio: tried to fill full buffer";
     }
     write_idx_ += n;
+    // a nearly full buffer filling up says little about the stream.
+    if (room * 2 >= storage_size_) {
+      full_fills_ = n == room ? full_fills_ + 1 : 0;
+    }
     int err = tin::GetErrorCode();
     if (err != 0) {
       err_ = err;
@@ -120,15 +366,32 @@ int Reader::ReadErr() {
 }
 
 int Reader::ReadSlice(uint8 delim, base::StringPiece* line) {
+  return ReadSliceImpl(&delim, 1, line);
+}
+
+int Reader::ReadSliceAny(const base::StringPiece& delims,
+                         base::StringPiece* line) {
+  DCHECK(!delims.empty());
+  return ReadSliceImpl(reinterpret_cast<const uint8*>(delims.data()),
+                       static_cast<int>(delims.size()), line);
+}
+
+int Reader::ReadSliceImpl(const uint8* delims, int ndelims,
+                          base::StringPiece* line) {
   int err = 0;
+  // bytes already searched, Fill may move data but keeps it in order.
+  int searched = 0;
   while (true) {
-    const_iterator it =  std::find(begin(), end(), delim);
+    const_iterator it = ndelims == 1 ?
+      FindByte(begin() + searched, end(), delims[0]) :
+      FindAnyByte(begin() + searched, end(), delims, ndelims);
     if (it != end()) {
       size_t n = it - begin() + 1;
       *line = base::ToStringPiece(begin(), n);
       read_idx_ += static_cast<int>(n);
       break;
     }
+    searched = buffered();
 
     // Pending error?
     if (err_ != 0) {
@@ -140,8 +403,8 @@ int Reader::ReadSlice(uint8 delim, base::StringPiece* line) {
 
     // Buffer full?
     if (buffered() >= storage_size_) {
-      read_idx_ = write_idx_;
       *line = base::ToStringPiece(begin(), buffered());
+      read_idx_ = write_idx_;
       err = TIN_EBUFFERFULL;
       break;
     }
@@ -242,6 +505,194 @@ int Reader::UnreadByte() {
   return 0;
 }
 
+BufferedWriter::BufferedWriter(tin::io::Writer* wr, int block_size)
+  : wr_(wr)
+  , block_size_(block_size)
+  , buffered_(0)
+  , err_(0)
+  , flushing_(false)
+  , auto_flush_(false) {
+  DCHECK_GT(block_size, 0);
+}
+
+BufferedWriter::~BufferedWriter() {
+  SetAutoFlush(false);
+  STLDeleteElements(&blocks_);
+  STLDeleteElements(&spare_);
+}
+
+void BufferedWriter::Reset(tin::io::Writer* wr) {
+  wr_ = wr;
+  Consume(buffered_);
+  err_ = 0;
+}
+
+int BufferedWriter::Write(const void* buf, int nbytes) {
+  if (err_ != 0) {
+    tin::SetErrorCode(err_);
+    return 0;
+  }
+  if (nbytes >= block_size_) {
+    // large write, gather it with the chain instead of copying.
+    int n = FlushWith(buf, nbytes);
+    tin::SetErrorCode(err_);
+    return n;
+  }
+  const char* p = static_cast<const char*>(buf);
+  int left = nbytes;
+  while (left > 0) {
+    if (blocks_.empty() || blocks_.back()->free() == 0) {
+      IOBuffer* block = NULL;
+      if (!spare_.empty()) {
+        block = spare_.back();
+        spare_.pop_back();
+      } else {
+        block = new IOBuffer(block_size_);
+      }
+      blocks_.push_back(block);
+    }
+    int n = blocks_.back()->Write(p, std::min(left, blocks_.back()->free()));
+    p += n;
+    left -= n;
+  }
+  buffered_ += nbytes;
+  tin::SetErrorCode(0);
+  return nbytes;
+}
+
+int BufferedWriter::Flush() {
+  if (err_ == 0 && buffered_ > 0) {
+    FlushWith(NULL, 0);
+  }
+  tin::SetErrorCode(err_);
+  return err_;
+}
+
+int BufferedWriter::FlushWith(const void* extra, int extra_len) {
+  // re-entered from the io wait hook while this writer waits to write.
+  if (flushing_) {
+    return 0;
+  }
+  flushing_ = true;
+  const int kMaxFlushVecs = 64;
+  tin::io::IOVec iov[kMaxFlushVecs];
+  int extra_written = 0;
+  while (err_ == 0 && (buffered_ > 0 || extra_written < extra_len)) {
+    int cnt = 0;
+    int want = 0;
+    for (size_t i = 0; i < blocks_.size() && cnt < kMaxFlushVecs; ++i) {
+      iov[cnt].base = blocks_[i]->begin();
+      iov[cnt].len = blocks_[i]->buffered();
+      want += iov[cnt].len;
+      cnt++;
+    }
+    bool with_extra = false;
+    if (cnt < kMaxFlushVecs && want == buffered_ && extra_written < extra_len) {
+      iov[cnt].base = const_cast<char*>(static_cast<const char*>(extra)) +
+                      extra_written;
+      iov[cnt].len = extra_len - extra_written;
+      want += iov[cnt].len;
+      cnt++;
+      with_extra = true;
+    }
+    int n = wr_->Writev(iov, cnt);
+    int err = tin::GetErrorCode();
+    DCHECK_GE(n, 0);
+    int from_chain = std::min(n, buffered_);
+    Consume(from_chain);
+    if (with_extra) {
+      extra_written += n - from_chain;
+    }
+    if (err == 0 && n < want) {
+      err = n == 0 ? TIN_ENOPROGRESS : 0;
+    }
+    err_ = err;
+  }
+  flushing_ = false;
+  return extra_written;
+}
+
+int BufferedWriter::WriteChain(const tin::io::IOBufChain& chain) {
+  if (err_ != 0) {
+    tin::SetErrorCode(err_);
+    return 0;
+  }
+  const int kMaxChainVecs = 64;
+  tin::io::IOVec iov[kMaxChainVecs];
+  tin::io::IOBufChain rest(chain);
+  int nwritten = 0;
+  if (chain.size() < block_size_) {
+    while (!rest.empty()) {
+      int cnt = rest.ToIOVecs(iov, kMaxChainVecs);
+      int n = 0;
+      for (int i = 0; i < cnt; ++i) {
+        n += Write(iov[i].base, iov[i].len);
+      }
+      nwritten += n;
+      rest.TrimFront(n);
+    }
+    return nwritten;
+  }
+  if (Flush() != 0) {
+    return 0;
+  }
+  while (!rest.empty()) {
+    int cnt = rest.ToIOVecs(iov, kMaxChainVecs);
+    int n = wr_->Writev(iov, cnt);
+    int err = tin::GetErrorCode();
+    nwritten += n;
+    rest.TrimFront(n);
+    if (err == 0 && n == 0) {
+      err = TIN_ENOPROGRESS;
+    }
+    if (err != 0) {
+      err_ = err;
+      break;
+    }
+  }
+  tin::SetErrorCode(err_);
+  return nwritten;
+}
+
+void BufferedWriter::Consume(int n) {
+  buffered_ -= n;
+  size_t done = 0;
+  while (n > 0 && done < blocks_.size()) {
+    IOBuffer* block = blocks_[done];
+    int m = std::min(n, block->buffered());
+    block->AdvanceReadablePtr(m);
+    n -= m;
+    if (block->buffered() == 0) {
+      done++;
+    }
+  }
+  if (buffered_ == 0) {
+    done = blocks_.size();
+  }
+  for (size_t i = 0; i < done; ++i) {
+    blocks_[i]->clear();
+    spare_.push_back(blocks_[i]);
+  }
+  blocks_.erase(blocks_.begin(), blocks_.begin() + done);
+}
+
+void BufferedWriter::SetAutoFlush(bool enable) {
+  tin::runtime::G* gp = tin::runtime::GetG();
+  if (enable) {
+    gp->SetIoWaitHook(&BufferedWriter::AutoFlush, this);
+  } else if (auto_flush_ && gp->IoWaitHookArg() == this) {
+    gp->SetIoWaitHook(NULL, NULL);
+  }
+  auto_flush_ = enable;
+}
+
+void BufferedWriter::AutoFlush(void* arg) {
+  BufferedWriter* self = static_cast<BufferedWriter*>(arg);
+  if (self->err_ == 0 && self->buffered_ > 0) {
+    self->FlushWith(NULL, 0);
+  }
+}
+
 int Reader::ReadByte(uint8* c) {
   while (empty()) {
     if (err_ != 0) {
@@ -5,15 +5,19 @@
 #pragma once
 
 #include <cstdlib>
+#include <vector>
 
 #include "base/basictypes.h"
 #include "base/strings/string_piece.h"
 #include "tin/io/io.h"
+#include "tin/io/io_buffer.h"
+#include "tin/io/iobuf_chain.h"
 
 namespace tin {
 namespace bufio {
 
 const int kDefaultReaderBufSize = 4096;
+const int kMaxReaderBufSize = 64 * 1024;
 
 /*
 +--------------+--------------------------------+
@@ -24,7 +28,7 @@ const int kDefaultReaderBufSize = 4096;
              read_idx           write_idx
 */
 
-class Reader : public tin::io::Reader {
+class Reader : public tin::io::Reader, public tin::io::WriterTo {
  public:
   explicit Reader(tin::io::Reader* rd, size_t size = kDefaultReaderBufSize);
   virtual ~Reader();
@@ -32,11 +36,46 @@ class Reader : public tin::io::Reader {
   // reset a new underlying reader.
   void Reset(tin::io::Reader* rd);
 
+  // the buffer starts at min bytes and grows up to max while fills keep
+  // filling it completely. default is the constructor size up to
+  // kMaxReaderBufSize.
+  void SetSizeLimits(int min_size, int max_size);
+
+  // gives the storage back to the runtime buffer pool if nothing is
+  // buffered, e.g. before an idle connection waits for its next request.
+  // it is taken again on the next fill at the minimum size.
+  // returns true if none is held.
+  bool ReleaseIdle();
+
   virtual int Read(void* buf, int nbytes);
 
+  // reads exactly nbytes unless an error occurs. whatever is not
+  // buffered yet goes straight into buf when it is larger than the
+  // buffer. returns bytes read, detail error see tin::GetErrorCode().
+  int ReadInto(void* buf, int nbytes);
+
+  // like ReadInto, but appends the bytes to chain. what is not buffered
+  // yet is read straight into the pooled blocks of chain.
+  int ReadChain(int nbytes, tin::io::IOBufChain* chain);
+
+  // skips nbytes, e.g. after Peek. returns bytes skipped, detail error
+  // see tin::GetErrorCode().
+  int Discard(int nbytes);
+
+  // copies everything up to EOF to wr, reusing the buffer for reads and
+  // never copying in between. EOF is not an error.
+  virtual int64 WriteTo(tin::io::Writer* wr);
+
+  virtual tin::io::WriterTo* AsWriterTo() { return this; }
+
   // return error code.
   int ReadSlice(uint8 delim, base::StringPiece* line);
 
+  // like ReadSlice, but stops at the first byte that is any of delims,
+  // e.g. "\r\n" for header parsing.
+  // return error code.
+  int ReadSliceAny(const base::StringPiece& delims, base::StringPiece* line);
+
   // return error code.
   int ReadLine(base::StringPiece* line, bool* is_prefix);
 
@@ -47,6 +86,8 @@ class Reader : public tin::io::Reader {
   // inline functions
   int buffered() const { return write_idx_ - read_idx_; }
   int free() const { return (storage_size_ - write_idx_); }
+  // the most Peek can return now.
+  int buffer_size() const { return storage_size_; }
 
   bool empty() const { return read_idx_ == write_idx_; }
   bool full() const {
@@ -65,10 +106,19 @@ class Reader : public tin::io::Reader {
  private:
   int ReadErr();
   void Fill();
+  void Grow();
+  int ReadSliceImpl(const uint8* delims, int ndelims,
+                    base::StringPiece* line);
 
  private:
+  // allocated on the first fill, may be released by ReleaseIdle.
   uint8* storage_;
   int storage_size_;
+  int storage_capacity_;
+  int min_size_;
+  int max_size_;
+  // consecutive fills that used all free space.
+  int full_fills_;
   int read_idx_;
   int write_idx_;
   int err_;
@@ -82,6 +132,58 @@ class Writer : public tin::io::Writer {
   virtual int Write(const void* buf, int nbytes) = 0;
 };
 
+const int kDefaultWriterBlockSize = 4096;
+
+// accumulates small writes in a chain of blocks and hands them to the
+// underlying writer with a single Writev on Flush. writes of a block or
+// more are sent together with what is buffered, without copying.
+class BufferedWriter : public Writer {
+ public:
+  explicit BufferedWriter(tin::io::Writer* wr,
+                          int block_size = kDefaultWriterBlockSize);
+  virtual ~BufferedWriter();
+
+  // reset a new underlying writer, buffered data is dropped.
+  void Reset(tin::io::Writer* wr);
+
+  // note: buffered writes always succeed unless a previous flush failed,
+  // the error is sticky and reported by later Write/Flush calls.
+  virtual int Write(const void* buf, int nbytes);
+
+  // return error code.
+  int Flush();
+
+  // small chains are copied into the buffer, larger ones are flushed
+  // right after it by slice, without copying. returns bytes accepted.
+  int WriteChain(const tin::io::IOBufChain& chain);
+
+  // flush automatically before the current greenlet parks on network io,
+  // so pipelined responses go out once the handler waits for more input.
+  // must be enabled and disabled on the greenlet that uses the writer.
+  void SetAutoFlush(bool enable);
+
+  int buffered() const { return buffered_; }
+
+ private:
+  int FlushWith(const void* extra, int extra_len);
+  void Consume(int n);
+  static void AutoFlush(void* arg);
+
+ private:
+  tin::io::Writer* wr_;
+  int block_size_;
+  // pending data, oldest block first.
+  std::vector<IOBuffer*> blocks_;
+  // flushed blocks kept for reuse.
+  std::vector<IOBuffer*> spare_;
+  int buffered_;
+  int err_;
+  bool flushing_;
+  bool auto_flush_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferedWriter);
+};
+
 
 
 }  // namespace bufio
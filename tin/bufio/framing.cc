@@ -0,0 +1,250 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <vector>
+
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+#include "tin/util/hash.h"
+
+#include "tin/bufio/framing.h"
+
+namespace tin {
+namespace bufio {
+
+namespace {
+
+// a uint32 takes at most 5 bytes as a varint.
+const int kMaxVarintBytes = 5;
+const int kChecksumBytes = 4;
+
+uint32 LoadUint32BE(const char* p) {
+  const uint8* b = reinterpret_cast<const uint8*>(p);
+  return (static_cast<uint32>(b[0]) << 24) |
+         (static_cast<uint32>(b[1]) << 16) |
+         (static_cast<uint32>(b[2]) << 8) |
+         static_cast<uint32>(b[3]);
+}
+
+void StoreUint32BE(uint32 v, uint8* b) {
+  b[0] = static_cast<uint8>(v >> 24);
+  b[1] = static_cast<uint8>(v >> 16);
+  b[2] = static_cast<uint8>(v >> 8);
+  b[3] = static_cast<uint8>(v);
+}
+
+// EOF in the middle of a header is a truncated frame.
+int HeaderError(int err, size_t peeked) {
+  return err == TIN_EOF && peeked > 0 ? TIN_UNEXPECTED_EOF : err;
+}
+
+}  // namespace
+
+std::string Frame::ToString() const {
+  return chained() ? chain.ToString() : piece.as_string();
+}
+
+FrameReader::FrameReader(Reader* rd, FrameFormat format,
+                         int max_frame_size)
+  : rd_(rd)
+  , format_(format)
+  , max_frame_size_(max_frame_size)
+  , delim_('\n')
+  , checksum_(false) {
+}
+
+int FrameReader::ReadFrame(Frame* frame) {
+  frame->piece.clear();
+  frame->chain.clear();
+  int err = 0;
+  if (format_ == kFrameDelimited) {
+    err = ReadDelimited(frame);
+    tin::SetErrorCode(err);
+    return err;
+  }
+  int len = 0;
+  int header = 0;
+  err = ReadLength(&len, &header);
+  if (err == 0) {
+    int trailer = checksum_ ? kChecksumBytes : 0;
+    if (header + len + trailer <= rd_->buffer_size()) {
+      // the common case, the frame is already buffered or fits.
+      base::StringPiece piece;
+      err = rd_->Peek(header + len + trailer, &piece);
+      if (err == 0) {
+        frame->piece = piece.substr(header, len);
+        if (checksum_ &&
+            Crc32c(frame->piece) != LoadUint32BE(piece.data() + header + len)) {
+          frame->piece.clear();
+          err = TIN_EBADPROTOCOL;
+        }
+        rd_->Discard(header + len + trailer);
+      } else if (err == TIN_EOF) {
+        err = TIN_UNEXPECTED_EOF;
+      }
+    } else {
+      rd_->Discard(header);
+      rd_->ReadChain(len, &frame->chain);
+      err = tin::GetErrorCode();
+      if (err == 0 && checksum_)
+        err = ReadChecksum(frame);
+    }
+  }
+  tin::SetErrorCode(err);
+  return err;
+}
+
+int FrameReader::ReadLength(int* len, int* header) {
+  base::StringPiece p;
+  uint32 v = 0;
+  if (format_ == kFrameUint32BE) {
+    int err = rd_->Peek(4, &p);
+    if (err != 0)
+      return HeaderError(err, p.size());
+    v = LoadUint32BE(p.data());
+    *header = 4;
+  } else {
+    int i = 0;
+    while (true) {
+      if (i == kMaxVarintBytes)
+        return TIN_EBADPROTOCOL;
+      // buffered after the first byte but for a frame split by a read.
+      int err = rd_->Peek(i + 1, &p);
+      if (err != 0)
+        return HeaderError(err, p.size());
+      uint8 b = static_cast<uint8>(p[i]);
+      v |= static_cast<uint32>(b & 0x7f) << (7 * i);
+      i++;
+      if ((b & 0x80) == 0)
+        break;
+    }
+    *header = i;
+  }
+  if (v > static_cast<uint32>(max_frame_size_))
+    return TIN_ETOOLARGE;
+  *len = static_cast<int>(v);
+  return 0;
+}
+
+int FrameReader::ReadChecksum(Frame* frame) {
+  base::StringPiece p;
+  int err = rd_->Peek(kChecksumBytes, &p);
+  if (err != 0) {
+    frame->chain.clear();
+    return err == TIN_EOF ? TIN_UNEXPECTED_EOF : err;
+  }
+  uint32 crc = 0;
+  std::vector<tin::io::IOVec> iov(frame->chain.slices());
+  int n = frame->chain.ToIOVecs(&iov[0], static_cast<int>(iov.size()));
+  for (int i = 0; i < n; i++)
+    crc = Crc32cExtend(crc, iov[i].base, iov[i].len);
+  bool ok = crc == LoadUint32BE(p.data());
+  rd_->Discard(kChecksumBytes);
+  if (!ok) {
+    frame->chain.clear();
+    return TIN_EBADPROTOCOL;
+  }
+  return 0;
+}
+
+int FrameReader::ReadDelimited(Frame* frame) {
+  base::StringPiece line;
+  int err = rd_->ReadSlice(delim_, &line);
+  if (err == 0) {
+    if (static_cast<int>(line.size()) - 1 > max_frame_size_)
+      return TIN_ETOOLARGE;
+    frame->piece = base::StringPiece(line.data(), line.size() - 1);
+    return 0;
+  }
+  // longer than the buffer, gather the pieces.
+  while (err == TIN_EBUFFERFULL) {
+    if (frame->chain.size() + static_cast<int>(line.size()) >
+        max_frame_size_) {
+      frame->chain.clear();
+      return TIN_ETOOLARGE;
+    }
+    frame->chain.Append(line.data(), static_cast<int>(line.size()));
+    err = rd_->ReadSlice(delim_, &line);
+  }
+  if (err == 0) {
+    frame->chain.Append(line.data(), static_cast<int>(line.size()) - 1);
+    if (frame->chain.size() > max_frame_size_) {
+      frame->chain.clear();
+      return TIN_ETOOLARGE;
+    }
+    return 0;
+  }
+  if (err == TIN_EOF && (!frame->chain.empty() || !line.empty()))
+    err = TIN_UNEXPECTED_EOF;
+  frame->chain.clear();
+  return err;
+}
+
+namespace {
+
+int DoWriteFrame(tin::io::Writer* wr, FrameFormat format,
+                 const base::StringPiece& payload, uint8 delim,
+                 bool checksum) {
+  uint8 header[kMaxVarintBytes];
+  int header_len = 0;
+  uint32 v = static_cast<uint32>(payload.size());
+  if (format == kFrameUint32BE) {
+    StoreUint32BE(v, header);
+    header_len = 4;
+  } else if (format == kFrameVarint) {
+    while (v >= 0x80) {
+      header[header_len++] = static_cast<uint8>(v | 0x80);
+      v >>= 7;
+    }
+    header[header_len++] = static_cast<uint8>(v);
+  }
+  tin::io::IOVec iov[3];
+  int iovcnt = 0;
+  if (header_len > 0) {
+    iov[iovcnt].base = header;
+    iov[iovcnt].len = header_len;
+    iovcnt++;
+  }
+  iov[iovcnt].base = const_cast<char*>(payload.data());
+  iov[iovcnt].len = static_cast<int>(payload.size());
+  iovcnt++;
+  if (format == kFrameDelimited) {
+    iov[iovcnt].base = &delim;
+    iov[iovcnt].len = 1;
+    iovcnt++;
+  }
+  uint8 trailer[kChecksumBytes];
+  if (checksum) {
+    StoreUint32BE(Crc32c(payload), trailer);
+    iov[iovcnt].base = trailer;
+    iov[iovcnt].len = kChecksumBytes;
+    iovcnt++;
+  }
+  int total = header_len + static_cast<int>(payload.size()) +
+              (format == kFrameDelimited ? 1 : 0) +
+              (checksum ? kChecksumBytes : 0);
+  int n = wr->Writev(iov, iovcnt);
+  int err = tin::GetErrorCode();
+  if (err == 0 && n != total)
+    err = TIN_EIO;
+  tin::SetErrorCode(err);
+  return err;
+}
+
+}  // namespace
+
+int WriteFrame(tin::io::Writer* wr, FrameFormat format,
+               const base::StringPiece& payload, uint8 delim) {
+  return DoWriteFrame(wr, format, payload, delim, false);
+}
+
+int WriteCheckedFrame(tin::io::Writer* wr, FrameFormat format,
+                      const base::StringPiece& payload) {
+  DCHECK(format != kFrameDelimited);
+  return DoWriteFrame(wr, format, payload, '\n', true);
+}
+
+}  // namespace bufio
+}  // namespace tin
@@ -0,0 +1,98 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <string>
+
+#include "base/basictypes.h"
+#include "base/logging.h"
+#include "base/strings/string_piece.h"
+#include "tin/io/io.h"
+#include "tin/io/iobuf_chain.h"
+#include "tin/bufio/bufio.h"
+
+namespace tin {
+namespace bufio {
+
+enum FrameFormat {
+  // a base 128 varint length, protobuf style, then the payload.
+  kFrameVarint = 0,
+  // a 4 byte big endian length, then the payload.
+  kFrameUint32BE,
+  // the payload up to a delimiter byte, e.g. '\n'.
+  kFrameDelimited
+};
+
+const int kDefaultMaxFrameSize = 16 * 1024 * 1024;
+
+// one frame, excluding its length or delimiter. a frame that fits the
+// reader buffer is a view into it, valid until the next read from that
+// reader. a larger one is in pooled blocks owned by chain.
+struct Frame {
+  base::StringPiece piece;
+  tin::io::IOBufChain chain;
+
+  bool chained() const {
+    return !chain.empty();
+  }
+
+  int size() const {
+    return chained() ? chain.size() : static_cast<int>(piece.size());
+  }
+
+  // copies a chained frame, for callers that want contiguous bytes.
+  std::string ToString() const;
+};
+
+// reads frames from a bufio::Reader, most without copying and without a
+// syscall of their own when the peer pipelines them.
+class FrameReader {
+ public:
+  FrameReader(Reader* rd, FrameFormat format,
+              int max_frame_size = kDefaultMaxFrameSize);
+
+  void SetDelimiter(uint8 delim) {
+    delim_ = delim;
+  }
+
+  // length prefixed frames carry a CRC32C of the payload after it, see
+  // WriteCheckedFrame. a mismatch is TIN_EBADPROTOCOL.
+  void EnableChecksum(bool enable) {
+    DCHECK(!enable || format_ != kFrameDelimited);
+    checksum_ = enable;
+  }
+
+  // return error code. TIN_EOF only between frames, TIN_UNEXPECTED_EOF
+  // inside one, TIN_ETOOLARGE if a frame is longer than the maximum,
+  // which leaves the stream unusable.
+  int ReadFrame(Frame* frame);
+
+ private:
+  // the length and the header bytes before the payload.
+  int ReadLength(int* len, int* header);
+  int ReadDelimited(Frame* frame);
+  // reads and checks the CRC32C after a chained frame.
+  int ReadChecksum(Frame* frame);
+
+  Reader* rd_;
+  FrameFormat format_;
+  int max_frame_size_;
+  uint8 delim_;
+  bool checksum_;
+  DISALLOW_COPY_AND_ASSIGN(FrameReader);
+};
+
+// writes the header and payload with one gather write, or the payload
+// and delim for kFrameDelimited. return error code.
+int WriteFrame(tin::io::Writer* wr, FrameFormat format,
+               const base::StringPiece& payload, uint8 delim = '\n');
+
+// WriteFrame plus the CRC32C of payload in 4 big endian bytes, for a
+// FrameReader with EnableChecksum. length prefixed formats only.
+int WriteCheckedFrame(tin::io::Writer* wr, FrameFormat format,
+                      const base::StringPiece& payload);
+
+}  // namespace bufio
+}  // namespace tin
@@ -0,0 +1,197 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <vector>
+
+#include "base/logging.h"
+#include "base/memory/ref_counted.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/scheduler.h"
+#include "tin/communication/ring_chan.h"
+
+namespace tin {
+
+// what happens to a subscriber the ring has lapped.
+enum BroadcastPolicy {
+  // it skips to the oldest message still held, see missed().
+  kBroadcastLag = 0,
+  // its next Recv fails with TIN_ECANCELED.
+  kBroadcastDrop
+};
+
+template <class T>
+class BroadcastReceiver;
+
+// one ring shared by every subscriber, each keeping only a cursor. Publish
+// copies a message once and never waits for a slow subscriber, it wakes
+// the parked ones with one ReadyBatch. hand out large messages as
+// refcounted pointers, Recv copies T.
+template <class T>
+class BroadcastImpl
+  : public base::RefCountedThreadSafe<BroadcastImpl<T> > {
+ public:
+  BroadcastImpl(uint32 size, BroadcastPolicy policy)
+    : mask_(RingCapacity(size) - 1)
+    , ring_(mask_ + 1)
+    , policy_(policy)
+    , tail_(0)
+    , closed_(false)
+    , waiters_(NULL)
+    , num_waiters_(0) {
+  }
+
+  // false once closed.
+  bool Publish(const T& t) {
+    runtime::G* glist = NULL;
+    int32 n = 0;
+    {
+      runtime::RawMutexGuard guard(&lock_);
+      if (closed_)
+        return false;
+      ring_[tail_ & mask_] = t;
+      tail_++;
+      glist = TakeWaiters(&n);
+    }
+    if (n > 0)
+      runtime::ReadyBatch(glist, n);
+    return true;
+  }
+
+  // subscribers get what was published before, then TIN_EOF.
+  void Close() {
+    runtime::G* glist = NULL;
+    int32 n = 0;
+    {
+      runtime::RawMutexGuard guard(&lock_);
+      if (closed_)
+        return;
+      closed_ = true;
+      glist = TakeWaiters(&n);
+    }
+    if (n > 0)
+      runtime::ReadyBatch(glist, n);
+  }
+
+  BroadcastPolicy policy() const {
+    return policy_;
+  }
+
+ private:
+  friend class base::RefCountedThreadSafe<BroadcastImpl<T> >;
+  friend class BroadcastReceiver<T>;
+
+  ~BroadcastImpl() {
+    DCHECK(waiters_ == NULL);
+  }
+
+  uint64 Tail() {
+    runtime::RawMutexGuard guard(&lock_);
+    return tail_;
+  }
+
+  // the cursor moves past what was taken, or to the oldest held message
+  // if it was lapped. return error code.
+  int Recv(uint64* cursor, uint64* missed, T* t) {
+    lock_.Lock();
+    while (true) {
+      uint64 oldest = tail_ > mask_ ? tail_ - mask_ - 1 : 0;
+      if (*cursor < oldest) {
+        if (policy_ == kBroadcastDrop) {
+          lock_.Unlock();
+          return TIN_ECANCELED;
+        }
+        *missed += oldest - *cursor;
+        *cursor = oldest;
+      }
+      if (*cursor < tail_) {
+        *t = ring_[*cursor & mask_];
+        (*cursor)++;
+        lock_.Unlock();
+        return 0;
+      }
+      if (closed_) {
+        lock_.Unlock();
+        return TIN_EOF;
+      }
+      // schedlink is ours until Publish readies us.
+      runtime::G* gp = runtime::GetG();
+      gp->SetSchedLink(waiters_);
+      waiters_ = gp;
+      num_waiters_++;
+      runtime::ParkUnlock(&lock_, runtime::kParkChan);
+      lock_.Lock();
+    }
+  }
+
+  // lock_ held.
+  runtime::G* TakeWaiters(int32* n) {
+    runtime::G* glist = waiters_;
+    *n = num_waiters_;
+    waiters_ = NULL;
+    num_waiters_ = 0;
+    return glist;
+  }
+
+  const uint64 mask_;
+  std::vector<T> ring_;
+  const BroadcastPolicy policy_;
+  runtime::RawMutex lock_;
+  // sequence of the next message.
+  uint64 tail_;
+  bool closed_;
+  // parked subscribers linked by schedlink.
+  runtime::G* waiters_;
+  int32 num_waiters_;
+  DISALLOW_COPY_AND_ASSIGN(BroadcastImpl);
+};
+
+// a cursor into a broadcast, used by one greenlet at a time. it sees what
+// is published after it was made.
+template <class T>
+class BroadcastReceiver {
+ public:
+  explicit BroadcastReceiver(BroadcastImpl<T>* broadcast)
+    : broadcast_(broadcast)
+    , cursor_(broadcast->Tail())
+    , missed_(0) {
+  }
+
+  // parks until a message is published. return error code, TIN_EOF once
+  // closed and drained, TIN_ECANCELED if dropped for falling behind.
+  int Recv(T* t) {
+    return broadcast_->Recv(&cursor_, &missed_, t);
+  }
+
+  // messages skipped under kBroadcastLag.
+  uint64 missed() const {
+    return missed_;
+  }
+
+ private:
+  scoped_refptr<BroadcastImpl<T> > broadcast_;
+  uint64 cursor_;
+  uint64 missed_;
+  DISALLOW_COPY_AND_ASSIGN(BroadcastReceiver);
+};
+
+template <typename T>
+class Broadcast : public scoped_refptr<BroadcastImpl<T> > {
+ public:
+  explicit Broadcast(BroadcastImpl<T>* t)
+    : scoped_refptr<BroadcastImpl<T> >(t) {
+  }
+};
+
+// size messages are held for subscribers that fall behind.
+template <typename T>
+Broadcast<T> MakeBroadcast(uint32 size = kDefaultChanSize,
+                           BroadcastPolicy policy = kBroadcastLag) {
+  return Broadcast<T>(new BroadcastImpl<T>(size, policy));
+}
+
+}  // namespace tin
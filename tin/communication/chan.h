@@ -5,13 +5,18 @@
 #pragma once
 #include <utility>
 #include <iostream>
-#include <deque>
+#include <memory>
 
 #include "base/memory/ref_counted.h"
 #include "base/synchronization/cancellation_flag.h"
 #include "tin/sync/atomic.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/deadline.h"
 #include "tin/runtime/raw_mutex.h"
 #include "tin/runtime/semaphore.h"
+#include "tin/communication/move_util.h"
+#include "tin/communication/select_queue.h"
+#include "tin/communication/handoff_queue.h"
 
 
 namespace tin {
@@ -22,51 +27,221 @@ class Channel
   : public base::RefCountedThreadSafe<Channel<T> > {
  public:
   explicit Channel(uint32 max_size = kDefaultChanSize)
-    : max_size_(max_size)
-    , free_space_sem_(max_size)
+    : free_space_sem_(max_size)
     , used_space_sem_(0)
+    , ring_(NULL)
+    , head_(0)
+    , count_(0)
+    , max_size_(max_size)
     , closed_(0) {
-    // std::cout << "Channel constructor " << rand() << std::endl;
+    // slots are constructed on push, so T needs no default constructor.
+    if (max_size_ > 0)
+      ring_ = std::allocator<T>().allocate(max_size_);
   }
 
+  // a channel of max_size 0 is unbuffered, every Push waits for a Pop and
+  // hands its value over directly.
   bool Push(const T& t) {
     if (IsClosed())
       return false;
-    bool ok;
-    runtime::SemAcquire(&free_space_sem_);
-    {
-      runtime::RawMutexGuard guard(&lock_);
-      ok = !IsClosed();
-      if (ok) {
-        queue_.push_back(t);
-      }
+    if (max_size_ == 0)
+      return HandoffPush(const_cast<T*>(&t), Deadline::Remaining());
+    if (!AcquireSlot(&free_space_sem_))
+      return false;
+    bool ok = PushAcquired(CopyMaker(t));
+    MaybeYield();
+    return ok;
+  }
+
+  // moves *t in without copying, IOBuffer and other move-only types can
+  // only be sent this way. *t is left empty if pushed.
+  bool PushMove(T* t) {
+    if (IsClosed())
+      return false;
+    if (max_size_ == 0)
+      return HandoffPush(t, Deadline::Remaining());
+    if (!AcquireSlot(&free_space_sem_))
+      return false;
+    bool ok = PushAcquired(MoveMaker(t));
+    MaybeYield();
+    return ok;
+  }
+
+  // constructs the item in its slot from the arguments.
+  bool Emplace() {
+    if (IsClosed())
+      return false;
+    if (max_size_ == 0) {
+      T t;
+      return HandoffPush(&t, Deadline::Remaining());
     }
-    if (ok) {
-      runtime::SemRelease(&used_space_sem_);
-    } else {
-      runtime::SemRelease(&free_space_sem_);
+    if (!AcquireSlot(&free_space_sem_))
+      return false;
+    bool ok = PushAcquired(EmplaceMaker0());
+    MaybeYield();
+    return ok;
+  }
+
+  template <typename A1>
+  bool Emplace(const A1& a1) {
+    if (IsClosed())
+      return false;
+    if (max_size_ == 0) {
+      T t(a1);
+      return HandoffPush(&t, Deadline::Remaining());
+    }
+    if (!AcquireSlot(&free_space_sem_))
+      return false;
+    bool ok = PushAcquired(EmplaceMaker1<A1>(a1));
+    MaybeYield();
+    return ok;
+  }
+
+  template <typename A1, typename A2>
+  bool Emplace(const A1& a1, const A2& a2) {
+    if (IsClosed())
+      return false;
+    if (max_size_ == 0) {
+      T t(a1, a2);
+      return HandoffPush(&t, Deadline::Remaining());
     }
+    if (!AcquireSlot(&free_space_sem_))
+      return false;
+    bool ok = PushAcquired(EmplaceMaker2<A1, A2>(a1, a2));
+    MaybeYield();
     return ok;
   }
 
+  // the item is moved out of the channel into *t.
   bool Pop(T* t) {
     if (IsClosed())
       return false;
+    if (max_size_ == 0)
+      return HandoffPop(t, Deadline::Remaining());
+    if (!AcquireSlot(&used_space_sem_))
+      return false;
+    bool ok = PopAcquired(t);
+    MaybeYield();
+    return ok;
+  }
+
+  // pushes n items taking the lock once per run of free slots, parks
+  // while full. returns how many were pushed, less than n if closed.
+  int PushN(const T* t, int n) {
+    int pushed = 0;
+    while (pushed < n && !IsClosed()) {
+      if (max_size_ == 0) {
+        if (!HandoffPush(const_cast<T*>(t + pushed),
+                         Deadline::Remaining()))
+          break;
+        pushed++;
+        continue;
+      }
+      if (!AcquireSlot(&free_space_sem_))
+        break;
+      uint32 k = 1 + runtime::SemTryAcquireN(&free_space_sem_,
+                                             n - pushed - 1);
+      bool ok;
+      {
+        runtime::RawMutexGuard guard(&lock_);
+        ok = !IsClosed();
+        if (ok) {
+          for (uint32 i = 0; i < k; ++i) {
+            CopyMaker make(t[pushed + i]);
+            make(Tail());
+            count_++;
+          }
+        }
+      }
+      if (!ok) {
+        runtime::SemReleaseN(&free_space_sem_, k);
+        break;
+      }
+      // one batch of readies for every popper the items feed.
+      runtime::SemReleaseN(&used_space_sem_, k);
+      if (k == 1) {
+        recv_waiters_.WakeOne();
+      } else {
+        recv_waiters_.WakeAll();
+      }
+      pushed += k;
+    }
+    MaybeYield();
+    return pushed;
+  }
+
+  // parks until at least one item is there, then pops up to max of them
+  // under one lock. returns how many, 0 if closed.
+  int PopN(T* t, int max) {
+    if (IsClosed() || max <= 0)
+      return 0;
+    if (max_size_ == 0)
+      return HandoffPop(t, Deadline::Remaining()) ? 1 : 0;
+    if (!AcquireSlot(&used_space_sem_))
+      return 0;
+    uint32 k = 1 + runtime::SemTryAcquireN(&used_space_sem_, max - 1);
     bool ok;
-    runtime::SemAcquire(&used_space_sem_);
-    do {
+    {
       runtime::RawMutexGuard guard(&lock_);
       ok = !IsClosed();
       if (ok) {
-        *t = queue_.front();
-        queue_.pop_front();
+        for (uint32 i = 0; i < k; ++i) {
+          TakeLocked(t + i);
+        }
       }
-    } while (0);
-    if (ok) {
-      runtime::SemRelease(&free_space_sem_);
+    }
+    if (!ok) {
+      runtime::SemReleaseN(&used_space_sem_, k);
+      return 0;
+    }
+    runtime::SemReleaseN(&free_space_sem_, k);
+    if (k == 1) {
+      send_waiters_.WakeOne();
     } else {
-      runtime::SemRelease(&used_space_sem_);
+      send_waiters_.WakeAll();
     }
+    MaybeYield();
+    return static_cast<int>(k);
+  }
+
+  // never parks, false if the channel is full or closed.
+  bool TryPush(const T& t) {
+    if (max_size_ == 0)
+      return !IsClosed() && HandoffPush(const_cast<T*>(&t), 0);
+    if (IsClosed() || !runtime::SemTryAcquire(&free_space_sem_))
+      return false;
+    return PushAcquired(CopyMaker(t));
+  }
+
+  // never parks, false if the channel is empty or closed.
+  bool TryPop(T* t) {
+    if (max_size_ == 0)
+      return !IsClosed() && HandoffPop(t, 0);
+    if (IsClosed() || !runtime::SemTryAcquire(&used_space_sem_))
+      return false;
+    return PopAcquired(t);
+  }
+
+  // parks at most ns nano seconds for room, false on timeout or close.
+  bool PushFor(const T& t, int64 ns) {
+    if (max_size_ == 0)
+      return !IsClosed() &&
+             HandoffPush(const_cast<T*>(&t), WithinDeadline(ns));
+    if (IsClosed() || !runtime::SemAcquireFor(&free_space_sem_, ns))
+      return false;
+    bool ok = PushAcquired(CopyMaker(t));
+    MaybeYield();
+    return ok;
+  }
+
+  // parks at most ns nano seconds for an item, false on timeout or close.
+  bool PopFor(T* t, int64 ns) {
+    if (max_size_ == 0)
+      return !IsClosed() && HandoffPop(t, WithinDeadline(ns));
+    if (IsClosed() || !runtime::SemAcquireFor(&used_space_sem_, ns))
+      return false;
+    bool ok = PopAcquired(t);
+    MaybeYield();
     return ok;
   }
 
@@ -75,36 +250,235 @@ class Channel
       // already closed.
       return;
     }
-    std::deque<T> queue;
+    // closed, no push or pop touches the slots any more. destroy the
+    // items without the lock, a destructor may block or close others.
+    uint32 head = 0;
+    uint32 count = 0;
     {
       runtime::RawMutexGuard guard(&lock_);
-      std::swap(queue, queue_);
+      head = head_;
+      count = count_;
+      count_ = 0;
     }
-    ClearQueue(queue, base::is_pointer<T>());
+    ClearQueue(head, count, base::is_pointer<T>());
+    if (max_size_ == 0)
+      CloseHandoff();
     runtime::SemRelease(&free_space_sem_);
     runtime::SemRelease(&used_space_sem_);
+    send_waiters_.WakeAll();
+    recv_waiters_.WakeAll();
   }
 
   bool IsClosed() {
     return atomic::acquire_load32(&closed_) != 0;
   }
 
+  // used by Select.
+  SelectWaitQueue* SendWaiters() {
+    return &send_waiters_;
+  }
+
+  SelectWaitQueue* RecvWaiters() {
+    return &recv_waiters_;
+  }
+
  private:
-  void ClearQueue(std::deque<T>& queue, base::false_type) {  // NOLINT
-    queue.clear();
+  // a wait under a tin::Deadline ends with it, on the timer of the
+  // deadline rather than one of its own.
+  static bool AcquireSlot(uint32* sem) {
+    if (!Deadline::Active()) {
+      runtime::SemAcquire(sem);
+      return true;
+    }
+    return runtime::SemAcquireCancelable(sem);
+  }
+
+  // a negative ns does not park.
+  static int64 WithinDeadline(int64 ns) {
+    int64 left = Deadline::Remaining();
+    if (ns < 0)
+      ns = 0;
+    return left >= 0 && left < ns ? left : ns;
+  }
+
+  // construct an item in a free slot.
+  class CopyMaker {
+   public:
+    explicit CopyMaker(const T& t) : t_(t) {}
+    void operator()(void* p) const { new (p) T(t_); }
+   private:
+    const T& t_;
+  };
+
+  class MoveMaker {
+   public:
+    explicit MoveMaker(T* t) : t_(t) {}
+    void operator()(void* p) const { MoveConstruct(p, t_); }
+   private:
+    T* t_;
+  };
+
+  class EmplaceMaker0 {
+   public:
+    void operator()(void* p) const { new (p) T(); }
+  };
+
+  template <typename A1>
+  class EmplaceMaker1 {
+   public:
+    explicit EmplaceMaker1(const A1& a1) : a1_(a1) {}
+    void operator()(void* p) const { new (p) T(a1_); }
+   private:
+    const A1& a1_;
+  };
+
+  template <typename A1, typename A2>
+  class EmplaceMaker2 {
+   public:
+    EmplaceMaker2(const A1& a1, const A2& a2) : a1_(a1), a2_(a2) {}
+    void operator()(void* p) const { new (p) T(a1_, a2_); }
+   private:
+    const A1& a1_;
+    const A2& a2_;
+  };
+
+  T* Tail() {
+    return ring_ + (head_ + count_) % max_size_;
+  }
+
+  // moves the oldest item out and destroys its slot.
+  void TakeLocked(T* t) {
+    T* slot = ring_ + head_;
+    MoveAssign(t, slot);
+    slot->~T();
+    head_ = (head_ + 1) % max_size_;
+    count_--;
+  }
+
+  // unbuffered channels. ns < 0 waits forever, 0 only takes a greenlet
+  // already parked on the other side. the value moves from *t, a plain
+  // copy unless T is move-only.
+  bool HandoffPush(T* t, int64 ns) {
+    lock_.Lock();
+    if (IsClosed()) {
+      lock_.Unlock();
+      return false;
+    }
+    runtime::Sudog* r = recvq_.Dequeue();
+    if (r != NULL) {
+      MoveAssign(static_cast<T*>(r->elem), t);
+      runtime::G* gp = HandoffQueue::Complete(r);
+      lock_.Unlock();
+      HandoffQueue::Wake(gp);
+      return true;
+    }
+    if (ns == 0) {
+      lock_.Unlock();
+      return false;
+    }
+    runtime::Sudog s;
+    s.elem = t;
+    return sendq_.Park(&lock_, &s, ns, &recv_waiters_) == kHandoffDone;
   }
 
-  void ClearQueue(std::deque<T>& queue, base::true_type) {  // NOLINT
-    for (typename std::deque<T>::iterator iter = queue.begin();
-         iter != queue.end();
-         ++iter) {
-      delete *iter;
+  bool HandoffPop(T* t, int64 ns) {
+    lock_.Lock();
+    if (IsClosed()) {
+      lock_.Unlock();
+      return false;
     }
-    queue.clear();
+    runtime::Sudog* s = sendq_.Dequeue();
+    if (s != NULL) {
+      MoveAssign(t, static_cast<T*>(s->elem));
+      runtime::G* gp = HandoffQueue::Complete(s);
+      lock_.Unlock();
+      HandoffQueue::Wake(gp);
+      return true;
+    }
+    if (ns == 0) {
+      lock_.Unlock();
+      return false;
+    }
+    runtime::Sudog r;
+    r.elem = t;
+    return recvq_.Park(&lock_, &r, ns, &send_waiters_) == kHandoffDone;
   }
+
+  void CloseHandoff() {
+    int32 nsend = 0;
+    int32 nrecv = 0;
+    runtime::G* senders = NULL;
+    runtime::G* receivers = NULL;
+    {
+      runtime::RawMutexGuard guard(&lock_);
+      senders = sendq_.CloseLocked(&nsend);
+      receivers = recvq_.CloseLocked(&nrecv);
+    }
+    HandoffQueue::WakeBatch(senders, nsend);
+    HandoffQueue::WakeBatch(receivers, nrecv);
+  }
+
+  // the caller took a count of free_space_sem_.
+  template <typename Maker>
+  bool PushAcquired(const Maker& make) {
+    bool ok;
+    {
+      runtime::RawMutexGuard guard(&lock_);
+      ok = !IsClosed();
+      if (ok) {
+        make(Tail());
+        count_++;
+      }
+    }
+    if (ok) {
+      runtime::SemRelease(&used_space_sem_);
+      recv_waiters_.WakeOne();
+    } else {
+      runtime::SemRelease(&free_space_sem_);
+    }
+    return ok;
+  }
+
+  // the caller took a count of used_space_sem_.
+  bool PopAcquired(T* t) {
+    bool ok;
+    {
+      runtime::RawMutexGuard guard(&lock_);
+      ok = !IsClosed();
+      if (ok) {
+        TakeLocked(t);
+      }
+    }
+    if (ok) {
+      runtime::SemRelease(&free_space_sem_);
+      send_waiters_.WakeOne();
+    } else {
+      runtime::SemRelease(&used_space_sem_);
+    }
+    return ok;
+  }
+
+  // destroys count items from slot head.
+  void ClearQueue(uint32 head, uint32 count, base::false_type) {
+    for (; count > 0; count--) {
+      ring_[head].~T();
+      head = (head + 1) % max_size_;
+    }
+  }
+
+  void ClearQueue(uint32 head, uint32 count, base::true_type) {
+    for (; count > 0; count--) {
+      delete ring_[head];
+      head = (head + 1) % max_size_;
+    }
+  }
+
   friend class base::RefCountedThreadSafe<Channel<T> >;
   ~Channel() {
     // std::cout << "Channel destructor_______\n";
+    ClearQueue(head_, count_, base::false_type());
+    if (ring_ != NULL)
+      std::allocator<T>().deallocate(ring_, max_size_);
   }
   DISALLOW_COPY_AND_ASSIGN(Channel<T>);
 
@@ -112,9 +486,17 @@ class Channel
   uint32 free_space_sem_;
   uint32 used_space_sem_;
   runtime::RawMutex lock_;
-  std::deque<T> queue_;
+  // max_size_ slots from head_, count_ of them hold items.
+  T* ring_;
+  uint32 head_;
+  uint32 count_;
   uint32 max_size_;
   uint32 closed_;
+  SelectWaitQueue send_waiters_;
+  SelectWaitQueue recv_waiters_;
+  // parked greenlets of an unbuffered channel.
+  HandoffQueue sendq_;
+  HandoffQueue recvq_;
 };
 
 
@@ -0,0 +1,160 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/logging.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/scheduler.h"
+#include "tin/runtime/timer/timer_queue.h"
+#include "tin/runtime/env.h"
+
+#include "tin/communication/handoff_queue.h"
+
+namespace tin {
+
+namespace {
+
+// lives on the stack of the parked greenlet, which waits for a fired
+// deadline to be done with it before returning.
+struct HandoffWaiter {
+  runtime::Sudog* s;
+  runtime::RawMutex* lock;
+  HandoffQueue* queue;
+  bool fired;
+};
+
+}  // namespace
+
+HandoffQueue::HandoffQueue()
+  : head_(NULL)
+  , tail_(NULL) {
+}
+
+HandoffQueue::~HandoffQueue() {
+  DCHECK(head_ == NULL);
+}
+
+void HandoffQueue::Enqueue(runtime::Sudog* s) {
+  s->next = NULL;
+  s->prev = tail_;
+  if (tail_ != NULL) {
+    tail_->next = s;
+  } else {
+    head_ = s;
+  }
+  tail_ = s;
+}
+
+bool HandoffQueue::Remove(runtime::Sudog* s) {
+  runtime::Sudog* p = head_;
+  while (p != NULL && p != s)
+    p = p->next;
+  if (p == NULL)
+    return false;
+  if (s->next != NULL) {
+    s->next->prev = s->prev;
+  } else {
+    tail_ = s->prev;
+  }
+  if (s->prev != NULL) {
+    s->prev->next = s->next;
+  } else {
+    head_ = s->next;
+  }
+  s->next = NULL;
+  s->prev = NULL;
+  return true;
+}
+
+runtime::Sudog* HandoffQueue::Dequeue() {
+  runtime::Sudog* s = head_;
+  if (s != NULL)
+    Remove(s);
+  return s;
+}
+
+uint32 HandoffQueue::Park(runtime::RawMutex* lock, runtime::Sudog* s,
+                          int64 ns, SelectWaitQueue* notify) {
+  runtime::G* gp = runtime::GetG();
+  s->gp = gp;
+  s->wakedup = 0;
+  Enqueue(s);
+  // a select on the other side can complete with us now.
+  notify->WakeOne();
+
+  HandoffWaiter w;
+  w.s = s;
+  w.lock = lock;
+  w.queue = this;
+  w.fired = false;
+  runtime::Timer* timer = NULL;
+  if (ns >= 0) {
+    timer = gp->GetTimer();
+    timer->f = OnDeadline;
+    timer->when = runtime::NanoFromNow(ns);
+    timer->slack = 0;
+    timer->arg = &w;
+    runtime::timer_q->AddTimer(timer);
+  }
+  runtime::ParkUnlock(lock, runtime::kParkChan);
+
+  if (timer != NULL && !runtime::timer_q->DelTimer(timer)) {
+    // the deadline fired, wait until its callback is done with w.
+    while (true) {
+      lock->Lock();
+      bool fired = w.fired;
+      lock->Unlock();
+      if (fired)
+        break;
+      tin::Sched();
+    }
+  }
+  return s->wakedup;
+}
+
+runtime::G* HandoffQueue::CloseLocked(int32* n) {
+  runtime::G* glist = NULL;
+  runtime::G* gtail = NULL;
+  *n = 0;
+  runtime::Sudog* s = NULL;
+  while ((s = Dequeue()) != NULL) {
+    s->wakedup = kHandoffClosed;
+    runtime::G* gp = s->gp;
+    gp->SetSchedLink(NULL);
+    if (gtail == NULL) {
+      glist = gp;
+    } else {
+      gtail->SetSchedLink(gp);
+    }
+    gtail = gp;
+    (*n)++;
+  }
+  return glist;
+}
+
+void HandoffQueue::Wake(runtime::G* gp) {
+  runtime::Ready(gp);
+}
+
+void HandoffQueue::WakeBatch(runtime::G* glist, int32 n) {
+  runtime::ReadyBatch(glist, n);
+}
+
+void HandoffQueue::OnDeadline(void* arg, uintptr_t seq) {
+  HandoffWaiter* w = static_cast<HandoffWaiter*>(arg);
+  runtime::G* gp = NULL;
+  {
+    runtime::RawMutexGuard guard(w->lock);
+    // a peer or Close may have taken it already.
+    if (w->queue->Remove(w->s)) {
+      w->s->wakedup = kHandoffTimeout;
+      gp = w->s->gp;
+    }
+    w->fired = true;
+  }
+  if (gp != NULL)
+    runtime::Ready(gp);
+}
+
+}  // namespace tin
@@ -0,0 +1,66 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include "base/basictypes.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/communication/select_queue.h"
+
+namespace tin {
+
+// left in Sudog::wakedup of a greenlet parked on an unbuffered channel.
+const uint32 kHandoffDone = 1;
+const uint32 kHandoffTimeout = 2;
+const uint32 kHandoffClosed = 3;
+
+// greenlets parked on one side of an unbuffered channel, guarded by the
+// channel lock. a peer takes the first one and copies the value straight
+// from or into its Sudog::elem, then readies it into run_next.
+class HandoffQueue {
+ public:
+  HandoffQueue();
+  ~HandoffQueue();
+
+  bool empty() const {
+    return head_ == NULL;
+  }
+
+  // NULL if nobody is parked.
+  runtime::Sudog* Dequeue();
+
+  // marks s done and returns its greenlet, ready it once unlocked.
+  static runtime::G* Complete(runtime::Sudog* s) {
+    s->wakedup = kHandoffDone;
+    return s->gp;
+  }
+
+  // queues s and parks, lock is held on entry and released on return.
+  // ns < 0 waits without a deadline. a select waiting for the other side
+  // is woken by notify. returns what the peer, the deadline or Close left
+  // in s->wakedup.
+  uint32 Park(runtime::RawMutex* lock, runtime::Sudog* s, int64 ns,
+              SelectWaitQueue* notify);
+
+  // dequeues everybody with kHandoffClosed, returns a list linked by
+  // schedlink for WakeBatch after unlocking.
+  runtime::G* CloseLocked(int32* n);
+
+  // readies gp into run_next of the current P.
+  static void Wake(runtime::G* gp);
+  static void WakeBatch(runtime::G* glist, int32 n);
+
+ private:
+  static void OnDeadline(void* arg, uintptr_t seq);
+
+  void Enqueue(runtime::Sudog* s);
+  bool Remove(runtime::Sudog* s);
+
+  runtime::Sudog* head_;
+  runtime::Sudog* tail_;
+  DISALLOW_COPY_AND_ASSIGN(HandoffQueue);
+};
+
+}  // namespace tin
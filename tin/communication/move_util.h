@@ -0,0 +1,84 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <new>
+
+#include "base/basictypes.h"
+#include "base/move.h"
+
+namespace tin {
+namespace internal {
+
+typedef char YesType;
+
+struct NoType {
+  YesType dummy[2];
+};
+
+template <bool B, typename T = void>
+struct EnableIf {};
+
+template <typename T>
+struct EnableIf<true, T> {
+  typedef T type;
+};
+
+// true for types declared with MOVE_ONLY_TYPE_FOR_CPP_03, e.g. IOBuffer.
+template <typename T>
+struct IsMoveOnlyType {
+  template <typename U>
+  static YesType Test(const typename U::MoveOnlyTypeForCPP03*);
+
+  template <typename U>
+  static NoType Test(...);
+
+  static const bool value = sizeof(Test<T>(0)) == sizeof(YesType);
+};
+
+}  // namespace internal
+
+// *to takes over *from, through Pass() for move-only types and by plain
+// assignment, leaving *from as is, for everything else.
+template <typename T>
+inline typename internal::EnableIf<!internal::IsMoveOnlyType<T>::value>::type
+MoveAssign(T* to, T* from) {
+  *to = *from;
+}
+
+template <typename T>
+inline typename internal::EnableIf<internal::IsMoveOnlyType<T>::value>::type
+MoveAssign(T* to, T* from) {
+  *to = from->Pass();
+}
+
+// *t as an argument that moves from it, e.g. for push_back.
+template <typename T>
+inline typename internal::EnableIf<!internal::IsMoveOnlyType<T>::value,
+                                   const T&>::type
+MoveArg(T* t) {
+  return *t;
+}
+
+template <typename T>
+inline typename internal::EnableIf<internal::IsMoveOnlyType<T>::value,
+                                   T>::type
+MoveArg(T* t) {
+  return t->Pass();
+}
+
+// constructs a T at p the same way.
+template <typename T>
+inline typename internal::EnableIf<!internal::IsMoveOnlyType<T>::value>::type
+MoveConstruct(void* p, T* from) {
+  new (p) T(*from);
+}
+
+template <typename T>
+inline typename internal::EnableIf<internal::IsMoveOnlyType<T>::value>::type
+MoveConstruct(void* p, T* from) {
+  new (p) T(from->Pass());
+}
+
+}  // namespace tin
@@ -4,13 +4,16 @@
 
 #pragma once
 #include <iostream>
+#include <algorithm>
 #include <deque>
 #include "base/memory/ref_counted.h"
 #include "base/synchronization/cancellation_flag.h"
 #include "tin/sync/atomic.h"
 #include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/runtime.h"
 #include "tin/runtime/semaphore.h"
 #include "tin/sync/cond.h"
+#include "tin/communication/move_util.h"
 
 
 namespace tin {
@@ -32,53 +35,97 @@ class QueueImpl
   }
 
   bool Enqueue(const T& t, size_t* size = NULL) {
+    return EnqueueImpl(const_cast<T*>(&t), base::false_type(), -1, size);
+  }
+
+  // moves *t in without copying, the way to queue move-only types such
+  // as IOBuffer. Dequeue always moves the item out.
+  bool EnqueueMove(T* t, size_t* size = NULL) {
+    return EnqueueImpl(t, base::true_type(), -1, size);
+  }
+
+  bool Dequeue(T* t, size_t* size = NULL) {
+    return DequeueImpl(t, -1, size);
+  }
+
+  // appends n items, waiting while full, and wakes the consumers once per
+  // run of free room. returns how many went in, less than n if closed.
+  size_t EnqueueBatch(const T* t, size_t n, size_t* size = NULL) {
     MutexGuard guard(&lock_);
-    if (closed_)
-      return false;
-    while (queue_.size() == capacity_) {  // queue is full.
-      full_waiters_++;
-      // Wait will release lock automatically.
-      full_cond_.Wait();
-      // Wait acquired lock automatically.
-      full_waiters_--;
-      if (closed_)
-        return false;
-    }
-    // now, we have space to push at least one item.
-    queue_.push_back(t);
-    // some consumers is waiting due to empty queue.
-    if (empty_waiters_ > 0) {
-      // some consumers is waiting for an item.
-      empty_cond_.Signal();
+    size_t pushed = 0;
+    while (pushed < n && !closed_) {
+      if (queue_.size() >= capacity_) {  // queue is full.
+        full_waiters_++;
+        full_cond_.Wait();
+        full_waiters_--;
+        continue;
+      }
+      size_t k = std::min(n - pushed, capacity_ - queue_.size());
+      queue_.insert(queue_.end(), t + pushed, t + pushed + k);
+      pushed += k;
+      if (empty_waiters_ > 0) {
+        if (k == 1) {
+          empty_cond_.Signal();
+        } else {
+          empty_cond_.Broascast();
+        }
+      }
     }
     if (size != NULL)
       *size = queue_.size();
-    return true;
+    return pushed;
   }
 
-  bool Dequeue(T* t, size_t* size = NULL) {
+  // waits for at least one item, then takes up to max of them under one
+  // lock hold. returns how many, 0 if closed.
+  size_t DequeueBatch(T* t, size_t max, size_t* size = NULL) {
     MutexGuard guard(&lock_);
-    if (closed_)
-      return false;
+    if (closed_ || max == 0)
+      return 0;
     while (queue_.size() == 0) {  // queue is empty
       empty_waiters_++;
-      // Wait will release lock automatically.
       empty_cond_.Wait();
-      // Wait acquired lock automatically.
       empty_waiters_--;
       if (closed_)
-        return false;
+        return 0;
     }
-    *t = queue_.front();
-    queue_.pop_front();
-    // some producers is waiting due to full queue.
+    size_t k = std::min(max, queue_.size());
+    for (size_t i = 0; i < k; ++i) {
+      MoveAssign(t + i, &queue_.front());
+      queue_.pop_front();
+    }
+    // all producers the room frees in one go.
     if (full_waiters_ > 0) {
-      // some producers is waiting for a slot to put item.
-      full_cond_.Signal();
+      if (k == 1) {
+        full_cond_.Signal();
+      } else {
+        full_cond_.Broascast();
+      }
     }
     if (size != NULL)
       *size = queue_.size();
-    return true;
+    return k;
+  }
+
+  // never waits, false if the queue is full or closed.
+  bool TryEnqueue(const T& t, size_t* size = NULL) {
+    return EnqueueImpl(const_cast<T*>(&t), base::false_type(), 0, size);
+  }
+
+  // never waits, false if the queue is empty or closed.
+  bool TryDequeue(T* t, size_t* size = NULL) {
+    return DequeueImpl(t, 0, size);
+  }
+
+  // waits at most ns nano seconds for a slot, false on timeout or close.
+  bool EnqueueFor(const T& t, int64 ns, size_t* size = NULL) {
+    return EnqueueImpl(const_cast<T*>(&t), base::false_type(),
+                       ns < 0 ? 0 : ns, size);
+  }
+
+  // waits at most ns nano seconds for an item, false on timeout or close.
+  bool DequeueFor(T* t, int64 ns, size_t* size = NULL) {
+    return DequeueImpl(t, ns < 0 ? 0 : ns, size);
   }
 
   void Close() {
@@ -131,6 +178,80 @@ class QueueImpl
   }
 
  private:
+  // ns < 0 waits without a deadline.
+  template <typename Move>
+  bool EnqueueImpl(T* t, Move move, int64 ns, size_t* size) {
+    int64 deadline = ns > 0 ? MonoNow() + ns : 0;
+    MutexGuard guard(&lock_);
+    if (closed_)
+      return false;
+    while (queue_.size() == capacity_) {  // queue is full.
+      if (!WaitLocked(&full_cond_, &full_waiters_, ns, deadline))
+        return false;
+      if (closed_)
+        return false;
+    }
+    // now, we have space to push at least one item.
+    PushBack(t, move);
+    // some consumers is waiting due to empty queue.
+    if (empty_waiters_ > 0) {
+      // some consumers is waiting for an item.
+      empty_cond_.Signal();
+    }
+    if (size != NULL)
+      *size = queue_.size();
+    return true;
+  }
+
+  bool DequeueImpl(T* t, int64 ns, size_t* size) {
+    int64 deadline = ns > 0 ? MonoNow() + ns : 0;
+    MutexGuard guard(&lock_);
+    if (closed_)
+      return false;
+    while (queue_.size() == 0) {  // queue is empty
+      if (!WaitLocked(&empty_cond_, &empty_waiters_, ns, deadline))
+        return false;
+      if (closed_)
+        return false;
+    }
+    MoveAssign(t, &queue_.front());
+    queue_.pop_front();
+    // some producers is waiting due to full queue.
+    if (full_waiters_ > 0) {
+      // some producers is waiting for a slot to put item.
+      full_cond_.Signal();
+    }
+    if (size != NULL)
+      *size = queue_.size();
+    return true;
+  }
+
+  void PushBack(T* t, base::false_type) {
+    queue_.push_back(*t);
+  }
+
+  void PushBack(T* t, base::true_type) {
+    queue_.push_back(MoveArg(t));
+  }
+
+  // returns false once the deadline passed.
+  bool WaitLocked(Cond* cond, int* waiters, int64 ns, int64 deadline) {
+    if (ns == 0)
+      return false;
+    (*waiters)++;
+    bool signaled = true;
+    if (ns < 0) {
+      // Wait will release lock automatically.
+      cond->Wait();
+    } else {
+      int64 left = deadline - MonoNow();
+      signaled = left > 0 && cond->WaitFor(left);
+    }
+    // Wait acquired lock automatically.
+    (*waiters)--;
+    return signaled;
+  }
+
   friend class base::RefCountedThreadSafe<QueueImpl<T>>;
   ~QueueImpl() {
     STLClearElements(&queue_);
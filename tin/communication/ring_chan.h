@@ -0,0 +1,298 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <vector>
+
+#include "base/memory/ref_counted.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/communication/chan.h"
+
+namespace tin {
+
+const int kRingCacheLineSize = 64;
+
+inline uint32 RingCapacity(uint32 size) {
+  uint32 capacity = 2;
+  while (capacity < size)
+    capacity <<= 1;
+  return capacity;
+}
+
+// bounded multi producer multi consumer ring, every cell carries a
+// sequence number telling which lap may use it next.
+template <class T>
+class MpmcRing {
+ public:
+  explicit MpmcRing(uint32 size)
+    : mask_(RingCapacity(size) - 1)
+    , cells_(mask_ + 1)
+    , head_(0)
+    , tail_(0) {
+    for (uintptr_t i = 0; i <= mask_; ++i) {
+      cells_[i].seq = i;
+    }
+  }
+
+  bool TryPush(const T& t) {
+    uintptr_t pos = atomic::relaxed_load(&tail_);
+    Cell* cell = NULL;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      uintptr_t seq = atomic::acquire_load(&cell->seq);
+      intptr_t diff = static_cast<intptr_t>(seq - pos);
+      if (diff == 0) {
+        if (atomic::cas(&tail_, pos, pos + 1))
+          break;
+        pos = atomic::relaxed_load(&tail_);
+      } else if (diff < 0) {
+        return false;  // full.
+      } else {
+        pos = atomic::relaxed_load(&tail_);
+      }
+    }
+    cell->data = t;
+    atomic::release_store(&cell->seq, pos + 1);
+    return true;
+  }
+
+  bool TryPop(T* t) {
+    uintptr_t pos = atomic::relaxed_load(&head_);
+    Cell* cell = NULL;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      uintptr_t seq = atomic::acquire_load(&cell->seq);
+      intptr_t diff = static_cast<intptr_t>(seq - (pos + 1));
+      if (diff == 0) {
+        if (atomic::cas(&head_, pos, pos + 1))
+          break;
+        pos = atomic::relaxed_load(&head_);
+      } else if (diff < 0) {
+        return false;  // empty.
+      } else {
+        pos = atomic::relaxed_load(&head_);
+      }
+    }
+    *t = cell->data;
+    // drop what the slot holds, e.g. a refcounted pointer.
+    cell->data = T();
+    atomic::release_store(&cell->seq, pos + mask_ + 1);
+    return true;
+  }
+
+ private:
+  struct Cell {
+    uintptr_t seq;
+    T data;
+  };
+
+  const uintptr_t mask_;
+  std::vector<Cell> cells_;
+  char pad0_[kRingCacheLineSize];
+  uintptr_t head_;
+  char pad1_[kRingCacheLineSize - sizeof(uintptr_t)];
+  uintptr_t tail_;
+  char pad2_[kRingCacheLineSize - sizeof(uintptr_t)];
+  DISALLOW_COPY_AND_ASSIGN(MpmcRing);
+};
+
+// bounded ring for exactly one producer and one consumer greenlet.
+template <class T>
+class SpscRing {
+ public:
+  explicit SpscRing(uint32 size)
+    : mask_(RingCapacity(size) - 1)
+    , slots_(mask_ + 1)
+    , head_(0)
+    , tail_(0) {
+  }
+
+  bool TryPush(const T& t) {
+    uintptr_t tail = atomic::relaxed_load(&tail_);
+    if (tail - atomic::acquire_load(&head_) > mask_)
+      return false;  // full.
+    slots_[tail & mask_] = t;
+    atomic::release_store(&tail_, tail + 1);
+    return true;
+  }
+
+  bool TryPop(T* t) {
+    uintptr_t head = atomic::relaxed_load(&head_);
+    if (head == atomic::acquire_load(&tail_))
+      return false;  // empty.
+    *t = slots_[head & mask_];
+    slots_[head & mask_] = T();
+    atomic::release_store(&head_, head + 1);
+    return true;
+  }
+
+ private:
+  const uintptr_t mask_;
+  std::vector<T> slots_;
+  char pad0_[kRingCacheLineSize];
+  // written by the consumer only.
+  uintptr_t head_;
+  char pad1_[kRingCacheLineSize - sizeof(uintptr_t)];
+  // written by the producer only.
+  uintptr_t tail_;
+  char pad2_[kRingCacheLineSize - sizeof(uintptr_t)];
+  DISALLOW_COPY_AND_ASSIGN(SpscRing);
+};
+
+// Channel over a lock-free ring. Push and Pop touch no lock and no
+// semaphore unless the ring is full or empty, then the greenlet parks
+// until the other side makes progress.
+template <class T, class Ring>
+class RingChannel
+  : public base::RefCountedThreadSafe<RingChannel<T, Ring> > {
+ public:
+  explicit RingChannel(uint32 max_size = kDefaultChanSize)
+    : ring_(max_size)
+    , push_waiters_(0)
+    , push_sema_(0)
+    , pop_waiters_(0)
+    , pop_sema_(0)
+    , closed_(0) {
+  }
+
+  bool Push(const T& t) {
+    while (true) {
+      if (IsClosed())
+        return false;
+      if (ring_.TryPush(t)) {
+        Wake(&pop_waiters_, &pop_sema_);
+        MaybeYield();
+        return true;
+      }
+      // full, announce ourselves then look again so a pop in between
+      // can't be missed.
+      atomic::Inc32(&push_waiters_, 1);
+      bool pushed = !IsClosed() && ring_.TryPush(t);
+      if (pushed || IsClosed()) {
+        CancelWait(&push_waiters_);
+        if (pushed)
+          Wake(&pop_waiters_, &pop_sema_);
+        return pushed;
+      }
+      runtime::SemAcquire(&push_sema_);
+    }
+  }
+
+  bool Pop(T* t) {
+    while (true) {
+      if (IsClosed())
+        return false;
+      if (ring_.TryPop(t)) {
+        Wake(&push_waiters_, &push_sema_);
+        MaybeYield();
+        return true;
+      }
+      atomic::Inc32(&pop_waiters_, 1);
+      bool popped = !IsClosed() && ring_.TryPop(t);
+      if (popped || IsClosed()) {
+        CancelWait(&pop_waiters_);
+        if (popped)
+          Wake(&push_waiters_, &push_sema_);
+        return popped;
+      }
+      runtime::SemAcquire(&pop_sema_);
+    }
+  }
+
+  void Close() {
+    if (atomic::exchange32(&closed_, 1) != 0) {
+      // already closed.
+      return;
+    }
+    runtime::SemReleaseN(&push_sema_, atomic::exchange32(&push_waiters_, 0));
+    runtime::SemReleaseN(&pop_sema_, atomic::exchange32(&pop_waiters_, 0));
+  }
+
+  bool IsClosed() {
+    return atomic::acquire_load32(&closed_) != 0;
+  }
+
+ private:
+  friend class base::RefCountedThreadSafe<RingChannel<T, Ring> >;
+  ~RingChannel() {
+    T t;
+    while (ring_.TryPop(&t)) {
+      ClearItem(t, base::is_pointer<T>());
+    }
+  }
+
+  void ClearItem(const T& t, base::false_type) {
+  }
+
+  void ClearItem(const T& t, base::true_type) {
+    delete t;
+  }
+
+  // hands one parked waiter of the other side a wakeup.
+  void Wake(uint32* waiters, uint32* sema) {
+    // full barrier, orders our ring update before reading waiters.
+    uint32 v = static_cast<uint32>(atomic::Inc32(waiters, 0));
+    while (v > 0) {
+      if (atomic::cas32(waiters, v, v - 1)) {
+        runtime::SemRelease(sema);
+        return;
+      }
+      v = atomic::load32(waiters);
+    }
+  }
+
+  // we did not park after all. if a waker already took our count its
+  // wakeup stays in the semaphore and some later waiter retries once.
+  void CancelWait(uint32* waiters) {
+    uint32 v = atomic::load32(waiters);
+    while (v > 0 && !atomic::cas32(waiters, v, v - 1)) {
+      v = atomic::load32(waiters);
+    }
+  }
+
+ private:
+  Ring ring_;
+  uint32 push_waiters_;
+  uint32 push_sema_;
+  char pad0_[kRingCacheLineSize - 2 * sizeof(uint32)];
+  uint32 pop_waiters_;
+  uint32 pop_sema_;
+  char pad1_[kRingCacheLineSize - 2 * sizeof(uint32)];
+  uint32 closed_;
+  DISALLOW_COPY_AND_ASSIGN(RingChannel);
+};
+
+template <typename T>
+class RingChan
+  : public scoped_refptr<RingChannel<T, MpmcRing<T> > > {
+ public:
+  explicit RingChan(RingChannel<T, MpmcRing<T> >* t)
+    : scoped_refptr<RingChannel<T, MpmcRing<T> > >(t) {
+  }
+};
+
+// for a pipeline stage with exactly one sender and one receiver.
+template <typename T>
+class SpscChan
+  : public scoped_refptr<RingChannel<T, SpscRing<T> > > {
+ public:
+  explicit SpscChan(RingChannel<T, SpscRing<T> >* t)
+    : scoped_refptr<RingChannel<T, SpscRing<T> > >(t) {
+  }
+};
+
+template <typename T>
+RingChan<T> MakeRingChan(uint32 max_size = kDefaultChanSize) {
+  return RingChan<T>(new RingChannel<T, MpmcRing<T> >(max_size));
+}
+
+template <typename T>
+SpscChan<T> MakeSpscChan(uint32 max_size = kDefaultChanSize) {
+  return SpscChan<T>(new RingChannel<T, SpscRing<T> >(max_size));
+}
+
+}  // namespace tin
@@ -0,0 +1,151 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+
+#include "base/logging.h"
+#include "base/stl_util.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/runtime/timer/timer_queue.h"
+#include "tin/runtime/env.h"
+
+#include "tin/communication/select.h"
+
+namespace tin {
+
+namespace {
+
+// shared by a parked select and its timer, freed by the last to let go.
+struct SelectWaiter {
+  SelectWaiter()
+    : done(0)
+    , sema(0)
+    , refs(1) {
+  }
+
+  uint32 done;
+  uint32 sema;
+  int32 refs;
+};
+
+void UnrefWaiter(SelectWaiter* w) {
+  if (atomic::Inc32(&w->refs, -1) == 0)
+    delete w;
+}
+
+void OnSelectTimeout(void* arg, uintptr_t seq) {
+  SelectWaiter* w = static_cast<SelectWaiter*>(arg);
+  if (atomic::cas32(&w->done, 0, 1))
+    runtime::SemRelease(&w->sema);
+  UnrefWaiter(w);
+}
+
+}  // namespace
+
+Select::Select()
+  : timeout_(-1) {
+}
+
+Select::~Select() {
+  STLDeleteElements(&cases_);
+}
+
+void Select::Timeout(int64 ns) {
+  timeout_ = ns < 0 ? 0 : ns;
+}
+
+int Select::AddCase(SelectCase* c) {
+  cases_.push_back(c);
+  return static_cast<int>(cases_.size()) - 1;
+}
+
+int Select::PollCases(int first) {
+  int n = static_cast<int>(cases_.size());
+  for (int k = 0; k < n; ++k) {
+    int i = (first + k) % n;
+    if (cases_[i]->Poll())
+      return i;
+  }
+  return -1;
+}
+
+int Select::Wait() {
+  int n = static_cast<int>(cases_.size());
+  CHECK(n > 0 || timeout_ >= 0) << "Select without cases blocks forever";
+  int first = n > 1 ? rand() % n : 0;
+  int fired = PollCases(first);
+  if (fired >= 0)
+    return fired;
+  if (timeout_ == 0)
+    return kSelectTimeout;
+
+  runtime::G* gp = runtime::GetG();
+  SelectWaiter* w = new SelectWaiter;
+  std::vector<runtime::Sudog> sudogs(n);
+  for (int i = 0; i < n; ++i) {
+    sudogs[i].gp = gp;
+    sudogs[i].selectdone = &w->done;
+    sudogs[i].address = &w->sema;
+  }
+  runtime::Timer* timer = NULL;
+  if (timeout_ > 0) {
+    timer = gp->GetTimer();
+    timer->f = OnSelectTimeout;
+    timer->when = MonoNow() + timeout_;
+    timer->slack = 0;
+    timer->arg = w;
+    atomic::Inc32(&w->refs, 1);
+    runtime::timer_q->AddTimer(timer);
+  }
+
+  while (true) {
+    for (int i = 0; i < n; ++i) {
+      sudogs[i].wakedup = 0;
+      cases_[i]->WaitQueue()->Enqueue(&sudogs[i]);
+    }
+    // look again, a change before we were queued woke nobody.
+    fired = PollCases(first);
+    if (fired < 0 || !atomic::cas32(&w->done, 0, 1)) {
+      // park once, or wait for the wakeup already on its way so that it
+      // does not touch w after we are gone.
+      runtime::SemAcquire(&w->sema);
+    }
+    for (int i = 0; i < n; ++i) {
+      cases_[i]->WaitQueue()->Remove(&sudogs[i]);
+    }
+    if (fired >= 0)
+      break;
+
+    int woken = -1;
+    for (int i = 0; i < n; ++i) {
+      if (sudogs[i].wakedup != 0) {
+        woken = i;
+        break;
+      }
+    }
+    if (woken < 0) {
+      fired = kSelectTimeout;
+      break;
+    }
+    // the case that woke us first, it may have been taken by someone
+    // else meanwhile.
+    fired = cases_[woken]->Poll() ? woken : PollCases(first);
+    if (fired >= 0)
+      break;
+    atomic::release_store32(&w->done, 0);
+  }
+
+  // a timer that already fired drops its reference itself.
+  if (timer != NULL && runtime::timer_q->DelTimer(timer))
+    UnrefWaiter(w);
+  UnrefWaiter(w);
+  return fired;
+}
+
+}  // namespace tin
@@ -0,0 +1,126 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/memory/ref_counted.h"
+#include "tin/communication/chan.h"
+#include "tin/communication/select_queue.h"
+
+namespace tin {
+
+// returned by Select::Wait when the timeout expired first.
+const int kSelectTimeout = -1;
+
+class SelectCase {
+ public:
+  virtual ~SelectCase() {}
+  // completes the case if that does not need to park.
+  virtual bool Poll() = 0;
+  virtual SelectWaitQueue* WaitQueue() = 0;
+};
+
+template <class T>
+class SelectRecvCase : public SelectCase {
+ public:
+  SelectRecvCase(Channel<T>* ch, T* t, bool* ok)
+    : ch_(ch)
+    , t_(t)
+    , ok_(ok) {
+  }
+
+  virtual bool Poll() {
+    bool ok = ch_->TryPop(t_);
+    // a closed channel is always ready.
+    if (!ok && !ch_->IsClosed())
+      return false;
+    if (ok_ != NULL)
+      *ok_ = ok;
+    return true;
+  }
+
+  virtual SelectWaitQueue* WaitQueue() {
+    return ch_->RecvWaiters();
+  }
+
+ private:
+  scoped_refptr<Channel<T> > ch_;
+  T* t_;
+  bool* ok_;
+  DISALLOW_COPY_AND_ASSIGN(SelectRecvCase);
+};
+
+template <class T>
+class SelectSendCase : public SelectCase {
+ public:
+  SelectSendCase(Channel<T>* ch, const T& t, bool* ok)
+    : ch_(ch)
+    , t_(t)
+    , ok_(ok) {
+  }
+
+  virtual bool Poll() {
+    bool ok = ch_->TryPush(t_);
+    if (!ok && !ch_->IsClosed())
+      return false;
+    if (ok_ != NULL)
+      *ok_ = ok;
+    return true;
+  }
+
+  virtual SelectWaitQueue* WaitQueue() {
+    return ch_->SendWaiters();
+  }
+
+ private:
+  scoped_refptr<Channel<T> > ch_;
+  T t_;
+  bool* ok_;
+  DISALLOW_COPY_AND_ASSIGN(SelectSendCase);
+};
+
+// waits on several channel operations at once and completes exactly one.
+//
+//   Select sel;
+//   int a = sel.Recv(in1, &v1);
+//   int b = sel.Recv(in2, &v2);
+//   sel.Timeout(100 * kMillisecond);
+//   int fired = sel.Wait();
+//
+// a case on a closed channel completes with *ok set to false. ready cases
+// are tried in a random order so none of them starves.
+class Select {
+ public:
+  Select();
+  ~Select();
+
+  // each returns the index Wait reports for the case.
+  template <class T>
+  int Recv(Channel<T>* ch, T* t, bool* ok = NULL) {
+    return AddCase(new SelectRecvCase<T>(ch, t, ok));
+  }
+
+  template <class T>
+  int Send(Channel<T>* ch, const T& t, bool* ok = NULL) {
+    return AddCase(new SelectSendCase<T>(ch, t, ok));
+  }
+
+  // gives up after ns nano seconds, 0 only polls the cases once.
+  void Timeout(int64 ns);
+
+  // parks until a case completes, returns its index or kSelectTimeout.
+  int Wait();
+
+ private:
+  int AddCase(SelectCase* c);
+  int PollCases(int first);
+
+  std::vector<SelectCase*> cases_;
+  int64 timeout_;
+  DISALLOW_COPY_AND_ASSIGN(Select);
+};
+
+}  // namespace tin
@@ -0,0 +1,77 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/logging.h"
+
+#include "tin/communication/select_queue.h"
+
+namespace tin {
+
+SelectWaitQueue::SelectWaitQueue()
+  : head_(NULL)
+  , tail_(NULL)
+  , nwait_(0) {
+}
+
+SelectWaitQueue::~SelectWaitQueue() {
+  DCHECK(head_ == NULL);
+}
+
+void SelectWaitQueue::Enqueue(runtime::Sudog* s) {
+  runtime::RawMutexGuard guard(&lock_);
+  s->next = NULL;
+  s->prev = tail_;
+  if (tail_ != NULL) {
+    tail_->next = s;
+  } else {
+    head_ = s;
+  }
+  tail_ = s;
+  // full barrier, the select polls its cases after this.
+  atomic::Inc32(&nwait_, 1);
+}
+
+void SelectWaitQueue::Remove(runtime::Sudog* s) {
+  runtime::RawMutexGuard guard(&lock_);
+  if (s->next != NULL) {
+    s->next->prev = s->prev;
+  } else {
+    tail_ = s->prev;
+  }
+  if (s->prev != NULL) {
+    s->prev->next = s->next;
+  } else {
+    head_ = s->next;
+  }
+  s->next = NULL;
+  s->prev = NULL;
+  atomic::Inc32(&nwait_, -1);
+}
+
+void SelectWaitQueue::Wake(bool all) {
+  runtime::Sudog* won = NULL;
+  {
+    runtime::RawMutexGuard guard(&lock_);
+    for (runtime::Sudog* s = head_; s != NULL; s = s->next) {
+      // selects already decided stay queued until their owner removes
+      // them, skip those.
+      if (!atomic::cas32(s->selectdone, 0, 1))
+        continue;
+      s->wakedup = 1;
+      s->waitlink = won;
+      won = s;
+      if (!all)
+        break;
+    }
+  }
+  // a select frees its sudogs once its semaphore is released, read the
+  // link first.
+  while (won != NULL) {
+    runtime::Sudog* next = won->waitlink;
+    runtime::SemRelease(won->address);
+    won = next;
+  }
+}
+
+}  // namespace tin
@@ -0,0 +1,45 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include "base/basictypes.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/semaphore.h"
+
+namespace tin {
+
+// selects waiting for one direction of a channel. every case of a select
+// enqueues its own Sudog, they share selectdone and park on the semaphore
+// at address, so whoever flips selectdone first wakes the select.
+class SelectWaitQueue {
+ public:
+  SelectWaitQueue();
+  ~SelectWaitQueue();
+
+  void Enqueue(runtime::Sudog* s);
+  void Remove(runtime::Sudog* s);
+
+  // called after the channel changed, a single load if nobody selects.
+  void WakeOne() {
+    if (atomic::load32(&nwait_) != 0)
+      Wake(false);
+  }
+
+  void WakeAll() {
+    if (atomic::load32(&nwait_) != 0)
+      Wake(true);
+  }
+
+ private:
+  void Wake(bool all);
+
+  runtime::RawMutex lock_;
+  runtime::Sudog* head_;
+  runtime::Sudog* tail_;
+  uint32 nwait_;  // read w/o the lock.
+  DISALLOW_COPY_AND_ASSIGN(SelectWaitQueue);
+};
+
+}  // namespace tin
@@ -0,0 +1,160 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stddef.h>
+
+#include "base/basictypes.h"
+#include "base/memory/scoped_ptr.h"
+#include "tin/sync/mutex.h"
+#include "tin/net/poll_desc.h"
+#include "tin/net/unix_conn.h"
+
+namespace tin {
+
+// a bounded ring in memory shared between processes on one host, say one
+// process per numa node and its sidecars, where loopback tcp costs tens of
+// micro seconds a message. cells carry a sequence number like MpmcRing,
+// so any number of processes and greenlets may push and pop. a side that
+// finds the ring empty or full counts itself in the shared header and
+// parks in netpoll on a wake descriptor, a semaphore eventfd on linux and
+// a pipe else. the other side posts a token for each counted one, and
+// only then makes a syscall, so a busy channel makes none.
+//
+// the memory and the descriptors are anonymous, the creator hands them to
+// a peer over a unix socket, see Send and Receive. posix only, the peers
+// must have the same pointer size. a peer that dies leaves the ring as it
+// was, it is not noticed.
+class ShmRing {
+ public:
+  // capacity is rounded up to a power of 2, slots are slot_size bytes.
+  // NULL on error, see tin::GetErrorCode().
+  static ShmRing* Create(uint32 capacity, uint32 slot_size);
+
+  // maps the ring a peer passed with Send over conn. slot_size must be the
+  // one it was created with.
+  static ShmRing* Receive(const net::UnixConn& conn, uint32 slot_size);
+
+  // unmaps and closes the descriptors, the peers keep the ring.
+  ~ShmRing();
+
+  // passes the ring to the process calling Receive at the other end of
+  // conn, this one keeps using it as well.
+  bool Send(const net::UnixConn& conn);
+
+  // copy slot_size bytes, parking while the ring is full or empty. false
+  // once the ring is closed, Pop drains what is left first.
+  bool Push(const void* data);
+  bool Pop(void* data);
+
+  // never park. TryPush is false if the ring is full or closed, TryPop
+  // if it is empty.
+  bool TryPush(const void* data);
+  bool TryPop(void* data);
+
+  // closes the ring for every process, the parked sides are woken.
+  void Close();
+  bool IsClosed();
+
+  uint32 SlotSize() const {
+    return slot_size_;
+  }
+
+ private:
+  struct Header;
+
+  // a descriptor to park on, written to wake the parked.
+  struct Wake {
+    Wake()
+      : rfd(-1)
+      , wfd(-1) {
+    }
+
+    int rfd;
+    int wfd;
+    net::PollDesc pd;
+  };
+
+  ShmRing();
+
+  // takes over the descriptors, closed on failure. create lays out an
+  // empty ring of capacity slots.
+  static ShmRing* Map(int shm_fd, const int* wake_fds, uint32 slot_size,
+                      uint32 capacity, bool create);
+  char* Cell(uintptr_t pos) const;
+  // parks on wake until a token is posted, false once closed.
+  bool Await(Wake* wake);
+  // posts a token for every side *waiting counts.
+  void Signal(Wake* wake, int32* waiting);
+  static bool TakeToken(Wake* wake);
+  static void PostTokens(Wake* wake, int32 n);
+
+  Header* header_;
+  size_t length_;
+  uint32 slot_size_;
+  uint32 stride_;
+  uintptr_t mask_;
+  int shm_fd_;
+  // filled slots, and free ones.
+  Wake data_;
+  Wake space_;
+  // one greenlet at a time parks on a descriptor.
+  Mutex push_mu_;
+  Mutex pop_mu_;
+  DISALLOW_COPY_AND_ASSIGN(ShmRing);
+};
+
+// a Channel of trivially copyable T, say fixed size structs without
+// pointers, between processes. T is copied bytewise.
+template <class T>
+class ShmChannel {
+ public:
+  static ShmChannel* Create(uint32 capacity) {
+    ShmRing* ring = ShmRing::Create(capacity, sizeof(T));
+    return ring != NULL ? new ShmChannel(ring) : NULL;
+  }
+
+  static ShmChannel* Receive(const net::UnixConn& conn) {
+    ShmRing* ring = ShmRing::Receive(conn, sizeof(T));
+    return ring != NULL ? new ShmChannel(ring) : NULL;
+  }
+
+  bool Send(const net::UnixConn& conn) {
+    return ring_->Send(conn);
+  }
+
+  bool Push(const T& t) {
+    return ring_->Push(&t);
+  }
+
+  bool Pop(T* t) {
+    return ring_->Pop(t);
+  }
+
+  bool TryPush(const T& t) {
+    return ring_->TryPush(&t);
+  }
+
+  bool TryPop(T* t) {
+    return ring_->TryPop(t);
+  }
+
+  void Close() {
+    ring_->Close();
+  }
+
+  bool IsClosed() {
+    return ring_->IsClosed();
+  }
+
+ private:
+  explicit ShmChannel(ShmRing* ring)
+    : ring_(ring) {
+  }
+
+  scoped_ptr<ShmRing> ring_;
+  DISALLOW_COPY_AND_ASSIGN(ShmChannel);
+};
+
+}  // namespace tin
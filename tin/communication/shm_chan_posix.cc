@@ -0,0 +1,407 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "build/build_config.h"
+
+#if defined(OS_LINUX)
+#include <sys/eventfd.h>
+#endif
+
+#include <string>
+
+#include "base/posix/eintr_wrapper.h"
+#include "base/rand_util.h"
+#include "base/strings/string_number_conversions.h"
+#include "tin/error/error.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/posix_util.h"
+#include "tin/net/netfd_common.h"
+
+#include "tin/communication/shm_chan.h"
+
+namespace tin {
+
+namespace {
+
+const uint32 kShmMagic = 0x74696e72;  // "tinr"
+const size_t kShmCacheLineSize = 64;
+// the shared memory, then the read and write ends of data_ and space_.
+const int kShmFds = 5;
+
+inline size_t AlignUp(size_t n, size_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+void SetSysError() {
+  SetErrorCode(TinTranslateSysError(errno));
+}
+
+void CloseFds(const int* fds, int n) {
+  for (int i = 0; i < n; ++i) {
+    if (fds[i] >= 0)
+      close(fds[i]);
+  }
+}
+
+// *rfd is polled for tokens, *wfd posts them.
+bool NewWakeFds(int* rfd, int* wfd) {
+#if defined(OS_LINUX)
+  // a read takes one token, like a Semaphore.
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+  if (fd == -1)
+    return false;
+  *rfd = fd;
+  *wfd = dup(fd);
+  if (*wfd == -1) {
+    close(fd);
+    return false;
+  }
+  Cloexec(*wfd, true);
+#else
+  int fds[2];
+  if (pipe(fds) == -1)
+    return false;
+  for (int i = 0; i < 2; ++i) {
+    Nonblock(fds[i], true);
+    Cloexec(fds[i], true);
+  }
+  *rfd = fds[0];
+  *wfd = fds[1];
+#endif
+  return true;
+}
+
+}  // namespace
+
+struct ShmRing::Header {
+  uint32 magic;
+  uint32 pointer_size;
+  uint32 capacity;
+  uint32 slot_size;
+  int32 closed;
+  char pad0[kShmCacheLineSize];
+  uintptr_t head;
+  char pad1[kShmCacheLineSize - sizeof(uintptr_t)];
+  uintptr_t tail;
+  char pad2[kShmCacheLineSize - sizeof(uintptr_t)];
+  // the sides about to park on data_ and space_, over all processes.
+  int32 pop_waiting;
+  int32 push_waiting;
+  char pad3[kShmCacheLineSize - 2 * sizeof(int32)];
+};
+
+ShmRing::ShmRing()
+  : header_(NULL)
+  , length_(0)
+  , slot_size_(0)
+  , stride_(0)
+  , mask_(0)
+  , shm_fd_(-1) {
+}
+
+ShmRing::~ShmRing() {
+  Wake* wakes[2] = {&data_, &space_};
+  for (int i = 0; i < 2; ++i) {
+    wakes[i]->pd.Close();
+    if (wakes[i]->rfd >= 0)
+      close(wakes[i]->rfd);
+    if (wakes[i]->wfd >= 0)
+      close(wakes[i]->wfd);
+  }
+  if (header_ != NULL)
+    munmap(header_, length_);
+  if (shm_fd_ >= 0)
+    close(shm_fd_);
+}
+
+ShmRing* ShmRing::Create(uint32 capacity, uint32 slot_size) {
+  if (slot_size == 0 || capacity == 0 || capacity > (1U << 30)) {
+    SetErrorCode(TIN_EINVAL);
+    return NULL;
+  }
+  uint32 cap = 2;
+  while (cap < capacity)
+    cap <<= 1;
+  // unlinked at once, the descriptor is all that names it.
+  std::string name = "/tin-shm-" + base::IntToString(getpid()) + "-" +
+                     base::Uint64ToString(base::RandUint64());
+  int shm_fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (shm_fd == -1) {
+    SetSysError();
+    return NULL;
+  }
+  shm_unlink(name.c_str());
+  Cloexec(shm_fd, true);
+  int fds[kShmFds - 1] = {-1, -1, -1, -1};
+  if (!NewWakeFds(&fds[0], &fds[1]) || !NewWakeFds(&fds[2], &fds[3])) {
+    SetSysError();
+    CloseFds(fds, kShmFds - 1);
+    close(shm_fd);
+    return NULL;
+  }
+  return Map(shm_fd, fds, slot_size, cap, true);
+}
+
+ShmRing* ShmRing::Receive(const net::UnixConn& conn, uint32 slot_size) {
+  int32 n = 0;
+  int got = 0;
+  int fds[net::kMaxPassedFds];
+  int nfds = 0;
+  // the descriptors come with the first byte of the count.
+  while (got < static_cast<int>(sizeof(n))) {
+    int more = 0;
+    got += conn->ReadFds(reinterpret_cast<char*>(&n) + got,
+                         sizeof(n) - got, fds + nfds,
+                         net::kMaxPassedFds - nfds, &more);
+    nfds += more;
+    if (ErrorOccured()) {
+      CloseFds(fds, nfds);
+      return NULL;
+    }
+  }
+  if (n != kShmFds || nfds != kShmFds) {
+    CloseFds(fds, nfds);
+    SetErrorCode(TIN_EBADPROTOCOL);
+    return NULL;
+  }
+  return Map(fds[0], fds + 1, slot_size, 0, false);
+}
+
+ShmRing* ShmRing::Map(int shm_fd, const int* wake_fds, uint32 slot_size,
+                      uint32 capacity, bool create) {
+  scoped_ptr<ShmRing> ring(new ShmRing);
+  ring->shm_fd_ = shm_fd;
+  ring->data_.rfd = wake_fds[0];
+  ring->data_.wfd = wake_fds[1];
+  ring->space_.rfd = wake_fds[2];
+  ring->space_.wfd = wake_fds[3];
+  ring->slot_size_ = slot_size;
+  // the sequence, then the payload, 8 byte aligned.
+  ring->stride_ = static_cast<uint32>(
+      AlignUp(sizeof(uintptr_t) + slot_size, sizeof(uint64)));
+  size_t cells = AlignUp(sizeof(Header), kShmCacheLineSize);
+  if (create) {
+    ring->length_ = cells + static_cast<size_t>(capacity) * ring->stride_;
+    if (HANDLE_EINTR(ftruncate(shm_fd, ring->length_)) == -1) {
+      SetSysError();
+      return NULL;
+    }
+  } else {
+    struct stat st;
+    if (fstat(shm_fd, &st) == -1) {
+      SetSysError();
+      return NULL;
+    }
+    ring->length_ = static_cast<size_t>(st.st_size);
+    if (ring->length_ < cells) {
+      SetErrorCode(TIN_EBADPROTOCOL);
+      return NULL;
+    }
+  }
+  void* p = mmap(NULL, ring->length_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 shm_fd, 0);
+  if (p == MAP_FAILED) {
+    SetSysError();
+    return NULL;
+  }
+  Header* header = static_cast<Header*>(p);
+  ring->header_ = header;
+  if (create) {
+    // ftruncate zero filled the rest.
+    header->pointer_size = sizeof(uintptr_t);
+    header->capacity = capacity;
+    header->slot_size = slot_size;
+    for (uintptr_t i = 0; i < capacity; ++i) {
+      uintptr_t* seq = reinterpret_cast<uintptr_t*>(
+          static_cast<char*>(p) + cells + i * ring->stride_);
+      *seq = i;
+    }
+    atomic::release_store32(&header->magic, kShmMagic);
+  } else {
+    capacity = header->capacity;
+    if (atomic::acquire_load32(&header->magic) != kShmMagic ||
+        header->pointer_size != sizeof(uintptr_t) ||
+        header->slot_size != slot_size || capacity < 2 ||
+        (capacity & (capacity - 1)) != 0 ||
+        ring->length_ < cells + static_cast<size_t>(capacity) * ring->stride_) {
+      SetErrorCode(TIN_EBADPROTOCOL);
+      return NULL;
+    }
+  }
+  ring->mask_ = capacity - 1;
+  int err = ring->data_.pd.Init(ring->data_.rfd);
+  if (err == 0)
+    err = ring->space_.pd.Init(ring->space_.rfd);
+  if (err != 0) {
+    SetErrorCode(TinTranslateSysError(err));
+    return NULL;
+  }
+  SetErrorCode(0);
+  return ring.release();
+}
+
+bool ShmRing::Send(const net::UnixConn& conn) {
+  int32 n = kShmFds;
+  int fds[kShmFds] = {
+    shm_fd_, data_.rfd, data_.wfd, space_.rfd, space_.wfd
+  };
+  conn->WriteFds(&n, sizeof(n), fds, kShmFds);
+  return !ErrorOccured();
+}
+
+char* ShmRing::Cell(uintptr_t pos) const {
+  return reinterpret_cast<char*>(header_) +
+         AlignUp(sizeof(Header), kShmCacheLineSize) +
+         (pos & mask_) * stride_;
+}
+
+bool ShmRing::TryPush(const void* data) {
+  if (IsClosed())
+    return false;
+  uintptr_t pos = atomic::relaxed_load(&header_->tail);
+  char* cell = NULL;
+  while (true) {
+    cell = Cell(pos);
+    uintptr_t seq = atomic::acquire_load(reinterpret_cast<uintptr_t*>(cell));
+    intptr_t diff = static_cast<intptr_t>(seq - pos);
+    if (diff == 0) {
+      if (atomic::cas(&header_->tail, pos, pos + 1))
+        break;
+      pos = atomic::relaxed_load(&header_->tail);
+    } else if (diff < 0) {
+      return false;  // full.
+    } else {
+      pos = atomic::relaxed_load(&header_->tail);
+    }
+  }
+  memcpy(cell + sizeof(uintptr_t), data, slot_size_);
+  atomic::release_store(reinterpret_cast<uintptr_t*>(cell), pos + 1);
+  Signal(&data_, &header_->pop_waiting);
+  return true;
+}
+
+bool ShmRing::TryPop(void* data) {
+  uintptr_t pos = atomic::relaxed_load(&header_->head);
+  char* cell = NULL;
+  while (true) {
+    cell = Cell(pos);
+    uintptr_t seq = atomic::acquire_load(reinterpret_cast<uintptr_t*>(cell));
+    intptr_t diff = static_cast<intptr_t>(seq - (pos + 1));
+    if (diff == 0) {
+      if (atomic::cas(&header_->head, pos, pos + 1))
+        break;
+      pos = atomic::relaxed_load(&header_->head);
+    } else if (diff < 0) {
+      return false;  // empty.
+    } else {
+      pos = atomic::relaxed_load(&header_->head);
+    }
+  }
+  memcpy(data, cell + sizeof(uintptr_t), slot_size_);
+  atomic::release_store(reinterpret_cast<uintptr_t*>(cell), pos + mask_ + 1);
+  Signal(&space_, &header_->push_waiting);
+  return true;
+}
+
+bool ShmRing::Push(const void* data) {
+  if (TryPush(data))
+    return true;
+  MutexGuard guard(&push_mu_);
+  while (!TryPush(data)) {
+    if (IsClosed())
+      return false;
+    // counted before the check again, a Pop after it sees the count.
+    atomic::Inc32(&header_->push_waiting, 1);
+    if (TryPush(data))
+      return true;
+    if (!Await(&space_))
+      return false;
+  }
+  return true;
+}
+
+bool ShmRing::Pop(void* data) {
+  if (TryPop(data))
+    return true;
+  MutexGuard guard(&pop_mu_);
+  while (!TryPop(data)) {
+    if (IsClosed())
+      return false;
+    atomic::Inc32(&header_->pop_waiting, 1);
+    if (TryPop(data))
+      return true;
+    if (!Await(&data_))
+      return false;
+  }
+  return true;
+}
+
+void ShmRing::Close() {
+  if (atomic::exchange32(&header_->closed, 1) != 0)
+    return;
+  Signal(&data_, &header_->pop_waiting);
+  Signal(&space_, &header_->push_waiting);
+}
+
+bool ShmRing::IsClosed() {
+  return atomic::acquire_load32(&header_->closed) != 0;
+}
+
+bool ShmRing::Await(Wake* wake) {
+  if (wake->pd.PrepareRead() != 0)
+    return false;
+  // a count left by a side that did not park leaves a stale token, it
+  // only costs a check of the ring.
+  while (!TakeToken(wake)) {
+    if (IsClosed() || wake->pd.WaitRead() != 0)
+      return false;
+  }
+  return true;
+}
+
+void ShmRing::Signal(Wake* wake, int32* waiting) {
+  // the full barrier of load orders it after the push or pop.
+  if (atomic::load32(waiting) == 0)
+    return;
+  int32 n = atomic::exchange32(waiting, 0);
+  if (n > 0)
+    PostTokens(wake, n);
+}
+
+bool ShmRing::TakeToken(Wake* wake) {
+#if defined(OS_LINUX)
+  uint64 v;
+  return HANDLE_EINTR(read(wake->rfd, &v, sizeof(v))) == sizeof(v);
+#else
+  char c;
+  return HANDLE_EINTR(read(wake->rfd, &c, 1)) == 1;
+#endif
+}
+
+void ShmRing::PostTokens(Wake* wake, int32 n) {
+#if defined(OS_LINUX)
+  uint64 v = static_cast<uint64>(n);
+  HANDLE_EINTR(write(wake->wfd, &v, sizeof(v)));
+#else
+  // a full pipe holds tokens enough.
+  char buf[64];
+  memset(buf, 0, sizeof(buf));
+  while (n > 0) {
+    int k = n < static_cast<int32>(sizeof(buf)) ? n : sizeof(buf);
+    if (HANDLE_EINTR(write(wake->wfd, buf, k)) != k)
+      return;
+    n -= k;
+  }
+#endif
+}
+
+}  // namespace tin
@@ -4,12 +4,15 @@
 
 #pragma once
 
+#include "base/basictypes.h"
 #include "tin/config/default.h"
 
 namespace tin {
 
 class Config {
  public:
+  // 1 by default. 0 runs as many Ps as the process may use cpus, a cgroup
+  // cpu quota counts. SetMaxProcs of tin changes it at runtime.
   int MaxProcs() const {
     return max_procs_;
   }
@@ -51,6 +54,201 @@ class Config {
     max_machine_ = max_machine;
   }
 
+  int RunqCapacity() const {
+    return runq_capacity_;
+  }
+
+  void SetRunqCapacity(int capacity) {
+    runq_capacity_ = capacity;
+  }
+
+  // rounds of stealing inside the NUMA node before a spinning M steals
+  // from other nodes, 0 - 3.
+  int StealBackoffRounds() const {
+    return steal_backoff_rounds_;
+  }
+
+  void SetStealBackoffRounds(int rounds) {
+    steal_backoff_rounds_ = rounds;
+  }
+
+  // bit i set means cpu i may be used. when not 0, P slot n is bound to the
+  // n-th cpu of mask (wrapping), and M threads follow the P they run.
+  uint64 CpuAffinity() const {
+    return cpu_affinity_;
+  }
+
+  void SetCpuAffinity(uint64 mask) {
+    cpu_affinity_ = mask;
+  }
+
+  // deadline APIs count from CoarseNow() instead of MonoNow(), deadlines
+  // may then be off by up to a sysmon tick.
+  bool IsCoarseDeadlineEnabled() const {
+    return enable_coarse_deadline_;
+  }
+
+  void EnableCoarseDeadline(bool enable) {
+    enable_coarse_deadline_ = enable;
+  }
+
+  // events fetched by one epoll_wait per poller shard, or completions by
+  // one GetQueuedCompletionStatusEx on windows.
+  int NetPollBatch() const {
+    return netpoll_batch_;
+  }
+
+  void SetNetPollBatch(int batch) {
+    netpoll_batch_ = batch;
+  }
+
+  // spinning Ms keep polling the network this long before they park,
+  // 0 disables busy polling.
+  int NetPollBusyPollUs() const {
+    return netpoll_busy_poll_us_;
+  }
+
+  void SetNetPollBusyPollUs(int us) {
+    netpoll_busy_poll_us_ = us;
+  }
+
+  // a spinning M keeps looking for work this long before it parks, saves
+  // the futex sleep and wakeup when work comes in at a high rate. 0 parks
+  // after one round of stealing.
+  int MSpinUs() const {
+    return m_spin_us_;
+  }
+
+  void SetMSpinUs(int us) {
+    m_spin_us_ = us;
+  }
+
+  // a P blocked in a syscall or BlockingSection is handed to another M
+  // only after this long, even if greenlets wait for it.
+  int SyscallRetakeUs() const {
+    return syscall_retake_us_;
+  }
+
+  void SetSyscallRetakeUs(int us) {
+    syscall_retake_us_ = us;
+  }
+
+  // tin::Overloaded holds while the p99 delay from runnable to running of
+  // the last sysmon interval is above it. needs EnableSchedLatency, 0 is
+  // off.
+  int OverloadDelayUs() const {
+    return overload_delay_us_;
+  }
+
+  void SetOverloadDelayUs(int us) {
+    overload_delay_us_ = us;
+  }
+
+  // ... or while more than it runnable greenlets queue per P, 0 is off.
+  int OverloadRunqDepth() const {
+    return overload_runq_depth_;
+  }
+
+  void SetOverloadRunqDepth(int depth) {
+    overload_runq_depth_ = depth;
+  }
+
+  // sysmon logs a warning when a timer fired later than this after its
+  // when, see GetTimerLagStats. at most once a second, 0 is off.
+  int TimerLagWarnMs() const {
+    return timer_lag_warn_ms_;
+  }
+
+  void SetTimerLagWarnMs(int ms) {
+    timer_lag_warn_ms_ = ms;
+  }
+
+  // ... and when no netpoll ran for longer than this, see
+  // GetNetPollGapStats.
+  int NetPollGapWarnMs() const {
+    return netpoll_gap_warn_ms_;
+  }
+
+  void SetNetPollGapWarnMs(int ms) {
+    netpoll_gap_warn_ms_ = ms;
+  }
+
+  // TCP_FASTOPEN queue length set on listening sockets where supported,
+  // 0 leaves fast open off. the kernel must allow server side fast open,
+  // see net.ipv4.tcp_fastopen on linux.
+  int TcpFastOpenQueue() const {
+    return tcp_fastopen_queue_;
+  }
+
+  void SetTcpFastOpenQueue(int qlen) {
+    tcp_fastopen_queue_ = qlen;
+  }
+
+  // seconds a listening socket holds a new connection back until the
+  // client sends, so Accept and the handler greenlet skip the ones that
+  // never do. TCP_DEFER_ACCEPT on linux, the dataready accept filter on
+  // freebsd, 0 leaves it off. not for protocols where the server speaks
+  // first.
+  int TcpDeferAcceptSec() const {
+    return tcp_defer_accept_sec_;
+  }
+
+  void SetTcpDeferAcceptSec(int sec) {
+    tcp_defer_accept_sec_ = sec;
+  }
+
+  // SO_BUSY_POLL set on new sockets where supported, 0 leaves it alone.
+  int SocketBusyPollUs() const {
+    return socket_busy_poll_us_;
+  }
+
+  void SetSocketBusyPollUs(int us) {
+    socket_busy_poll_us_ = us;
+  }
+
+  // windows only, AcceptEx operations kept outstanding on a listening
+  // socket, each with a socket created up front. 0 or 1 posts one AcceptEx
+  // per Accept call.
+  int AcceptExPosted() const {
+    return acceptex_posted_;
+  }
+
+  void SetAcceptExPosted(int n) {
+    acceptex_posted_ = n;
+  }
+
+  // windows only, reads and writes of tcp connections go through
+  // Registered I/O: copies through pre-registered buffers, per P
+  // completion queues drained by the poller in batches. falls back to
+  // overlapped io where RIO is missing (before windows 8).
+  bool IsRioEnabled() const {
+    return enable_rio_;
+  }
+
+  void EnableRio(bool enable) {
+    enable_rio_ = enable;
+  }
+
+  // linux only, submit socket reads, writes and accepts through io_uring,
+  // falls back to epoll readiness if the kernel lacks it.
+  bool IsIoUringEnabled() const {
+    return enable_io_uring_;
+  }
+
+  void EnableIoUring(bool enable) {
+    enable_io_uring_ = enable;
+  }
+
+  // resolve names with the built in UDP client on the netpoller, with a
+  // TTL cache. names that need local resolution still get getaddrinfo.
+  bool IsDnsClientEnabled() const {
+    return enable_dns_client_;
+  }
+
+  void EnableDnsClient(bool enable) {
+    enable_dns_client_ = enable;
+  }
+
   bool IsStackProtectionEnabled() const {
     return enable_stack_protection_;
   }
@@ -59,13 +257,166 @@ class Config {
     enable_stack_protection_ = enable;
   }
 
+  // reserve StackSize() of address space per greenlet, commit on demand.
+  bool IsLazyStackEnabled() const {
+    return enable_lazy_stack_;
+  }
+
+  void EnableLazyStack(bool enable) {
+    enable_lazy_stack_ = enable;
+  }
+
+  // release physical stack pages of greenlets parked on network IO.
+  bool IsIdleStackReleaseEnabled() const {
+    return enable_idle_stack_release_;
+  }
+
+  void EnableIdleStackRelease(bool enable) {
+    enable_idle_stack_release_ = enable;
+  }
+
+  // time greenlets wait between becoming runnable and running, see
+  // GetSchedLatencyStats. costs a clock read per wakeup, has to be set
+  // before the runtime starts.
+  bool IsSchedLatencyEnabled() const {
+    return enable_sched_latency_;
+  }
+
+  void EnableSchedLatency(bool enable) {
+    enable_sched_latency_ = enable;
+  }
+
+  // SIGQUIT writes DumpGreenlets to stderr instead of killing the process.
+  // posix only.
+  bool IsSigquitDumpEnabled() const {
+    return enable_sigquit_dump_;
+  }
+
+  void EnableSigquitDump(bool enable) {
+    enable_sigquit_dump_ = enable;
+  }
+
+  // paints new stacks with a canary and measures how deep they were used
+  // at greenlet exit, see GetStackUsageStats. painting commits every page
+  // of a lazy stack and idle stacks are not released meanwhile. has to be
+  // set before the runtime starts.
+  // greenlet stacks of 8 KiB to 1 MiB and the pooled io buffers come from
+  // 2 MiB huge page arenas, explicit huge pages if the OS has some
+  // reserved, transparent ones else. cuts TLB misses of many stacks, but
+  // only the ends of an arena are guarded and the arenas are never
+  // unmapped. has to be set before the runtime starts.
+  bool IsHugePagesEnabled() const {
+    return enable_huge_pages_;
+  }
+
+  void EnableHugePages(bool enable) {
+    enable_huge_pages_ = enable;
+  }
+
+  // bytes all greenlet stacks may take together, 0 is no limit. a spawn
+  // needing a new stack beyond it waits until an exited greenlet's stack
+  // can be reused or the budget has room again. spawns that can not wait,
+  // from g0 or tin::Post, go over it.
+  int64 StackBudget() const {
+    return stack_budget_;
+  }
+
+  void SetStackBudget(int64 bytes) {
+    stack_budget_ = bytes;
+  }
+
+  // over the budget, spawns fail with TIN_ENOMEM instead of waiting.
+  // joinable ones still wait, they can not fail.
+  bool IsStackBudgetFailFastEnabled() const {
+    return enable_stack_budget_fail_fast_;
+  }
+
+  void EnableStackBudgetFailFast(bool enable) {
+    enable_stack_budget_fail_fast_ = enable;
+  }
+
+  bool IsStackHighWaterEnabled() const {
+    return enable_stack_high_water_;
+  }
+
+  void EnableStackHighWater(bool enable) {
+    enable_stack_high_water_ = enable;
+  }
+
+  // thread per core: every greenlet stays on the P it was spawned on, Ps
+  // never steal from each other and keep their M through all but stuck
+  // syscalls. work moves between Ps by tin::SendTo. pair with
+  // SetCpuAffinity.
+  bool IsSharedNothingEnabled() const {
+    return enable_shared_nothing_;
+  }
+
+  void EnableSharedNothing(bool enable) {
+    enable_shared_nothing_ = enable;
+  }
+
+  // bytes of the log ring of each M, 0 logs synchronously. base logging
+  // then only queues the message, an OS thread writes it to stderr, and
+  // a full ring drops it. stderr whatever logging::InitLogging was given,
+  // leave it 0 when base logging goes to a file. see
+  // tin/runtime/async_log.h.
+  int AsyncLogBufferSize() const {
+    return async_log_buffer_size_;
+  }
+
+  void SetAsyncLogBufferSize(int bytes) {
+    async_log_buffer_size_ = bytes;
+  }
+
+  // before TinMain runs, every P gets an M, n greenlets with stacks of the
+  // default size are made and exit into the free pools, n poll descriptors
+  // are cached and the netpoller is started. 0 leaves all of it to the
+  // first use, as it starts faster.
+  int PrewarmGreenlets() const {
+    return prewarm_greenlets_;
+  }
+
+  void SetPrewarmGreenlets(int n) {
+    prewarm_greenlets_ = n;
+  }
+
  private:
   int max_procs_;
   int max_machine_;
   int stack_size_;
   int os_thread_stack_size_;
+  int runq_capacity_;
+  int steal_backoff_rounds_;
+  uint64 cpu_affinity_;
+  int64 stack_budget_;
+  int netpoll_batch_;
+  int netpoll_busy_poll_us_;
+  int m_spin_us_;
+  int syscall_retake_us_;
+  int overload_delay_us_;
+  int overload_runq_depth_;
+  int timer_lag_warn_ms_;
+  int netpoll_gap_warn_ms_;
+  int socket_busy_poll_us_;
+  int tcp_fastopen_queue_;
+  int tcp_defer_accept_sec_;
+  int acceptex_posted_;
+  int async_log_buffer_size_;
+  int prewarm_greenlets_;
   bool ignore_sigpipe_;
   bool enable_stack_protection_;
+  bool enable_lazy_stack_;
+  bool enable_idle_stack_release_;
+  bool enable_coarse_deadline_;
+  bool enable_io_uring_;
+  bool enable_rio_;
+  bool enable_dns_client_;
+  bool enable_sched_latency_;
+  bool enable_sigquit_dump_;
+  bool enable_stack_high_water_;
+  bool enable_huge_pages_;
+  bool enable_shared_nothing_;
+  bool enable_stack_budget_fail_fast_;
 };
 
 }  // namespace tin
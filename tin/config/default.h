@@ -12,6 +12,12 @@ const int kStackAllignment = 64;
 
 const int kDefaultOSThreadStackSize = 640 * 1024;
 
+// slots of the per-P local run queue, rounded up to power of 2.
+const int kDefaultRunqCapacity = 256;
+
+// events fetched by one epoll_wait.
+const int kDefaultNetPollBatch = 128;
+
 #define CACHELINE_SIZE 64;
 
 }  // namespace tin
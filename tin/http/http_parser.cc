@@ -0,0 +1,400 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+
+#include "tin/http/http_parser.h"
+
+namespace tin {
+namespace http {
+
+namespace {
+
+// larger chunks are surely an attack.
+const int64 kMaxChunkSize = static_cast<int64>(1) << 40;
+
+inline char ToLower(char c) {
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool EqualsIgnoreCase(const base::StringPiece& a, const base::StringPiece& b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (ToLower(a[i]) != ToLower(b[i]))
+      return false;
+  }
+  return true;
+}
+
+base::StringPiece TrimSpace(base::StringPiece s) {
+  while (!s.empty() && (s[0] == ' ' || s[0] == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s[s.size() - 1] == ' ' || s[s.size() - 1] == '\t'))
+    s.remove_suffix(1);
+  return s;
+}
+
+// token is in the comma separated list, e.g. Connection: keep-alive.
+bool HasToken(base::StringPiece list, const base::StringPiece& token) {
+  while (!list.empty()) {
+    size_t comma = list.find(',');
+    base::StringPiece item = TrimSpace(list.substr(0, comma));
+    if (EqualsIgnoreCase(item, token))
+      return true;
+    if (comma == base::StringPiece::npos)
+      break;
+    list.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+// the last transfer coding is chunked.
+bool EndsWithChunked(base::StringPiece list) {
+  size_t comma = list.rfind(',');
+  if (comma != base::StringPiece::npos)
+    list.remove_prefix(comma + 1);
+  return EqualsIgnoreCase(TrimSpace(list), "chunked");
+}
+
+bool IsTokenChar(char c) {
+  return c > ' ' && c < 0x7f && strchr("()<>@,;:\\\"/[]?={}", c) == NULL;
+}
+
+// one line without its CRLF or LF, *next is after it. false if there
+// is no line end before end.
+bool NextLine(const char* p, const char* end, base::StringPiece* line,
+              const char** next) {
+  const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+  if (nl == NULL)
+    return false;
+  *next = nl + 1;
+  if (nl > p && nl[-1] == '\r')
+    nl--;
+  *line = base::StringPiece(p, nl - p);
+  return true;
+}
+
+int ParseRequestLine(const base::StringPiece& line, HttpRequest* req) {
+  size_t sp1 = line.find(' ');
+  if (sp1 == base::StringPiece::npos || sp1 == 0)
+    return TIN_EBADPROTOCOL;
+  size_t sp2 = line.find(' ', sp1 + 1);
+  if (sp2 == base::StringPiece::npos || sp2 == sp1 + 1)
+    return TIN_EBADPROTOCOL;
+  req->method = line.substr(0, sp1);
+  for (size_t i = 0; i < req->method.size(); i++) {
+    if (!IsTokenChar(req->method[i]))
+      return TIN_EBADPROTOCOL;
+  }
+  req->target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  base::StringPiece version = line.substr(sp2 + 1);
+  if (version.size() != 8 || !version.starts_with("HTTP/1.") ||
+      (version[7] != '0' && version[7] != '1')) {
+    return TIN_EBADPROTOCOL;
+  }
+  req->minor_version = version[7] - '0';
+  return 0;
+}
+
+bool ParseContentLength(const base::StringPiece& value, int64* length) {
+  if (value.empty() || value.size() > 18)
+    return false;
+  int64 v = 0;
+  for (size_t i = 0; i < value.size(); i++) {
+    if (value[i] < '0' || value[i] > '9')
+      return false;
+    v = v * 10 + (value[i] - '0');
+  }
+  *length = v;
+  return true;
+}
+
+int HexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = ToLower(c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+inline void Rebase(base::StringPiece* s, const char* from, const char* to) {
+  if (s->data() != NULL)
+    *s = base::StringPiece(to + (s->data() - from), s->size());
+}
+
+// points the views of req at to, where the head moved from from.
+void RebaseRequest(HttpRequest* req, const char* from, const char* to) {
+  if (from == to)
+    return;
+  Rebase(&req->method, from, to);
+  Rebase(&req->target, from, to);
+  for (int i = 0; i < req->num_headers; i++) {
+    Rebase(&req->headers[i].name, from, to);
+    Rebase(&req->headers[i].value, from, to);
+  }
+}
+
+}  // namespace
+
+void HttpRequest::Clear() {
+  method.clear();
+  target.clear();
+  minor_version = 1;
+  num_headers = 0;
+  content_length = -1;
+  chunked = false;
+  keep_alive = false;
+  body.clear();
+  body_buffered = false;
+}
+
+base::StringPiece HttpRequest::Header(const base::StringPiece& name) const {
+  for (int i = 0; i < num_headers; i++) {
+    if (EqualsIgnoreCase(headers[i].name, name))
+      return headers[i].value;
+  }
+  return base::StringPiece();
+}
+
+int ParseRequestHead(const char* data, int len, HttpRequest* req) {
+  const char* p = data;
+  const char* end = data + len;
+  base::StringPiece line;
+  if (!NextLine(p, end, &line, &p))
+    return TIN_EBADPROTOCOL;
+  int err = ParseRequestLine(line, req);
+  if (err != 0)
+    return err;
+  req->keep_alive = req->minor_version == 1;
+  bool has_length = false;
+  while (true) {
+    if (!NextLine(p, end, &line, &p))
+      return TIN_EBADPROTOCOL;
+    if (line.empty())
+      break;
+    // obsolete line folding is not worth the trouble.
+    if (line[0] == ' ' || line[0] == '\t')
+      return TIN_EBADPROTOCOL;
+    size_t colon = line.find(':');
+    if (colon == base::StringPiece::npos || colon == 0)
+      return TIN_EBADPROTOCOL;
+    if (req->num_headers == kMaxHttpHeaders)
+      return TIN_ETOOLARGE;
+    HttpHeader* h = &req->headers[req->num_headers++];
+    h->name = line.substr(0, colon);
+    for (size_t i = 0; i < h->name.size(); i++) {
+      if (!IsTokenChar(h->name[i]))
+        return TIN_EBADPROTOCOL;
+    }
+    h->value = TrimSpace(line.substr(colon + 1));
+    if (EqualsIgnoreCase(h->name, "content-length")) {
+      int64 length = 0;
+      if (!ParseContentLength(h->value, &length) ||
+          (has_length && length != req->content_length)) {
+        return TIN_EBADPROTOCOL;
+      }
+      has_length = true;
+      req->content_length = length;
+    } else if (EqualsIgnoreCase(h->name, "transfer-encoding")) {
+      // anything but a final chunked can't be framed.
+      if (!EndsWithChunked(h->value))
+        return TIN_EBADPROTOCOL;
+      req->chunked = true;
+    } else if (EqualsIgnoreCase(h->name, "connection")) {
+      if (HasToken(h->value, "close"))
+        req->keep_alive = false;
+      else if (HasToken(h->value, "keep-alive"))
+        req->keep_alive = true;
+    }
+  }
+  if (req->chunked && has_length) {
+    // smuggling bait, the chunked framing wins and the connection ends.
+    req->content_length = -1;
+    req->keep_alive = false;
+  }
+  return 0;
+}
+
+HttpRequestReader::HttpRequestReader(tin::bufio::Reader* rd)
+  : rd_(rd)
+  , remaining_(0)
+  , chunked_(false)
+  , body_done_(true) {
+}
+
+int HttpRequestReader::ReadRequest(HttpRequest* req) {
+  req->Clear();
+  int err = SkipBody();
+  int head_len = 0;
+  if (err == 0)
+    err = FindHeadEnd(&head_len);
+  const char* head = reinterpret_cast<const char*>(rd_->begin());
+  if (err == 0)
+    err = ParseRequestHead(head, head_len, req);
+  if (err != 0) {
+    tin::SetErrorCode(err);
+    return err;
+  }
+  chunked_ = req->chunked;
+  remaining_ = chunked_ ? 0 : std::max<int64>(req->content_length, 0);
+  body_done_ = !chunked_ && remaining_ == 0;
+  if (!chunked_ && remaining_ > 0 &&
+      head_len + remaining_ <= rd_->buffer_size()) {
+    // the body fits too, may move the head in the buffer.
+    base::StringPiece all;
+    err = rd_->Peek(head_len + static_cast<int>(remaining_), &all);
+    if (err != 0) {
+      err = err == TIN_EOF ? TIN_UNEXPECTED_EOF : err;
+      tin::SetErrorCode(err);
+      return err;
+    }
+    RebaseRequest(req, head, all.data());
+    req->body = all.substr(head_len);
+    req->body_buffered = true;
+    rd_->Discard(static_cast<int>(all.size()));
+    remaining_ = 0;
+    body_done_ = true;
+  } else {
+    req->body_buffered = body_done_;
+    rd_->Discard(head_len);
+  }
+  tin::SetErrorCode(0);
+  return 0;
+}
+
+int HttpRequestReader::FindHeadEnd(int* head_len) {
+  int searched = 0;
+  while (true) {
+    const char* p = reinterpret_cast<const char*>(rd_->begin());
+    int n = rd_->buffered();
+    // empty lines before a request are allowed.
+    if (searched == 0 && n > 0 && (p[0] == '\r' || p[0] == '\n')) {
+      rd_->Discard(1);
+      continue;
+    }
+    const char* end = p + n;
+    const char* q = p + searched;
+    while ((q = static_cast<const char*>(memchr(q, '\n', end - q))) != NULL) {
+      if (q + 1 < end && q[1] == '\n') {
+        *head_len = static_cast<int>(q + 2 - p);
+        return 0;
+      }
+      if (q + 2 < end && q[1] == '\r' && q[2] == '\n') {
+        *head_len = static_cast<int>(q + 3 - p);
+        return 0;
+      }
+      q++;
+    }
+    // a line end at the tail is looked at again with more data.
+    searched = std::max(n - 2, 0);
+    if (n >= rd_->buffer_size())
+      return TIN_ETOOLARGE;
+    int err = rd_->Peek(n + 1, NULL);
+    if (err != 0)
+      return err == TIN_EOF && n > 0 ? TIN_UNEXPECTED_EOF : err;
+  }
+}
+
+int HttpRequestReader::Read(void* buf, int nbytes) {
+  int err = 0;
+  if (!body_done_ && chunked_ && remaining_ == 0)
+    err = ReadChunkSize();
+  if (err != 0 || body_done_) {
+    tin::SetErrorCode(err != 0 ? err : TIN_EOF);
+    return 0;
+  }
+  int want = static_cast<int>(std::min<int64>(nbytes, remaining_));
+  int n = rd_->Read(buf, want);
+  err = tin::GetErrorCode();
+  remaining_ -= n;
+  if (n > 0) {
+    err = 0;
+    if (remaining_ == 0) {
+      if (chunked_) {
+        // the CRLF after the chunk data.
+        base::StringPiece line;
+        err = rd_->ReadSlice('\n', &line);
+        if (err == 0 && line != "\r\n" && line != "\n")
+          err = TIN_EBADPROTOCOL;
+      } else {
+        body_done_ = true;
+      }
+    }
+  } else if (err == TIN_EOF || err == 0) {
+    err = TIN_UNEXPECTED_EOF;
+  }
+  tin::SetErrorCode(err);
+  return n;
+}
+
+int HttpRequestReader::ReadChunkSize() {
+  base::StringPiece line;
+  int err = rd_->ReadSlice('\n', &line);
+  if (err != 0)
+    return err == TIN_EOF ? TIN_UNEXPECTED_EOF :
+           err == TIN_EBUFFERFULL ? TIN_EBADPROTOCOL : err;
+  int64 size = 0;
+  size_t i = 0;
+  int digit;
+  for (; i < line.size() && (digit = HexValue(line[i])) >= 0; i++) {
+    size = size * 16 + digit;
+    if (size > kMaxChunkSize)
+      return TIN_EBADPROTOCOL;
+  }
+  // extensions after ';' are ignored.
+  if (i == 0 || (line[i] != ';' && line[i] != '\r' && line[i] != '\n'))
+    return TIN_EBADPROTOCOL;
+  if (size > 0) {
+    remaining_ = size;
+    return 0;
+  }
+  // the trailer section, up to an empty line.
+  while (true) {
+    err = rd_->ReadSlice('\n', &line);
+    if (err != 0)
+      return err == TIN_EOF ? TIN_UNEXPECTED_EOF : TIN_EBADPROTOCOL;
+    if (line == "\r\n" || line == "\n")
+      break;
+  }
+  body_done_ = true;
+  return 0;
+}
+
+int HttpRequestReader::SkipBody() {
+  while (!body_done_) {
+    if (remaining_ > 0) {
+      // Discard takes an int.
+      int skip = static_cast<int>(std::min<int64>(remaining_, kint32max));
+      int n = rd_->Discard(skip);
+      remaining_ -= n;
+      if (n != skip)
+        return TIN_UNEXPECTED_EOF;
+      if (remaining_ > 0)
+        continue;
+      if (!chunked_) {
+        body_done_ = true;
+        break;
+      }
+      base::StringPiece line;
+      int err = rd_->ReadSlice('\n', &line);
+      if (err != 0 || (line != "\r\n" && line != "\n"))
+        return TIN_EBADPROTOCOL;
+    }
+    int err = ReadChunkSize();
+    if (err != 0)
+      return err;
+  }
+  return 0;
+}
+
+}  // namespace http
+}  // namespace tin
@@ -0,0 +1,89 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+#include "base/strings/string_piece.h"
+#include "tin/io/io.h"
+#include "tin/bufio/bufio.h"
+
+namespace tin {
+namespace http {
+
+const int kMaxHttpHeaders = 64;
+
+struct HttpHeader {
+  base::StringPiece name;
+  base::StringPiece value;
+};
+
+// a parsed request head. every piece is a view into the bufio::Reader
+// buffer the request was read from, see HttpRequestReader.
+struct HttpRequest {
+  HttpRequest() {
+    Clear();
+  }
+
+  void Clear();
+
+  // the value of the first header called name, ignoring case, empty if
+  // there is none.
+  base::StringPiece Header(const base::StringPiece& name) const;
+
+  base::StringPiece method;
+  base::StringPiece target;
+  // 0 or 1, the x in HTTP/1.x.
+  int minor_version;
+  HttpHeader headers[kMaxHttpHeaders];
+  int num_headers;
+  // -1 without a Content-Length.
+  int64 content_length;
+  bool chunked;
+  // the connection may carry another request after this one.
+  bool keep_alive;
+  // the whole body when it was buffered with the head, else empty and
+  // the body is read with HttpRequestReader::ReadBody.
+  base::StringPiece body;
+  bool body_buffered;
+};
+
+// parses the head in data[0, len), which ends with the empty line.
+// return error code, TIN_EBADPROTOCOL for a malformed head and
+// TIN_ETOOLARGE for more than kMaxHttpHeaders.
+int ParseRequestHead(const char* data, int len, HttpRequest* req);
+
+// reads pipelined requests from a connection without copying or
+// allocating. the head is parsed where it sits in the reader buffer; a
+// body that fits the buffer too comes with it. the views stay valid
+// until the next ReadRequest, or until ReadBody reads past the buffer.
+class HttpRequestReader : public tin::io::Reader {
+ public:
+  explicit HttpRequestReader(tin::bufio::Reader* rd);
+
+  // skips what is left of the previous body first. return error code,
+  // TIN_EOF if the connection ended between requests, TIN_ETOOLARGE for
+  // a head that does not fit the buffer.
+  int ReadRequest(HttpRequest* req);
+
+  // the body of the current request, decoding chunked framing. returns
+  // bytes read, 0 with TIN_EOF at its end.
+  virtual int Read(void* buf, int nbytes);
+
+ private:
+  int FindHeadEnd(int* head_len);
+  int ReadChunkSize();
+  int SkipBody();
+
+  tin::bufio::Reader* rd_;
+  // body bytes left, of the current chunk if chunked.
+  int64 remaining_;
+  bool chunked_;
+  // the last chunk was read, or the body is done.
+  bool body_done_;
+  DISALLOW_COPY_AND_ASSIGN(HttpRequestReader);
+};
+
+}  // namespace http
+}  // namespace tin
@@ -0,0 +1,265 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+
+#include "base/bind.h"
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+
+#include "tin/http/http_server.h"
+
+namespace tin {
+namespace http {
+
+namespace {
+
+const char* StatusText(int status) {
+  switch (status) {
+    case 100: return "Continue";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+  }
+}
+
+// 1xx, 204 and 304 never have a body.
+bool StatusHasBody(int status) {
+  return status >= 200 && status != 204 && status != 304;
+}
+
+}  // namespace
+
+HttpResponseWriter::HttpResponseWriter(tin::bufio::BufferedWriter* wr)
+  : wr_(wr)
+  , status_(200)
+  , minor_version_(1)
+  , head_only_(false)
+  , keep_alive_(false)
+  , head_written_(false)
+  , chunked_(false)
+  , finished_(false)
+  , err_(0)
+  , num_headers_(0) {
+}
+
+void HttpResponseWriter::Reset(const HttpRequest& req, bool keep_alive) {
+  status_ = 200;
+  minor_version_ = req.minor_version;
+  head_only_ = req.method == "HEAD";
+  keep_alive_ = keep_alive;
+  head_written_ = false;
+  chunked_ = false;
+  finished_ = false;
+  num_headers_ = 0;
+}
+
+bool HttpResponseWriter::AddHeader(const base::StringPiece& name,
+                                   const base::StringPiece& value) {
+  DCHECK(!head_written_);
+  if (num_headers_ == kMaxHttpHeaders)
+    return false;
+  headers_[num_headers_].name = name;
+  headers_[num_headers_].value = value;
+  num_headers_++;
+  return true;
+}
+
+int HttpResponseWriter::Send(const base::StringPiece& body) {
+  DCHECK(!head_written_);
+  int err = WriteHead(static_cast<int64>(body.size()));
+  if (err == 0 && !head_only_ && StatusHasBody(status_))
+    err = WriteRaw(body);
+  finished_ = true;
+  return err;
+}
+
+int HttpResponseWriter::Write(const base::StringPiece& data) {
+  DCHECK(!finished_);
+  int err = head_written_ ? err_ : WriteHead(-1);
+  if (err != 0 || data.empty() || head_only_ || !StatusHasBody(status_))
+    return err;
+  if (!chunked_)
+    return WriteRaw(data);
+  char size[16];
+  int n = snprintf(size, sizeof(size), "%x\r\n",
+                   static_cast<unsigned>(data.size()));
+  err = WriteRaw(base::StringPiece(size, n));
+  if (err == 0)
+    err = WriteRaw(data);
+  if (err == 0)
+    err = WriteRaw("\r\n");
+  return err;
+}
+
+int HttpResponseWriter::Finish() {
+  if (finished_)
+    return err_;
+  finished_ = true;
+  if (!head_written_)
+    return WriteHead(0);
+  if (chunked_)
+    return WriteRaw("0\r\n\r\n");
+  return err_;
+}
+
+int HttpResponseWriter::WriteHead(int64 content_length) {
+  head_written_ = true;
+  // HTTP/1.0 has no chunks, the close ends the body.
+  if (content_length < 0 && minor_version_ == 0)
+    keep_alive_ = false;
+  chunked_ = content_length < 0 && minor_version_ == 1 &&
+             StatusHasBody(status_);
+  char line[128];
+  int n = snprintf(line, sizeof(line), "HTTP/1.%d %d %s\r\n",
+                   minor_version_, status_, StatusText(status_));
+  WriteRaw(base::StringPiece(line, n));
+  for (int i = 0; i < num_headers_; i++) {
+    WriteRaw(headers_[i].name);
+    WriteRaw(": ");
+    WriteRaw(headers_[i].value);
+    WriteRaw("\r\n");
+  }
+  if (chunked_) {
+    WriteRaw("Transfer-Encoding: chunked\r\n");
+  } else if (content_length >= 0 && StatusHasBody(status_)) {
+    n = snprintf(line, sizeof(line), "Content-Length: %lld\r\n",
+                 static_cast<long long>(content_length));
+    WriteRaw(base::StringPiece(line, n));
+  }
+  if (!keep_alive_ && minor_version_ == 1)
+    WriteRaw("Connection: close\r\n");
+  else if (keep_alive_ && minor_version_ == 0)
+    WriteRaw("Connection: keep-alive\r\n");
+  return WriteRaw("\r\n");
+}
+
+int HttpResponseWriter::WriteRaw(const base::StringPiece& data) {
+  if (err_ != 0)
+    return err_;
+  int n = wr_->Write(data.data(), static_cast<int>(data.size()));
+  if (n != static_cast<int>(data.size())) {
+    err_ = tin::GetErrorCode();
+    if (err_ == 0)
+      err_ = TIN_EIO;
+  }
+  return err_;
+}
+
+HttpServer::HttpServer(const HttpHandler& handler,
+                       const HttpServerOptions& options)
+  : handler_(handler)
+  , options_(options)
+  , idle_(NULL) {
+}
+
+HttpServer::~HttpServer() {
+}
+
+bool HttpServer::ListenAndServe(const base::StringPiece& addr,
+                                uint16 port) {
+  server_ = tin::net::MakeServer(
+      base::Bind(&HttpServer::ServeConn, base::Unretained(this)),
+      options_.server);
+  return server_->ListenAndServe(addr, port);
+}
+
+bool HttpServer::Drain(int64 timeout) {
+  {
+    MutexGuard guard(&idle_mu_);
+    draining_ = true;
+    for (IdleConn* idle = idle_; idle != NULL; idle = idle->next) {
+      // the pending read ends with EOF.
+      idle->conn->CloseRead();
+    }
+  }
+  return server_->Drain(timeout);
+}
+
+bool HttpServer::EnterIdle(IdleConn* idle) {
+  MutexGuard guard(&idle_mu_);
+  if (draining_)
+    return false;
+  idle->prev = NULL;
+  idle->next = idle_;
+  if (idle_ != NULL)
+    idle_->prev = idle;
+  idle_ = idle;
+  return true;
+}
+
+void HttpServer::LeaveIdle(IdleConn* idle) {
+  MutexGuard guard(&idle_mu_);
+  if (idle->prev != NULL)
+    idle->prev->next = idle->next;
+  else
+    idle_ = idle->next;
+  if (idle->next != NULL)
+    idle->next->prev = idle->prev;
+}
+
+void HttpServer::ServeConn(tin::net::TcpConn conn) {
+  tin::bufio::Reader rd(conn.get(), options_.read_buffer_size);
+  // a head must fit without growing.
+  rd.SetSizeLimits(options_.read_buffer_size, options_.read_buffer_size);
+  tin::bufio::BufferedWriter wr(conn.get());
+  // pipelined responses go out together, once the next read would wait.
+  wr.SetAutoFlush(true);
+  HttpRequestReader reader(&rd);
+  HttpRequest req;
+  HttpResponseWriter resp(&wr);
+  IdleConn idle;
+  idle.conn = conn.get();
+  while (true) {
+    bool waiting = rd.buffered() == 0;
+    if (waiting) {
+      // an idle connection holds no read buffer.
+      rd.ReleaseIdle();
+      if (!EnterIdle(&idle))
+        break;
+    }
+    conn->SetReadDeadline(options_.idle_timeout);
+    int err = reader.ReadRequest(&req);
+    if (waiting)
+      LeaveIdle(&idle);
+    if (err != 0) {
+      if (err == TIN_ETOOLARGE || err == TIN_EBADPROTOCOL) {
+        resp.Reset(req, false);
+        resp.SetStatus(err == TIN_ETOOLARGE ? 431 : 400);
+        resp.Send("");
+      } else if (err != TIN_EOF) {
+        VLOG(1) << "http read failed: " << tin::GetErrorStr();
+      }
+      break;
+    }
+    resp.Reset(req, req.keep_alive && !draining_);
+    handler_.Run(&req, &reader, &resp);
+    if (resp.Finish() != 0 || !resp.keep_alive())
+      break;
+  }
+  wr.Flush();
+  wr.SetAutoFlush(false);
+  conn->Close();
+}
+
+}  // namespace http
+}  // namespace tin
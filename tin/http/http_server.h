@@ -0,0 +1,134 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+#include "base/callback.h"
+#include "base/strings/string_piece.h"
+#include "tin/time/time.h"
+#include "tin/sync/atomic_flag.h"
+#include "tin/sync/mutex.h"
+#include "tin/bufio/bufio.h"
+#include "tin/net/server.h"
+#include "tin/net/tcp_conn.h"
+#include "tin/http/http_parser.h"
+
+namespace tin {
+namespace http {
+
+// formats the response into the connection's buffered writer, which is
+// flushed once the connection waits for its next request, so pipelined
+// responses leave together.
+class HttpResponseWriter {
+ public:
+  explicit HttpResponseWriter(tin::bufio::BufferedWriter* wr);
+
+  // for the next request.
+  void Reset(const HttpRequest& req, bool keep_alive);
+
+  void SetStatus(int status) {
+    status_ = status;
+  }
+
+  // name and value must stay alive until the head is written. false if
+  // there are kMaxHttpHeaders already.
+  bool AddHeader(const base::StringPiece& name,
+                 const base::StringPiece& value);
+
+  // closes the connection after this response.
+  void SetKeepAlive(bool keep_alive) {
+    keep_alive_ = keep_alive_ && keep_alive;
+  }
+
+  bool keep_alive() const {
+    return keep_alive_;
+  }
+
+  // the whole body, with a Content-Length. return error code.
+  int Send(const base::StringPiece& body);
+
+  // a part of a streamed body, chunked for HTTP/1.1 and ended by the
+  // close for HTTP/1.0. return error code.
+  int Write(const base::StringPiece& data);
+
+  // ends the response, an empty one if nothing was sent.
+  int Finish();
+
+ private:
+  // content_length -1 streams.
+  int WriteHead(int64 content_length);
+  int WriteRaw(const base::StringPiece& data);
+
+  tin::bufio::BufferedWriter* wr_;
+  int status_;
+  int minor_version_;
+  bool head_only_;
+  bool keep_alive_;
+  bool head_written_;
+  bool chunked_;
+  bool finished_;
+  int err_;
+  HttpHeader headers_[kMaxHttpHeaders];
+  int num_headers_;
+  DISALLOW_COPY_AND_ASSIGN(HttpResponseWriter);
+};
+
+// runs on the greenlet of the connection. body reads the body of req,
+// which is in req->body already if req->body_buffered.
+typedef base::Callback<void(HttpRequest* req, HttpRequestReader* body,
+                            HttpResponseWriter* resp)> HttpHandler;
+
+struct HttpServerOptions {
+  HttpServerOptions()
+    : idle_timeout(60 * kSecond)
+    , read_buffer_size(16 * 1024) {
+  }
+
+  tin::net::ServerOptions server;
+  // keep-alive connections waiting longer for a request are closed.
+  int64 idle_timeout;
+  // holds a request head, and the body if it fits. a larger head gets
+  // 431.
+  int read_buffer_size;
+};
+
+// an HTTP/1.1 server with keep-alive and pipelining on tin::net::Server.
+// the per request path does not allocate. must outlive Drain.
+class HttpServer {
+ public:
+  HttpServer(const HttpHandler& handler, const HttpServerOptions& options);
+  ~HttpServer();
+
+  // false with the error code set if addr:port can't be listened on.
+  bool ListenAndServe(const base::StringPiece& addr, uint16 port);
+
+  // see ServerImpl::Drain. keep-alive connections waiting for a request
+  // are closed at once, the others after their current response.
+  bool Drain(int64 timeout);
+
+ private:
+  // a connection waiting for its next request, on its greenlet's stack.
+  struct IdleConn {
+    tin::net::TcpConnImpl* conn;
+    IdleConn* prev;
+    IdleConn* next;
+  };
+
+  void ServeConn(tin::net::TcpConn conn);
+  // false if draining.
+  bool EnterIdle(IdleConn* idle);
+  void LeaveIdle(IdleConn* idle);
+
+  HttpHandler handler_;
+  HttpServerOptions options_;
+  tin::net::Server server_;
+  Mutex idle_mu_;
+  IdleConn* idle_;
+  AtomicFlag draining_;
+  DISALLOW_COPY_AND_ASSIGN(HttpServer);
+};
+
+}  // namespace http
+}  // namespace tin
@@ -0,0 +1,630 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(TIN_LZ4)
+#include <lz4frame.h>
+#endif
+#if defined(TIN_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+#include "tin/sync/pool.h"
+
+#include "tin/io/compress.h"
+
+namespace tin {
+namespace io {
+
+namespace internal {
+
+class CompressContext {
+ public:
+  virtual ~CompressContext() {}
+  // starts a frame at level, 0 for the default.
+  virtual bool Begin(int level, IOBufChain* out) = 0;
+  virtual bool Update(const char* data, int len, IOBufChain* out) = 0;
+  virtual bool Flush(IOBufChain* out) = 0;
+  virtual bool End(IOBufChain* out) = 0;
+  virtual void Release() = 0;
+};
+
+class DecompressContext {
+ public:
+  virtual ~DecompressContext() {}
+  // decodes from src to dst, false for corrupt input. *frame_end once the
+  // frame is decoded and all of it is in dst.
+  virtual bool Decode(const char* src, int src_len, int* consumed,
+                      char* dst, int dst_len, int* produced,
+                      bool* frame_end) = 0;
+  // gives the context back for reuse, it must be at a frame end.
+  virtual void Release() = 0;
+};
+
+}  // namespace internal
+
+namespace {
+
+// compressed bytes kept before a Write hands them to dst.
+const int kCompressOutBatch = 64 * 1024;
+// least room a codec writes into, smaller tails are left unfilled.
+const int kCompressMinTail = 1024;
+// input the lz4 codec takes at once.
+const int kLz4Chunk = 16 * 1024;
+
+using internal::CompressContext;
+using internal::DecompressContext;
+
+#if defined(TIN_LZ4)
+class Lz4Compressor : public CompressContext {
+ public:
+  Lz4Compressor()
+    : ctx_(NULL) {
+    memset(&prefs_, 0, sizeof(prefs_));
+    prefs_.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs_.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+  }
+
+  virtual ~Lz4Compressor() {
+    if (ctx_ != NULL)
+      LZ4F_freeCompressionContext(ctx_);
+  }
+
+  bool Init() {
+    return !LZ4F_isError(
+        LZ4F_createCompressionContext(&ctx_, LZ4F_VERSION));
+  }
+
+  virtual bool Begin(int level, IOBufChain* out) {
+    prefs_.compressionLevel = level;
+    return Emit(out, LZ4F_HEADER_SIZE_MAX, kBegin, NULL, 0);
+  }
+
+  virtual bool Update(const char* data, int len, IOBufChain* out) {
+    // compressBound counts a whole buffered block on top of the input,
+    // small pieces keep the tail it asks for near one block.
+    while (len > 0) {
+      int n = std::min(len, kLz4Chunk);
+      if (!Emit(out, LZ4F_compressBound(n, &prefs_), kUpdate, data, n))
+        return false;
+      data += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  virtual bool Flush(IOBufChain* out) {
+    return Emit(out, LZ4F_compressBound(0, &prefs_), kFlush, NULL, 0);
+  }
+
+  virtual bool End(IOBufChain* out) {
+    return Emit(out, LZ4F_compressBound(0, &prefs_), kEnd, NULL, 0);
+  }
+
+  virtual void Release();
+
+ private:
+  enum Op {
+    kBegin,
+    kUpdate,
+    kFlush,
+    kEnd
+  };
+
+  bool Emit(IOBufChain* out, size_t bound, Op op, const char* data,
+            int len) {
+    char* ptr = NULL;
+    int room = 0;
+    out->GetWritableTail(static_cast<int>(bound), &ptr, &room);
+    size_t n = 0;
+    switch (op) {
+    case kBegin:
+      n = LZ4F_compressBegin(ctx_, ptr, room, &prefs_);
+      break;
+    case kUpdate:
+      n = LZ4F_compressUpdate(ctx_, ptr, room, data, len, NULL);
+      break;
+    case kFlush:
+      n = LZ4F_flush(ctx_, ptr, room, NULL);
+      break;
+    case kEnd:
+      n = LZ4F_compressEnd(ctx_, ptr, room, NULL);
+      break;
+    }
+    if (LZ4F_isError(n)) {
+      out->CommitTail(0);
+      return false;
+    }
+    out->CommitTail(static_cast<int>(n));
+    return true;
+  }
+
+  LZ4F_cctx* ctx_;
+  LZ4F_preferences_t prefs_;
+  DISALLOW_COPY_AND_ASSIGN(Lz4Compressor);
+};
+
+class Lz4Decompressor : public DecompressContext {
+ public:
+  Lz4Decompressor()
+    : ctx_(NULL) {
+  }
+
+  virtual ~Lz4Decompressor() {
+    if (ctx_ != NULL)
+      LZ4F_freeDecompressionContext(ctx_);
+  }
+
+  bool Init() {
+    return !LZ4F_isError(
+        LZ4F_createDecompressionContext(&ctx_, LZ4F_VERSION));
+  }
+
+  virtual bool Decode(const char* src, int src_len, int* consumed,
+                      char* dst, int dst_len, int* produced,
+                      bool* frame_end) {
+    size_t in = src_len;
+    size_t out = dst_len;
+    size_t hint = LZ4F_decompress(ctx_, dst, &out, src, &in, NULL);
+    if (LZ4F_isError(hint)) {
+      LZ4F_resetDecompressionContext(ctx_);
+      return false;
+    }
+    *consumed = static_cast<int>(in);
+    *produced = static_cast<int>(out);
+    *frame_end = hint == 0;
+    return true;
+  }
+
+  virtual void Release();
+
+ private:
+  LZ4F_dctx* ctx_;
+  DISALLOW_COPY_AND_ASSIGN(Lz4Decompressor);
+};
+
+Lz4Compressor* NewLz4Compressor() {
+  Lz4Compressor* ctx = new Lz4Compressor;
+  if (!ctx->Init()) {
+    delete ctx;
+    return NULL;
+  }
+  return ctx;
+}
+
+Lz4Decompressor* NewLz4Decompressor() {
+  Lz4Decompressor* ctx = new Lz4Decompressor;
+  if (!ctx->Init()) {
+    delete ctx;
+    return NULL;
+  }
+  return ctx;
+}
+
+Pool<Lz4Compressor> lz4_compressors(&NewLz4Compressor);
+Pool<Lz4Decompressor> lz4_decompressors(&NewLz4Decompressor);
+
+void Lz4Compressor::Release() {
+  lz4_compressors.Put(this);
+}
+
+void Lz4Decompressor::Release() {
+  lz4_decompressors.Put(this);
+}
+#endif  // TIN_LZ4
+
+#if defined(TIN_ZSTD)
+class ZstdCompressor : public CompressContext {
+ public:
+  ZstdCompressor()
+    : ctx_(ZSTD_createCCtx()) {
+  }
+
+  virtual ~ZstdCompressor() {
+    ZSTD_freeCCtx(ctx_);
+  }
+
+  bool Init() {
+    return ctx_ != NULL;
+  }
+
+  virtual bool Begin(int level, IOBufChain* out) {
+    ZSTD_CCtx_reset(ctx_, ZSTD_reset_session_only);
+    return !ZSTD_isError(ZSTD_CCtx_setParameter(
+        ctx_, ZSTD_c_compressionLevel, level));
+  }
+
+  virtual bool Update(const char* data, int len, IOBufChain* out) {
+    return Stream(out, data, len, ZSTD_e_continue);
+  }
+
+  virtual bool Flush(IOBufChain* out) {
+    return Stream(out, NULL, 0, ZSTD_e_flush);
+  }
+
+  virtual bool End(IOBufChain* out) {
+    return Stream(out, NULL, 0, ZSTD_e_end);
+  }
+
+  virtual void Release();
+
+ private:
+  // the codec keeps what does not fit, flush and end are done once it
+  // has nothing left.
+  bool Stream(IOBufChain* out, const char* data, int len,
+              ZSTD_EndDirective op) {
+    ZSTD_inBuffer in = { data, static_cast<size_t>(len), 0 };
+    while (true) {
+      char* ptr = NULL;
+      int room = 0;
+      out->GetWritableTail(kCompressMinTail, &ptr, &room);
+      ZSTD_outBuffer dst = { ptr, static_cast<size_t>(room), 0 };
+      size_t left = ZSTD_compressStream2(ctx_, &dst, &in, op);
+      out->CommitTail(static_cast<int>(dst.pos));
+      if (ZSTD_isError(left))
+        return false;
+      if (op == ZSTD_e_continue ? in.pos == in.size : left == 0)
+        return true;
+    }
+  }
+
+  ZSTD_CCtx* ctx_;
+  DISALLOW_COPY_AND_ASSIGN(ZstdCompressor);
+};
+
+class ZstdDecompressor : public DecompressContext {
+ public:
+  ZstdDecompressor()
+    : ctx_(ZSTD_createDCtx()) {
+  }
+
+  virtual ~ZstdDecompressor() {
+    ZSTD_freeDCtx(ctx_);
+  }
+
+  bool Init() {
+    return ctx_ != NULL;
+  }
+
+  virtual bool Decode(const char* src, int src_len, int* consumed,
+                      char* dst, int dst_len, int* produced,
+                      bool* frame_end) {
+    ZSTD_inBuffer in = { src, static_cast<size_t>(src_len), 0 };
+    ZSTD_outBuffer out = { dst, static_cast<size_t>(dst_len), 0 };
+    size_t hint = ZSTD_decompressStream(ctx_, &out, &in);
+    if (ZSTD_isError(hint)) {
+      ZSTD_DCtx_reset(ctx_, ZSTD_reset_session_only);
+      return false;
+    }
+    *consumed = static_cast<int>(in.pos);
+    *produced = static_cast<int>(out.pos);
+    *frame_end = hint == 0;
+    return true;
+  }
+
+  virtual void Release();
+
+ private:
+  ZSTD_DCtx* ctx_;
+  DISALLOW_COPY_AND_ASSIGN(ZstdDecompressor);
+};
+
+ZstdCompressor* NewZstdCompressor() {
+  ZstdCompressor* ctx = new ZstdCompressor;
+  if (!ctx->Init()) {
+    delete ctx;
+    return NULL;
+  }
+  return ctx;
+}
+
+ZstdDecompressor* NewZstdDecompressor() {
+  ZstdDecompressor* ctx = new ZstdDecompressor;
+  if (!ctx->Init()) {
+    delete ctx;
+    return NULL;
+  }
+  return ctx;
+}
+
+Pool<ZstdCompressor> zstd_compressors(&NewZstdCompressor);
+Pool<ZstdDecompressor> zstd_decompressors(&NewZstdDecompressor);
+
+void ZstdCompressor::Release() {
+  zstd_compressors.Put(this);
+}
+
+void ZstdDecompressor::Release() {
+  zstd_decompressors.Put(this);
+}
+#endif  // TIN_ZSTD
+
+CompressContext* GetCompressor(CompressCodec codec) {
+  switch (codec) {
+#if defined(TIN_LZ4)
+  case kCodecLz4Frame:
+    return lz4_compressors.Get();
+#endif
+#if defined(TIN_ZSTD)
+  case kCodecZstd:
+    return zstd_compressors.Get();
+#endif
+  default:
+    return NULL;
+  }
+}
+
+DecompressContext* GetDecompressor(CompressCodec codec) {
+  switch (codec) {
+#if defined(TIN_LZ4)
+  case kCodecLz4Frame:
+    return lz4_decompressors.Get();
+#endif
+#if defined(TIN_ZSTD)
+  case kCodecZstd:
+    return zstd_decompressors.Get();
+#endif
+  default:
+    return NULL;
+  }
+}
+
+}  // namespace
+
+bool CompressCodecAvailable(CompressCodec codec) {
+  switch (codec) {
+#if defined(TIN_LZ4)
+  case kCodecLz4Frame:
+    return true;
+#endif
+#if defined(TIN_ZSTD)
+  case kCodecZstd:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+CompressWriter::CompressWriter(Writer* dst, const CompressOptions& options)
+  : dst_(dst)
+  , options_(options)
+  , ctx_(NULL)
+  , err_(0) {
+}
+
+CompressWriter::~CompressWriter() {
+  Drop();
+}
+
+int CompressWriter::Write(const void* buf, int nbytes) {
+  err_ = Compress(static_cast<const char*>(buf), nbytes);
+  if (err_ == 0 && out_.size() >= kCompressOutBatch)
+    err_ = WriteOut();
+  tin::SetErrorCode(err_);
+  return err_ == 0 ? nbytes : 0;
+}
+
+int CompressWriter::WriteChain(const IOBufChain& chain) {
+  IOVec iov[16];
+  IOBufChain rest = chain;
+  int done = 0;
+  while (!rest.empty()) {
+    int n = rest.ToIOVecs(iov, arraysize(iov));
+    for (int i = 0; i < n; i++) {
+      err_ = Compress(static_cast<const char*>(iov[i].base), iov[i].len);
+      if (err_ != 0) {
+        tin::SetErrorCode(err_);
+        return done;
+      }
+      done += iov[i].len;
+      rest.TrimFront(iov[i].len);
+    }
+    if (out_.size() >= kCompressOutBatch) {
+      err_ = WriteOut();
+      if (err_ != 0) {
+        tin::SetErrorCode(err_);
+        return done;
+      }
+    }
+  }
+  tin::SetErrorCode(0);
+  return done;
+}
+
+int CompressWriter::Flush() {
+  if (err_ != 0)
+    return err_;
+  if (ctx_ != NULL && !ctx_->Flush(&out_))
+    err_ = TIN_EPROTO;
+  if (err_ == 0)
+    err_ = WriteOut();
+  return err_;
+}
+
+int CompressWriter::Close() {
+  if (err_ != 0)
+    return err_;
+  if (ctx_ == NULL)
+    err_ = Begin();
+  if (err_ == 0 && !ctx_->End(&out_))
+    err_ = TIN_EPROTO;
+  if (err_ != 0)
+    return err_;
+  ctx_->Release();
+  ctx_ = NULL;
+  err_ = WriteOut();
+  return err_;
+}
+
+void CompressWriter::Reset(Writer* dst) {
+  Drop();
+  dst_ = dst;
+  out_.clear();
+  err_ = 0;
+}
+
+IOBufChain CompressWriter::TakeOutput() {
+  IOBufChain out = out_;
+  out_.clear();
+  return out;
+}
+
+int CompressWriter::Begin() {
+  ctx_ = GetCompressor(options_.codec);
+  if (ctx_ == NULL)
+    return CompressCodecAvailable(options_.codec) ? TIN_ENOMEM : TIN_ENOSYS;
+  if (!ctx_->Begin(options_.level, &out_)) {
+    Drop();
+    return TIN_EINVAL;
+  }
+  return 0;
+}
+
+int CompressWriter::Compress(const char* data, int len) {
+  if (err_ != 0)
+    return err_;
+  if (ctx_ == NULL) {
+    int err = Begin();
+    if (err != 0)
+      return err;
+  }
+  return ctx_->Update(data, len, &out_) ? 0 : TIN_EPROTO;
+}
+
+int CompressWriter::WriteOut() {
+  if (dst_ == NULL)
+    return 0;
+  IOVec iov[16];
+  while (!out_.empty()) {
+    int n = out_.ToIOVecs(iov, arraysize(iov));
+    int want = 0;
+    for (int i = 0; i < n; i++)
+      want += iov[i].len;
+    int wrote = dst_->Writev(iov, n);
+    out_.TrimFront(wrote);
+    if (wrote < want) {
+      int err = tin::GetErrorCode();
+      return err != 0 ? err : TIN_EIO;
+    }
+  }
+  return 0;
+}
+
+void CompressWriter::Drop() {
+  // the state of an unfinished frame is not reused.
+  delete ctx_;
+  ctx_ = NULL;
+}
+
+DecompressReader::DecompressReader(Reader* src, CompressCodec codec)
+  : src_(src)
+  , codec_(codec)
+  , ctx_(NULL)
+  , err_(0)
+  , in_frame_(false) {
+}
+
+DecompressReader::~DecompressReader() {
+  Drop();
+}
+
+int DecompressReader::Read(void* buf, int nbytes) {
+  if (err_ != 0 || nbytes <= 0) {
+    tin::SetErrorCode(err_);
+    return 0;
+  }
+  if (ctx_ == NULL) {
+    ctx_ = GetDecompressor(codec_);
+    if (ctx_ == NULL) {
+      tin::SetErrorCode(CompressCodecAvailable(codec_) ? TIN_ENOMEM :
+                                                         TIN_ENOSYS);
+      return 0;
+    }
+  }
+  char* dst = static_cast<char*>(buf);
+  while (true) {
+    while (!in_.empty()) {
+      IOVec iov;
+      in_.ToIOVecs(&iov, 1);
+      int consumed = 0;
+      int produced = 0;
+      bool frame_end = false;
+      if (!ctx_->Decode(static_cast<const char*>(iov.base), iov.len,
+                        &consumed, dst, nbytes, &produced, &frame_end)) {
+        err_ = TIN_EPROTO;
+        tin::SetErrorCode(err_);
+        return 0;
+      }
+      in_.TrimFront(consumed);
+      if (consumed > 0 || produced > 0)
+        in_frame_ = !frame_end;
+      if (produced > 0) {
+        tin::SetErrorCode(0);
+        return produced;
+      }
+      if (consumed == 0)
+        break;
+    }
+    int err = Fill();
+    if (err != 0) {
+      if (err == TIN_EOF && in_frame_)
+        err = TIN_EPROTO;
+      if (err != TIN_EAGAIN)
+        err_ = err;
+      if (err == TIN_EOF)
+        Drop();
+      tin::SetErrorCode(err);
+      return 0;
+    }
+  }
+}
+
+void DecompressReader::Feed(const IOBufChain& chain) {
+  in_.Append(chain);
+}
+
+void DecompressReader::Reset(Reader* src) {
+  // a context in the middle of a frame is not reused.
+  if (in_frame_) {
+    delete ctx_;
+    ctx_ = NULL;
+  }
+  src_ = src;
+  in_.clear();
+  err_ = 0;
+  in_frame_ = false;
+}
+
+int DecompressReader::Fill() {
+  if (src_ == NULL)
+    return TIN_EAGAIN;
+  char* ptr = NULL;
+  int room = 0;
+  in_.GetWritableTail(kCompressMinTail, &ptr, &room);
+  int n = src_->Read(ptr, room);
+  int err = tin::GetErrorCode();
+  in_.CommitTail(n);
+  if (n > 0)
+    return 0;
+  return err != 0 ? err : TIN_EIO;
+}
+
+void DecompressReader::Drop() {
+  if (ctx_ == NULL)
+    return;
+  if (in_frame_)
+    delete ctx_;
+  else
+    ctx_->Release();
+  ctx_ = NULL;
+}
+
+}  // namespace io
+}  // namespace tin
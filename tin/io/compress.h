@@ -0,0 +1,129 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+#include "tin/io/io.h"
+#include "tin/io/iobuf_chain.h"
+
+namespace tin {
+namespace io {
+
+enum CompressCodec {
+  // the LZ4 frame format, with a content checksum.
+  kCodecLz4Frame = 0,
+  kCodecZstd
+};
+
+// false if tin was built without the codec, see TIN_ENABLE_LZ4 and
+// TIN_ENABLE_ZSTD. the streams then fail with TIN_ENOSYS.
+bool CompressCodecAvailable(CompressCodec codec);
+
+struct CompressOptions {
+  CompressOptions()
+    : codec(kCodecLz4Frame)
+    , level(0) {
+  }
+
+  CompressCodec codec;
+  // 0 for the default level of the codec.
+  int level;
+};
+
+namespace internal {
+class CompressContext;
+class DecompressContext;
+}  // namespace internal
+
+// compresses what is written into frames of options.codec. the codec
+// writes straight into the pooled blocks of a chain, which goes to dst by
+// slice with Writev, or is taken with TakeOutput for a queue of chains,
+// e.g. TcpConn::AsyncWriteChain or bufio::BufferedWriter::WriteChain.
+// the codec context and its window come from a pool of the current P
+// when a frame starts and go back once it ends.
+class CompressWriter : public Writer {
+ public:
+  // dst NULL keeps the output for TakeOutput.
+  explicit CompressWriter(Writer* dst,
+                          const CompressOptions& options = CompressOptions());
+  // drops an unfinished frame, Close first to keep it.
+  virtual ~CompressWriter();
+
+  // note: output reaches dst only once a block is done, on Flush or
+  // Close. the first error is sticky like in bufio::BufferedWriter.
+  virtual int Write(const void* buf, int nbytes);
+
+  // compresses chain slice by slice, returns bytes accepted.
+  int WriteChain(const IOBufChain& chain);
+
+  // ends the block, so the peer can decode everything written so far,
+  // and writes the output to dst.
+  // return error code.
+  int Flush();
+
+  // ends the frame and writes the output to dst, the next write starts
+  // a new frame.
+  // return error code.
+  int Close();
+
+  // drops the frame, pending output and a sticky error, dst is the new
+  // destination.
+  void Reset(Writer* dst);
+
+  // compressed bytes not yet written to dst, sharing the blocks.
+  IOBufChain TakeOutput();
+
+ private:
+  int Begin();
+  int Compress(const char* data, int len);
+  int WriteOut();
+  void Drop();
+
+  Writer* dst_;
+  CompressOptions options_;
+  internal::CompressContext* ctx_;
+  IOBufChain out_;
+  int err_;
+
+  DISALLOW_COPY_AND_ASSIGN(CompressWriter);
+};
+
+// decompresses the frames src reads, any number of them back to back.
+// input is read into pooled chain blocks and decoded from there straight
+// into the buffer of Read. the context comes from a pool of the current
+// P and goes back at EOF.
+class DecompressReader : public Reader {
+ public:
+  // src NULL reads only what Feed gave.
+  DecompressReader(Reader* src, CompressCodec codec);
+  virtual ~DecompressReader();
+
+  // TIN_EOF once src is at EOF between frames, TIN_EPROTO for corrupt or
+  // truncated input. with no src, 0 with TIN_EAGAIN until it is fed more.
+  virtual int Read(void* buf, int nbytes);
+
+  // queues compressed bytes, e.g. of TcpConn::ReadPooled, without a copy.
+  void Feed(const IOBufChain& chain);
+
+  // drops the input and the frame state, src is the new source.
+  void Reset(Reader* src);
+
+ private:
+  int Fill();
+  void Drop();
+
+  Reader* src_;
+  CompressCodec codec_;
+  internal::DecompressContext* ctx_;
+  IOBufChain in_;
+  int err_;
+  // inside a frame, EOF now is a truncated frame.
+  bool in_frame_;
+
+  DISALLOW_COPY_AND_ASSIGN(DecompressReader);
+};
+
+}  // namespace io
+}  // namespace tin
@@ -0,0 +1,239 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "build/build_config.h"
+
+#if defined(OS_POSIX)
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/threadpoll.h"
+#include "tin/io/file_appender.h"
+
+namespace tin {
+
+using namespace runtime;  // NOLINT
+
+namespace {
+
+#if defined(OS_POSIX)
+#if defined(IOV_MAX)
+const int kMaxIovecs = IOV_MAX;
+#else
+const int kMaxIovecs = 1024;
+#endif
+
+int SyncData(int fd) {
+#if defined(OS_LINUX)
+  return fdatasync(fd);
+#else
+  return fsync(fd);
+#endif
+}
+#endif
+
+}  // namespace
+
+// one pass over the whole batch, on the thread pool.
+class CommitWork : public GletWork {
+ public:
+  CommitWork(file_t file, int64 offset,
+             const std::vector<const char*>& datas,
+             const std::vector<int>& sizes)
+    : succeed_(false)
+    , file_(file)
+    , offset_(offset)
+    , datas_(datas)
+    , sizes_(sizes) {
+  }
+
+  virtual ~CommitWork() { }
+
+  virtual void Run() {
+    succeed_ = WriteAll() && Sync();
+    Finalize();
+  }
+
+  bool Succeed() const {
+    return succeed_;
+  }
+
+ private:
+#if defined(OS_POSIX)
+  bool WriteAll() {
+    std::vector<struct iovec> iov(datas_.size());
+    for (size_t i = 0; i < datas_.size(); i++) {
+      iov[i].iov_base = const_cast<char*>(datas_[i]);
+      iov[i].iov_len = sizes_[i];
+    }
+    size_t first = 0;
+    int64 offset = offset_;
+    while (first < iov.size()) {
+      int cnt = static_cast<int>(
+          std::min(iov.size() - first, static_cast<size_t>(kMaxIovecs)));
+      ssize_t n = pwritev(file_, &iov[first], cnt, offset);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      offset += n;
+      // skip what is fully written, trim a partially written one.
+      while (first < iov.size() &&
+             static_cast<size_t>(n) >= iov[first].iov_len) {
+        n -= iov[first].iov_len;
+        first++;
+      }
+      if (n > 0) {
+        iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + n;
+        iov[first].iov_len -= n;
+      }
+    }
+    return true;
+  }
+
+  bool Sync() {
+    while (SyncData(file_) != 0) {
+      if (errno != EINTR)
+        return false;
+    }
+    return true;
+  }
+#else
+  // no gather write for positional io, one write per append.
+  bool WriteAll() {
+    int64 offset = offset_;
+    for (size_t i = 0; i < datas_.size(); i++) {
+      int done = 0;
+      while (done < sizes_[i]) {
+        int n = base::WritePlatformFile(file_, offset + done,
+                                        datas_[i] + done, sizes_[i] - done);
+        if (n <= 0)
+          return false;
+        done += n;
+      }
+      offset += sizes_[i];
+    }
+    return true;
+  }
+
+  bool Sync() {
+    return base::FlushPlatformFile(file_);
+  }
+#endif
+
+  bool succeed_;
+  file_t file_;
+  int64 offset_;
+  const std::vector<const char*>& datas_;
+  const std::vector<int>& sizes_;
+};
+
+FileAppender::FileAppender(file_t file, int64 offset)
+  : file_(file)
+  , cond_(&mu_)
+  , offset_(offset)
+  , head_(NULL)
+  , tail_(NULL)
+  , pending_(0)
+  , committing_(false)
+  , batches_(0) {
+}
+
+FileAppender::~FileAppender() {
+  DCHECK(head_ == NULL && !committing_);
+}
+
+int FileAppender::Append(const char* data, int size) {
+  Request req;
+  req.data = data;
+  req.size = size;
+  req.result = -1;
+  req.error = 0;
+  req.done = false;
+  req.next = NULL;
+
+  MutexGuard guard(&mu_);
+  if (tail_ != NULL) {
+    tail_->next = &req;
+  } else {
+    head_ = &req;
+  }
+  tail_ = &req;
+  pending_++;
+
+  while (!req.done) {
+    if (committing_) {
+      // a batch is in flight, ours goes with the next one.
+      cond_.Wait();
+      continue;
+    }
+    // lead the next batch, everything queued so far, ours included.
+    Request* batch = head_;
+    int32 n = pending_;
+    int64 offset = offset_;
+    head_ = tail_ = NULL;
+    pending_ = 0;
+    committing_ = true;
+    mu_.Unlock();
+    int error = 0;
+    bool succeed = Commit(batch, offset, n, &error);
+    mu_.Lock();
+    // the owners are waiting for mu_ at the earliest, batch is still there.
+    for (Request* r = batch; r != NULL; r = r->next) {
+      r->result = succeed ? r->size : -1;
+      r->error = error;
+      r->done = true;
+      if (succeed)
+        offset_ += r->size;
+    }
+    batches_++;
+    committing_ = false;
+    // the done ones return, one of the others leads the next batch.
+    cond_.Broascast();
+  }
+  SetErrorCode(req.error);
+  return req.result;
+}
+
+bool FileAppender::Commit(Request* batch, int64 offset, int32 n,
+                          int* error) {
+  std::vector<const char*> datas;
+  std::vector<int> sizes;
+  datas.reserve(n);
+  sizes.reserve(n);
+  for (Request* r = batch; r != NULL; r = r->next) {
+    datas.push_back(r->data);
+    sizes.push_back(r->size);
+  }
+  CommitWork work(file_, offset, datas, sizes);
+  SubmitGletWork(&work);
+  if (!work.Succeed()) {
+    *error = GetErrorCode();
+    return false;
+  }
+  return true;
+}
+
+int64 FileAppender::Offset() {
+  MutexGuard guard(&mu_);
+  return offset_;
+}
+
+uint64 FileAppender::Batches() {
+  MutexGuard guard(&mu_);
+  return batches_;
+}
+
+}  // namespace tin
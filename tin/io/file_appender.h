@@ -0,0 +1,60 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include "base/basictypes.h"
+#include "tin/sync/mutex.h"
+#include "tin/sync/cond.h"
+#include "tin/io/ioutil.h"
+
+namespace tin {
+
+// group commit for append only files such as write ahead logs. appends
+// from many greenlets are queued, one of them takes the whole queue and
+// writes it with a single pwritev followed by a single fdatasync on the
+// thread pool, meanwhile the next batch builds up behind it.
+class FileAppender {
+ public:
+  // appends at offset, usually the current size of file. file stays owned
+  // by the caller and must outlive the appender.
+  FileAppender(file_t file, int64 offset);
+  ~FileAppender();
+
+  // returns once data is durable, size or -1 with the error code set. a
+  // failed batch fails all of its appends, nothing is retried.
+  int Append(const char* data, int size);
+
+  // end of the data written so far.
+  int64 Offset();
+
+  // batches committed, appends / batches is the sharing achieved.
+  uint64 Batches();
+
+ private:
+  struct Request {
+    const char* data;
+    int size;
+    int result;
+    int error;
+    bool done;
+    Request* next;
+  };
+
+  // writes and syncs the batch at offset, called without mu_.
+  bool Commit(Request* batch, int64 offset, int32 n, int* error);
+
+  file_t file_;
+  Mutex mu_;
+  Cond cond_;
+  // guarded by mu_.
+  int64 offset_;
+  Request* head_;
+  Request* tail_;
+  int32 pending_;
+  bool committing_;
+  uint64 batches_;
+  DISALLOW_COPY_AND_ASSIGN(FileAppender);
+};
+
+}  // namespace tin
@@ -5,11 +5,67 @@
 #include "base/logging.h"
 #include "tin/error/error.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/buffer_pool.h"
 #include "tin/io/io.h"
 
 namespace tin {
 namespace io {
 
+int Writer::Writev(const IOVec* iov, int iovcnt) {
+  int n = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    int nn = Write(iov[i].base, iov[i].len);
+    DCHECK_GE(nn, 0);
+    n += nn;
+    if (GetErrorCode() != 0)
+      break;
+  }
+  return n;
+}
+
+int64 Copy(Writer* dst, Reader* src) {
+  WriterTo* wt = src->AsWriterTo();
+  if (wt != NULL) {
+    return wt->WriteTo(dst);
+  }
+  ReaderFrom* rf = dst->AsReaderFrom();
+  if (rf != NULL) {
+    return rf->ReadFrom(src);
+  }
+  return CopyBuffer(dst, src);
+}
+
+int64 CopyBuffer(Writer* dst, Reader* src) {
+  const int kCopyBufferSize = 16 * 1024;
+  int capacity = 0;
+  char* buf = tin::runtime::BufferAlloc(kCopyBufferSize, &capacity);
+  int64 total = 0;
+  int err = 0;
+  while (true) {
+    int n = src->Read(buf, capacity);
+    DCHECK_GE(n, 0);
+    int rerr = GetErrorCode();
+    if (n > 0) {
+      int nw = dst->Write(buf, n);
+      total += nw;
+      err = GetErrorCode();
+      if (err == 0 && nw != n) {
+        err = TIN_ENOPROGRESS;
+      }
+      if (err != 0) {
+        break;
+      }
+    }
+    if (rerr != 0) {
+      err = rerr == TIN_EOF ? 0 : rerr;
+      break;
+    }
+  }
+  tin::runtime::BufferFree(buf, capacity);
+  SetErrorCode(err);
+  return total;
+}
+
 int ReadAtLeast(Reader* reader, void* buf, int len, int min) {
   if (len < min) {
     SetErrorCode(TIN_EINVAL);
@@ -9,21 +9,68 @@
 namespace tin {
 namespace io {
 
+// one segment of a scatter/gather request, see Readv/Writev.
+struct IOVec {
+  void* base;
+  int len;
+};
+
+class WriterTo;
+class ReaderFrom;
+
+// lets Copy recognize readers and writers it can short-circuit without
+// rtti, e.g. two sockets that may splice.
+enum StreamKind {
+  kStreamGeneric = 0,
+  kStreamTcpConn = 1
+};
+
 class Reader {
  public:
   virtual ~Reader() {}
   virtual int Read(void* buf, int nbytes) = 0;
+  virtual WriterTo* AsWriterTo() { return NULL; }
+  virtual int ReaderKind() const { return kStreamGeneric; }
 };
 
 class Writer {
  public:
   virtual ~Writer() {}
   virtual int Write(const void* buf, int nbytes) = 0;
+  // gather write, the default writes the segments one by one and stops
+  // at the first error. returns the total bytes written.
+  virtual int Writev(const IOVec* iov, int iovcnt);
+  virtual ReaderFrom* AsReaderFrom() { return NULL; }
+  virtual int WriterKind() const { return kStreamGeneric; }
 };
 
 class IOReadWriter : public Reader, public Writer {
 };
 
+// readers that can push their data to a writer without an intermediate
+// buffer of the caller. EOF is not an error.
+class WriterTo {
+ public:
+  virtual ~WriterTo() {}
+  virtual int64 WriteTo(Writer* dst) = 0;
+};
+
+// writers that can pull data from a reader more efficiently up to EOF.
+class ReaderFrom {
+ public:
+  virtual ~ReaderFrom() {}
+  virtual int64 ReadFrom(Reader* src) = 0;
+};
+
+// copies src to dst until EOF, preferring src's WriterTo then dst's
+// ReaderFrom, else bouncing through a pooled buffer.
+// returns bytes copied, detail error see tin::GetErrorCode().
+int64 Copy(Writer* dst, Reader* src);
+
+// the buffered loop of Copy, for ReaderFrom/WriterTo implementations
+// that have no better path for a given peer.
+int64 CopyBuffer(Writer* dst, Reader* src);
+
 int ReadAtLeast(Reader* reader, void* buf, int nbytes, int min);
 
 int ReadFull(Reader* reader, void* buf, int nbytes);
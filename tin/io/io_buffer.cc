@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include "base/logging.h"
+#include "tin/runtime/buffer_pool.h"
 #include "tin/io/io_buffer.h"
 
 // Some of the following member functions are marked inlined, even though they
@@ -30,15 +31,21 @@ IOBuffer::IOBuffer()
 IOBuffer::IOBuffer(size_t size)
   : write_idx_(0),
     read_idx_(0),
-    storage_size_(static_cast<int>(size)) {
+    storage_size_(0) {
   // Callers may try to allocate overly large blocks, but negative sizes are
   // obviously wrong.
   CHECK_GE(size, 0u);
-  storage_ = new char[size];
+  storage_ = runtime::BufferAlloc(static_cast<int>(size), &storage_size_);
 }
 
 IOBuffer::~IOBuffer() {
-  delete[] storage_;
+  FreeStorage();
+}
+
+void IOBuffer::FreeStorage() {
+  runtime::BufferFree(storage_, storage_size_);
+  storage_ = NULL;
+  storage_size_ = 0;
 }
 
 std::string IOBuffer::str() const {
@@ -96,11 +103,10 @@ int IOBuffer::Read(char* bytes, size_t sz) {
 
 
 void IOBuffer::Reset(int size = kInitialIOBufferSize) {
-  delete[] storage_;
-  storage_ = new char[size],
+  runtime::BufferFree(storage_, storage_size_);
+  storage_ = runtime::BufferAlloc(size, &storage_size_);
   write_idx_ = 0;
   read_idx_ = 0;
-  storage_size_ = size;
 }
 
 // Attempts to reserve a contiguous block of buffer space by either reclaiming
@@ -131,16 +137,18 @@ bool IOBuffer::ReserveMore(int size) {
       }
 
       // have to extend the thing
-      char* new_storage = new char[new_storage_size];
+      int new_capacity = 0;
+      char* new_storage =
+        runtime::BufferAlloc(new_storage_size, &new_capacity);
 
       // copy still useful info to the new buffer.
       memcpy(new_storage, read_ptr, read_size);
       // reset pointers.
       read_idx_ = 0;
       write_idx_ = read_size;
-      delete[] storage_;
+      runtime::BufferFree(storage_, storage_size_);
       storage_ = new_storage;
-      storage_size_ = new_storage_size;
+      storage_size_ = new_capacity;
     }
     changed = true;
   }
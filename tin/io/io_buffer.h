@@ -8,6 +8,7 @@
 #include <string>
 #include "base/basictypes.h"
 #include "base/move.h"
+#include "base/memory/ref_counted.h"
 
 namespace tin {
 
@@ -67,6 +68,10 @@ class IOBuffer {
 
   void Swap(IOBuffer* other);
 
+ private:
+  // hands storage_ back to the runtime buffer pool.
+  void FreeStorage();
+
  private:
   char* storage_;
   int write_idx_;
@@ -87,7 +92,7 @@ class IOBuffer {
   }
 
   void operator=(RValue rvalue) {
-    delete storage_;
+    FreeStorage();
     storage_ = rvalue.object->storage_;
     write_idx_ = rvalue.object->write_idx_;
     read_idx_ = rvalue.object->read_idx_;
@@ -100,6 +105,27 @@ class IOBuffer {
   }
 };
 
+// shares an IOBuffer between owners, e.g. a writer and the kernel while a
+// zero copy send still references its pages.
+class RefCountedIOBuffer
+  : public base::RefCountedThreadSafe<RefCountedIOBuffer> {
+ public:
+  explicit RefCountedIOBuffer(IOBuffer buffer)
+    : buffer_(buffer.Pass()) {
+  }
+
+  IOBuffer* buffer() { return &buffer_; }
+  const IOBuffer* buffer() const { return &buffer_; }
+
+ private:
+  friend class base::RefCountedThreadSafe<RefCountedIOBuffer>;
+  ~RefCountedIOBuffer() {}
+
+  IOBuffer buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(RefCountedIOBuffer);
+};
+
 }  // namespace tin
 
 #endif  // PKG_IO_IO_BUFFER_H_
@@ -0,0 +1,156 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "tin/runtime/buffer_pool.h"
+
+#include "tin/io/iobuf_chain.h"
+
+namespace tin {
+namespace io {
+
+IOBufBlock::IOBufBlock(int capacity)
+  : data_(NULL)
+  , size_(0)
+  , capacity_(0) {
+  CHECK_GT(capacity, 0);
+  data_ = tin::runtime::BufferAlloc(capacity, &capacity_);
+}
+
+IOBufBlock::~IOBufBlock() {
+  tin::runtime::BufferFree(data_, capacity_);
+}
+
+IOBufChain::IOBufChain()
+  : size_(0) {
+}
+
+IOBufChain::~IOBufChain() {
+}
+
+void IOBufChain::clear() {
+  slices_.clear();
+  size_ = 0;
+}
+
+void IOBufChain::Append(const void* data, int len) {
+  DCHECK_GE(len, 0);
+  const char* p = static_cast<const char*>(data);
+  while (len > 0) {
+    char* ptr = NULL;
+    int n = 0;
+    GetWritableTail(1, &ptr, &n);
+    n = std::min(n, len);
+    memcpy(ptr, p, n);
+    CommitTail(n);
+    p += n;
+    len -= n;
+  }
+}
+
+void IOBufChain::Append(const IOBufChain& other) {
+  // other may be this chain.
+  std::vector<Slice> slices(other.slices_);
+  slices_.insert(slices_.end(), slices.begin(), slices.end());
+  size_ += other.size_;
+}
+
+IOBufChain IOBufChain::Split(int n) {
+  DCHECK_GE(n, 0);
+  n = std::min(n, size_);
+  IOBufChain head;
+  size_t i = 0;
+  while (n > 0) {
+    Slice& s = slices_[i];
+    if (s.len <= n) {
+      head.slices_.push_back(s);
+      head.size_ += s.len;
+      n -= s.len;
+      ++i;
+    } else {
+      Slice part = s;
+      part.len = n;
+      head.slices_.push_back(part);
+      head.size_ += n;
+      s.offset += n;
+      s.len -= n;
+      n = 0;
+    }
+  }
+  slices_.erase(slices_.begin(), slices_.begin() + i);
+  size_ -= head.size_;
+  return head;
+}
+
+void IOBufChain::TrimFront(int n) {
+  Split(n);
+}
+
+int IOBufChain::CopyTo(void* buf, int len) const {
+  char* p = static_cast<char*>(buf);
+  int copied = 0;
+  for (size_t i = 0; i < slices_.size() && copied < len; ++i) {
+    const Slice& s = slices_[i];
+    int n = std::min(s.len, len - copied);
+    memcpy(p + copied, s.block->data() + s.offset, n);
+    copied += n;
+  }
+  return copied;
+}
+
+std::string IOBufChain::ToString() const {
+  std::string str(size_, '\0');
+  if (size_ > 0) {
+    CopyTo(&str[0], size_);
+  }
+  return str;
+}
+
+int IOBufChain::ToIOVecs(IOVec* iov, int max) const {
+  int n = std::min(max, static_cast<int>(slices_.size()));
+  for (int i = 0; i < n; ++i) {
+    const Slice& s = slices_[i];
+    iov[i].base = s.block->data() + s.offset;
+    iov[i].len = s.len;
+  }
+  return n;
+}
+
+void IOBufChain::GetWritableTail(int min, char** ptr, int* len) {
+  if (!slices_.empty()) {
+    Slice& s = slices_.back();
+    // bytes past every slice of a block nobody else holds are ours.
+    if (s.block->HasOneRef() && s.offset + s.len == s.block->size() &&
+        s.block->free() >= min) {
+      *ptr = s.block->data() + s.block->size();
+      *len = s.block->free();
+      return;
+    }
+  }
+  Slice s;
+  s.block = new IOBufBlock(std::max(min, kDefaultIOBufBlockSize));
+  s.offset = 0;
+  s.len = 0;
+  slices_.push_back(s);
+  *ptr = s.block->data();
+  *len = s.block->free();
+}
+
+void IOBufChain::CommitTail(int n) {
+  DCHECK(!slices_.empty());
+  Slice& s = slices_.back();
+  DCHECK_LE(n, s.block->free());
+  s.block->Commit(n);
+  s.len += n;
+  size_ += n;
+  if (s.len == 0) {
+    slices_.pop_back();
+  }
+}
+
+}  // namespace io
+}  // namespace tin
@@ -0,0 +1,99 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/memory/ref_counted.h"
+#include "tin/io/io.h"
+
+namespace tin {
+namespace io {
+
+const int kDefaultIOBufBlockSize = 16 * 1024;
+
+// a fixed size block shared by every slice that points into it. bytes
+// below size() are never written again, so slices can be handed around
+// without copying. storage comes from the runtime buffer pool.
+class IOBufBlock : public base::RefCountedThreadSafe<IOBufBlock> {
+ public:
+  explicit IOBufBlock(int capacity);
+
+  char* data() { return data_; }
+  const char* data() const { return data_; }
+  int size() const { return size_; }
+  int capacity() const { return capacity_; }
+  int free() const { return capacity_ - size_; }
+
+  void Commit(int n) { size_ += n; }
+
+ private:
+  friend class base::RefCountedThreadSafe<IOBufBlock>;
+  ~IOBufBlock();
+
+  char* data_;
+  int size_;
+  int capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(IOBufBlock);
+};
+
+// a rope of slices over refcounted blocks. copying a chain shares the
+// blocks, so Split, Append(chain) and Clone never copy payload bytes and
+// a chain can be passed through a Chan by value.
+class IOBufChain {
+ public:
+  IOBufChain();
+  ~IOBufChain();
+
+  int size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  int slices() const { return static_cast<int>(slices_.size()); }
+
+  void clear();
+
+  // copies data in, filling the tail block first if only we own it.
+  void Append(const void* data, int len);
+
+  // shares the blocks of other.
+  void Append(const IOBufChain& other);
+
+  // removes the first n bytes from this chain and returns them.
+  IOBufChain Split(int n);
+
+  void TrimFront(int n);
+
+  IOBufChain Clone() const {
+    return *this;
+  }
+
+  // copies up to len bytes from the front, returns bytes copied.
+  int CopyTo(void* buf, int len) const;
+
+  std::string ToString() const;
+
+  // fills iov with the slices from the front, returns the count.
+  int ToIOVecs(IOVec* iov, int max) const;
+
+  // room for at least min bytes at the tail for a read, commit what
+  // was filled with CommitTail.
+  void GetWritableTail(int min, char** ptr, int* len);
+  void CommitTail(int n);
+
+ private:
+  struct Slice {
+    scoped_refptr<IOBufBlock> block;
+    int offset;
+    int len;
+  };
+
+  std::vector<Slice> slices_;
+  int size_;
+};
+
+}  // namespace io
+}  // namespace tin
@@ -8,6 +8,7 @@
 #include "tin/runtime/util.h"
 #include "tin/runtime/scheduler.h"
 #include "tin/runtime/threadpoll.h"
+#include "tin/runtime/net/uring.h"
 #include "tin/io/ioutil.h"
 
 namespace tin {
@@ -190,6 +191,130 @@ int WriteFile(file_t file, const char* data, int size) {
   return work->BytesWritten();
 }
 
+// ReadAt, WriteAt
+class PositionalWork : public GletWork {
+ public:
+  PositionalWork(file_t file, char* data, int size, int64 offset,
+                 bool write)
+    : result_(-1)
+    , file_(file)
+    , data_(data)
+    , size_(size)
+    , offset_(offset)
+    , write_(write) {
+  }
+
+  virtual ~PositionalWork() { }
+
+  virtual void Run() {
+    if (write_) {
+      result_ = base::WritePlatformFile(file_, offset_, data_, size_);
+    } else {
+      result_ = base::ReadPlatformFile(file_, offset_, data_, size_);
+    }
+    Finalize();
+  }
+
+  int Result() const {
+    return result_;
+  }
+
+ private:
+  int result_;
+  file_t file_;
+  char* data_;
+  int size_;
+  int64 offset_;
+  bool write_;
+};
+
+#if defined(OS_LINUX)
+struct UringFileRequest {
+  file_t file;
+  char* data;
+  int size;
+  int64 offset;
+  bool write;
+  UringOp op;
+};
+
+// we are parked, the completion may ready us now.
+bool QueueUringFileUnlockF(void* arg1, void* arg2) {
+  UringFileRequest* req = static_cast<UringFileRequest*>(arg1);
+  if (req->write) {
+    UringWriteAt(req->file, req->data, req->size, req->offset, &req->op);
+  } else {
+    UringReadAt(req->file, req->data, req->size, req->offset, &req->op);
+  }
+  return true;
+}
+#endif
+
+int PositionalIO(file_t file, char* data, int size, int64 offset,
+                 bool write) {
+#if defined(OS_LINUX)
+  if (UringEnabled()) {
+    UringFileRequest req;
+    req.file = file;
+    req.data = data;
+    req.size = size;
+    req.offset = offset;
+    req.write = write;
+    req.op.gp = GetG();
+    // submitted in a batch with the other requests of this P.
+    Park(QueueUringFileUnlockF, &req, NULL, runtime::kParkBlocking);
+    DCHECK(req.op.Done());
+    if (req.op.res < 0) {
+      SetErrorCode(TinTranslateSysError(-req.op.res));
+      return -1;
+    }
+    return req.op.res;
+  }
+#endif
+  // the greenlet stays parked until Run is done, no need for the heap.
+  PositionalWork work(file, data, size, offset, write);
+  SubmitGletWork(&work);
+  return work.Result();
+}
+
+int ReadAt(file_t file, char* data, int size, int64 offset) {
+  return PositionalIO(file, data, size, offset, false);
+}
+
+int WriteAt(file_t file, const char* data, int size, int64 offset) {
+  return PositionalIO(file, const_cast<char*>(data), size, offset, true);
+}
+
+// FlushFile
+class FlushFileWork : public GletWork {
+ public:
+  explicit FlushFileWork(file_t file)
+    : succeed_(false)
+    , file_(file) {
+  }
+
+  virtual ~FlushFileWork() { }
+
+  virtual void Run() {
+    succeed_ = base::FlushPlatformFile(file_);
+    Finalize();
+  }
+
+  bool Succeed() const {
+    return succeed_;
+  }
+
+ private:
+  bool succeed_;
+  file_t file_;
+};
+
+bool FlushFile(file_t file) {
+  FlushFileWork work(file);
+  SubmitGletWork(&work);
+  return work.Succeed();
+}
+
 // DeleteFile
 class DeleteFileWork : public GletWork {
  public:
@@ -24,10 +24,21 @@ bool CloseFile(file_t file);
 
 bool TruncateFile(file_t file, int64 length);
 
+// data and metadata reach stable storage, see FileAppender to share the
+// flush between writers.
+bool FlushFile(file_t file);
+
 int ReadFile(file_t file, char* data, int size);
 
 int WriteFile(file_t file, const char* data, int size);
 
+// positional, the file position is left alone. return bytes transferred or
+// -1 with the error code set. go through io_uring if it's enabled, else
+// through the thread pool.
+int ReadAt(file_t file, char* data, int size, int64 offset);
+
+int WriteAt(file_t file, const char* data, int size, int64 offset);
+
 bool DeleteFile(const path_t& path, bool recursive);
 
 // handy functions
@@ -0,0 +1,237 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "build/build_config.h"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "base/logging.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/threadpoll.h"
+#include "tin/io/mapped_file.h"
+
+namespace tin {
+
+using namespace runtime;  // NOLINT
+
+namespace {
+
+// 16k or 64k on some arm64 and ppc64 kernels, madvise fails on a start
+// aligned to less.
+size_t SystemPageSize() {
+#if defined(OS_WIN)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+#else
+  return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+const size_t kPageSize = SystemPageSize();
+
+}  // namespace
+
+class MappedFile::Mapping : public base::RefCountedThreadSafe<Mapping> {
+ public:
+  Mapping(char* data, size_t length)
+    : data_(data)
+    , length_(length) {
+  }
+
+  char* data() const {
+    return data_;
+  }
+
+  size_t length() const {
+    return length_;
+  }
+
+ private:
+  friend class base::RefCountedThreadSafe<Mapping>;
+
+  ~Mapping() {
+    if (data_ == NULL)
+      return;
+#if defined(OS_WIN)
+    UnmapViewOfFile(data_);
+#else
+    munmap(data_, length_);
+#endif
+  }
+
+  char* data_;
+  size_t length_;
+  DISALLOW_COPY_AND_ASSIGN(Mapping);
+};
+
+// the mapping is set up on the thread pool, mmap may wait on the file
+// system and fstat goes to disk.
+class MapFileWork : public GletWork {
+ public:
+  explicit MapFileWork(file_t file)
+    : data_(NULL)
+    , length_(0)
+    , result_(false)
+    , file_(file) {
+  }
+
+  virtual ~MapFileWork() { }
+
+  virtual void Run() {
+    result_ = Map();
+    int err = GetLastSystemErrorCode();
+    // the file is not needed once mapped. close it before resuming, the
+    // work lives on the stack of the waiting greenlet.
+    base::ClosePlatformFile(file_);
+    SaveLastError(err);
+    Resume();
+  }
+
+  char* data() const {
+    return data_;
+  }
+
+  size_t length() const {
+    return length_;
+  }
+
+  bool Result() const {
+    return result_;
+  }
+
+ private:
+  bool Map() {
+#if defined(OS_WIN)
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size))
+      return false;
+    length_ = static_cast<size_t>(size.QuadPart);
+    if (length_ == 0)
+      return true;
+    HANDLE map = CreateFileMapping(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map == NULL)
+      return false;
+    data_ = static_cast<char*>(MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0));
+    // the view keeps the section alive.
+    CloseHandle(map);
+    return data_ != NULL;
+#else
+    struct stat st;
+    if (fstat(file_, &st) != 0)
+      return false;
+    length_ = static_cast<size_t>(st.st_size);
+    // mmap refuses empty files, there is nothing to map anyway.
+    if (length_ == 0)
+      return true;
+    void* addr = mmap(NULL, length_, PROT_READ, MAP_SHARED, file_, 0);
+    if (addr == MAP_FAILED)
+      return false;
+    data_ = static_cast<char*>(addr);
+    return true;
+#endif
+  }
+
+  char* data_;
+  size_t length_;
+  bool result_;
+  file_t file_;
+};
+
+// fire and forget, nobody waits for it. the ref keeps the range mapped
+// even if the file is closed meanwhile.
+class PrefetchWork : public Work {
+ public:
+  PrefetchWork(MappedFile::Mapping* mapping, size_t offset, size_t length)
+    : mapping_(mapping)
+    , offset_(offset)
+    , length_(length) {
+  }
+
+  virtual ~PrefetchWork() { }
+
+  virtual void Run() {
+    char* data = mapping_->data() + offset_;
+#if defined(OS_WIN)
+    // PrefetchVirtualMemory needs Windows 8, touch a byte per page.
+    volatile char sink = 0;
+    for (size_t i = 0; i < length_; i += kPageSize)
+      sink += data[i];
+#else
+    madvise(data, length_, MADV_WILLNEED);
+#endif
+    delete this;
+  }
+
+ private:
+  scoped_refptr<MappedFile::Mapping> mapping_;
+  size_t offset_;
+  size_t length_;
+};
+
+MappedFile::MappedFile()
+  : data_(NULL)
+  , length_(0)
+  , valid_(false) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Open(const path_t& path) {
+  file_t file = OpenFileForRead(path, NULL);
+  if (file == kInvalidFile)
+    return false;
+  return Initialize(file);
+}
+
+bool MappedFile::Initialize(file_t file) {
+  DCHECK(!valid_);
+  MapFileWork work(file);
+  SubmitGletWork(&work);
+  if (!work.Result())
+    return false;
+  mapping_ = new Mapping(work.data(), work.length());
+  data_ = work.data();
+  length_ = work.length();
+  valid_ = true;
+  return true;
+}
+
+void MappedFile::Close() {
+  mapping_ = NULL;
+  data_ = NULL;
+  length_ = 0;
+  valid_ = false;
+}
+
+base::StringPiece MappedFile::Slice(size_t offset, size_t len) const {
+  if (offset >= length_)
+    return base::StringPiece();
+  if (len > length_ - offset)
+    len = length_ - offset;
+  return base::StringPiece(data_ + offset, len);
+}
+
+void MappedFile::Prefetch(size_t offset, size_t len) {
+  if (offset >= length_ || len == 0)
+    return;
+  if (len > length_ - offset)
+    len = length_ - offset;
+  // madvise wants a page aligned start, the map itself is.
+  size_t start = offset & ~(kPageSize - 1);
+  len += offset - start;
+  ThreadPoll::GetInstance()->AddWork(
+      new PrefetchWork(mapping_.get(), start, len));
+}
+
+}  // namespace tin
@@ -0,0 +1,71 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include "base/memory/ref_counted.h"
+#include "base/strings/string_piece.h"
+#include "tin/io/ioutil.h"
+
+namespace tin {
+
+// read only view of a whole file mapped in memory, for large immutable
+// files such as indices. reads are plain memory accesses, no syscall, but
+// touching a page that is not in the page cache is a major fault that
+// blocks the whole P, Prefetch pulls hot ranges in from the thread pool.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // maps the whole file read only, open and mmap run on the thread pool.
+  // false with the error code set on failure.
+  bool Open(const path_t& path);
+
+  // same, but maps an already opened file. file is closed in any case,
+  // the mapping stays valid without it.
+  bool Initialize(file_t file);
+
+  // unmaps, once the prefetches still pending are done.
+  void Close();
+
+  bool IsValid() const {
+    return valid_;
+  }
+
+  const char* data() const {
+    return data_;
+  }
+
+  size_t length() const {
+    return length_;
+  }
+
+  base::StringPiece View() const {
+    return base::StringPiece(data_, length_);
+  }
+
+  // [offset, offset + len) clamped to the end of the file.
+  base::StringPiece Slice(size_t offset, size_t len) const;
+
+  // asks the kernel to read [offset, offset + len) ahead, madvise
+  // WILLNEED is issued on the thread pool and this returns at once.
+  void Prefetch(size_t offset, size_t len);
+
+  void Prefetch() {
+    Prefetch(0, length_);
+  }
+
+ private:
+  friend class PrefetchWork;
+  class Mapping;
+
+  // shared with pending prefetches, they may finish after Close.
+  scoped_refptr<Mapping> mapping_;
+  const char* data_;
+  size_t length_;
+  bool valid_;
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+};
+
+}  // namespace tin
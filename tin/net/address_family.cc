@@ -28,6 +28,8 @@ int ConvertAddressFamily(AddressFamily address_family) {
     return AF_INET;
   case ADDRESS_FAMILY_IPV6:
     return AF_INET6;
+  case ADDRESS_FAMILY_UNIX:
+    return AF_UNIX;
   }
   NOTREACHED();
   return AF_UNSPEC;
@@ -17,7 +17,8 @@ enum AddressFamily {
   ADDRESS_FAMILY_UNSPECIFIED,   // AF_UNSPEC
   ADDRESS_FAMILY_IPV4,          // AF_INET
   ADDRESS_FAMILY_IPV6,          // AF_INET6
-  ADDRESS_FAMILY_LAST = ADDRESS_FAMILY_IPV6
+  ADDRESS_FAMILY_UNIX,          // AF_UNIX, sockets only, never resolved
+  ADDRESS_FAMILY_LAST = ADDRESS_FAMILY_UNIX
 };
 
 // HostResolverFlags is a bitflag enum used by host resolver procedures to
@@ -37,7 +38,7 @@ typedef int HostResolverFlags;
 // Returns AddressFamily for |address|.
 AddressFamily GetAddressFamily(const IPAddress& address);
 
-// Maps the given AddressFamily to either AF_INET, AF_INET6 or AF_UNSPEC.
+// Maps the given AddressFamily to AF_INET, AF_INET6, AF_UNIX or AF_UNSPEC.
 int ConvertAddressFamily(AddressFamily address_family);
 
 }  // namespace net
@@ -0,0 +1,69 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <new>
+
+#include "base/basictypes.h"
+#include "tin/sync/pool.h"
+
+#include "tin/net/conn_alloc.h"
+
+namespace tin {
+namespace net {
+
+namespace {
+
+template <size_t Size>
+struct ConnBlock {
+  union {
+    char bytes[Size];
+    // as aligned as malloc is.
+    double align_double;
+    int64 align_int64;
+    void* align_pointer;
+  };
+};
+
+template <size_t Size>
+ConnBlock<Size>* NewConnBlock() {
+  return new ConnBlock<Size>;
+}
+
+Pool<ConnBlock<256> > pool_256(&NewConnBlock<256>);
+Pool<ConnBlock<512> > pool_512(&NewConnBlock<512>);
+Pool<ConnBlock<1024> > pool_1024(&NewConnBlock<1024>);
+Pool<ConnBlock<2048> > pool_2048(&NewConnBlock<2048>);
+
+}  // namespace
+
+void* ConnAlloc(size_t size) {
+  if (size <= 256)
+    return pool_256.Get();
+  if (size <= 512)
+    return pool_512.Get();
+  if (size <= 1024)
+    return pool_1024.Get();
+  if (size <= 2048)
+    return pool_2048.Get();
+  return ::operator new(size);
+}
+
+void ConnFree(void* p, size_t size) {
+  if (p == NULL)
+    return;
+  if (size <= 256) {
+    pool_256.Put(static_cast<ConnBlock<256>*>(p));
+  } else if (size <= 512) {
+    pool_512.Put(static_cast<ConnBlock<512>*>(p));
+  } else if (size <= 1024) {
+    pool_1024.Put(static_cast<ConnBlock<1024>*>(p));
+  } else if (size <= 2048) {
+    pool_2048.Put(static_cast<ConnBlock<2048>*>(p));
+  } else {
+    ::operator delete(p);
+  }
+}
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,28 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+
+namespace tin {
+namespace net {
+
+// memory of the objects every connection makes, NetFD and TcpConnImpl.
+// blocks of a few size classes are recycled through a tin::Pool, so an
+// accept mostly takes them from the cache of its P instead of malloc.
+// larger sizes go to operator new.
+void* ConnAlloc(size_t size);
+void ConnFree(void* p, size_t size);
+
+}  // namespace net
+}  // namespace tin
+
+// class operators that put T on ConnAlloc.
+#define TIN_CONN_ALLOCATED() \
+  static void* operator new(size_t size) { \
+    return tin::net::ConnAlloc(size); \
+  } \
+  static void operator delete(void* p, size_t size) { \
+    tin::net::ConnFree(p, size); \
+  }
@@ -0,0 +1,260 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "tin/config/config.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/spawn.h"
+#include "tin/sync/pool.h"
+#include "tin/net/dialer.h"
+
+#include "tin/net/conn_pool.h"
+
+namespace tin {
+namespace net {
+
+namespace {
+// the reaper runs this often relative to idle_timeout, expired
+// connections live at most 1.5 idle_timeout.
+const int kReapsPerTimeout = 2;
+}  // namespace
+
+ConnPool::ConnPool(const ConnPoolOptions& options)
+  : options_(options)
+  , active_cond_(&mu_)
+  , reaper_cond_(&mu_)
+  , stopping_(false)
+  , reaper_done_(false) {
+  int nshards = std::max(runtime::rtm_conf->MaxProcs(), 1);
+  for (int i = 0; i < nshards; ++i) {
+    Shard* shard = new Shard;
+    memset(&shard->stats, 0, sizeof(shard->stats));
+    shards_.push_back(shard);
+  }
+  Spawn(&ConnPool::ReaperLoop, base::Unretained(this));
+}
+
+ConnPool::~ConnPool() {
+  {
+    MutexGuard guard(&mu_);
+    stopping_ = true;
+    reaper_cond_.Signal();
+    while (!reaper_done_)
+      reaper_cond_.Wait();
+  }
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    delete shards_[i];
+  }
+}
+
+ConnPool::Shard* ConnPool::LocalShard() {
+  int id = tin::internal::PoolProcId();
+  if (id < 0)
+    id = 0;
+  return shards_[id % shards_.size()];
+}
+
+TcpConn ConnPool::TakeIdle(Shard* shard, const IPEndPoint& endpoint,
+                           int64 now, std::vector<TcpConn>* dropped) {
+  while (true) {
+    TcpConn conn = PopIdle(shard, endpoint, now, dropped);
+    if (conn.get() == NULL)
+      return conn;
+    // a recv, not under the shard lock.
+    bool usable = conn->IsIdleUsable();
+    {
+      runtime::RawMutexGuard guard(&shard->lock);
+      if (usable) {
+        shard->stats.hits++;
+      } else {
+        shard->stats.unhealthy++;
+      }
+    }
+    if (usable)
+      return conn;
+    dropped->push_back(conn);
+  }
+}
+
+TcpConn ConnPool::PopIdle(Shard* shard, const IPEndPoint& endpoint,
+                          int64 now, std::vector<TcpConn>* dropped) {
+  runtime::RawMutexGuard guard(&shard->lock);
+  IdleMap::iterator it = shard->idle.find(endpoint);
+  if (it == shard->idle.end())
+    return TcpConn();
+  std::deque<IdleConn>& conns = it->second;
+  TcpConn conn;
+  // newest first, its peer is the least likely to have given up.
+  while (!conns.empty()) {
+    IdleConn idle = conns.back();
+    conns.pop_back();
+    if (now - idle.since > options_.idle_timeout) {
+      shard->stats.reaped++;
+      dropped->push_back(idle.conn);
+      continue;
+    }
+    conn = idle.conn;
+    break;
+  }
+  if (conns.empty())
+    shard->idle.erase(it);
+  return conn;
+}
+
+TcpConn ConnPool::Get(const IPEndPoint& endpoint) {
+  if (options_.max_active > 0)
+    AcquireActive(endpoint);
+
+  // closed once the shard locks are released.
+  std::vector<TcpConn> dropped;
+  int64 now = CoarseNow();
+  Shard* local = LocalShard();
+  TcpConn conn = TakeIdle(local, endpoint, now, &dropped);
+  for (size_t i = 0; conn.get() == NULL && i < shards_.size(); ++i) {
+    if (shards_[i] != local)
+      conn = TakeIdle(shards_[i], endpoint, now, &dropped);
+  }
+  if (conn.get() != NULL)
+    return conn;
+
+  {
+    runtime::RawMutexGuard guard(&local->lock);
+    local->stats.dials++;
+  }
+  conn = DialTcpTimeout(endpoint.address(), endpoint.port(),
+                        options_.dial_timeout);
+  if (ErrorOccured()) {
+    if (options_.max_active > 0)
+      ReleaseActive(endpoint);
+    return TcpConn();
+  }
+  return conn;
+}
+
+void ConnPool::Put(const IPEndPoint& endpoint, const TcpConn& conn,
+                   bool reusable) {
+  if (options_.max_active > 0)
+    ReleaseActive(endpoint);
+  if (conn.get() == NULL)
+    return;
+  if (!reusable || options_.max_idle <= 0) {
+    conn->Close();
+    return;
+  }
+  TcpConn evicted;
+  {
+    Shard* shard = LocalShard();
+    runtime::RawMutexGuard guard(&shard->lock);
+    std::deque<IdleConn>& conns = shard->idle[endpoint];
+    if (static_cast<int>(conns.size()) >= options_.max_idle) {
+      evicted = conns.front().conn;
+      conns.pop_front();
+    }
+    IdleConn idle;
+    idle.conn = conn;
+    idle.since = CoarseNow();
+    conns.push_back(idle);
+  }
+  if (evicted.get() != NULL)
+    evicted->Close();
+}
+
+void ConnPool::CloseIdle() {
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    IdleMap idle;
+    {
+      runtime::RawMutexGuard guard(&shards_[i]->lock);
+      idle.swap(shards_[i]->idle);
+    }
+    for (IdleMap::iterator it = idle.begin(); it != idle.end(); ++it) {
+      for (size_t j = 0; j < it->second.size(); ++j)
+        it->second[j].conn->Close();
+    }
+  }
+}
+
+void ConnPool::GetStats(ConnPoolStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    runtime::RawMutexGuard guard(&shards_[i]->lock);
+    stats->hits += shards_[i]->stats.hits;
+    stats->dials += shards_[i]->stats.dials;
+    stats->unhealthy += shards_[i]->stats.unhealthy;
+    stats->reaped += shards_[i]->stats.reaped;
+  }
+}
+
+void ConnPool::AcquireActive(const IPEndPoint& endpoint) {
+  MutexGuard guard(&mu_);
+  int* active = &active_[endpoint];
+  while (*active >= options_.max_active) {
+    active_cond_.Wait();
+    // the map may have changed meanwhile.
+    active = &active_[endpoint];
+  }
+  (*active)++;
+}
+
+void ConnPool::ReleaseActive(const IPEndPoint& endpoint) {
+  MutexGuard guard(&mu_);
+  std::map<IPEndPoint, int>::iterator it = active_.find(endpoint);
+  DCHECK(it != active_.end() && it->second > 0);
+  if (--it->second == 0)
+    active_.erase(it);
+  // waiters may be for other endpoints.
+  active_cond_.Broascast();
+}
+
+void ConnPool::Reap(int64 now) {
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    std::vector<TcpConn> expired;
+    {
+      Shard* shard = shards_[i];
+      runtime::RawMutexGuard guard(&shard->lock);
+      IdleMap::iterator it = shard->idle.begin();
+      while (it != shard->idle.end()) {
+        // oldest at the front.
+        std::deque<IdleConn>& conns = it->second;
+        while (!conns.empty() &&
+               now - conns.front().since > options_.idle_timeout) {
+          expired.push_back(conns.front().conn);
+          conns.pop_front();
+          shard->stats.reaped++;
+        }
+        if (conns.empty()) {
+          shard->idle.erase(it++);
+        } else {
+          ++it;
+        }
+      }
+    }
+    for (size_t j = 0; j < expired.size(); ++j)
+      expired[j]->Close();
+  }
+}
+
+void ConnPool::ReaperLoop() {
+  int64 period = std::max(options_.idle_timeout / kReapsPerTimeout,
+                          kMillisecond);
+  MutexGuard guard(&mu_);
+  while (!stopping_) {
+    reaper_cond_.WaitFor(period);
+    if (stopping_)
+      break;
+    mu_.Unlock();
+    Reap(CoarseNow());
+    mu_.Lock();
+  }
+  CloseIdle();
+  reaper_done_ = true;
+  reaper_cond_.Signal();
+}
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,116 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "tin/time/time.h"
+#include "tin/sync/mutex.h"
+#include "tin/sync/cond.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/net/ip_endpoint.h"
+#include "tin/net/tcp_conn.h"
+
+namespace tin {
+namespace net {
+
+struct ConnPoolOptions {
+  ConnPoolOptions()
+    : max_idle(8)
+    , max_active(0)
+    , idle_timeout(90 * kSecond)
+    , dial_timeout(-1) {
+  }
+
+  // idle connections kept per endpoint on each P.
+  int max_idle;
+  // connections per endpoint handed out and not yet Put back, Get waits
+  // beyond that. 0 is no limit.
+  int max_active;
+  // idle connections older than that are closed.
+  int64 idle_timeout;
+  // see DialTcpTimeout, -1 waits for the kernel.
+  int64 dial_timeout;
+};
+
+struct ConnPoolStats {
+  // Gets served by an idle connection.
+  uint64 hits;
+  uint64 dials;
+  // idle connections found closed or readable by the peer.
+  uint64 unhealthy;
+  // closed for exceeding idle_timeout.
+  uint64 reaped;
+};
+
+// keeps client connections open between requests, keyed by endpoint.
+// idle lists are per P, Get and Put take the lock of the current P only
+// and look at other Ps only if the local list is empty. a reaper
+// greenlet closes expired connections. must be created and destroyed on
+// a greenlet.
+class ConnPool {
+ public:
+  explicit ConnPool(const ConnPoolOptions& options);
+  ~ConnPool();
+
+  // a healthy idle connection to endpoint, or a new one. an empty
+  // TcpConn with the error code set if the dial failed.
+  TcpConn Get(const IPEndPoint& endpoint);
+
+  // returns conn from Get. not reusable if the protocol state is unknown,
+  // e.g. after an error mid request, it is closed then.
+  void Put(const IPEndPoint& endpoint, const TcpConn& conn,
+           bool reusable = true);
+
+  // closes every idle connection.
+  void CloseIdle();
+
+  void GetStats(ConnPoolStats* stats);
+
+ private:
+  struct IdleConn {
+    TcpConn conn;
+    int64 since;
+  };
+
+  typedef std::map<IPEndPoint, std::deque<IdleConn> > IdleMap;
+
+  struct Shard {
+    runtime::RawMutex lock;
+    IdleMap idle;
+    ConnPoolStats stats;
+  };
+
+  Shard* LocalShard();
+  // newest usable connection of shard, the unusable ones go to *dropped.
+  TcpConn TakeIdle(Shard* shard, const IPEndPoint& endpoint, int64 now,
+                   std::vector<TcpConn>* dropped);
+  // the newest idle connection that has not expired, unchecked.
+  TcpConn PopIdle(Shard* shard, const IPEndPoint& endpoint, int64 now,
+                  std::vector<TcpConn>* dropped);
+  void AcquireActive(const IPEndPoint& endpoint);
+  void ReleaseActive(const IPEndPoint& endpoint);
+  void Reap(int64 now);
+  void ReaperLoop();
+
+  const ConnPoolOptions options_;
+  std::vector<Shard*> shards_;
+
+  // guards active_ and the reaper state. active_ is only kept with
+  // max_active set.
+  Mutex mu_;
+  Cond active_cond_;
+  Cond reaper_cond_;
+  std::map<IPEndPoint, int> active_;
+  bool stopping_;
+  bool reaper_done_;
+  DISALLOW_COPY_AND_ASSIGN(ConnPool);
+};
+
+}  // namespace net
+}  // namespace tin
@@ -2,14 +2,29 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
+#include <set>
+#include <vector>
+
 #include "base/logging.h"
+#include "base/memory/ref_counted.h"
+#include "build/build_config.h"
 
 #include "tin/error/error.h"
 #include "tin/time/time.h"
+#include "tin/sync/mutex.h"
+#include "tin/sync/cond.h"
 #include "tin/net/ip_endpoint.h"
 #include "tin/net/netfd.h"
+#include "tin/net/resolve.h"
+#if defined(OS_POSIX)
+#include "tin/net/sys_socket.h"
+#include "tin/net/handover.h"
+#endif
 #include "tin/net/dialer.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/spawn.h"
 
 namespace tin {
 namespace net {
@@ -23,7 +38,7 @@ TcpConn DialTcpInternal(const IPAddress& address, uint16 port, int64 deadline) {
     IPEndPoint endpoint(address, port);
     if (deadline == -1)
       deadline = kint64max;
-    err = netfd->Dial(NULL, &endpoint, kint64max);
+    err = netfd->Dial(NULL, &endpoint, deadline);
     if (err != 0) {
       delete netfd;
       netfd = NULL;
@@ -33,14 +48,167 @@ TcpConn DialTcpInternal(const IPAddress& address, uint16 port, int64 deadline) {
   return MakeTcpConn(new TcpConnImpl(netfd));
 }
 
+namespace {
+
+// RFC 8305 connection attempt delay.
+const int64 kHappyEyeballsDelay = 250 * kMillisecond;
+
+// happy eyeballs, one greenlet per connection attempt. the next attempt
+// starts after kHappyEyeballsDelay, or at once if one fails, the first
+// connection wins and the attempts still in flight are closed.
+class ParallelDial : public base::RefCountedThreadSafe<ParallelDial> {
+ public:
+  explicit ParallelDial(int64 deadline)
+    : cond_(&mu_)
+    , winner_(NULL)
+    , done_(false)
+    , failed_(0)
+    , last_error_(0)
+    , deadline_(deadline) {
+  }
+
+  NetFD* Run(const AddressList& endpoints, int* error_code);
+
+ private:
+  friend class base::RefCountedThreadSafe<ParallelDial>;
+
+  ~ParallelDial() { }
+
+  void Attempt(const IPEndPoint& endpoint);
+
+  Mutex mu_;
+  Cond cond_;
+  NetFD* winner_;
+  bool done_;
+  size_t failed_;
+  int last_error_;
+  const int64 deadline_;
+  // attempts in connect. one that got its NetFD but is not in connect yet
+  // when the winner closes the others runs to its own timeout.
+  std::set<NetFD*> inflight_;
+  DISALLOW_COPY_AND_ASSIGN(ParallelDial);
+};
+
+void ParallelDial::Attempt(const IPEndPoint& endpoint) {
+  int err = 0;
+  NetFD* netfd = NewFD(endpoint.GetFamily(), SOCK_STREAM, &err);
+  {
+    MutexGuard guard(&mu_);
+    if (netfd == NULL || done_) {
+      if (netfd == NULL) {
+        failed_++;
+        last_error_ = err;
+      }
+      delete netfd;
+      cond_.Broascast();
+      return;
+    }
+    inflight_.insert(netfd);
+  }
+  IPEndPoint remote(endpoint);
+  err = netfd->Dial(NULL, &remote, deadline_);
+  MutexGuard guard(&mu_);
+  inflight_.erase(netfd);
+  if (err == 0 && !done_) {
+    winner_ = netfd;
+    done_ = true;
+  } else {
+    if (err != 0) {
+      failed_++;
+      last_error_ = err;
+    }
+    delete netfd;
+  }
+  cond_.Broascast();
+}
+
+NetFD* ParallelDial::Run(const AddressList& endpoints, int* error_code) {
+  // alternate families, starting with the one the resolver put first.
+  std::vector<IPEndPoint> first;
+  std::vector<IPEndPoint> second;
+  AddressFamily preferred = endpoints[0].GetFamily();
+  for (size_t i = 0; i < endpoints.size(); ++i) {
+    if (endpoints[i].GetFamily() == preferred) {
+      first.push_back(endpoints[i]);
+    } else {
+      second.push_back(endpoints[i]);
+    }
+  }
+  std::vector<IPEndPoint> order;
+  for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+    if (i < first.size())
+      order.push_back(first[i]);
+    if (i < second.size())
+      order.push_back(second[i]);
+  }
+
+  MutexGuard guard(&mu_);
+  size_t launched = 0;
+  while (!done_) {
+    if (launched < order.size()) {
+      Spawn(&ParallelDial::Attempt, scoped_refptr<ParallelDial>(this),
+            order[launched]);
+      launched++;
+      size_t failed = failed_;
+      int64 next = MonoNow() + kHappyEyeballsDelay;
+      while (!done_ && failed_ == failed) {
+        int64 left = next - MonoNow();
+        if (left <= 0 || !cond_.WaitFor(left))
+          break;
+      }
+      continue;
+    }
+    if (failed_ == launched)
+      break;
+    cond_.Wait();
+  }
+  // late attempts give up, the ones in connect are woken up.
+  done_ = true;
+  for (std::set<NetFD*>::iterator it = inflight_.begin();
+       it != inflight_.end(); ++it) {
+    (*it)->Close();
+  }
+  *error_code = winner_ == NULL ? last_error_ : 0;
+  return winner_;
+}
+
+}  // namespace
+
+TcpConn DialTcpInternal(const AddressList& endpoints, int64 deadline) {
+  if (endpoints.empty()) {
+    SetErrorCode(TIN_EINVAL);
+    return TcpConn(NULL);
+  }
+  if (deadline == -1)
+    deadline = kint64max;
+  int err = 0;
+  scoped_refptr<ParallelDial> dial(new ParallelDial(deadline));
+  NetFD* netfd = dial->Run(endpoints, &err);
+  SetErrorCode(TinTranslateSysError(err));
+  return MakeTcpConn(new TcpConnImpl(netfd));
+}
+
 TcpConn DialTcpInternal(const base::StringPiece& address, uint16 port,
                         int64 deadline) {
   IPAddress ip_address;
-  if (!ip_address.AssignFromIPLiteral(address)) {
-    SetErrorCode(TIN_EINVAL);
+  if (ip_address.AssignFromIPLiteral(address)) {
+    return DialTcpInternal(ip_address, port, deadline);
+  }
+  std::vector<IPAddress> addresses;
+  if (ResolveHostname(address, ADDRESS_FAMILY_UNSPECIFIED, &addresses) != 0 ||
+      addresses.empty()) {
+    if (!ErrorOccured())
+      SetErrorCode(TIN_EAI_NONAME);
     return TcpConn(NULL);
   }
-  return DialTcpInternal(ip_address, port, deadline);
+  if (addresses.size() == 1) {
+    return DialTcpInternal(addresses[0], port, deadline);
+  }
+  AddressList endpoints;
+  for (size_t i = 0; i < addresses.size(); ++i) {
+    endpoints.push_back(IPEndPoint(addresses[i], port));
+  }
+  return DialTcpInternal(endpoints, deadline);
 }
 
 TcpConn DialTcp(const IPAddress& address, uint16 port) {
@@ -60,7 +228,85 @@ TcpConn DialTcpTimeout(const base::StringPiece& address, uint16 port,
   return DialTcpInternal(address, port, deadline);
 }
 
-TCPListener ListenTcp(const IPAddress& address, uint16 port, int backlog) {
+TcpConn DialTcpFastOpen(const IPAddress& address, uint16 port,
+                        const base::StringPiece& data, int64 deadline) {
+  int err = 0;
+  AddressFamily family =
+    address.IsIPv4() ? ADDRESS_FAMILY_IPV4 : ADDRESS_FAMILY_IPV6;
+  NetFD* netfd = NewFD(family, SOCK_STREAM, &err);
+  if (netfd != NULL) {
+    IPEndPoint endpoint(address, port);
+    if (deadline == -1)
+      deadline = kint64max;
+#if defined(OS_LINUX)
+    // connect returns at once then, the SYN leaves with the first write.
+    bool fastopen = netfd->EnableFastOpenConnect();
+#endif
+    err = netfd->Dial(NULL, &endpoint, deadline);
+    if (err == 0 && !data.empty()) {
+      int n = 0;
+#if defined(OS_LINUX)
+      if (fastopen) {
+        err = netfd->FastOpenWrite(data.data(), data.size(), &n);
+      } else {
+        err = netfd->Write(data.data(), data.size(), &n);
+      }
+#else
+      err = netfd->Write(data.data(), data.size(), &n);
+#endif
+    }
+    if (err != 0) {
+      delete netfd;
+      netfd = NULL;
+    }
+  }
+  SetErrorCode(TinTranslateSysError(err));
+  return MakeTcpConn(new TcpConnImpl(netfd));
+}
+
+TcpConn DialTcp(const AddressList& endpoints) {
+  return DialTcpInternal(endpoints, -1);
+}
+
+TcpConn DialTcpTimeout(const AddressList& endpoints, int64 deadline) {
+  return DialTcpInternal(endpoints, deadline);
+}
+
+namespace {
+// applies Config::TcpDeferAcceptSec once netfd listens, an accept filter
+// only takes then. a failure only costs the optimization.
+void DeferAccept(NetFD* netfd) {
+  int defer = tin::runtime::rtm_conf->TcpDeferAcceptSec();
+  if (defer <= 0)
+    return;
+#if defined(TCP_DEFER_ACCEPT)
+  int rv = netfd->SetSockOpt(IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer,
+                             sizeof(defer));
+  VLOG_IF(1, rv != 0) << "TCP_DEFER_ACCEPT failed: " << rv;
+#elif defined(SO_ACCEPTFILTER)
+  // accf_data has to be loaded.
+  struct accept_filter_arg afa;
+  memset(&afa, 0, sizeof(afa));
+  strcpy(afa.af_name, "dataready");
+  int rv = netfd->SetSockOpt(SOL_SOCKET, SO_ACCEPTFILTER, &afa,
+                             sizeof(afa));
+  VLOG_IF(1, rv != 0) << "SO_ACCEPTFILTER failed: " << rv;
+#endif
+}
+}  // namespace
+
+NetFD* ListenOne(const IPAddress& address, uint16 port, int backlog,
+                 bool reuseport, int* error_code) {
+#if defined(OS_POSIX)
+  // left by the process we took over from, already bound and listening.
+  NetFD* inherited = TakeInheritedListener(IPEndPoint(address, port));
+  if (inherited != NULL) {
+    // the old process may have run without it, or with another value.
+    DeferAccept(inherited);
+    *error_code = 0;
+    return inherited;
+  }
+#endif
   int err = 0;
   AddressFamily family =
     address.IsIPv4() ? ADDRESS_FAMILY_IPV4 : ADDRESS_FAMILY_IPV6;
@@ -73,6 +319,21 @@ TCPListener ListenTcp(const IPAddress& address, uint16 port, int backlog) {
       err = netfd->SetSockOpt(SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
 #endif
     }
+#if defined(TCP_FASTOPEN)
+    int qlen = tin::runtime::rtm_conf->TcpFastOpenQueue();
+    if (err == 0 && qlen > 0) {
+      // an old kernel without it is not worth failing the listen for.
+      int rv = netfd->SetSockOpt(IPPROTO_TCP, TCP_FASTOPEN, &qlen,
+                                 sizeof(qlen));
+      VLOG_IF(1, rv != 0) << "TCP_FASTOPEN failed: " << rv;
+    }
+#endif
+#if defined(OS_LINUX)
+    if (err == 0 && reuseport) {
+      int on = 1;
+      err = netfd->SetSockOpt(SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
+#endif
     if (err == 0) {
       IPEndPoint endpoint(address, port);
       err = netfd->Bind(endpoint);
@@ -82,10 +343,19 @@ TCPListener ListenTcp(const IPAddress& address, uint16 port, int backlog) {
   if (err == 0) {
     err = netfd->Listen(backlog);
   }
+  if (err == 0)
+    DeferAccept(netfd);
   if (err != 0 && netfd != NULL) {
     delete netfd;
     netfd = NULL;
   }
+  *error_code = err;
+  return netfd;
+}
+
+TCPListener ListenTcp(const IPAddress& address, uint16 port, int backlog) {
+  int err = 0;
+  NetFD* netfd = ListenOne(address, port, backlog, false, &err);
   TCPListenerImpl* listener = NULL;
   if (netfd != NULL) {
     listener = new TCPListenerImpl(netfd, backlog);
@@ -94,6 +364,42 @@ TCPListener ListenTcp(const IPAddress& address, uint16 port, int backlog) {
   return TCPListener(listener);
 }
 
+TCPListener ListenTcp(const IPAddress& address, uint16 port, int backlog,
+                      int shards) {
+#if defined(OS_LINUX)
+  if (shards <= 0) {
+    shards = tin::runtime::rtm_conf->MaxProcs();
+  }
+#else
+  // other kernels either lack SO_REUSEPORT or hand every connection
+  // to the last socket bound, so sharding would only starve the rest.
+  shards = 1;
+#endif
+  // each socket would get its own ephemeral port.
+  if (shards == 1 || port == 0) {
+    return ListenTcp(address, port, backlog);
+  }
+  int err = 0;
+  std::vector<NetFD*> netfds;
+  for (int i = 0; i < shards; ++i) {
+    NetFD* netfd = ListenOne(address, port, backlog, true, &err);
+    if (netfd == NULL) {
+      break;
+    }
+    netfds.push_back(netfd);
+  }
+  TCPListenerImpl* listener = NULL;
+  if (err == 0) {
+    listener = new TCPListenerImpl(netfds, backlog);
+  } else {
+    for (size_t i = 0; i < netfds.size(); ++i) {
+      delete netfds[i];
+    }
+  }
+  SetErrorCode(TinTranslateSysError(err));
+  return TCPListener(listener);
+}
+
 TCPListener ListenTcp(const base::StringPiece& address, uint16 port,
                       int backlog) {
   IPAddress ip_address;
@@ -104,5 +410,15 @@ TCPListener ListenTcp(const base::StringPiece& address, uint16 port,
   return ListenTcp(ip_address, port, backlog);
 }
 
+TCPListener ListenTcp(const base::StringPiece& address, uint16 port,
+                      int backlog, int shards) {
+  IPAddress ip_address;
+  if (!ip_address.AssignFromIPLiteral(address)) {
+    SetErrorCode(TIN_EINVAL);
+    return TCPListener(NULL);
+  }
+  return ListenTcp(ip_address, port, backlog, shards);
+}
+
 }  // namespace net
 }  // namespace tin
@@ -7,6 +7,7 @@
 #include "base/basictypes.h"
 #include "base/strings/string_piece.h"
 #include "tin/net/ip_address.h"
+#include "tin/net/address_list.h"
 #include "tin/net/tcp_conn.h"
 #include "tin/net/listener.h"
 
@@ -15,16 +16,41 @@ namespace net {
 
 TcpConn DialTcp(const IPAddress& address, uint16 port);
 
+// addr is an IP literal or a host name. a name with several addresses is
+// dialed like the AddressList overload.
 TcpConn DialTcp(const base::StringPiece& addr, uint16 port);
 
+// happy eyeballs (RFC 8305), attempts alternate address families and a
+// new one starts every 250ms, or as soon as one fails. the first
+// connection wins, the others are closed.
+TcpConn DialTcp(const AddressList& endpoints);
+
 TcpConn DialTcpTimeout(const IPAddress& address, uint16 port, int64 deadline);
 
 TcpConn DialTcpTimeout(const base::StringPiece& addr, uint16 port,
                        int64 deadline);
 
+// dials and sends data, with TCP fast open where the kernel supports it
+// so data rides on the SYN instead of waiting a round trip. data must be
+// safe to replay, a server may see it twice. falls back to connect and
+// write elsewhere.
+TcpConn DialTcpFastOpen(const IPAddress& address, uint16 port,
+                        const base::StringPiece& data, int64 deadline = -1);
+
+// deadline applies to each attempt.
+TcpConn DialTcpTimeout(const AddressList& endpoints, int64 deadline);
+
 TCPListener ListenTcp(const base::StringPiece& addr, uint16 port,
                       int backlog = 511);
 
+// opens |shards| SO_REUSEPORT sockets on the same address so the kernel
+// spreads incoming connections across them, 0 means one per P.
+// run one accept loop per shard, see TCPListenerImpl::Accept(int).
+// falls back to a single socket where the kernel does not balance
+// SO_REUSEPORT listeners.
+TCPListener ListenTcp(const base::StringPiece& addr, uint16 port,
+                      int backlog, int shards);
+
 }  // namespace net
 }  // namespace tin
 
@@ -0,0 +1,517 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "build/build_config.h"
+#if defined(OS_POSIX)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#endif
+
+#include <string.h>
+
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/memory/scoped_ptr.h"
+#include "base/rand_util.h"
+#include "tin/error/error.h"
+#include "tin/time/time.h"
+#include "tin/io/ioutil.h"
+#include "tin/sync/once.h"
+#include "tin/sync/mutex.h"
+#include "tin/sync/cond.h"
+#include "tin/runtime/runtime.h"
+#include "tin/net/ip_endpoint.h"
+#include "tin/net/netfd.h"
+
+#include "tin/net/dns_client.h"
+
+namespace tin {
+namespace net {
+
+#if defined(OS_POSIX)
+namespace {
+
+const uint16 kDnsPort = 53;
+// per attempt, like the resolv.conf default of glibc.
+const int64 kDnsTimeout = 2 * kSecond;
+const int kDnsAttempts = 2;
+// no EDNS0, bigger answers come truncated and go to getaddrinfo.
+const int kDnsMaxUdpSize = 512;
+const size_t kDnsCacheMax = 4096;
+// don't trust a TTL beyond that.
+const uint32 kDnsMaxTtl = 3600;
+
+const uint16 kTypeA = 1;
+const uint16 kTypeAAAA = 28;
+const uint16 kClassIN = 1;
+
+enum {
+  kDnsOk,
+  kDnsNxDomain,
+  kDnsFailed,
+  // not the answer to our query, keep reading.
+  kDnsIgnore,
+};
+
+std::string ToLower(const base::StringPiece& s) {
+  std::string lower(s.data(), s.size());
+  for (size_t i = 0; i < lower.size(); i++) {
+    if (lower[i] >= 'A' && lower[i] <= 'Z')
+      lower[i] += 'a' - 'A';
+  }
+  return lower;
+}
+
+bool EndsWith(const std::string& s, const char* suffix) {
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// small config files, read through the thread pool.
+bool ReadWholeFile(const char* path, std::string* content) {
+  file_t file = OpenFileForRead(path_t(path), NULL);
+  if (file == kInvalidFile)
+    return false;
+  char buf[4096];
+  while (true) {
+    int n = tin::ReadFile(file, buf, sizeof(buf));
+    if (n <= 0)
+      break;
+    content->append(buf, n);
+  }
+  CloseFile(file);
+  return true;
+}
+
+void PutUint16(std::string* out, uint16 v) {
+  out->push_back(static_cast<char>(v >> 8));
+  out->push_back(static_cast<char>(v & 0xff));
+}
+
+uint16 GetUint16(const uint8* p) {
+  return static_cast<uint16>((p[0] << 8) | p[1]);
+}
+
+uint32 GetUint32(const uint8* p) {
+  return (static_cast<uint32>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) |
+         p[3];
+}
+
+// recursion desired, one question.
+bool BuildQuery(const std::string& name, uint16 id, uint16 qtype,
+                std::string* out) {
+  if (name.size() > 253)
+    return false;
+  PutUint16(out, id);
+  PutUint16(out, 0x0100);
+  PutUint16(out, 1);
+  PutUint16(out, 0);
+  PutUint16(out, 0);
+  PutUint16(out, 0);
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t end = name.find('.', start);
+    if (end == std::string::npos)
+      end = name.size();
+    size_t len = end - start;
+    if (len == 0 || len > 63)
+      return false;
+    out->push_back(static_cast<char>(len));
+    out->append(name, start, len);
+    start = end + 1;
+  }
+  out->push_back(0);
+  PutUint16(out, qtype);
+  PutUint16(out, kClassIN);
+  return true;
+}
+
+// advances *pos past a possibly compressed name.
+bool SkipName(const uint8* msg, int len, int* pos) {
+  int p = *pos;
+  while (p < len) {
+    uint8 c = msg[p];
+    if (c == 0) {
+      *pos = p + 1;
+      return true;
+    }
+    if ((c & 0xC0) == 0xC0) {
+      // a pointer ends the name.
+      if (p + 2 > len)
+        return false;
+      *pos = p + 2;
+      return true;
+    }
+    if ((c & 0xC0) != 0)
+      return false;
+    p += c + 1;
+  }
+  return false;
+}
+
+// takes the A or AAAA records of the answer section, CNAMEs are followed
+// by the server and their targets come along in the same section.
+int ParseResponse(const uint8* msg, int len, uint16 id, uint16 qtype,
+                  std::vector<IPAddress>* out, uint32* ttl) {
+  if (len < 12 || GetUint16(msg) != id)
+    return kDnsIgnore;
+  uint16 flags = GetUint16(msg + 2);
+  // not a response.
+  if ((flags & 0x8000) == 0)
+    return kDnsIgnore;
+  // truncated.
+  if ((flags & 0x0200) != 0)
+    return kDnsFailed;
+  int rcode = flags & 0x000f;
+  if (rcode == 3)
+    return kDnsNxDomain;
+  if (rcode != 0)
+    return kDnsFailed;
+  int qdcount = GetUint16(msg + 4);
+  int ancount = GetUint16(msg + 6);
+  int pos = 12;
+  for (int i = 0; i < qdcount; i++) {
+    if (!SkipName(msg, len, &pos) || pos + 4 > len)
+      return kDnsFailed;
+    pos += 4;
+  }
+  for (int i = 0; i < ancount; i++) {
+    if (!SkipName(msg, len, &pos) || pos + 10 > len)
+      return kDnsFailed;
+    uint16 type = GetUint16(msg + pos);
+    uint16 klass = GetUint16(msg + pos + 2);
+    uint32 record_ttl = GetUint32(msg + pos + 4);
+    int rdlen = GetUint16(msg + pos + 8);
+    pos += 10;
+    if (pos + rdlen > len)
+      return kDnsFailed;
+    if (type == qtype && klass == kClassIN) {
+      if ((type == kTypeA && rdlen == IPAddress::kIPv4AddressSize) ||
+          (type == kTypeAAAA && rdlen == IPAddress::kIPv6AddressSize)) {
+        out->push_back(IPAddress(msg + pos, rdlen));
+        if (record_ttl < *ttl)
+          *ttl = record_ttl;
+      }
+    }
+    pos += rdlen;
+  }
+  return kDnsOk;
+}
+
+// one query to one server over a connected UDP socket.
+int Exchange(const IPAddress& server, const std::string& query, uint16 id,
+             uint16 qtype, std::vector<IPAddress>* out, uint32* ttl) {
+  AddressFamily family =
+    server.IsIPv4() ? ADDRESS_FAMILY_IPV4 : ADDRESS_FAMILY_IPV6;
+  int err = 0;
+  scoped_ptr<NetFD> netfd(NewFD(family, SOCK_DGRAM, &err));
+  if (netfd.get() == NULL)
+    return kDnsFailed;
+  IPEndPoint endpoint(server, kDnsPort);
+  if (netfd->Dial(NULL, &endpoint, kint64max) != 0)
+    return kDnsFailed;
+  netfd->SetReadDeadline(kDnsTimeout);
+  int n = 0;
+  if (netfd->Write(query.data(), static_cast<int>(query.size()), &n) != 0)
+    return kDnsFailed;
+  uint8 buf[kDnsMaxUdpSize];
+  while (true) {
+    // a timeout ends the attempt as well.
+    if (netfd->ReadFrom(buf, sizeof(buf), &n, NULL) != 0)
+      return kDnsFailed;
+    std::vector<IPAddress> addresses;
+    uint32 record_ttl = *ttl;
+    int rv = ParseResponse(buf, n, id, qtype, &addresses, &record_ttl);
+    if (rv == kDnsIgnore)
+      continue;
+    if (rv == kDnsOk) {
+      out->insert(out->end(), addresses.begin(), addresses.end());
+      *ttl = record_ttl;
+    }
+    return rv;
+  }
+}
+
+class DnsClient {
+ public:
+  DnsClient()
+    : ndots_(1)
+    , cond_(&mu_) {
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  static DnsClient* GetInstance() {
+    static DnsClient* client = new DnsClient;
+    return client;
+  }
+
+  bool Lookup(const base::StringPiece& hostname, AddressFamily af,
+              std::vector<IPAddress>* addresses, int* error);
+
+  void GetStats(DnsStats* stats) {
+    MutexGuard guard(&mu_);
+    *stats = stats_;
+  }
+
+ private:
+  struct ConfigLoader {
+    explicit ConfigLoader(DnsClient* client)
+      : client(client) {
+    }
+
+    void operator()() {
+      client->LoadConfig();
+    }
+
+    DnsClient* client;
+  };
+
+  struct CacheEntry {
+    std::vector<IPAddress> addresses;
+    int64 expire;
+  };
+
+  // a query in flight, freed by the last greenlet done with it.
+  struct Flight {
+    Flight()
+      : done(false)
+      , fallback(false)
+      , error(0)
+      , refs(1) {
+    }
+
+    bool done;
+    bool fallback;
+    int error;
+    int refs;
+    std::vector<IPAddress> addresses;
+  };
+
+  void LoadConfig();
+  bool IsLocal(const std::string& name) const;
+  int Query(const std::string& name, AddressFamily af,
+            std::vector<IPAddress>* out, uint32* ttl);
+  int QueryType(const std::string& name, uint16 qtype,
+                std::vector<IPAddress>* out, uint32* ttl);
+  // mu_ must be held.
+  void CachePut(const std::string& key,
+                const std::vector<IPAddress>& addresses, uint32 ttl);
+
+  // read once, changes need a restart.
+  Once once_;
+  std::vector<IPAddress> servers_;
+  std::set<std::string> hosts_;
+  int ndots_;
+
+  Mutex mu_;
+  Cond cond_;
+  std::map<std::string, CacheEntry> cache_;
+  std::map<std::string, Flight*> flights_;
+  DnsStats stats_;
+  DISALLOW_COPY_AND_ASSIGN(DnsClient);
+};
+
+void DnsClient::LoadConfig() {
+  std::string content;
+  if (ReadWholeFile("/etc/resolv.conf", &content)) {
+    std::istringstream lines(content);
+    std::string line;
+    while (std::getline(lines, line)) {
+      std::istringstream words(line);
+      std::string word;
+      words >> word;
+      if (word == "nameserver") {
+        std::string literal;
+        words >> literal;
+        IPAddress address;
+        if (address.AssignFromIPLiteral(literal))
+          servers_.push_back(address);
+      } else if (word == "options") {
+        while (words >> word) {
+          if (word.compare(0, 6, "ndots:") == 0)
+            ndots_ = atoi(word.c_str() + 6);
+        }
+      }
+    }
+  }
+  content.clear();
+  if (ReadWholeFile("/etc/hosts", &content)) {
+    std::istringstream lines(content);
+    std::string line;
+    while (std::getline(lines, line)) {
+      line = line.substr(0, line.find('#'));
+      std::istringstream words(line);
+      std::string word;
+      // the address.
+      if (!(words >> word))
+        continue;
+      while (words >> word)
+        hosts_.insert(ToLower(word));
+    }
+  }
+  VLOG(1) << "dns client: " << servers_.size() << " name servers, "
+          << hosts_.size() << " names in hosts file";
+}
+
+bool DnsClient::IsLocal(const std::string& name) const {
+  int dots = 0;
+  for (size_t i = 0; i < name.size(); i++) {
+    if (name[i] == '.')
+      dots++;
+  }
+  // search domains apply.
+  if (dots < ndots_)
+    return true;
+  if (name == "localhost" || EndsWith(name, ".localhost") ||
+      EndsWith(name, ".local"))
+    return true;
+  return hosts_.find(name) != hosts_.end();
+}
+
+int DnsClient::QueryType(const std::string& name, uint16 qtype,
+                         std::vector<IPAddress>* out, uint32* ttl) {
+  uint16 id = static_cast<uint16>(base::RandUint64());
+  std::string query;
+  if (!BuildQuery(name, id, qtype, &query))
+    return kDnsFailed;
+  for (int attempt = 0; attempt < kDnsAttempts; attempt++) {
+    for (size_t i = 0; i < servers_.size(); i++) {
+      int rv = Exchange(servers_[i], query, id, qtype, out, ttl);
+      if (rv != kDnsFailed)
+        return rv;
+    }
+  }
+  return kDnsFailed;
+}
+
+int DnsClient::Query(const std::string& name, AddressFamily af,
+                     std::vector<IPAddress>* out, uint32* ttl) {
+  *ttl = kDnsMaxTtl;
+  int rv = kDnsOk;
+  // v4 first, the order ResolveHostname callers take front() from.
+  if (af != ADDRESS_FAMILY_IPV6)
+    rv = QueryType(name, kTypeA, out, ttl);
+  if (rv == kDnsOk && af != ADDRESS_FAMILY_IPV4)
+    rv = QueryType(name, kTypeAAAA, out, ttl);
+  return rv;
+}
+
+void DnsClient::CachePut(const std::string& key,
+                         const std::vector<IPAddress>& addresses,
+                         uint32 ttl) {
+  int64 now = MonoNow();
+  if (cache_.size() >= kDnsCacheMax) {
+    std::map<std::string, CacheEntry>::iterator it = cache_.begin();
+    while (it != cache_.end()) {
+      if (it->second.expire <= now) {
+        cache_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+    if (cache_.size() >= kDnsCacheMax)
+      cache_.clear();
+  }
+  CacheEntry& entry = cache_[key];
+  entry.addresses = addresses;
+  entry.expire = now + ttl * kSecond;
+}
+
+bool DnsClient::Lookup(const base::StringPiece& hostname, AddressFamily af,
+                       std::vector<IPAddress>* addresses, int* error) {
+  once_.Do(ConfigLoader(this));
+  std::string name = ToLower(hostname);
+  if (!name.empty() && name[name.size() - 1] == '.')
+    name.resize(name.size() - 1);
+
+  MutexGuard guard(&mu_);
+  if (servers_.empty() || name.empty() || IsLocal(name)) {
+    stats_.fallbacks++;
+    return false;
+  }
+  std::string key = name;
+  key.push_back('/');
+  key.push_back(static_cast<char>('0' + af));
+
+  std::map<std::string, CacheEntry>::iterator it = cache_.find(key);
+  if (it != cache_.end()) {
+    if (it->second.expire > MonoNow()) {
+      stats_.cache_hits++;
+      *addresses = it->second.addresses;
+      *error = 0;
+      return true;
+    }
+    cache_.erase(it);
+  }
+
+  Flight* flight = NULL;
+  std::map<std::string, Flight*>::iterator fit = flights_.find(key);
+  if (fit != flights_.end()) {
+    stats_.shared++;
+    flight = fit->second;
+    flight->refs++;
+    while (!flight->done)
+      cond_.Wait();
+  } else {
+    stats_.queries++;
+    flight = new Flight;
+    flights_[key] = flight;
+    mu_.Unlock();
+    std::vector<IPAddress> result;
+    uint32 ttl = 0;
+    int rv = Query(name, af, &result, &ttl);
+    mu_.Lock();
+    flights_.erase(key);
+    if (rv == kDnsFailed) {
+      flight->fallback = true;
+      stats_.fallbacks++;
+    } else if (rv == kDnsNxDomain || result.empty()) {
+      flight->error = EAI_NONAME;
+    } else {
+      flight->addresses.swap(result);
+      if (ttl > 0)
+        CachePut(key, flight->addresses, ttl);
+    }
+    flight->done = true;
+    cond_.Broascast();
+  }
+
+  bool answered = !flight->fallback;
+  *addresses = flight->addresses;
+  *error = flight->error;
+  if (--flight->refs == 0)
+    delete flight;
+  return answered;
+}
+
+}  // namespace
+
+bool DnsLookup(const base::StringPiece& hostname, AddressFamily af,
+               std::vector<IPAddress>* addresses, int* error) {
+  return DnsClient::GetInstance()->Lookup(hostname, af, addresses, error);
+}
+
+void GetDnsStats(DnsStats* stats) {
+  DnsClient::GetInstance()->GetStats(stats);
+}
+#else
+// no resolv.conf, everything goes through getaddrinfo.
+bool DnsLookup(const base::StringPiece& hostname, AddressFamily af,
+               std::vector<IPAddress>* addresses, int* error) {
+  return false;
+}
+
+void GetDnsStats(DnsStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+#endif
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,41 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/strings/string_piece.h"
+#include "tin/net/address_family.h"
+#include "tin/net/ip_address.h"
+
+namespace tin {
+namespace net {
+
+// resolves hostname over UDP against the name servers of resolv.conf, the
+// greenlet parks on the netpoller instead of holding a thread pool worker.
+// answers are cached for their TTL and concurrent lookups of one name
+// share a single query. returns false if the name is for getaddrinfo:
+// listed in the hosts file, fewer dots than ndots, .local, no name server,
+// or the servers failed or truncated the answer. on true *error is 0 or
+// EAI_NONAME.
+bool DnsLookup(const base::StringPiece& hostname, AddressFamily af,
+               std::vector<IPAddress>* addresses, int* error);
+
+struct DnsStats {
+  // answered from the cache.
+  uint64 cache_hits;
+  // lookups that sent queries.
+  uint64 queries;
+  // lookups that waited for a query of another greenlet.
+  uint64 shared;
+  // left to getaddrinfo.
+  uint64 fallbacks;
+};
+
+void GetDnsStats(DnsStats* stats);
+
+}  // namespace net
+}  // namespace tin
@@ -83,6 +83,18 @@ bool FdMutex::Deref() {
 }
 
 bool FdMutex::RWLock(bool read) {
+  if (exclusive_) {
+    if ((state_.load(quark::memory_order_acquire) & kMutexClosed) != 0) {
+      return false;
+    }
+    // a Close racing with us is fine, the reference keeps the socket
+    // until RWUnlock and the evicted poller fails the io.
+    uint64 old_value = state_.fetch_add(kMutexRef);
+    if (((old_value + kMutexRef) & kMutexRefMask) == 0) {
+      LOG(FATAL) << "net: inconsistent fdMutex";
+    }
+    return true;
+  }
   uint64 mutex_bit, mutex_wait, mutex_mask;
   uint32* mutex_sema;
   if (read) {
@@ -126,6 +138,10 @@ bool FdMutex::RWLock(bool read) {
 }
 
 bool FdMutex::RWUnlock(bool read) {
+  if (exclusive_) {
+    uint64 new_value = state_.fetch_sub(kMutexRef) - kMutexRef;
+    return (new_value & (kMutexClosed | kMutexRefMask)) == kMutexClosed;
+  }
   uint64 mutex_bit, mutex_wait, mutex_mask;
   uint32* mutex_sema;
   if (read) {
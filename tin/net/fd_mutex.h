@@ -15,6 +15,7 @@ class FdMutex {
     : state_(0)
     , rsema_(0)
     , wsema_(0)
+    , exclusive_(false)
   {};
   bool Incref();
   bool IncrefAndClose();
@@ -22,10 +23,19 @@ class FdMutex {
   bool RWLock(bool read);
   bool RWUnlock(bool read);
 
+  // for a connection with one reader and one writer greenlet: RWLock and
+  // RWUnlock only take the reference that keeps the socket open, one
+  // atomic add instead of the lock CAS loop. concurrent readers or
+  // writers are on the caller then. set before the fd is shared.
+  void SetExclusive() {
+    exclusive_ = true;
+  }
+
  private:
   quark::atomic_uint64_t state_;
   uint32 rsema_;
   uint32 wsema_;
+  bool exclusive_;
 };
 
 }  // namespace net
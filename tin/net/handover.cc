@@ -0,0 +1,232 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+
+#include "base/logging.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "tin/error/error.h"
+#include "tin/sync/mutex.h"
+#include "tin/sync/once.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/posix_util.h"
+#include "tin/net/sockaddr_storage.h"
+#include "tin/net/netfd.h"
+
+#include "tin/net/handover.h"
+
+namespace tin {
+namespace net {
+
+const char kListenFdsEnv[] = "TIN_LISTEN_FDS";
+
+namespace {
+
+class Inherited {
+ public:
+  static Inherited* GetInstance() {
+    static Inherited* inherited = new Inherited;
+    return inherited;
+  }
+
+  void Add(int fd) {
+    LoadOnce();
+    MutexGuard guard(&mu_);
+    AddLocked(fd);
+  }
+
+  NetFD* Take(const IPEndPoint& endpoint) {
+    LoadOnce();
+    int fd = -1;
+    {
+      MutexGuard guard(&mu_);
+      FdMap::iterator it = fds_.find(endpoint);
+      if (it == fds_.end())
+        return NULL;
+      fd = it->second.front();
+      it->second.pop_front();
+      if (it->second.empty())
+        fds_.erase(it);
+    }
+    int err = 0;
+    NetFD* netfd = NewFDFromSysFd(fd, &err);
+    LOG_IF(WARNING, netfd == NULL) << "inherited listener " << fd
+                                   << " unusable: " << strerror(err);
+    return netfd;
+  }
+
+  int CloseRest() {
+    LoadOnce();
+    MutexGuard guard(&mu_);
+    int n = 0;
+    for (FdMap::iterator it = fds_.begin(); it != fds_.end(); ++it) {
+      for (size_t i = 0; i < it->second.size(); ++i) {
+        close(it->second[i]);
+        n++;
+      }
+    }
+    fds_.clear();
+    return n;
+  }
+
+ private:
+  typedef std::map<IPEndPoint, std::deque<int> > FdMap;
+
+  struct Loader {
+    explicit Loader(Inherited* inherited)
+      : inherited(inherited) {
+    }
+
+    void operator()() {
+      inherited->Load();
+    }
+
+    Inherited* inherited;
+  };
+
+  Inherited() {
+  }
+
+  void LoadOnce() {
+    once_.Do(Loader(this));
+  }
+
+  void Load() {
+    const char* env = getenv(kListenFdsEnv);
+    if (env == NULL)
+      return;
+    std::vector<std::string> fds;
+    base::SplitString(env, ',', &fds);
+    MutexGuard guard(&mu_);
+    for (size_t i = 0; i < fds.size(); ++i) {
+      int fd = -1;
+      if (base::StringToInt(fds[i], &fd) && fd >= 0)
+        AddLocked(fd);
+    }
+    // not meant for the children of this process.
+    unsetenv(kListenFdsEnv);
+  }
+
+  void AddLocked(int fd) {
+    int listening = 0;
+    socklen_t optlen = sizeof(listening);
+    SockaddrStorage storage;
+    IPEndPoint endpoint;
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening,
+                   &optlen) == -1 || !listening ||
+        getsockname(fd, storage.addr, &storage.addr_len) == -1 ||
+        !endpoint.FromSockAddr(storage.addr, storage.addr_len)) {
+      LOG(WARNING) << "ignoring inherited fd " << fd
+                   << ", not a TCP listener";
+      return;
+    }
+    fds_[endpoint].push_back(fd);
+  }
+
+  Once once_;
+  Mutex mu_;
+  FdMap fds_;
+  DISALLOW_COPY_AND_ASSIGN(Inherited);
+};
+
+void ListenerFds(const std::vector<TCPListener>& listeners,
+                 std::vector<int>* fds) {
+  for (size_t i = 0; i < listeners.size(); ++i) {
+    for (int j = 0; j < listeners[i]->Shards(); ++j)
+      fds->push_back(static_cast<int>(listeners[i]->SysFd(j)));
+  }
+}
+
+}  // namespace
+
+bool ExportListeners(const std::vector<TCPListener>& listeners) {
+  std::vector<int> fds;
+  ListenerFds(listeners, &fds);
+  std::string env;
+  for (size_t i = 0; i < fds.size(); ++i) {
+    if (Cloexec(fds[i], false) == -1) {
+      SetErrorCode(TinTranslateSysError(errno));
+      return false;
+    }
+    if (!env.empty())
+      env.push_back(',');
+    env.append(base::IntToString(fds[i]));
+  }
+  if (setenv(kListenFdsEnv, env.c_str(), 1) == -1) {
+    SetErrorCode(TinTranslateSysError(errno));
+    return false;
+  }
+  SetErrorCode(0);
+  return true;
+}
+
+// each message is the number of descriptors attached to it, 0 ends the
+// list.
+bool SendListeners(const UnixConn& conn,
+                   const std::vector<TCPListener>& listeners) {
+  std::vector<int> fds;
+  ListenerFds(listeners, &fds);
+  size_t sent = 0;
+  while (true) {
+    int32 n = static_cast<int32>(
+        std::min<size_t>(fds.size() - sent, kMaxPassedFds));
+    if (n > 0) {
+      conn->WriteFds(&n, sizeof(n), &fds[sent], n);
+    } else {
+      conn->Write(&n, sizeof(n));
+    }
+    if (ErrorOccured())
+      return false;
+    if (n == 0)
+      return true;
+    sent += n;
+  }
+}
+
+int ReceiveListeners(const UnixConn& conn) {
+  int total = 0;
+  while (true) {
+    int32 n = 0;
+    int got = 0;
+    int fds[kMaxPassedFds];
+    int nfds = 0;
+    // the descriptors come with the first byte of the count.
+    while (got < static_cast<int>(sizeof(n))) {
+      int more = 0;
+      got += conn->ReadFds(reinterpret_cast<char*>(&n) + got,
+                           sizeof(n) - got, fds + nfds,
+                           kMaxPassedFds - nfds, &more);
+      nfds += more;
+      if (ErrorOccured()) {
+        for (int i = 0; i < nfds; ++i)
+          close(fds[i]);
+        return -1;
+      }
+    }
+    for (int i = 0; i < nfds; ++i)
+      Inherited::GetInstance()->Add(fds[i]);
+    total += nfds;
+    if (n == 0)
+      return total;
+  }
+}
+
+NetFD* TakeInheritedListener(const IPEndPoint& endpoint) {
+  return Inherited::GetInstance()->Take(endpoint);
+}
+
+int CloseInheritedListeners() {
+  return Inherited::GetInstance()->CloseRest();
+}
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,50 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "tin/net/ip_endpoint.h"
+#include "tin/net/listener.h"
+#include "tin/net/unix_conn.h"
+
+// listening sockets survive a restart, so the kernel keeps queueing
+// connections while the new binary starts up. the old process hands its
+// listeners over, by exec or over a unix socket, then Drains them. the
+// new one calls ListenTcp as usual and gets the inherited socket back.
+
+namespace tin {
+namespace net {
+
+class NetFD;
+
+// comma separated descriptors of the sockets passed across exec.
+extern const char kListenFdsEnv[];
+
+// lets the sockets of listeners survive exec and lists them in
+// kListenFdsEnv. call right before starting the new binary. false on
+// error, see tin::GetErrorCode().
+bool ExportListeners(const std::vector<TCPListener>& listeners);
+
+// passes the sockets of listeners to the process calling ReceiveListeners
+// at the other end of conn. the copies here stay open.
+bool SendListeners(const UnixConn& conn,
+                   const std::vector<TCPListener>& listeners);
+
+// takes the sockets of SendListeners, ListenTcp adopts them like the
+// ones inherited across exec. returns how many, -1 on error.
+int ReceiveListeners(const UnixConn& conn);
+
+// an inherited socket listening on endpoint, NULL if none is left.
+// ListenTcp asks this before binding.
+NetFD* TakeInheritedListener(const IPEndPoint& endpoint);
+
+// closes the inherited sockets nobody listened on again, e.g. addresses
+// dropped from the configuration. returns how many.
+int CloseInheritedListeners();
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,145 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "base/logging.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/env.h"
+#include "tin/sync/pool.h"
+#include "tin/net/netfd_common.h"
+
+#include "tin/net/idle_reaper.h"
+
+namespace tin {
+namespace net {
+
+namespace {
+// sweeps per idle timeout, how late a connection may be closed.
+const int kSweepsPerIdle = 4;
+const int64 kNanosPerMs = 1000 * 1000;
+}  // namespace
+
+IdleReaper::IdleReaper(int64 idle_ns)
+  : idle_ms_(static_cast<uint32>(std::max<int64>(idle_ns / kNanosPerMs, 1)))
+  , period_ns_(std::max<int64>(idle_ns / kSweepsPerIdle, kNanosPerMs))
+  , reaped_(0)
+  , stopped_(false) {
+  int procs = runtime::rtm_conf->MaxProcs();
+  for (int i = 0; i < procs; i++)
+    shards_.push_back(new Shard);
+  for (int i = 0; i < procs; i++) {
+    SpawnOptions opts(0, "idle_reaper");
+    opts.proc = i;
+    opts.sticky = true;
+    group_.Spawn(opts, base::Bind(&IdleReaper::Run, base::Unretained(this),
+                                  i));
+  }
+}
+
+IdleReaper::~IdleReaper() {
+  Stop();
+  for (size_t i = 0; i < shards_.size(); i++) {
+    Shard* shard = shards_[i];
+    {
+      runtime::RawMutexGuard guard(&shard->lock);
+      while (shard->head.next != &shard->head) {
+        IdleEntry* e = shard->head.next;
+        Unlink(shard, e);
+        e->reaper = NULL;
+      }
+    }
+    delete shard;
+  }
+}
+
+void IdleReaper::Add(NetFDCommon* fd) {
+  IdleEntry* e = fd->IdleLinks();
+  DCHECK(e->reaper == NULL);
+  int id = internal::PoolProcId();
+  e->shard = id < 0 ? 0 : id % static_cast<int>(shards_.size());
+  e->fd = fd;
+  e->reaper = this;
+  atomic::relaxed_store32(&e->last_active,
+                          static_cast<uint32>(CoarseNow() / kNanosPerMs));
+  Shard* shard = shards_[e->shard];
+  runtime::RawMutexGuard guard(&shard->lock);
+  e->linked = true;
+  e->prev = shard->head.prev;
+  e->next = &shard->head;
+  shard->head.prev->next = e;
+  shard->head.prev = e;
+  shard->count++;
+}
+
+void IdleReaper::Remove(NetFDCommon* fd) {
+  IdleEntry* e = fd->IdleLinks();
+  Shard* shard = shards_[e->shard];
+  {
+    runtime::RawMutexGuard guard(&shard->lock);
+    // not if reaped meanwhile.
+    if (e->linked)
+      Unlink(shard, e);
+  }
+  e->reaper = NULL;
+}
+
+void IdleReaper::Stop() {
+  if (stopped_)
+    return;
+  stopped_ = true;
+  group_.Cancel();
+  group_.Wait();
+}
+
+int64 IdleReaper::Tracked() const {
+  int64 n = 0;
+  for (size_t i = 0; i < shards_.size(); i++)
+    n += atomic::relaxed_load(&shards_[i]->count);
+  return n;
+}
+
+void IdleReaper::Run(int shard) {
+  while (!tin::Canceled()) {
+    tin::NanoSleep(period_ns_);
+    if (tin::Canceled())
+      return;
+    Sweep(shards_[shard]);
+  }
+}
+
+void IdleReaper::Sweep(Shard* shard) {
+  uint32 now = static_cast<uint32>(CoarseNow() / kNanosPerMs);
+  uint32 reaped = 0;
+  runtime::RawMutexGuard guard(&shard->lock);
+  // the io path stamps without touching the links, so the list is in Add
+  // order and a sweep visits every entry, a load and a compare each.
+  IdleEntry* e = shard->head.next;
+  while (e != &shard->head) {
+    IdleEntry* next = e->next;
+    if (now - atomic::relaxed_load32(&e->last_active) >= idle_ms_) {
+      Unlink(shard, e);
+      // under the lock, the owner deleting the fd waits for it in Remove.
+      // Close only wakes the waiters of the fd and never parks.
+      e->fd->Close();
+      reaped++;
+    }
+    e = next;
+  }
+  if (reaped > 0)
+    atomic::Inc32(&reaped_, reaped);
+}
+
+void IdleReaper::Unlink(Shard* shard, IdleEntry* e) {
+  e->prev->next = e->next;
+  e->next->prev = e->prev;
+  e->prev = NULL;
+  e->next = NULL;
+  e->linked = false;
+  shard->count--;
+}
+
+}  // namespace net
+}  // namespace tin
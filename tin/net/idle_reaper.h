@@ -0,0 +1,103 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <vector>
+
+#include "base/basictypes.h"
+#include "tin/sync/atomic.h"
+#include "tin/sync/task_group.h"
+#include "tin/runtime/raw_mutex.h"
+
+namespace tin {
+namespace net {
+
+class IdleReaper;
+class NetFDCommon;
+
+// the links of a NetFD on a list of an IdleReaper, in the NetFD so
+// tracking allocates nothing.
+struct IdleEntry {
+  IdleEntry()
+    : prev(NULL)
+    , next(NULL)
+    , fd(NULL)
+    , reaper(NULL)
+    , linked(false)
+    , shard(0)
+    , last_active(0) {
+  }
+
+  IdleEntry* prev;
+  IdleEntry* next;
+  NetFDCommon* fd;
+  // set and cleared by the owner of the fd, Add and Remove.
+  IdleReaper* reaper;
+  // on the list, changed under the lock of the shard.
+  bool linked;
+  int shard;
+  // milli seconds of CoarseNow() at the last read or write, stored
+  // without a lock by the io path and wrapping.
+  uint32 last_active;
+};
+
+// closes connections that did no read or write for a while, instead of a
+// read deadline each connection keeps re-arming in the timer queue. io
+// only stamps the coarse clock into the connection, one sweeper per P
+// walks the connections of its P and closes those idle for too long, so
+// they are closed at most a quarter of idle_ns late. blocked Reads and
+// Writes then fail like after Close.
+//
+// the reaper must outlive the connections it tracks, or be destroyed
+// while none of them is deleted.
+class IdleReaper {
+ public:
+  explicit IdleReaper(int64 idle_ns);
+  // Stop, the connections tracked stay open.
+  ~IdleReaper();
+
+  // tracks fd on the list of the current P until it is reaped, Removed
+  // or destroyed. see TcpConnImpl::SetIdleReaper.
+  void Add(NetFDCommon* fd);
+  void Remove(NetFDCommon* fd);
+
+  // stops the sweepers and waits for them.
+  void Stop();
+
+  int64 Tracked() const;
+  uint32 Reaped() const {
+    return atomic::relaxed_load32(&reaped_);
+  }
+
+ private:
+  struct Shard {
+    Shard()
+      : count(0) {
+      head.prev = &head;
+      head.next = &head;
+    }
+
+    runtime::RawMutex lock;
+    // circular, head is not an fd.
+    IdleEntry head;
+    intptr_t count;
+    char pad[64];
+  };
+
+  void Run(int shard);
+  void Sweep(Shard* shard);
+  // shard->lock must be held.
+  static void Unlink(Shard* shard, IdleEntry* e);
+
+  const uint32 idle_ms_;
+  const int64 period_ns_;
+  std::vector<Shard*> shards_;
+  uint32 reaped_;
+  TaskGroup group_;
+  bool stopped_;
+  DISALLOW_COPY_AND_ASSIGN(IdleReaper);
+};
+
+}  // namespace net
+}  // namespace tin
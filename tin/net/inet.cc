@@ -2,7 +2,6 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
-#include <stdio.h>
 #include <string.h>
 
 #include "build/build_config.h"
@@ -13,8 +12,6 @@
 #endif
 
 #include "base/basictypes.h"
-#include "base/strings/string_util.h"
-#include "base/sys_byteorder.h"
 #include "tin/error/error.h"
 
 #include "tin/net/inet.h"
@@ -22,302 +19,252 @@
 namespace tin {
 namespace net {
 
-const int kInetAddrStrLen = 16;
-const int kInetAddrStrLen6 = 46;
-
 namespace {
-struct Inet6Addr {
-  union {
-    uint8       Byte[16];
-    uint16      Word[8];
-  } u;
-};
-}
 
-int INetNToP4(const unsigned char* src, char* dst, size_t size) {
-  static const char fmt[] = "%u.%u.%u.%u";
-  char tmp[kInetAddrStrLen];
-  int l;
+const char kHexDigits[] = "0123456789abcdef";
+
+// 0-15, or -1 if c is no hex digit.
+inline int HexValue(char c) {
+  unsigned d = static_cast<unsigned char>(c) - '0';
+  if (d < 10)
+    return d;
+  d = (static_cast<unsigned char>(c) | 0x20) - 'a';
+  if (d < 6)
+    return d + 10;
+  return -1;
+}
 
-  l = base::snprintf(tmp, sizeof(tmp), fmt, src[0], src[1], src[2], src[3]);
-  if (l <= 0 || (size_t) l >= size) {
-    return TIN_ENOSPC;
+// v < 256, without leading zeros.
+inline char* PutDecimal(unsigned v, char* p) {
+  if (v >= 100) {
+    *p++ = static_cast<char>('0' + v / 100);
+    v %= 100;
+    *p++ = static_cast<char>('0' + v / 10);
+  } else if (v >= 10) {
+    *p++ = static_cast<char>('0' + v / 10);
   }
-  base::strlcpy(dst, tmp, size);
-  dst[size - 1] = '\0';
-  return 0;
+  *p++ = static_cast<char>('0' + v % 10);
+  return p;
+}
+
+// v < 0x10000, without leading zeros.
+inline char* PutHex(unsigned v, char* p) {
+  if (v >= 0x1000)
+    *p++ = kHexDigits[v >> 12];
+  if (v >= 0x100)
+    *p++ = kHexDigits[(v >> 8) & 0xf];
+  if (v >= 0x10)
+    *p++ = kHexDigits[(v >> 4) & 0xf];
+  *p++ = kHexDigits[v & 0xf];
+  return p;
+}
+
+size_t CopyOut(const char* tmp, size_t n, char* dst, size_t size) {
+  if (n >= size)
+    return 0;
+  memcpy(dst, tmp, n);
+  dst[n] = '\0';
+  return n;
 }
 
-static int INetNToP6(const unsigned char* src, char* dst, size_t size) {
-  /*
-   * Note that int32 and int16 need only be "at least" large enough
-   * to contain a value of the specified size.  On some systems, like
-   * Crays, there is no such thing as an integer variable with 16 bits.
-   * Keep this in mind if you think this function should have been coded
-   * to use pointer overlays.  All the world's not a VAX.
-   */
-  char tmp[kInetAddrStrLen6], *tp;
-  struct {
-    int base, len;
-  } best, cur;
-  unsigned int words[sizeof(Inet6Addr) / sizeof(uint16)];
-  int i;
+}  // namespace
 
-  /*
-   * Preprocess:
-   *  Copy the input (bytewise) array into a wordwise array.
-   *  Find the longest run of 0x00's in src[] for :: shorthanding.
-   */
-  memset(words, '\0', sizeof words);
-  for (i = 0; i < (int) sizeof(Inet6Addr); i++)  // NOLINT
-    words[i / 2] |= (src[i] << ((1 - (i % 2)) << 3));
-  best.base = -1;
-  best.len = 0;
-  cur.base = -1;
-  cur.len = 0;
-  for (i = 0; i < (int) arraysize(words); i++) {    // NOLINT
-    if (words[i] == 0) {
-      if (cur.base == -1)
-        cur.base = i, cur.len = 1;
-      else
-        cur.len++;
+bool ParseIPv4(const char* src, size_t len, uint8* dst) {
+  uint8 tmp[4];
+  int octets = 0;
+  int ndigits = 0;
+  unsigned val = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned d = static_cast<unsigned char>(src[i]) - '0';
+    if (d < 10) {
+      // no leading zeros, like inet_pton.
+      if (ndigits == 1 && val == 0)
+        return false;
+      val = val * 10 + d;
+      if (val > 255)
+        return false;
+      ndigits++;
+    } else if (src[i] == '.' && ndigits != 0 && octets < 3) {
+      tmp[octets++] = static_cast<uint8>(val);
+      val = 0;
+      ndigits = 0;
     } else {
-      if (cur.base != -1) {
-        if (best.base == -1 || cur.len > best.len)
-          best = cur;
-        cur.base = -1;
-      }
+      return false;
     }
   }
-  if (cur.base != -1) {
-    if (best.base == -1 || cur.len > best.len)
-      best = cur;
-  }
-  if (best.base != -1 && best.len < 2)
-    best.base = -1;
+  if (octets != 3 || ndigits == 0)
+    return false;
+  tmp[3] = static_cast<uint8>(val);
+  memcpy(dst, tmp, sizeof(tmp));
+  return true;
+}
 
-  /*
-   * Format the result.
-   */
-  tp = tmp;
-  for (i = 0; i < static_cast<int>(arraysize(words)); i++) {
-    /* Are we inside the best run of 0x00's? */
-    if (best.base != -1 && i >= best.base &&
-        i < (best.base + best.len)) {
-      if (i == best.base)
-        *tp++ = ':';
-      continue;
+bool ParseIPv6(const char* src, size_t len, uint8* dst) {
+  const char* zone = static_cast<const char*>(memchr(src, '%', len));
+  if (zone != NULL)
+    len = zone - src;
+
+  uint8 tmp[16];
+  size_t n = 0;
+  // where :: is, in bytes of tmp.
+  int gap = -1;
+  size_t i = 0;
+  if (len > 0 && src[0] == ':') {
+    if (len < 2 || src[1] != ':')
+      return false;
+    gap = 0;
+    i = 2;
+  }
+  while (i < len) {
+    if (n == sizeof(tmp))
+      return false;
+    size_t start = i;
+    unsigned val = 0;
+    // one digit more than a group has, to tell it is too long.
+    for (; i < len && i - start < 5; i++) {
+      int h = HexValue(src[i]);
+      if (h < 0)
+        break;
+      val = (val << 4) | h;
     }
-    /* Are we following an initial run of 0x00s or any real hex? */
-    if (i != 0)
-      *tp++ = ':';
-    /* Is this address an encapsulated IPv4? */
-    if (i == 6 && best.base == 0 && (best.len == 6 ||
-                                     (best.len == 7 && words[7] != 0x0001) ||
-                                     (best.len == 5 && words[5] == 0xffff))) {
-      int err = INetNToP4(src + 12, tp, sizeof tmp - (tp - tmp));
-      if (err)
-        return err;
-      tp += strlen(tp);
+    size_t ndigits = i - start;
+    if (ndigits == 0)
+      return false;
+    if (i < len && src[i] == '.') {
+      if (n + 4 > sizeof(tmp) || !ParseIPv4(src + start, len - start, tmp + n))
+        return false;
+      n += 4;
       break;
     }
-    tp += sprintf(tp, "%x", words[i]);  // NOLINT
+    if (ndigits > 4)
+      return false;
+    tmp[n++] = static_cast<uint8>(val >> 8);
+    tmp[n++] = static_cast<uint8>(val);
+    if (i == len)
+      break;
+    if (src[i++] != ':' || i == len)
+      return false;
+    if (src[i] == ':') {
+      if (gap >= 0)
+        return false;
+      gap = static_cast<int>(n);
+      i++;
+    }
   }
-  /* Was it a trailing run of 0x00's? */
-  if (best.base != -1 && (best.base + best.len) == arraysize(words))
-    *tp++ = ':';
-  *tp++ = '\0';
 
-  /*
-   * Check for overflow, copy, and we're done.
-   */
-  if ((size_t)(tp - tmp) > size) {
-    return TIN_ENOSPC;
+  if (gap >= 0) {
+    // :: stands for one group at least.
+    if (n == sizeof(tmp))
+      return false;
+    size_t tail = n - gap;
+    memmove(tmp + sizeof(tmp) - tail, tmp + gap, tail);
+    memset(tmp + gap, 0, sizeof(tmp) - n);
+  } else if (n != sizeof(tmp)) {
+    return false;
   }
-  base::strlcpy(dst, tmp, kInetAddrStrLen6);
-  return 0;
+  memcpy(dst, tmp, sizeof(tmp));
+  return true;
 }
 
-// const unsigned char* src, char* dst, size_t size
-int InetNToP(int af, const void* src, char* dst, size_t size) {
-  switch (af) {
-  case AF_INET:
-    return (INetNToP4(static_cast<const unsigned char*>(src), dst, size));
-  case AF_INET6:
-    return (INetNToP6(static_cast<const unsigned char*>(src), dst, size));
-  default:
-    return TIN_EAFNOSUPPORT;
-  }
-  /* NOTREACHED */
-}
-
-
-bool InetNToP(bool ipv4, const void* src, std::string* dst) {
-  char tmp[kInetAddrStrLen6];
-  int ret = InetNToP(ipv4 ? AF_INET : AF_INET6, src, tmp, kInetAddrStrLen6);
-  if (ret == 0) {
-    dst->resize(ipv4 ? kInetAddrStrLen : kInetAddrStrLen6);
-    *dst = tmp;
+size_t FormatIPv4(const uint8* src, char* dst, size_t size) {
+  char tmp[kInetAddrStrLen];
+  char* p = tmp;
+  for (int i = 0; i < 4; i++) {
+    if (i != 0)
+      *p++ = '.';
+    p = PutDecimal(src[i], p);
   }
-  return ret == 0;
+  return CopyOut(tmp, p - tmp, dst, size);
 }
 
-static int INetPToN4(const char* src, unsigned char* dst) {
-  static const char digits[] = "0123456789";
-  int saw_digit, octets, ch;
-  unsigned char tmp[sizeof(struct in_addr)], *tp;
-
-  saw_digit = 0;
-  octets = 0;
-  *(tp = tmp) = 0;
-  while ((ch = *src++) != '\0') {
-    const char* pch;
+size_t FormatIPv6(const uint8* src, char* dst, size_t size) {
+  unsigned words[8];
+  for (int i = 0; i < 8; i++)
+    words[i] = (src[2 * i] << 8) | src[2 * i + 1];
 
-    if ((pch = strchr(digits, ch)) != NULL) {
-      unsigned int nw = static_cast<unsigned int>(*tp * 10 + (pch - digits));
-
-      if (saw_digit && *tp == 0)
-        return TIN_EINVAL;
-      if (nw > 255)
-        return TIN_EINVAL;
-      *tp = nw;
-      if (!saw_digit) {
-        if (++octets > 4)
-          return TIN_EINVAL;
-        saw_digit = 1;
-      }
-    } else if (ch == '.' && saw_digit) {
-      if (octets == 4)
-        return TIN_EINVAL;
-      *++tp = 0;
-      saw_digit = 0;
-    } else {
-      return TIN_EINVAL;
+  // the first longest run of two or more zero words becomes ::.
+  int best_base = -1;
+  int best_len = 0;
+  int cur_base = -1;
+  for (int i = 0; i <= 8; i++) {
+    if (i < 8 && words[i] == 0) {
+      if (cur_base == -1)
+        cur_base = i;
+      continue;
+    }
+    if (cur_base != -1 && i - cur_base > best_len) {
+      best_base = cur_base;
+      best_len = i - cur_base;
     }
+    cur_base = -1;
   }
-  if (octets < 4)
-    return TIN_EINVAL;
-  memcpy(dst, tmp, sizeof(struct in_addr));
-  return 0;
-}
-
-static int INetPToN6(const char* src, unsigned char* dst) {
-  static const char xdigits_l[] = "0123456789abcdef",
-                                  xdigits_u[] = "0123456789ABCDEF";
-  unsigned char tmp[sizeof(Inet6Addr)], *tp, *endp, *colonp;
-  const char* xdigits, *curtok;
-  int ch, seen_xdigits;
-  unsigned int val;
-
-  memset((tp = tmp), '\0', sizeof tmp);
-  endp = tp + sizeof tmp;
-  colonp = NULL;
-  /* Leading :: requires some special handling. */
-  if (*src == ':')
-    if (*++src != ':')
-      return TIN_EINVAL;
-  curtok = src;
-  seen_xdigits = 0;
-  val = 0;
-  while ((ch = *src++) != '\0') {
-    const char* pch;
+  if (best_len < 2)
+    best_base = -1;
 
-    if ((pch = strchr((xdigits = xdigits_l), ch)) == NULL)
-      pch = strchr((xdigits = xdigits_u), ch);
-    if (pch != NULL) {
-      val <<= 4;
-      val |= (pch - xdigits);
-      if (++seen_xdigits > 4)
-        return TIN_EINVAL;
-      continue;
-    }
-    if (ch == ':') {
-      curtok = src;
-      if (!seen_xdigits) {
-        if (colonp)
-          return TIN_EINVAL;
-        colonp = tp;
-        continue;
-      } else if (*src == '\0') {
-        return TIN_EINVAL;
-      }
-      if (tp + sizeof(uint16) > endp)
-        return EINVAL;
-      *tp++ = (unsigned char) (val >> 8) & 0xff;
-      *tp++ = (unsigned char) val & 0xff;
-      seen_xdigits = 0;
-      val = 0;
+  char tmp[kInetAddrStrLen6];
+  char* p = tmp;
+  for (int i = 0; i < 8; i++) {
+    if (best_base != -1 && i >= best_base && i < best_base + best_len) {
+      if (i == best_base)
+        *p++ = ':';
       continue;
     }
-    if (ch == '.' && ((tp + sizeof(struct in_addr)) <= endp)) {
-      int err = INetPToN4(curtok, tp);
-      if (err == 0) {
-        tp += sizeof(struct in_addr);
-        seen_xdigits = 0;
-        break;  /*%< '\\0' was seen by inet_pton4(). */
+    if (i != 0)
+      *p++ = ':';
+    // an IPv4-compatible or IPv4-mapped address.
+    if (i == 6 && best_base == 0 &&
+        (best_len == 6 || (best_len == 5 && words[5] == 0xffff))) {
+      for (int j = 12; j < 16; j++) {
+        if (j != 12)
+          *p++ = '.';
+        p = PutDecimal(src[j], p);
       }
+      break;
     }
-    return TIN_EINVAL;
+    p = PutHex(words[i], p);
   }
-  if (seen_xdigits) {
-    if (tp + sizeof(uint16) > endp)
-      return EINVAL;
-    *tp++ = (unsigned char) (val >> 8) & 0xff;
-    *tp++ = (unsigned char) val & 0xff;
-  }
-  if (colonp != NULL) {
-    /*
-     * Since some memmove()'s erroneously fail to handle
-     * overlapping regions, we'll do the shift by hand.
-     */
-    const int n = static_cast<const int>(tp - colonp);
-    int i;
+  if (best_base != -1 && best_base + best_len == 8)
+    *p++ = ':';
+  return CopyOut(tmp, p - tmp, dst, size);
+}
 
-    if (tp == endp)
-      return EINVAL;
-    for (i = 1; i <= n; i++) {
-      endp[- i] = colonp[n - i];
-      colonp[n - i] = 0;
-    }
-    tp = endp;
+int InetNToP(int af, const void* src, char* dst, size_t size) {
+  const uint8* bytes = static_cast<const uint8*>(src);
+  switch (af) {
+  case AF_INET:
+    return FormatIPv4(bytes, dst, size) != 0 ? 0 : TIN_ENOSPC;
+  case AF_INET6:
+    return FormatIPv6(bytes, dst, size) != 0 ? 0 : TIN_ENOSPC;
+  default:
+    return TIN_EAFNOSUPPORT;
   }
-  if (tp != endp)
-    return TIN_EINVAL;
-  memcpy(dst, tmp, sizeof tmp);
-  return 0;
 }
 
+bool InetNToP(bool ipv4, const void* src, std::string* dst) {
+  char tmp[kInetAddrStrLen6];
+  const uint8* bytes = static_cast<const uint8*>(src);
+  size_t n = ipv4 ? FormatIPv4(bytes, tmp, sizeof(tmp))
+                  : FormatIPv6(bytes, tmp, sizeof(tmp));
+  if (n != 0)
+    dst->assign(tmp, n);
+  return n != 0;
+}
 
 int INetPToN(int af, const char* src, void* dst) {
   if (src == NULL || dst == NULL)
     return TIN_EINVAL;
 
+  uint8* bytes = static_cast<uint8*>(dst);
   switch (af) {
   case AF_INET:
-    return (INetPToN4(src, static_cast<unsigned char*>(dst)));
-  case AF_INET6: {
-    int len;
-    char tmp[kInetAddrStrLen6], *s;
-    const char* p;
-    s = (char*) src;  // NOLINT
-    p = strchr(src, '%');
-    if (p != NULL) {
-      s = tmp;
-      len = static_cast<int>(p - src);
-      if (len > kInetAddrStrLen6 - 1)
-        return TIN_EINVAL;
-      memcpy(s, src, len);
-      s[len] = '\0';
-    }
-    return INetPToN6(s,  static_cast<unsigned char*>(dst));
-  }
+    return ParseIPv4(src, strlen(src), bytes) ? 0 : TIN_EINVAL;
+  case AF_INET6:
+    return ParseIPv6(src, strlen(src), bytes) ? 0 : TIN_EINVAL;
   default:
     return TIN_EAFNOSUPPORT;
   }
-  /* NOTREACHED */
 }
 
-
 bool INetPToN(bool ipv4, const char* src, void* dst) {
   return INetPToN(ipv4 ? AF_INET : AF_INET6, src, dst) == 0;
 }
@@ -5,9 +5,15 @@
 #pragma once
 #include <string>
 
+#include "base/basictypes.h"
+
 namespace tin {
 namespace net {
 
+// buffer sizes that hold any literal and its NUL.
+const int kInetAddrStrLen = 16;
+const int kInetAddrStrLen6 = 46;
+
 int InetNToP(int af, const void* src, char* dst, size_t size);
 
 int INetPToN(int af, const char* src, void* dst);
@@ -17,5 +23,16 @@ bool InetNToP(bool ipv4, const void* src, std::string* dst);
 
 bool INetPToN(bool ipv4, const char* src, void* dst);
 
+// parse len chars of src, which needs no NUL, into 4 or 16 network order
+// bytes at dst. no allocation, dst is left alone on a malformed literal.
+// ParseIPv6 accepts a trailing dotted quad and ignores a %zone suffix.
+bool ParseIPv4(const char* src, size_t len, uint8* dst);
+bool ParseIPv6(const char* src, size_t len, uint8* dst);
+
+// write the canonical literal of the 4 or 16 bytes at src NUL terminated
+// into dst. returns its length, 0 if size is too small for it.
+size_t FormatIPv4(const uint8* src, char* dst, size_t size);
+size_t FormatIPv6(const uint8* src, char* dst, size_t size);
+
 }  // namespace net
 }  // namespace tin
@@ -4,6 +4,9 @@
 
 
 #include <limits.h>
+#include <string.h>
+
+#include <algorithm>
 #include <utility>
 
 #include "base/basictypes.h"
@@ -26,7 +29,7 @@ const uint8 kIPv4MappedPrefix[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
 // Note that this function assumes:
 // * |ip_address| is at least |prefix_length_in_bits| (bits) long;
 // * |ip_prefix| is at least |prefix_length_in_bits| (bits) long.
-bool IPAddressPrefixCheck(const std::vector<uint8>& ip_address,
+bool IPAddressPrefixCheck(const tin::net::IPAddressBytes& ip_address,
                           const uint8* ip_prefix,
                           size_t prefix_length_in_bits) {
   // Compare all the bytes that fall entirely within the prefix.
@@ -62,7 +65,7 @@ struct ReservedIPv4Range {
   size_t prefix_length_in_bits;
 };
 }
-bool IsReservedIPv4(const std::vector<uint8>& ip_address) {
+bool IsReservedIPv4(const tin::net::IPAddressBytes& ip_address) {
   // Different IP versions have different range reservations.
   DCHECK_EQ(tin::net::IPAddress::kIPv4AddressSize, ip_address.size());
   static const ReservedIPv4Range kReservedIPv4Ranges[] = {
@@ -96,7 +99,7 @@ struct PublicIPv6Range {
 };
 }
 
-bool IsReservedIPv6(const std::vector<uint8>& ip_address) {
+bool IsReservedIPv6(const tin::net::IPAddressBytes& ip_address) {
   // Different IP versions have different range reservations.
   DCHECK_EQ(tin::net::IPAddress::kIPv6AddressSize, ip_address.size());
   static const PublicIPv6Range kPublicIPv6Ranges[] = {
@@ -117,32 +120,62 @@ bool IsReservedIPv6(const std::vector<uint8>& ip_address) {
 }
 
 bool ParseIPLiteralToBytes(const base::StringPiece& ip_literal,
-                           std::vector<uint8>* bytes) {
+                           tin::net::IPAddressBytes* bytes) {
   // |ip_literal| could be either an IPv4 or an IPv6 literal. If it contains
   // a colon however, it must be an IPv6 address.
   bool ipv4 = ip_literal.find(':') == base::StringPiece::npos;
-  bytes->resize(ipv4 ? 4 : 16);  // 128 bits.
-  return tin::net::INetPToN(ipv4, ip_literal.data(), vector_as_array(bytes));
+  bytes->Resize(ipv4 ? 4 : 16);  // 128 bits.
+  // ip_literal is not NUL terminated, a substr of the hostname for one.
+  if (ipv4)
+    return tin::net::ParseIPv4(ip_literal.data(), ip_literal.size(),
+                               bytes->data());
+  return tin::net::ParseIPv6(ip_literal.data(), ip_literal.size(),
+                             bytes->data());
 }
 
 }  // namespace
 namespace tin {
 namespace net {
 
+void IPAddressBytes::Assign(const uint8* data, size_t data_len) {
+  DCHECK_LE(data_len, sizeof(bytes_));
+  size_ = static_cast<uint8>(std::min(data_len, sizeof(bytes_)));
+  memcpy(bytes_, data, size_);
+}
+
+void IPAddressBytes::Resize(size_t size) {
+  DCHECK_LE(size, sizeof(bytes_));
+  size = std::min(size, sizeof(bytes_));
+  if (size > size_)
+    memset(bytes_ + size_, 0, size - size_);
+  size_ = static_cast<uint8>(size);
+}
+
+bool IPAddressBytes::operator==(const IPAddressBytes& that) const {
+  return size_ == that.size_ && memcmp(bytes_, that.bytes_, size_) == 0;
+}
+
+bool IPAddressBytes::operator!=(const IPAddressBytes& that) const {
+  return !(*this == that);
+}
+
+bool IPAddressBytes::operator<(const IPAddressBytes& that) const {
+  if (size_ != that.size_)
+    return size_ < that.size_;
+  return memcmp(bytes_, that.bytes_, size_) < 0;
+}
+
 IPAddress::IPAddress() {}
 
 IPAddress::IPAddress(const std::vector<uint8>& address)
-  : ip_address_(address) {}
+  : ip_address_(vector_as_array(&address), address.size()) {}
 
 IPAddress::IPAddress(const uint8* address, size_t address_len)
-  : ip_address_(address, address + address_len) {}
+  : ip_address_(address, address_len) {}
 
 IPAddress::IPAddress(uint8 b0, uint8 b1, uint8 b2, uint8 b3) {
-  ip_address_.reserve(4);
-  ip_address_.push_back(b0);
-  ip_address_.push_back(b1);
-  ip_address_.push_back(b2);
-  ip_address_.push_back(b3);
+  const uint8 address[] = {b0, b1, b2, b3};
+  ip_address_.Assign(address, arraysize(address));
 }
 
 IPAddress::IPAddress(uint8 b0,
@@ -164,15 +197,9 @@ IPAddress::IPAddress(uint8 b0,
   const uint8 address[] = {b0, b1, b2,  b3,  b4,  b5,  b6,  b7,
                            b8, b9, b10, b11, b12, b13, b14, b15
                           };
-  ip_address_.assign(address, address + arraysize(address));
+  ip_address_.Assign(address, arraysize(address));
 }
 
-
-IPAddress::IPAddress(const IPAddress& other)
-  : ip_address_(other.ip_address_) {}
-
-IPAddress::~IPAddress() {}
-
 bool IPAddress::IsIPv4() const {
   return ip_address_.size() == kIPv4AddressSize;
 }
@@ -208,12 +235,12 @@ bool IPAddress::IsIPv4MappedIPv6() const {
 }
 
 bool IPAddress::AssignFromIPLiteral(const base::StringPiece& ip_literal) {
-  std::vector<uint8> number;
+  IPAddressBytes number;
 
   if (!ParseIPLiteralToBytes(ip_literal, &number))
     return false;
 
-  std::swap(number, ip_address_);
+  ip_address_ = number;
   return true;
 }
 
@@ -233,7 +260,9 @@ IPAddress IPAddress::IPv6Localhost() {
 
 // static
 IPAddress IPAddress::AllZeros(size_t num_zero_bytes) {
-  return IPAddress(std::vector<uint8>(num_zero_bytes));
+  IPAddress address;
+  address.ip_address_.Resize(num_zero_bytes);
+  return address;
 }
 
 // static
@@ -256,17 +285,31 @@ bool IPAddress::operator!=(const IPAddress& that) const {
 
 bool IPAddress::operator<(const IPAddress& that) const {
   // Sort IPv4 before IPv6.
-  if (ip_address_.size() != that.ip_address_.size()) {
-    return ip_address_.size() < that.ip_address_.size();
-  }
-
   return ip_address_ < that.ip_address_;
 }
 
+size_t IPAddress::Hash() const {
+  // FNV-1a.
+  uint32 h = 2166136261u;
+  for (size_t i = 0; i < ip_address_.size(); ++i) {
+    h ^= ip_address_[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
 std::string IPAddress::ToString() const {
-  std::string str;
-  InetNToP(IsIPv4(), vector_as_array(&ip_address_), &str);
-  return str;
+  char buf[kMaxLiteralSize];
+  size_t n = ToString(buf, sizeof(buf));
+  return std::string(buf, n);
+}
+
+size_t IPAddress::ToString(char* buf, size_t size) const {
+  if (IsIPv4())
+    return FormatIPv4(ip_address_.data(), buf, size);
+  if (IsIPv6())
+    return FormatIPv6(ip_address_.data(), buf, size);
+  return 0;
 }
 
 std::string IPAddressToStringWithPort(const IPAddress& address, uint16 port) {
@@ -282,28 +325,26 @@ std::string IPAddressToStringWithPort(const IPAddress& address, uint16 port) {
 }
 
 std::string IPAddressToPackedString(const IPAddress& address) {
-  return std::string(reinterpret_cast<const char*>(
-                       vector_as_array(&address.bytes())), address.size());
+  return std::string(reinterpret_cast<const char*>(address.bytes().data()),
+                     address.size());
 }
 
 IPAddress ConvertIPv4ToIPv4MappedIPv6(const IPAddress& address) {
   DCHECK(address.IsIPv4());
   // IPv4-mapped addresses are formed by:
   // <80 bits of zeros>  + <16 bits of ones> + <32-bit IPv4 address.
-  std::vector<uint8> bytes;
-  bytes.reserve(16);
-  bytes.insert(bytes.end(), kIPv4MappedPrefix,
-               kIPv4MappedPrefix + arraysize(kIPv4MappedPrefix));
-  bytes.insert(bytes.end(), address.bytes().begin(), address.bytes().end());
+  uint8 bytes[IPAddress::kIPv6AddressSize];
+  memcpy(bytes, kIPv4MappedPrefix, arraysize(kIPv4MappedPrefix));
+  memcpy(bytes + arraysize(kIPv4MappedPrefix), address.bytes().data(),
+         IPAddress::kIPv4AddressSize);
   return IPAddress(bytes);
 }
 
 IPAddress ConvertIPv4MappedIPv6ToIPv4(const IPAddress& address) {
   DCHECK(address.IsIPv4MappedIPv6());
 
-  return IPAddress(std::vector<uint8>(
-                     address.bytes().begin() + arraysize(kIPv4MappedPrefix),
-                     address.bytes().end()));
+  return IPAddress(address.bytes().data() + arraysize(kIPv4MappedPrefix),
+                   IPAddress::kIPv4AddressSize);
 }
 
 bool IPAddressMatchesPrefix(const IPAddress& ip_address,
@@ -329,10 +370,36 @@ bool IPAddressMatchesPrefix(const IPAddress& ip_address,
   }
 
   return IPAddressPrefixCheck(ip_address.bytes(),
-                              vector_as_array(&ip_prefix.bytes()),
+                              ip_prefix.bytes().data(),
                               prefix_length_in_bits);
 }
 
+bool ParseCIDRBlock(const base::StringPiece& cidr_literal,
+                    IPAddress* ip_address,
+                    size_t* prefix_length_in_bits) {
+  size_t slash = cidr_literal.find('/');
+  if (slash == base::StringPiece::npos)
+    return false;
+  base::StringPiece length = cidr_literal.substr(slash + 1);
+  if (length.empty() || length.size() > 3)
+    return false;
+  size_t bits = 0;
+  for (size_t i = 0; i < length.size(); ++i) {
+    if (length[i] < '0' || length[i] > '9')
+      return false;
+    bits = bits * 10 + (length[i] - '0');
+  }
+
+  IPAddress address;
+  if (!address.AssignFromIPLiteral(cidr_literal.substr(0, slash)) ||
+      bits > address.size() * 8) {
+    return false;
+  }
+  *ip_address = address;
+  *prefix_length_in_bits = bits;
+  return true;
+}
+
 bool ParseURLHostnameToAddress(const base::StringPiece& hostname,
                                IPAddress* ip_address) {
   if (hostname.size() >= 2 && hostname.front() == '[' &&
@@ -363,8 +430,9 @@ unsigned CommonPrefixLength(const IPAddress& a1, const IPAddress& a2) {
 }
 
 unsigned MaskPrefixLength(const IPAddress& mask) {
-  std::vector<uint8> all_ones(mask.size(), 0xFF);
-  return CommonPrefixLength(mask, IPAddress(all_ones));
+  uint8 all_ones[IPAddress::kIPv6AddressSize];
+  memset(all_ones, 0xFF, sizeof(all_ones));
+  return CommonPrefixLength(mask, IPAddress(all_ones, mask.size()));
 }
 
 }  // namespace net
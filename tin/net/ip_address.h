@@ -16,10 +16,47 @@
 namespace tin {
 namespace net {
 
+// up to 16 bytes of an address stored inline, copies never allocate.
+class IPAddressBytes {
+ public:
+  IPAddressBytes() : size_(0) {}
+  IPAddressBytes(const uint8* data, size_t data_len) { Assign(data, data_len); }
+
+  // copies at most 16 bytes of data.
+  void Assign(const uint8* data, size_t data_len);
+
+  // new bytes are zero.
+  void Resize(size_t size);
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const uint8* data() const { return bytes_; }
+  uint8* data() { return bytes_; }
+
+  const uint8* begin() const { return bytes_; }
+  const uint8* end() const { return bytes_ + size_; }
+
+  uint8 operator[](size_t i) const { return bytes_[i]; }
+  uint8& operator[](size_t i) { return bytes_[i]; }
+
+  bool operator==(const IPAddressBytes& that) const;
+  bool operator!=(const IPAddressBytes& that) const;
+  // by size first, then the bytes.
+  bool operator<(const IPAddressBytes& that) const;
+
+ private:
+  uint8 bytes_[16];
+  uint8 size_;
+};
+
 class  IPAddress {
  public:
   enum  { kIPv4AddressSize = 4, kIPv6AddressSize = 16 };
 
+  // ToString(buf, size) never needs more, the NUL included.
+  enum { kMaxLiteralSize = 46 };
+
   // Creates a zero-sized, invalid address.
   IPAddress();
 
@@ -27,13 +64,11 @@ class  IPAddress {
   // network byte order.
   explicit IPAddress(const std::vector<uint8>& address);
 
-  IPAddress(const IPAddress& other);
-
   // Copies the input address to |ip_address_|. The input is expected to be in
   // network byte order.
   template <size_t N>
   IPAddress(const uint8(&address)[N])  // NOLINT
-    : ip_address_(address, address + N) {}
+    : ip_address_(address, N) {}
 
   // Copies the input address to |ip_address_| taking an additional length
   // parameter. The input is expected to be in network byte order.
@@ -62,8 +97,6 @@ class  IPAddress {
             uint8 b14,
             uint8 b15);
 
-  ~IPAddress();
-
   // Returns true if the IP has |kIPv4AddressSize| elements.
   bool IsIPv4() const;
 
@@ -96,13 +129,20 @@ class  IPAddress {
   // |ip_address_| is invalid.
   std::string ToString() const;
 
+  // As above, written NUL terminated into |buf| without allocating. Returns
+  // the length, 0 when |ip_address_| is invalid or |size| is too small.
+  size_t ToString(char* buf, size_t size) const;
+
   // Parses an IP address literal (either IPv4 or IPv6) to its numeric value.
   // Returns true on success and fills |ip_address_| with the numeric value.
   bool AssignFromIPLiteral(const base::StringPiece& ip_literal)
   WARN_UNUSED_RESULT;
 
-  // Returns the underlying byte vector.
-  const std::vector<uint8>& bytes() const { return ip_address_; }
+  // Returns the underlying bytes.
+  const IPAddressBytes& bytes() const { return ip_address_; }
+
+  // for hash maps keyed by address.
+  size_t Hash() const;
 
   // Returns an IPAddress instance representing the 127.0.0.1 address.
   static IPAddress IPv4Localhost();
@@ -126,9 +166,9 @@ class  IPAddress {
  private:
   // IPv4 addresses will have length kIPv4AddressSize, whereas IPv6 address
   // will have length kIPv6AddressSize.
-  std::vector<uint8> ip_address_;
+  IPAddressBytes ip_address_;
 
-  // This class is copyable and assignable.
+  // This class is trivially copyable and assignable.
 };
 
 typedef std::vector<IPAddress> IPAddressList;
@@ -173,6 +213,10 @@ bool IPAddressMatchesPrefix(const IPAddress& ip_address,
 //    10.10.3.1/20
 //    a:b:c::/46
 //    ::1/128
+bool ParseCIDRBlock(const base::StringPiece& cidr_literal,
+                    IPAddress* ip_address,
+                    size_t* prefix_length_in_bits)
+WARN_UNUSED_RESULT;
 
 // Parses a URL-safe IP literal (see RFC 3986, Sec 3.2.2) to its numeric value.
 // Returns true on success, and fills |ip_address| with the numeric value.
@@ -83,16 +83,9 @@ bool GetIPAddressFromSockAddr(const struct sockaddr* sock_addr,
 
 IPEndPoint::IPEndPoint() : port_(0) {}
 
-IPEndPoint::~IPEndPoint() {}
-
 IPEndPoint::IPEndPoint(const IPAddress& address, uint16 port)
   : address_(address), port_(port) {}
 
-IPEndPoint::IPEndPoint(const IPEndPoint& endpoint) {
-  address_ = endpoint.address_;
-  port_ = endpoint.port_;
-}
-
 AddressFamily IPEndPoint::GetFamily() const {
   return GetAddressFamily(address_);
 }
@@ -122,7 +115,7 @@ bool IPEndPoint::ToSockAddr(struct sockaddr* address,
     memset(addr, 0, sizeof(struct sockaddr_in));
     addr->sin_family = AF_INET;
     addr->sin_port = base::HostToNet16(port_);
-    memcpy(&addr->sin_addr, vector_as_array(&address_.bytes()),
+    memcpy(&addr->sin_addr, address_.bytes().data(),
            IPAddress::kIPv4AddressSize);
     break;
   }
@@ -135,7 +128,7 @@ bool IPEndPoint::ToSockAddr(struct sockaddr* address,
     memset(addr6, 0, sizeof(struct sockaddr_in6));
     addr6->sin6_family = AF_INET6;
     addr6->sin6_port = base::HostToNet16(port_);
-    memcpy(&addr6->sin6_addr, vector_as_array(&address_.bytes()),
+    memcpy(&addr6->sin6_addr, address_.bytes().data(),
            IPAddress::kIPv6AddressSize);
     break;
   }
@@ -166,6 +159,37 @@ std::string IPEndPoint::ToString() const {
   return IPAddressToStringWithPort(address_, port_);
 }
 
+size_t IPEndPoint::ToString(char* buf, size_t size) const {
+  if (size < 2)
+    return 0;
+  // room for the bracket of an IPv6 address.
+  size_t n = address_.ToString(buf + 1, size - 1);
+  if (n == 0)
+    return 0;
+  if (address_.IsIPv6()) {
+    buf[0] = '[';
+    buf[++n] = ']';
+    n++;
+  } else {
+    memmove(buf, buf + 1, n);
+  }
+  // ":65535" and the NUL.
+  char port[8];
+  char* p = port + sizeof(port);
+  *--p = '\0';
+  unsigned v = port_;
+  do {
+    *--p = static_cast<char>('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  *--p = ':';
+  size_t plen = port + sizeof(port) - p;
+  if (n + plen > size)
+    return 0;
+  memcpy(buf + n, p, plen);
+  return n + plen - 1;
+}
+
 std::string IPEndPoint::ToStringWithoutPort() const {
   return address_.ToString();
 }
@@ -185,5 +209,9 @@ bool IPEndPoint::operator==(const IPEndPoint& other) const {
   return address_ == other.address_ && port_ == other.port_;
 }
 
+size_t IPEndPoint::Hash() const {
+  return address_.Hash() * 31 + port_;
+}
+
 }  // namespace net
 }  // namespace tin
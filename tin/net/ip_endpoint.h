@@ -23,9 +23,7 @@ namespace net {
 class  IPEndPoint {
  public:
   IPEndPoint();
-  ~IPEndPoint();
   IPEndPoint(const IPAddress& address, uint16 port);
-  IPEndPoint(const IPEndPoint& endpoint);
 
   const IPAddress& address() const {
     return address_;
@@ -61,6 +59,13 @@ class  IPEndPoint {
   // when |address_| is invalid (the port will be ignored).
   std::string ToString() const;
 
+  // As above, written NUL terminated into |buf| without allocating. Returns
+  // the length, 0 when |address_| is invalid or |size| is too small.
+  // kMaxLiteralSize bytes always do.
+  size_t ToString(char* buf, size_t size) const;
+
+  enum { kMaxLiteralSize = IPAddress::kMaxLiteralSize + 8 };
+
   // As above, but without port. Returns the empty string when address_ is
   // invalid.
   std::string ToStringWithoutPort() const;
@@ -68,6 +73,9 @@ class  IPEndPoint {
   bool operator<(const IPEndPoint& that) const;
   bool operator==(const IPEndPoint& that) const;
 
+  // for hash maps keyed by endpoint, see IPAddress::Hash.
+  size_t Hash() const;
+
  private:
   IPAddress address_;
   uint16 port_;
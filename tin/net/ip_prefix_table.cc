@@ -0,0 +1,292 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+#include <deque>
+#include <utility>
+
+#include "base/logging.h"
+#include "build/build_config.h"
+
+#if defined(COMPILER_MSVC)
+#include <intrin.h>
+#endif
+
+#include "tin/net/ip_prefix_table.h"
+
+namespace tin {
+namespace net {
+
+namespace {
+
+const int kStride = 6;
+const int kSlots = 1 << kStride;
+// two strides resolved by one load.
+const int kDirectBits = 2 * kStride;
+const uint32 kDirectLeaf = 0x80000000u;
+
+inline int Popcount(uint64 x) {
+#if defined(COMPILER_GCC)
+  return __builtin_popcountll(x);
+#elif defined(COMPILER_MSVC) && defined(ARCH_CPU_64_BITS)
+  return static_cast<int>(__popcnt64(x));
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// the kStride bits of the 128 bit key hi:lo from bit offset on, zero
+// padded past the end.
+inline uint32 Chunk(uint64 hi, uint64 lo, int offset) {
+  uint64 w;
+  if (offset == 0) {
+    w = hi;
+  } else if (offset < 64) {
+    w = (hi << offset) | (lo >> (64 - offset));
+  } else {
+    w = lo << (offset - 64);
+  }
+  return static_cast<uint32>(w >> (64 - kStride));
+}
+
+uint64 LoadBigEndian64(const uint8* p) {
+  uint64 v = 0;
+  for (int i = 0; i < 8; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+// an IPv4 address is the top 32 bits of hi, lo is 0.
+uint64 IPv4Key(const uint8* p) {
+  uint32 v = (static_cast<uint32>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) |
+             p[3];
+  return static_cast<uint64>(v) << 32;
+}
+
+void KeyOf(const IPAddress& address, uint64* hi, uint64* lo) {
+  const uint8* p = address.bytes().data();
+  if (address.IsIPv4()) {
+    *hi = IPv4Key(p);
+    *lo = 0;
+  } else {
+    *hi = LoadBigEndian64(p);
+    *lo = LoadBigEndian64(p + 8);
+  }
+}
+
+// the trie while it is built, every slot a child or a pushed down leaf.
+struct BuildNode {
+  int32 child[kSlots];
+  int32 value[kSlots];
+};
+
+int NewBuildNode(std::vector<BuildNode>* nodes, int32 value) {
+  BuildNode node;
+  for (int i = 0; i < kSlots; i++) {
+    node.child[i] = -1;
+    node.value[i] = value;
+  }
+  nodes->push_back(node);
+  return static_cast<int>(nodes->size() - 1);
+}
+
+}  // namespace
+
+IPPrefixTable::Builder::Builder() {
+}
+
+IPPrefixTable::Builder::~Builder() {
+}
+
+bool IPPrefixTable::Builder::Add(const IPAddress& prefix,
+                                 size_t prefix_length_in_bits,
+                                 int value) {
+  // kint32max would not fit the biased direct leaves.
+  if (!prefix.IsValid() || value < 0 || value == kint32max ||
+      prefix_length_in_bits > prefix.size() * 8) {
+    return false;
+  }
+  Entry e;
+  KeyOf(prefix, &e.hi, &e.lo);
+  e.len = static_cast<int>(prefix_length_in_bits);
+  e.value = value;
+  // drop the host bits.
+  if (e.len < 64) {
+    e.hi = e.len == 0 ? 0 : e.hi & (~0ULL << (64 - e.len));
+    e.lo = 0;
+  } else if (e.len < 128) {
+    e.lo = e.len == 64 ? 0 : e.lo & (~0ULL << (128 - e.len));
+  }
+  if (prefix.IsIPv4()) {
+    v4_.push_back(e);
+  } else {
+    v6_.push_back(e);
+  }
+  return true;
+}
+
+bool IPPrefixTable::Builder::AddCIDR(const base::StringPiece& cidr_literal,
+                                     int value) {
+  IPAddress prefix;
+  size_t prefix_length_in_bits = 0;
+  if (!ParseCIDRBlock(cidr_literal, &prefix, &prefix_length_in_bits))
+    return false;
+  return Add(prefix, prefix_length_in_bits, value);
+}
+
+IPPrefixTable* IPPrefixTable::Builder::Build() const {
+  IPPrefixTable* table = new IPPrefixTable;
+  BuildTrie(v4_, &table->v4_);
+  BuildTrie(v6_, &table->v6_);
+  return table;
+}
+
+IPPrefixTable::IPPrefixTable() {
+}
+
+IPPrefixTable::~IPPrefixTable() {
+}
+
+namespace {
+struct ShorterPrefix {
+  template <typename E>
+  bool operator()(const E& a, const E& b) const {
+    return a.len < b.len;
+  }
+};
+}  // namespace
+
+// static
+void IPPrefixTable::BuildTrie(const std::vector<Builder::Entry>& entries,
+                              Trie* trie) {
+  // shorter prefixes first, a longer one then overwrites the leaves it
+  // covers and never finds a child below them.
+  std::vector<Builder::Entry> sorted(entries);
+  std::stable_sort(sorted.begin(), sorted.end(), ShorterPrefix());
+
+  std::vector<BuildNode> nodes;
+  NewBuildNode(&nodes, kNoMatch);
+  for (size_t i = 0; i < sorted.size(); i++) {
+    const Builder::Entry& e = sorted[i];
+    int node = 0;
+    int offset = 0;
+    while (true) {
+      uint32 slot = Chunk(e.hi, e.lo, offset);
+      int rem = e.len - offset;
+      if (rem <= kStride) {
+        int span = 1 << (kStride - rem);
+        for (int s = 0; s < span; s++) {
+          DCHECK_EQ(nodes[node].child[slot + s], -1);
+          nodes[node].value[slot + s] = e.value;
+        }
+        break;
+      }
+      if (nodes[node].child[slot] == -1) {
+        int child = NewBuildNode(&nodes, nodes[node].value[slot]);
+        nodes[node].child[slot] = child;
+      }
+      node = nodes[node].child[slot];
+      offset += kStride;
+    }
+  }
+
+  // the direct table stands for the first two levels, leaf values are
+  // stored biased by one so kNoMatch fits.
+  trie->direct.assign(1 << kDirectBits, 0);
+  trie->nodes.clear();
+  trie->leaves.clear();
+  std::deque<std::pair<int, uint32> > queue;
+  const BuildNode& root = nodes[0];
+  for (int d = 0; d < (1 << kDirectBits); d++) {
+    int s1 = d >> kStride;
+    int s2 = d & (kSlots - 1);
+    int32 value = root.value[s1];
+    int child = -1;
+    if (root.child[s1] != -1) {
+      const BuildNode& level1 = nodes[root.child[s1]];
+      value = level1.value[s2];
+      child = level1.child[s2];
+    }
+    if (child == -1) {
+      trie->direct[d] = kDirectLeaf | static_cast<uint32>(value + 1);
+      continue;
+    }
+    trie->direct[d] = static_cast<uint32>(trie->nodes.size());
+    queue.push_back(std::make_pair(child, trie->direct[d]));
+    trie->nodes.push_back(Node());
+  }
+
+  // breadth first, so the children of a node are adjacent.
+  while (!queue.empty()) {
+    const BuildNode& b = nodes[queue.front().first];
+    uint32 at = queue.front().second;
+    queue.pop_front();
+
+    Node n;
+    n.vector = 0;
+    n.leafvec = 0;
+    n.base1 = static_cast<uint32>(trie->nodes.size());
+    n.base0 = static_cast<uint32>(trie->leaves.size());
+    bool any_leaf = false;
+    int32 last = 0;
+    for (int s = 0; s < kSlots; s++) {
+      if (b.child[s] != -1) {
+        n.vector |= 1ULL << s;
+        queue.push_back(std::make_pair(
+            b.child[s], static_cast<uint32>(trie->nodes.size())));
+        trie->nodes.push_back(Node());
+        continue;
+      }
+      if (!any_leaf || b.value[s] != last) {
+        n.leafvec |= 1ULL << s;
+        trie->leaves.push_back(b.value[s]);
+        last = b.value[s];
+        any_leaf = true;
+      }
+    }
+    trie->nodes[at] = n;
+  }
+}
+
+int IPPrefixTable::Trie::Lookup(uint64 hi, uint64 lo) const {
+  uint32 d = direct[static_cast<uint32>(hi >> (64 - kDirectBits))];
+  if ((d & kDirectLeaf) != 0)
+    return static_cast<int>(d & ~kDirectLeaf) - 1;
+  const Node* n = &nodes[d];
+  int offset = kDirectBits;
+  while (true) {
+    uint32 slot = Chunk(hi, lo, offset);
+    uint64 bit = 1ULL << slot;
+    uint64 mask = (bit << 1) - 1;
+    if ((n->vector & bit) == 0)
+      return leaves[n->base0 + Popcount(n->leafvec & mask) - 1];
+    n = &nodes[n->base1 + Popcount(n->vector & mask) - 1];
+    offset += kStride;
+  }
+}
+
+int IPPrefixTable::Lookup(const IPAddress& address) const {
+  if (address.IsIPv4())
+    return v4_.Lookup(IPv4Key(address.bytes().data()), 0);
+  if (!address.IsIPv6())
+    return kNoMatch;
+  if (address.IsIPv4MappedIPv6())
+    return v4_.Lookup(IPv4Key(address.bytes().data() + 12), 0);
+  uint64 hi = 0;
+  uint64 lo = 0;
+  KeyOf(address, &hi, &lo);
+  return v6_.Lookup(hi, lo);
+}
+
+size_t IPPrefixTable::MemoryUsage() const {
+  return (v4_.direct.size() + v6_.direct.size()) * sizeof(uint32) +
+         (v4_.nodes.size() + v6_.nodes.size()) * sizeof(Node) +
+         (v4_.leaves.size() + v6_.leaves.size()) * sizeof(int32);
+}
+
+}  // namespace net
+}  // namespace tin
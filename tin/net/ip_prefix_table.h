@@ -0,0 +1,95 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/strings/string_piece.h"
+#include "tin/net/ip_address.h"
+
+namespace tin {
+namespace net {
+
+// longest prefix match of an address against many prefixes, like an
+// allow/deny list, a poptrie: a direct table for the first 12 bits, then
+// 64-way nodes whose children and leaves are found by popcount, runs of
+// equal leaves stored once. immutable once built, so one table is shared
+// by any number of greenlets and threads.
+class IPPrefixTable {
+ public:
+  enum { kNoMatch = -1 };
+
+  class Builder {
+   public:
+    Builder();
+    ~Builder();
+
+    // value must be in [0, kint32max). the longest matching prefix wins, of
+    // equal prefixes the one added last. bits past the prefix length are
+    // ignored. false if the prefix is invalid or too long.
+    bool Add(const IPAddress& prefix, size_t prefix_length_in_bits,
+             int value);
+
+    // as above with a block in CIDR notation, "10.0.0.0/8".
+    bool AddCIDR(const base::StringPiece& cidr_literal, int value);
+
+    // the caller owns the table, the builder can be reused.
+    IPPrefixTable* Build() const;
+
+   private:
+    struct Entry {
+      uint64 hi;
+      uint64 lo;
+      int len;
+      int value;
+    };
+
+    friend class IPPrefixTable;
+
+    std::vector<Entry> v4_;
+    std::vector<Entry> v6_;
+    DISALLOW_COPY_AND_ASSIGN(Builder);
+  };
+
+  ~IPPrefixTable();
+
+  // the value of the longest prefix matching address, kNoMatch if none
+  // does. IPv4-mapped IPv6 addresses are looked up as IPv4.
+  int Lookup(const IPAddress& address) const;
+
+  size_t MemoryUsage() const;
+
+ private:
+  struct Node {
+    // which slots are child nodes.
+    uint64 vector;
+    // leaf slots that start a run of equal values.
+    uint64 leafvec;
+    uint32 base0;
+    uint32 base1;
+  };
+
+  struct Trie {
+    int Lookup(uint64 hi, uint64 lo) const;
+
+    // a node index, or a leaf value with kDirectLeaf set.
+    std::vector<uint32> direct;
+    std::vector<Node> nodes;
+    std::vector<int32> leaves;
+  };
+
+  IPPrefixTable();
+
+  static void BuildTrie(const std::vector<Builder::Entry>& entries,
+                        Trie* trie);
+
+  Trie v4_;
+  Trie v6_;
+  DISALLOW_COPY_AND_ASSIGN(IPPrefixTable);
+};
+
+}  // namespace net
+}  // namespace tin
@@ -2,12 +2,17 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
+
+#include "base/logging.h"
 #include "build/build_config.h"
 
 #include "tin/net/sys_socket.h"
 #include "tin/error/error.h"
 #include "tin/time/time.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/p.h"
 #include "tin/net/netfd.h"
 
 #include "tin/net/listener.h"
@@ -16,33 +21,108 @@ namespace tin {
 namespace net {
 
 TCPListenerImpl::TCPListenerImpl(NetFD* netfd, int backlog)
-  : netfd_(netfd) {
+  : netfds_(1, netfd)
+  , tracker_(new ConnTracker) {
+}
+
+TCPListenerImpl::TCPListenerImpl(const std::vector<NetFD*>& netfds,
+                                 int backlog)
+  : netfds_(netfds)
+  , tracker_(new ConnTracker) {
+  DCHECK(!netfds_.empty());
 }
 
 TCPListenerImpl::~TCPListenerImpl() {
-  delete netfd_;
+  for (size_t i = 0; i < netfds_.size(); ++i) {
+    delete netfds_[i];
+  }
 }
 
 void TCPListenerImpl::SetDeadline(int64 t) {
-  int err = netfd_->SetDeadline(t);
+  int err = 0;
+  for (size_t i = 0; i < netfds_.size(); ++i) {
+    int e = netfds_[i]->SetDeadline(t);
+    if (err == 0)
+      err = e;
+  }
   SetErrorCode(TinTranslateSysError(err));
 }
 
 void TCPListenerImpl::Close() {
-  int err = netfd_->Close();
+  int err = 0;
+  for (size_t i = 0; i < netfds_.size(); ++i) {
+    int e = netfds_[i]->Close();
+    if (err == 0)
+      err = e;
+  }
   SetErrorCode(TinTranslateSysError(err));
 }
 
+uintptr_t TCPListenerImpl::SysFd(int shard) const {
+  return netfds_[shard % Shards()]->SysFd();
+}
+
+bool TCPListenerImpl::Drain(int64 timeout) {
+  for (size_t i = 0; i < netfds_.size(); ++i) {
+    netfds_[i]->Close();
+  }
+  bool idle = tracker_->WaitIdle(timeout);
+  SetErrorCode(idle ? 0 : TIN_ETIMEDOUT);
+  return idle;
+}
+
+int TCPListenerImpl::ActiveConns() {
+  return tracker_->Active();
+}
+
+void TCPListenerImpl::EnableStats() {
+  tracker_->EnableStats();
+}
+
+void TCPListenerImpl::GetStats(NetStatsSnapshot* snapshot) {
+  tracker_->GetStats(snapshot);
+}
+
+int TCPListenerImpl::CurrentShard() const {
+  if (netfds_.size() == 1)
+    return 0;
+  tin::runtime::P* p = tin::runtime::GetP();
+  return p != NULL ? p->Id() % Shards() : 0;
+}
+
 TcpConn TCPListenerImpl::Accept() {
+  return Accept(CurrentShard());
+}
+
+TcpConn TCPListenerImpl::Accept(int shard) {
   NetFD* newfd = NULL;
   TcpConnImpl* conn = NULL;
-  int err = netfd_->Accept(&newfd);
+  int err = netfds_[shard % Shards()]->Accept(&newfd);
   if (err == 0) {
     conn = new TcpConnImpl(newfd);
+    conn->Track(tracker_.get());
   }
   SetErrorCode(TinTranslateSysError(err));
   return MakeTcpConn(conn);
 }
 
+int TCPListenerImpl::AcceptBatch(TcpConn* conns, int max) {
+  return AcceptBatch(CurrentShard(), conns, max);
+}
+
+int TCPListenerImpl::AcceptBatch(int shard, TcpConn* conns, int max) {
+  const int kMaxBatch = 64;
+  NetFD* newfds[kMaxBatch];
+  int n = 0;
+  int err = netfds_[shard % Shards()]->AcceptBatch(
+      newfds, std::min(max, kMaxBatch), &n);
+  for (int i = 0; i < n; ++i) {
+    conns[i] = MakeTcpConn(new TcpConnImpl(newfds[i]));
+    conns[i]->Track(tracker_.get());
+  }
+  SetErrorCode(TinTranslateSysError(err));
+  return n;
+}
+
 }  // namespace net
 }  // namespace tin
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "base/basictypes.h"
 #include "base/memory/scoped_ptr.h"
 #include "base/memory/ref_counted.h"
@@ -19,14 +21,48 @@ class TCPListenerImpl
   : public base::RefCountedThreadSafe<TCPListenerImpl> {
  public:
   TCPListenerImpl(NetFD* netfd, int backlog);
+  // takes ownership of SO_REUSEPORT sockets bound to the same address.
+  TCPListenerImpl(const std::vector<NetFD*>& netfds, int backlog);
   ~TCPListenerImpl();
 
   void SetDeadline(int64 t);
+  // accepts on the shard of the current P.
   TcpConn Accept();
+  TcpConn Accept(int shard);
+  // waits for one connection and takes up to max - 1 more that are
+  // already queued, returns the number stored in conns.
+  int AcceptBatch(TcpConn* conns, int max);
+  int AcceptBatch(int shard, TcpConn* conns, int max);
   void Close();
 
+  // stops accepting and waits up to timeout (relative, -1 forever) for
+  // the connections accepted so far to be released. a successor holding
+  // the sockets through a handover keeps serving the backlog. false if
+  // connections were still alive at the timeout.
+  bool Drain(int64 timeout);
+
+  // accepted connections not yet destroyed.
+  int ActiveConns();
+
+  // counts the io of connections accepted from now on, aggregated by
+  // GetStats. needs a TIN_NET_STATS build for more than conns.
+  void EnableStats();
+  void GetStats(NetStatsSnapshot* snapshot);
+
+  int Shards() const {
+    return static_cast<int>(netfds_.size());
+  }
+
+  // the listening socket of shard, to hand over to another process with
+  // UnixConnImpl::WriteFds. stays owned by this listener.
+  uintptr_t SysFd(int shard = 0) const;
+
+ private:
+  int CurrentShard() const;
+
  private:
-  NetFD* netfd_;
+  std::vector<NetFD*> netfds_;
+  scoped_refptr<ConnTracker> tracker_;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(TCPListenerImpl);
@@ -0,0 +1,38 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "tin/net/net_stats.h"
+
+namespace tin {
+namespace net {
+
+NetStats::NetStats()
+  : bytes_read(0)
+  , bytes_written(0)
+  , read_calls(0)
+  , write_calls(0)
+  , read_parks(0)
+  , write_parks(0)
+  , read_park_ns(0)
+  , write_park_ns(0)
+  , read_timeouts(0)
+  , write_timeouts(0) {
+}
+
+void NetStats::AddTo(NetStatsSnapshot* snapshot) const {
+  snapshot->conns++;
+  snapshot->bytes_read += bytes_read.load(quark::memory_order_relaxed);
+  snapshot->bytes_written += bytes_written.load(quark::memory_order_relaxed);
+  snapshot->read_calls += read_calls.load(quark::memory_order_relaxed);
+  snapshot->write_calls += write_calls.load(quark::memory_order_relaxed);
+  snapshot->read_parks += read_parks.load(quark::memory_order_relaxed);
+  snapshot->write_parks += write_parks.load(quark::memory_order_relaxed);
+  snapshot->read_park_ns += read_park_ns.load(quark::memory_order_relaxed);
+  snapshot->write_park_ns += write_park_ns.load(quark::memory_order_relaxed);
+  snapshot->read_timeouts += read_timeouts.load(quark::memory_order_relaxed);
+  snapshot->write_timeouts += write_timeouts.load(quark::memory_order_relaxed);
+}
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,104 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+#include "quark/atomic.hpp"
+
+// connection io counters. compiled in with TIN_NET_STATS (cmake
+// -DTIN_ENABLE_NET_STATS=ON), then enabled per listener, see
+// TCPListenerImpl::EnableStats. without the define every TIN_NET_STAT
+// is gone and a NetFD carries just a NULL pointer.
+
+namespace tin {
+namespace net {
+
+struct NetStatsSnapshot {
+  // connections counted, open and closed.
+  uint64 conns;
+  uint64 bytes_read;
+  uint64 bytes_written;
+  // read and write syscalls, io_uring requests included.
+  uint64 read_calls;
+  uint64 write_calls;
+  // waits on the poller after EAGAIN, and the time spent there.
+  uint64 read_parks;
+  uint64 write_parks;
+  int64 read_park_ns;
+  int64 write_park_ns;
+  // waits ended by a read or write deadline.
+  uint64 read_timeouts;
+  uint64 write_timeouts;
+};
+
+// kernel view of one tcp connection, see TcpConnImpl::Info. fields the
+// platform does not report stay 0.
+struct TcpInfo {
+  // smoothed round trip time and its variance.
+  int64 rtt_us;
+  int64 rtt_var_us;
+  // congestion window and segment size, the window in segments.
+  uint32 snd_cwnd;
+  uint32 snd_mss;
+  // segments retransmitted over the lifetime of the connection, from
+  // the bytes retransmitted on windows.
+  uint32 total_retrans;
+  // segments sent and not yet acked.
+  uint32 unacked;
+  // bytes written and not yet acked, sent or not. only those sent on
+  // windows.
+  int64 send_queue;
+};
+
+// one round of TcpInfo samples over the connections of a ConnTracker,
+// see ConnTracker::EnableTcpInfoSampling.
+struct TcpInfoStats {
+  // rounds done, 0 while none is.
+  uint64 rounds;
+  // MonoNow() of the last round and the connections it sampled.
+  int64 sampled_at;
+  uint32 samples;
+  int64 rtt_us_avg;
+  int64 rtt_us_max;
+  uint32 snd_cwnd_avg;
+  uint64 total_retrans;
+  int64 send_queue_avg;
+  int64 send_queue_max;
+};
+
+// counters of one connection. each is bumped by the reader or the
+// writer only, relaxed adds keep concurrent snapshots well defined.
+struct NetStats {
+  NetStats();
+
+  void AddTo(NetStatsSnapshot* snapshot) const;
+
+  quark::atomic_uint64_t bytes_read;
+  quark::atomic_uint64_t bytes_written;
+  quark::atomic_uint64_t read_calls;
+  quark::atomic_uint64_t write_calls;
+  quark::atomic_uint64_t read_parks;
+  quark::atomic_uint64_t write_parks;
+  quark::atomic_uint64_t read_park_ns;
+  quark::atomic_uint64_t write_park_ns;
+  quark::atomic_uint64_t read_timeouts;
+  quark::atomic_uint64_t write_timeouts;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(NetStats);
+};
+
+#if defined(TIN_NET_STATS)
+#define TIN_NET_STAT(stats, field, n)                                    \
+  do {                                                                   \
+    if ((stats) != NULL)                                                 \
+      (stats)->field.fetch_add((n), quark::memory_order_relaxed);        \
+  } while (0)
+#else
+#define TIN_NET_STAT(stats, field, n) do { } while (0)
+#endif
+
+}  // namespace net
+}  // namespace tin
@@ -10,6 +10,7 @@
 #include "base/strings/string_util.h"
 #include "tin/error/error.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/util.h"
 #include "tin/runtime/net/pollops.h"
 #include "tin/net/net.h"
 #include "tin/net/sockaddr_storage.h"
@@ -27,7 +28,8 @@ NetFDCommon::NetFDCommon(uintptr_t sysfd,
   : sysfd_(sysfd)
   , family_(family)
   , sotype_(sotype)
-  , net_(net) {
+  , net_(net)
+  , stats_(NULL) {
 }
 
 NetFDCommon::~NetFDCommon() {
@@ -97,7 +99,7 @@ int NetFDCommon::SetWriteDeadline(int64 t) {
 }
 
 int NetFDCommon::SetDeadlineImpl(int64 t, int mode) {
-  int64 now = MonoNow();
+  int64 now = runtime::DeadlineNow();
   int64 d = now + t;
   // test overflow.
   if (kint64max - now < t) {
@@ -5,17 +5,53 @@
 #pragma once
 #include <string>
 #include "base/strings/string_piece.h"
+#include "tin/net/conn_alloc.h"
 #include "tin/net/fd_mutex.h"
 #include "tin/net/poll_desc.h"
 #include "tin/net/address_list.h"
 #include "tin/net/ip_endpoint.h"
 #include "tin/net/sockaddr_storage.h"
+#include "tin/net/net_stats.h"
+#include "tin/net/idle_reaper.h"
+#include "tin/runtime/runtime.h"
 
 namespace tin {
 namespace net {
 
+// upper bound on segments per Readv/Writev, well below the IOV_MAX of
+// the platforms we run on.
+const int kMaxIOVecs = 64;
+
 const uintptr_t kInvalidSocket = uintptr_t(~0);
 
+// upper bound on datagrams per ReadMsgs/WriteMsgs.
+const int kMaxUdpBatch = 32;
+
+// upper bound on descriptors per WriteFds/ReadFds, the linux limit is 253.
+const int kMaxPassedFds = 64;
+
+// one datagram of a batch, see NetFD::ReadMsgs and WriteMsgs.
+struct UdpMessage {
+  UdpMessage()
+    : buf(NULL)
+    , len(0)
+    , n(0)
+    , segment_size(0) {
+  }
+
+  // payload, len bytes of room when reading.
+  char* buf;
+  int len;
+  // peer the datagram came from. where to send it, left empty on a
+  // connected socket.
+  IPEndPoint addr;
+  // bytes received or sent.
+  int n;
+  // writes: the kernel splits buf into datagrams of that size (GSO).
+  // reads: size of the datagrams coalesced into buf (GRO). 0 for none.
+  int segment_size;
+};
+
 class NetFDCommon {
  public:
   NetFDCommon(uintptr_t sysfd,
@@ -25,6 +61,9 @@ class NetFDCommon {
 
   virtual ~NetFDCommon();
 
+  // one for every connection, see ConnAlloc.
+  TIN_CONN_ALLOCATED()
+
   int Incref();
 
   int ReadLock();
@@ -47,6 +86,12 @@ class NetFDCommon {
 
   int SetDeadlineImpl(int64 t, int mode);
 
+  // see FdMutex::SetExclusive, before the fd is handed to its reader and
+  // writer greenlets.
+  void SetExclusive() {
+    fdmu_.SetExclusive();
+  }
+
   void Decref();
 
   PollDesc* Pd() {
@@ -61,6 +106,25 @@ class NetFDCommon {
     return static_cast<int>(sysfd_);
   }
 
+  // counters of this fd, owned by the caller. NULL stops counting.
+  void SetStats(NetStats* stats) {
+    stats_ = stats;
+  }
+
+  // see IdleReaper.
+  IdleEntry* IdleLinks() {
+    return &idle_;
+  }
+
+  // at the start of each read and write, one store of the coarse clock
+  // while an IdleReaper tracks the fd.
+  void TouchIdle() {
+    if (idle_.reaper != NULL) {
+      atomic::relaxed_store32(&idle_.last_active,
+                              static_cast<uint32>(CoarseNow() / 1000000));
+    }
+  }
+
  protected:
   FdMutex fdmu_;
   uintptr_t sysfd_;
@@ -69,6 +133,8 @@ class NetFDCommon {
   int is_connected_;
   std::string  net_;
   PollDesc pd_;
+  NetStats* stats_;
+  IdleEntry idle_;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(NetFDCommon);
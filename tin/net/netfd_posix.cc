@@ -2,7 +2,27 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include "build/build_config.h"
+
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#if defined(OS_LINUX)
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include "base/logging.h"
 #include "base/bind.h"
@@ -13,8 +33,11 @@
 
 #include "tin/error/error.h"
 #include "tin/runtime/env.h"
+#include "tin/runtime/runtime.h"
 #include "tin/runtime/posix_util.h"
+#include "tin/runtime/net/netpoll.h"
 #include "tin/runtime/net/pollops.h"
+#include "tin/runtime/net/poll_descriptor.h"
 #include "tin/net/net.h"
 #include "tin/net/sockaddr_storage.h"
 #include "tin/net/ip_address.h"
@@ -22,174 +45,1222 @@
 
 #include "tin/net/netfd_posix.h"
 
+#if defined(OS_LINUX)
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#endif
+
+#if defined(OS_LINUX)
+// older headers lack the UDP offload options.
+#if !defined(SOL_UDP)
+#define SOL_UDP 17
+#endif
+#if !defined(UDP_SEGMENT)
+#define UDP_SEGMENT 103
+#endif
+#if !defined(UDP_GRO)
+#define UDP_GRO 104
+#endif
+#endif
+
 namespace tin {
 namespace net {
 
-NetFD::NetFD(uintptr_t sysfd,
-             AddressFamily family,
-             int sotype,
-             const std::string& net)
-  : NetFDCommon(sysfd, family, sotype, net) {
+NetFD::NetFD(uintptr_t sysfd,
+             AddressFamily family,
+             int sotype,
+             const std::string& net)
+  : NetFDCommon(sysfd, family, sotype, net)
+  , zc_mode_(0)
+  , zc_seq_(0) {
+}
+
+NetFD::~NetFD() {
+  Close();
+}
+
+int NetFD::Init() {
+#if defined(OS_LINUX) && defined(SO_BUSY_POLL)
+  int busy_poll_us = tin::runtime::rtm_conf->SocketBusyPollUs();
+  if (busy_poll_us > 0 &&
+      setsockopt(IntFd(), SOL_SOCKET, SO_BUSY_POLL,
+                 &busy_poll_us, sizeof(busy_poll_us))) {
+    // raising it above net.core.busy_read needs CAP_NET_ADMIN.
+    VLOG(1) << "SO_BUSY_POLL failed due to " << strerror(errno);
+  }
+#endif
+  return pd_.Init(sysfd_);
+}
+
+#if defined(OS_LINUX)
+int NetFD::WaitUring(tin::runtime::UringOp* op) {
+  int err = 0;
+  // woken up by readiness events of the poller too.
+  while (!op->Done()) {
+    err = pd_.Wait(op->mode);
+    if (err != 0) {
+      break;
+    }
+  }
+  if (err != 0) {
+    // the kernel may still touch the buffer, wait for the cancellation.
+    tin::runtime::UringCancel(op);
+    while (!op->Done()) {
+      pd_.WaitCanceled(op->mode);
+    }
+    if (op->res != -ECANCELED) {
+      // completed before the cancel.
+      err = 0;
+    }
+  }
+  return err;
+}
+
+int NetFD::UringRead(void* buf, int len, int* nread) {
+  rop_.pd = pd_.Desc();
+  rop_.mode = 'r';
+  tin::runtime::UringRecv(IntFd(), buf, len, &rop_);
+  TIN_NET_STAT(stats_, read_calls, 1);
+  int err = WaitUring(&rop_);
+  int n = 0;
+  if (err == 0) {
+    if (rop_.res < 0) {
+      err = -rop_.res;
+    } else {
+      n = rop_.res;
+    }
+  }
+  err = EofError(n, err);
+  if (!err)
+    *nread = n;
+  TIN_NET_STAT(stats_, bytes_read, n);
+  return err;
+}
+
+int NetFD::UringWrite(const void* buf, int len, int* nwritten) {
+  const char* ptr = static_cast<const char*>(buf);
+  int nn = 0;
+  int err = 0;
+  wop_.pd = pd_.Desc();
+  wop_.mode = 'w';
+  while (nn < len) {
+    tin::runtime::UringSend(IntFd(), ptr + nn, len - nn, &wop_);
+    TIN_NET_STAT(stats_, write_calls, 1);
+    err = WaitUring(&wop_);
+    if (err != 0) {
+      break;
+    }
+    if (wop_.res < 0) {
+      err = -wop_.res;
+      break;
+    }
+    if (wop_.res == 0) {
+      err = TIN_UNEXPECTED_EOF;
+      break;
+    }
+    nn += wop_.res;
+    TIN_NET_STAT(stats_, bytes_written, wop_.res);
+  }
+  *nwritten = nn;
+  return err;
+}
+
+int NetFD::UringAccept(int* fd) {
+  rop_.pd = pd_.Desc();
+  rop_.mode = 'r';
+  while (true) {
+    tin::runtime::UringAccept(IntFd(), &rop_);
+    int err = WaitUring(&rop_);
+    if (err != 0) {
+      return err;
+    }
+    if (rop_.res == -ECONNABORTED) {
+      continue;
+    }
+    if (rop_.res < 0) {
+      return -rop_.res;
+    }
+    *fd = rop_.res;
+    return 0;
+  }
+}
+#endif
+
+int NetFD::Read(void* buf, int len, int* nread) {
+  TouchIdle();
+  int err = ReadLock();
+  if (err != 0) {
+    *nread = 0;
+    return err;
+  }
+  bool eof = false;
+  err = BeginRead(&eof);
+  if (err != 0 || eof) {
+    ReadUnlock();
+    *nread = 0;
+    return err;
+  }
+  tin::runtime::PollDescriptor* pd = pd_.Desc();
+#if defined(OS_LINUX)
+  if (tin::runtime::UringEnabled()) {
+    err = UringRead(buf, len, nread);
+    ReadUnlock();
+    MaybeYield();
+    return err;
+  }
+#endif
+  while (true) {
+    // non-blocking read should never set EINTR,
+    // however, it's harmless to deal with it.
+    int n = HANDLE_EINTR(read(IntFd(), buf, len));
+    err = (n == -1) ? errno : 0;
+    TIN_NET_STAT(stats_, read_calls, 1);
+    if (err != 0) {
+      n = 0;
+      if (err == EAGAIN) {
+        err = WaitRead();
+        if (err == 0) {
+          continue;
+        }
+      }
+    }
+    pd->eof_seen = err == 0 && n == 0 && len > 0;
+    err = EofError(n, err);
+    if (!err)
+      *nread = n;
+    TIN_NET_STAT(stats_, bytes_read, n);
+    pd->drained = err == 0 && n < len;
+    break;
+  }
+  ReadUnlock();
+  MaybeYield();
+  return err;
+}
+
+int NetFD::WaitRead() {
+#if defined(TIN_NET_STATS)
+  if (stats_ != NULL) {
+    int64 start = MonoNow();
+    int err = pd_.WaitRead();
+    TIN_NET_STAT(stats_, read_parks, 1);
+    TIN_NET_STAT(stats_, read_park_ns, MonoNow() - start);
+    if (err == TIN_ETIMEOUT_INTR)
+      TIN_NET_STAT(stats_, read_timeouts, 1);
+    return err;
+  }
+#endif
+  return pd_.WaitRead();
+}
+
+int NetFD::WaitWrite() {
+#if defined(TIN_NET_STATS)
+  if (stats_ != NULL) {
+    int64 start = MonoNow();
+    int err = pd_.WaitWrite();
+    TIN_NET_STAT(stats_, write_parks, 1);
+    TIN_NET_STAT(stats_, write_park_ns, MonoNow() - start);
+    if (err == TIN_ETIMEOUT_INTR)
+      TIN_NET_STAT(stats_, write_timeouts, 1);
+    return err;
+  }
+#endif
+  return pd_.WaitWrite();
+}
+
+int NetFD::BeginRead(bool* eof) {
+  tin::runtime::PollDescriptor* pd = pd_.Desc();
+  if (pd->eof_seen) {
+    // a read returned 0 already, no need to ask the kernel again.
+    *eof = true;
+    return EofError(0, 0);
+  }
+  if (pd->drained && atomic::acquire_load32(&pd->rdhup) == 0) {
+    // the socket buffer was empty, a read would just say EAGAIN. keep the
+    // ready state the poller may have set since, it is the only edge.
+    return WaitRead();
+  }
+  // after rdhup the last bytes may have come with the FIN, read them.
+  return pd_.PrepareRead();
+}
+
+int NetFD::ReadPooled(tin::io::IOBufChain* chain, int max, int* nread) {
+  TouchIdle();
+  *nread = 0;
+  int err = ReadLock();
+  if (err != 0) {
+    return err;
+  }
+  bool eof = false;
+  err = BeginRead(&eof);
+  if (err != 0 || eof) {
+    ReadUnlock();
+    return err;
+  }
+  tin::runtime::PollDescriptor* pd = pd_.Desc();
+  while (true) {
+    // a per-P pool hit is cheap enough to give the buffer back on EAGAIN
+    // instead of probing the socket first.
+    char* ptr = NULL;
+    int len = 0;
+    chain->GetWritableTail(1, &ptr, &len);
+    len = std::min(len, max);
+    int n = HANDLE_EINTR(read(IntFd(), ptr, len));
+    err = (n == -1) ? errno : 0;
+    TIN_NET_STAT(stats_, read_calls, 1);
+    if (err != 0) {
+      n = 0;
+      chain->CommitTail(0);
+      if (err == EAGAIN) {
+        err = WaitRead();
+        if (err == 0) {
+          continue;
+        }
+      }
+    } else {
+      chain->CommitTail(n);
+    }
+    pd->eof_seen = err == 0 && n == 0 && len > 0;
+    err = EofError(n, err);
+    if (!err)
+      *nread = n;
+    TIN_NET_STAT(stats_, bytes_read, n);
+    pd->drained = err == 0 && n < len;
+    break;
+  }
+  ReadUnlock();
+  MaybeYield();
+  return err;
+}
+
+int NetFD::Readv(const tin::io::IOVec* iov, int iovcnt, int* nread) {
+  TouchIdle();
+  *nread = 0;
+  if (iovcnt <= 0 || iovcnt > kMaxIOVecs) {
+    return EINVAL;
+  }
+  struct iovec vec[kMaxIOVecs];
+  int total = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    vec[i].iov_base = iov[i].base;
+    vec[i].iov_len = iov[i].len;
+    total += iov[i].len;
+  }
+  int err = ReadLock();
+  if (err != 0) {
+    return err;
+  }
+  bool eof = false;
+  err = BeginRead(&eof);
+  if (err != 0 || eof) {
+    ReadUnlock();
+    return err;
+  }
+  tin::runtime::PollDescriptor* pd = pd_.Desc();
+  while (true) {
+    int n = HANDLE_EINTR(readv(IntFd(), vec, iovcnt));
+    err = (n == -1) ? errno : 0;
+    TIN_NET_STAT(stats_, read_calls, 1);
+    if (err != 0) {
+      n = 0;
+      if (err == EAGAIN) {
+        err = WaitRead();
+        if (err == 0) {
+          continue;
+        }
+      }
+    }
+    pd->eof_seen = err == 0 && n == 0 && total > 0;
+    err = EofError(n, err);
+    if (!err)
+      *nread = n;
+    TIN_NET_STAT(stats_, bytes_read, n);
+    pd->drained = err == 0 && n < total;
+    break;
+  }
+  ReadUnlock();
+  MaybeYield();
+  return err;
+}
+
+int NetFD::Writev(const tin::io::IOVec* iov, int iovcnt, int* nwritten) {
+  TouchIdle();
+  *nwritten = 0;
+  if (iovcnt <= 0 || iovcnt > kMaxIOVecs) {
+    return EINVAL;
+  }
+  struct iovec vec[kMaxIOVecs];
+  int total = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    vec[i].iov_base = iov[i].base;
+    vec[i].iov_len = iov[i].len;
+    total += iov[i].len;
+  }
+  int err = WriteLock();
+  if (err != 0) {
+    return err;
+  }
+  err = pd_.PrepareWrite();
+  if (err != 0) {
+    WriteUnlock();
+    return err;
+  }
+  struct iovec* cur = vec;
+  int left = iovcnt;
+  int nn = 0;
+  while (nn < total) {
+    int n = HANDLE_EINTR(writev(IntFd(), cur, left));
+    err = (n == -1) ? errno : 0;
+    TIN_NET_STAT(stats_, write_calls, 1);
+    if (n > 0) {
+      TIN_NET_STAT(stats_, bytes_written, n);
+      nn += n;
+      // drop the segments written in full and trim the partial one.
+      while (left > 0 && static_cast<size_t>(n) >= cur->iov_len) {
+        n -= cur->iov_len;
+        ++cur;
+        --left;
+      }
+      if (left > 0) {
+        cur->iov_base = static_cast<char*>(cur->iov_base) + n;
+        cur->iov_len -= n;
+      }
+      continue;
+    }
+    if (err == EAGAIN) {
+      err = WaitWrite();
+      if (err == 0) {
+        continue;
+      }
+    }
+    if (err != 0)
+      break;
+    err = TIN_UNEXPECTED_EOF;
+    break;
+  }
+  WriteUnlock();
+  *nwritten = nn;
+  MaybeYield();
+  return err;
+}
+
+int NetFD::SendFile(tin::file_t file, int64 offset, int64 len,
+                    int64* nsent) {
+  *nsent = 0;
+  if (offset < 0 || len < 0) {
+    return EINVAL;
+  }
+  int err = WriteLock();
+  if (err != 0) {
+    return err;
+  }
+  err = pd_.PrepareWrite();
+  if (err != 0) {
+    WriteUnlock();
+    return err;
+  }
+  int64 nn = 0;
+  while (nn < len) {
+    // linux caps a single call just below 2G anyway.
+    int64 chunk = std::min<int64>(len - nn, 1 << 30);
+    int64 n = 0;
+#if defined(OS_LINUX)
+    off_t off = static_cast<off_t>(offset + nn);
+    ssize_t r = HANDLE_EINTR(sendfile(IntFd(), file, &off, chunk));
+    err = (r == -1) ? errno : 0;
+    n = r > 0 ? r : 0;
+#elif defined(OS_MACOSX)
+    off_t sbytes = static_cast<off_t>(chunk);
+    int r = sendfile(file, IntFd(), offset + nn, &sbytes, NULL, 0);
+    err = (r == -1) ? errno : 0;
+    n = sbytes;
+    if (err == EINTR)
+      err = n > 0 ? 0 : EINTR;
+#else
+    off_t sbytes = 0;
+    int r = sendfile(file, IntFd(), offset + nn, chunk, NULL, &sbytes, 0);
+    err = (r == -1) ? errno : 0;
+    n = sbytes;
+    if (err == EINTR)
+      err = n > 0 ? 0 : EINTR;
+#endif
+    // darwin and bsd report partial progress together with EAGAIN.
+    nn += n;
+    if (err == EINTR) {
+      continue;
+    }
+    if (err == EAGAIN) {
+      err = WaitWrite();
+      if (err == 0) {
+        continue;
+      }
+    }
+    if (err != 0)
+      break;
+    if (n == 0) {
+      // the file is shorter than asked for.
+      err = TIN_UNEXPECTED_EOF;
+      break;
+    }
+  }
+  WriteUnlock();
+  *nsent = nn;
+  MaybeYield();
+  return err;
+}
+
+int NetFD::WriteZeroCopy(tin::RefCountedIOBuffer* data, int* nwritten) {
+  const char* ptr = data->buffer()->begin();
+  int len = data->buffer()->buffered();
+#if defined(OS_LINUX)
+  // below this, pinning pages and reaping completions costs more than
+  // the copy it saves.
+  const int kZeroCopyMinBytes = 16 * 1024;
+  if (len < kZeroCopyMinBytes || !EnableZeroCopy()) {
+    return Write(ptr, len, nwritten);
+  }
+  int err = WriteLock();
+  if (err != 0) {
+    *nwritten = 0;
+    return err;
+  }
+  err = pd_.PrepareWrite();
+  if (err != 0) {
+    WriteUnlock();
+    *nwritten = 0;
+    return err;
+  }
+  ReleaseZeroCopy();
+  uint32 seq = zc_seq_;
+  int flags = MSG_ZEROCOPY;
+  int nn = 0;
+  while (nn < len) {
+    int n = HANDLE_EINTR(send(IntFd(), ptr + nn, len - nn, flags));
+    err = (n == -1) ? errno : 0;
+    if (n >= 0 && (flags & MSG_ZEROCOPY) != 0) {
+      zc_seq_++;
+    }
+    if (n > 0) {
+      nn += n;
+      continue;
+    }
+    if (err == ENOBUFS && (flags & MSG_ZEROCOPY) != 0) {
+      // out of optmem for notifications, copy the rest.
+      flags = 0;
+      continue;
+    }
+    if (err == EAGAIN) {
+      err = WaitWrite();
+      if (err == 0) {
+        continue;
+      }
+    }
+    if (err != 0)
+      break;
+    err = TIN_UNEXPECTED_EOF;
+    break;
+  }
+  if (zc_seq_ != seq) {
+    ZeroCopyPin pin;
+    pin.seq_end = zc_seq_;
+    pin.data = data;
+    zc_pinned_.push_back(pin);
+  }
+  WriteUnlock();
+  *nwritten = nn;
+  MaybeYield();
+  return err;
+#else
+  return Write(ptr, len, nwritten);
+#endif
+}
+
+#if defined(OS_LINUX)
+bool NetFD::EnableZeroCopy() {
+  if (zc_mode_ == 0) {
+    int on = 1;
+    zc_mode_ = SetSockOpt(SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0 ?
+      1 : -1;
+    if (zc_mode_ == 1) {
+      atomic::release_store32(&pd_.Desc()->zerocopy, 1);
+    }
+  }
+  return zc_mode_ == 1;
+}
+
+void NetFD::ReleaseZeroCopy() {
+  uint32 done = atomic::acquire_load32(&pd_.Desc()->zc_done);
+  while (!zc_pinned_.empty() &&
+         static_cast<int32>(done - zc_pinned_.front().seq_end) >= 0) {
+    zc_pinned_.pop_front();
+  }
+}
+#endif
+
+#if defined(OS_LINUX)
+int NetFD::SpliceFrom(NetFD* src, int64* nspliced) {
+  *nspliced = 0;
+  int p[2];
+  if (pipe2(p, O_NONBLOCK | O_CLOEXEC) == -1) {
+    return errno;
+  }
+  const size_t kSpliceChunk = 64 * 1024;
+  const unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+  int err = src->ReadLock();
+  if (err != 0) {
+    close(p[0]);
+    close(p[1]);
+    return err;
+  }
+  err = WriteLock();
+  if (err != 0) {
+    src->ReadUnlock();
+    close(p[0]);
+    close(p[1]);
+    return err;
+  }
+  err = src->pd_.PrepareRead();
+  if (err == 0) {
+    err = pd_.PrepareWrite();
+  }
+  int64 total = 0;
+  // bytes sitting in the pipe.
+  int64 inpipe = 0;
+  bool eof = false;
+  while (err == 0 && (!eof || inpipe > 0)) {
+    if (!eof && inpipe == 0) {
+      ssize_t n = HANDLE_EINTR(splice(src->IntFd(), NULL, p[1], NULL,
+                                      kSpliceChunk, flags));
+      if (n > 0) {
+        inpipe += n;
+      } else if (n == 0) {
+        eof = true;
+      } else if (errno == EAGAIN) {
+        err = src->WaitRead();
+      } else {
+        err = errno;
+      }
+      continue;
+    }
+    ssize_t n = HANDLE_EINTR(splice(p[0], NULL, IntFd(), NULL, inpipe,
+                                    flags));
+    if (n > 0) {
+      inpipe -= n;
+      total += n;
+    } else if (n == -1 && errno == EAGAIN) {
+      err = WaitWrite();
+    } else {
+      err = n == 0 ? TIN_UNEXPECTED_EOF : errno;
+    }
+  }
+  // src may have buffered data we did not see an edge for, let its next
+  // read ask the kernel.
+  src->pd_.Desc()->drained = false;
+  WriteUnlock();
+  src->ReadUnlock();
+  close(p[0]);
+  close(p[1]);
+  *nspliced = total;
+  MaybeYield();
+  return err;
+}
+#endif
+
+int NetFD::Write(const void* buf, int len, int* nwritten) {
+  TouchIdle();
+  int err = WriteLock();
+  if (err != 0) {
+    *nwritten = 0;
+    return err;
+  }
+  err = pd_.PrepareWrite();
+  if (err != 0) {
+    WriteLock();
+    *nwritten = 0;
+    return err;
+  }
+#if defined(OS_LINUX)
+  if (tin::runtime::UringEnabled()) {
+    err = UringWrite(buf, len, nwritten);
+    WriteUnlock();
+    MaybeYield();
+    return err;
+  }
+#endif
+  const char* ptr = static_cast<const char*>(buf);
+  int nn = 0;
+  while (true) {
+    int n = HANDLE_EINTR(write(IntFd(), ptr + nn, len - nn));
+    err = (n == -1) ? errno : 0;
+    TIN_NET_STAT(stats_, write_calls, 1);
+    if (n > 0) {
+      TIN_NET_STAT(stats_, bytes_written, n);
+      nn += n;
+    }
+    if (nn == len) {
+      break;
+    }
+
+    if (err == EAGAIN) {
+      err = WaitWrite();
+      // waked up, io ready or error occurred(timeout intr, close intr, etc).
+      if (err == 0) {
+        continue;
+      }
+    }
+    if (err != 0)
+      break;
+    if (n == 0) {
+      err = TIN_UNEXPECTED_EOF;
+      break;
+    }
+  }
+  WriteUnlock();
+  *nwritten = nn;
+  MaybeYield();
+  return err;
+}
+
+void NetFD::Destroy() {
+  if (sysfd_ == kInvalidSocket)
+    return;
+  pd_.Close();
+  close(IntFd());
+  sysfd_ = kInvalidSocket;
+#if defined(OS_LINUX)
+  // the kernel holds its own page references past close, the pins only
+  // kept the buffers from being reused while the sends were queued.
+  zc_pinned_.clear();
+#endif
+}
+
+int NetFD::Shutdown(int how) {
+  int err = Incref();
+  if (err != 0) {
+    return err;
+  }
+  err = (shutdown(IntFd(), how)) == -1 ? errno : 0;
+  Decref();
+  return err;
+}
+
+int NetFD::CloseRead() {
+  return Shutdown(SHUT_RD);
+}
+
+int NetFD::CloseWrite() {
+  return Shutdown(SHUT_WR);
+}
+
+int NetFD::Dial(IPEndPoint* local, IPEndPoint* remote, int64 deadline) {
+  int err = 0;
+  SockaddrStorage lstorage;
+  if (local != NULL) {
+    if (local->GetFamily() != family_) {
+      return EINVAL;
+    }
+    if (!local->ToSockAddr(lstorage.addr, &lstorage.addr_len)) {
+      return EINVAL;
+    }
+
+    if (::bind(sysfd_, lstorage.addr, lstorage.addr_len) != 0) {
+      return errno;
+    }
+  }
+
+  SockaddrStorage rstorage;
+  if (remote != NULL) {
+    if (remote->GetFamily() != family_) {
+      return EINVAL;
+    }
+    if (!remote->ToSockAddr(rstorage.addr, &rstorage.addr_len)) {
+      return EINVAL;
+    }
+    err = Connect(local == NULL ? NULL : &lstorage, &rstorage, deadline);
+    if (err != 0) {
+      return err;
+    }
+    is_connected_ = true;
+  } else {
+    err = Init();
+    if (err != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+int NetFD::Bind(const IPEndPoint& address) {
+  int err = 0;
+  SockaddrStorage storage;
+  if (address.ToSockAddr(storage.addr, &storage.addr_len)) {
+    err = bind(sysfd_, storage.addr, storage.addr_len) == -1 ? errno : 0;
+    return err;
+  }
+  return EINVAL;
+}
+
+int NetFD::ReadFrom(void* buf, int len, int* nread, IPEndPoint* from) {
+  *nread = 0;
+  int err = ReadLock();
+  if (err != 0) {
+    return err;
+  }
+  err = pd_.PrepareRead();
+  if (err != 0) {
+    ReadUnlock();
+    return err;
+  }
+  SockaddrStorage storage;
+  while (true) {
+    storage.addr_len = sizeof(storage.addr_storage);
+    int n = HANDLE_EINTR(recvfrom(IntFd(), buf, len, 0, storage.addr,
+                                  &storage.addr_len));
+    err = (n == -1) ? errno : 0;
+    if (err == EAGAIN) {
+      err = WaitRead();
+      if (err == 0) {
+        continue;
+      }
+    }
+    if (err == 0) {
+      *nread = n;
+      if (from != NULL && !from->FromSockAddr(storage.addr,
+                                              storage.addr_len)) {
+        *from = IPEndPoint();
+      }
+    }
+    break;
+  }
+  ReadUnlock();
+  MaybeYield();
+  return err;
+}
+
+int NetFD::WriteTo(const void* buf, int len, const IPEndPoint& to,
+                   int* nwritten) {
+  *nwritten = 0;
+  SockaddrStorage storage;
+  if (!to.ToSockAddr(storage.addr, &storage.addr_len)) {
+    return EINVAL;
+  }
+  int err = WriteLock();
+  if (err != 0) {
+    return err;
+  }
+  err = pd_.PrepareWrite();
+  if (err != 0) {
+    WriteUnlock();
+    return err;
+  }
+  while (true) {
+    int n = HANDLE_EINTR(sendto(IntFd(), buf, len, 0, storage.addr,
+                                storage.addr_len));
+    err = (n == -1) ? errno : 0;
+    if (err == EAGAIN) {
+      err = WaitWrite();
+      if (err == 0) {
+        continue;
+      }
+    }
+    if (err == 0) {
+      *nwritten = n;
+    }
+    break;
+  }
+  WriteUnlock();
+  MaybeYield();
+  return err;
+}
+
+#if defined(OS_LINUX)
+int NetFD::RecvMsgsOnce(UdpMessage* msgs, int n) {
+  struct mmsghdr hdrs[kMaxUdpBatch];
+  struct iovec iovs[kMaxUdpBatch];
+  SockaddrStorage addrs[kMaxUdpBatch];
+  char control[kMaxUdpBatch][CMSG_SPACE(sizeof(int))];
+  memset(hdrs, 0, sizeof(hdrs[0]) * n);
+  for (int i = 0; i < n; ++i) {
+    iovs[i].iov_base = msgs[i].buf;
+    iovs[i].iov_len = msgs[i].len;
+    struct msghdr* hdr = &hdrs[i].msg_hdr;
+    hdr->msg_name = addrs[i].addr;
+    hdr->msg_namelen = sizeof(addrs[i].addr_storage);
+    hdr->msg_iov = &iovs[i];
+    hdr->msg_iovlen = 1;
+    hdr->msg_control = control[i];
+    hdr->msg_controllen = sizeof(control[i]);
+  }
+  int got = HANDLE_EINTR(recvmmsg(IntFd(), hdrs, n, 0, NULL));
+  for (int i = 0; i < got; ++i) {
+    struct msghdr* hdr = &hdrs[i].msg_hdr;
+    msgs[i].n = hdrs[i].msg_len;
+    msgs[i].segment_size = 0;
+    if (!msgs[i].addr.FromSockAddr(addrs[i].addr, hdr->msg_namelen)) {
+      msgs[i].addr = IPEndPoint();
+    }
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(hdr); cm != NULL;
+         cm = CMSG_NXTHDR(hdr, cm)) {
+      if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+        int size = 0;
+        memcpy(&size, CMSG_DATA(cm), sizeof(size));
+        msgs[i].segment_size = size;
+      }
+    }
+  }
+  return got;
+}
+
+int NetFD::SendMsgsOnce(UdpMessage* msgs, int n) {
+  struct mmsghdr hdrs[kMaxUdpBatch];
+  struct iovec iovs[kMaxUdpBatch];
+  SockaddrStorage addrs[kMaxUdpBatch];
+  char control[kMaxUdpBatch][CMSG_SPACE(sizeof(uint16))];
+  memset(hdrs, 0, sizeof(hdrs[0]) * n);
+  for (int i = 0; i < n; ++i) {
+    iovs[i].iov_base = msgs[i].buf;
+    iovs[i].iov_len = msgs[i].len;
+    struct msghdr* hdr = &hdrs[i].msg_hdr;
+    hdr->msg_iov = &iovs[i];
+    hdr->msg_iovlen = 1;
+    if (!msgs[i].addr.address().empty()) {
+      if (!msgs[i].addr.ToSockAddr(addrs[i].addr, &addrs[i].addr_len)) {
+        errno = EINVAL;
+        return -1;
+      }
+      hdr->msg_name = addrs[i].addr;
+      hdr->msg_namelen = addrs[i].addr_len;
+    }
+    if (msgs[i].segment_size > 0) {
+      // GSO, one buffer leaves as several datagrams.
+      hdr->msg_control = control[i];
+      hdr->msg_controllen = sizeof(control[i]);
+      struct cmsghdr* cm = CMSG_FIRSTHDR(hdr);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16));
+      uint16 size = static_cast<uint16>(msgs[i].segment_size);
+      memcpy(CMSG_DATA(cm), &size, sizeof(size));
+    }
+  }
+  int sent = HANDLE_EINTR(sendmmsg(IntFd(), hdrs, n, 0));
+  for (int i = 0; i < sent; ++i) {
+    msgs[i].n = hdrs[i].msg_len;
+  }
+  return sent;
 }
 
-NetFD::~NetFD() {
-  Close();
+bool NetFD::EnableGro() {
+  int on = 1;
+  return setsockopt(IntFd(), SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+}
+#else
+// no mmsg calls, loop until the socket says EAGAIN.
+int NetFD::RecvMsgsOnce(UdpMessage* msgs, int n) {
+  int got = 0;
+  for (; got < n; ++got) {
+    SockaddrStorage storage;
+    int rv = HANDLE_EINTR(recvfrom(IntFd(), msgs[got].buf, msgs[got].len, 0,
+                                   storage.addr, &storage.addr_len));
+    if (rv == -1)
+      break;
+    msgs[got].n = rv;
+    msgs[got].segment_size = 0;
+    if (!msgs[got].addr.FromSockAddr(storage.addr, storage.addr_len)) {
+      msgs[got].addr = IPEndPoint();
+    }
+  }
+  return got > 0 ? got : -1;
 }
 
-int NetFD::Init() {
-  return pd_.Init(sysfd_);
+// segment_size is done by hand, one sendto per segment.
+int NetFD::SendMsgsOnce(UdpMessage* msgs, int n) {
+  int sent = 0;
+  for (; sent < n; ++sent) {
+    SockaddrStorage storage;
+    struct sockaddr* addr = NULL;
+    socklen_t addr_len = 0;
+    if (!msgs[sent].addr.address().empty()) {
+      if (!msgs[sent].addr.ToSockAddr(storage.addr, &storage.addr_len)) {
+        errno = EINVAL;
+        break;
+      }
+      addr = storage.addr;
+      addr_len = storage.addr_len;
+    }
+    int len = msgs[sent].len;
+    int step = msgs[sent].segment_size > 0 ? msgs[sent].segment_size : len;
+    int done = 0;
+    do {
+      int chunk = std::min(step, len - done);
+      int rv = HANDLE_EINTR(sendto(IntFd(), msgs[sent].buf + done, chunk, 0,
+                                   addr, addr_len));
+      if (rv == -1)
+        break;
+      done += rv;
+    } while (done < len);
+    if (done < len) {
+      if (done == 0)
+        return sent > 0 ? sent : -1;
+      // counted as sent with n < len, the rest is not resent. the batch
+      // stops here so the later messages don't overtake it.
+      msgs[sent].n = done;
+      return sent + 1;
+    }
+    msgs[sent].n = done;
+  }
+  return sent > 0 ? sent : -1;
 }
 
-int NetFD::Read(void* buf, int len, int* nread) {
+bool NetFD::EnableGro() {
+  return false;
+}
+#endif
+
+int NetFD::ReadMsgs(UdpMessage* msgs, int n, int* nmsgs) {
+  *nmsgs = 0;
+  if (n <= 0) {
+    return 0;
+  }
+  n = std::min(n, kMaxUdpBatch);
   int err = ReadLock();
   if (err != 0) {
-    *nread = 0;
     return err;
   }
   err = pd_.PrepareRead();
   if (err != 0) {
     ReadUnlock();
-    *nread = 0;
     return err;
   }
   while (true) {
-    // non-blocking read should never set EINTR,
-    // however, it's harmless to deal with it.
-    int n = HANDLE_EINTR(read(IntFd(), buf, len));
-    err = (n == -1) ? errno : 0;
-    if (err != 0) {
-      n = 0;
-      if (err == EAGAIN) {
-        err = pd_.WaitRead();
-        if (err == 0) {
-          continue;
-        }
+    int got = RecvMsgsOnce(msgs, n);
+    err = (got == -1) ? errno : 0;
+    if (err == EAGAIN) {
+      err = WaitRead();
+      if (err == 0) {
+        continue;
       }
     }
-    err = EofError(n, err);
-    if (!err)
-      *nread = n;
+    if (err == 0) {
+      *nmsgs = got;
+    }
     break;
   }
   ReadUnlock();
+  MaybeYield();
   return err;
 }
 
-int NetFD::Write(const void* buf, int len, int* nwritten) {
+int NetFD::WriteMsgs(UdpMessage* msgs, int n, int* nmsgs) {
+  *nmsgs = 0;
   int err = WriteLock();
   if (err != 0) {
-    *nwritten = 0;
     return err;
   }
   err = pd_.PrepareWrite();
   if (err != 0) {
-    WriteLock();
-    *nwritten = 0;
+    WriteUnlock();
     return err;
   }
-  const char* ptr = static_cast<const char*>(buf);
-  int nn = 0;
-  while (true) {
-    int n = HANDLE_EINTR(write(IntFd(), ptr + nn, len - nn));
-    err = (n == -1) ? errno : 0;
-    if (n > 0) {
-      nn += n;
-    }
-    if (nn == len) {
-      break;
-    }
-
+  while (*nmsgs < n) {
+    int batch = std::min(n - *nmsgs, kMaxUdpBatch);
+    int sent = SendMsgsOnce(msgs + *nmsgs, batch);
+    err = (sent == -1) ? errno : 0;
     if (err == EAGAIN) {
-      err = pd_.WaitWrite();
-      // waked up, io ready or error occurred(timeout intr, close intr, etc).
+      err = WaitWrite();
       if (err == 0) {
         continue;
       }
     }
-    if (err != 0)
-      break;
-    if (n == 0) {
-      err = TIN_UNEXPECTED_EOF;
+    if (err != 0) {
       break;
     }
+    *nmsgs += sent;
   }
   WriteUnlock();
-  *nwritten = nn;
+  MaybeYield();
   return err;
 }
 
-void NetFD::Destroy() {
-  if (sysfd_ == kInvalidSocket)
-    return;
-  pd_.Close();
-  close(IntFd());
-  sysfd_ = kInvalidSocket;
-}
+namespace {
 
-int NetFD::Shutdown(int how) {
-  int err = Incref();
-  if (err != 0) {
-    return err;
+bool UnixSockaddr(const base::StringPiece& path, SockaddrStorage* storage) {
+  struct sockaddr_un* addr =
+      reinterpret_cast<struct sockaddr_un*>(storage->addr);
+  if (path.empty() || path.size() >= sizeof(addr->sun_path)) {
+    return false;
   }
-  err = (shutdown(IntFd(), how)) == -1 ? errno : 0;
-  Decref();
-  return err;
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path, path.data(), path.size());
+  socklen_t len = offsetof(struct sockaddr_un, sun_path) + path.size();
+#if defined(OS_LINUX)
+  if (path[0] == '@') {
+    // abstract names are not nul terminated.
+    addr->sun_path[0] = '\0';
+    storage->addr_len = len;
+    return true;
+  }
+#endif
+  storage->addr_len = len + 1;
+  return true;
 }
 
-int NetFD::CloseRead() {
-  return Shutdown(SHUT_RD);
+}  // namespace
+
+int NetFD::BindUnix(const base::StringPiece& path) {
+  SockaddrStorage storage;
+  if (family_ != ADDRESS_FAMILY_UNIX || !UnixSockaddr(path, &storage)) {
+    return EINVAL;
+  }
+  return bind(sysfd_, storage.addr, storage.addr_len) == -1 ? errno : 0;
 }
 
-int NetFD::CloseWrite() {
-  return Shutdown(SHUT_WR);
+int NetFD::DialUnix(const base::StringPiece& path, int64 deadline) {
+  SockaddrStorage storage;
+  if (family_ != ADDRESS_FAMILY_UNIX || !UnixSockaddr(path, &storage)) {
+    return EINVAL;
+  }
+  int err = Connect(NULL, &storage, deadline);
+  if (err != 0) {
+    return err;
+  }
+  is_connected_ = true;
+  return 0;
 }
 
-int NetFD::Dial(IPEndPoint* local, IPEndPoint* remote, int64 deadline) {
-  int err = 0;
-  SockaddrStorage lstorage;
-  if (local != NULL) {
-    if (local->GetFamily() != family_) {
-      return EINVAL;
+int NetFD::WriteFds(const void* buf, int len, const int* fds, int nfds,
+                    int* nwritten) {
+  *nwritten = 0;
+  // stream sockets drop ancillary data sent without payload.
+  if (len <= 0 || nfds < 0 || nfds > kMaxPassedFds) {
+    return EINVAL;
+  }
+  int err = WriteLock();
+  if (err != 0) {
+    return err;
+  }
+  err = pd_.PrepareWrite();
+  if (err != 0) {
+    WriteUnlock();
+    return err;
+  }
+  char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  const char* ptr = static_cast<const char*>(buf);
+  int nn = 0;
+  while (nn < len) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(ptr + nn);
+    iov.iov_len = len - nn;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    // the descriptors go with the first bytes only.
+    if (nn == 0 && nfds > 0) {
+      msg.msg_control = control;
+      msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+      struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+      cm->cmsg_level = SOL_SOCKET;
+      cm->cmsg_type = SCM_RIGHTS;
+      cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+      memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
     }
-    if (!local->ToSockAddr(lstorage.addr, &lstorage.addr_len)) {
-      return EINVAL;
+    int n = HANDLE_EINTR(sendmsg(IntFd(), &msg, 0));
+    err = (n == -1) ? errno : 0;
+    if (n > 0) {
+      nn += n;
+      continue;
     }
-
-    if (::bind(sysfd_, lstorage.addr, lstorage.addr_len) != 0) {
-      return errno;
+    if (err == EAGAIN) {
+      err = WaitWrite();
+      if (err == 0) {
+        continue;
+      }
     }
+    if (err != 0)
+      break;
+    err = TIN_UNEXPECTED_EOF;
+    break;
   }
+  WriteUnlock();
+  *nwritten = nn;
+  MaybeYield();
+  return err;
+}
 
-  SockaddrStorage rstorage;
-  if (remote != NULL) {
-    if (remote->GetFamily() != family_) {
-      return EINVAL;
-    }
-    if (!remote->ToSockAddr(rstorage.addr, &rstorage.addr_len)) {
-      return EINVAL;
+int NetFD::ReadFds(void* buf, int len, int* fds, int maxfds, int* nfds,
+                   int* nread) {
+  *nread = 0;
+  *nfds = 0;
+  int err = ReadLock();
+  if (err != 0) {
+    return err;
+  }
+  err = pd_.PrepareRead();
+  if (err != 0) {
+    ReadUnlock();
+    return err;
+  }
+  // room for the sender limit, so nothing is lost to MSG_CTRUNC.
+  char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  int flags = 0;
+#if defined(OS_LINUX)
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+  while (true) {
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int n = HANDLE_EINTR(recvmsg(IntFd(), &msg, flags));
+    err = (n == -1) ? errno : 0;
+    if (err == EAGAIN) {
+      err = WaitRead();
+      if (err == 0) {
+        continue;
+      }
     }
-    err = Connect(local == NULL ? NULL : &lstorage, &rstorage, deadline);
     if (err != 0) {
-      return err;
+      break;
     }
-    is_connected_ = true;
-  } else {
-    err = Init();
-    if (err != 0) {
-      return err;
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+        continue;
+      int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const char* data = reinterpret_cast<const char*>(CMSG_DATA(cm));
+      for (int i = 0; i < count; ++i) {
+        int fd;
+        memcpy(&fd, data + i * sizeof(int), sizeof(fd));
+        if (*nfds < maxfds) {
+#if !defined(OS_LINUX)
+          Cloexec(fd, true);
+#endif
+          fds[(*nfds)++] = fd;
+        } else {
+          close(fd);
+        }
+      }
     }
+    VLOG_IF(1, (msg.msg_flags & MSG_CTRUNC) != 0)
+        << "ReadFds: descriptors truncated";
+    err = EofError(n, err);
+    if (!err)
+      *nread = n;
+    break;
   }
-  return 0;
-}
-
-int NetFD::Bind(const IPEndPoint& address) {
-  int err = 0;
-  SockaddrStorage storage;
-  if (address.ToSockAddr(storage.addr, &storage.addr_len)) {
-    err = bind(sysfd_, storage.addr, storage.addr_len) == -1 ? errno : 0;
-    return err;
-  }
-  return EINVAL;
+  ReadUnlock();
+  MaybeYield();
+  return err;
 }
 
 int NetFD::Listen(int backlog /*= 511*/) {
@@ -203,12 +1274,20 @@ int NetFD::Accept(NetFD** newfd) {
     return err;
   }
   int fd = -1;
-  while (true) {
+#if defined(OS_LINUX)
+  if (tin::runtime::UringEnabled()) {
+    err = UringAccept(&fd);
+    if (err != 0) {
+      return err;
+    }
+  }
+#endif
+  while (fd == -1) {
     fd = tin::Accept(IntFd(), NULL, NULL);
     err = fd == -1 ? errno : 0;
     if (err != 0) {
       if (err  == EAGAIN) {
-        err = pd_.WaitRead();
+        err = WaitRead();
         if (err == 0) {
           continue;
         }
@@ -228,6 +1307,34 @@ int NetFD::Accept(NetFD** newfd) {
   return 0;
 }
 
+int NetFD::AcceptBatch(NetFD** newfds, int max, int* naccepted) {
+  *naccepted = 0;
+  if (max <= 0) {
+    return EINVAL;
+  }
+  int err = Accept(&newfds[0]);
+  if (err != 0) {
+    return err;
+  }
+  int n = 1;
+  while (n < max) {
+    int fd = tin::Accept(IntFd(), NULL, NULL);
+    if (fd == -1) {
+      if (errno == ECONNABORTED) {
+        continue;
+      }
+      // EAGAIN or a hard error, either way the next call will see it.
+      break;
+    }
+    scoped_ptr<NetFD> netfd(new NetFD(fd, family_, sotype_, net_));
+    if (netfd->Init() != 0) {
+      continue;
+    }
+    newfds[n++] = netfd.release();
+  }
+  *naccepted = n;
+  return 0;
+}
 
 int NetFD::AcceptImpl(NetFD** newfd) {
   int err = ReadLock();
@@ -251,6 +1358,75 @@ int NetFD::SetSockOpt(int level, int name, const void* optval,
   return err == -1 ? errno : 0;
 }
 
+int NetFD::GetTcpInfo(TcpInfo* info) {
+  memset(info, 0, sizeof(*info));
+#if defined(OS_LINUX) && defined(TCP_INFO)
+  struct tcp_info ti;
+  socklen_t len = sizeof(ti);
+  memset(&ti, 0, sizeof(ti));
+  if (getsockopt(IntFd(), IPPROTO_TCP, TCP_INFO, &ti, &len) == -1)
+    return errno;
+  info->rtt_us = ti.tcpi_rtt;
+  info->rtt_var_us = ti.tcpi_rttvar;
+  info->snd_cwnd = ti.tcpi_snd_cwnd;
+  info->snd_mss = ti.tcpi_snd_mss;
+  info->total_retrans = ti.tcpi_total_retrans;
+  info->unacked = ti.tcpi_unacked;
+  int outq = 0;
+  if (ioctl(IntFd(), TIOCOUTQ, &outq) == 0)
+    info->send_queue = outq;
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+#if defined(OS_LINUX)
+bool NetFD::EnableFastOpenConnect() {
+#if defined(TCP_FASTOPEN_CONNECT)
+  int on = 1;
+  return setsockopt(IntFd(), IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on,
+                    sizeof(on)) == 0;
+#else
+  return false;
+#endif
+}
+
+int NetFD::FastOpenWrite(const void* buf, int len, int* nwritten) {
+  // without a cookie for the peer the SYN leaves alone, and writing
+  // before the handshake completes says EINPROGRESS.
+  while (true) {
+    int err = Write(buf, len, nwritten);
+    if (err != EINPROGRESS || *nwritten != 0)
+      return err;
+    err = WaitWrite();
+    if (err != 0)
+      return err;
+  }
+}
+#endif
+
+bool NetFD::IdleCheck() {
+  if (sysfd_ == kInvalidSocket)
+    return false;
+  tin::runtime::PollDescriptor* pd = pd_.Desc();
+  if (pd == NULL || pd->eof_seen)
+    return false;
+#if defined(OS_LINUX)
+  // nobody writes a parked connection, let go of the sends the poller
+  // has seen completed since the last write.
+  ReleaseZeroCopy();
+#endif
+  // no edge since the socket was read empty, nothing came in. after rdhup
+  // the peek below tells data from the FIN.
+  if (pd->drained && atomic::acquire_load32(&pd->rdhup) == 0 &&
+      atomic::relaxed_load(&pd->rg) != tin::runtime::kPdReady)
+    return true;
+  char c;
+  int n = HANDLE_EINTR(recv(IntFd(), &c, 1, MSG_PEEK | MSG_DONTWAIT));
+  return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
 int NetFD::SetTCPKeepAlive(bool enable, int sec) {
   int on = enable ? 1 : 0;
   if (setsockopt(IntFd(), SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)))
@@ -308,7 +1484,7 @@ int NetFD::Connect(SockaddrStorage* laddr, SockaddrStorage* raddr,
     SetWriteDeadline(deadline);
 
   while (true) {
-    err = pd_.WaitWrite();
+    err = WaitWrite();
     if (err != 0) {
       break;
     }
@@ -373,5 +1549,54 @@ NetFD* NewFD(AddressFamily family, int sotype, int* error_code) {
   return new NetFD(sysfd, family, sotype, "unused");
 }
 
+NetFD* NewFDFromSysFd(int fd, int* error_code) {
+  int err = 0;
+  int sotype = 0;
+  socklen_t optlen = sizeof(sotype);
+  SockaddrStorage storage;
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &sotype, &optlen) == -1 ||
+      getsockname(fd, storage.addr, &storage.addr_len) == -1) {
+    err = errno;
+  }
+  AddressFamily family = ADDRESS_FAMILY_UNSPECIFIED;
+  if (err == 0) {
+    switch (storage.addr_storage.ss_family) {
+    case AF_INET:
+      family = ADDRESS_FAMILY_IPV4;
+      break;
+    case AF_INET6:
+      family = ADDRESS_FAMILY_IPV6;
+      break;
+    case AF_UNIX:
+      family = ADDRESS_FAMILY_UNIX;
+      break;
+    default:
+      err = EAFNOSUPPORT;
+    }
+  }
+  if (err == 0) {
+    err = (Cloexec(fd, true) == -1) ? errno : 0;
+    if (err == 0) {
+      err = (Nonblock(fd, true) == -1) ? errno : 0;
+    }
+  }
+  if (err != 0) {
+    VLOG(1) << "NewFDFromSysFd failed due to " << strerror(err);
+    close(fd);
+    if (error_code != NULL)
+      *error_code = err;
+    return NULL;
+  }
+  scoped_ptr<NetFD> netfd(new NetFD(fd, family, sotype, "unused"));
+  err = netfd->Init();
+  if (err != 0) {
+    // closes fd.
+    if (error_code != NULL)
+      *error_code = err;
+    return NULL;
+  }
+  return netfd.release();
+}
+
 }  // namespace net
 }  // namespace tin
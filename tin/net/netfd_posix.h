@@ -3,13 +3,20 @@
 // found in the LICENSE file.
 
 #pragma once
+#include <deque>
 #include <string>
+#include "base/memory/ref_counted.h"
 #include "base/strings/string_piece.h"
+#include "tin/io/io.h"
+#include "tin/io/ioutil.h"
+#include "tin/io/io_buffer.h"
+#include "tin/io/iobuf_chain.h"
 #include "tin/net/fd_mutex.h"
 #include "tin/net/poll_desc.h"
 #include "tin/net/address_list.h"
 #include "tin/net/ip_endpoint.h"
 #include "tin/net/sockaddr_storage.h"
+#include "tin/runtime/net/uring.h"
 #include "tin/net/netfd_common.h"
 
 namespace tin {
@@ -30,6 +37,40 @@ class NetFD : public NetFDCommon {
 
   int Write(const void* buf, int len, int* nwritten);
 
+  // waits for data before taking a buffer from the pool, so an idle
+  // reader holds no memory. appends up to max bytes to chain.
+  int ReadPooled(tin::io::IOBufChain* chain, int max, int* nread);
+
+  // scatter read, returns as soon as anything was read like Read.
+  int Readv(const tin::io::IOVec* iov, int iovcnt, int* nread);
+
+  // gather write, retries partial writes like Write until every
+  // segment is out or an error occurs.
+  int Writev(const tin::io::IOVec* iov, int iovcnt, int* nwritten);
+
+  // sends len bytes of file starting at offset without copying through
+  // user space, parks on a full socket buffer like Write.
+  int SendFile(tin::file_t file, int64 offset, int64 len, int64* nsent);
+
+  // like Write on the readable bytes of data, but lets the kernel send
+  // straight from its pages on linux. data is kept alive until the kernel
+  // reports it done. small writes and other platforms take the plain
+  // Write path.
+  int WriteZeroCopy(tin::RefCountedIOBuffer* data, int* nwritten);
+
+#if defined(OS_LINUX)
+  // moves everything src reads up to EOF into this socket with splice(2)
+  // through a private pipe, parking on either side as needed.
+  int SpliceFrom(NetFD* src, int64* nspliced);
+
+  // TCP_FASTOPEN_CONNECT before Dial, so the first write goes out with
+  // the SYN. false if the kernel does not support it.
+  bool EnableFastOpenConnect();
+  // the first write on a fast open socket, waits for the handshake if
+  // the data could not go with the SYN.
+  int FastOpenWrite(const void* buf, int len, int* nwritten);
+#endif
+
   virtual void Destroy();
 
   int Shutdown(int how);
@@ -42,10 +83,44 @@ class NetFD : public NetFDCommon {
 
   int Bind(const IPEndPoint& address);
 
+  // datagram sockets, park until a datagram arrives or there is room for
+  // one. from may be NULL.
+  int ReadFrom(void* buf, int len, int* nread, IPEndPoint* from);
+  int WriteTo(const void* buf, int len, const IPEndPoint& to,
+              int* nwritten);
+  // receives up to n (at most kMaxUdpBatch) datagrams with one recvmmsg
+  // on linux, parks only if none is queued.
+  int ReadMsgs(UdpMessage* msgs, int n, int* nmsgs);
+  // sends all n datagrams, sendmmsg on linux, parks on a full buffer.
+  int WriteMsgs(UdpMessage* msgs, int n, int* nmsgs);
+  // UDP_GRO, linux 5.0 and up.
+  bool EnableGro();
+
+  // ADDRESS_FAMILY_UNIX sockets. path names a file, or with a leading
+  // '@' a linux abstract socket that needs no cleanup.
+  int BindUnix(const base::StringPiece& path);
+  int DialUnix(const base::StringPiece& path, int64 deadline);
+
+  // stream data with file descriptors attached (SCM_RIGHTS), at most
+  // kMaxPassedFds per call and len must not be 0. fds stay owned by the
+  // caller, the peer gets its own copies.
+  int WriteFds(const void* buf, int len, const int* fds, int nfds,
+               int* nwritten);
+  // reads like Read, descriptors that came with the data are stored in
+  // fds and owned by the caller, those beyond maxfds are closed. a read
+  // stops where descriptors are attached, so a short read says nothing
+  // about the socket buffer and no drained state is kept.
+  int ReadFds(void* buf, int len, int* fds, int maxfds, int* nfds,
+              int* nread);
+
   int Listen(int backlog = 511);
 
   int Accept(NetFD** newfd);
 
+  // blocks for the first connection, then takes whatever else is
+  // already queued without parking again, up to max.
+  int AcceptBatch(NetFD** newfds, int max, int* naccepted);
+
   int EofError(int n, int err);
 
   int GetSockOpt(int level, int name, void* optval,
@@ -56,13 +131,70 @@ class NetFD : public NetFDCommon {
 
   int SetTCPKeepAlive(bool enable, int sec);
 
+  // TCP_INFO of the socket, SIO_TCP_INFO on windows.
+  int GetTcpInfo(TcpInfo* info);
+
+  // for connections kept idle in a pool: false if the peer closed or
+  // sent something meanwhile. answered from the poller state when the
+  // last read drained the socket, else peeks with a non-blocking recv.
+  bool IdleCheck();
+
+  // parks until the socket is readable, or writable if write, for callers
+  // doing their own non-blocking io on SysFd, e.g. OpenSSL with kTLS.
+  // honors the deadlines like Read and Write.
+  int WaitIO(bool write) {
+    return write ? WaitWrite() : WaitRead();
+  }
+
+  // WaitIO without a greenlet, closure is posted once it would return.
+  int WaitIOAsync(bool write, const base::Closure& closure) {
+    return pd_.WaitAsync(write ? 'w' : 'r', closure);
+  }
+
  private:
   int Connect(SockaddrStorage* laddr, SockaddrStorage* raddr, int64 deadline);
   int AcceptImpl(NetFD** newfd);
+  // one non-blocking pass, datagrams done or -1 with errno.
+  int RecvMsgsOnce(UdpMessage* msgs, int n);
+  int SendMsgsOnce(UdpMessage* msgs, int n);
+  // read side of Read/Readv once the read lock is held. *eof is set
+  // when the peer is known to be done and no syscall is needed.
+  int BeginRead(bool* eof);
+  // pd_.WaitRead/WaitWrite, counted into stats_ with TIN_NET_STATS.
+  int WaitRead();
+  int WaitWrite();
+#if defined(OS_LINUX)
+  int WaitUring(tin::runtime::UringOp* op);
+  int UringRead(void* buf, int len, int* nread);
+  int UringWrite(const void* buf, int len, int* nwritten);
+  int UringAccept(int* fd);
+  bool EnableZeroCopy();
+  void ReleaseZeroCopy();
+#endif
+
+ private:
+  // requests in flight on the io_uring backend.
+  tin::runtime::UringOp rop_;
+  tin::runtime::UringOp wop_;
+
+  struct ZeroCopyPin {
+    // zerocopy sends issued once this buffer is fully queued.
+    uint32 seq_end;
+    scoped_refptr<tin::RefCountedIOBuffer> data;
+  };
+  // 0 untried, 1 enabled, -1 not supported by the socket.
+  int zc_mode_;
+  uint32 zc_seq_;
+  std::deque<ZeroCopyPin> zc_pinned_;
 };
 
 NetFD* NewFD(AddressFamily family, int sotype, int* error_code = NULL);
 
+// takes over a socket inherited or received with ReadFds, family and type
+// are read from the socket. it is made non-blocking and close-on-exec.
+// fd is owned by the NetFD, or closed on failure.
+NetFD* NewFDFromSysFd(int fd, int* error_code = NULL);
+
 }  // namespace net
 }  // namespace tin
 
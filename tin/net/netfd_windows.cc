@@ -5,6 +5,9 @@
 #include <winsock2.h>
 #include <Mswsock.h>
 #include <mstcpip.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include "base/logging.h"
 #include "base/bind.h"
@@ -16,10 +19,14 @@
 #include "tin/net/ip_address.h"
 #include "tin/time/time.h"
 #include "tin/error/error.h"
+#include "tin/sync/atomic.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/env.h"
 #include "tin/runtime/greenlet.h"
+#include "tin/runtime/scheduler.h"
 #include "tin/communication/chan.h"
 #include "tin/runtime/net/pollops.h"
+#include "tin/net/rio_windows.h"
 
 #include "tin/net/netfd_windows.h"
 
@@ -60,13 +67,24 @@ struct IoSrvReq {
   bool cancel_io;
 };
 
+namespace {
+const uintptr_t kIoSrvDone = 1;
+
+bool IoSrvWaitCommit(void* arg1, void* arg2) {
+  Operation* op = static_cast<Operation*>(arg1);
+  // false if the server is done already, we are resumed at once.
+  return atomic::release_cas(&op->srv_g, 0, reinterpret_cast<uintptr_t>(arg2));
+}
+}  // namespace
+
 enum WinIoSyscallTyle {
   kWSARecv = 0,
   kWSASend = 1,
   kWSARecvFrom = 2,
   kWSASendto = 3,
   kAcceptEx = 4,
-  kConnectEx = 5
+  kConnectEx = 5,
+  kTransmitFile = 6
 };
 
 int WinSubmitIO(Operation* op) {
@@ -76,13 +94,13 @@ int WinSubmitIO(Operation* op) {
   op->flags = 0;
   switch (op->io_type) {
   case kWSARecv: {
-    err = WSARecv(op->fd->SysFd(), &op->buf, 1, &op->qty, &op->flags,
+    err = WSARecv(op->fd->SysFd(), op->bufs, op->nbufs, &op->qty, &op->flags,
                   &op->overlapped, NULL);
     break;
   }
   case kWSASend: {
-    err = WSASend(op->fd->SysFd(), &op->buf, 1, &op->qty, 0, &op->overlapped,
-                  NULL);
+    err = WSASend(op->fd->SysFd(), op->bufs, op->nbufs, &op->qty, 0,
+                  &op->overlapped, NULL);
     break;
   }
   case kWSARecvFrom: {
@@ -111,6 +129,16 @@ int WinSubmitIO(Operation* op) {
     }
     break;
   }
+  case kTransmitFile: {
+    op->overlapped.Offset = static_cast<DWORD>(op->file_offset);
+    op->overlapped.OffsetHigh = static_cast<DWORD>(op->file_offset >> 32);
+    err = TransmitFile(op->fd->SysFd(), op->file, op->buf.len, 0,
+                       &op->overlapped, NULL, 0);
+    if (err == FALSE) {
+      err = SOCKET_ERROR;
+    }
+    break;
+  }
   default:
     LOG(FATAL) << "invalid syscall type";
   }  // switch
@@ -137,6 +165,17 @@ class WinIoServer {
   int ExecIO(Operation* o, int* n);
 
  private:
+  // runs req on the server thread and waits for its error code.
+  int Call(const IoSrvReq& req) {
+    atomic::relaxed_store(&req.op->srv_g, 0);
+    if (!chan_->Push(req))
+      return TIN_OBJECT_CLOSED;
+    runtime::Park(IoSrvWaitCommit, req.op, runtime::GetG(),
+                  runtime::kParkBlocking);
+    atomic::acquire_load(&req.op->srv_g);
+    return req.op->srv_err;
+  }
+
   void ProcessRemoteIO() {
     tin::LockOSThread();
 
@@ -150,8 +189,10 @@ class WinIoServer {
           err = GetLastError();
         }
       }
-      if (!r.op->err_chan->Push(err))
-        break;
+      r.op->srv_err = err;
+      uintptr_t gp = atomic::exchange(&r.op->srv_g, kIoSrvDone);
+      if (gp != 0)
+        runtime::Ready(reinterpret_cast<runtime::G*>(gp));
     }
 
     tin::UnlockOSThread();
@@ -174,16 +215,7 @@ int WinIoServer::ExecIO(Operation* op, int* n) {
     err = WinSubmitIO(op);
   } else {
     // for os before windows xp.
-    IoSrvReq req(op);
-    if (chan_->Push(req)) {
-      if (!op->err_chan->Pop(&err)) {
-        // pop failed.
-        err = TIN_OBJECT_CLOSED;
-      }
-    } else {
-      // push failed.
-      err = TIN_OBJECT_CLOSED;
-    }
+    err = Call(IoSrvReq(op));
   }
 
   switch (err) {
@@ -240,14 +272,7 @@ int WinIoServer::ExecIO(Operation* op, int* n) {
       LOG(FATAL) << "CancelIoEx.";
     }
   } else {
-    IoSrvReq req(op, true);
-    if (!chan_->Push(req)) {
-      err = TIN_OBJECT_CLOSED;
-    } else {
-      if (!op->err_chan->Pop(&err)) {
-        err = TIN_OBJECT_CLOSED;
-      }
-    }
+    err = Call(IoSrvReq(op, true));
   }
   // Wait for cancellation to complete.
   fd->Pd()->WaitCanceled(op->mode);
@@ -280,7 +305,11 @@ NetFD* NewFD(AddressFamily family, int sotype, int* error_code) {
   // int sotype = SOCK_STREAM;
   // protocol: If a value of 0 is specified, the caller does not wish to specify
   // a protocol and the service provider will choose the protocol to use.
-  uintptr_t sysfd = socket(ConvertAddressFamily(family), sotype, 0);
+  // tcp sockets may go on RIO once connected, that needs the flag here.
+  uintptr_t sysfd = sotype == SOCK_STREAM
+      ? WSASocket(ConvertAddressFamily(family), sotype, 0, NULL, 0,
+                  RioSocketFlags())
+      : socket(ConvertAddressFamily(family), sotype, 0);
   if (sysfd == INVALID_SOCKET) {
     if (error_code != NULL)
       *error_code = WSAGetLastError();
@@ -294,7 +323,9 @@ NetFD::NetFD(uintptr_t sysfd,
              int sotype,
              const std::string& net)
   : NetFDCommon(sysfd, family, sotype, net)
-  , skip_sync_notification_(false) {
+  , skip_sync_notification_(false)
+  , naccept_ops_(0)
+  , accept_next_(0) {
   base::CallOnce(&start_server_once_flag, StartWinIOServer);
 }
 
@@ -395,9 +426,54 @@ int NetFD::SetTCPKeepAlive(bool enable, int sec) {
   return rv == -1 ? WSAGetLastError() : 0;
 }
 
+int NetFD::GetTcpInfo(TcpInfo* info) {
+  memset(info, 0, sizeof(*info));
+#if defined(SIO_TCP_INFO)
+  // windows 10 1703 and later.
+  DWORD version = 0;
+  TCP_INFO_v0 ti;
+  DWORD bytes_returned = 0;
+  int rv = WSAIoctl(SysFd(), SIO_TCP_INFO, &version, sizeof(version), &ti,
+                    sizeof(ti), &bytes_returned, NULL, NULL);
+  if (rv == SOCKET_ERROR)
+    return WSAGetLastError();
+  info->rtt_us = ti.RttUs;
+  info->snd_mss = ti.Mss;
+  if (ti.Mss > 0) {
+    info->snd_cwnd = ti.Cwnd / ti.Mss;
+    info->total_retrans = static_cast<uint32>(ti.BytesRetrans / ti.Mss);
+    info->unacked = ti.BytesInFlight / ti.Mss;
+  }
+  info->send_queue = ti.BytesInFlight;
+  return 0;
+#else
+  return WSAEOPNOTSUPP;
+#endif
+}
+
 void NetFD::Destroy() {
   if (sysfd_ == INVALID_SOCKET)
     return;
+  CancelAccepts();
+  if (rio_) {
+    // posted RIO ops complete aborted once the socket is closed, and
+    // refer to rop_ and wop_ until then.
+    closesocket(sysfd_);
+    if (rio_->ReceivePosted()) {
+      while (atomic::acquire_load32(&rop_.done) == 0)
+        pd_.WaitCanceled('r');
+      rio_->Received(&rop_);
+    }
+    if (rio_->SendPosted()) {
+      while (atomic::acquire_load32(&wop_.done) == 0)
+        pd_.WaitCanceled('w');
+      rio_->Sent();
+    }
+    rio_.reset();
+    pd_.Close();
+    sysfd_ = INVALID_SOCKET;
+    return;
+  }
   pd_.Close();
   closesocket(sysfd_);
   sysfd_ = INVALID_SOCKET;
@@ -480,6 +556,7 @@ int NetFD::Dial(IPEndPoint* local, IPEndPoint* remote, int64 deadline) {
       return err;
     }
     is_connected_ = true;
+    OpenRio();
   } else {
     err = Init();
     if (err != 0) {
@@ -535,6 +612,7 @@ int NetFD::AcceptOne(Operation* op, NetFD** new_fd) {
   if (err != 0) {
     return err;
   }
+  net_fd->OpenRio();
   *new_fd = net_fd.release();
   return 0;
 }
@@ -544,6 +622,12 @@ int NetFD::Accept(NetFD** new_fd) {
   if (err != 0)
     return err;
 
+  if (flag_cancelioex_avaiable && runtime::rtm_conf->AcceptExPosted() > 1) {
+    err = AcceptPosted(new_fd);
+    ReadUnlock();
+    return err;
+  }
+
   Operation* op = &rop_;
   if (!op->accept_buf) {
     op->accept_buf.reset(new sockaddr_storage[2]);
@@ -569,38 +653,427 @@ int NetFD::Accept(NetFD** new_fd) {
   return err;
 }
 
+int NetFD::PostAccept(int i) {
+  int err = 0;
+  NetFD* net_fd = NewFD(family_, sotype_, &err);
+  if (net_fd == NULL) {
+    return err;
+  }
+  err = net_fd->Init();
+  if (err != 0) {
+    delete net_fd;
+    return err;
+  }
+
+  Operation* op = &accept_ops_[i];
+  op->handle = net_fd->SysFd();
+  op->io_type = kAcceptEx;
+  op->rsan = sizeof(sockaddr_storage);
+  op->error_no = 0;
+  atomic::relaxed_store32(&op->done, 0);
+  accept_fds_[i] = net_fd;
+  // submitted by us, we only get here when CancelIoEx is available.
+  err = WinSubmitIO(op);
+  if (err == 0 && skip_sync_notification_) {
+    // no completion message will follow.
+    atomic::release_store32(&op->done, 1);
+    return 0;
+  }
+  if (err == 0 || err == ERROR_IO_PENDING) {
+    return 0;
+  }
+  accept_fds_[i] = NULL;
+  delete net_fd;
+  return err;
+}
+
+// all posted AcceptEx complete on the 'r' mode of our pd, so a wakeup
+// only says some op is done, their done flags tell which.
+int NetFD::AcceptPosted(NetFD** new_fd) {
+  if (!accept_ops_) {
+    naccept_ops_ = runtime::rtm_conf->AcceptExPosted();
+    accept_ops_.reset(new Operation[naccept_ops_]);
+    accept_fds_.reset(new NetFD*[naccept_ops_]);
+    for (int i = 0; i < naccept_ops_; i++) {
+      Operation* op = &accept_ops_[i];
+      op->mode = 'r';
+      op->fd = this;
+      op->runtime_ctx = pd_.DescAsUintptr();
+      op->accept_buf.reset(new sockaddr_storage[2]);
+      accept_fds_[i] = NULL;
+    }
+  }
+
+  bool prepared = false;
+  while (true) {
+    int err = 0;
+    int nposted = 0;
+    for (int k = 0; k < naccept_ops_; k++) {
+      int i = (accept_next_ + k) % naccept_ops_;
+      if (accept_fds_[i] == NULL) {
+        // posted again on every scan until it works.
+        int post_err = PostAccept(i);
+        if (post_err != 0) {
+          err = post_err;
+          continue;
+        }
+      }
+      nposted++;
+      Operation* op = &accept_ops_[i];
+      if (atomic::acquire_load32(&op->done) == 0) {
+        continue;
+      }
+      NetFD* net_fd = accept_fds_[i];
+      accept_fds_[i] = NULL;
+      accept_next_ = (i + 1) % naccept_ops_;
+      int accept_err = op->error_no;
+      if (accept_err == 0 &&
+          ::setsockopt(net_fd->SysFd(), SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+                       reinterpret_cast<const char*>(&sysfd_),
+                       sizeof(sysfd_)) != 0) {
+        accept_err = WSAGetLastError();
+      }
+      // keep the pool full, a failure is retried by the next scan.
+      PostAccept(i);
+      if (accept_err == 0) {
+        net_fd->OpenRio();
+        *new_fd = net_fd;
+        return 0;
+      }
+      delete net_fd;
+      // see Accept, these are about the new connection only.
+      if (accept_err != ERROR_NETNAME_DELETED && accept_err != WSAECONNRESET) {
+        return accept_err;
+      }
+    }
+    if (nposted == 0) {
+      return err;
+    }
+
+    // rescan after Prepare, it drops a completion that came before.
+    if (!prepared) {
+      err = pd_.Prepare('r');
+      if (err != 0) {
+        return err;
+      }
+      prepared = true;
+      continue;
+    }
+    prepared = false;
+    err = pd_.Wait('r');
+    if (err != 0) {
+      return err;
+    }
+  }
+}
+
+void NetFD::CancelAccepts() {
+  if (!accept_ops_) {
+    return;
+  }
+  for (int i = 0; i < naccept_ops_; i++) {
+    Operation* op = &accept_ops_[i];
+    if (accept_fds_[i] != NULL && atomic::acquire_load32(&op->done) == 0) {
+      // ERROR_NOT_FOUND if it completed meanwhile.
+      CancelIoEx(reinterpret_cast<HANDLE>(sysfd_), &op->overlapped);
+    }
+  }
+  for (int i = 0; i < naccept_ops_; i++) {
+    if (accept_fds_[i] == NULL) {
+      continue;
+    }
+    // the aborted completions still refer to the ops.
+    while (atomic::acquire_load32(&accept_ops_[i].done) == 0) {
+      pd_.WaitCanceled('r');
+    }
+    delete accept_fds_[i];
+    accept_fds_[i] = NULL;
+  }
+}
+
+void NetFD::OpenRio() {
+  if (sotype_ != SOCK_STREAM || !RioInit())
+    return;
+  scoped_ptr<RioQueue> rio(new RioQueue);
+  int err = rio->Open(sysfd_);
+  if (err != 0) {
+    LOG(WARNING) << "RIO: request queue not opened, error code: " << err;
+    return;
+  }
+  rio_.reset(rio.release());
+}
+
+int NetFD::RioWait(Operation* op) {
+  // rechecked after Prepare, it drops a completion that came before.
+  while (atomic::acquire_load32(&op->done) == 0) {
+    int err = pd_.Prepare(op->mode);
+    if (err != 0)
+      return err;
+    if (atomic::acquire_load32(&op->done) != 0)
+      break;
+    err = pd_.Wait(op->mode);
+    if (err != 0)
+      return err;
+  }
+  return 0;
+}
+
+int NetFD::RioRead(const WSABUF* bufs, int nbufs, int* nread) {
+  *nread = 0;
+  Operation* op = &rop_;
+  if (!rio_->Buffered()) {
+    // a receive left by a timed out Read is still ours.
+    if (!rio_->ReceivePosted()) {
+      int err = rio_->Receive(op);
+      if (err != 0)
+        return err;
+    }
+    int err = RioWait(op);
+    if (err != 0)
+      return err;
+    rio_->Received(op);
+    if (op->error_no != 0)
+      return op->error_no;
+  }
+  // 0 at eof.
+  *nread = rio_->Take(bufs, nbufs);
+  return 0;
+}
+
+int NetFD::RioWrite(const WSABUF* bufs, int nbufs, int* nwritten) {
+  *nwritten = 0;
+  Operation* op = &wop_;
+  if (rio_->SendPosted()) {
+    // the bytes of a timed out Write still go out first.
+    int err = RioWait(op);
+    if (err != 0)
+      return err;
+    rio_->Sent();
+    if (op->error_no != 0)
+      return op->error_no;
+  }
+  int total = 0;
+  for (int i = 0; i < nbufs; i++)
+    total += bufs[i].len;
+  int err = 0;
+  while (*nwritten < total) {
+    int n = 0;
+    err = rio_->Send(op, bufs, nbufs, *nwritten, &n);
+    if (err != 0)
+      break;
+    err = RioWait(op);
+    if (err != 0)
+      break;
+    rio_->Sent();
+    if (op->error_no != 0) {
+      err = op->error_no;
+      break;
+    }
+    // a RIO send completes all of its bytes or fails.
+    *nwritten += n;
+  }
+  return err;
+}
+
+int NetFD::AcceptBatch(NetFD** new_fds, int max, int* naccepted) {
+  *naccepted = 0;
+  if (max <= 0)
+    return ERROR_INVALID_PARAMETER;
+  int err = Accept(&new_fds[0]);
+  if (err == 0)
+    *naccepted = 1;
+  return err;
+}
+
 int NetFD::Read(void* buf, int len, int* nread) {
+  TouchIdle();
+  int err = ReadLock();
+  if (err != 0)
+    return err;
+
+  int n = 0;
+  if (rio_) {
+    WSABUF vec;
+    vec.buf = static_cast<char*>(buf);
+    vec.len = len;
+    err = RioRead(&vec, 1, &n);
+  } else {
+    Operation* op = &rop_;
+    op->InitBuf(buf, len);
+    op->io_type = kWSARecv;
+    err = rsrv->ExecIO(op, &n);
+  }
+  err = EofError(n, err);
+  if (err == 0)
+    *nread = n;
+
+  ReadUnlock();
+  MaybeYield();
+  return err;
+}
+
+int NetFD::ReadPooled(tin::io::IOBufChain* chain, int max, int* nread) {
+  TouchIdle();
+  *nread = 0;
+  int n = 0;
+  if (rio_) {
+    // the receive slot holds the data while the connection is idle.
+    char* ptr = NULL;
+    int len = 0;
+    chain->GetWritableTail(1, &ptr, &len);
+    int err = Read(ptr, std::min(len, max), &n);
+    chain->CommitTail(err == 0 ? n : 0);
+    if (err == 0)
+      *nread = n;
+    return err;
+  }
   int err = ReadLock();
   if (err != 0)
     return err;
 
+  // a zero byte WSARecv completes once data arrives, without pinning
+  // a buffer while the connection is idle.
   Operation* op = &rop_;
-  op->InitBuf(buf, len);
+  op->InitBuf(NULL, 0);
   op->io_type = kWSARecv;
-  int n = 0;
   err = rsrv->ExecIO(op, &n);
+  ReadUnlock();
+  if (err != 0)
+    return err;
+
+  char* ptr = NULL;
+  int len = 0;
+  chain->GetWritableTail(1, &ptr, &len);
+  err = Read(ptr, std::min(len, max), &n);
+  chain->CommitTail(err == 0 ? n : 0);
+  if (err == 0)
+    *nread = n;
+  return err;
+}
+
+int NetFD::Readv(const tin::io::IOVec* iov, int iovcnt, int* nread) {
+  TouchIdle();
+  if (iovcnt <= 0 || iovcnt > kMaxIOVecs)
+    return ERROR_INVALID_PARAMETER;
+  WSABUF vec[kMaxIOVecs];
+  for (int i = 0; i < iovcnt; ++i) {
+    vec[i].buf = static_cast<char*>(iov[i].base);
+    vec[i].len = iov[i].len;
+  }
+  int err = ReadLock();
+  if (err != 0)
+    return err;
+
+  int n = 0;
+  if (rio_) {
+    err = RioRead(vec, iovcnt, &n);
+  } else {
+    Operation* op = &rop_;
+    op->InitBufs(vec, iovcnt);
+    op->io_type = kWSARecv;
+    err = rsrv->ExecIO(op, &n);
+    op->InitBuf(NULL, 0);
+  }
   err = EofError(n, err);
   if (err == 0)
     *nread = n;
 
   ReadUnlock();
+  MaybeYield();
   return err;
 }
 
-int NetFD::Write(const void* buf, int len, int* nwritten) {
+int NetFD::Writev(const tin::io::IOVec* iov, int iovcnt, int* nwritten) {
+  TouchIdle();
+  if (iovcnt <= 0 || iovcnt > kMaxIOVecs)
+    return ERROR_INVALID_PARAMETER;
+  WSABUF vec[kMaxIOVecs];
+  for (int i = 0; i < iovcnt; ++i) {
+    vec[i].buf = static_cast<char*>(iov[i].base);
+    vec[i].len = iov[i].len;
+  }
+  int err = WriteLock();
+  if (err != 0)
+    return err;
+
+  // an overlapped WSASend completes every buffer or fails, same as Write.
+  int n = 0;
+  if (rio_) {
+    err = RioWrite(vec, iovcnt, &n);
+  } else {
+    Operation* op = &wop_;
+    op->InitBufs(vec, iovcnt);
+    op->io_type = kWSASend;
+    err = rsrv->ExecIO(op, &n);
+    op->InitBuf(NULL, 0);
+  }
+  if (err == 0)
+    *nwritten = n;
+
+  WriteUnlock();
+  MaybeYield();
+  return err;
+}
+
+int NetFD::SendFile(tin::file_t file, int64 offset, int64 len,
+                    int64* nsent) {
+  *nsent = 0;
+  if (offset < 0 || len < 0)
+    return ERROR_INVALID_PARAMETER;
   int err = WriteLock();
   if (err != 0)
     return err;
 
   Operation* op = &wop_;
-  op->InitBuf(const_cast<void*>(buf), len);
-  op->io_type = kWSASend;
+  int64 nn = 0;
+  while (nn < len) {
+    // TransmitFile takes at most 2G - 1 bytes per call.
+    int chunk = static_cast<int>(std::min<int64>(len - nn, 1 << 30));
+    op->InitBuf(NULL, chunk);
+    op->file = file;
+    op->file_offset = offset + nn;
+    op->io_type = kTransmitFile;
+    int n = 0;
+    err = rsrv->ExecIO(op, &n);
+    nn += n;
+    if (err != 0)
+      break;
+    if (n == 0) {
+      err = TIN_UNEXPECTED_EOF;
+      break;
+    }
+  }
+  op->file = INVALID_HANDLE_VALUE;
+  *nsent = nn;
+
+  WriteUnlock();
+  MaybeYield();
+  return err;
+}
+
+int NetFD::Write(const void* buf, int len, int* nwritten) {
+  TouchIdle();
+  int err = WriteLock();
+  if (err != 0)
+    return err;
+
   int n = 0;
-  err = rsrv->ExecIO(op, &n);
+  if (rio_) {
+    WSABUF vec;
+    vec.buf = static_cast<char*>(const_cast<void*>(buf));
+    vec.len = len;
+    err = RioWrite(&vec, 1, &n);
+  } else {
+    Operation* op = &wop_;
+    op->InitBuf(const_cast<void*>(buf), len);
+    op->io_type = kWSASend;
+    err = rsrv->ExecIO(op, &n);
+  }
   if (err == 0)
     *nwritten = n;
 
   WriteUnlock();
+  MaybeYield();
   return err;
 }
 
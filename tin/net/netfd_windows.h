@@ -9,11 +9,14 @@
 
 #include "base/strings/string_piece.h"
 #include "tin/platform/platform_win.h"
+#include "tin/io/io.h"
+#include "tin/io/ioutil.h"
+#include "tin/io/io_buffer.h"
+#include "tin/io/iobuf_chain.h"
 #include "tin/net/fd_mutex.h"
 #include "tin/net/poll_desc.h"
 #include "tin/net/address_list.h"
 #include "tin/net/ip_endpoint.h"
-#include "tin/communication/chan.h"
 
 #include "tin/net/netfd_common.h"
 
@@ -21,6 +24,7 @@ namespace tin {
 namespace net {
 
 class NetFD;
+class RioQueue;
 struct SockaddrStorage;
 
 struct Operation {
@@ -31,10 +35,16 @@ struct Operation {
     , handle(NULL)
     , error_no(0)
     , qty(0)
+    , done(0)
     , flags(0)
     , fd(NULL)
+    , bufs(&buf)
+    , nbufs(1)
+    , file(INVALID_HANDLE_VALUE)
+    , file_offset(0)
     , mode(0)
-    , err_chan(tin::MakeChan<int>(1)) {
+    , srv_g(0)
+    , srv_err(0) {
   }
 
   ~Operation() {
@@ -43,23 +53,39 @@ struct Operation {
   void InitBuf(void* ptr, int len) {
     buf.buf = static_cast<char*>(ptr);
     buf.len = len;
+    bufs = &buf;
+    nbufs = 1;
+  }
+
+  // |vec| must outlive the operation.
+  void InitBufs(WSABUF* vec, int n) {
+    bufs = vec;
+    nbufs = n;
   }
 
   int io_type;
+  // from here to done laid out like runtime::NetOP, the poller fills it.
   OVERLAPPED overlapped;
   uintptr_t runtime_ctx;
   int32 mode;
   int32 error_no;
   DWORD qty;
+  int32 done;
 
   NetFD* fd;
   WSABUF buf;
+  WSABUF* bufs;
+  DWORD nbufs;
+  HANDLE file;  // TransmitFile source.
+  int64 file_offset;
   SockaddrStorage* sa;
   DWORD flags;
   uintptr_t handle;  // listen socket handle.
   scoped_ptr<sockaddr_storage[]> accept_buf;
   int32 rsan;
-  tin::Chan<int> err_chan;
+  // WinIoServer handshake, 0, the waiting G or kIoSrvDone.
+  uintptr_t srv_g;
+  int srv_err;
 };
 
 class NetFD : public NetFDCommon {
@@ -77,6 +103,20 @@ class NetFD : public NetFDCommon {
 
   int Write(const void* buf, int len, int* nwritten);
 
+  int ReadPooled(tin::io::IOBufChain* chain, int max, int* nread);
+
+  int Readv(const tin::io::IOVec* iov, int iovcnt, int* nread);
+
+  int Writev(const tin::io::IOVec* iov, int iovcnt, int* nwritten);
+
+  int SendFile(tin::file_t file, int64 offset, int64 len, int64* nsent);
+
+  // no zero copy send on windows, data is written with Write.
+  int WriteZeroCopy(tin::RefCountedIOBuffer* data, int* nwritten) {
+    return Write(data->buffer()->begin(), data->buffer()->buffered(),
+                 nwritten);
+  }
+
   virtual void Destroy();
 
   int Shutdown(int how);
@@ -93,6 +133,10 @@ class NetFD : public NetFDCommon {
 
   int Accept(NetFD** newfd);
 
+  // AcceptEx completes one connection per operation, so this only
+  // ever returns a single connection.
+  int AcceptBatch(NetFD** newfds, int max, int* naccepted);
+
   int EofError(int n, int err);
 
   int GetSockOpt(int level, int name, void* optval, socklen_t* optlen);
@@ -101,6 +145,23 @@ class NetFD : public NetFDCommon {
 
   int SetTCPKeepAlive(bool enable, int sec);
 
+  // TCP_INFO of the socket, SIO_TCP_INFO on windows.
+  int GetTcpInfo(TcpInfo* info);
+
+  // see the posix version, no health check here yet.
+  bool IdleCheck() {
+    return sysfd_ != kInvalidSocket;
+  }
+
+  // completion ports have no readiness to wait for.
+  int WaitIO(bool write) {
+    return WSAEOPNOTSUPP;
+  }
+
+  int WaitIOAsync(bool write, const base::Closure& closure) {
+    return WSAEOPNOTSUPP;
+  }
+
   bool SkipSyncNotification() {
     return skip_sync_notification_;
   }
@@ -109,10 +170,31 @@ class NetFD : public NetFDCommon {
   int Connect(SockaddrStorage* laddr, SockaddrStorage* raddr, int64 deadline);
   int AcceptOne(Operation* op, NetFD** newfd);
 
+  // the AcceptEx pool of a listener, see Config::AcceptExPosted.
+  int AcceptPosted(NetFD** newfd);
+  int PostAccept(int i);
+  // cancels the posted AcceptEx and waits for their completions.
+  void CancelAccepts();
+
+  // moves a connected tcp socket to RIO, see RioInit. it stays on
+  // overlapped io if that fails.
+  void OpenRio();
+  // waits for the RIO op posted, its completion survives a timeout.
+  int RioWait(Operation* op);
+  int RioRead(const WSABUF* bufs, int nbufs, int* nread);
+  int RioWrite(const WSABUF* bufs, int nbufs, int* nwritten);
+
  private:
   bool skip_sync_notification_;
   Operation rop_;
   Operation wop_;
+  int naccept_ops_;
+  int accept_next_;
+  scoped_ptr<Operation[]> accept_ops_;
+  // the socket each posted AcceptEx accepts into, NULL if not posted.
+  scoped_ptr<NetFD*[]> accept_fds_;
+  // set for a connection on RIO, rop_ and wop_ complete through it then.
+  scoped_ptr<RioQueue> rio_;
 };
 
 NetFD* NewFD(AddressFamily family, int sotype, int* error_code = NULL);
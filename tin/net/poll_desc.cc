@@ -3,7 +3,6 @@
 // found in the LICENSE file.
 
 #include "base/logging.h"
-#include "base/synchronization/once.h"
 #include "tin/error/error.h"
 #include "tin/net/net.h"
 #include "tin/runtime/runtime.h"
@@ -22,6 +21,8 @@ int ConvertErr(int res) {
     return TIN_ECLOSE_INTR;
   case 2:
     return TIN_ETIMEOUT_INTR;
+  case runtime::pollops::kPollErrCanceled:
+    return TIN_ECANCELED;
   }
   LOG(FATAL) << "unreachable error.";
   // unreachable.
@@ -29,10 +30,8 @@ int ConvertErr(int res) {
 }
 }  // namespace
 
-base::OnceType server_init = ONCE_INIT;
-
 int PollDesc::Init(uintptr_t sysfd) {
-  base::CallOnce(&server_init, tin::runtime::pollops::ServerInit);
+  runtime::pollops::ServerInitOnce();
   int error_no = 0;
   runtime::PollDescriptor* ctx = runtime::pollops::Open(sysfd, &error_no);
   if (error_no == 0) {
@@ -82,6 +81,15 @@ int PollDesc::WaitWrite() {
   return Wait('w');
 }
 
+int PollDesc::WaitAsync(int mode, const base::Closure& closure) {
+  int res = runtime::pollops::WaitAsync(Desc(), mode, closure);
+  return ConvertErr(res);
+}
+
+int PollDesc::Move(int proc_id) {
+  return runtime::pollops::Move(Desc(), proc_id);
+}
+
 void PollDesc::WaitCanceled(int mode) {
   runtime::pollops::WaitCanceled(Desc(), mode);
 }
@@ -5,6 +5,8 @@
 #pragma once
 #include <string>
 
+#include "base/callback.h"
+
 namespace tin {
 
 // forward declaration.
@@ -32,6 +34,10 @@ class PollDesc {
   int Wait(int mode);
   int WaitRead();
   int WaitWrite();
+  // see pollops::WaitAsync.
+  int WaitAsync(int mode, const base::Closure& closure);
+  // polled by the shard of P proc_id from now on, 0 or an errno.
+  int Move(int proc_id);
   void WaitCanceled(int mode);
   void WaitCanceledRead();
   void WaitCanceledWrite();
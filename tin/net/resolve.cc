@@ -16,10 +16,13 @@
 
 #include "base/logging.h"
 #include "tin/error/error.h"
+#include "tin/config/config.h"
+#include "tin/runtime/env.h"
 #include "tin/runtime/util.h"
 #include "tin/runtime/runtime.h"
 #include "tin/runtime/threadpoll.h"
 #include "tin/net/ip_endpoint.h"
+#include "tin/net/dns_client.h"
 
 #include "tin/net/resolve.h"
 
@@ -101,6 +104,13 @@ int ResolveHostname(const base::StringPiece& hostname,
     tin::SetErrorCode(TIN_EINVAL);
     return -1;
   }
+  if (rtm_conf->IsDnsClientEnabled()) {
+    int error = 0;
+    if (DnsLookup(hostname, family, addresses, &error)) {
+      tin::SetErrorCode(error == 0 ? 0 : TIN_EAI_NONAME);
+      return error;
+    }
+  }
   scoped_ptr<ResolveHostnameWork> work(
     new ResolveHostnameWork(hostname, family, addresses));
   SubmitGetAddrInfoGletWork(work.get());
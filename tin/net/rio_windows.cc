@@ -0,0 +1,303 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <winsock2.h>
+#include <mswsock.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/synchronization/once.h"
+#include "tin/sync/atomic.h"
+#include "tin/sync/pool.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/net/netpoll.h"
+#include "tin/net/netfd_windows.h"
+
+#include "tin/net/rio_windows.h"
+
+namespace tin {
+namespace net {
+
+// one of the slots a registered chunk is cut in.
+struct RioSlot {
+  RioSlot* next;
+  RIO_BUFFERID id;
+  DWORD offset;
+  char* data;
+};
+
+// the completion queue and the buffer pool of a P. the lock serializes
+// the queue, posting to the request queues on it included, as RIO wants.
+struct RioShard {
+  // first, the port entry of a notification points to it.
+  OVERLAPPED overlapped;
+  runtime::RawMutex lock;
+  RIO_CQ cq;
+  DWORD cq_size;
+  // request queues on cq, each with room for two completions.
+  DWORD queues;
+  RioSlot* free_slots;
+  char pad[64];
+};
+
+namespace {
+
+// slots per registered chunk, 1MB.
+const int kRioChunkSlots = 64;
+const DWORD kRioInitialCqSize = 1024;
+const int kRioDequeueBatch = 256;
+
+RIO_EXTENSION_FUNCTION_TABLE rio;
+bool rio_enabled = false;
+int nshards = 0;
+RioShard* shards = NULL;
+base::OnceType rio_once = ONCE_INIT;
+
+// lock held. NULL if no chunk could be registered.
+RioSlot* TakeSlot(RioShard* shard) {
+  if (shard->free_slots == NULL) {
+    DWORD size = kRioSlotSize * kRioChunkSlots;
+    char* chunk = static_cast<char*>(
+        VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (chunk == NULL)
+      return NULL;
+    // registered for good, slots go back to the pool only.
+    RIO_BUFFERID id = rio.RIORegisterBuffer(chunk, size);
+    if (id == RIO_INVALID_BUFFERID) {
+      VirtualFree(chunk, 0, MEM_RELEASE);
+      return NULL;
+    }
+    for (int i = 0; i < kRioChunkSlots; i++) {
+      RioSlot* slot = new RioSlot;
+      slot->id = id;
+      slot->offset = i * kRioSlotSize;
+      slot->data = chunk + slot->offset;
+      slot->next = shard->free_slots;
+      shard->free_slots = slot;
+    }
+  }
+  RioSlot* slot = shard->free_slots;
+  shard->free_slots = slot->next;
+  return slot;
+}
+
+void PutSlot(RioShard* shard, RioSlot* slot) {
+  slot->next = shard->free_slots;
+  shard->free_slots = slot;
+}
+
+void Drain(runtime::G** gpp, void* ol) {
+  RioShard* shard = reinterpret_cast<RioShard*>(ol);
+  RIORESULT results[kRioDequeueBatch];
+  runtime::RawMutexGuard guard(&shard->lock);
+  while (true) {
+    ULONG n = rio.RIODequeueCompletion(shard->cq, results, kRioDequeueBatch);
+    if (n == RIO_CORRUPT_CQ)
+      LOG(FATAL) << "RIO: corrupt completion queue";
+    for (ULONG i = 0; i < n; i++) {
+      Operation* op = reinterpret_cast<Operation*>(results[i].RequestContext);
+      op->error_no = results[i].Status;
+      op->qty = results[i].BytesTransferred;
+      atomic::release_store32(&op->done, 1);
+      runtime::NetPollReady(
+          gpp, reinterpret_cast<runtime::PollDescriptor*>(op->runtime_ctx),
+          op->mode);
+    }
+    if (n < static_cast<ULONG>(kRioDequeueBatch))
+      break;
+  }
+  // one notification per arm.
+  int err = rio.RIONotify(shard->cq);
+  if (err != ERROR_SUCCESS && err != WSAEALREADY)
+    LOG(FATAL) << "RIO: RIONotify failed, error code: " << err;
+}
+
+void InitRio() {
+  if (!runtime::rtm_conf->IsRioEnabled())
+    return;
+#if defined(WSAID_MULTIPLE_RIO)
+  SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (s == INVALID_SOCKET)
+    return;
+  GUID id = WSAID_MULTIPLE_RIO;
+  DWORD bytes = 0;
+  memset(&rio, 0, sizeof(rio));
+  rio.cbSize = sizeof(rio);
+  int rv = WSAIoctl(s, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &id,
+                    sizeof(id), &rio, sizeof(rio), &bytes, NULL, NULL);
+  closesocket(s);
+  if (rv == SOCKET_ERROR) {
+    LOG(WARNING) << "RIO not available, error code: " << WSAGetLastError();
+    return;
+  }
+
+  nshards = std::max(runtime::rtm_conf->MaxProcs(), 1);
+  shards = new RioShard[nshards];
+  for (int i = 0; i < nshards; i++) {
+    RioShard* shard = &shards[i];
+    memset(&shard->overlapped, 0, sizeof(shard->overlapped));
+    RIO_NOTIFICATION_COMPLETION nc;
+    memset(&nc, 0, sizeof(nc));
+    nc.Type = RIO_IOCP_COMPLETION;
+    nc.Iocp.IocpHandle = reinterpret_cast<HANDLE>(runtime::NetPollIocp());
+    nc.Iocp.CompletionKey = reinterpret_cast<PVOID>(runtime::kNetPollRioKey);
+    nc.Iocp.Overlapped = &shard->overlapped;
+    shard->cq = rio.RIOCreateCompletionQueue(kRioInitialCqSize, &nc);
+    if (shard->cq == RIO_INVALID_CQ) {
+      LOG(WARNING) << "RIO: RIOCreateCompletionQueue failed, error code: "
+                   << WSAGetLastError();
+      // the queues made so far stay, nothing is posted on them.
+      return;
+    }
+    shard->cq_size = kRioInitialCqSize;
+    shard->queues = 0;
+    shard->free_slots = NULL;
+    rio.RIONotify(shard->cq);
+  }
+  runtime::NetPollSetRioDrain(Drain);
+  rio_enabled = true;
+#endif
+}
+
+}  // namespace
+
+bool RioInit() {
+  base::CallOnce(&rio_once, InitRio);
+  return rio_enabled;
+}
+
+DWORD RioSocketFlags() {
+#if defined(WSA_FLAG_REGISTERED_IO)
+  return RioInit() ? WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO
+                   : WSA_FLAG_OVERLAPPED;
+#else
+  return WSA_FLAG_OVERLAPPED;
+#endif
+}
+
+RioQueue::RioQueue()
+  : shard_(NULL)
+  , rq_(RIO_INVALID_RQ)
+  , recv_slot_(NULL)
+  , send_slot_(NULL)
+  , recv_off_(0)
+  , recv_len_(0)
+  , recv_posted_(false)
+  , send_posted_(false) {
+}
+
+RioQueue::~RioQueue() {
+  // the socket is closed and nothing is posted anymore, closing it freed
+  // the request queue.
+  DCHECK(!recv_posted_ && !send_posted_);
+  if (shard_ == NULL)
+    return;
+  runtime::RawMutexGuard guard(&shard_->lock);
+  if (recv_slot_ != NULL)
+    PutSlot(shard_, recv_slot_);
+  if (send_slot_ != NULL)
+    PutSlot(shard_, send_slot_);
+  if (rq_ != RIO_INVALID_RQ)
+    shard_->queues--;
+}
+
+int RioQueue::Open(uintptr_t sysfd) {
+  DCHECK(rio_enabled);
+  int id = internal::PoolProcId();
+  RioShard* shard = &shards[id < 0 ? 0 : id % nshards];
+  runtime::RawMutexGuard guard(&shard->lock);
+  DWORD need = (shard->queues + 1) * 2;
+  if (need > shard->cq_size) {
+    DWORD size = std::max(need, shard->cq_size * 2);
+    if (!rio.RIOResizeCompletionQueue(shard->cq, size))
+      return WSAGetLastError();
+    shard->cq_size = size;
+  }
+  recv_slot_ = TakeSlot(shard);
+  send_slot_ = TakeSlot(shard);
+  shard_ = shard;
+  if (recv_slot_ == NULL || send_slot_ == NULL)
+    return WSAENOBUFS;
+  rq_ = rio.RIOCreateRequestQueue(static_cast<SOCKET>(sysfd), 1, 1, 1, 1,
+                                  shard->cq, shard->cq, NULL);
+  if (rq_ == RIO_INVALID_RQ)
+    return WSAGetLastError();
+  shard->queues++;
+  return 0;
+}
+
+int RioQueue::Receive(Operation* op) {
+  DCHECK(!recv_posted_);
+  RIO_BUF buf;
+  buf.BufferId = recv_slot_->id;
+  buf.Offset = recv_slot_->offset;
+  buf.Length = kRioSlotSize;
+  op->error_no = 0;
+  op->qty = 0;
+  atomic::relaxed_store32(&op->done, 0);
+  runtime::RawMutexGuard guard(&shard_->lock);
+  if (!rio.RIOReceive(rq_, &buf, 1, 0, op))
+    return WSAGetLastError();
+  recv_posted_ = true;
+  return 0;
+}
+
+void RioQueue::Received(Operation* op) {
+  recv_posted_ = false;
+  recv_off_ = 0;
+  recv_len_ = op->error_no == 0 ? static_cast<int>(op->qty) : 0;
+}
+
+int RioQueue::Take(const WSABUF* bufs, int nbufs) {
+  int n = 0;
+  for (int i = 0; i < nbufs && recv_off_ < recv_len_; i++) {
+    int len = std::min(static_cast<int>(bufs[i].len), recv_len_ - recv_off_);
+    memcpy(bufs[i].buf, recv_slot_->data + recv_off_, len);
+    recv_off_ += len;
+    n += len;
+  }
+  return n;
+}
+
+int RioQueue::Send(Operation* op, const WSABUF* bufs, int nbufs, int skip,
+                   int* n) {
+  DCHECK(!send_posted_);
+  int len = 0;
+  for (int i = 0; i < nbufs && len < kRioSlotSize; i++) {
+    int blen = static_cast<int>(bufs[i].len);
+    if (skip >= blen) {
+      skip -= blen;
+      continue;
+    }
+    int chunk = std::min(blen - skip, kRioSlotSize - len);
+    memcpy(send_slot_->data + len, bufs[i].buf + skip, chunk);
+    len += chunk;
+    skip = 0;
+  }
+  RIO_BUF buf;
+  buf.BufferId = send_slot_->id;
+  buf.Offset = send_slot_->offset;
+  buf.Length = len;
+  op->error_no = 0;
+  op->qty = 0;
+  atomic::relaxed_store32(&op->done, 0);
+  *n = 0;
+  runtime::RawMutexGuard guard(&shard_->lock);
+  if (!rio.RIOSend(rq_, &buf, 1, 0, op))
+    return WSAGetLastError();
+  send_posted_ = true;
+  *n = len;
+  return 0;
+}
+
+void RioQueue::Sent() {
+  send_posted_ = false;
+}
+
+}  // namespace net
+}  // namespace tin
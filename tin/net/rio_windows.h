@@ -0,0 +1,88 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <winsock2.h>
+#include <mswsock.h>
+
+#include "base/basictypes.h"
+
+// Registered I/O for tcp connections, see Config::EnableRio. data moves
+// through slots of buffers registered once per P, so no operation locks
+// pages, and a receive or send is posted to a request queue without a
+// kernel transition. every P has a completion queue that notifies the
+// poller's completion port with kNetPollRioKey, one port entry then stands
+// for a batch of completions dequeued at once.
+
+namespace tin {
+namespace net {
+
+struct Operation;
+struct RioShard;
+struct RioSlot;
+
+// bytes a receive or send moves at most, the slot size of the pools.
+const int kRioSlotSize = 16 * 1024;
+
+// loads the RIO functions and sets up a completion queue per P, once.
+// false unless Config::EnableRio is set and the system has RIO, sockets
+// then stay on overlapped io.
+bool RioInit();
+
+// the WSASocket flags of a socket that may use RIO.
+DWORD RioSocketFlags();
+
+// the request queue of a connection with at most one receive and one
+// send outstanding, serialized by the fd locks of the NetFD. an operation
+// posted stays posted when its waiter times out, the next Read or Write
+// picks it up. completions fill op like the poller does for overlapped
+// io and ready the pd of op.
+class RioQueue {
+ public:
+  RioQueue();
+  ~RioQueue();
+
+  // on the completion queue of the P running the caller, 0 or a winsock
+  // error.
+  int Open(uintptr_t sysfd);
+
+  // posts a receive into the receive slot.
+  int Receive(Operation* op);
+  // the receive completed with op->qty bytes or op->error_no.
+  void Received(Operation* op);
+  // copies out what the last receive got, less what was taken already.
+  int Take(const WSABUF* bufs, int nbufs);
+
+  // copies up to kRioSlotSize bytes of bufs, from byte skip on, into the
+  // send slot and posts them. *n bytes are posted.
+  int Send(Operation* op, const WSABUF* bufs, int nbufs, int skip, int* n);
+  void Sent();
+
+  bool ReceivePosted() const {
+    return recv_posted_;
+  }
+
+  bool SendPosted() const {
+    return send_posted_;
+  }
+
+  // received bytes not yet taken.
+  bool Buffered() const {
+    return recv_off_ < recv_len_;
+  }
+
+ private:
+  RioShard* shard_;
+  RIO_RQ rq_;
+  RioSlot* recv_slot_;
+  RioSlot* send_slot_;
+  int recv_off_;
+  int recv_len_;
+  bool recv_posted_;
+  bool send_posted_;
+  DISALLOW_COPY_AND_ASSIGN(RioQueue);
+};
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,151 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/time/time.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/runtime/spawn.h"
+#include "tin/net/dialer.h"
+
+#include "tin/net/server.h"
+
+namespace tin {
+namespace net {
+
+namespace {
+
+const int kMaxAcceptBatch = 64;
+// how often a loop paused by overload looks again.
+const int64 kOverloadPollNs = 1 * kMillisecond;
+
+// out of fds, backing off lets handlers close some.
+bool TemporaryAcceptError(int err) {
+  return err == TIN_EMFILE || err == TIN_ENFILE || err == TIN_ENOBUFS ||
+         err == TIN_ENOMEM;
+}
+
+}  // namespace
+
+ServerImpl::ServerImpl(const ConnHandler& handler,
+                       const ServerOptions& options)
+  : handler_(handler)
+  , options_(options)
+  , listener_(NULL)
+  , slots_(options.max_conns > 0 ? options.max_conns : 0) {
+  options_.accept_batch =
+    std::max(1, std::min(options_.accept_batch, kMaxAcceptBatch));
+}
+
+ServerImpl::~ServerImpl() {
+}
+
+bool ServerImpl::ListenAndServe(const base::StringPiece& addr,
+                                uint16 port) {
+  TCPListener listener =
+    ListenTcp(addr, port, options_.backlog, options_.shards);
+  if (listener.get() == NULL)
+    return false;
+  Serve(listener);
+  return true;
+}
+
+void ServerImpl::Serve(TCPListener listener) {
+  DCHECK(listener_.get() == NULL);
+  listener_ = listener;
+  int shards = listener_->Shards();
+  loops_.Add(shards);
+  for (int i = 0; i < shards; i++) {
+    // holds a reference until the loop returns.
+    Spawn(&ServerImpl::AcceptLoop, this, i);
+  }
+}
+
+bool ServerImpl::Drain(int64 timeout) {
+  draining_ = true;
+  // wakes the loops parked at the connection limit.
+  if (options_.max_conns > 0) {
+    for (int i = 0; i < listener_->Shards(); i++)
+      runtime::SemRelease(&slots_);
+  }
+  bool idle = listener_->Drain(timeout);
+  loops_.Wait();
+  SetErrorCode(idle ? 0 : TIN_ETIMEDOUT);
+  return idle;
+}
+
+int ServerImpl::ActiveConns() {
+  return listener_.get() != NULL ? listener_->ActiveConns() : 0;
+}
+
+void ServerImpl::AcceptLoop(int shard) {
+  TcpConn conns[kMaxAcceptBatch];
+  int64 backoff = 0;
+  while (!draining_) {
+    if (options_.pause_when_overloaded && Overloaded()) {
+      NanoSleep(kOverloadPollNs);
+      continue;
+    }
+    int want = options_.accept_batch;
+    if (options_.max_conns > 0) {
+      runtime::SemAcquire(&slots_);
+      uint32 more = runtime::SemTryAcquireN(&slots_, want - 1);
+      want = 1 + static_cast<int>(more);
+      if (draining_)
+        break;
+    }
+    int n = listener_->AcceptBatch(shard, conns, want);
+    int err = GetErrorCode();
+    for (int i = n; options_.max_conns > 0 && i < want; i++)
+      runtime::SemRelease(&slots_);
+    for (int i = 0; i < n; i++) {
+      int proc = options_.incoming_cpu ? Place(conns[i]) : -1;
+      if (proc >= 0) {
+        SpawnOptions opts;
+        opts.proc = proc;
+        DoSpawn(opts, base::Bind(&ServerImpl::Handle, this, conns[i]));
+      } else {
+        // lands on the run queue of this P.
+        Spawn(&ServerImpl::Handle, this, conns[i]);
+      }
+      conns[i] = TcpConn();
+    }
+    if (n > 0) {
+      backoff = 0;
+    } else if (TemporaryAcceptError(err)) {
+      backoff = backoff == 0 ? 5 * kMillisecond :
+                               std::min(2 * backoff, int64(kSecond));
+      LOG(WARNING) << "accept failed: " << GetErrorStr() << ", retrying in "
+                   << backoff / kMillisecond << "ms";
+      NanoSleep(backoff);
+    } else if (err != 0) {
+      VLOG_IF(1, !draining_) << "accept loop stopped: " << GetErrorStr();
+      break;
+    }
+  }
+  loops_.Done();
+}
+
+int ServerImpl::Place(const TcpConn& conn) {
+  int proc = ProcOfCpu(conn->IncomingCpu());
+  if (proc < 0)
+    return -1;
+  if (!conn->MovePoller(proc)) {
+    VLOG(1) << "MovePoller failed: " << GetErrorStr();
+  }
+  return proc;
+}
+
+void ServerImpl::Handle(TcpConn conn) {
+  handler_.Run(conn);
+  if (options_.max_conns > 0)
+    runtime::SemRelease(&slots_);
+}
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,117 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+#include "base/callback.h"
+#include "base/memory/ref_counted.h"
+#include "base/strings/string_piece.h"
+#include "tin/sync/atomic_flag.h"
+#include "tin/sync/wait_group.h"
+#include "tin/net/listener.h"
+#include "tin/net/tcp_conn.h"
+
+namespace tin {
+namespace net {
+
+// serves one connection, runs on a greenlet of its own.
+typedef base::Callback<void(TcpConn)> ConnHandler;
+
+struct ServerOptions {
+  ServerOptions()
+    : backlog(511)
+    , shards(0)
+    , max_conns(0)
+    , accept_batch(16)
+    , incoming_cpu(false)
+    , pause_when_overloaded(false) {
+  }
+
+  int backlog;
+  // SO_REUSEPORT sockets and accept loops, 0 is one per P. see ListenTcp.
+  int shards;
+  // connections served at once, 0 is no limit. at the limit the accept
+  // loops stop accepting and the rest queues in the kernel backlog.
+  int max_conns;
+  // connections taken per wakeup of an accept loop.
+  int accept_batch;
+  // a handler starts on the P bound to the cpu the NIC steers its flow
+  // to and its connection is polled there, see TcpConnImpl::IncomingCpu.
+  // pays off with Config::SetCpuAffinity and RSS set up to match.
+  bool incoming_cpu;
+  // the accept loops stop while tin::Overloaded holds, new connections
+  // wait in the kernel backlog and the ones being served keep their
+  // latency.
+  bool pause_when_overloaded;
+};
+
+// runs one accept loop per listener shard, each spawns the handlers of
+// the connections it accepts on its own P, so a connection starts out
+// next to the loop the kernel woke for it instead of being stolen.
+class ServerImpl
+  : public base::RefCountedThreadSafe<ServerImpl> {
+ public:
+  ServerImpl(const ConnHandler& handler, const ServerOptions& options);
+
+  // listens on addr:port and returns once the accept loops are spawned.
+  // false with the error code set if the address can not be listened on.
+  bool ListenAndServe(const base::StringPiece& addr, uint16 port);
+  // serves a listener opened elsewhere, e.g. taken over by a handover.
+  void Serve(TCPListener listener);
+
+  // stops accepting and waits up to timeout (relative, -1 forever) for
+  // the connections being served to be released, see
+  // TCPListenerImpl::Drain. false if some were still alive at the timeout,
+  // their handlers keep running.
+  bool Drain(int64 timeout);
+
+  // true once Drain was called, long running handlers should wind up.
+  bool Draining() const {
+    return draining_;
+  }
+
+  int ActiveConns();
+
+  TCPListener listener() const {
+    return listener_;
+  }
+
+ private:
+  friend class base::RefCountedThreadSafe<ServerImpl>;
+  ~ServerImpl();
+
+  void AcceptLoop(int shard);
+  // P for the handler of conn by its incoming cpu, -1 if unknown.
+  int Place(const TcpConn& conn);
+  void Handle(TcpConn conn);
+
+  ConnHandler handler_;
+  ServerOptions options_;
+  TCPListener listener_;
+  AtomicFlag draining_;
+  // free connection slots if max_conns is set.
+  uint32 slots_;
+  WaitGroup loops_;
+  DISALLOW_COPY_AND_ASSIGN(ServerImpl);
+};
+
+class Server
+  : public scoped_refptr<ServerImpl> {
+ public:
+  Server() {
+  }
+
+  explicit Server(ServerImpl* t)
+    : scoped_refptr<ServerImpl>(t) {
+  }
+};
+
+inline Server MakeServer(const ConnHandler& handler,
+                         const ServerOptions& options = ServerOptions()) {
+  return Server(new ServerImpl(handler, options));
+}
+
+}  // namespace net
+}  // namespace tin
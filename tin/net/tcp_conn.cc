@@ -2,26 +2,208 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "build/build_config.h"
+#include "base/bind.h"
 #include "base/logging.h"
+#include "base/rand_util.h"
 
 #include "tin/net/sys_socket.h"
 #include "tin/error/error.h"
 #include "tin/time/time.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/spawn.h"
 #include "tin/net/netfd.h"
 #include "tin/net/tcp_conn.h"
 
 namespace tin {
 namespace net {
 
+namespace {
+const int kDefaultWriteQueueLow = 64 * 1024;
+const int kDefaultWriteQueueHigh = 256 * 1024;
+}  // namespace
+
+ConnTracker::ConnTracker()
+  : cond_(&mu_)
+  , active_(0)
+  , stats_enabled_(false)
+  , sample_period_(0)
+  , sample_count_(0) {
+  memset(&closed_, 0, sizeof(closed_));
+  memset(&tcp_info_, 0, sizeof(tcp_info_));
+}
+
+ConnTracker::~ConnTracker() {
+  sampler_.Cancel();
+  sampler_.Wait();
+}
+
+void ConnTracker::Add(NetStats* stats) {
+  MutexGuard guard(&mu_);
+  active_++;
+  if (stats != NULL)
+    live_.insert(stats);
+}
+
+void ConnTracker::Done(NetStats* stats) {
+  MutexGuard guard(&mu_);
+  DCHECK_GT(active_, 0);
+  if (stats != NULL) {
+    stats->AddTo(&closed_);
+    live_.erase(stats);
+  }
+  if (--active_ == 0)
+    cond_.Broascast();
+}
+
+void ConnTracker::EnableStats() {
+  MutexGuard guard(&mu_);
+  stats_enabled_ = true;
+}
+
+bool ConnTracker::StatsEnabled() {
+  MutexGuard guard(&mu_);
+  return stats_enabled_;
+}
+
+void ConnTracker::GetStats(NetStatsSnapshot* snapshot) {
+  MutexGuard guard(&mu_);
+  *snapshot = closed_;
+  for (std::set<NetStats*>::iterator it = live_.begin(); it != live_.end();
+       ++it) {
+    (*it)->AddTo(snapshot);
+  }
+}
+
+void ConnTracker::EnableTcpInfoSampling(int64 period_ns, int count) {
+  DCHECK_GT(period_ns, 0);
+  DCHECK_GT(count, 0);
+  {
+    MutexGuard guard(&mu_);
+    if (sample_period_ != 0)
+      return;
+    sample_period_ = period_ns;
+    sample_count_ = count;
+  }
+  sampler_.Spawn(SpawnOptions(0, "tcp_info_sampler"),
+                 base::Bind(&ConnTracker::SampleLoop, base::Unretained(this)));
+}
+
+void ConnTracker::GetTcpInfoStats(TcpInfoStats* stats) {
+  MutexGuard guard(&mu_);
+  *stats = tcp_info_;
+}
+
+bool ConnTracker::AddSampled(TcpConnImpl* conn) {
+  MutexGuard guard(&mu_);
+  if (sample_period_ == 0)
+    return false;
+  conn->sample_index_ = sampled_.size();
+  sampled_.push_back(conn);
+  return true;
+}
+
+void ConnTracker::RemoveSampled(TcpConnImpl* conn) {
+  MutexGuard guard(&mu_);
+  size_t i = conn->sample_index_;
+  DCHECK(sampled_[i] == conn);
+  sampled_[i] = sampled_.back();
+  sampled_[i]->sample_index_ = i;
+  sampled_.pop_back();
+}
+
+void ConnTracker::SampleLoop() {
+  while (!tin::Canceled()) {
+    tin::NanoSleep(sample_period_);
+    if (tin::Canceled())
+      return;
+    SampleRound();
+  }
+}
+
+void ConnTracker::SampleRound() {
+  TcpInfoStats round;
+  memset(&round, 0, sizeof(round));
+  int64 rtt_sum = 0;
+  uint64 cwnd_sum = 0;
+  int64 queue_sum = 0;
+  MutexGuard guard(&mu_);
+  size_t n = sampled_.size();
+  size_t count = std::min(n, static_cast<size_t>(sample_count_));
+  // the front of a partial shuffle, connections are kept from
+  // destruction by the lock, see RemoveSampled.
+  for (size_t i = 0; i < count; i++) {
+    size_t j = i + static_cast<size_t>(base::RandGenerator(n - i));
+    std::swap(sampled_[i], sampled_[j]);
+    sampled_[i]->sample_index_ = i;
+    sampled_[j]->sample_index_ = j;
+    TcpInfo info;
+    if (!sampled_[i]->Info(&info))
+      continue;
+    round.samples++;
+    rtt_sum += info.rtt_us;
+    round.rtt_us_max = std::max(round.rtt_us_max, info.rtt_us);
+    cwnd_sum += info.snd_cwnd;
+    round.total_retrans += info.total_retrans;
+    queue_sum += info.send_queue;
+    round.send_queue_max = std::max(round.send_queue_max, info.send_queue);
+  }
+  if (round.samples > 0) {
+    round.rtt_us_avg = rtt_sum / round.samples;
+    round.snd_cwnd_avg = static_cast<uint32>(cwnd_sum / round.samples);
+    round.send_queue_avg = queue_sum / round.samples;
+  }
+  round.rounds = tcp_info_.rounds + 1;
+  round.sampled_at = MonoNow();
+  tcp_info_ = round;
+}
+
+int ConnTracker::Active() {
+  MutexGuard guard(&mu_);
+  return active_;
+}
+
+bool ConnTracker::WaitIdle(int64 timeout) {
+  int64 deadline = timeout < 0 ? kint64max : MonoNow() + timeout;
+  MutexGuard guard(&mu_);
+  while (active_ > 0) {
+    if (timeout < 0) {
+      cond_.Wait();
+      continue;
+    }
+    int64 left = deadline - MonoNow();
+    if (left <= 0 || !cond_.WaitFor(left))
+      return active_ == 0;
+  }
+  return true;
+}
+
 TcpConnImpl::TcpConnImpl(NetFD* netfd)
-  : netfd_(netfd) ,
-    total_read_bytes_(0) {
+  : netfd_(netfd)
+  , total_read_bytes_(0)
+  , sampled_(false)
+  , sample_index_(0)
+  , wq_cond_(&wq_mu_)
+  , wq_bytes_(0)
+  , wq_low_(kDefaultWriteQueueLow)
+  , wq_high_(kDefaultWriteQueueHigh)
+  , wq_full_(false)
+  , wq_flushing_(false)
+  , wq_error_(0) {
 }
 
 TcpConnImpl::~TcpConnImpl() {
+  if (sampled_)
+    tracker_->RemoveSampled(this);
+  // before the fd goes, a sweep may be closing it.
+  SetIdleReaper(NULL);
   delete netfd_;
+  if (tracker_.get() != NULL)
+    tracker_->Done(stats_.get());
 }
 
 int TcpConnImpl::Read(void* buf, int nbytes) {
@@ -30,11 +212,28 @@ int TcpConnImpl::Read(void* buf, int nbytes) {
   int err = netfd_->Read(buf, nbytes, &nread);
   tin::SetErrorCode(TinTranslateSysError(err));
   if (nread > 0) {
-    total_read_bytes_ += total_read_bytes_;
+    total_read_bytes_ += nread;
+  }
+  return nread;
+}
+
+int TcpConnImpl::Readv(const tin::io::IOVec* iov, int iovcnt) {
+  int nread = 0;
+  int err = netfd_->Readv(iov, iovcnt, &nread);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  if (nread > 0) {
+    total_read_bytes_ += nread;
   }
   return nread;
 }
 
+int TcpConnImpl::Writev(const tin::io::IOVec* iov, int iovcnt) {
+  int nwritten = 0;
+  int err = netfd_->Writev(iov, iovcnt, &nwritten);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nwritten;
+}
+
 int TcpConnImpl::Write(const void* buf, int nbytes) {
   LOG_IF(FATAL, nbytes == 0) << "Write on zero buffer.";
   int nwritten = 0;
@@ -43,6 +242,201 @@ int TcpConnImpl::Write(const void* buf, int nbytes) {
   return nwritten;
 }
 
+int64 TcpConnImpl::SendFile(tin::file_t file, int64 offset, int64 len) {
+  int64 nsent = 0;
+  int err = netfd_->SendFile(file, offset, len, &nsent);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nsent;
+}
+
+int TcpConnImpl::WriteZeroCopy(tin::RefCountedIOBuffer* data) {
+  int nwritten = 0;
+  int err = netfd_->WriteZeroCopy(data, &nwritten);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nwritten;
+}
+
+int TcpConnImpl::ReadChain(tin::io::IOBufChain* chain, int max) {
+  LOG_IF(FATAL, max == 0) << "Read on zero buffer.";
+  char* ptr = NULL;
+  int len = 0;
+  chain->GetWritableTail(1, &ptr, &len);
+  int nread = Read(ptr, std::min(len, max));
+  chain->CommitTail(nread);
+  return nread;
+}
+
+tin::io::IOBufChain TcpConnImpl::ReadPooled(int max) {
+  LOG_IF(FATAL, max == 0) << "Read on zero buffer.";
+  tin::io::IOBufChain chain;
+  int nread = 0;
+  int err = netfd_->ReadPooled(&chain, max, &nread);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  if (nread > 0) {
+    total_read_bytes_ += nread;
+  }
+  return chain;
+}
+
+int TcpConnImpl::WriteChain(const tin::io::IOBufChain& chain) {
+  tin::io::IOBufChain rest(chain);
+  tin::io::IOVec iov[kMaxIOVecs];
+  int nwritten = 0;
+  int err = 0;
+  while (!rest.empty()) {
+    int cnt = rest.ToIOVecs(iov, kMaxIOVecs);
+    int n = 0;
+    err = netfd_->Writev(iov, cnt, &n);
+    nwritten += n;
+    if (err != 0)
+      break;
+    rest.TrimFront(n);
+  }
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nwritten;
+}
+
+bool TcpConnImpl::AsyncWrite(const void* buf, int nbytes) {
+  return Enqueue(NULL, buf, nbytes);
+}
+
+bool TcpConnImpl::AsyncWriteChain(const tin::io::IOBufChain& chain) {
+  return Enqueue(&chain, NULL, chain.size());
+}
+
+bool TcpConnImpl::Enqueue(const tin::io::IOBufChain* chain,
+                          const void* buf, int nbytes) {
+  MutexGuard guard(&wq_mu_);
+  if (wq_error_ != 0) {
+    tin::SetErrorCode(wq_error_);
+    return false;
+  }
+  if (wq_full_) {
+    tin::SetErrorCode(TIN_EAGAIN);
+    return false;
+  }
+  if (chain != NULL) {
+    wq_.Append(*chain);
+  } else {
+    wq_.Append(buf, nbytes);
+  }
+  wq_bytes_ += nbytes;
+  if (wq_bytes_ >= wq_high_)
+    wq_full_ = true;
+  if (!wq_flushing_ && !wq_.empty()) {
+    wq_flushing_ = true;
+    Spawn(&TcpConnImpl::FlushLoop, scoped_refptr<TcpConnImpl>(this));
+  }
+  tin::SetErrorCode(0);
+  return true;
+}
+
+void TcpConnImpl::FlushLoop() {
+  tin::io::IOVec iov[kMaxIOVecs];
+  MutexGuard guard(&wq_mu_);
+  while (!wq_.empty() && wq_error_ == 0) {
+    // producers append to the emptied queue meanwhile.
+    tin::io::IOBufChain batch = wq_.Split(wq_.size());
+    wq_mu_.Unlock();
+    int err = 0;
+    while (!batch.empty() && err == 0) {
+      int cnt = batch.ToIOVecs(iov, kMaxIOVecs);
+      int n = 0;
+      err = netfd_->Writev(iov, cnt, &n);
+      batch.TrimFront(n);
+      wq_mu_.Lock();
+      wq_bytes_ -= n;
+      if (wq_full_ && wq_bytes_ <= wq_low_) {
+        wq_full_ = false;
+        wq_cond_.Broascast();
+      }
+      wq_mu_.Unlock();
+    }
+    wq_mu_.Lock();
+    if (err != 0) {
+      // nothing queued will make it, a reconnect starts over.
+      wq_error_ = TinTranslateSysError(err);
+      wq_.clear();
+      wq_bytes_ = 0;
+    }
+  }
+  wq_flushing_ = false;
+  wq_cond_.Broascast();
+}
+
+void TcpConnImpl::SetWriteQueueWatermarks(int low, int high) {
+  DCHECK_LE(low, high);
+  MutexGuard guard(&wq_mu_);
+  wq_low_ = low;
+  wq_high_ = high;
+  wq_full_ = wq_bytes_ >= high;
+  wq_cond_.Broascast();
+}
+
+int TcpConnImpl::QueuedBytes() {
+  MutexGuard guard(&wq_mu_);
+  return wq_bytes_;
+}
+
+bool TcpConnImpl::Writable() {
+  MutexGuard guard(&wq_mu_);
+  return WritableLocked();
+}
+
+bool TcpConnImpl::WritableLocked() {
+  return !wq_full_ || wq_error_ != 0;
+}
+
+bool TcpConnImpl::FlushedLocked() {
+  return !wq_flushing_;
+}
+
+bool TcpConnImpl::WaitWritable(int64 timeout) {
+  MutexGuard guard(&wq_mu_);
+  return WaitQueue(&TcpConnImpl::WritableLocked, timeout);
+}
+
+bool TcpConnImpl::WaitFlushed(int64 timeout) {
+  MutexGuard guard(&wq_mu_);
+  return WaitQueue(&TcpConnImpl::FlushedLocked, timeout);
+}
+
+bool TcpConnImpl::WaitQueue(bool (TcpConnImpl::*pred)(), int64 timeout) {
+  int64 deadline = timeout < 0 ? kint64max : MonoNow() + timeout;
+  while (!(this->*pred)()) {
+    if (timeout < 0) {
+      wq_cond_.Wait();
+      continue;
+    }
+    int64 left = deadline - MonoNow();
+    if (left <= 0 || !wq_cond_.WaitFor(left)) {
+      if (!(this->*pred)()) {
+        tin::SetErrorCode(TIN_ETIMEDOUT);
+        return false;
+      }
+      break;
+    }
+  }
+  tin::SetErrorCode(wq_error_);
+  return wq_error_ == 0;
+}
+
+int64 TcpConnImpl::ReadFrom(tin::io::Reader* src) {
+#if defined(OS_LINUX)
+  if (src->ReaderKind() == tin::io::kStreamTcpConn) {
+    TcpConnImpl* peer = static_cast<TcpConnImpl*>(src);
+    int64 n = 0;
+    int err = netfd_->SpliceFrom(peer->netfd_, &n);
+    if (n > 0) {
+      peer->total_read_bytes_ += n;
+    }
+    tin::SetErrorCode(TinTranslateSysError(err));
+    return n;
+  }
+#endif
+  return tin::io::CopyBuffer(this, src);
+}
+
 void TcpConnImpl::SetDeadline(int64 t) {
   netfd_->SetDeadline(t);
 }
@@ -119,6 +513,74 @@ void TcpConnImpl::CloseWrite() {
   tin::SetErrorCode(err);
 }
 
+bool TcpConnImpl::IsIdleUsable() {
+  return netfd_ != NULL && netfd_->IdleCheck();
+}
+
+uintptr_t TcpConnImpl::SysFd() {
+  return netfd_->SysFd();
+}
+
+bool TcpConnImpl::WaitIO(bool write) {
+  int err = netfd_->WaitIO(write);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return err == 0;
+}
+
+bool TcpConnImpl::WaitIOAsync(bool write, const base::Closure& closure) {
+  int err = netfd_->WaitIOAsync(write, closure);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return err == 0;
+}
+
+bool TcpConnImpl::Info(TcpInfo* info) {
+  int err = netfd_->GetTcpInfo(info);
+  err = TinTranslateSysError(err);
+  tin::SetErrorCode(err);
+  return err == 0;
+}
+
+int TcpConnImpl::IncomingCpu() {
+#if defined(SO_INCOMING_CPU)
+  int cpu = -1;
+  socklen_t len = sizeof(cpu);
+  if (GetSockOpt(SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len))
+    return cpu;
+#endif
+  return -1;
+}
+
+bool TcpConnImpl::MovePoller(int proc_id) {
+  int err = netfd_->Pd()->Move(proc_id);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return err == 0;
+}
+
+void TcpConnImpl::SetExclusive() {
+  netfd_->SetExclusive();
+}
+
+void TcpConnImpl::Track(ConnTracker* tracker) {
+  DCHECK(tracker_.get() == NULL);
+  if (tracker->StatsEnabled()) {
+    stats_.reset(new NetStats);
+    netfd_->SetStats(stats_.get());
+  }
+  tracker->Add(stats_.get());
+  tracker_ = tracker;
+  sampled_ = tracker->AddSampled(this);
+}
+
+void TcpConnImpl::SetIdleReaper(IdleReaper* reaper) {
+  IdleReaper* old = netfd_->IdleLinks()->reaper;
+  if (old == reaper)
+    return;
+  if (old != NULL)
+    old->Remove(netfd_);
+  if (reaper != NULL)
+    reaper->Add(netfd_);
+}
+
 void TcpConnImpl::Close() {
   netfd_->Close();
 }
@@ -4,25 +4,98 @@
 
 #pragma once
 
+#include <set>
+#include <vector>
+
 #include "base/basictypes.h"
 #include "base/memory/scoped_ptr.h"
 #include "base/memory/ref_counted.h"
 #include "tin/time/time.h"
 #include "tin/io/io.h"
+#include "tin/io/ioutil.h"
+#include "tin/io/io_buffer.h"
+#include "tin/io/iobuf_chain.h"
+#include "tin/sync/mutex.h"
+#include "tin/sync/cond.h"
+#include "tin/sync/task_group.h"
+#include "tin/net/conn_alloc.h"
+#include "tin/net/net_stats.h"
+#include "tin/net/idle_reaper.h"
 
 namespace tin {
 namespace net {
 
 class NetFD;
+class TcpConnImpl;
+
+// counts the connections accepted by a listener until they are
+// destroyed, see TCPListenerImpl::Drain.
+class ConnTracker
+  : public base::RefCountedThreadSafe<ConnTracker> {
+ public:
+  ConnTracker();
+
+  // stats are the counters of the connection if StatsEnabled(), else NULL.
+  void Add(NetStats* stats);
+  void Done(NetStats* stats);
+
+  int Active();
+
+  // counts the io of connections tracked from now on. the counters stay
+  // 0 unless built with TIN_NET_STATS, see net_stats.h.
+  void EnableStats();
+  bool StatsEnabled();
+  // sums over the closed and the open connections.
+  void GetStats(NetStatsSnapshot* snapshot);
+
+  // waits until no connection is left, timeout is relative and -1 waits
+  // forever. false on timeout.
+  bool WaitIdle(int64 timeout);
+
+  // every period_ns takes TcpConnImpl::Info of up to count connections
+  // picked at random among those tracked from now on, for
+  // GetTcpInfoStats. a low rate keeps the syscalls off the io path. once.
+  void EnableTcpInfoSampling(int64 period_ns, int count);
+  // the last round, all 0 before the first.
+  void GetTcpInfoStats(TcpInfoStats* stats);
+
+ private:
+  friend class base::RefCountedThreadSafe<ConnTracker>;
+  friend class TcpConnImpl;
+  ~ConnTracker();
+
+  // false if not sampling.
+  bool AddSampled(TcpConnImpl* conn);
+  void RemoveSampled(TcpConnImpl* conn);
+  void SampleLoop();
+  void SampleRound();
+
+  Mutex mu_;
+  Cond cond_;
+  int active_;
+  bool stats_enabled_;
+  std::set<NetStats*> live_;
+  NetStatsSnapshot closed_;
+  // connections sampled, each knows its index.
+  std::vector<TcpConnImpl*> sampled_;
+  int64 sample_period_;
+  int sample_count_;
+  TcpInfoStats tcp_info_;
+  TaskGroup sampler_;
+  DISALLOW_COPY_AND_ASSIGN(ConnTracker);
+};
 
 class TcpConnImpl
   : public base::RefCountedThreadSafe<TcpConnImpl>
-  , public tin::io::IOReadWriter {
+  , public tin::io::IOReadWriter
+  , public tin::io::ReaderFrom {
  public:
   explicit TcpConnImpl(NetFD* netfd);
 
   virtual ~TcpConnImpl();
 
+  TIN_CONN_ALLOCATED()
+
   // note: Read full or partial on success, or read partial on failure.
   // return value : indicate n bytes written. n >= 0.
   // don't handle error based on return value.
@@ -35,6 +108,66 @@ class TcpConnImpl
   // detail error, see tin::GetErrorCode()
   int Write(const void* buf, int nbytes);
 
+  // scatter/gather versions of Read and Write with the same semantics,
+  // at most kMaxIOVecs segments per call.
+  int Readv(const tin::io::IOVec* iov, int iovcnt);
+
+  int Writev(const tin::io::IOVec* iov, int iovcnt);
+
+  // sends len bytes of file from offset straight from the page cache.
+  // the file position is left untouched. returns bytes sent, like Write.
+  int64 SendFile(tin::file_t file, int64 offset, int64 len);
+
+  // writes the readable bytes of data with MSG_ZEROCOPY where available,
+  // holding a reference until the kernel is done with the pages. worth it
+  // for large payloads only, data must not be modified meanwhile.
+  int WriteZeroCopy(tin::RefCountedIOBuffer* data);
+
+  // reads up to max bytes into fresh tail space of chain.
+  int ReadChain(tin::io::IOBufChain* chain, int max);
+
+  // waits for data without holding a buffer, then reads up to max bytes
+  // into pooled storage and returns them. errors via tin::GetErrorCode().
+  tin::io::IOBufChain ReadPooled(
+      int max = tin::io::kDefaultIOBufBlockSize);
+
+  // writes every slice of chain with gather writes, no payload copies.
+  int WriteChain(const tin::io::IOBufChain& chain);
+
+  // queues data for a flusher greenlet that writes as the socket drains
+  // and returns at once, so fan-out needs no writer greenlet per
+  // connection. data is taken whole. false with nothing queued while
+  // above the high watermark (TIN_EAGAIN) or after a failed write, which
+  // left its error for every later call. do not mix with Write while
+  // data is queued.
+  bool AsyncWrite(const void* buf, int nbytes);
+  bool AsyncWriteChain(const tin::io::IOBufChain& chain);
+
+  // AsyncWrite refuses data once high bytes are queued, until the queue
+  // fell to low. 64K and 256K by default.
+  void SetWriteQueueWatermarks(int low, int high);
+
+  // bytes queued and not yet written.
+  int QueuedBytes();
+
+  // false while AsyncWrite would refuse data.
+  bool Writable();
+
+  // waits for Writable(), timeout is relative and -1 waits forever.
+  // false on timeout or a failed write.
+  bool WaitWritable(int64 timeout);
+
+  // waits until everything queued is written, e.g. before Close.
+  bool WaitFlushed(int64 timeout);
+
+  // copies src into this connection until EOF. another TcpConn is
+  // spliced through a kernel pipe on linux, without touching user space.
+  virtual int64 ReadFrom(tin::io::Reader* src);
+
+  virtual tin::io::ReaderFrom* AsReaderFrom() { return this; }
+  virtual int ReaderKind() const { return tin::io::kStreamTcpConn; }
+  virtual int WriterKind() const { return tin::io::kStreamTcpConn; }
+
   void SetDeadline(int64 t);
 
   void SetReadDeadline(int64 t);
@@ -55,6 +188,51 @@ class TcpConnImpl
 
   bool SetSockOpt(int level, int name, const void* optval, socklen_t optlen);
 
+  // false if the peer closed or sent data while the connection sat
+  // unused, see ConnPool.
+  bool IsIdleUsable();
+
+  // the socket, to pass to another process with UnixConnImpl::WriteFds.
+  // stays owned by this connection.
+  uintptr_t SysFd();
+
+  // waits until SysFd is readable, or writable if write, for io done on
+  // it directly. false with the error code set on a deadline or close,
+  // not supported on windows.
+  bool WaitIO(bool write);
+
+  // parks the connection instead of a greenlet, for the many idle ones of
+  // a gateway: closure is posted as a new greenlet once WaitIO would
+  // return, and may call WaitIO and read then. bind a ref of the
+  // connection into closure, false with the error code set if it already
+  // is closed or past its deadline. not supported on windows.
+  bool WaitIOAsync(bool write, const base::Closure& closure);
+
+  // kernel congestion state: TCP_INFO, SIO_TCP_INFO on windows. false with
+  // the error code set if not supported or closed.
+  bool Info(TcpInfo* info);
+
+  // the cpu the NIC steers this flow to, SO_INCOMING_CPU on linux. -1 if
+  // not known.
+  int IncomingCpu();
+
+  // polled next to P proc_id from now on, for a connection handed to a
+  // greenlet there before it did any io.
+  bool MovePoller(int proc_id);
+
+  // one reader and one writer greenlet at a time, each Read and Write
+  // skips the fd lock, see FdMutex::SetExclusive. not with AsyncWrite
+  // and Write mixed. call before the connection is shared.
+  void SetExclusive();
+
+  // counted by tracker for the lifetime of this connection.
+  void Track(ConnTracker* tracker);
+
+  // closed by reaper once it did no io for the idle time of reaper, in
+  // place of a read deadline. NULL stops it. from the owner of the
+  // connection, which is taken off reaper when it is destroyed.
+  void SetIdleReaper(IdleReaper* reaper);
+
   void CloseRead();
 
   void CloseWrite();
@@ -66,14 +244,46 @@ class TcpConnImpl
   }
 
  private:
+  friend class ConnTracker;
+
+  // chain, or buf if chain is NULL.
+  bool Enqueue(const tin::io::IOBufChain* chain, const void* buf,
+               int nbytes);
+  // wq_mu_ held, wait until pred or timeout.
+  bool WaitQueue(bool (TcpConnImpl::*pred)(), int64 timeout);
+  bool WritableLocked();
+  bool FlushedLocked();
+  void FlushLoop();
+
   NetFD* netfd_;
   int64 total_read_bytes_;
+  scoped_refptr<ConnTracker> tracker_;
+  scoped_ptr<NetStats> stats_;
+  // on the sampled list of tracker_, at sample_index_ guarded by its lock.
+  bool sampled_;
+  size_t sample_index_;
+
+  // AsyncWrite queue, guarded by wq_mu_.
+  Mutex wq_mu_;
+  Cond wq_cond_;
+  tin::io::IOBufChain wq_;
+  // queued plus taken by the flusher and not yet written.
+  int wq_bytes_;
+  int wq_low_;
+  int wq_high_;
+  // above high, cleared at low.
+  bool wq_full_;
+  bool wq_flushing_;
+  int wq_error_;
   DISALLOW_COPY_AND_ASSIGN(TcpConnImpl);
 };
 
 class TcpConn
   : public scoped_refptr<TcpConnImpl> {
  public:
+  TcpConn() {
+  }
+
   explicit TcpConn(TcpConnImpl* t)
     : scoped_refptr<TcpConnImpl>(t) {
   }
@@ -0,0 +1,519 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include <algorithm>
+
+#include "build/build_config.h"
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/blocking.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/runtime/spawn.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/sync/wait_group.h"
+#include "tin/io/ioutil.h"
+
+#include "tin/net/tls_conn.h"
+
+#if defined(OS_LINUX) && defined(SSL_OP_ENABLE_KTLS) && \
+    !defined(OPENSSL_NO_KTLS)
+#define TIN_KTLS 1
+#endif
+
+namespace tin {
+namespace net {
+
+namespace {
+
+// a full record with its overhead.
+const int kTlsBufSize = 16 * 1024 + 512;
+
+void LogSslErrors(const char* what) {
+  unsigned long e;
+  while ((e = ERR_get_error()) != 0) {
+    char buf[256];
+    ERR_error_string_n(e, buf, sizeof(buf));
+    VLOG(1) << what << ": " << buf;
+  }
+}
+
+// a client got a session or a ticket to resume with.
+int OnNewSession(SSL* ssl, SSL_SESSION* session) {
+  TlsConnImpl* conn = static_cast<TlsConnImpl*>(SSL_get_app_data(ssl));
+  if (conn == NULL || conn->server_name().empty())
+    return 0;
+  // may run in a BlockingSection, the cache lock could park.
+  conn->OnNewSession(session);
+  return 1;
+}
+
+int DoHandshake(SSL* ssl, bool blocking) {
+  if (blocking) {
+    BlockingSection section;
+    return SSL_do_handshake(ssl);
+  }
+  return SSL_do_handshake(ssl);
+}
+
+}  // namespace
+
+TlsContext::TlsContext(SSL_CTX* ctx, const TlsOptions& options)
+  : ctx_(ctx)
+  , options_(options)
+  , handshake_slots_(std::max(options.max_handshakes, 0)) {
+}
+
+TlsContext::~TlsContext() {
+  for (std::map<std::string, SSL_SESSION*>::iterator it = sessions_.begin();
+       it != sessions_.end(); ++it) {
+    SSL_SESSION_free(it->second);
+  }
+  SSL_CTX_free(ctx_);
+}
+
+SSL_SESSION* TlsContext::GetSession(const std::string& key) {
+  MutexGuard guard(&mu_);
+  std::map<std::string, SSL_SESSION*>::iterator it = sessions_.find(key);
+  if (it == sessions_.end())
+    return NULL;
+  SSL_SESSION_up_ref(it->second);
+  return it->second;
+}
+
+void TlsContext::PutSession(const std::string& key, SSL_SESSION* session) {
+  MutexGuard guard(&mu_);
+  std::map<std::string, SSL_SESSION*>::iterator it = sessions_.find(key);
+  if (it != sessions_.end()) {
+    SSL_SESSION_free(it->second);
+    it->second = session;
+    return;
+  }
+  while (!order_.empty() &&
+         static_cast<int>(sessions_.size()) >= options_.session_cache_size) {
+    it = sessions_.find(order_.front());
+    SSL_SESSION_free(it->second);
+    sessions_.erase(it);
+    order_.pop_front();
+  }
+  if (options_.session_cache_size <= 0) {
+    SSL_SESSION_free(session);
+    return;
+  }
+  sessions_[key] = session;
+  order_.push_back(key);
+}
+
+void TlsContext::AcquireHandshake() {
+  if (options_.max_handshakes > 0)
+    runtime::SemAcquire(&handshake_slots_);
+}
+
+void TlsContext::ReleaseHandshake() {
+  if (options_.max_handshakes > 0)
+    runtime::SemRelease(&handshake_slots_);
+}
+
+TlsContext* NewTlsContext(const TlsOptions& options) {
+  SSL_CTX* ctx = SSL_CTX_new(options.server ? TLS_server_method() :
+                                              TLS_client_method());
+  if (ctx == NULL) {
+    LogSslErrors("SSL_CTX_new");
+    SetErrorCode(TIN_ENOMEM);
+    return NULL;
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  long opts = SSL_OP_NO_COMPRESSION;
+#if defined(SSL_OP_NO_RENEGOTIATION)
+  // a renegotiation would need a read inside Write.
+  opts |= SSL_OP_NO_RENEGOTIATION;
+#endif
+  if (!options.session_tickets)
+    opts |= SSL_OP_NO_TICKET;
+#if defined(TIN_KTLS)
+  if (options.ktls)
+    opts |= SSL_OP_ENABLE_KTLS;
+#endif
+  SSL_CTX_set_options(ctx, opts);
+  SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+  bool ok = true;
+  if (options.server) {
+    static const unsigned char kSessionContext[] = "tin";
+    SSL_CTX_set_session_id_context(ctx, kSessionContext,
+                                   sizeof(kSessionContext) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, std::max(options.session_cache_size, 0));
+    ok = SSL_CTX_use_certificate_chain_file(
+            ctx, options.cert_file.c_str()) == 1 &&
+         SSL_CTX_use_PrivateKey_file(
+            ctx, options.key_file.c_str(), SSL_FILETYPE_PEM) == 1 &&
+         SSL_CTX_check_private_key(ctx) == 1;
+  } else {
+    // the sessions live in TlsContext, keyed by server name.
+    SSL_CTX_set_session_cache_mode(
+        ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &OnNewSession);
+    if (options.verify_peer) {
+      SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+      ok = options.ca_file.empty() ?
+             SSL_CTX_set_default_verify_paths(ctx) == 1 :
+             SSL_CTX_load_verify_locations(
+                ctx, options.ca_file.c_str(), NULL) == 1;
+    }
+  }
+  if (!ok) {
+    LogSslErrors("loading certificates");
+    SSL_CTX_free(ctx);
+    SetErrorCode(TIN_EINVAL);
+    return NULL;
+  }
+  SetErrorCode(0);
+  return new TlsContext(ctx, options);
+}
+
+TlsConnImpl::TlsConnImpl(TlsContext* context, TcpConn conn,
+                         const std::string& server_name)
+  : context_(context)
+  , conn_(conn)
+  , server_name_(server_name)
+  , ssl_(SSL_new(context->ctx()))
+  , rbio_(NULL)
+  , wbio_(NULL)
+  , handshaken_(false)
+  , new_session_(NULL) {
+  CHECK(ssl_ != NULL);
+  SSL_set_app_data(ssl_, this);
+  bool socket_bio = false;
+#if defined(TIN_KTLS)
+  socket_bio = context->options().ktls;
+#endif
+  if (socket_bio) {
+    BIO* bio = BIO_new_socket(static_cast<int>(conn_->SysFd()), BIO_NOCLOSE);
+    SSL_set_bio(ssl_, bio, bio);
+  } else {
+    rbio_ = BIO_new(BIO_s_mem());
+    wbio_ = BIO_new(BIO_s_mem());
+    // the engine owns both, an empty rbio wants a read instead of EOF.
+    BIO_set_mem_eof_return(rbio_, -1);
+    SSL_set_bio(ssl_, rbio_, wbio_);
+    in_buf_.reset(new char[kTlsBufSize]);
+    out_buf_.reset(new char[kTlsBufSize]);
+  }
+  if (context->options().server) {
+    SSL_set_accept_state(ssl_);
+  } else {
+    SSL_set_connect_state(ssl_);
+    if (!server_name_.empty()) {
+      SSL_set_tlsext_host_name(ssl_, server_name_.c_str());
+      if (context->options().verify_peer) {
+        X509_VERIFY_PARAM_set1_host(SSL_get0_param(ssl_),
+                                    server_name_.c_str(), 0);
+      }
+      SSL_SESSION* session = context->GetSession(server_name_);
+      if (session != NULL) {
+        SSL_set_session(ssl_, session);
+        SSL_SESSION_free(session);
+      }
+    }
+  }
+}
+
+TlsConnImpl::~TlsConnImpl() {
+  if (new_session_ != NULL)
+    SSL_SESSION_free(new_session_);
+  SSL_free(ssl_);
+}
+
+void TlsConnImpl::OnNewSession(SSL_SESSION* session) {
+  if (new_session_ != NULL)
+    SSL_SESSION_free(new_session_);
+  new_session_ = session;
+}
+
+void TlsConnImpl::SaveSession() {
+  mu_.Lock();
+  SSL_SESSION* session = new_session_;
+  new_session_ = NULL;
+  mu_.Unlock();
+  if (session != NULL)
+    context_->PutSession(server_name_, session);
+}
+
+bool TlsConnImpl::Handshake() {
+  int err = 0;
+  if (context_->options().handshake_mode == kTlsHandshakeBatch &&
+      runtime::GetG()->Priority() != kPriorityBatch) {
+    WaitGroup done(1);
+    SpawnOptions opts;
+    opts.priority = kPriorityBatch;
+    Spawn(opts, &TlsConnImpl::BatchHandshake, this, &done, &err);
+    done.Wait();
+  } else {
+    MutexGuard read_guard(&read_mu_);
+    MutexGuard write_guard(&write_mu_);
+    err = HandshakeLocked();
+  }
+  SetErrorCode(err);
+  return err == 0;
+}
+
+void TlsConnImpl::BatchHandshake(WaitGroup* done, int* err) {
+  {
+    MutexGuard read_guard(&read_mu_);
+    MutexGuard write_guard(&write_mu_);
+    *err = HandshakeLocked();
+  }
+  done->Done();
+}
+
+int TlsConnImpl::HandshakeLocked() {
+  bool blocking =
+    context_->options().handshake_mode == kTlsHandshakeBlocking;
+  while (!handshaken_) {
+    if (blocking)
+      context_->AcquireHandshake();
+    mu_.Lock();
+    ERR_clear_error();
+    int rv = DoHandshake(ssl_, blocking);
+    int ssl_err = rv == 1 ? SSL_ERROR_NONE : SSL_get_error(ssl_, rv);
+    mu_.Unlock();
+    if (blocking)
+      context_->ReleaseHandshake();
+    int err = Continue(ssl_err, kHoldRead | kHoldWrite);
+    if (err != 0)
+      return err;
+    handshaken_ = ssl_err == SSL_ERROR_NONE;
+  }
+  return 0;
+}
+
+int TlsConnImpl::Read(void* buf, int nbytes) {
+  if (!handshaken_ && !Handshake())
+    return 0;
+  MutexGuard guard(&read_mu_);
+  int err = 0;
+  int n = 0;
+  while (true) {
+    mu_.Lock();
+    ERR_clear_error();
+    n = SSL_read(ssl_, buf, nbytes);
+    int ssl_err = n > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl_, n);
+    mu_.Unlock();
+    err = Continue(ssl_err, kHoldRead);
+    if (err != 0 || n > 0)
+      break;
+  }
+  SetErrorCode(err);
+  return n > 0 ? n : 0;
+}
+
+int TlsConnImpl::Write(const void* buf, int nbytes) {
+  if (!handshaken_ && !Handshake())
+    return 0;
+  MutexGuard guard(&write_mu_);
+  const char* p = static_cast<const char*>(buf);
+  int written = 0;
+  int err = 0;
+  while (written < nbytes) {
+    mu_.Lock();
+    ERR_clear_error();
+    int n = SSL_write(ssl_, p + written, nbytes - written);
+    int ssl_err = n > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl_, n);
+    mu_.Unlock();
+    if (n > 0)
+      written += n;
+    err = Continue(ssl_err, kHoldWrite);
+    if (err != 0)
+      break;
+  }
+  SetErrorCode(err);
+  return written;
+}
+
+int64 TlsConnImpl::SendFile(tin::file_t file, int64 offset, int64 len) {
+  if (!handshaken_ && !Handshake())
+    return 0;
+  int64 sent = 0;
+#if defined(TIN_KTLS)
+  if (KtlsSend()) {
+    MutexGuard guard(&write_mu_);
+    int err = 0;
+    while (sent < len) {
+      mu_.Lock();
+      ERR_clear_error();
+      ossl_ssize_t n = SSL_sendfile(ssl_, file, offset + sent,
+                                    static_cast<size_t>(len - sent), 0);
+      int ssl_err = n > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl_, n);
+      mu_.Unlock();
+      if (n > 0)
+        sent += n;
+      err = Continue(ssl_err, kHoldWrite);
+      if (err != 0)
+        break;
+    }
+    SetErrorCode(err);
+    return sent;
+  }
+#endif
+  scoped_ptr<char[]> buf(new char[kTlsBufSize]);
+  while (sent < len) {
+    int want = static_cast<int>(std::min<int64>(len - sent, kTlsBufSize));
+    int n = tin::ReadAt(file, buf.get(), want, offset + sent);
+    if (n <= 0) {
+      if (n == 0)
+        SetErrorCode(TIN_UNEXPECTED_EOF);
+      break;
+    }
+    int w = Write(buf.get(), n);
+    sent += w;
+    if (w != n)
+      break;
+  }
+  return sent;
+}
+
+bool TlsConnImpl::Resumed() {
+  MutexGuard guard(&mu_);
+  return SSL_session_reused(ssl_) == 1;
+}
+
+bool TlsConnImpl::KtlsSend() {
+#if defined(TIN_KTLS)
+  MutexGuard guard(&mu_);
+  return rbio_ == NULL && BIO_get_ktls_send(SSL_get_wbio(ssl_)) == 1;
+#else
+  return false;
+#endif
+}
+
+bool TlsConnImpl::KtlsRecv() {
+#if defined(TIN_KTLS)
+  MutexGuard guard(&mu_);
+  return rbio_ == NULL && BIO_get_ktls_recv(SSL_get_rbio(ssl_)) == 1;
+#else
+  return false;
+#endif
+}
+
+void TlsConnImpl::Close() {
+  if (handshaken_) {
+    MutexGuard guard(&write_mu_);
+    mu_.Lock();
+    ERR_clear_error();
+    // best effort, the peer may already be gone.
+    SSL_shutdown(ssl_);
+    mu_.Unlock();
+    if (wbio_ != NULL)
+      FlushLocked();
+  }
+  conn_->Close();
+}
+
+int TlsConnImpl::Continue(int ssl_err, int held) {
+  SaveSession();
+  // before anything parks, the error queue is per thread.
+  int fatal = 0;
+  if (ssl_err != SSL_ERROR_NONE && ssl_err != SSL_ERROR_WANT_READ &&
+      ssl_err != SSL_ERROR_WANT_WRITE) {
+    fatal = SslError(ssl_err);
+  }
+  int err = 0;
+  if (wbio_ != NULL) {
+    if (held & kHoldWrite) {
+      err = FlushLocked();
+    } else {
+      mu_.Lock();
+      bool pending = BIO_ctrl_pending(wbio_) > 0;
+      mu_.Unlock();
+      if (pending) {
+        // e.g. a key update the read produced.
+        MutexGuard guard(&write_mu_);
+        err = FlushLocked();
+      }
+    }
+    if (err != 0)
+      return err;
+  }
+  if (fatal != 0)
+    return fatal;
+  switch (ssl_err) {
+    case SSL_ERROR_NONE:
+      return 0;
+    case SSL_ERROR_WANT_READ:
+      if (rbio_ == NULL)
+        return conn_->WaitIO(false) ? 0 : GetErrorCode();
+      if (!(held & kHoldRead))
+        return TIN_EBADPROTOCOL;
+      return Fill();
+    case SSL_ERROR_WANT_WRITE:
+      if (rbio_ == NULL)
+        return conn_->WaitIO(true) ? 0 : GetErrorCode();
+      return 0;
+    default:
+      return 0;
+  }
+}
+
+int TlsConnImpl::FlushLocked() {
+  while (true) {
+    mu_.Lock();
+    int n = BIO_read(wbio_, out_buf_.get(), kTlsBufSize);
+    mu_.Unlock();
+    if (n <= 0)
+      return 0;
+    if (conn_->Write(out_buf_.get(), n) != n)
+      return GetErrorCode();
+  }
+}
+
+int TlsConnImpl::Fill() {
+  int n = conn_->Read(in_buf_.get(), kTlsBufSize);
+  int err = GetErrorCode();
+  if (n > 0) {
+    mu_.Lock();
+    BIO_write(rbio_, in_buf_.get(), n);
+    mu_.Unlock();
+    return 0;
+  }
+  // a clean end is a close_notify, the engine reports it itself.
+  return err == TIN_EOF ? TIN_UNEXPECTED_EOF : err;
+}
+
+int TlsConnImpl::SslError(int ssl_err) {
+  switch (ssl_err) {
+    case SSL_ERROR_ZERO_RETURN:
+      return TIN_EOF;
+    case SSL_ERROR_SYSCALL:
+      if (ERR_peek_error() == 0)
+        return TIN_UNEXPECTED_EOF;
+      break;
+    default:
+      break;
+  }
+  LogSslErrors("tls");
+  return TIN_EBADPROTOCOL;
+}
+
+TlsConn TlsClient(TlsContext* context, TcpConn conn,
+                  const std::string& server_name) {
+  TlsConn tls(new TlsConnImpl(context, conn, server_name));
+  if (!tls->Handshake())
+    return TlsConn();
+  return tls;
+}
+
+TlsConn TlsServer(TlsContext* context, TcpConn conn) {
+  TlsConn tls(new TlsConnImpl(context, conn, ""));
+  if (!tls->Handshake())
+    return TlsConn();
+  return tls;
+}
+
+}  // namespace net
+}  // namespace tin
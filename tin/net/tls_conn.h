@@ -0,0 +1,229 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include "base/basictypes.h"
+#include "base/memory/ref_counted.h"
+#include "base/memory/scoped_ptr.h"
+#include "tin/io/io.h"
+#include "tin/sync/mutex.h"
+#include "tin/net/tcp_conn.h"
+
+// OpenSSL and BoringSSL both name their types so.
+struct ssl_ctx_st;
+struct ssl_st;
+struct bio_st;
+struct ssl_session_st;
+
+namespace tin {
+
+class WaitGroup;
+
+namespace net {
+
+// where the handshake crypto runs. an RSA or ECDHE handshake takes
+// hundreds of micro seconds, inline it delays every greenlet queued on
+// the P behind it.
+enum TlsHandshakeMode {
+  kTlsHandshakeInline = 0,
+  // on a kPriorityBatch greenlet, which runs only when no latency
+  // greenlet is runnable, the caller waits for it.
+  kTlsHandshakeBatch,
+  // each crypto step in a BlockingSection, so sysmon hands the P to
+  // another M if it runs long. at most max_handshakes at once.
+  kTlsHandshakeBlocking
+};
+
+struct TlsOptions {
+  TlsOptions()
+    : server(false)
+    , verify_peer(true)
+    , session_cache_size(1024)
+    , session_tickets(true)
+    , ktls(false)
+    , handshake_mode(kTlsHandshakeInline)
+    , max_handshakes(0) {
+  }
+
+  bool server;
+  // PEM files, required for a server.
+  std::string cert_file;
+  std::string key_file;
+  // PEM bundle to verify the peer with, empty is the system default.
+  std::string ca_file;
+  // clients check the certificate and the server name.
+  bool verify_peer;
+  // sessions kept for resumption, by session id on a server and by
+  // server name on a client.
+  int session_cache_size;
+  // stateless resumption, the server seals the session into a ticket.
+  bool session_tickets;
+  // lets the kernel do the record crypto once the handshake is done, so
+  // TlsConnImpl::SendFile stays zero copy. needs linux and an OpenSSL 3
+  // built with ktls, silently off else.
+  bool ktls;
+  // a TlsHandshakeMode.
+  int handshake_mode;
+  // handshake steps in a BlockingSection at once, 0 is no limit. bounds
+  // the Ms a handshake storm can take.
+  int max_handshakes;
+};
+
+// an SSL_CTX and the client session cache, shared by the connections.
+class TlsContext
+  : public base::RefCountedThreadSafe<TlsContext> {
+ public:
+  ssl_ctx_st* ctx() const {
+    return ctx_;
+  }
+
+  const TlsOptions& options() const {
+    return options_;
+  }
+
+  // a reference the caller frees, NULL if none is cached for key.
+  ssl_session_st* GetSession(const std::string& key);
+  // takes the reference of session.
+  void PutSession(const std::string& key, ssl_session_st* session);
+
+  // bound kTlsHandshakeBlocking steps, see max_handshakes.
+  void AcquireHandshake();
+  void ReleaseHandshake();
+
+ private:
+  friend class base::RefCountedThreadSafe<TlsContext>;
+  friend TlsContext* NewTlsContext(const TlsOptions& options);
+
+  TlsContext(ssl_ctx_st* ctx, const TlsOptions& options);
+  ~TlsContext();
+
+  ssl_ctx_st* ctx_;
+  TlsOptions options_;
+  Mutex mu_;
+  std::map<std::string, ssl_session_st*> sessions_;
+  // insertion order, the oldest is evicted first.
+  std::deque<std::string> order_;
+  uint32 handshake_slots_;
+  DISALLOW_COPY_AND_ASSIGN(TlsContext);
+};
+
+// NULL with the error code set if the certificates can't be loaded.
+TlsContext* NewTlsContext(const TlsOptions& options);
+
+// TLS over a TcpConn. the engine talks to memory BIOs and the records go
+// through the connection, so deadlines, stats and pooled reads apply as
+// usual. with ktls the engine works on the socket instead and hands the
+// keys to the kernel after the handshake.
+//
+// one Read and one Write may run at once, from different greenlets.
+class TlsConnImpl
+  : public base::RefCountedThreadSafe<TlsConnImpl>
+  , public tin::io::IOReadWriter {
+ public:
+  // a client sends server_name as SNI, verifies the certificate against
+  // it and keys its cached session by it. a server passes "".
+  TlsConnImpl(TlsContext* context, TcpConn conn,
+              const std::string& server_name);
+  virtual ~TlsConnImpl();
+
+  // Read and Write do it on first use too. false with the error code
+  // set, TIN_EBADPROTOCOL if the peer did not speak TLS or failed
+  // verification.
+  bool Handshake();
+
+  // TIN_EOF after the peer's close_notify, TIN_UNEXPECTED_EOF if the
+  // connection ended without one.
+  virtual int Read(void* buf, int nbytes);
+  virtual int Write(const void* buf, int nbytes);
+
+  // through sendfile if the kernel does the crypto, else read into a
+  // buffer and encrypted here.
+  int64 SendFile(tin::file_t file, int64 offset, int64 len);
+
+  // the handshake resumed a cached session or a ticket.
+  bool Resumed();
+  // the kernel encrypts, decrypts.
+  bool KtlsSend();
+  bool KtlsRecv();
+
+  // sends close_notify and closes the connection.
+  void Close();
+
+  TcpConn conn() const {
+    return conn_;
+  }
+
+  const std::string& server_name() const {
+    return server_name_;
+  }
+
+  // the engine got a session to resume with, takes its reference. called
+  // inside an SSL call, the cache is updated once it returned.
+  void OnNewSession(ssl_session_st* session);
+
+ private:
+  enum {
+    kHoldRead = 1,
+    kHoldWrite = 2
+  };
+
+  // after an SSL call that returned ssl_err with the held io locks: sends
+  // what the engine produced and waits for what it needs. 0 to go on.
+  int Continue(int ssl_err, int held);
+  // write_mu_ held, moves the engine output to the connection.
+  int FlushLocked();
+  // read_mu_ held, feeds the engine from the connection.
+  int Fill();
+  int SslError(int ssl_err);
+  // read_mu_ and write_mu_ held.
+  int HandshakeLocked();
+  void BatchHandshake(WaitGroup* done, int* err);
+  // a session the engine handed to OnNewSession, cached outside mu_.
+  void SaveSession();
+
+  scoped_refptr<TlsContext> context_;
+  TcpConn conn_;
+  std::string server_name_;
+  ssl_st* ssl_;
+  // the network side of the memory BIOs, NULL on the socket.
+  bio_st* rbio_;
+  bio_st* wbio_;
+  bool handshaken_;
+  // guarded by mu_.
+  ssl_session_st* new_session_;
+  // guards ssl_, never held while parking.
+  Mutex mu_;
+  // serialize the reads and the writes, taken before mu_.
+  Mutex read_mu_;
+  Mutex write_mu_;
+  scoped_ptr<char[]> in_buf_;
+  scoped_ptr<char[]> out_buf_;
+  DISALLOW_COPY_AND_ASSIGN(TlsConnImpl);
+};
+
+class TlsConn
+  : public scoped_refptr<TlsConnImpl> {
+ public:
+  TlsConn() {
+  }
+
+  explicit TlsConn(TlsConnImpl* t)
+    : scoped_refptr<TlsConnImpl>(t) {
+  }
+};
+
+// runs the handshake as a client, NULL with the error code set if it
+// fails.
+TlsConn TlsClient(TlsContext* context, TcpConn conn,
+                  const std::string& server_name);
+// the server side, e.g. from a ConnHandler of tin::net::Server.
+TlsConn TlsServer(TlsContext* context, TcpConn conn);
+
+}  // namespace net
+}  // namespace tin
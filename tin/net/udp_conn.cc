@@ -0,0 +1,146 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+#include "tin/net/netfd.h"
+
+#include "tin/net/udp_conn.h"
+
+namespace tin {
+namespace net {
+
+UdpConnImpl::UdpConnImpl(NetFD* netfd)
+  : netfd_(netfd) {
+}
+
+UdpConnImpl::~UdpConnImpl() {
+  delete netfd_;
+}
+
+int UdpConnImpl::Read(void* buf, int nbytes) {
+  int nread = 0;
+  // not NetFD::Read, a short datagram says nothing about the queue.
+  int err = netfd_->ReadFrom(buf, nbytes, &nread, NULL);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nread;
+}
+
+int UdpConnImpl::Write(const void* buf, int nbytes) {
+  int nwritten = 0;
+  int err = netfd_->Write(buf, nbytes, &nwritten);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nwritten;
+}
+
+int UdpConnImpl::ReadFrom(void* buf, int nbytes, IPEndPoint* from) {
+  int nread = 0;
+  int err = netfd_->ReadFrom(buf, nbytes, &nread, from);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nread;
+}
+
+int UdpConnImpl::WriteTo(const void* buf, int nbytes, const IPEndPoint& to) {
+  int nwritten = 0;
+  int err = netfd_->WriteTo(buf, nbytes, to, &nwritten);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nwritten;
+}
+
+int UdpConnImpl::ReadBatch(UdpMessage* msgs, int n) {
+  int nmsgs = 0;
+  int err = netfd_->ReadMsgs(msgs, n, &nmsgs);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nmsgs;
+}
+
+int UdpConnImpl::WriteBatch(UdpMessage* msgs, int n) {
+  int nmsgs = 0;
+  int err = netfd_->WriteMsgs(msgs, n, &nmsgs);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nmsgs;
+}
+
+bool UdpConnImpl::EnableGro() {
+  return netfd_->EnableGro();
+}
+
+void UdpConnImpl::SetDeadline(int64 t) {
+  netfd_->SetDeadline(t);
+}
+
+void UdpConnImpl::SetReadDeadline(int64 t) {
+  netfd_->SetReadDeadline(t);
+}
+
+void UdpConnImpl::SetWriteDeadline(int64 t) {
+  netfd_->SetWriteDeadline(t);
+}
+
+void UdpConnImpl::SetReadBuffer(int bytes) {
+  (void)netfd_->SetSockOpt(SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+}
+
+void UdpConnImpl::SetWriteBuffer(int bytes) {
+  (void)netfd_->SetSockOpt(SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+}
+
+void UdpConnImpl::Close() {
+  netfd_->Close();
+}
+
+UdpConn ListenUdp(const IPAddress& address, uint16 port) {
+  int err = 0;
+  AddressFamily family =
+    address.IsIPv4() ? ADDRESS_FAMILY_IPV4 : ADDRESS_FAMILY_IPV6;
+  NetFD* netfd = NewFD(family, SOCK_DGRAM, &err);
+  if (netfd != NULL) {
+    err = netfd->Init();
+    if (err == 0) {
+      IPEndPoint endpoint(address, port);
+      err = netfd->Bind(endpoint);
+    }
+    if (err != 0) {
+      delete netfd;
+      netfd = NULL;
+    }
+  }
+  SetErrorCode(TinTranslateSysError(err));
+  if (netfd == NULL)
+    return UdpConn(NULL);
+  return UdpConn(new UdpConnImpl(netfd));
+}
+
+UdpConn ListenUdp(const base::StringPiece& address, uint16 port) {
+  IPAddress ip_address;
+  if (!ip_address.AssignFromIPLiteral(address)) {
+    SetErrorCode(TIN_EINVAL);
+    return UdpConn(NULL);
+  }
+  return ListenUdp(ip_address, port);
+}
+
+UdpConn DialUdp(const IPAddress& address, uint16 port) {
+  int err = 0;
+  AddressFamily family =
+    address.IsIPv4() ? ADDRESS_FAMILY_IPV4 : ADDRESS_FAMILY_IPV6;
+  NetFD* netfd = NewFD(family, SOCK_DGRAM, &err);
+  if (netfd != NULL) {
+    IPEndPoint endpoint(address, port);
+    // connect on a datagram socket returns at once.
+    err = netfd->Dial(NULL, &endpoint, kint64max);
+    if (err != 0) {
+      delete netfd;
+      netfd = NULL;
+    }
+  }
+  SetErrorCode(TinTranslateSysError(err));
+  if (netfd == NULL)
+    return UdpConn(NULL);
+  return UdpConn(new UdpConnImpl(netfd));
+}
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,79 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+#include "base/memory/ref_counted.h"
+#include "base/strings/string_piece.h"
+#include "tin/net/ip_address.h"
+#include "tin/net/ip_endpoint.h"
+#include "tin/net/netfd_common.h"
+
+namespace tin {
+namespace net {
+
+class NetFD;
+
+// a UDP socket on the netpoller. the calls return bytes or datagrams
+// done, the detailed error is in tin::GetErrorCode().
+class UdpConnImpl
+  : public base::RefCountedThreadSafe<UdpConnImpl> {
+ public:
+  explicit UdpConnImpl(NetFD* netfd);
+  virtual ~UdpConnImpl();
+
+  // connected sockets, see DialUdp.
+  int Read(void* buf, int nbytes);
+  int Write(const void* buf, int nbytes);
+
+  // from may be NULL.
+  int ReadFrom(void* buf, int nbytes, IPEndPoint* from);
+  int WriteTo(const void* buf, int nbytes, const IPEndPoint& to);
+
+  // up to n datagrams per call, recvmmsg on linux. waits for the first
+  // one only, returns how many msgs were filled in.
+  int ReadBatch(UdpMessage* msgs, int n);
+  // sends all n msgs with sendmmsg on linux, returns how many went out.
+  // msgs with segment_size set are split by the kernel (UDP_SEGMENT),
+  // by hand where that is not supported.
+  int WriteBatch(UdpMessage* msgs, int n);
+
+  // lets the kernel coalesce datagrams of a flow into one ReadBatch
+  // message (UDP_GRO), false where not supported.
+  bool EnableGro();
+
+  void SetDeadline(int64 t);
+  void SetReadDeadline(int64 t);
+  void SetWriteDeadline(int64 t);
+  void SetReadBuffer(int bytes);
+  void SetWriteBuffer(int bytes);
+  void Close();
+
+ private:
+  NetFD* netfd_;
+  DISALLOW_COPY_AND_ASSIGN(UdpConnImpl);
+};
+
+class UdpConn
+  : public scoped_refptr<UdpConnImpl> {
+ public:
+  UdpConn() {
+  }
+
+  explicit UdpConn(UdpConnImpl* t)
+    : scoped_refptr<UdpConnImpl>(t) {
+  }
+};
+
+// bound to address:port, port 0 picks one.
+UdpConn ListenUdp(const IPAddress& address, uint16 port);
+
+UdpConn ListenUdp(const base::StringPiece& addr, uint16 port);
+
+// connected to address:port, Read and Write only talk to that peer.
+UdpConn DialUdp(const IPAddress& address, uint16 port);
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,225 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <unistd.h>
+
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+#include "tin/net/netfd.h"
+
+#include "tin/net/unix_conn.h"
+
+namespace tin {
+namespace net {
+
+UnixConnImpl::UnixConnImpl(NetFD* netfd)
+  : netfd_(netfd) {
+}
+
+UnixConnImpl::~UnixConnImpl() {
+  delete netfd_;
+}
+
+int UnixConnImpl::Read(void* buf, int nbytes) {
+  int nread = 0;
+  int nfds = 0;
+  // not NetFD::Read, reads stop short where descriptors are attached.
+  int err = netfd_->ReadFds(buf, nbytes, NULL, 0, &nfds, &nread);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nread;
+}
+
+int UnixConnImpl::Write(const void* buf, int nbytes) {
+  int nwritten = 0;
+  int err = netfd_->Write(buf, nbytes, &nwritten);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nwritten;
+}
+
+int UnixConnImpl::WriteFds(const void* buf, int nbytes, const int* fds,
+                           int nfds) {
+  int nwritten = 0;
+  int err = netfd_->WriteFds(buf, nbytes, fds, nfds, &nwritten);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nwritten;
+}
+
+int UnixConnImpl::ReadFds(void* buf, int nbytes, int* fds, int maxfds,
+                          int* nfds) {
+  int nread = 0;
+  int err = netfd_->ReadFds(buf, nbytes, fds, maxfds, nfds, &nread);
+  tin::SetErrorCode(TinTranslateSysError(err));
+  return nread;
+}
+
+void UnixConnImpl::SetDeadline(int64 t) {
+  netfd_->SetDeadline(t);
+}
+
+void UnixConnImpl::SetReadDeadline(int64 t) {
+  netfd_->SetReadDeadline(t);
+}
+
+void UnixConnImpl::SetWriteDeadline(int64 t) {
+  netfd_->SetWriteDeadline(t);
+}
+
+void UnixConnImpl::SetReadBuffer(int bytes) {
+  (void)netfd_->SetSockOpt(SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+}
+
+void UnixConnImpl::SetWriteBuffer(int bytes) {
+  (void)netfd_->SetSockOpt(SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+}
+
+uintptr_t UnixConnImpl::SysFd() {
+  return netfd_->SysFd();
+}
+
+void UnixConnImpl::CloseRead() {
+  int err = netfd_->CloseRead();
+  tin::SetErrorCode(TinTranslateSysError(err));
+}
+
+void UnixConnImpl::CloseWrite() {
+  int err = netfd_->CloseWrite();
+  tin::SetErrorCode(TinTranslateSysError(err));
+}
+
+void UnixConnImpl::Close() {
+  netfd_->Close();
+}
+
+UnixListenerImpl::UnixListenerImpl(NetFD* netfd, const std::string& path)
+  : netfd_(netfd)
+  , path_(path)
+  , unlink_(true) {
+}
+
+UnixListenerImpl::~UnixListenerImpl() {
+  Unlink();
+  delete netfd_;
+}
+
+UnixConn UnixListenerImpl::Accept() {
+  NetFD* newfd = NULL;
+  UnixConnImpl* conn = NULL;
+  int err = netfd_->Accept(&newfd);
+  if (err == 0) {
+    conn = new UnixConnImpl(newfd);
+  }
+  SetErrorCode(TinTranslateSysError(err));
+  return UnixConn(conn);
+}
+
+void UnixListenerImpl::SetDeadline(int64 t) {
+  int err = netfd_->SetDeadline(t);
+  SetErrorCode(TinTranslateSysError(err));
+}
+
+void UnixListenerImpl::Close() {
+  int err = netfd_->Close();
+  Unlink();
+  SetErrorCode(TinTranslateSysError(err));
+}
+
+void UnixListenerImpl::SetUnlinkOnClose(bool unlink) {
+  unlink_ = unlink;
+}
+
+uintptr_t UnixListenerImpl::SysFd() {
+  return netfd_->SysFd();
+}
+
+void UnixListenerImpl::Unlink() {
+  if (unlink_ && !path_.empty()) {
+    unlink(path_.c_str());
+    path_.clear();
+  }
+}
+
+UnixListener ListenUnix(const base::StringPiece& path, int backlog) {
+  int err = 0;
+  NetFD* netfd = NewFD(ADDRESS_FAMILY_UNIX, SOCK_STREAM, &err);
+  if (netfd != NULL) {
+    err = netfd->Init();
+    if (err == 0) {
+      err = netfd->BindUnix(path);
+    }
+    if (err == 0) {
+      err = netfd->Listen(backlog);
+    }
+    if (err != 0) {
+      delete netfd;
+      netfd = NULL;
+    }
+  }
+  SetErrorCode(TinTranslateSysError(err));
+  if (netfd == NULL)
+    return UnixListener(NULL);
+  // abstract names vanish with the socket.
+  std::string file;
+  if (path[0] != '@')
+    path.CopyToString(&file);
+  return UnixListener(new UnixListenerImpl(netfd, file));
+}
+
+UnixConn DialUnix(const base::StringPiece& path, int64 deadline) {
+  int err = 0;
+  NetFD* netfd = NewFD(ADDRESS_FAMILY_UNIX, SOCK_STREAM, &err);
+  if (netfd != NULL) {
+    if (deadline == -1)
+      deadline = kint64max;
+    err = netfd->DialUnix(path, deadline);
+    if (err != 0) {
+      delete netfd;
+      netfd = NULL;
+    }
+  }
+  SetErrorCode(TinTranslateSysError(err));
+  if (netfd == NULL)
+    return UnixConn(NULL);
+  return UnixConn(new UnixConnImpl(netfd));
+}
+
+TcpConn TcpConnFromFd(int fd) {
+  int err = 0;
+  NetFD* netfd = NewFDFromSysFd(fd, &err);
+  SetErrorCode(TinTranslateSysError(err));
+  if (netfd == NULL)
+    return TcpConn();
+  return MakeTcpConn(new TcpConnImpl(netfd));
+}
+
+TCPListener TcpListenerFromFd(int fd) {
+  int err = 0;
+  NetFD* netfd = NewFDFromSysFd(fd, &err);
+  SetErrorCode(TinTranslateSysError(err));
+  if (netfd == NULL)
+    return TCPListener(NULL);
+  return MakeTcpListener(new TCPListenerImpl(netfd, 0));
+}
+
+UnixConn UnixConnFromFd(int fd) {
+  int err = 0;
+  NetFD* netfd = NewFDFromSysFd(fd, &err);
+  SetErrorCode(TinTranslateSysError(err));
+  if (netfd == NULL)
+    return UnixConn(NULL);
+  return UnixConn(new UnixConnImpl(netfd));
+}
+
+UnixListener UnixListenerFromFd(int fd) {
+  int err = 0;
+  NetFD* netfd = NewFDFromSysFd(fd, &err);
+  SetErrorCode(TinTranslateSysError(err));
+  if (netfd == NULL)
+    return UnixListener(NULL);
+  // the path belongs to whoever created the socket.
+  return UnixListener(new UnixListenerImpl(netfd, std::string()));
+}
+
+}  // namespace net
+}  // namespace tin
@@ -0,0 +1,124 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <string>
+
+#include "base/basictypes.h"
+#include "base/memory/ref_counted.h"
+#include "base/strings/string_piece.h"
+#include "tin/time/time.h"
+#include "tin/io/io.h"
+#include "tin/net/tcp_conn.h"
+#include "tin/net/listener.h"
+
+namespace tin {
+namespace net {
+
+class NetFD;
+
+// a stream connection over an AF_UNIX socket, for IPC on the same host
+// without the TCP stack. like TcpConnImpl the calls return bytes done,
+// the detailed error is in tin::GetErrorCode().
+class UnixConnImpl
+  : public base::RefCountedThreadSafe<UnixConnImpl>
+  , public tin::io::IOReadWriter {
+ public:
+  explicit UnixConnImpl(NetFD* netfd);
+  virtual ~UnixConnImpl();
+
+  // descriptors the peer attached to the data read are closed.
+  int Read(void* buf, int nbytes);
+
+  int Write(const void* buf, int nbytes);
+
+  // writes nbytes (at least 1) with nfds descriptors attached, at most
+  // kMaxPassedFds. the peer gets copies, fds stay open here.
+  int WriteFds(const void* buf, int nbytes, const int* fds, int nfds);
+
+  // reads like Read and stores the descriptors that came with the data
+  // in fds, up to maxfds. *nfds is their number, the caller owns them,
+  // see TcpConnFromFd and TcpListenerFromFd.
+  int ReadFds(void* buf, int nbytes, int* fds, int maxfds, int* nfds);
+
+  void SetDeadline(int64 t);
+  void SetReadDeadline(int64 t);
+  void SetWriteDeadline(int64 t);
+  void SetReadBuffer(int bytes);
+  void SetWriteBuffer(int bytes);
+
+  uintptr_t SysFd();
+
+  void CloseRead();
+  void CloseWrite();
+  void Close();
+
+ private:
+  NetFD* netfd_;
+  DISALLOW_COPY_AND_ASSIGN(UnixConnImpl);
+};
+
+class UnixConn
+  : public scoped_refptr<UnixConnImpl> {
+ public:
+  UnixConn() {
+  }
+
+  explicit UnixConn(UnixConnImpl* t)
+    : scoped_refptr<UnixConnImpl>(t) {
+  }
+};
+
+class UnixListenerImpl
+  : public base::RefCountedThreadSafe<UnixListenerImpl> {
+ public:
+  // path is removed on Close if not empty.
+  UnixListenerImpl(NetFD* netfd, const std::string& path);
+  ~UnixListenerImpl();
+
+  UnixConn Accept();
+  void SetDeadline(int64 t);
+  void Close();
+
+  // false keeps the socket file after Close, for a listener handed over
+  // to another process.
+  void SetUnlinkOnClose(bool unlink);
+
+  uintptr_t SysFd();
+
+ private:
+  void Unlink();
+
+  NetFD* netfd_;
+  std::string path_;
+  bool unlink_;
+  DISALLOW_COPY_AND_ASSIGN(UnixListenerImpl);
+};
+
+class UnixListener
+  : public scoped_refptr<UnixListenerImpl> {
+ public:
+  explicit UnixListener(UnixListenerImpl* t)
+    : scoped_refptr<UnixListenerImpl>(t) {
+  }
+};
+
+// path is a file system path, or on linux '@' and an abstract name. an
+// existing file at path fails with TIN_EADDRINUSE, it is not removed.
+UnixListener ListenUnix(const base::StringPiece& path, int backlog = 511);
+
+// deadline is relative, -1 waits for the kernel.
+UnixConn DialUnix(const base::StringPiece& path, int64 deadline = -1);
+
+// take over a socket received with ReadFds or inherited at exec, for
+// handing accepted connections and listeners between processes. fd is
+// owned by the result or closed on failure.
+TcpConn TcpConnFromFd(int fd);
+TCPListener TcpListenerFromFd(int fd);
+UnixConn UnixConnFromFd(int fd);
+UnixListener UnixListenerFromFd(int fd);
+
+}  // namespace net
+}  // namespace tin
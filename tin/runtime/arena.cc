@@ -0,0 +1,107 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdlib.h>
+
+#include "base/logging.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/util.h"
+
+#include "tin/runtime/arena.h"
+
+namespace tin {
+namespace runtime {
+
+namespace {
+const size_t kChunkHeader =
+    (sizeof(ArenaChunk) + kArenaAlign - 1) & ~(kArenaAlign - 1);
+// larger blocks get a chunk of their own, the rest of the current chunk
+// is kept for the small ones.
+const size_t kLargeBlock = kArenaChunkSize / 4;
+
+char* ChunkData(ArenaChunk* chunk) {
+  return reinterpret_cast<char*>(chunk) + kChunkHeader;
+}
+
+ArenaChunk* MallocChunk(size_t size) {
+  ArenaChunk* chunk = static_cast<ArenaChunk*>(malloc(size));
+  if (chunk == NULL)
+    LOG(FATAL) << "arena: out of memory";
+  chunk->next = NULL;
+  chunk->size = size;
+  return chunk;
+}
+}  // namespace
+
+ArenaChunk* ArenaChunkNew() {
+  P* p = GetP();
+  ArenaChunk* chunk = p != NULL ? p->ArenaChunkGet() : NULL;
+  if (chunk == NULL)
+    chunk = MallocChunk(kArenaChunkSize);
+  return chunk;
+}
+
+void ArenaChunkFree(ArenaChunk* chunk) {
+  free(chunk);
+}
+
+Arena::Arena()
+  : head_(NULL)
+  , ptr_(NULL)
+  , end_(NULL)
+  , footprint_(0) {
+}
+
+Arena::~Arena() {
+  Release(NULL);
+}
+
+void* Arena::AllocateSlow(size_t size) {
+  ArenaChunk* chunk = NULL;
+  if (size > kLargeBlock) {
+    chunk = MallocChunk(kChunkHeader + size);
+    // behind the current chunk, which keeps bumping.
+    if (head_ != NULL) {
+      chunk->next = head_->next;
+      head_->next = chunk;
+    } else {
+      head_ = chunk;
+    }
+    footprint_ += chunk->size;
+    return ChunkData(chunk);
+  }
+  chunk = ArenaChunkNew();
+  chunk->next = head_;
+  head_ = chunk;
+  footprint_ += chunk->size;
+  ptr_ = ChunkData(chunk) + size;
+  end_ = reinterpret_cast<char*>(chunk) + kArenaChunkSize;
+  return ChunkData(chunk);
+}
+
+void Arena::Release(P* p) {
+  while (head_ != NULL) {
+    ArenaChunk* chunk = head_;
+    head_ = chunk->next;
+    if (p != NULL && chunk->size == kArenaChunkSize) {
+      p->ArenaChunkPut(chunk);
+    } else {
+      ArenaChunkFree(chunk);
+    }
+  }
+  ptr_ = NULL;
+  end_ = NULL;
+  footprint_ = 0;
+}
+
+}  // namespace runtime
+
+void* ArenaAllocate(size_t size) {
+  runtime::G* gp = runtime::GetG();
+  DCHECK(gp != NULL) << "ArenaAllocate outside of a greenlet";
+  return gp->GetArena()->Allocate(size);
+}
+
+}  // namespace tin
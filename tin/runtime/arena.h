@@ -0,0 +1,136 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+
+#include <limits>
+#include <new>
+
+#include "base/basictypes.h"
+
+namespace tin {
+namespace runtime {
+
+class P;
+
+struct ArenaChunk {
+  ArenaChunk* next;
+  // kArenaChunkSize for the chunks cached by the Ps, else a large block.
+  size_t size;
+};
+
+// chunks recycled through the per P cache, including the header.
+const size_t kArenaChunkSize = 16 * 1024;
+const size_t kArenaAlign = 16;
+
+// bump allocator of one greenlet, nothing is freed until Release gives
+// all the chunks back at once.
+class Arena {
+ public:
+  Arena();
+  ~Arena();
+
+  void* Allocate(size_t size) {
+    size = (size + kArenaAlign - 1) & ~(kArenaAlign - 1);
+    if (size > static_cast<size_t>(end_ - ptr_))
+      return AllocateSlow(size);
+    void* p = ptr_;
+    ptr_ += size;
+    return p;
+  }
+
+  // to the chunk cache of p, freed if p is NULL or its cache is full.
+  void Release(P* p);
+
+  // bytes taken from chunks, headers included.
+  size_t Footprint() const {
+    return footprint_;
+  }
+
+ private:
+  void* AllocateSlow(size_t size);
+
+  ArenaChunk* head_;
+  char* ptr_;
+  char* end_;
+  size_t footprint_;
+  DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+// a chunk of kArenaChunkSize, from the cache of the current P if any.
+ArenaChunk* ArenaChunkNew();
+void ArenaChunkFree(ArenaChunk* chunk);
+
+}  // namespace runtime
+
+// size bytes from the arena of the current greenlet, which lives until
+// the greenlet exits. they are never freed one by one.
+void* ArenaAllocate(size_t size);
+
+// STL allocator on the arena of the current greenlet, for containers
+// used by one greenlet only and dying with it. deallocate is a no-op.
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind {
+    typedef ArenaAllocator<U> other;
+  };
+
+  ArenaAllocator() {
+  }
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) {
+  }
+
+  pointer address(reference x) const {
+    return &x;
+  }
+
+  const_pointer address(const_reference x) const {
+    return &x;
+  }
+
+  pointer allocate(size_type n, const void* hint = 0) {
+    return static_cast<pointer>(ArenaAllocate(n * sizeof(T)));
+  }
+
+  void deallocate(pointer p, size_type n) {
+  }
+
+  size_type max_size() const {
+    return std::numeric_limits<size_type>::max() / sizeof(T);
+  }
+
+  void construct(pointer p, const T& value) {
+    new (p) T(value);
+  }
+
+  void destroy(pointer p) {
+    p->~T();
+  }
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&) {
+  return false;
+}
+
+}  // namespace tin
@@ -0,0 +1,216 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "base/logging.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/platform_thread.h"
+#include "tin/config/config.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/util.h"
+
+#include "tin/runtime/async_log.h"
+
+namespace tin {
+namespace runtime {
+
+// messages of one M as a length then the bytes. single producer, the
+// thread of the M, single consumer, whoever holds the writer lock.
+struct LogRing {
+  explicit LogRing(uint32 size)
+    : next(NULL)
+    , mask(size - 1)
+    , buf(new char[size])
+    , head(0)
+    , tail(0) {
+  }
+
+  // false if full.
+  bool TryPush(const char* data, uint32 len) {
+    uintptr_t t = atomic::relaxed_load(&tail);
+    uintptr_t need = sizeof(len) + len;
+    if (mask + 1 - (t - atomic::acquire_load(&head)) < need)
+      return false;
+    CopyIn(t, reinterpret_cast<const char*>(&len), sizeof(len));
+    CopyIn(t + sizeof(len), data, len);
+    atomic::release_store(&tail, t + need);
+    return true;
+  }
+
+  // writes the messages queued to file, true if there were any.
+  bool Drain(FILE* file) {
+    uintptr_t h = atomic::relaxed_load(&head);
+    uintptr_t t = atomic::acquire_load(&tail);
+    if (h == t)
+      return false;
+    while (h != t) {
+      uint32 len = 0;
+      CopyOut(h, reinterpret_cast<char*>(&len), sizeof(len));
+      uintptr_t start = (h + sizeof(len)) & mask;
+      uintptr_t first = std::min<uintptr_t>(len, mask + 1 - start);
+      fwrite(buf + start, 1, first, file);
+      if (first < len)
+        fwrite(buf, 1, len - first, file);
+      h += sizeof(len) + len;
+    }
+    atomic::release_store(&head, h);
+    return true;
+  }
+
+  void CopyIn(uintptr_t pos, const char* data, uintptr_t n) {
+    for (uintptr_t i = 0; i < n; i++)
+      buf[(pos + i) & mask] = data[i];
+  }
+
+  void CopyOut(uintptr_t pos, char* data, uintptr_t n) {
+    for (uintptr_t i = 0; i < n; i++)
+      data[i] = buf[(pos + i) & mask];
+  }
+
+  // the list of rings, pushed once and never taken off.
+  LogRing* next;
+  const uintptr_t mask;
+  char* buf;
+  char pad0_[64];
+  uintptr_t head;
+  char pad1_[64 - sizeof(uintptr_t)];
+  uintptr_t tail;
+};
+
+namespace {
+
+// the writer looks again after this long without messages.
+const int kFlushIntervalMs = 2;
+
+uintptr_t rings = 0;
+uintptr_t dropped = 0;
+uint32 ring_size = 0;
+// held while draining, makes the writer thread and AsyncLogFlush the one
+// consumer.
+base::Lock* drain_lock = NULL;
+logging::LogMessageHandlerFunction old_handler = NULL;
+
+bool DrainAll() {
+  bool any = false;
+  for (LogRing* r = reinterpret_cast<LogRing*>(atomic::acquire_load(&rings));
+       r != NULL; r = r->next) {
+    any |= r->Drain(stderr);
+  }
+  if (any)
+    fflush(stderr);
+  return any;
+}
+
+LogRing* RingOf(M* m) {
+  LogRing* ring = m->GetLogRing();
+  if (ring != NULL)
+    return ring;
+  ring = new LogRing(ring_size);
+  while (true) {
+    uintptr_t head = atomic::relaxed_load(&rings);
+    ring->next = reinterpret_cast<LogRing*>(head);
+    if (atomic::cas(&rings, head, reinterpret_cast<uintptr_t>(ring)))
+      break;
+  }
+  m->SetLogRing(ring);
+  return ring;
+}
+
+bool HandleLogMessage(int severity, const char* file, int line,
+                      size_t message_start, const std::string& str) {
+  if (old_handler != NULL &&
+      old_handler(severity, file, line, message_start, str)) {
+    return true;
+  }
+  M* m = GetM();
+  // a message the ring can never hold is written at once, not dropped.
+  if (severity >= logging::LOG_FATAL || m == NULL ||
+      str.size() + sizeof(uint32) > ring_size) {
+    // in order after what is queued.
+    AsyncLogFlush();
+    return false;
+  }
+  if (!RingOf(m)->TryPush(str.data(), static_cast<uint32>(str.size()))) {
+    uintptr_t old = atomic::relaxed_load(&dropped);
+    while (!atomic::cas(&dropped, old, old + 1))
+      old = atomic::relaxed_load(&dropped);
+  }
+  return true;
+}
+
+class LogWriter : public base::PlatformThread::Delegate {
+ public:
+  LogWriter()
+    : reported_(0) {
+  }
+
+  bool Start() {
+    return base::PlatformThread::CreateNonJoinable(0, this);
+  }
+
+ private:
+  virtual void ThreadMain() {
+    base::PlatformThread::SetName("TinLog");
+    while (true) {
+      bool any = false;
+      {
+        base::AutoLock guard(*drain_lock);
+        any = DrainAll();
+      }
+      uintptr_t n = atomic::relaxed_load(&dropped);
+      if (n != reported_) {
+        fprintf(stderr, "tin: %llu log messages dropped\n",
+                static_cast<unsigned long long>(n - reported_));
+        fflush(stderr);
+        reported_ = n;
+      }
+      if (!any) {
+        base::PlatformThread::Sleep(
+            base::TimeDelta::FromMilliseconds(kFlushIntervalMs));
+      }
+    }
+  }
+
+  uintptr_t reported_;
+  DISALLOW_COPY_AND_ASSIGN(LogWriter);
+};
+
+}  // namespace
+
+void AsyncLogInit() {
+  uint32 size = 1024;
+  while (size < static_cast<uint32>(rtm_conf->AsyncLogBufferSize()))
+    size *= 2;
+  ring_size = size;
+  drain_lock = new base::Lock;
+  old_handler = logging::GetLogMessageHandler();
+  logging::SetLogMessageHandler(&HandleLogMessage);
+  // lives as long as the process.
+  LogWriter* writer = new LogWriter;
+  if (!writer->Start()) {
+    LOG(ERROR) << "async log: writer thread not started, logging sync";
+    logging::SetLogMessageHandler(old_handler);
+  }
+}
+
+void AsyncLogFlush() {
+  if (drain_lock == NULL)
+    return;
+  base::AutoLock guard(*drain_lock);
+  DrainAll();
+}
+
+uint64 AsyncLogDropped() {
+  return atomic::relaxed_load(&dropped);
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,31 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include "base/basictypes.h"
+
+namespace tin {
+namespace runtime {
+
+struct LogRing;
+
+// routes base logging of Ms through a ring per M that an OS thread of its
+// own writes to stderr in batches, see Config::SetAsyncLogBufferSize. a
+// full ring drops the message and counts it. FATAL ones, those larger
+// than a ring and those of threads that are not Ms are written at once as
+// before.
+//
+// the writer does not know the destination base logging was initialized
+// with, queued messages go to stderr even if it logs to a file. async
+// logging is for processes that log to stderr only.
+void AsyncLogInit();
+
+// writes what is queued, from any thread, e.g. before exiting.
+void AsyncLogFlush();
+
+// messages dropped since start up.
+uint64 AsyncLogDropped();
+
+}  // namespace runtime
+}  // namespace tin
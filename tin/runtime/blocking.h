@@ -0,0 +1,45 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include "base/callback.h"
+#include "base/basictypes.h"
+
+#include "tin/runtime/runtime.h"
+
+namespace tin {
+
+// wraps a call that may block the OS thread, e.g. fsync or a database
+// client. the P stays with the caller, sysmon hands it to another M only
+// if the call is still blocked after Config::SyscallRetakeUs and other
+// greenlets are waiting, so short calls cost no handoff.
+class BlockingSection {
+ public:
+  BlockingSection() {
+    EnterSyscall();
+  }
+
+  ~BlockingSection() {
+    ExitSyscall();
+  }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BlockingSection);
+};
+
+// runs fn inside a BlockingSection, fn must not call back into tin, e.g.
+// use channels or spawn greenlets.
+template <typename R>
+R RunBlocking(const base::Callback<R(void)>& fn) {
+  BlockingSection section;
+  return fn.Run();
+}
+
+template <typename R>
+R RunBlocking(R (*fn)()) {
+  BlockingSection section;
+  return fn();
+}
+
+}  // namespace tin
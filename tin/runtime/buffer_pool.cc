@@ -0,0 +1,238 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/logging.h"
+
+#include "tin/sync/atomic.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/scheduler.h"
+#include "tin/runtime/stack/huge_page_arena.h"
+
+#include "tin/runtime/buffer_pool.h"
+
+namespace tin {
+namespace runtime {
+
+namespace {
+
+const int32 kBufferLocalMax = 32;
+const int32 kBufferLocalKeep = 16;
+const int32 kBufferGlobalMax = 1024;
+
+// free buffers are linked through their first word.
+struct FreeBuffer {
+  FreeBuffer* next;
+};
+
+// only touched by the M that owns P, no locking.
+struct BufferCache {
+  FreeBuffer* head[kNumBufferClasses];
+  int32 count[kNumBufferClasses];
+};
+
+BufferCache local_cache[kTinProcsLimit];
+
+RawMutex global_lock;
+FreeBuffer* global_head[kNumBufferClasses];
+int32 global_count[kNumBufferClasses];
+
+// NULL outside of greenlets, e.g. before the runtime is up, those
+// allocate directly.
+bool InGreenlet() {
+  G* gp = GetGOrNull();
+  return gp != NULL && gp->M() != NULL;
+}
+
+// NULL unless the P of the M runs, in a syscall or blocking section
+// sysmon may hand it to another M meanwhile. those use the global list.
+BufferCache* CurrentCache() {
+  M* m = GetGOrNull()->M();
+  P* p = m->P();
+  if (p == NULL || p->GetStatus() != kPrunning || p->M() != m) {
+    return NULL;
+  }
+  return &local_cache[p->Id()];
+}
+
+// the config is fixed before the runtime starts, so buffers go back to
+// where they came from.
+bool HugePageBuffers() {
+  return rtm_conf != NULL && rtm_conf->IsHugePagesEnabled();
+}
+
+char* NewBuffer(int size_class) {
+  int size = BufferClassSize(size_class);
+  if (HugePageBuffers()) {
+    char* buf = static_cast<char*>(HugePageAlloc(size));
+    if (buf == NULL)
+      LOG(FATAL) << "failed to map a huge page arena";
+    return buf;
+  }
+  return new char[size];
+}
+
+void DeleteBuffer(char* buf, int size_class) {
+  if (HugePageBuffers()) {
+    HugePageFree(buf, BufferClassSize(size_class));
+  } else {
+    delete [] buf;
+  }
+}
+
+void GlobalPut(int size_class, FreeBuffer* head, FreeBuffer* tail,
+               int32 n) {
+  {
+    RawMutexGuard guard(&global_lock);
+    if (global_count[size_class] < kBufferGlobalMax) {
+      tail->next = global_head[size_class];
+      global_head[size_class] = head;
+      global_count[size_class] += n;
+      return;
+    }
+  }
+  tail->next = NULL;
+  while (head != NULL) {
+    FreeBuffer* b = head;
+    head = head->next;
+    DeleteBuffer(reinterpret_cast<char*>(b), size_class);
+  }
+}
+
+FreeBuffer* GlobalGet(int size_class, int32 maximum, int32* n) {
+  *n = 0;
+  if (atomic::relaxed_load32(&global_count[size_class]) == 0) {
+    return NULL;
+  }
+  RawMutexGuard guard(&global_lock);
+  FreeBuffer* head = global_head[size_class];
+  if (head == NULL) {
+    return NULL;
+  }
+  FreeBuffer* tail = head;
+  int32 count = 1;
+  while (count < maximum && tail->next != NULL) {
+    tail = tail->next;
+    count++;
+  }
+  global_head[size_class] = tail->next;
+  global_count[size_class] -= count;
+  tail->next = NULL;
+  *n = count;
+  return head;
+}
+
+}  // namespace
+
+int BufferSizeClass(int size) {
+  // small buffers would waste most of a 4 KiB block.
+  if (size <= kMinBufferClassSize / 2) {
+    return -1;
+  }
+  for (int i = 0; i < kNumBufferClasses; i++) {
+    if (size <= BufferClassSize(i))
+      return i;
+  }
+  return -1;
+}
+
+int BufferClassSize(int size_class) {
+  DCHECK(size_class >= 0 && size_class < kNumBufferClasses);
+  return kMinBufferClassSize << (2 * size_class);
+}
+
+char* BufferAlloc(int size, int* capacity) {
+  int size_class = BufferSizeClass(size);
+  if (size_class < 0) {
+    *capacity = size;
+    return new char[size];
+  }
+  *capacity = BufferClassSize(size_class);
+  if (!InGreenlet()) {
+    return NewBuffer(size_class);
+  }
+  BufferCache* cache = CurrentCache();
+  if (cache == NULL) {
+    int32 n = 0;
+    FreeBuffer* b = GlobalGet(size_class, 1, &n);
+    return n != 0 ? reinterpret_cast<char*>(b) : NewBuffer(size_class);
+  }
+  if (cache->head[size_class] == NULL) {
+    int32 n = 0;
+    cache->head[size_class] = GlobalGet(size_class, kBufferLocalKeep, &n);
+    cache->count[size_class] = n;
+    if (n == 0) {
+      return NewBuffer(size_class);
+    }
+  }
+  FreeBuffer* b = cache->head[size_class];
+  cache->head[size_class] = b->next;
+  cache->count[size_class]--;
+  return reinterpret_cast<char*>(b);
+}
+
+void BufferFree(char* buf, int capacity) {
+  if (buf == NULL) {
+    return;
+  }
+  int size_class = BufferSizeClass(capacity);
+  if (size_class < 0 || capacity != BufferClassSize(size_class)) {
+    delete [] buf;
+    return;
+  }
+  if (!InGreenlet()) {
+    DeleteBuffer(buf, size_class);
+    return;
+  }
+  FreeBuffer* b = reinterpret_cast<FreeBuffer*>(buf);
+  BufferCache* cache = CurrentCache();
+  if (cache == NULL) {
+    GlobalPut(size_class, b, b, 1);
+    return;
+  }
+  b->next = cache->head[size_class];
+  cache->head[size_class] = b;
+  cache->count[size_class]++;
+  if (cache->count[size_class] < kBufferLocalMax) {
+    return;
+  }
+  // move the older half to the global list.
+  FreeBuffer* tail = cache->head[size_class];
+  for (int32 i = 1; i < kBufferLocalKeep; i++) {
+    tail = tail->next;
+  }
+  FreeBuffer* head = tail->next;
+  tail->next = NULL;
+  FreeBuffer* last = head;
+  while (last->next != NULL) {
+    last = last->next;
+  }
+  GlobalPut(size_class, head, last,
+            cache->count[size_class] - kBufferLocalKeep);
+  cache->count[size_class] = kBufferLocalKeep;
+}
+
+void BufferPurge(int proc_id) {
+  BufferCache* cache = &local_cache[proc_id];
+  for (int i = 0; i < kNumBufferClasses; i++) {
+    FreeBuffer* head = cache->head[i];
+    if (head == NULL) {
+      continue;
+    }
+    FreeBuffer* last = head;
+    while (last->next != NULL) {
+      last = last->next;
+    }
+    GlobalPut(i, head, last, cache->count[i]);
+    cache->head[i] = NULL;
+    cache->count[i] = 0;
+  }
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,32 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+
+namespace tin {
+namespace runtime {
+
+// io buffers of 4 KiB, 16 KiB and 64 KiB are recycled through per-P
+// caches backed by a global list, like greenlets are.
+const int kMinBufferClassSize = 4 * 1024;
+const int kNumBufferClasses = 3;
+
+// returns -1 if size is too small or too large to be pooled.
+int BufferSizeClass(int size);
+
+int BufferClassSize(int size_class);
+
+// returns storage of at least size bytes, *capacity is its real size
+// and must be passed back to BufferFree.
+char* BufferAlloc(int size, int* capacity);
+
+void BufferFree(char* buf, int capacity);
+
+// move the buffers cached by P proc_id to the global list.
+void BufferPurge(int proc_id);
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,113 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/pprof.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/profiler.h"
+
+#include "tin/runtime/contention.h"
+
+namespace tin {
+namespace runtime {
+
+int32 contention_rate = 0;
+
+namespace {
+
+const int kMaxFrames = 32;
+
+struct ContentionCount {
+  int64 count;
+  int64 delay;
+};
+
+typedef std::map<std::vector<uintptr_t>, ContentionCount> ContentionMap;
+
+RawMutex contention_lock;
+ContentionMap* contentions = NULL;
+
+}  // namespace
+
+struct ContentionSample {
+  int64 start;
+  int32 rate;
+  int depth;
+  void* pcs[kMaxFrames];
+};
+
+ContentionSample* StartContentionSlow(P* p, int32 rate) {
+  if (p->ContentionTick() % static_cast<uint32>(rate) != 0)
+    return NULL;
+  ContentionSample* s = new ContentionSample;
+  s->rate = rate;
+  // without Park and StartContentionSlow.
+  s->depth = CaptureStack(s->pcs, kMaxFrames, 2);
+  s->start = MonoNow();
+  return s;
+}
+
+void FinishContention(ContentionSample* s) {
+  int64 delay = MonoNow() - s->start;
+  std::vector<uintptr_t> pcs;
+  for (int i = 0; i < s->depth; i++)
+    pcs.push_back(reinterpret_cast<uintptr_t>(s->pcs[i]));
+  {
+    RawMutexGuard guard(&contention_lock);
+    if (contentions == NULL)
+      contentions = new ContentionMap;
+    ContentionCount& c =
+      contentions->insert(std::make_pair(pcs, ContentionCount())).first->second;
+    // each sample stands for rate waits.
+    c.count += s->rate;
+    c.delay += delay * s->rate;
+  }
+  delete s;
+}
+
+}  // namespace runtime
+
+void SetContentionProfileRate(int rate) {
+  atomic::relaxed_store32(&runtime::contention_rate, rate > 0 ? rate : 0);
+}
+
+void ResetContentionProfile() {
+  runtime::ContentionMap* old = NULL;
+  {
+    runtime::RawMutexGuard guard(&runtime::contention_lock);
+    old = runtime::contentions;
+    runtime::contentions = NULL;
+  }
+  delete old;
+}
+
+bool WriteContentionProfile(const char* path) {
+  runtime::ContentionMap copy;
+  {
+    runtime::RawMutexGuard guard(&runtime::contention_lock);
+    if (runtime::contentions != NULL)
+      copy = *runtime::contentions;
+  }
+  runtime::PprofBuilder builder;
+  builder.AddSampleType("contentions", "count");
+  builder.AddSampleType("delay", "nanoseconds");
+  std::vector<runtime::PprofLabel> labels;
+  for (runtime::ContentionMap::const_iterator it = copy.begin();
+       it != copy.end(); ++it) {
+    std::vector<int64> values;
+    values.push_back(it->second.count);
+    values.push_back(it->second.delay);
+    builder.AddSample(it->first, values, labels);
+  }
+  int32 rate = atomic::relaxed_load32(&runtime::contention_rate);
+  builder.SetPeriod("contentions", "count", rate > 0 ? rate : 1);
+  return runtime::WriteProfileFile(path, builder.Encode());
+}
+
+}  // namespace tin
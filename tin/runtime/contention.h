@@ -0,0 +1,35 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+
+#include "tin/sync/atomic.h"
+
+namespace tin {
+namespace runtime {
+
+class P;
+
+// see SetContentionProfileRate, 0 is off.
+extern int32 contention_rate;
+
+struct ContentionSample;
+
+ContentionSample* StartContentionSlow(P* p, int32 rate);
+
+// records how long the greenlet waited and frees s.
+void FinishContention(ContentionSample* s);
+
+// a sample of the park about to happen on p if it is due, NULL else.
+inline ContentionSample* StartContention(P* p) {
+  int32 rate = atomic::relaxed_load32(&contention_rate);
+  if (rate <= 0)
+    return NULL;
+  return StartContentionSlow(p, rate);
+}
+
+}  // namespace runtime
+}  // namespace tin
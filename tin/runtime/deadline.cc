@@ -0,0 +1,45 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "tin/runtime/util.h"
+#include "tin/runtime/greenlet.h"
+
+#include "tin/runtime/deadline.h"
+
+namespace tin {
+
+Deadline::Deadline(int64 ns) {
+  runtime::G* gp = runtime::GetG();
+  saved_ = gp->Deadline();
+  if (ns < 0)
+    return;
+  int64 now = MonoNow();
+  int64 when = now > kint64max - ns ? kint64max : now + ns;
+  if (when < saved_)
+    gp->SetDeadline(when);
+}
+
+Deadline::~Deadline() {
+  runtime::G* gp = runtime::GetG();
+  if (gp->Deadline() != saved_)
+    gp->SetDeadline(saved_);
+}
+
+int64 Deadline::Remaining() {
+  int64 when = runtime::GetG()->Deadline();
+  if (when == kint64max)
+    return -1;
+  int64 left = when - MonoNow();
+  return left > 0 ? left : 0;
+}
+
+bool Deadline::Active() {
+  return runtime::GetG()->Deadline() != kint64max;
+}
+
+bool Deadline::Exceeded() {
+  return runtime::GetG()->DeadlineExpired();
+}
+
+}  // namespace tin
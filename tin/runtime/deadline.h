@@ -0,0 +1,42 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+
+namespace tin {
+
+// bounds everything the current greenlet waits for while in scope, one
+// budget for a whole request instead of a deadline per call:
+//
+//   tin::Deadline deadline(200 * kMillisecond);
+//   conn = dialer.Dial(...);
+//   conn->Write(...);  conn->Read(...);
+//
+// io waits of NetFD (Read, Write, Dial and Accept) fail with
+// TIN_ETIMEOUT_INTR once it passed, SemAcquireFor and NanoSleep end early
+// and Channel ops return false. it is armed as one timer of the greenlet
+// however many waits happen. nested deadlines only tighten, the outer one
+// is back once they go out of scope.
+class Deadline {
+ public:
+  // ns < 0 sets no deadline and keeps the outer one.
+  explicit Deadline(int64 ns);
+  ~Deadline();
+
+  // nano seconds left of the current greenlet's deadline, 0 once passed,
+  // -1 if none.
+  static int64 Remaining();
+
+  static bool Active();
+
+  static bool Exceeded();
+
+ private:
+  int64 saved_;
+  DISALLOW_COPY_AND_ASSIGN(Deadline);
+};
+
+}  // namespace tin
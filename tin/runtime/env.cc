@@ -5,42 +5,99 @@
 #include <signal.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
 #include "build/build_config.h"
 
+#include "base/bind.h"
+#include "base/compiler_specific.h"
 #include "base/sys_info.h"
 #include "tin/runtime/util.h"
+#include "tin/runtime/async_log.h"
 #include "tin/runtime/timer/timer_queue.h"
 #include "tin/runtime/greenlet.h"
+#include "tin/runtime/greenlet_dump.h"
 #include "tin/runtime/m.h"
 #include "tin/runtime/threadpoll.h"
 #include "tin/runtime/scheduler.h"
 #include "tin/runtime/sysmon.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/runtime/spawn.h"
+#include "tin/runtime/net/pollops.h"
+#include "tin/runtime/net/poll_descriptor.h"
 
 #include "tin/runtime/env.h"
 
 namespace tin {
 namespace runtime {
 
+namespace {
+
+uint32 prewarm_gate = 0;
+uint32 prewarm_done = 0;
+
+void PrewarmGlet() {
+  SemAcquire(&prewarm_gate);
+  SemRelease(&prewarm_done);
+}
+
+}  // namespace
+
 Env::Env()
   : argc_(0)
   , argv_(NULL)
-  , main_signal_(false, false) {
+  , main_signal_(false, false)
+  , start_ns_(0)
+  , main_ns_(0) {
 }
 
 void Env::PreInit() {
-  num_processors_ = base::SysInfo::NumberOfProcessors();
+  int ncpus = base::SysInfo::NumberOfProcessors();
+  topology_.Discover(ncpus);
+  // a container may get less cpu time than it sees cpus.
+  num_processors_ = CpuQuotaLimit(ncpus);
+}
+
+int Env::CpuForProc(int proc_id) const {
+  uint64 mask = conf_->CpuAffinity();
+  int ncpus = 0;
+  for (int cpu = 0; cpu < 64; cpu++) {
+    if (mask & (1ULL << cpu))
+      ncpus++;
+  }
+  if (ncpus == 0)
+    return proc_id % topology_.NumCpus();
+
+  int nth = proc_id % ncpus;
+  for (int cpu = 0; cpu < 64; cpu++) {
+    if ((mask & (1ULL << cpu)) && nth-- == 0)
+      return cpu;
+  }
+  return 0;
 }
 
 int Env::Initialize(EntryFn fn, int argc, char** argv, tin::Config* new_conf) {
+  start_ns_ = MonoNow();
   PreInit();
   fn_ = fn;
   conf_ = new_conf;
   rtm_conf = conf_;
+  if (conf_->MaxProcs() <= 0) {
+    conf_->SetMaxProcs(std::min(num_processors_, kTinProcsLimit));
+  }
+  SemTableInit(conf_->MaxProcs());
   SignalInit();
+  if (conf_->AsyncLogBufferSize() > 0)
+    AsyncLogInit();
   sched = new Scheduler;
   timer_q = new TimerQueue;
+#if !defined(TIN_NATIVE_TLS)
   glet_tls = new base::ThreadLocalPointer<Greenlet>;
-  ThreadPoll::GetInstance()->Start();
+#endif
+  // one worker each for now, SysMonInit starts the rest off the path to
+  // the entry function.
+  ThreadPoll::GetInstance()->StartFirst();
+  ThreadPoll::GetResolverInstance()->StartFirst();
   M::New(base::Bind(&SysInit), NULL);
   return 0;
 }
@@ -59,21 +116,49 @@ void Env::SysInit() {
   GetM()->SetM0Flag();
   sched->Init();
   SpawnSimple(&MainGlet, NULL, "main");
-  M::New(base::Bind(&SysMon), NULL);
+  M::New(base::Bind(&SysMonInit), NULL);
+}
+
+void Env::SysMonInit() {
+  ThreadPoll::GetInstance()->Start();
+  ThreadPoll::GetResolverInstance()->Start();
+  SysMon();
 }
 
 void* Env::MainGlet(intptr_t) {
+  int n = rtm_conf->PrewarmGreenlets();
+  if (n > 0)
+    rtm_env->Prewarm(n);
+  atomic::release_store(&rtm_env->main_ns_, MonoNow());
   rtm_env->fn_(rtm_env->argc_, rtm_env->argv_);
   rtm_env->OnMainExit();
   return NULL;
 }
 
+void Env::Prewarm(int n) {
+  pollops::ServerInitOnce();
+  PrewarmPollDescriptors(n);
+  // spread over the Ps, each one woken for them gets an M. they wait at
+  // the gate so none exits and hands its stack to the next one.
+  int procs = conf_->MaxProcs();
+  for (int i = 0; i < n; ++i) {
+    SpawnOptions opts(0, "prewarm");
+    opts.proc = i % procs;
+    DoSpawn(opts, base::Bind(&PrewarmGlet));
+  }
+  SemReleaseN(&prewarm_gate, n);
+  for (int i = 0; i < n; ++i)
+    SemAcquire(&prewarm_done);
+}
+
 void Env::OnMainExit() {
   // current workaround, exit directly.
+  AsyncLogFlush();
   _exit(0);
   // TODO(author) wait for all exit, thread pool, net poller etc.
   exit_flag_ = true;
   ThreadPoll::GetInstance()->JoinAll();
+  ThreadPoll::GetResolverInstance()->JoinAll();
   timer_q->Join();
   rtm_env->main_signal_.Signal();
 }
@@ -89,6 +174,8 @@ void Env::SignalInit() {
     bool success = (sigaction(SIGPIPE, &sigpipe_action, NULL) == 0);
     DCHECK(success);
   }
+  if (rtm_conf->IsSigquitDumpEnabled())
+    InstallSigquitDump();
 #endif
 }
 
@@ -108,5 +195,25 @@ TimerQueue* timer_q = NULL;
 base::ThreadLocalPointer<Greenlet>* glet_tls = NULL;
 tin::Config* rtm_conf = NULL;
 
+#if defined(TIN_NATIVE_TLS)
+namespace {
+#if defined(COMPILER_MSVC)
+__declspec(thread) ThreadState thread_state;
+#else
+__thread ThreadState thread_state;
+#endif
+}  // namespace
+
+NOINLINE ThreadState* CurrentThreadState() {
+  ThreadState* ts = &thread_state;
+#if defined(COMPILER_GCC)
+  // a volatile asm keeps lto from proving the function pure and merging
+  // two calls around a switch.
+  __asm__ __volatile__("" : "+r"(ts));
+#endif
+  return ts;
+}
+#endif
+
 }  // namespace runtime
 }  // namespace tin
@@ -9,8 +9,10 @@
 #include "base/threading/thread_local.h"
 
 #include "tin/tin.h"
+#include "tin/sync/atomic.h"
 #include "tin/sync/atomic_flag.h"
 #include "tin/config/config.h"
+#include "tin/runtime/topology.h"
 
 namespace tin {
 namespace runtime {
@@ -26,16 +28,28 @@ class Env {
   int NumberOfProcessors() {
     return num_processors_;
   }
+  const CpuTopology& Topology() const {
+    return topology_;
+  }
+  // the cpu P proc_id is meant to run on.
+  int CpuForProc(int proc_id) const;
   int WaitMainExit();
   bool ExitFlag() const {
     return exit_flag_ == true;
   }
+  // nano seconds from Initialize until the entry function was called,
+  // prewarming included. 0 before.
+  int64 StartupNs() const {
+    return atomic::acquire_load(&main_ns_) == 0 ? 0 : main_ns_ - start_ns_;
+  }
 
  private:
   void SignalInit();
   void PreInit();
   static void SysInit();
+  static void SysMonInit();
   static void* MainGlet(intptr_t);
+  void Prewarm(int n);
   void OnMainExit();
 
  private:
@@ -44,8 +58,11 @@ class Env {
   char** argv_;
   tin::Config* conf_;
   int num_processors_;
+  CpuTopology topology_;
   base::WaitableEvent main_signal_;
   tin::AtomicFlag exit_flag_;
+  int64 start_ns_;
+  int64 main_ns_;
   DISALLOW_COPY_AND_ASSIGN(Env);
 };
 
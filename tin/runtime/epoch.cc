@@ -0,0 +1,189 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <vector>
+
+#include "base/synchronization/lock.h"
+#include "tin/config/config.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/scheduler.h"
+#include "tin/runtime/util.h"
+
+#include "tin/runtime/epoch.h"
+
+namespace tin {
+namespace runtime {
+
+// what one P retired, by epoch modulo kEpochSlots. owner only.
+struct EpochLimbo {
+  struct Entry {
+    void* ptr;
+    RetireFunc f;
+  };
+
+  EpochLimbo()
+    : pending(0) {
+    for (int i = 0; i < kEpochSlots; i++)
+      tag[i] = 0;
+  }
+
+  enum {
+    // e - 2 is freed before e + 1 needs its slot.
+    kEpochSlots = 3
+  };
+  uintptr_t tag[kEpochSlots];
+  std::vector<Entry> entries[kEpochSlots];
+  int pending;
+};
+
+namespace {
+
+// an idle P, see EpochOffline. the global epoch starts above it.
+const uintptr_t kEpochOffline = 0;
+// retired entries of a P before it tries to move the epoch.
+const int kEpochAdvanceBatch = 64;
+
+uintptr_t global_epoch = 1;
+
+// what was retired off a P and what removed Ps left behind, guarded by
+// orphan_lock. orphan_pending may be read without it.
+base::Lock orphan_lock;
+EpochLimbo* orphan = NULL;
+int32 orphan_pending = 0;
+
+EpochLimbo* LimboOf(P* p) {
+  if (p->Limbo() == NULL)
+    p->SetLimbo(new EpochLimbo);
+  return p->Limbo();
+}
+
+void FreeSlot(EpochLimbo* limbo, int slot) {
+  std::vector<EpochLimbo::Entry> entries;
+  entries.swap(limbo->entries[slot]);
+  limbo->pending -= static_cast<int>(entries.size());
+  for (size_t i = 0; i < entries.size(); i++)
+    entries[i].f(entries[i].ptr);
+}
+
+// frees the slots two epochs behind e.
+void FreeSafe(EpochLimbo* limbo, uintptr_t e) {
+  for (int i = 0; i < EpochLimbo::kEpochSlots; i++) {
+    if (!limbo->entries[i].empty() && e - limbo->tag[i] >= 2)
+      FreeSlot(limbo, i);
+  }
+}
+
+// tags ptr with the epoch, true once limbo holds a batch to free.
+bool Push(EpochLimbo* limbo, void* ptr, RetireFunc f) {
+  // full barrier, the unlink before ptr is tagged.
+  uintptr_t e = atomic::load(&global_epoch);
+  int slot = static_cast<int>(e % EpochLimbo::kEpochSlots);
+  if (limbo->tag[slot] != e) {
+    // an epoch three behind.
+    if (!limbo->entries[slot].empty())
+      FreeSlot(limbo, slot);
+    limbo->tag[slot] = e;
+  }
+  EpochLimbo::Entry entry = {ptr, f};
+  limbo->entries[slot].push_back(entry);
+  return ++limbo->pending >= kEpochAdvanceBatch;
+}
+
+// moves the entries of from to to. slots match modulo kEpochSlots, a
+// merged one keeps the later tag, freeing late is always safe.
+void Merge(EpochLimbo* to, EpochLimbo* from) {
+  for (int i = 0; i < EpochLimbo::kEpochSlots; i++) {
+    std::vector<EpochLimbo::Entry>& src = from->entries[i];
+    if (src.empty())
+      continue;
+    std::vector<EpochLimbo::Entry>& dst = to->entries[i];
+    if (dst.empty() ||
+        static_cast<intptr_t>(from->tag[i] - to->tag[i]) > 0) {
+      to->tag[i] = from->tag[i];
+    }
+    dst.insert(dst.end(), src.begin(), src.end());
+    to->pending += static_cast<int>(src.size());
+    from->pending -= static_cast<int>(src.size());
+    src.clear();
+  }
+}
+
+// e + 1 once every running P saw e.
+uintptr_t TryAdvance() {
+  uintptr_t e = atomic::acquire_load(&global_epoch);
+  int nprocs = rtm_conf->MaxProcs();
+  for (int i = 0; i < nprocs; i++) {
+    P* p = sched->Proc(i);
+    if (p == NULL)
+      continue;
+    uintptr_t seen = atomic::acquire_load(p->MutableEpoch());
+    if (seen != e && seen != kEpochOffline)
+      return e;
+  }
+  uintptr_t next = e + 1 == kEpochOffline ? e + 2 : e + 1;
+  atomic::cas(&global_epoch, e, next);
+  return atomic::acquire_load(&global_epoch);
+}
+
+}  // namespace
+
+void EpochRetire(void* ptr, RetireFunc f) {
+  P* p = GetP();
+  if (p == NULL) {
+    // a thread pool worker or a greenlet in RunBlocking, the Ps reclaim
+    // it, see EpochReclaim.
+    base::AutoLock guard(orphan_lock);
+    if (orphan == NULL)
+      orphan = new EpochLimbo;
+    if (Push(orphan, ptr, f))
+      FreeSafe(orphan, TryAdvance());
+    atomic::relaxed_store32(&orphan_pending, orphan->pending);
+    return;
+  }
+  // our own greenlet may still hold what it read, so p does not pass a
+  // quiescent point here, the epoch moves once it has.
+  if (Push(LimboOf(p), ptr, f))
+    FreeSafe(p->Limbo(), TryAdvance());
+}
+
+void EpochQuiescent(P* p) {
+  uintptr_t e = atomic::relaxed_load(&global_epoch);
+  if (atomic::relaxed_load(p->MutableEpoch()) != e) {
+    // full barrier, reads of the greenlets before are done and the ones
+    // after come later, also for a P that was offline.
+    atomic::exchange(p->MutableEpoch(), e);
+  }
+}
+
+void EpochReclaim(P* p) {
+  if (atomic::relaxed_load32(&orphan_pending) != 0 && orphan_lock.Try()) {
+    FreeSafe(orphan, TryAdvance());
+    atomic::relaxed_store32(&orphan_pending, orphan->pending);
+    orphan_lock.Release();
+  }
+  EpochLimbo* limbo = p->Limbo();
+  if (limbo == NULL || limbo->pending == 0)
+    return;
+  FreeSafe(limbo, TryAdvance());
+}
+
+void EpochAbandon(P* p) {
+  EpochLimbo* limbo = p->Limbo();
+  if (limbo == NULL || limbo->pending == 0)
+    return;
+  base::AutoLock guard(orphan_lock);
+  if (orphan == NULL)
+    orphan = new EpochLimbo;
+  Merge(orphan, limbo);
+  atomic::relaxed_store32(&orphan_pending, orphan->pending);
+}
+
+void EpochOffline(P* p) {
+  atomic::release_store(p->MutableEpoch(), kEpochOffline);
+}
+
+}  // namespace runtime
+}  // namespace tin
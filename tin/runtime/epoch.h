@@ -0,0 +1,45 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include "base/basictypes.h"
+
+namespace tin {
+namespace runtime {
+
+class P;
+
+// epoch based reclamation for lock free structures, the quiescent state
+// flavour. a greenlet may read what it finds as long as it does not
+// switch, every park, yield and scheduler round of its P is a quiescent
+// point where the P announces the global epoch it saw. what is unlinked
+// and retired in epoch e is freed once the epoch reached e + 2, every
+// running P passed a quiescent point in between. idle Ps hold nothing, a
+// P in a syscall holds things back until it returns or sysmon retakes it.
+//
+// readers need no guard and pay nothing, but only greenlets may read,
+// not threadpoll or foreign threads.
+typedef void (*RetireFunc)(void* ptr);
+
+// f(ptr) once no greenlet can still see ptr, after ptr was unlinked. off
+// a P, say from threadpoll, it goes to a shared limbo under a lock. f must
+// not block, it may run on g0.
+void EpochRetire(void* ptr, RetireFunc f);
+
+// p is between greenlets, cheap unless the epoch moved.
+void EpochQuiescent(P* p);
+
+// frees what p retired that is safe by now and moves the epoch along if
+// p waits for that, from g0 where no lock of the last greenlet is held.
+void EpochReclaim(P* p);
+
+// p goes idle and holds nothing until its next quiescent point.
+void EpochOffline(P* p);
+
+// hands what p retired to the shared limbo, for a P ResizeProc removes
+// while the world is stopped.
+void EpochAbandon(P* p);
+
+}  // namespace runtime
+}  // namespace tin
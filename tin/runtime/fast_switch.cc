@@ -0,0 +1,41 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "tin/runtime/fast_switch.h"
+
+#if defined(TIN_FIXED_FP_SWITCH)
+// from in rdi, to in rsi, args in rdx. the frame from the stack pointer
+// up: mxcsr and x87 control word, r12-r15, rbx, rbp, rip. a fresh one of
+// make_zcontext takes args in rdi.
+__asm__(
+    ".text\n"
+    ".globl tin_jump_zcontext_fixed_fp\n"
+    ".type tin_jump_zcontext_fixed_fp,@function\n"
+    ".align 16\n"
+    "tin_jump_zcontext_fixed_fp:\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r15\n"
+    "  pushq %r14\n"
+    "  pushq %r13\n"
+    "  pushq %r12\n"
+    "  leaq -0x8(%rsp), %rsp\n"
+    // cheap, and keeps the frame good for a full jump_zcontext.
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 0x4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  leaq 0x8(%rsp), %rsp\n"
+    "  popq %r12\n"
+    "  popq %r13\n"
+    "  popq %r14\n"
+    "  popq %r15\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  popq %r8\n"
+    "  movq %rdx, %rax\n"
+    "  movq %rdx, %rdi\n"
+    "  jmp *%r8\n"
+    ".size tin_jump_zcontext_fixed_fp,.-tin_jump_zcontext_fixed_fp\n");
+#endif
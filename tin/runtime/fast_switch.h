@@ -0,0 +1,23 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include "build/build_config.h"
+#include "context/zcontext.h"
+
+// x86-64 SysV only: there jump_zcontext pays for stmxcsr/fnstcw and the
+// far dearer ldmxcsr/fldcw on every switch. the Windows frame differs,
+// and on AArch64 zcontext saves d8-d15, registers the ABI keeps across
+// calls rather than fp modes, so neither has anything to skip.
+#if defined(ARCH_CPU_X86_64) && defined(OS_POSIX) && !defined(OS_MACOSX)
+#define TIN_FIXED_FP_SWITCH 1
+
+// jump_zcontext without restoring mxcsr and the x87 control word, for a
+// switch between two greenlets that never change them. it saves them
+// still, the frame is the one of zcontext so either one resumes what the
+// other saved.
+extern "C" intptr_t tin_jump_zcontext_fixed_fp(zcontext_t* from,
+                                               zcontext_t to,
+                                               intptr_t args);
+#endif
@@ -2,29 +2,142 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
 #include <utility>
 
+#include "base/logging.h"
 #include "base/memory/scoped_ptr.h"
 #include "base/strings/string_util.h"
+#include "build/build_config.h"
 #include "context/zcontext.h"
+#include "tin/error/error.h"
+#include "tin/runtime/arena.h"
 #include "tin/runtime/m.h"
 #include "tin/runtime/p.h"
 #include "tin/runtime/scheduler.h"
+#include "tin/runtime/spawn.h"
+#include "tin/runtime/stack/huge_page_arena.h"
 #include "tin/runtime/timer/timer_queue.h"
+#include "tin/util/hash.h"
 
 #include "tin/runtime/greenlet.h"
 
 namespace tin {
 namespace runtime {
 
+namespace {
+int32 local_slots = 0;
+LocalDtor local_dtors[kGreenletLocalSlots];
+
+const uintptr_t kStackCanary = static_cast<uintptr_t>(0xfeedfacecafebeefULL);
+// names beyond it are accounted as one.
+const size_t kMaxStackUsageNames = 256;
+
+RawMutex stack_usage_lock;
+std::map<std::string, StackUsageStats>* stack_usage = NULL;
+
+void RecordStackUsage(const char* name, int stack_size, int64 used) {
+  RawMutexGuard guard(&stack_usage_lock);
+  if (stack_usage == NULL)
+    stack_usage = new std::map<std::string, StackUsageStats>;
+  std::string key(name);
+  if (stack_usage->size() >= kMaxStackUsageNames &&
+      stack_usage->find(key) == stack_usage->end()) {
+    key = "(other)";
+  }
+  std::map<std::string, StackUsageStats>::iterator it =
+      stack_usage->find(key);
+  if (it == stack_usage->end()) {
+    StackUsageStats s;
+    memset(&s, 0, sizeof(s));
+    base::strlcpy(s.name, key.c_str(), arraysize(s.name));
+    it = stack_usage->insert(std::make_pair(key, s)).first;
+  }
+  StackUsageStats* s = &it->second;
+  s->exits++;
+  s->sum_used += used;
+  s->max_used = std::max(s->max_used, used);
+  s->stack_size = std::max(s->stack_size, static_cast<int64>(stack_size));
+}
+
+// how often a spawn over the stack budget looks again.
+const int64 kStackBudgetPollNs = 1 * kMillisecond;
+
+// charges a new stack to the budget. over it, waits until it has room or
+// an exited greenlet of size_class can be reused, that one is left in
+// *reused then. false with TIN_ENOMEM if failing fast.
+bool ChargeStack(int stack_size, int size_class, bool joinable,
+                 Greenlet** reused) {
+  // g0, e.g. draining tin::Post, can not wait.
+  Greenlet* curg = GetG();
+  bool can_wait = curg != NULL && !curg->IsG0();
+  while (!sched->StackCharge(stack_size, !can_wait)) {
+    if (rtm_conf->IsStackBudgetFailFastEnabled() && !joinable) {
+      sched->CountStackBudgetFail();
+      SetErrorCode(TIN_ENOMEM);
+      return false;
+    }
+    sched->CountStackBudgetWait();
+    tin::NanoSleep(kStackBudgetPollNs);
+    if (size_class >= 0) {
+      *reused = GetP()->GFGet(size_class);
+      if (*reused != NULL)
+        return true;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+int NewGreenletLocalSlot(LocalDtor dtor) {
+  int32 slot = atomic::Inc32(&local_slots, 1) - 1;
+  if (slot >= kGreenletLocalSlots) {
+    LOG(FATAL) << "out of greenlet local slots, " << kGreenletLocalSlots
+               << " at most";
+  }
+  local_dtors[slot] = dtor;
+  return slot;
+}
+
 Greenlet::Greenlet()
-  : lockedm_(NULL)
+  : state_(GLET_EXITED)
+  , wait_reason_(kParkOther)
+  , priority_(kPriorityLatency)
+  , home_proc_(-1)
+  , sticky_(false)
+  , canceled_(0)
+  , runnable_since_(0)
+  , alllink_(NULL)
+  , lockedm_(NULL)
+  , inplace_run_(NULL)
+  , inplace_(NULL)
+  , stack_size_(0)
+  , stack_dirty_(NULL)
+  , sticky_since_(0)
   , error_code_(0)
-  , timer_(NULL) {
+  , arena_(NULL)
+  , io_wait_hook_(NULL)
+  , io_wait_hook_arg_(NULL)
+  , in_io_wait_hook_(false)
+  , cancel_firing_(false)
+  , cancel_f_(NULL)
+  , cancel_arg_(NULL)
+  , cancel_data_(0)
+  , deadline_(kint64max)
+  , deadline_seq_(0)
+  , deadline_done_(0)
+  , deadline_expired_(0)
+  , joinable_(false)
+  , join_state_(0) {
+  memset(locals_, 0, sizeof(locals_));
 }
 
 Greenlet::~Greenlet() {
-  delete timer_;
+  delete arena_;
 }
 
 void Greenlet::SetName(const char* name) {
@@ -34,11 +147,16 @@ void Greenlet::SetName(const char* name) {
     base::strlcpy(name_, "greenlet", arraysize(name_));
 }
 
-Timer* Greenlet::GetTimer() {
-  if (timer_ == NULL) {
-    timer_ = new Timer;
+Arena* Greenlet::GetArena() {
+  if (arena_ == NULL) {
+    arena_ = new Arena;
   }
-  return timer_;
+  return arena_;
+}
+
+void Greenlet::ReleaseArena(P* p) {
+  if (arena_ != NULL)
+    arena_->Release(p);
 }
 
 Greenlet* Greenlet::Create(GreenletFunc entry,
@@ -47,59 +165,376 @@ Greenlet* Greenlet::Create(GreenletFunc entry,
                            intptr_t args /*= 0*/,
                            bool joinable /*= false*/,
                            int stack_size /*= kDefaultStackSize*/,
-                           const char* name /*= "greenlet"*/) {
-  // joinable, not implement
+                           const char* name /*= "greenlet"*/,
+                           int priority /*= 0*/,
+                           const InPlaceEntry* inplace /*= NULL*/,
+                           int proc /*= -1*/,
+                           bool sticky /*= false*/) {
   if (stack_size == 0)
     stack_size = kDefaultStackSize;
-  scoped_ptr<Greenlet> glet(new Greenlet);
-  {
-    glet->flags_ = 0;
-    glet->args_ = 0;
+  if (!sysg0 && rtm_conf->IsSharedNothingEnabled()) {
+    if (proc < 0)
+      proc = GetP()->Id();
+    sticky = true;
+  }
+  int size_class = StackSizeClass(stack_size);
+  if (size_class >= 0) {
+    // round up, so the stack can be recycled within its size class.
+    stack_size = StackClassSize(size_class);
+  }
+  scoped_ptr<Greenlet> glet;
+  if (!sysg0 && size_class >= 0) {
+    // reuse an exited greenlet together with its warm stack.
+    glet.reset(GetP()->GFGet(size_class));
+  }
+  if (glet.get() == NULL && !sysg0) {
+    Greenlet* reused = NULL;
+    if (!ChargeStack(stack_size, size_class, joinable, &reused))
+      return NULL;
+    glet.reset(reused);
   }
-  glet->state_ = GLET_RUNNABLE;
+  if (glet.get() == NULL && !sysg0) {
+    // an exited greenlet whose stack was freed, already registered.
+    glet.reset(sched->GShellGet());
+  }
+  if (glet.get() == NULL) {
+    glet.reset(new Greenlet);
+    // registered for good, see P::AllGreenlets.
+    if (!sysg0)
+      GetP()->AddGreenlet(glet.get());
+  }
+  if (!glet->HasStack()) {
+    if (rtm_conf->IsHugePagesEnabled() && IsHugePageSlotSize(stack_size)) {
+      glet->stack_.reset(NewStack(kHugePageStack, stack_size));
+    } else if (rtm_conf->IsLazyStackEnabled()) {
+      glet->stack_.reset(NewStack(kLazyStack, stack_size));
+    } else if (rtm_conf->IsStackProtectionEnabled()) {
+      glet->stack_.reset(NewStack(kProtectedFixedStack, stack_size));
+    } else {
+      glet->stack_.reset(NewStack(kFixedStack, stack_size));
+    }
+    glet->stack_size_ = stack_size;
+    glet->stack_dirty_ = NULL;
+  }
+  if (rtm_conf->IsStackHighWaterEnabled())
+    glet->PaintStack();
+#if defined(TIN_FIXED_FP_MODES)
+  glet->flags_ = kGletFlagFixedFp;
+#else
+  // the scheduler loop of g0 leaves them alone.
+  glet->flags_ = sysg0 ? kGletFlagFixedFp : 0;
+#endif
+  glet->lockedm_ = NULL;
+  glet->error_code_ = 0;
+  glet->io_wait_hook_ = NULL;
+  glet->io_wait_hook_arg_ = NULL;
+  glet->in_io_wait_hook_ = false;
+  glet->canceled_ = 0;
+  glet->cancel_f_ = NULL;
+  glet->deadline_expired_ = 0;
+  glet->joinable_ = joinable;
+  glet->join_state_ = 0;
+  glet->retval_ = NULL;
+  glet->SetSchedLink(NULL);
+  glet->wait_reason_ = kParkOther;
+  glet->priority_ = priority;
+  if (priority == kPriorityBatch)
+    sched->SetBatchUsed();
+  glet->home_proc_ = proc;
+  glet->sticky_ = sticky && proc >= 0;
+  glet->runnable_since_ = 0;
+  glet->SetState(GLET_RUNNABLE);
   glet->args_ = args;
   glet->entry_ = entry;
   if (closure != NULL) {
     std::swap(glet->closure_, *closure);
   }
+  glet->inplace_run_ = NULL;
+  if (inplace != NULL)
+    glet->SetInPlace(*inplace);
   glet->SetName(name);
-  if (rtm_conf->IsStackProtectionEnabled()) {
-    glet->stack_.reset(NewStack(kProtectedFixedStack, stack_size));
-  } else {
-    glet->stack_.reset(NewStack(kFixedStack, stack_size));
-  }
   // make_zcontext round address internally.
   glet->context_ =
     make_zcontext(glet->stack_->Pointer(), stack_size, StaticProc);
   if (!sysg0) {
+    GetP()->CountSpawn();
+    TraceEvent(kTraceSpawn, glet.get());
     GetP()->RunqPut(glet.get(), true);
-    sched->WakePIfNecessary();
+    // one with a home is woken there, see Scheduler::StickyReady.
+    if (glet->home_proc_ < 0)
+      sched->WakePIfNecessary();
   } else {
     glet->SetG0Flag();
-    glet_tls->Set(glet.get());
+    SetG(glet.get());
   }
   return glet.release();
 }
 
+bool Greenlet::BeginCancelable(CancelFunc fn, void* arg, uintptr_t data) {
+  RawMutexGuard guard(&cancel_lock_);
+  if (canceled_ != 0 || deadline_expired_ != 0)
+    return false;
+  cancel_f_ = fn;
+  cancel_arg_ = arg;
+  cancel_data_ = data;
+  return true;
+}
+
+bool Greenlet::EndCancelable() {
+  while (true) {
+    {
+      RawMutexGuard guard(&cancel_lock_);
+      cancel_f_ = NULL;
+      if (!cancel_firing_)
+        return canceled_ != 0 || deadline_expired_ != 0;
+    }
+    // fn may still touch the state of the wait, or park on a lock.
+    tin::Sched();
+  }
+}
+
+void Greenlet::Cancel() {
+  Interrupt(false, 0);
+}
+
+void Greenlet::SetDeadline(int64 when) {
+  if (deadline_timer_.f != NULL) {
+    if (!timer_q->DelTimer(&deadline_timer_)) {
+      // fired, wait until its callback is done with us.
+      while (atomic::acquire_load(&deadline_done_) != deadline_timer_.seq)
+        tin::Sched();
+    }
+    deadline_timer_.f = NULL;
+  }
+  bool expired = when != kint64max && when <= MonoNow();
+  {
+    RawMutexGuard guard(&cancel_lock_);
+    deadline_seq_++;
+    deadline_ = when;
+    atomic::release_store32(&deadline_expired_, expired ? 1 : 0);
+  }
+  if (when == kint64max || expired)
+    return;
+  deadline_timer_.when = when;
+  deadline_timer_.slack = 0;
+  deadline_timer_.f = OnDeadline;
+  deadline_timer_.arg = this;
+  deadline_timer_.seq = deadline_seq_;
+  timer_q->AddTimer(&deadline_timer_);
+}
+
+int Greenlet::InterruptError() const {
+  return Canceled() ? TIN_ECANCELED : TIN_ETIMEOUT_INTR;
+}
+
+void Greenlet::OnDeadline(void* arg, uintptr_t seq) {
+  Greenlet* gp = static_cast<Greenlet*>(arg);
+  gp->Interrupt(true, seq);
+  atomic::release_store(&gp->deadline_done_, seq);
+}
+
+void Greenlet::Interrupt(bool deadline, uintptr_t seq) {
+  CancelFunc fn = NULL;
+  void* arg = NULL;
+  uintptr_t data = 0;
+  {
+    RawMutexGuard guard(&cancel_lock_);
+    uint32* flag = deadline ? &deadline_expired_ : &canceled_;
+    if (*flag != 0 || (deadline && seq != deadline_seq_))
+      return;
+    atomic::release_store32(flag, 1);
+    if (cancel_f_ == NULL)
+      return;
+    fn = cancel_f_;
+    arg = cancel_arg_;
+    data = cancel_data_;
+    cancel_f_ = NULL;
+    cancel_firing_ = true;
+  }
+  // without the lock, fn takes the locks of the wait which the greenlet
+  // holds while registering.
+  fn(arg, data);
+  RawMutexGuard guard(&cancel_lock_);
+  cancel_firing_ = false;
+}
+
+namespace {
+const uintptr_t kJoinExited = 1;
+}  // namespace
+
+bool Greenlet::JoinCommit(void* arg1, void* arg2) {
+  uintptr_t* state = static_cast<uintptr_t*>(arg2);
+  // fails if reaped meanwhile, the joiner is requeued then.
+  return atomic::release_cas(state, 0, reinterpret_cast<uintptr_t>(arg1));
+}
+
+void* Greenlet::Join() {
+  DCHECK(joinable_) << "Join of a greenlet not spawned joinable";
+  G* gp = GetG();
+  while (atomic::acquire_load(&join_state_) != kJoinExited) {
+    Park(JoinCommit, gp, &join_state_, kParkJoin);
+  }
+  void* retval = retval_;
+  joinable_ = false;
+  P* p = GetP();
+  if (p != NULL) {
+    p->GFPut(this);
+  } else {
+    sched->GShellPutBatch(this, this);
+  }
+  return retval;
+}
+
+void Greenlet::CompleteJoin() {
+  uintptr_t joiner = atomic::exchange(&join_state_, kJoinExited);
+  if (joiner != 0)
+    Ready(GpCastBack(joiner));
+}
+
+void Greenlet::ReleaseIdleStack() {
+  // released pages read back as zeros, not the canary.
+  if (rtm_conf->IsStackHighWaterEnabled())
+    return;
+  // context_ is the saved stack pointer of a switched out greenlet.
+  stack_->ReleaseUnused(reinterpret_cast<void*>(context_));
+}
+
+void Greenlet::PaintStack() {
+  uintptr_t* top = static_cast<uintptr_t*>(stack_->Pointer());
+  uintptr_t* p = stack_dirty_;
+  if (p == NULL)
+    p = static_cast<uintptr_t*>(stack_->Bottom());
+  // a recycled stack only needs what its last run used.
+  for (; p < top; p++)
+    *p = kStackCanary;
+  stack_dirty_ = top;
+}
+
+void Greenlet::RecordStackHighWater() {
+  if (stack_dirty_ == NULL || !HasStack())
+    return;
+  uintptr_t* top = static_cast<uintptr_t*>(stack_->Pointer());
+  uintptr_t* p = static_cast<uintptr_t*>(stack_->Bottom());
+  while (p < top && *p == kStackCanary)
+    p++;
+  stack_dirty_ = p;
+  RecordStackUsage(name_, stack_size_,
+                   reinterpret_cast<char*>(top) - reinterpret_cast<char*>(p));
+}
+
+void Greenlet::DropStack() {
+  if (stack_.get() != NULL)
+    sched->StackUncharge(stack_size_);
+  stack_.reset();
+  stack_size_ = 0;
+}
+
+namespace {
+
+// slots of the saved frame pointer and return address above the saved
+// stack pointer, zcontext pushes the callee saved registers like fcontext.
+#if defined(ARCH_CPU_X86_64)
+// mxcsr and x87 control word, r12-r15, rbx, rbp, rip.
+const int kSavedFpSlot = 6;
+const int kSavedPcSlot = 7;
+#elif defined(ARCH_CPU_ARM64)
+// d8-d15, x19-x28, fp, lr.
+const int kSavedFpSlot = 18;
+const int kSavedPcSlot = 19;
+#else
+const int kSavedFpSlot = -1;
+const int kSavedPcSlot = -1;
+#endif
+
+}  // namespace
+
+int Greenlet::SavedBacktrace(uintptr_t* pcs, int max) {
+  if (kSavedPcSlot < 0 || stack_.get() == NULL || max <= 0)
+    return 0;
+  uintptr_t lo = reinterpret_cast<uintptr_t>(context_);
+  uintptr_t hi = reinterpret_cast<uintptr_t>(stack_->Pointer());
+  if (lo == 0 || hi - lo > static_cast<uintptr_t>(stack_size_))
+    return 0;
+  uintptr_t* saved = reinterpret_cast<uintptr_t*>(lo);
+  int n = 0;
+  pcs[n++] = saved[kSavedPcSlot];
+  uintptr_t fp = saved[kSavedFpSlot];
+  // every frame is a saved fp followed by the return address, and frames
+  // only grow towards the stack top.
+  while (n < max && fp > lo && fp + 2 * sizeof(uintptr_t) <= hi &&
+         fp % sizeof(uintptr_t) == 0) {
+    uintptr_t* frame = reinterpret_cast<uintptr_t*>(fp);
+    if (frame[1] == 0)
+      break;
+    pcs[n++] = frame[1];
+    lo = fp;
+    fp = frame[0];
+  }
+  return n;
+}
+
+void Greenlet::SetInPlace(const InPlaceEntry& entry) {
+  inplace_ = &inplace_buf_;
+  if (entry.size > sizeof(inplace_buf_))
+    inplace_ = ::operator new(entry.size);
+  entry.construct(inplace_, entry.src);
+  inplace_run_ = entry.run;
+}
+
 void Greenlet::StaticProc(intptr_t args) {
   Greenlet* glet = reinterpret_cast<Greenlet*>(args);
   glet->Proc();
 }
 
 void Greenlet::Proc() {
-  if (!closure_.is_null()) {
+  // started by a parking greenlet instead of g0.
+  sched->OnSwitch(this);
+  // placed, from now on it goes where it is woken.
+  if (!sticky_)
+    home_proc_ = -1;
+  if (inplace_run_ != NULL) {
+    // runs and destroys the callable.
+    inplace_run_(inplace_);
+    inplace_run_ = NULL;
+    if (inplace_ != &inplace_buf_)
+      ::operator delete(inplace_);
+  } else if (!closure_.is_null()) {
     closure_.Run();
   } else {
     retval_ = entry_(args_);
   }
+  // release bound arguments now, this greenlet may sit in a free list.
+  closure_.Reset();
+  RunLocalDtors();
 
   // glet exit.
+  if (lockedm_ != NULL) {
+    // exited while locked, free the thread for other greenlets.
+    *lockedm_->MutableLocked() = 0;
+    lockedm_->SetLockedG(NULL);
+    lockedm_ = NULL;
+  }
   // add to m local dead queue.
+  M()->P()->CountExit();
   M()->AddToDeadQueue(this);
-  Park();
+  Park(NULL, NULL, NULL, kParkExit);
   // never return.
 }
 
+void Greenlet::RunLocalDtors() {
+  int32 n = atomic::acquire_load32(&local_slots);
+  if (n > kGreenletLocalSlots)
+    n = kGreenletLocalSlots;
+  for (int i = 0; i < n; i++) {
+    void* value = locals_[i];
+    if (value == NULL)
+      continue;
+    locals_[i] = NULL;
+    if (local_dtors[i] != NULL)
+      local_dtors[i](value);
+  }
+}
+
 void SpawnSimple(GreenletFunc entry, void* args,  const char* name) {
   Greenlet::Create(entry,
                    NULL,
@@ -120,8 +555,52 @@ void SpawnSimple(base::Closure closure,  const char* name) {
                    name);
 }
 
+G* SpawnJoinable(GreenletFunc entry, void* args, const char* name) {
+  return Greenlet::Create(entry,
+                          NULL,
+                          false,
+                          reinterpret_cast<intptr_t>(args),
+                          true,
+                          0,
+                          name);
+}
+
+G* SpawnJoinable(base::Closure closure, const SpawnOptions& opts) {
+  return Greenlet::Create(NULL,
+                          &closure,
+                          false,
+                          0,
+                          true,
+                          opts.stack_size,
+                          opts.name,
+                          opts.priority);
+}
+
+void* JoinGreenlet(G* gp) {
+  return gp->Join();
+}
+
 }  // namespace runtime
 
+int GetStackUsageStats(StackUsageStats* stats, int max) {
+  runtime::RawMutexGuard guard(&runtime::stack_usage_lock);
+  if (runtime::stack_usage == NULL)
+    return 0;
+  int i = 0;
+  for (std::map<std::string, StackUsageStats>::const_iterator it =
+           runtime::stack_usage->begin();
+       it != runtime::stack_usage->end() && i < max; ++it) {
+    stats[i++] = it->second;
+  }
+  return static_cast<int>(runtime::stack_usage->size());
+}
+
+void ResetStackUsageStats() {
+  runtime::RawMutexGuard guard(&runtime::stack_usage_lock);
+  if (runtime::stack_usage != NULL)
+    runtime::stack_usage->clear();
+}
+
 void RuntimeSpawn(base::Closure* closure) {
   runtime::Greenlet::Create(NULL,
                             closure,
@@ -131,4 +610,60 @@ void RuntimeSpawn(base::Closure* closure) {
                             0);
 }
 
+void RuntimeSpawnInPlace(const runtime::InPlaceEntry& entry,
+                         const SpawnOptions* opts) {
+  SpawnOptions defaults;
+  if (opts == NULL)
+    opts = &defaults;
+  runtime::Greenlet::Create(NULL,
+                            NULL,
+                            false,
+                            0,
+                            false,
+                            opts->stack_size,
+                            opts->name,
+                            opts->priority,
+                            &entry,
+                            opts->proc,
+                            opts->sticky);
+}
+
+void RuntimeSpawn(base::Closure* closure, const SpawnOptions& opts) {
+  runtime::Greenlet::Create(NULL,
+                            closure,
+                            false,
+                            0,
+                            false,
+                            opts.stack_size,
+                            opts.name,
+                            opts.priority,
+                            NULL,
+                            opts.proc,
+                            opts.sticky);
+}
+
+void Post(const base::Closure& closure) {
+  Post(closure, SpawnOptions());
+}
+
+void Post(const base::Closure& closure, const SpawnOptions& opts) {
+  runtime::PostedWork* work = new runtime::PostedWork;
+  work->closure = closure;
+  work->opts = opts;
+  // the spawn comes later, keep a copy.
+  if (opts.name != NULL)
+    work->name = opts.name;
+  runtime::sched->PostPut(work);
+}
+
+void SendTo(int proc, const base::Closure& closure) {
+  runtime::sched->MailSend(proc, closure);
+}
+
+int ProcOfKey(const base::StringPiece& key) {
+  // multiply and shift rather than a modulo.
+  uint64 h = Hash64(key) >> 32;
+  return static_cast<int>((h * runtime::rtm_conf->MaxProcs()) >> 32);
+}
+
 }  // namespace tin
@@ -10,15 +10,23 @@
 #include "base/callback.h"
 #include "context/zcontext.h"
 #include "tin/config/config.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/runtime.h"
 #include "tin/runtime/util.h"
 #include "tin/runtime/guintptr.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/spawn.h"
 #include "tin/runtime/stack/stack.h"
+#include "tin/runtime/timer/timer.h"
 
 namespace tin {
+
+struct SpawnOptions;
+
 namespace runtime {
 
 class M;
-struct Timer;
+class Arena;
 
 enum GletState {
   GLET_RUNNING = 0,
@@ -30,9 +38,19 @@ enum GletState {
 
 enum GreenletFlag {
   kGletFlagG0 = 1,
+  // never changes mxcsr or the x87 control word, see SetFixedFpModes.
+  kGletFlagFixedFp = 2,
 };
 
+// slots of greenlet local storage, see GLocal.
+const int kGreenletLocalSlots = 16;
+
 typedef void* (*GreenletFunc)(intptr_t);
+// frees a greenlet local value left at exit.
+typedef void (*LocalDtor)(void* value);
+typedef void (*IoWaitHook)(void* arg);
+// ends a cancelable wait early, see Greenlet::BeginCancelable.
+typedef void (*CancelFunc)(void* arg, uintptr_t data);
 
 class Greenlet {
  public:
@@ -63,14 +81,65 @@ class Greenlet {
     lockedm_ = m;
   }
 
+  // next greenlet created on the same P, see P::AllGreenlets.
+  Greenlet* AllLink() const {
+    return alllink_;
+  }
+
+  void SetAllLink(Greenlet* gp) {
+    alllink_ = gp;
+  }
+
+  // the TraceParkReason of the last park.
+  int WaitReason() const {
+    return wait_reason_;
+  }
+
+  void SetWaitReason(int reason) {
+    wait_reason_ = reason;
+  }
+
   int GetState() const {
     return state_;
   }
 
+  // a GreenletPriority, fixed at Create.
+  int Priority() const {
+    return priority_;
+  }
+
   void SetState(int state) {
+    if (state == GLET_RUNNABLE && rtm_conf->IsSchedLatencyEnabled())
+      runnable_since_ = MonoNow();
     state_ = state;
   }
 
+  // the P it is queued on whenever it becomes runnable, -1 for the P
+  // making it runnable. see SpawnOptions::proc.
+  int HomeProc() const {
+    return home_proc_;
+  }
+
+  bool IsSticky() const {
+    return sticky_;
+  }
+
+  // CoarseNow() when it was queued on its home P.
+  int64 StickySince() const {
+    return sticky_since_;
+  }
+
+  void SetStickySince(int64 since) {
+    sticky_since_ = since;
+  }
+
+  // MonoNow() when it last became runnable, 0 if not taken yet.
+  int64 TakeRunnableSince() {
+    int64 since = runnable_since_;
+    runnable_since_ = 0;
+    return since;
+  }
+
   void SetName(const char* name);
 
   const char* GetName() {
@@ -97,7 +166,131 @@ class Greenlet {
     return (flags_ & kGletFlagG0) != 0;
   }
 
-  Timer* GetTimer();
+  void SetFixedFp(bool fixed) {
+    if (fixed)
+      flags_ |= kGletFlagFixedFp;
+    else
+      flags_ &= ~kGletFlagFixedFp;
+  }
+
+  bool HasFixedFp() {
+    return (flags_ & kGletFlagFixedFp) != 0;
+  }
+
+  // the timer of sleeps and timed waits, one at a time.
+  Timer* GetTimer() {
+    return &timer_;
+  }
+
+  // created on first use, its chunks are given back once the greenlet
+  // exited and is switched out, see M::ClearDeadQueue.
+  Arena* GetArena();
+  void ReleaseArena(P* p);
+
+  // run on this greenlet right before it parks waiting for network io,
+  // e.g. to flush buffered output. one hook per greenlet, NULL clears.
+  void SetIoWaitHook(IoWaitHook hook, void* arg) {
+    io_wait_hook_ = hook;
+    io_wait_hook_arg_ = arg;
+  }
+
+  void* IoWaitHookArg() const {
+    return io_wait_hook_arg_;
+  }
+
+  void RunIoWaitHook() {
+    if (io_wait_hook_ != NULL && !in_io_wait_hook_) {
+      // the hook may do io and wait itself.
+      in_io_wait_hook_ = true;
+      io_wait_hook_(io_wait_hook_arg_);
+      in_io_wait_hook_ = false;
+    }
+  }
+
+  // a wait that Cancel or the deadline may end early registers fn to wake
+  // the greenlet before it parks, false if it is interrupted already and
+  // must not park.
+  bool BeginCancelable(CancelFunc fn, void* arg, uintptr_t data);
+
+  // after the wait, whichever way it ended. waits for a Cancel running fn
+  // on another greenlet, returns true if the greenlet is interrupted.
+  bool EndCancelable();
+
+  // marks the greenlet canceled for good and ends its cancelable wait, if
+  // any. the caller must keep the greenlet from exiting meanwhile.
+  void Cancel();
+
+  bool Canceled() const {
+    return atomic::acquire_load32(&canceled_) != 0;
+  }
+
+  // see tin::Deadline, kint64max if none.
+  int64 Deadline() const {
+    return deadline_;
+  }
+
+  // the deadline ends the cancelable waits of the greenlet like Cancel
+  // once it passed, until a later one is set. one timer however many
+  // waits happen before.
+  void SetDeadline(int64 when);
+
+  bool DeadlineExpired() const {
+    return atomic::acquire_load32(&deadline_expired_) != 0;
+  }
+
+  // canceled or past the deadline, a cancelable wait ends at once.
+  bool Interrupted() const {
+    return Canceled() || DeadlineExpired();
+  }
+
+  // what an interrupted wait fails with, TIN_ECANCELED or, past the
+  // deadline only, TIN_ETIMEOUT_INTR.
+  int InterruptError() const;
+
+  // kept after its exit until Join, see SpawnJoinable.
+  bool Joinable() const {
+    return joinable_;
+  }
+
+  // parks until the joinable greenlet has exited and is switched out,
+  // recycles it and returns what its entry returned. one joiner only.
+  void* Join();
+
+  // by the M that reaped the exited joinable greenlet.
+  void CompleteJoin();
+
+  // slot is an index from NewGreenletLocalSlot.
+  void* Local(int slot) const {
+    return locals_[slot];
+  }
+
+  void SetLocal(int slot, void* value) {
+    locals_[slot] = value;
+  }
+
+  int StackSize() const {
+    return stack_size_;
+  }
+
+  // must be called while the greenlet is switched out.
+  void ReleaseIdleStack();
+
+  // measures the stack of the exited greenlet against the canary painted
+  // at Create, see Config::EnableStackHighWater.
+  void RecordStackHighWater();
+
+  bool HasStack() const {
+    return stack_.get() != NULL;
+  }
+
+  // frees the stack of an exited greenlet, the greenlet itself stays
+  // registered and may be reused by Create.
+  void DropStack();
+
+  // return addresses of a switched out greenlet, leaf first, found by
+  // walking frame pointers from its saved context. frames built without
+  // frame pointers end the walk early, 0 on unknown architectures.
+  int SavedBacktrace(uintptr_t* pcs, int max);
 
   static Greenlet* Create(GreenletFunc entry,
                           base::Closure* closure,
@@ -105,28 +298,86 @@ class Greenlet {
                           intptr_t args = 0,
                           bool joinable = false,
                           int stack_size = kDefaultStackSize,
-                          const char* name = "greenlet");
+                          const char* name = "greenlet",
+                          int priority = 0,
+                          const InPlaceEntry* inplace = NULL,
+                          int proc = -1,
+                          bool sticky = false);
 
  private:
   static void StaticProc(intptr_t args);
+  static bool JoinCommit(void* arg1, void* arg2);
+  static void OnDeadline(void* arg, uintptr_t seq);
+  // sets canceled_ or, for the deadline of seq, deadline_expired_ and ends
+  // the cancelable wait.
+  void Interrupt(bool deadline, uintptr_t seq);
+  void PaintStack();
+  // moves the callable of an in place spawn into the greenlet.
+  void SetInPlace(const InPlaceEntry& entry);
   void Proc();
+  void RunLocalDtors();
 
  private:
+  // hot, what queueing and switching touch comes first so it shares
+  // the first lines.
   GUintptr schedlink_;
   tin::runtime::M* m_;
+  int state_;
+  int wait_reason_;
+  int priority_;
+  int home_proc_;
+  // keeps home_proc_ once started.
+  bool sticky_;
+  int32 flags_;
+  uint32 canceled_;
+  int64 runnable_since_;
+  zcontext_t context_;
+  // cold below.
+  Greenlet* alllink_;
   tin::runtime::M* lockedm_;
   base::Closure cb_;
   GreenletFunc entry_;
   base::Closure closure_;
+  // see SetInPlace, inplace_ points to inplace_buf_ or the heap.
+  void (*inplace_run_)(void* storage);
+  void* inplace_;
+  union {
+    long double align;
+    char bytes[kInPlaceSpawnSize];
+  } inplace_buf_;
   intptr_t args_;
   void* retval_;
   char name_[32];
   scoped_ptr<Stack> stack_;
-  zcontext_t context_;
-  int state_;
-  int32 flags_;
+  int stack_size_;
+  // below it the stack still holds the canary, NULL if not painted.
+  uintptr_t* stack_dirty_;
+  int64 sticky_since_;
   int error_code_;
-  Timer* timer_;
+  Timer timer_;
+  Arena* arena_;
+  IoWaitHook io_wait_hook_;
+  void* io_wait_hook_arg_;
+  bool in_io_wait_hook_;
+  // see Cancel, the hook and cancel_firing_ are guarded by cancel_lock_,
+  // canceled_ is up with the hot fields.
+  RawMutex cancel_lock_;
+  bool cancel_firing_;
+  CancelFunc cancel_f_;
+  void* cancel_arg_;
+  uintptr_t cancel_data_;
+  // deadline_seq_ tells the timer of an earlier deadline, which stores its
+  // seq in deadline_done_ once its callback is done with us.
+  int64 deadline_;
+  uintptr_t deadline_seq_;
+  uintptr_t deadline_done_;
+  uint32 deadline_expired_;
+  Timer deadline_timer_;
+  bool joinable_;
+  // 0 while running, kJoinExited once reaped, else the parked joiner.
+  uintptr_t join_state_;
+  // NULL again once the greenlet exited, see RunLocalDtors.
+  void* locals_[kGreenletLocalSlots];
   DISALLOW_COPY_AND_ASSIGN(Greenlet);
 };
 
@@ -134,6 +385,19 @@ void SpawnSimple(GreenletFunc entry, void* args = NULL,
                  const char* name = NULL);
 void SpawnSimple(base::Closure closure,  const char* name = NULL);
 
+// like SpawnSimple, but the greenlet is kept after it exits until
+// JoinGreenlet, which must be called exactly once.
+G* SpawnJoinable(GreenletFunc entry, void* args = NULL,
+                 const char* name = NULL);
+G* SpawnJoinable(base::Closure closure, const SpawnOptions& opts);
+
+// returns what the entry of gp returned, NULL for a closure.
+void* JoinGreenlet(G* gp);
+
+// a free local slot of every greenlet, dtor (may be NULL) frees values
+// left at exit. slots are never given back, allocate them at startup.
+int NewGreenletLocalSlot(LocalDtor dtor);
+
 }  // namespace runtime
 
 void RuntimeSpawn(base::Closure* closure);
@@ -0,0 +1,176 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "build/build_config.h"
+
+#if defined(OS_POSIX)
+#include <execinfo.h>
+#endif
+
+#include "base/strings/string_util.h"
+#include "base/strings/stringprintf.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/scheduler.h"
+
+#include "tin/runtime/greenlet_dump.h"
+
+namespace tin {
+namespace runtime {
+
+namespace {
+
+const int kMaxDumpFrames = 32;
+
+int32 dump_requested = 0;
+
+bool IsExited(G* gp) {
+  int state = gp->GetState();
+  // parked for good, not reaped yet.
+  return state == GLET_EXITED ||
+         (state == GLET_WAITING && gp->WaitReason() == kParkExit);
+}
+
+const char* StateName(int state) {
+  switch (state) {
+    case GLET_RUNNING:
+      return "running";
+    case GLET_RUNNABLE:
+      return "runnable";
+    case GLET_WAITING:
+      return "waiting";
+    case GLET_SYSCALL:
+      return "syscall";
+    default:
+      return "exited";
+  }
+}
+
+void AppendBacktrace(G* gp, std::string* out) {
+  uintptr_t pcs[kMaxDumpFrames];
+  int n = gp->SavedBacktrace(pcs, kMaxDumpFrames);
+#if defined(OS_POSIX)
+  char** symbols = backtrace_symbols(reinterpret_cast<void**>(pcs), n);
+#endif
+  for (int i = 0; i < n; i++) {
+    base::StringAppendF(out, "  #%d 0x%lx", i,
+                        static_cast<unsigned long>(pcs[i]));
+#if defined(OS_POSIX)
+    if (symbols != NULL)
+      base::StringAppendF(out, " %s", symbols[i]);
+#endif
+    out->append("\n");
+  }
+#if defined(OS_POSIX)
+  free(symbols);
+#endif
+}
+
+#if defined(OS_POSIX)
+void SigquitHandler(int sig) {
+  atomic::release_store32(&dump_requested, 1);
+}
+#endif
+
+}  // namespace
+
+void InstallSigquitDump() {
+#if defined(OS_POSIX)
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SigquitHandler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGQUIT, &sa, NULL);
+#endif
+}
+
+void PollSigquitDump() {
+  if (atomic::relaxed_load32(&dump_requested) == 0)
+    return;
+  atomic::exchange32(&dump_requested, 0);
+  std::string out;
+  DumpGreenlets(&out);
+  fwrite(out.data(), 1, out.size(), stderr);
+  fflush(stderr);
+}
+
+}  // namespace runtime
+
+void CountGreenlets(GreenletCounts* counts) {
+  memset(counts, 0, sizeof(*counts));
+  for (int i = 0; i < runtime::kTinProcsLimit; i++) {
+    for (runtime::G* gp = runtime::sched->AllGreenlets(i); gp != NULL;
+         gp = gp->AllLink()) {
+      if (runtime::IsExited(gp))
+        continue;
+      counts->live++;
+      switch (gp->GetState()) {
+        case runtime::GLET_RUNNING:
+          counts->running++;
+          break;
+        case runtime::GLET_RUNNABLE:
+          counts->runnable++;
+          break;
+        case runtime::GLET_SYSCALL:
+          counts->syscall++;
+          break;
+        default: {
+          int reason = gp->WaitReason();
+          if (reason < 0 || reason >= runtime::kNumParkReasons)
+            reason = runtime::kParkOther;
+          counts->waiting[reason]++;
+          break;
+        }
+      }
+    }
+  }
+}
+
+void DumpGreenlets(std::string* out) {
+  GreenletCounts counts;
+  CountGreenlets(&counts);
+  base::StringAppendF(
+      out, "greenlets: %lld live, %lld running, %lld runnable, "
+      "%lld syscall", static_cast<long long>(counts.live),
+      static_cast<long long>(counts.running),
+      static_cast<long long>(counts.runnable),
+      static_cast<long long>(counts.syscall));
+  for (int r = 0; r < runtime::kNumParkReasons; r++) {
+    if (counts.waiting[r] != 0) {
+      base::StringAppendF(out, ", %lld %s",
+                          static_cast<long long>(counts.waiting[r]),
+                          runtime::TraceParkReasonName(r));
+    }
+  }
+  out->append("\n");
+
+  for (int i = 0; i < runtime::kTinProcsLimit; i++) {
+    for (runtime::G* gp = runtime::sched->AllGreenlets(i); gp != NULL;
+         gp = gp->AllLink()) {
+      if (runtime::IsExited(gp))
+        continue;
+      int state = gp->GetState();
+      char name[32];
+      base::strlcpy(name, gp->GetName(), arraysize(name));
+      base::StringAppendF(out, "\ngreenlet %p \"%s\" [%s", gp, name,
+                          runtime::StateName(state));
+      if (state == runtime::GLET_WAITING) {
+        base::StringAppendF(
+            out, ", %s", runtime::TraceParkReasonName(gp->WaitReason()));
+      }
+      out->append("]\n");
+      // the saved context of a running greenlet is stale.
+      if (state == runtime::GLET_WAITING || state == runtime::GLET_RUNNABLE)
+        runtime::AppendBacktrace(gp, out);
+    }
+  }
+}
+
+}  // namespace tin
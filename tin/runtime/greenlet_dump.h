@@ -0,0 +1,41 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <string>
+
+#include "base/basictypes.h"
+#include "tin/runtime/trace.h"
+
+namespace tin {
+
+struct GreenletCounts {
+  // greenlets that have not exited.
+  int64 live;
+  int64 running;
+  int64 runnable;
+  int64 syscall;
+  // waiting ones by runtime::TraceParkReason.
+  int64 waiting[runtime::kNumParkReasons];
+};
+
+void CountGreenlets(GreenletCounts* counts);
+
+// appends the counts and then every live greenlet with its id, name,
+// state, wait reason and the backtrace of where it was switched out to
+// out. the world is not stopped, so a greenlet that runs meanwhile may
+// show a stale state or a torn backtrace.
+void DumpGreenlets(std::string* out);
+
+namespace runtime {
+
+// makes SIGQUIT request a dump, see Config::EnableSigquitDump.
+void InstallSigquitDump();
+
+// called by sysmon, writes a requested dump to stderr.
+void PollSigquitDump();
+
+}  // namespace runtime
+}  // namespace tin
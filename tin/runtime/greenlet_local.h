@@ -0,0 +1,61 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/util.h"
+
+namespace tin {
+
+// a T* per greenlet, NULL until Set. a lookup is the current greenlet
+// plus a slot index. keys take one of kGreenletLocalSlots slots for good,
+// make them globals set up at startup. an owning key deletes the value a
+// greenlet leaves behind when it exits.
+//
+//   tin::GLocal<RequestContext> request_context;
+//   request_context.Set(new RequestContext(trace_id));
+//   request_context.Get()->trace_id;
+template <typename T>
+class GLocal {
+ public:
+  explicit GLocal(bool owned = true)
+    : slot_(runtime::NewGreenletLocalSlot(owned ? &Delete : NULL))
+    , owned_(owned) {
+  }
+
+  T* Get() const {
+    return static_cast<T*>(runtime::GetG()->Local(slot_));
+  }
+
+  // the old value is not deleted, see Reset.
+  void Set(T* value) {
+    runtime::GetG()->SetLocal(slot_, value);
+  }
+
+  T* Release() {
+    T* value = Get();
+    Set(NULL);
+    return value;
+  }
+
+  void Reset(T* value = NULL) {
+    T* old = Get();
+    Set(value);
+    if (owned_ && old != NULL && old != value)
+      Delete(old);
+  }
+
+ private:
+  static void Delete(void* value) {
+    delete static_cast<T*>(value);
+  }
+
+  const int slot_;
+  const bool owned_;
+  DISALLOW_COPY_AND_ASSIGN(GLocal);
+};
+
+}  // namespace tin
@@ -0,0 +1,459 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "build/build_config.h"
+
+#if defined(OS_POSIX)
+#include <signal.h>
+#endif
+
+#include "base/compiler_specific.h"
+#include "base/logging.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/platform_thread.h"
+#include "tin/sync/atomic.h"
+#include "tin/time/time.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/pprof.h"
+#include "tin/runtime/util.h"
+
+#include "tin/runtime/profiler.h"
+
+#if defined(TIN_HEAP_PROFILER)
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void __libc_free(void* p);
+}
+#define TIN_RAW_MALLOC __libc_malloc
+#define TIN_RAW_FREE __libc_free
+#else
+#define TIN_RAW_MALLOC malloc
+#define TIN_RAW_FREE free
+#endif
+
+#if defined(COMPILER_MSVC)
+#define TIN_HEAP_TLS __declspec(thread)
+#else
+// no lazy tls block, which would be malloc'ed from inside malloc.
+#define TIN_HEAP_TLS __thread __attribute__((tls_model("initial-exec")))
+#endif
+
+namespace tin {
+namespace runtime {
+
+namespace {
+
+const int kMaxFrames = 32;
+// many, so a free mostly finds its bucket empty, see OnFree.
+const int kBuckets = 64 * 1024;
+const int kDumpPollMs = 100;
+
+struct HeapSample {
+  HeapSample* next;
+  uintptr_t ptr;
+  size_t size;
+  // the rate it was sampled at, for the scaling.
+  intptr_t rate;
+  int depth;
+  char name[32];
+  void* pcs[kMaxFrames];
+};
+
+// a spin lock each, malloc may run before anything is constructed. live
+// counts the samples, a free reads it before it takes the lock.
+struct HeapBucket {
+  int32 lock;
+  int32 live;
+  HeapSample* head;
+};
+
+// bytes allocated until the next sample, and the generator of the gaps.
+struct HeapThread {
+  int64 countdown;
+  uint64 rng;
+  // recording a sample, its own allocations are not sampled.
+  int32 busy;
+};
+
+intptr_t heap_rate = 0;
+int32 heap_live = 0;
+HeapBucket heap_buckets[kBuckets];
+TIN_HEAP_TLS HeapThread heap_thread;
+
+void LockBucket(HeapBucket* b) {
+  while (!atomic::acquire_cas32(&b->lock, 0, 1))
+    YieldLogicProcessor();
+}
+
+void UnlockBucket(HeapBucket* b) {
+  atomic::release_store32(&b->lock, 0);
+}
+
+HeapBucket* BucketOf(uintptr_t ptr) {
+  // the low bits are alignment.
+  return &heap_buckets[(ptr >> 4) * 2654435761u % kBuckets];
+}
+
+// exponential gaps with a mean of rate, so each byte is equally likely
+// to be sampled whatever the allocation pattern.
+int64 NextGap(HeapThread* t, intptr_t rate) {
+  t->rng ^= t->rng << 13;
+  t->rng ^= t->rng >> 7;
+  t->rng ^= t->rng << 17;
+  double u = static_cast<double>((t->rng >> 11) + 1) / 9007199254740992.0;
+  return static_cast<int64>(-log(u) * rate) + 1;
+}
+
+void CopyName(char* dst, const char* src, size_t size) {
+  size_t i = 0;
+  for (; src != NULL && src[i] != '\0' && i + 1 < size; i++)
+    dst[i] = src[i];
+  dst[i] = '\0';
+}
+
+NOINLINE void SampleAlloc(void* p, size_t size, intptr_t rate) {
+  HeapThread* t = &heap_thread;
+  if (t->busy != 0)
+    return;
+  if (t->rng == 0) {
+    // first allocation of the thread, no gap drawn yet.
+    t->rng = reinterpret_cast<uintptr_t>(t) | 1;
+    t->countdown = NextGap(t, rate);
+    return;
+  }
+  t->countdown = NextGap(t, rate);
+  t->busy = 1;
+  HeapSample* s =
+      static_cast<HeapSample*>(TIN_RAW_MALLOC(sizeof(HeapSample)));
+  if (s != NULL) {
+    s->ptr = reinterpret_cast<uintptr_t>(p);
+    s->size = size;
+    s->rate = rate;
+    // without SampleAlloc and the hook.
+    s->depth = CaptureStack(s->pcs, kMaxFrames, 2);
+    G* gp = GetGOrNull();
+    CopyName(s->name, gp != NULL ? gp->GetName() : "(thread)",
+             sizeof(s->name));
+    HeapBucket* b = BucketOf(s->ptr);
+    LockBucket(b);
+    s->next = b->head;
+    b->head = s;
+    atomic::relaxed_store32(&b->live, b->live + 1);
+    UnlockBucket(b);
+    atomic::Inc32(&heap_live, 1);
+  }
+  t->busy = 0;
+}
+
+NOINLINE void SampleFree(HeapBucket* b, uintptr_t ptr) {
+  HeapSample* found = NULL;
+  LockBucket(b);
+  for (HeapSample** link = &b->head; *link != NULL; link = &(*link)->next) {
+    if ((*link)->ptr == ptr) {
+      found = *link;
+      *link = found->next;
+      atomic::relaxed_store32(&b->live, b->live - 1);
+      break;
+    }
+  }
+  UnlockBucket(b);
+  if (found != NULL) {
+    atomic::Inc32(&heap_live, -1);
+    TIN_RAW_FREE(found);
+  }
+}
+
+inline void OnAlloc(void* p, size_t size) {
+  intptr_t rate = atomic::relaxed_load(&heap_rate);
+  if (rate == 0 || p == NULL)
+    return;
+  HeapThread* t = &heap_thread;
+  t->countdown -= static_cast<int64>(size);
+  if (t->countdown > 0)
+    return;
+  SampleAlloc(p, size, rate);
+}
+
+inline void OnFree(void* p) {
+  // one load while nothing sampled is live, and one more for the bucket
+  // otherwise. a sample of p is in place before p is handed out, so an
+  // empty bucket needs no lock.
+  if (p == NULL || atomic::relaxed_load32(&heap_live) == 0)
+    return;
+  uintptr_t ptr = reinterpret_cast<uintptr_t>(p);
+  HeapBucket* b = BucketOf(ptr);
+  if (atomic::relaxed_load32(&b->live) == 0)
+    return;
+  SampleFree(b, ptr);
+}
+
+struct HeapKey {
+  std::string name;
+  std::vector<uintptr_t> pcs;
+
+  bool operator<(const HeapKey& other) const {
+    if (name != other.name)
+      return name < other.name;
+    return pcs < other.pcs;
+  }
+};
+
+struct HeapCount {
+  HeapCount()
+    : objects(0)
+    , bytes(0) {
+  }
+
+  double objects;
+  double bytes;
+};
+
+std::string EncodeHeapProfile() {
+  std::vector<HeapSample> copy;
+  // room for those born while copying, no allocation under a bucket lock,
+  // free would take the lock again.
+  copy.reserve(atomic::relaxed_load32(&heap_live) + 1024);
+  bool truncated = false;
+  for (int i = 0; i < kBuckets; i++) {
+    HeapBucket* b = &heap_buckets[i];
+    if (atomic::relaxed_load32(&b->live) == 0)
+      continue;
+    LockBucket(b);
+    for (HeapSample* s = b->head; s != NULL; s = s->next) {
+      if (copy.size() == copy.capacity()) {
+        truncated = true;
+        break;
+      }
+      copy.push_back(*s);
+    }
+    UnlockBucket(b);
+  }
+  if (truncated)
+    LOG(WARNING) << "heap profile: samples dropped while copying";
+
+  std::map<HeapKey, HeapCount> counts;
+  for (size_t i = 0; i < copy.size(); i++) {
+    const HeapSample& s = copy[i];
+    HeapKey key;
+    key.name = s.name;
+    for (int j = 0; j < s.depth; j++)
+      key.pcs.push_back(reinterpret_cast<uintptr_t>(s.pcs[j]));
+    // sampled with probability 1 - e^(-size/rate).
+    double p = 1 - exp(-static_cast<double>(s.size) / s.rate);
+    double weight = p > 0 ? 1 / p : 1;
+    HeapCount& c = counts[key];
+    c.objects += weight;
+    c.bytes += weight * s.size;
+  }
+
+  PprofBuilder builder;
+  builder.AddSampleType("inuse_objects", "count");
+  builder.AddSampleType("inuse_space", "bytes");
+  for (std::map<HeapKey, HeapCount>::const_iterator it = counts.begin();
+       it != counts.end(); ++it) {
+    std::vector<int64> values;
+    values.push_back(static_cast<int64>(it->second.objects + 0.5));
+    values.push_back(static_cast<int64>(it->second.bytes + 0.5));
+    std::vector<PprofLabel> labels;
+    labels.push_back(PprofLabel("greenlet", it->first.name));
+    builder.AddSample(it->first.pcs, values, labels);
+  }
+  intptr_t rate = atomic::relaxed_load(&heap_rate);
+  builder.SetPeriod("space", "bytes", rate > 0 ? rate : 1);
+  return builder.Encode();
+}
+
+#if defined(OS_POSIX)
+int32 dump_requests = 0;
+
+void DumpHandler(int sig) {
+  atomic::Inc32(&dump_requests, 1);
+}
+
+// writes the profiles asked for by the signal, nothing of that is safe
+// in the handler.
+class HeapDumper : public base::PlatformThread::Delegate {
+ public:
+  explicit HeapDumper(const std::string& path)
+    : path_(path)
+    , seq_(0) {
+  }
+
+  virtual ~HeapDumper() {
+  }
+
+ private:
+  virtual void ThreadMain() {
+    base::PlatformThread::SetName("TinHeapProfile");
+    int32 done = 0;
+    for (;;) {
+      base::PlatformThread::Sleep(
+          base::TimeDelta::FromMilliseconds(kDumpPollMs));
+      int32 requests = atomic::acquire_load32(&dump_requests);
+      if (requests == done)
+        continue;
+      done = requests;
+      char suffix[32];
+      snprintf(suffix, sizeof(suffix), ".%d.heap", ++seq_);
+      std::string path = path_ + suffix;
+      if (!WriteProfileFile(path.c_str(), EncodeHeapProfile()))
+        LOG(WARNING) << "heap profile: can not write " << path;
+    }
+  }
+
+  const std::string path_;
+  int seq_;
+  DISALLOW_COPY_AND_ASSIGN(HeapDumper);
+};
+
+base::Lock dumper_lock;
+HeapDumper* dumper = NULL;
+#endif  // OS_POSIX
+
+}  // namespace
+}  // namespace runtime
+
+bool SetHeapProfileRate(int64 rate) {
+  atomic::relaxed_store(&runtime::heap_rate,
+                        static_cast<intptr_t>(rate > 0 ? rate : 0));
+  return true;
+}
+
+bool WriteHeapProfile(const char* path) {
+  return runtime::WriteProfileFile(path, runtime::EncodeHeapProfile());
+}
+
+bool WriteHeapProfileOnSignal(int sig, const char* path) {
+#if defined(OS_POSIX)
+  base::AutoLock guard(runtime::dumper_lock);
+  if (runtime::dumper != NULL)
+    return false;
+  runtime::dumper = new runtime::HeapDumper(path);
+  if (!base::PlatformThread::CreateNonJoinable(0, runtime::dumper)) {
+    delete runtime::dumper;
+    runtime::dumper = NULL;
+    return false;
+  }
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = runtime::DumpHandler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  return sigaction(sig, &sa, NULL) == 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace tin
+
+// the hooks, every allocation of the process goes through them.
+#if defined(__GLIBC__)
+extern "C" {
+
+void* malloc(size_t size) {
+  void* p = __libc_malloc(size);
+  tin::runtime::OnAlloc(p, size);
+  return p;
+}
+
+void* calloc(size_t n, size_t size) {
+  void* p = __libc_calloc(n, size);
+  tin::runtime::OnAlloc(p, n * size);
+  return p;
+}
+
+void* realloc(void* old, size_t size) {
+  void* p = __libc_realloc(old, size);
+  // a failed realloc leaves old live and sampled, size 0 frees it. old may
+  // be handed out again before OnFree, which then drops the newer sample
+  // of the two, the counts stay right.
+  if (p != NULL || size == 0) {
+    tin::runtime::OnFree(old);
+    tin::runtime::OnAlloc(p, size);
+  }
+  return p;
+}
+
+void free(void* p) {
+  tin::runtime::OnFree(p);
+  __libc_free(p);
+}
+
+}  // extern "C"
+#else
+// operator new only, malloc can not be interposed portably.
+void* operator new(size_t size) {
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == NULL)
+    throw std::bad_alloc();
+  tin::runtime::OnAlloc(p, size);
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw() {
+  void* p = malloc(size == 0 ? 1 : size);
+  tin::runtime::OnAlloc(p, size);
+  return p;
+}
+
+void* operator new[](size_t size, const std::nothrow_t& nt) throw() {
+  return operator new(size, nt);
+}
+
+void operator delete(void* p) throw() {
+  tin::runtime::OnFree(p);
+  free(p);
+}
+
+void operator delete[](void* p) throw() {
+  operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw() {
+  operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw() {
+  operator delete(p);
+}
+#endif  // __GLIBC__
+
+#else  // TIN_HEAP_PROFILER
+
+namespace tin {
+
+bool SetHeapProfileRate(int64 rate) {
+  return false;
+}
+
+bool WriteHeapProfile(const char* path) {
+  return false;
+}
+
+bool WriteHeapProfileOnSignal(int sig, const char* path) {
+  return false;
+}
+
+}  // namespace tin
+
+#endif  // TIN_HEAP_PROFILER
@@ -19,31 +19,50 @@
 namespace tin {
 namespace runtime {
 
+namespace {
+const int kDeadReapBatch = 64;
+}  // namespace
+
 M::M()
-  : next_waitm_(0)
-  , cache_()
-  , wait_sema_()
-  , park_()
-  , p_(0)
-  , spinning_(false)
-  , schedlink_(0)
-  , nextp_(NULL)
+  : p_(0)
   , curg_(NULL)
   , g0_(0)
   , locked_g_(NULL)
-  , mstart_fn_()
+  , dead_head_(NULL)
+  , dead_tail_(NULL)
+  , locked_(0)
+  , spinning_(false)
+  , direct_switch_(false)
+  , trace_buf_(NULL)
+  , unlock_info_(new UnLockInfo)
   , sys_context_(NULL)
+  , park_()
+  , nextp_(NULL)
+  , schedlink_(0)
+  , next_waitm_(0)
+  , cache_()
+  , wait_sema_()
+  , mstart_fn_()
   , sys_thread_handle_()
-  , unlock_info_(new UnLockInfo)
   , is_m0_(0)
-  , dead_queue_()
-  , locked_(0) {
+  , bound_cpu_(-1)
+  , log_ring_(NULL) {
 }
 
 M::~M() {
   delete g0_;
 }
 
+void M::BindToCpu(int cpu) {
+  if (bound_cpu_ == cpu)
+    return;
+  if (!BindCurrentThreadToCpu(cpu)) {
+    LOG(WARNING) << "failed to bind M to cpu " << cpu;
+  }
+  // don't retry on every AcquireP if failed.
+  bound_cpu_ = cpu;
+}
+
 void M::EnsureSemaphoreExists() {
   if (!wait_sema_) {
     wait_sema_.reset(new base::WaitableEvent(false, false));
@@ -84,6 +103,7 @@ void M::OnSysThreadStop() {
 }
 
 void M::ThreadMain() {
+  SetCurrentM(this);
   OnSysThreadStart();
 
   g0_ = Greenlet::Create(G0StaticProc,
@@ -94,7 +114,7 @@ void M::ThreadMain() {
                          rtm_conf->StackSize(),
                          "sysg0");
   g0_->SetM(this);
-  glet_tls->Set(g0_);
+  SetG(g0_);
   // switch to g0
   jump_zcontext(&sys_context_,
                 *g0_->MutableContext(),
@@ -213,12 +233,49 @@ void M::StopLocked() {
   curm->nextp_ = NULL;
 }
 
+void M::AddToDeadQueue(G* gp) {
+  gp->SetSchedLink(NULL);
+  if (dead_tail_ == NULL) {
+    dead_head_ = gp;
+  } else {
+    dead_tail_->SetSchedLink(gp);
+  }
+  dead_tail_ = gp;
+}
+
 void M::ClearDeadQueue() {
-  if (!dead_queue_.empty()) {
-    G* gp = dead_queue_.front();
-    delete gp;
-    dead_queue_.pop_front();
+  // without a P the stacks are dropped, all in one batch.
+  G* shell_head = NULL;
+  G* shell_tail = NULL;
+  for (int i = 0; i < kDeadReapBatch && dead_head_ != NULL; i++) {
+    G* gp = dead_head_;
+    dead_head_ = GpCastBack(gp->SchedLink());
+    if (dead_head_ == NULL)
+      dead_tail_ = NULL;
+    gp->SetSchedLink(NULL);
+    TraceEvent(kTraceReap, gp);
+    gp->SetState(GLET_EXITED);
+    if (rtm_conf->IsStackHighWaterEnabled())
+      gp->RecordStackHighWater();
+    // the request scoped allocations die with the greenlet.
+    gp->ReleaseArena(p_);
+    if (gp->Joinable()) {
+      // recycled by its joiner.
+      gp->CompleteJoin();
+    } else if (p_ != NULL) {
+      // recycle the greenlet and its stack if we hold a P.
+      p_->GFPut(gp);
+    } else {
+      if (shell_tail == NULL) {
+        shell_head = gp;
+      } else {
+        shell_tail->SetSchedLink(gp);
+      }
+      shell_tail = gp;
+    }
   }
+  if (shell_head != NULL)
+    sched->GShellPutBatch(shell_head, shell_tail);
 }
 
 // -----------------------------------------------------
@@ -4,8 +4,6 @@
 
 #pragma once
 
-#include <list>
-
 #include "base/basictypes.h"
 #include "base/memory/scoped_ptr.h"
 #include "base/callback.h"
@@ -15,12 +13,15 @@
 #include "context/zcontext.h"
 
 #include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/util.h"
 #include "tin/runtime/unlock.h"
 
 namespace tin {
 namespace runtime {
 
 class P;
+struct TraceBuffer;
+struct LogRing;
 
 typedef class M AliasM;
 
@@ -54,8 +55,10 @@ class M : public base::PlatformThread::Delegate {
     return p_;
   }
 
+  // on the thread of the M only.
   void SetP(tin::runtime::P* p) {
     p_ = p;
+    SetCurrentP(p);
   }
 
   void SetSchedLink(M* m) {
@@ -86,6 +89,16 @@ class M : public base::PlatformThread::Delegate {
     curg_ = gp;
   }
 
+  // set while a greenlet switches to the next one without g0, which then
+  // does the rest of the scheduling round, see Scheduler::Reschedule.
+  bool DirectSwitch() const {
+    return direct_switch_;
+  }
+
+  void SetDirectSwitch(bool direct) {
+    direct_switch_ = direct;
+  }
+
 
   void SetUnlockInfo(UnlockFunc f, void* arg1, void* arg2, G* owner) {
     unlock_info_->SetF(f);
@@ -118,16 +131,38 @@ class M : public base::PlatformThread::Delegate {
     return is_m0_;
   }
 
+  // reaps up to kDeadReapBatch exited greenlets, after the switch away
+  // from them.
   void ClearDeadQueue();
 
-  void AddToDeadQueue(G* gp) {
-    dead_queue_.push_back(gp);
-  }
+  // linked by schedlink, an exited greenlet is on no run queue.
+  void AddToDeadQueue(G* gp);
 
   uint32* MutableLocked() {
     return &locked_;
   }
 
+  // follow the cpu of the P this M is running, see Config::SetCpuAffinity.
+  void BindToCpu(int cpu);
+
+  // see trace.cc, created on the first event of this M.
+  TraceBuffer* TraceBuf() const {
+    return trace_buf_;
+  }
+
+  void SetTraceBuf(TraceBuffer* buf) {
+    trace_buf_ = buf;
+  }
+
+  // see async_log.cc, created on the first message of this M.
+  LogRing* GetLogRing() const {
+    return log_ring_;
+  }
+
+  void SetLogRing(LogRing* ring) {
+    log_ring_ = ring;
+  }
+
   char* Cache() {
     if (!cache_) {
       cache_.reset(new char[64 * 1024]);
@@ -150,24 +185,34 @@ class M : public base::PlatformThread::Delegate {
   void DoUnlock();
 
  private:
-  uintptr_t next_waitm_;
-  scoped_ptr<char[]> cache_;
-  scoped_ptr<base::WaitableEvent> wait_sema_;
-  Note park_;
+  // owner hot.
   tin::runtime::P* p_;
-  bool spinning_;
-  tin::runtime::M* schedlink_;
-  tin::runtime::P* nextp_;
   G* curg_;
   G* g0_;
   G* locked_g_;
-  base::Closure mstart_fn_;
+  G* dead_head_;
+  G* dead_tail_;
+  uint32 locked_;
+  bool spinning_;
+  bool direct_switch_;
+  TraceBuffer* trace_buf_;
+  scoped_ptr<UnLockInfo> unlock_info_;
   zcontext_t sys_context_;
+  char pad0_[64];
+  // written by the threads that hand us a P or wake us.
+  Note park_;
+  tin::runtime::P* nextp_;
+  tin::runtime::M* schedlink_;
+  uintptr_t next_waitm_;
+  char pad1_[64];
+  // cold.
+  scoped_ptr<char[]> cache_;
+  scoped_ptr<base::WaitableEvent> wait_sema_;
+  base::Closure mstart_fn_;
   base::PlatformThreadHandle sys_thread_handle_;
-  scoped_ptr<UnLockInfo> unlock_info_;
   bool is_m0_;
-  std::list<G*> dead_queue_;
-  uint32 locked_;
+  int bound_cpu_;
+  LogRing* log_ring_;
   DISALLOW_COPY_AND_ASSIGN(M);
 };
 
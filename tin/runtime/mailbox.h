@@ -0,0 +1,58 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/callback.h"
+#include "tin/sync/atomic.h"
+
+namespace tin {
+namespace runtime {
+
+// closures one P sends another, see tin::SendTo. single producer single
+// consumer: only greenlets running on the sending P push, one at a time as
+// a P runs one greenlet at a time, and only the receiving P pops.
+class Mailbox {
+ public:
+  // size is a power of 2.
+  explicit Mailbox(uint32 size)
+    : mask_(size - 1)
+    , slots_(size)
+    , head_(0)
+    , tail_(0) {
+  }
+
+  bool TryPush(const base::Closure& closure) {
+    uintptr_t tail = atomic::relaxed_load(&tail_);
+    if (tail - atomic::acquire_load(&head_) > mask_)
+      return false;  // full.
+    slots_[tail & mask_] = closure;
+    atomic::release_store(&tail_, tail + 1);
+    return true;
+  }
+
+  bool TryPop(base::Closure* closure) {
+    uintptr_t head = atomic::relaxed_load(&head_);
+    if (head == atomic::acquire_load(&tail_))
+      return false;  // empty.
+    *closure = slots_[head & mask_];
+    slots_[head & mask_].Reset();
+    atomic::release_store(&head_, head + 1);
+    return true;
+  }
+
+ private:
+  const uintptr_t mask_;
+  std::vector<base::Closure> slots_;
+  char pad0_[64];
+  uintptr_t head_;
+  char pad1_[64 - sizeof(uintptr_t)];
+  uintptr_t tail_;
+  DISALLOW_COPY_AND_ASSIGN(Mailbox);
+};
+
+}  // namespace runtime
+}  // namespace tin
@@ -8,6 +8,7 @@
 #include "tin/runtime/runtime.h"
 #include "tin/runtime/greenlet.h"
 #include "tin/runtime/scheduler.h"
+#include "tin/runtime/spawn.h"
 #include "tin/runtime/net/netpoll.h"
 
 namespace tin {
@@ -25,6 +26,10 @@ void NetPollPostInit() {
   atomic::store32(&net_poll_Inited, 1);
 }
 
+G* NetPoll(bool block) {
+  return NetPollWait(block ? -1 : 0);
+}
+
 void NetPollDeinit() {
   NetPollPreDeinit();
   atomic::store32(&net_poll_Inited, 0);
@@ -64,6 +69,10 @@ int NetPollCheckErr(PollDescriptor* pd, int32 mode) {
 bool NetPollBlockCommit(void* arg1, void* arg2) {
   uintptr_t gp = reinterpret_cast<uintptr_t>(arg1);
   uintptr_t* gpp = reinterpret_cast<uintptr_t*>(arg2);
+  // we are on g0 now, and gp is not visible to others until the cas below.
+  if (rtm_conf->IsIdleStackReleaseEnabled()) {
+    GpCastBack(gp)->ReleaseIdleStack();
+  }
   return atomic::release_cas(gpp, kPdWait, gp);
 }
 
@@ -87,9 +96,10 @@ bool NetPollBlock(PollDescriptor* pd, int32 mode, bool waitio) {
     }
   }
 
-  if (waitio || NetPollCheckErr(pd, mode) == 0) {
-    G* gp = GetG();
-    Park(NetPollBlockCommit, gp, gpp);
+  // a Cancel that ran before the cas above did not find us waiting.
+  G* gp = GetG();
+  if (waitio || (NetPollCheckErr(pd, mode) == 0 && !gp->Interrupted())) {
+    Park(NetPollBlockCommit, gp, gpp, kParkNetPoll);
   }
 
   uintptr_t old = atomic::exchange(gpp, 0);
@@ -121,6 +131,15 @@ G* NetPollUnblock(PollDescriptor* pd, int32 mode, bool ioready) {
     }
 
     if (atomic::release_cas(gpp, old, new_value)) {
+      if (old == kPdCallback) {
+        // ours now, the greenlet spawned for it finds the fd ready, closed
+        // or timed out in its Wait.
+        base::Closure* cb = mode == 'w' ? &pd->wcb : &pd->rcb;
+        base::Closure closure = *cb;
+        cb->Reset();
+        tin::Post(closure);
+        return NULL;
+      }
       if (old == kPdReady || old == kPdWait) {
         old = 0;
       }
@@ -142,7 +161,27 @@ void NetPollDeadlineImpl(PollDescriptor* pd, uintptr_t seq, bool read,
     if (pd->rd <= 0 || pd->rt.f == NULL) {
       LOG(FATAL) << "NetPollDeadlineImpl: inconsistent read deadline";
     }
+#if defined(ARCH_CPU_64_BITS)
+    // pollops::SetDeadline pushes the deadline of a read timer back
+    // without the lock, then the timer is armed again for it.
+    volatile intptr_t* rd = reinterpret_cast<volatile intptr_t*>(&pd->rd);
+    while (true) {
+      intptr_t when = atomic::acquire_load(rd);
+      if (!write && when > pd->rt.when) {
+        pd->AddRef();
+        pd->rt.when = when;
+        timer_q->AddTimer(&pd->rt);
+        pd->lock.Unlock();
+        pd->Release();
+        return;
+      }
+      if (atomic::cas(rd, when, -1)) {
+        break;
+      }
+    }
+#else
     pd->rd = -1;
+#endif
     // full memory barrier between store to rd and load of rg in NetPollUnblock
     atomic::store(reinterpret_cast<uintptr_t*>(&pd->rt.f), 0);
     rg = NetPollUnblock(pd, 'r', false);
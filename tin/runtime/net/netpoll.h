@@ -6,6 +6,7 @@
 
 #include <string>
 
+#include "build/build_config.h"
 #include "tin/runtime/net/poll_descriptor.h"
 
 namespace tin {
@@ -13,6 +14,14 @@ namespace runtime {
 
 const uintptr_t kPdReady = 1;
 const uintptr_t kPdWait = 2;
+// no greenlet waits, readiness posts rcb or wcb, see pollops::WaitAsync.
+const uintptr_t kPdCallback = 3;
+
+// upper bound of poller shards, Ps share a shard beyond it.
+const int kNetPollMaxShards = 16;
+
+// upper bound of Config::NetPollBatch.
+const int kNetPollMaxBatch = 1024;
 
 void NetPollInit();
 
@@ -28,12 +37,35 @@ void NetPollDeinit();
 
 int32 NetPollOpen(uintptr_t fd, PollDescriptor* pd);
 
-int32 NetPollClose(uintptr_t fd);
+int32 NetPollClose(PollDescriptor* pd);
 
 void NetPollArm(PollDescriptor* pd, int mode);
 
+// polls all shards.
 G* NetPoll(bool block);
 
+// polls all shards, waits up to timeout_ns for something to get ready, -1
+// blocks. implemented by the backends.
+G* NetPollWait(int64 timeout_ns);
+
+// descriptors are bound to the shard of the P which opened them, returns -1
+// if the poller is not sharded.
+int NetPollShardOf(int proc_id);
+// registers pd with the shard of P proc_id instead, before anybody waits
+// on it. 0 or an errno.
+int32 NetPollMove(PollDescriptor* pd, int proc_id);
+
+// non-blocking poll of one shard.
+G* NetPollShard(int shard);
+
+// flushes IO requests queued by greenlets of this P, if the backend
+// batches them.
+void NetPollSubmit();
+
+// makes a blocked NetPoll(true) return, even with nothing ready. calls
+// while a break is pending are coalesced.
+void NetPollBreak();
+
 int NetPollCheckErr(PollDescriptor* pd, int32 mode);
 
 bool NetPollBlock(PollDescriptor* pd, int32 mode, bool waitio);
@@ -48,5 +80,19 @@ void NetpollReadDeadline(void* arg, uintptr_t seq);
 
 void NetPollWriteDeadline(void* arg, uintptr_t seq);
 
+#if defined(OS_WIN)
+// completion key the RIO completion queues notify the port with, see
+// tin/net/rio_windows.h. the OVERLAPPED of such an entry is the queue's.
+const uintptr_t kNetPollRioKey = 2;
+
+// dequeues the completions of the queue ol belongs to, chains the
+// greenlets they make ready onto *gpp and re-arms the notification.
+typedef void (*NetPollRioDrain)(G** gpp, void* ol);
+void NetPollSetRioDrain(NetPollRioDrain drain);
+
+// the completion port NetPollWait waits on.
+uintptr_t NetPollIocp();
+#endif
+
 }  // namespace runtime
 }  // namespace tin
@@ -3,30 +3,128 @@
 // found in the LICENSE file.
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/errqueue.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
 #include "base/logging.h"
 #include "base/posix/eintr_wrapper.h"
+#include "tin/sync/atomic.h"
+#include "tin/time/time.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/p.h"
 #include "tin/runtime/posix_util.h"
 #include "tin/runtime/net/netpoll.h"
+#include "tin/runtime/net/uring.h"
 
 namespace {
-int epfd = -1;
+// shard epoll fds are registered with root_epfd, which is what a blocking
+// poll waits on.
+int root_epfd = -1;
+int shard_epfds[tin::runtime::kNetPollMaxShards];
+int nshards = 0;
+// root_epfd event data of the io_uring completion ring.
+const uint32 kUringTag = tin::runtime::kNetPollMaxShards;
+// and of the eventfd NetPollBreak writes.
+const uint32 kBreakTag = tin::runtime::kNetPollMaxShards + 1;
+int break_fd = -1;
+// set while a break is written and not yet seen by a poller.
+int32 break_pending = 0;
+// the kernel has no epoll_pwait2, before 5.11.
+int32 no_pwait2 = 0;
 }
 
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
 namespace tin {
 namespace runtime {
 
 struct PollDescriptor;
 
-void NetPollInit() {
-  epfd = epoll_create(1024);
-  DCHECK_NE(epfd, -1);
-  if (epfd >= 0) {
-    DCHECK_EQ(tin::Cloexec(epfd, true), 0);
-    return;
+// drains MSG_ZEROCOPY completions, each one covers a range of sends.
+void ReapZeroCopy(PollDescriptor* pd) {
+  uint32 done = atomic::acquire_load32(&pd->zc_done);
+  while (true) {
+    char control[128];
+    msghdr msg = { 0 };
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(static_cast<int>(pd->fd), &msg, MSG_ERRQUEUE) == -1) {
+      break;
+    }
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      sock_extended_err* serr =
+        reinterpret_cast<sock_extended_err*>(CMSG_DATA(cm));
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      // ee_data is the last send of the range, inclusive.
+      if (static_cast<int32>(serr->ee_data + 1 - done) > 0) {
+        done = serr->ee_data + 1;
+      }
+    }
+  }
+  atomic::release_store32(&pd->zc_done, done);
+}
+
+int NewEpoll() {
+  int fd = epoll_create(1024);
+  DCHECK_NE(fd, -1);
+  if (fd >= 0) {
+    DCHECK_EQ(tin::Cloexec(fd, true), 0);
+    return fd;
   }
   LOG(FATAL) << "epoll_create failed";
+  return -1;
+}
+
+void NetPollInit() {
+  root_epfd = NewEpoll();
+  int n = rtm_conf->MaxProcs();
+  if (n > kNetPollMaxShards)
+    n = kNetPollMaxShards;
+  if (n < 1)
+    n = 1;
+  for (int i = 0; i < n; i++) {
+    shard_epfds[i] = NewEpoll();
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    if (epoll_ctl(root_epfd, EPOLL_CTL_ADD, shard_epfds[i], &ev) == -1) {
+      LOG(FATAL) << "epoll_ctl failed, error code: " << errno;
+    }
+  }
+  nshards = n;
+
+  break_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (break_fd == -1) {
+    LOG(FATAL) << "eventfd failed, error code: " << errno;
+  }
+  struct epoll_event bev;
+  bev.events = EPOLLIN;
+  bev.data.u32 = kBreakTag;
+  if (epoll_ctl(root_epfd, EPOLL_CTL_ADD, break_fd, &bev) == -1) {
+    LOG(FATAL) << "epoll_ctl failed, error code: " << errno;
+  }
+
+  if (rtm_conf->IsIoUringEnabled() && UringInit()) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = kUringTag;
+    if (epoll_ctl(root_epfd, EPOLL_CTL_ADD, UringFd(), &ev) == -1) {
+      LOG(FATAL) << "epoll_ctl failed, error code: " << errno;
+    }
+  }
 }
 
 void NetPollShutdown() {
@@ -39,18 +137,48 @@ void NetPollPreDeinit() {
 #define EPOLLRDHUP 0x2000
 #endif
 
+int NetPollShardOf(int proc_id) {
+  if (nshards == 0)
+    return -1;
+  return proc_id % nshards;
+}
+
 int32 NetPollOpen(uintptr_t fd, PollDescriptor* pd) {
+  P* p = GetP();
+  pd->shard = p != NULL ? NetPollShardOf(p->Id()) : 0;
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.u64 = PollDescriptorTag(pd);
+  if (epoll_ctl(shard_epfds[pd->shard], EPOLL_CTL_ADD,
+                static_cast<int>(fd), &ev) == -1)
+    return errno;
+  return 0;
+}
+
+int32 NetPollMove(PollDescriptor* pd, int proc_id) {
+  int shard = NetPollShardOf(proc_id);
+  if (shard < 0 || shard == pd->shard)
+    return 0;
+  // added before it is deleted, an edge in between shows up in either or
+  // both, twice is harmless.
   struct epoll_event ev;
   ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
-  ev.data.ptr = pd;
-  if (epoll_ctl(epfd, EPOLL_CTL_ADD, static_cast<int>(fd), &ev) == -1)
+  ev.data.u64 = PollDescriptorTag(pd);
+  if (epoll_ctl(shard_epfds[shard], EPOLL_CTL_ADD,
+                static_cast<int>(pd->fd), &ev) == -1)
+    return errno;
+  int old = pd->shard;
+  pd->shard = shard;
+  if (epoll_ctl(shard_epfds[old], EPOLL_CTL_DEL,
+                static_cast<int>(pd->fd), &ev) == -1)
     return errno;
   return 0;
 }
 
-int32 NetPollClose(uintptr_t fd) {
+int32 NetPollClose(PollDescriptor* pd) {
   struct epoll_event ev;
-  if (epoll_ctl(epfd, EPOLL_CTL_DEL,  static_cast<int>(fd), &ev) == -1)
+  if (epoll_ctl(shard_epfds[pd->shard], EPOLL_CTL_DEL,
+                static_cast<int>(pd->fd), &ev) == -1)
     return errno;
   return 0;
 }
@@ -59,36 +187,122 @@ void NetPollArm(PollDescriptor* pd, int mode) {
   LOG(FATAL) << "unused";
 }
 
-G* NetPoll(bool block) {
-  if (epfd == -1)
+void NetPollBreak() {
+  if (break_fd == -1 || !atomic::cas32(&break_pending, 0, 1)) {
+    return;
+  }
+  uint64 one = 1;
+  if (HANDLE_EINTR(write(break_fd, &one, sizeof(one))) != sizeof(one) &&
+      errno != EAGAIN) {
+    LOG(FATAL) << "eventfd write failed, error code: " << errno;
+  }
+}
+
+// appends greenlets made ready by events of shard to *gpp.
+void PollShard(int shard, G** gpp) {
+  epoll_event events[kNetPollMaxBatch];  // 12KB on stack.
+  int batch = rtm_conf->NetPollBatch();
+  if (batch <= 0 || batch > kNetPollMaxBatch)
+    batch = kNetPollMaxBatch;
+  int n = HANDLE_EINTR(
+      epoll_wait(shard_epfds[shard], &events[0], batch, 0));
+  if (n < 0) {
+    LOG(FATAL) << "epoll_wait, fatal error, error code: " << errno;
+  }
+  for (int i = 0; i < n; ++i) {
+    epoll_event& ev = events[i];
+    if (ev.events == 0) {
+      continue;
+    }
+    int mode = 0;
+    if ((ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+      mode += 'r';
+    }
+    if ((ev.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0) {
+      mode += 'w';
+    }
+    if (mode != 0) {
+      PollDescriptor* pd = PollDescriptorFromTag(ev.data.u64);
+      if (pd == NULL) {
+        // the fd was closed and pd reused meanwhile.
+        continue;
+      }
+      if ((ev.events & (EPOLLRDHUP | EPOLLHUP)) != 0) {
+        atomic::release_store32(&pd->rdhup, 1);
+      }
+      if ((ev.events & EPOLLERR) != 0 &&
+          atomic::acquire_load32(&pd->zerocopy) != 0) {
+        ReapZeroCopy(pd);
+      }
+      NetPollReady(gpp, pd, mode);
+    }
+  }
+}
+
+G* NetPollShard(int shard) {
+  if (shard < 0 || shard >= nshards)
+    return NULL;
+  G* gp = NULL;
+  PollShard(shard, &gp);
+  UringReap(&gp);
+  return gp;
+}
+
+void NetPollSubmit() {
+  UringSubmit();
+}
+
+// epoll_wait with a nano second timeout, -1 blocks.
+int EpollWait(int epfd, epoll_event* events, int maxevents,
+              int64 timeout_ns) {
+  if (timeout_ns <= 0) {
+    return epoll_wait(epfd, events, maxevents, timeout_ns < 0 ? -1 : 0);
+  }
+#if defined(__NR_epoll_pwait2)
+  if (atomic::relaxed_load32(&no_pwait2) == 0) {
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout_ns / kSecond);
+    ts.tv_nsec = static_cast<long>(timeout_ns % kSecond);
+    int n = static_cast<int>(
+        syscall(__NR_epoll_pwait2, epfd, events, maxevents, &ts, NULL, 0));
+    if (n >= 0 || errno != ENOSYS) {
+      return n;
+    }
+    atomic::relaxed_store32(&no_pwait2, 1);
+  }
+#endif
+  // round up, waking before the timer is due is a wasted round.
+  int64 ms = (timeout_ns + kMillisecond - 1) / kMillisecond;
+  if (ms > INT_MAX)
+    ms = INT_MAX;
+  return epoll_wait(epfd, events, maxevents, static_cast<int>(ms));
+}
+
+G* NetPollWait(int64 timeout_ns) {
+  if (root_epfd == -1)
     return NULL;
-  int waitms = -1;
-  epoll_event events[128];  // 1536 bytes on stack.
+  epoll_event events[kNetPollMaxShards + 2];
   while (true) {
-    int n =
-      HANDLE_EINTR(epoll_wait(epfd, &events[0], arraysize(events), waitms));
+    int n = HANDLE_EINTR(
+        EpollWait(root_epfd, &events[0], arraysize(events), timeout_ns));
     if (n < 0) {
       LOG(FATAL) << "epoll_wait, fatal error, error code: " << errno;
     }
     G* gp = NULL;
+    bool woken = false;
     for (int i = 0; i < n; ++i) {
-      epoll_event& ev = events[i];
-      if (ev.events == 0) {
-        continue;
-      }
-      int mode = 0;
-      if ((ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
-        mode += 'r';
-      }
-      if ((ev.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) != 0) {
-        mode += 'w';
-      }
-      if (mode != 0) {
-        PollDescriptor* pd = static_cast<PollDescriptor*>(ev.data.ptr);
-        NetPollReady(&gp, pd, mode);
+      if (events[i].data.u32 == kBreakTag) {
+        uint64 count = 0;
+        HANDLE_EINTR(read(break_fd, &count, sizeof(count)));
+        atomic::release_store32(&break_pending, 0);
+        woken = true;
+      } else if (events[i].data.u32 == kUringTag) {
+        UringReap(&gp);
+      } else {
+        PollShard(static_cast<int>(events[i].data.u32), &gp);
       }
     }
-    if (!block || gp != NULL) {
+    if (timeout_ns >= 0 || gp != NULL || woken) {
       return gp;
     }
   }
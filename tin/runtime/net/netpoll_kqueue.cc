@@ -15,14 +15,35 @@
 #include <fcntl.h>
 #include <time.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "base/logging.h"
 #include "base/posix/eintr_wrapper.h"
+#include "tin/sync/atomic.h"
+#include "tin/time/time.h"
 #include "tin/runtime/runtime.h"
 #include "tin/runtime/posix_util.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/util.h"
 #include "tin/runtime/net/NetPoll.h"
 
 namespace {
 int kq = -1;
+// ident of the EVFILT_USER event NetPollBreak triggers.
+const uintptr_t kBreakIdent = 0;
+// set while a break is triggered and not yet seen by a poller.
+int32 break_pending = 0;
+const int kMaxEvents = 64;
+// changes handed to one kevent call, errors need room in its event list.
+const int kMaxChanges = 64;
+// registrations queued for the changelist of the next kevent call, every
+// P flushes them on its next scheduling round at the latest.
+tin::runtime::RawMutex changes_lock;
+std::vector<struct kevent> changes;
+// read without the lock to skip it when there is nothing to flush.
+int32 nchanges = 0;
 }
 
 namespace tin {
@@ -33,11 +54,15 @@ struct PollDescriptor;
 void NetPollInit() {
   kq = kqueue();
   DCHECK_NE(kq, -1);
-  if (kq >= 0) {
-    DCHECK_EQ(tin::Cloexec(kq, true), 0);
-    return;
+  if (kq < 0) {
+    LOG(FATAL) << "kqueue failed";
+  }
+  DCHECK_EQ(tin::Cloexec(kq, true), 0);
+  struct kevent ev;
+  EV_SET(&ev, kBreakIdent, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+  if (kevent(kq, &ev, 1, NULL, 0, NULL) == -1) {
+    LOG(FATAL) << "kevent EVFILT_USER failed, error code: " << errno;
   }
-  LOG(FATAL) << "kqueue failed";
 }
 
 void NetPollShutdown() {
@@ -46,6 +71,56 @@ void NetPollShutdown() {
 void NetPollPreDeinit() {
 }
 
+namespace {
+
+// moves at most max queued changes to out.
+int TakeChanges(struct kevent* out, int max) {
+  if (atomic::relaxed_load32(&nchanges) == 0) {
+    return 0;
+  }
+  RawMutexGuard guard(&changes_lock);
+  int n = std::min(max, static_cast<int>(changes.size()));
+  std::copy(changes.begin(), changes.begin() + n, out);
+  changes.erase(changes.begin(), changes.begin() + n);
+  atomic::relaxed_store32(&nchanges, static_cast<int32>(changes.size()));
+  return n;
+}
+
+void LogChangeErrors(const struct kevent* events, int n) {
+  for (int i = 0; i < n; ++i) {
+    if ((events[i].flags & EV_ERROR) != 0 && events[i].data != 0) {
+      LOG(WARNING) << "kevent registration of fd " << events[i].ident
+                   << " failed, error code: " << events[i].data;
+    }
+  }
+}
+
+// applies changes without draining pending events, they are left to the
+// poller.
+void SubmitChanges(struct kevent* ch, int n) {
+  struct kevent receipts[kMaxChanges];
+  struct timespec ts;
+  memset(&ts, 0, sizeof(ts));
+  for (int i = 0; i < n; ++i) {
+    ch[i].flags |= EV_RECEIPT;
+  }
+  int r = HANDLE_EINTR(kevent(kq, ch, n, &receipts[0], n, &ts));
+  if (r == -1) {
+    LOG(FATAL) << "kevent failed, error code: " << errno;
+  }
+  LogChangeErrors(&receipts[0], r);
+}
+
+}  // namespace
+
+void NetPollSubmit() {
+  struct kevent ch[kMaxChanges];
+  int n = 0;
+  while ((n = TakeChanges(&ch[0], kMaxChanges)) > 0) {
+    SubmitChanges(&ch[0], n);
+  }
+}
+
 int32 NetPollOpen(uintptr_t fd, PollDescriptor* pd) {
   struct kevent ev[2];
   ev[0].ident = fd;
@@ -53,45 +128,101 @@ int32 NetPollOpen(uintptr_t fd, PollDescriptor* pd) {
   ev[0].flags = EV_ADD | EV_CLEAR;
   ev[0].fflags = 0;
   ev[0].data = 0;
+#if defined(ARCH_CPU_64_BITS)
+  ev[0].udata = reinterpret_cast<void*>(
+      static_cast<uintptr_t>(PollDescriptorTag(pd)));
+#else
   ev[0].udata = pd;
+#endif
   ev[1] = ev[0];
   ev[1].filter = EVFILT_WRITE;
-  int n = kevent(kq, &ev[0], 2, NULL, 0, NULL);
-  return n == -1 ? errno : 0;
+  if (GetG() == NULL || GetP() == NULL) {
+    // no scheduling round would flush it soon.
+    int n = kevent(kq, &ev[0], 2, NULL, 0, NULL);
+    return n == -1 ? errno : 0;
+  }
+  // saves a syscall per descriptor, errors are only logged.
+  RawMutexGuard guard(&changes_lock);
+  changes.push_back(ev[0]);
+  changes.push_back(ev[1]);
+  atomic::relaxed_store32(&nchanges, static_cast<int32>(changes.size()));
+  return 0;
 }
 
-int32 NetPollClose(uintptr_t fd) {
-  (void)fd;
+int32 NetPollClose(PollDescriptor* pd) {
   // Don't need to unregister because calling close()
-  // on fd will remove any kevents that reference the descriptor.
+  // on fd will remove any kevents that reference the descriptor, only drop
+  // the registration if it is still queued.
+  if (atomic::relaxed_load32(&nchanges) == 0) {
+    return 0;
+  }
+  RawMutexGuard guard(&changes_lock);
+  for (size_t i = 0; i < changes.size();) {
+    if (changes[i].ident == pd->fd) {
+      changes.erase(changes.begin() + i);
+    } else {
+      i++;
+    }
+  }
+  atomic::relaxed_store32(&nchanges, static_cast<int32>(changes.size()));
   return 0;
 }
 
+void NetPollBreak() {
+  if (kq == -1 || !atomic::cas32(&break_pending, 0, 1)) {
+    return;
+  }
+  struct kevent ev;
+  EV_SET(&ev, kBreakIdent, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+  if (HANDLE_EINTR(kevent(kq, &ev, 1, NULL, 0, NULL)) == -1) {
+    LOG(FATAL) << "kevent NOTE_TRIGGER failed, error code: " << errno;
+  }
+}
+
 void NetPollArm(PollDescriptor* pd, int mode) {
   LOG(FATAL) << "unused";
 }
 
-G* NetPoll(bool block) {
+G* NetPollWait(int64 timeout_ns) {
   if (kq == -1) {
     return NULL;
   }
   struct timespec* tp = NULL;
   struct timespec ts;
   memset(&ts, 0, sizeof(ts));
-  if (!block) {
+  if (timeout_ns >= 0) {
+    ts.tv_sec = static_cast<time_t>(timeout_ns / kSecond);
+    ts.tv_nsec = static_cast<long>(timeout_ns % kSecond);
     tp = &ts;
   }
-  struct kevent events[64];
+  struct kevent ch[kMaxChanges];
+  struct kevent events[kMaxChanges + kMaxEvents];
   while (true) {
-    int n =
-      HANDLE_EINTR(kevent(kq, NULL, 0, &events[0], arraysize(events), tp));
+    // all but the last batch of queued changes go in without waiting.
+    int nch = TakeChanges(&ch[0], kMaxChanges);
+    while (atomic::relaxed_load32(&nchanges) != 0) {
+      SubmitChanges(&ch[0], nch);
+      nch = TakeChanges(&ch[0], kMaxChanges);
+    }
+    int n = HANDLE_EINTR(
+        kevent(kq, &ch[0], nch, &events[0], arraysize(events), tp));
     if (n == -1) {
       LOG(FATAL) << "kevent failed";
     }
 
     G* gp = NULL;
+    bool woken = false;
     for (int i = 0; i < n; ++i) {
       struct kevent& ev = events[i];
+      if (ev.filter == EVFILT_USER) {
+        atomic::release_store32(&break_pending, 0);
+        woken = true;
+        continue;
+      }
+      if ((ev.flags & EV_ERROR) != 0) {
+        LogChangeErrors(&ev, 1);
+        continue;
+      }
       int mode = 0;
       if (ev.filter == EVFILT_READ) {
         mode += 'r';
@@ -100,16 +231,41 @@ G* NetPoll(bool block) {
         mode += 'w';
       }
       if (mode != 0) {
+#if defined(ARCH_CPU_64_BITS)
+        PollDescriptor* pd = PollDescriptorFromTag(
+            reinterpret_cast<uintptr_t>(ev.udata));
+        if (pd == NULL) {
+          // the fd was closed and pd reused meanwhile.
+          continue;
+        }
+#else
         PollDescriptor* pd = static_cast<PollDescriptor*>(ev.udata);
+#endif
+        if (ev.filter == EVFILT_READ && (ev.flags & EV_EOF) != 0) {
+          atomic::release_store32(&pd->rdhup, 1);
+        }
         NetPollReady(&gp, pd, mode);
       }
     }
-    if (!block || gp != NULL) {
+    if (timeout_ns >= 0 || gp != NULL || woken) {
       return gp;
     }
   }
   return NULL;
 }
 
+int NetPollShardOf(int proc_id) {
+  // single kqueue.
+  return -1;
+}
+
+G* NetPollShard(int shard) {
+  return NULL;
+}
+
+int32 NetPollMove(PollDescriptor* pd, int proc_id) {
+  return 0;
+}
+
 }  // namespace runtime
 }  // namespace tin
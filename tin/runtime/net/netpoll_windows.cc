@@ -6,7 +6,10 @@
 
 #include "base/logging.h"
 #include "tin/platform/platform_win.h"
+#include "tin/sync/atomic.h"
+#include "tin/time/time.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/env.h"
 
 #include "tin/runtime/net/NetPoll.h"
 
@@ -16,6 +19,7 @@ namespace runtime {
 
 struct PollDescriptor;
 
+// the head of tin::net::Operation from its OVERLAPPED on.
 struct NetOP {
   // used by windows
   OVERLAPPED ol;
@@ -24,6 +28,8 @@ struct NetOP {
   int32 mode;
   int32 eno;
   uint32 qty;
+  // set once eno and qty are, for ops sharing a pd and mode.
+  int32 done;
 };
 
 struct overlappedEntry {
@@ -35,6 +41,20 @@ struct overlappedEntry {
 
 HANDLE iocphandle = INVALID_HANDLE_VALUE;
 
+// completion key of NetPollBreak, shutdown posts 0.
+const ULONG_PTR kBreakKey = 1;
+// set while a break is posted and not yet seen by a poller.
+int32 break_pending = 0;
+NetPollRioDrain rio_drain = NULL;
+
+void NetPollSetRioDrain(NetPollRioDrain drain) {
+  rio_drain = drain;
+}
+
+uintptr_t NetPollIocp() {
+  return reinterpret_cast<uintptr_t>(iocphandle);
+}
+
 void NetPollInit() {
   iocphandle = CreateIoCompletionPort(INVALID_HANDLE_VALUE, 0, 0, 0xFFFFFFFF);
   if (iocphandle == 0) {
@@ -60,7 +80,7 @@ int32 NetPollOpen(uintptr_t fd, PollDescriptor* pd) {
   return 0;
 }
 
-int32 NetPollClose(uintptr_t fd) {
+int32 NetPollClose(PollDescriptor* pd) {
   // nothing to do
   return 0;
 }
@@ -69,6 +89,16 @@ void NetPollArm(PollDescriptor* pd, int mode) {
   LOG(FATAL) << "unused";
 }
 
+void NetPollBreak() {
+  if (!NetPollInited() || !atomic::cas32(&break_pending, 0, 1)) {
+    return;
+  }
+  if (PostQueuedCompletionStatus(iocphandle, 0, kBreakKey, NULL) == 0) {
+    LOG(FATAL) << "NetPoll: failed to post break, error code: "
+               << GetLastError();
+  }
+}
+
 void handlecompletion(G** gpp, NetOP* op, DWORD error_no, uint32 qty) {
   if (op == NULL) {
     LOG(FATAL) << "NetPoll: GetQueuedCompletionStatus returned op == nil";
@@ -79,26 +109,33 @@ void handlecompletion(G** gpp, NetOP* op, DWORD error_no, uint32 qty) {
   }
   op->eno = error_no;
   op->qty = qty;
+  atomic::release_store32(&op->done, 1);
   NetPollReady(gpp, op->pd, mode);
 }
 
-G* NetPoll(bool block) {
-  overlappedEntry entries[64];
+G* NetPollWait(int64 timeout_ns) {
+  overlappedEntry entries[kNetPollMaxBatch];  // 32KB on stack.
   DWORD qty, flags, i;
   ULONG_PTR  key = 0;
   ULONG n;
   DWORD error_no;
   NetOP* op;
   G* gp = NULL;
-  DWORD wait = 0;
-  if (block) {
-    wait = INFINITE;
+  DWORD wait = INFINITE;
+  if (timeout_ns >= 0) {
+    // round up, waking before the timer is due is a wasted round.
+    int64 ms = (timeout_ns + kMillisecond - 1) / kMillisecond;
+    wait = static_cast<DWORD>(ms < INFINITE ? ms : INFINITE - 1);
   }
+  bool block = timeout_ns < 0;
 
   bool shutdown_flag = false;
 
   if (pGetQueuedCompletionStatusEx != NULL) {
-    n = 64;
+    int batch = rtm_conf->NetPollBatch();
+    if (batch <= 0 || batch > kNetPollMaxBatch)
+      batch = kNetPollMaxBatch;
+    n = batch;
 
     if (pGetQueuedCompletionStatusEx(iocphandle,
                                      (LPOVERLAPPED_ENTRY)&entries[0],
@@ -114,7 +151,10 @@ G* NetPoll(bool block) {
       op = entries[i].op;
       error_no = 0;
       qty = 0;
-      if (op != NULL) {
+      if (entries[i].key == kNetPollRioKey) {
+        // many RIO completions behind one entry.
+        rio_drain(&gp, op);
+      } else if (op != NULL) {
         if (WSAGetOverlappedResult(op->pd->fd,
                                    (LPWSAOVERLAPPED)op,
                                    (LPDWORD)&qty,
@@ -123,6 +163,8 @@ G* NetPoll(bool block) {
           error_no = GetLastError();
         }
         handlecompletion(&gp, op, error_no, qty);
+      } else if (entries[i].key == kBreakKey) {
+        atomic::release_store32(&break_pending, 0);
       } else {
         shutdown_flag = true;
       }
@@ -145,8 +187,12 @@ G* NetPoll(bool block) {
         return NULL;
       }
     }
-    if (op != NULL) {
+    if (key == kNetPollRioKey && op != NULL) {
+      rio_drain(&gp, op);
+    } else if (op != NULL) {
       handlecompletion(&gp, op, error_no, qty);
+    } else if (key == kBreakKey) {
+      atomic::release_store32(&break_pending, 0);
     } else {
       shutdown_flag = true;
     }
@@ -158,5 +204,21 @@ G* NetPoll(bool block) {
   return gp;
 }
 
+int NetPollShardOf(int proc_id) {
+  // single completion port.
+  return -1;
+}
+
+G* NetPollShard(int shard) {
+  return NULL;
+}
+
+int32 NetPollMove(PollDescriptor* pd, int proc_id) {
+  return 0;
+}
+
+void NetPollSubmit() {
+}
+
 }  // namespace runtime
 }  // namespace tin
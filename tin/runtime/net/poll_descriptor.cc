@@ -2,20 +2,133 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
+
+#include "tin/sync/atomic.h"
+
 #include "tin/runtime/net/poll_descriptor.h"
 
 namespace tin {
 namespace runtime {
 
-PollDescriptor::PollDescriptor() {
+namespace {
+
+// about a page of descriptors per allocation.
+const int kPollSlabSize =
+    std::max<int>(4096 / sizeof(PollDescriptor), 1);
+
+#if defined(ARCH_CPU_64_BITS)
+// x86-64 and arm64 user space addresses fit in 48 bits.
+const int kPdTagShift = 48;
+#else
+const int kPdTagShift = 32;
+#endif
+const uint64 kPdPtrMask = (static_cast<uint64>(1) << kPdTagShift) - 1;
+
+struct PollCache {
+  PollCache()
+    : first(NULL) {
+  }
+
+  RawMutex lock;
+  PollDescriptor* first;
+};
+
+PollCache* GetPollCache() {
+  static PollCache* cache = new PollCache;
+  return cache;
+}
+
+// cache->lock must be held.
+void AddPollSlab(PollCache* cache) {
+  // never freed, see PollDescriptor.
+  PollDescriptor* slab = new PollDescriptor[kPollSlabSize];
+  for (int i = 0; i < kPollSlabSize; ++i) {
+    slab[i].link = cache->first;
+    cache->first = &slab[i];
+  }
+}
+
+}  // namespace
+
+PollDescriptor::PollDescriptor()
+  : refs(0) {
   fd = 0;
   closing = false;
   seq = 0;
+  fdseq = 0;
+  link = NULL;
   rg = 0;
   rd = 0;
   wg = 0;
   wd = 0;
   user = 0;
+  shard = 0;
+  rdhup = 0;
+  drained = false;
+  eof_seen = false;
+  zerocopy = 0;
+  zc_done = 0;
+  // deadlines are mostly reset before they fire.
+  rt.coarse = true;
+  wt.coarse = true;
+}
+
+void PollDescriptor::Release() {
+  if (refs.fetch_sub(1) != 1)
+    return;
+  // no timer holds a reference, so none is queued. the next Open resets
+  // the rest.
+  rt.f = NULL;
+  wt.f = NULL;
+  // drops events of the closed fd still in a poller batch.
+  atomic::release_store(&fdseq, fdseq + 1);
+  PollCache* cache = GetPollCache();
+  RawMutexGuard guard(&cache->lock);
+  link = cache->first;
+  cache->first = this;
+}
+
+PollDescriptor* NewPollDescriptor() {
+  PollCache* cache = GetPollCache();
+  PollDescriptor* pd = NULL;
+  {
+    RawMutexGuard guard(&cache->lock);
+    if (cache->first == NULL)
+      AddPollSlab(cache);
+    pd = cache->first;
+    cache->first = pd->link;
+  }
+  pd->link = NULL;
+  pd->AddRef();
+  return pd;
+}
+
+void PrewarmPollDescriptors(int n) {
+  PollCache* cache = GetPollCache();
+  RawMutexGuard guard(&cache->lock);
+  int free = 0;
+  for (PollDescriptor* pd = cache->first; pd != NULL; pd = pd->link)
+    free++;
+  for (; free < n; free += kPollSlabSize)
+    AddPollSlab(cache);
+}
+
+uint64 PollDescriptorTag(PollDescriptor* pd) {
+  uint64 ptr = reinterpret_cast<uintptr_t>(pd);
+  DCHECK_EQ(ptr & ~kPdPtrMask, 0u);
+  uint64 seq = atomic::acquire_load(&pd->fdseq);
+  return ptr | (seq << kPdTagShift);
+}
+
+PollDescriptor* PollDescriptorFromTag(uint64 tag) {
+  PollDescriptor* pd =
+      reinterpret_cast<PollDescriptor*>(static_cast<uintptr_t>(
+          tag & kPdPtrMask));
+  uint64 seq = atomic::acquire_load(&pd->fdseq);
+  if (((seq << kPdTagShift) ^ tag) & ~kPdPtrMask)
+    return NULL;
+  return pd;
 }
 
 }  // namespace runtime
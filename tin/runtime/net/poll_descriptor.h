@@ -4,8 +4,10 @@
 
 #pragma once
 
+#include "base/callback.h"
 #include "base/logging.h"
-#include "base/memory/ref_counted.h"
+#include "build/build_config.h"
+#include "quark/atomic.hpp"
 #include "tin/runtime/raw_mutex.h"
 #include "tin/runtime/timer/timer_queue.h"
 
@@ -13,16 +15,25 @@
 namespace tin {
 namespace runtime {
 
-struct PollDescriptor : public base::RefCountedThreadSafe<PollDescriptor> {
+// descriptors come from a cache of slabs that are never freed, like Go's
+// pollCache. a stale event or timer racing with a close still points at a
+// PollDescriptor, and Open bumps seq and fdseq so it is recognized.
+struct PollDescriptor {
   PollDescriptor();
 
-  ~PollDescriptor() {
-    // LOG(INFO) << "PollDescriptor destructor";
+  // held by the NetFD, armed timers and io_uring ops in flight. the last
+  // Release puts the descriptor back in the cache.
+  void AddRef() {
+    refs.fetch_add(1);
   }
+  void Release();
+
   RawMutex lock;
   uintptr_t fd;
   bool closing;
   uintptr_t seq;
+  // bumped by every Open, tags the events of the poller.
+  uintptr_t fdseq;
 
   uintptr_t rg;
   Timer rt;
@@ -32,17 +43,49 @@ struct PollDescriptor : public base::RefCountedThreadSafe<PollDescriptor> {
   Timer wt;
   int64 wd;
 
+  // posted in place of a parked greenlet while rg or wg is kPdCallback.
+  base::Closure rcb;
+  base::Closure wcb;
+
   uint32 user;
+  // poller shard the fd is registered with.
+  int32 shard;
+
+  // set by the poller once the peer shut down its write side.
+  int32 rdhup;
+  // owned by the reader, the last read did not fill its buffer so the
+  // socket buffer was empty, the next read waits for an edge first.
+  bool drained;
+  // owned by the reader, a read returned 0, the peer sent all it will.
+  bool eof_seen;
+
+  // set once the socket sends with MSG_ZEROCOPY, the poller then reaps
+  // completions from the error queue into zc_done, the count of sends
+  // the kernel no longer references.
+  int32 zerocopy;
+  uint32 zc_done;
+
+  quark::atomic_uint32_t refs;
+  // next free descriptor while in the cache.
+  PollDescriptor* link;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(PollDescriptor);
 };
 
-inline PollDescriptor* NewPollDescriptor() {
-  PollDescriptor* descriptor = new PollDescriptor;
-  descriptor->AddRef();
-  return descriptor;
-}
+// a descriptor from the cache with one reference.
+PollDescriptor* NewPollDescriptor();
+
+// fills the cache up to at least n free descriptors, see
+// Config::SetPrewarmGreenlets.
+void PrewarmPollDescriptors(int n);
+
+// event data for the poller, pd with the low bits of fdseq in the top
+// bits user space pointers leave clear.
+uint64 PollDescriptorTag(PollDescriptor* pd);
+
+// pd of tag, NULL if the event is of an earlier Open of pd.
+PollDescriptor* PollDescriptorFromTag(uint64 tag);
 
 }  // namespace runtime
 }  // namespace tin
@@ -3,9 +3,12 @@
 // found in the LICENSE file.
 
 #include "base/logging.h"
+#include "base/synchronization/once.h"
 #include "tin/sync/atomic.h"
 #include "tin/runtime/runtime.h"
 #include "tin/runtime/scheduler.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/spawn.h"
 #include "tin/runtime/net/netpoll.h"
 #include "tin/runtime/net/pollops.h"
 
@@ -13,11 +16,30 @@ namespace tin {
 namespace runtime {
 namespace pollops {
 
+namespace {
+// unblocks the waiter like an expired deadline, Wait then sees the cancel.
+void CancelWaitFn(void* arg, uintptr_t mode) {
+  PollDescriptor* pd = static_cast<PollDescriptor*>(arg);
+  G* gp = NetPollUnblock(pd, static_cast<int32>(mode), false);
+  if (gp != NULL)
+    Ready(gp);
+}
+
+int InterruptErr(G* gp) {
+  return gp->Canceled() ? kPollErrCanceled : kPollErrTimeout;
+}
+}  // namespace
+
 void ServerInit() {
   NetPollInit();
   NetPollPostInit();
 }
 
+void ServerInitOnce() {
+  static base::OnceType server_init = ONCE_INIT;
+  base::CallOnce(&server_init, ServerInit);
+}
+
 void ServerNotifyShutdown() {
   NetPollShutdown();
 }
@@ -38,10 +60,17 @@ PollDescriptor* Open(uintptr_t fd, int* error_no) {
   pd->fd = fd;
   pd->closing = false;
   pd->seq++;
+  // events still queued for the previous fd no longer match.
+  atomic::release_store(&pd->fdseq, pd->fdseq + 1);
   pd->rg = 0;
   pd->rd = 0;
   pd->wg = 0;
   pd->wd = 0;
+  pd->rdhup = 0;
+  pd->drained = false;
+  pd->eof_seen = false;
+  pd->zerocopy = 0;
+  pd->zc_done = 0;
   pd->lock.Unlock();
 
   *error_no = NetPollOpen(fd, pd);
@@ -59,7 +88,7 @@ void Close(PollDescriptor* pd) {
   if (pd->rg != 0 && pd->rg != kPdReady) {
     LOG(FATAL) << "netpollOpen: blocked read on closing descriptor";
   }
-  NetPollClose(pd->fd);
+  NetPollClose(pd);
   pd->Release();
 }
 
@@ -81,16 +110,56 @@ int Wait(PollDescriptor* pd, int mode) {
   if (err != 0) {
     return err;
   }
+  G* gp = GetG();
+  gp->RunIoWaitHook();
+  if (!gp->BeginCancelable(CancelWaitFn, pd, mode)) {
+    return InterruptErr(gp);
+  }
 
   while (!NetPollBlock(pd, mode, false)) {
     err = NetPollCheckErr(pd, mode);
+    if (err == 0 && gp->Interrupted()) {
+      err = InterruptErr(gp);
+    }
     if (err != 0) {
+      gp->EndCancelable();
       return err;
     }
     // Can happen if timeout has fired and unblocked us,
     // but before we had a chance to run, timeout has been reset.
     // Pretend it has not happened and retry.
   }
+  gp->EndCancelable();
+  return 0;
+}
+
+int WaitAsync(PollDescriptor* pd, int mode, const base::Closure& closure) {
+  int err = NetPollCheckErr(pd, mode);
+  if (err != 0) {
+    return err;
+  }
+  uintptr_t* gpp = mode == 'w' ? &pd->wg : &pd->rg;
+  base::Closure* cb = mode == 'w' ? &pd->wcb : &pd->rcb;
+  *cb = closure;
+  while (true) {
+    uintptr_t old = atomic::relaxed_load(gpp);
+    if (old == kPdReady) {
+      // the readiness is left for the next Wait.
+      cb->Reset();
+      tin::Post(closure);
+      return 0;
+    }
+    if (old != 0) {
+      LOG(FATAL) << "WaitAsync: double wait";
+    }
+    if (atomic::release_cas(gpp, 0, kPdCallback)) {
+      break;
+    }
+  }
+  // a deadline or close that ran before the cas did not see the callback.
+  if (NetPollCheckErr(pd, mode) != 0) {
+    NetPollUnblock(pd, mode, false);
+  }
   return 0;
 }
 
@@ -109,25 +178,63 @@ void DelTimerRefCounted(PollDescriptor* pd, Timer* t) {
     pd->Release();
 }
 
+// Re-arms t to call f at when, or disarms it if f is NULL. A pending timer
+// whose deadline only moves later is extended in place.
+void ResetTimer(PollDescriptor* pd, Timer* t, TimerCallback f, int64 when) {
+  if (t->f != NULL) {
+    if (t->f == f && timer_q->ExtendTimer(t, when, pd->seq))
+      return;
+    DelTimerRefCounted(pd, t);
+    t->f = NULL;
+  }
+  if (f == NULL)
+    return;
+  t->f = f;
+  t->when = when;
+  // Copy current seq into the timer arg.
+  // Timer func will check the seq against current descriptor seq,
+  // if they differ the descriptor was reused or timers were reset.
+  t->arg = pd;
+  t->seq = pd->seq;
+  AddTimerRefCounted(pd, t);
+}
+
+#if defined(ARCH_CPU_64_BITS)
+// a connection pushes its read deadline back before every read, which
+// needs neither the descriptor lock nor the timer bucket while a read
+// timer is armed for an earlier one. it fires then and is armed again for
+// the deadline we leave in rd, see NetPollDeadlineImpl.
+bool PushReadDeadline(PollDescriptor* pd, int64 d) {
+  volatile intptr_t* rd = reinterpret_cast<volatile intptr_t*>(&pd->rd);
+  intptr_t old = atomic::acquire_load(rd);
+  if (old <= 0 || d < old || d <= DeadlineNow()) {
+    return false;
+  }
+  // the combined timer fires for the write deadline too.
+  uintptr_t f = atomic::acquire_load(
+      reinterpret_cast<volatile uintptr_t*>(&pd->rt.f));
+  if (f != reinterpret_cast<uintptr_t>(&NetpollReadDeadline)) {
+    return false;
+  }
+  // fails once the timer expired the deadline.
+  return atomic::cas(rd, old, static_cast<intptr_t>(d));
+}
+#endif
+
 void SetDeadline(PollDescriptor* pd, int64 d, int mode) {
+#if defined(ARCH_CPU_64_BITS)
+  if (mode == 'r' && d > 0 && PushReadDeadline(pd, d)) {
+    return;
+  }
+#endif
   pd->lock.Lock();
   if (pd->closing) {
     pd->lock.Unlock();
     return;
   }
   pd->seq++;  // invalidate current timers
-  // Reset current timers.
-  if (pd->rt.f != NULL) {
-    DelTimerRefCounted(pd, &pd->rt);
-    pd->rt.f = NULL;
-  }
-
-  if (pd->wt.f != NULL) {
-    DelTimerRefCounted(pd, &pd->wt);
-    pd->wt.f = NULL;
-  }
 
-  if (d != 0 && d <= MonoNow()) {
+  if (d != 0 && d <= DeadlineNow()) {
     d = -1;
   }
   if (mode == 'r' || mode == 'r' + 'w') {
@@ -137,32 +244,18 @@ void SetDeadline(PollDescriptor* pd, int64 d, int mode) {
     pd->wd = d;
   }
 
+  TimerCallback rf = NULL;
+  TimerCallback wf = NULL;
   if (pd->rd > 0 && pd->rd == pd->wd) {
-    pd->rt.f = NetpollDeadline;
-    pd->rt.when = pd->rd;
-    // Copy current seq into the timer arg.
-    // Timer func will check the seq against current descriptor seq,
-    // if they differ the descriptor was reused or timers were reset.
-    pd->rt.arg = pd;
-    pd->rt.seq = pd->seq;
-    AddTimerRefCounted(pd, &pd->rt);
+    rf = NetpollDeadline;
   } else {
-    if (pd->rd > 0) {
-      pd->rt.f = NetpollReadDeadline;
-      pd->rt.when = pd->rd;
-      pd->rt.arg = pd;
-      pd->rt.seq = pd->seq;
-      AddTimerRefCounted(pd, &pd->rt);
-    }
-
-    if (pd->wd > 0) {
-      pd->wt.f = NetPollWriteDeadline;
-      pd->wt.when = pd->wd;
-      pd->wt.arg = pd;
-      pd->wt.seq = pd->seq;
-      AddTimerRefCounted(pd, &pd->wt);
-    }
+    if (pd->rd > 0)
+      rf = NetpollReadDeadline;
+    if (pd->wd > 0)
+      wf = NetPollWriteDeadline;
   }
+  ResetTimer(pd, &pd->rt, rf, pd->rd);
+  ResetTimer(pd, &pd->wt, wf, pd->wd);
 
   G* rg = NULL;
   G* wg = NULL;
@@ -185,6 +278,10 @@ void SetDeadline(PollDescriptor* pd, int64 d, int mode) {
   }
 }
 
+int Move(PollDescriptor* pd, int proc_id) {
+  return NetPollMove(pd, proc_id);
+}
+
 void Unblock(PollDescriptor* pd) {
   pd->lock.Lock();
   if (pd->closing) {
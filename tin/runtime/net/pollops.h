@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #pragma once
+#include "base/callback.h"
 
 namespace tin {
 namespace runtime {
@@ -11,15 +12,28 @@ struct PollDescriptor;
 namespace pollops {
 
 void ServerInit();
+// ServerInit the first time only, callable from any thread.
+void ServerInitOnce();
 void ServerNotifyShutdown();
 void ServerDeinit();
 PollDescriptor* Open(uintptr_t fd, int* error_no);
+// Wait returns this once the greenlet is canceled, see Greenlet::Cancel.
+// past the deadline of the greenlet it returns kPollErrTimeout like for an
+// expired deadline of the descriptor.
+const int kPollErrTimeout = 2;
+const int kPollErrCanceled = 3;
+
 int Wait(PollDescriptor* pd, int mode);
+// parks no greenlet, closure is posted once pd is ready for mode, closed
+// or past its deadline. an error of NetPollCheckErr if it is already.
+int WaitAsync(PollDescriptor* pd, int mode, const base::Closure& closure);
 void Close(PollDescriptor* pd);
 int Reset(PollDescriptor* pd, int mode);
 void Unblock(PollDescriptor* pd);
 void WaitCanceled(PollDescriptor* pd, int mode);
 void SetDeadline(PollDescriptor* pd, int64 d, int mode);
+// see NetPollMove.
+int Move(PollDescriptor* pd, int proc_id);
 
 }  // namespace pollops
 }  // namespace runtime
@@ -0,0 +1,274 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "base/logging.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/net/netpoll.h"
+#include "tin/runtime/net/poll_descriptor.h"
+
+#include "tin/runtime/net/uring.h"
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+namespace tin {
+namespace runtime {
+
+namespace {
+
+const uint32 kUringEntries = 1024;
+
+struct Ring {
+  int fd;
+  uint32 entries;
+  uint32* sq_head;
+  uint32* sq_tail;
+  uint32* sq_mask;
+  uint32* sq_array;
+  io_uring_sqe* sqes;
+  uint32* cq_head;
+  uint32* cq_tail;
+  uint32* cq_mask;
+  io_uring_cqe* cqes;
+  // queued but not yet passed to io_uring_enter.
+  int32 unsubmitted;
+  RawMutex sq_lock;
+  RawMutex cq_lock;
+};
+
+Ring* ring = NULL;
+
+inline uint32 LoadAcquire(uint32* p) {
+  return static_cast<uint32>(
+      atomic::acquire_load32(reinterpret_cast<volatile int32*>(p)));
+}
+
+inline void StoreRelease(uint32* p, uint32 v) {
+  atomic::release_store32(reinterpret_cast<volatile int32*>(p),
+                          static_cast<int32>(v));
+}
+
+int Enter(uint32 to_submit, uint32 min_complete, uint32 flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, ring->fd, to_submit,
+                                  min_complete, flags, NULL, 0));
+}
+
+// sq_lock must be held.
+void SubmitLocked() {
+  while (ring->unsubmitted > 0) {
+    int n = Enter(ring->unsubmitted, 0, 0);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EBUSY)
+        break;  // retried by the next UringSubmit.
+      LOG(FATAL) << "io_uring_enter failed, error code: " << errno;
+    }
+    atomic::relaxed_store32(&ring->unsubmitted, ring->unsubmitted - n);
+  }
+}
+
+// sq_lock must be held.
+io_uring_sqe* GetSqeLocked() {
+  while (true) {
+    uint32 head = LoadAcquire(ring->sq_head);
+    uint32 tail = *ring->sq_tail;
+    if (tail - head < ring->entries) {
+      uint32 index = tail & *ring->sq_mask;
+      io_uring_sqe* sqe = &ring->sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      ring->sq_array[index] = index;
+      return sqe;
+    }
+    // full, the kernel consumes the submitted entries synchronously.
+    SubmitLocked();
+  }
+}
+
+// sq_lock must be held.
+void PushSqeLocked() {
+  StoreRelease(ring->sq_tail, *ring->sq_tail + 1);
+  atomic::relaxed_store32(&ring->unsubmitted, ring->unsubmitted + 1);
+}
+
+void Queue(uint8 opcode, int fd, uint64 addr, uint32 len, uint32 op_flags,
+           uint64 user_data, uint64 off = 0) {
+  RawMutexGuard guard(&ring->sq_lock);
+  io_uring_sqe* sqe = GetSqeLocked();
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = off;
+  sqe->addr = addr;
+  sqe->len = len;
+  sqe->msg_flags = op_flags;
+  sqe->user_data = user_data;
+  PushSqeLocked();
+}
+
+void Prepare(UringOp* op) {
+  // keeps pd alive until the completion is reaped.
+  if (op->pd != NULL)
+    op->pd->AddRef();
+  op->res = 0;
+  atomic::release_store32(&op->done, 0);
+}
+
+}  // namespace
+
+bool UringInit() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = static_cast<int>(
+      syscall(__NR_io_uring_setup, kUringEntries, &params));
+  if (fd < 0) {
+    LOG(WARNING) << "io_uring_setup failed, error code: " << errno;
+    return false;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32);
+  size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap && cq_size > sq_size)
+    sq_size = cq_size;
+  char* sq = static_cast<char*>(mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, fd,
+                                     IORING_OFF_SQ_RING));
+  char* cq = sq;
+  if (sq != MAP_FAILED && !single_mmap) {
+    cq = static_cast<char*>(mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd,
+                                 IORING_OFF_CQ_RING));
+  }
+  void* sqes = MAP_FAILED;
+  if (sq != MAP_FAILED && cq != MAP_FAILED) {
+    sqes = mmap(NULL, params.sq_entries * sizeof(io_uring_sqe),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                IORING_OFF_SQES);
+  }
+  if (sqes == MAP_FAILED) {
+    // the process exits with the ring mapped, no need to unmap.
+    LOG(WARNING) << "io_uring mmap failed, error code: " << errno;
+    close(fd);
+    return false;
+  }
+
+  Ring* r = new Ring;
+  r->fd = fd;
+  r->entries = params.sq_entries;
+  r->sq_head = reinterpret_cast<uint32*>(sq + params.sq_off.head);
+  r->sq_tail = reinterpret_cast<uint32*>(sq + params.sq_off.tail);
+  r->sq_mask = reinterpret_cast<uint32*>(sq + params.sq_off.ring_mask);
+  r->sq_array = reinterpret_cast<uint32*>(sq + params.sq_off.array);
+  r->sqes = static_cast<io_uring_sqe*>(sqes);
+  r->cq_head = reinterpret_cast<uint32*>(cq + params.cq_off.head);
+  r->cq_tail = reinterpret_cast<uint32*>(cq + params.cq_off.tail);
+  r->cq_mask = reinterpret_cast<uint32*>(cq + params.cq_off.ring_mask);
+  r->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  r->unsubmitted = 0;
+  ring = r;
+  return true;
+}
+
+bool UringEnabled() {
+  return ring != NULL;
+}
+
+int UringFd() {
+  return ring != NULL ? ring->fd : -1;
+}
+
+void UringRecv(int fd, void* buf, int len, UringOp* op) {
+  Prepare(op);
+  Queue(IORING_OP_RECV, fd, reinterpret_cast<uintptr_t>(buf), len, 0,
+        reinterpret_cast<uintptr_t>(op));
+}
+
+void UringSend(int fd, const void* buf, int len, UringOp* op) {
+  Prepare(op);
+  Queue(IORING_OP_SEND, fd, reinterpret_cast<uintptr_t>(buf), len,
+        MSG_NOSIGNAL, reinterpret_cast<uintptr_t>(op));
+}
+
+void UringAccept(int fd, UringOp* op) {
+  Prepare(op);
+  // msg_flags shares the union with accept_flags.
+  Queue(IORING_OP_ACCEPT, fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC,
+        reinterpret_cast<uintptr_t>(op));
+}
+
+void UringReadAt(int fd, void* buf, int len, int64 offset, UringOp* op) {
+  DCHECK(op->pd == NULL && op->gp != NULL);
+  Prepare(op);
+  Queue(IORING_OP_READ, fd, reinterpret_cast<uintptr_t>(buf), len, 0,
+        reinterpret_cast<uintptr_t>(op), static_cast<uint64>(offset));
+}
+
+void UringWriteAt(int fd, const void* buf, int len, int64 offset,
+                  UringOp* op) {
+  DCHECK(op->pd == NULL && op->gp != NULL);
+  Prepare(op);
+  Queue(IORING_OP_WRITE, fd, reinterpret_cast<uintptr_t>(buf), len, 0,
+        reinterpret_cast<uintptr_t>(op), static_cast<uint64>(offset));
+}
+
+void UringCancel(UringOp* op) {
+  // the cancel request itself completes with user_data 0.
+  Queue(IORING_OP_ASYNC_CANCEL, -1, reinterpret_cast<uintptr_t>(op), 0, 0, 0);
+  UringSubmit();
+}
+
+void UringSubmit() {
+  if (ring == NULL || atomic::relaxed_load32(&ring->unsubmitted) == 0)
+    return;
+  RawMutexGuard guard(&ring->sq_lock);
+  SubmitLocked();
+}
+
+void UringReap(G** gpp) {
+  if (ring == NULL)
+    return;
+  if (*ring->cq_head == LoadAcquire(ring->cq_tail))
+    return;
+  RawMutexGuard guard(&ring->cq_lock);
+  uint32 head = *ring->cq_head;
+  uint32 tail = LoadAcquire(ring->cq_tail);
+  for (; head != tail; head++) {
+    io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    UringOp* op = reinterpret_cast<UringOp*>(cqe->user_data);
+    if (op == NULL)
+      continue;
+    // op may be reused once done is seen, save what we need first.
+    PollDescriptor* pd = op->pd;
+    G* gp = op->gp;
+    int32 mode = op->mode;
+    op->res = cqe->res;
+    atomic::release_store32(&op->done, 1);
+    if (pd == NULL) {
+      // a file request, its greenlet parked without a descriptor.
+      gp->SetSchedLink(*gpp);
+      *gpp = gp;
+      continue;
+    }
+    NetPollReady(gpp, pd, mode);
+    pd->Release();
+  }
+  StoreRelease(ring->cq_head, tail);
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,71 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "build/build_config.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/util.h"
+
+namespace tin {
+namespace runtime {
+
+struct PollDescriptor;
+
+// One io_uring request in flight. The completion stores res, marks the op
+// done and readies the greenlet parked on pd for mode, or gp if there is
+// no pd, e.g. for files.
+struct UringOp {
+  UringOp()
+    : pd(NULL)
+    , gp(NULL)
+    , mode(0)
+    , res(0)
+    , done(0) {
+  }
+
+  bool Done() const {
+    return atomic::acquire_load32(&done) != 0;
+  }
+
+  PollDescriptor* pd;
+  // parked before the request is queued, see UringReadAt.
+  G* gp;
+  int32 mode;
+  // bytes transferred, accepted fd or -errno.
+  int32 res;
+  int32 done;
+};
+
+#if defined(OS_LINUX)
+// sets up the ring, false if the kernel lacks io_uring.
+bool UringInit();
+bool UringEnabled();
+// pollable, readable when completions are pending.
+int UringFd();
+
+// requests are queued and submitted in batches by UringSubmit, the caller
+// waits on op->pd for op->mode until op->Done().
+void UringRecv(int fd, void* buf, int len, UringOp* op);
+void UringSend(int fd, const void* buf, int len, UringOp* op);
+void UringAccept(int fd, UringOp* op);
+// positional file io, op->gp must be set and parked by the time the
+// request is submitted, so queue them from an unlock function of Park.
+void UringReadAt(int fd, void* buf, int len, int64 offset, UringOp* op);
+void UringWriteAt(int fd, const void* buf, int len, int64 offset,
+                  UringOp* op);
+void UringCancel(UringOp* op);
+
+// submits the queued requests, cheap if there are none.
+void UringSubmit();
+// completes the finished requests, appends greenlets made ready to *gpp.
+void UringReap(G** gpp);
+#else
+inline bool UringEnabled() {
+  return false;
+}
+#endif
+
+}  // namespace runtime
+}  // namespace tin
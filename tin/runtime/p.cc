@@ -2,35 +2,136 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
+
 #include "base/logging.h"
 #include "base/threading/platform_thread.h"
 
 #include "tin/sync/atomic.h"
+#include "tin/runtime/arena.h"
 #include "tin/runtime/runtime.h"
 #include "tin/runtime/greenlet.h"
 #include "tin/runtime/scheduler.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/runtime/spawn.h"
 
 #include "tin/runtime/p.h"
 
 namespace tin {
 namespace runtime {
 
+namespace {
+// closures one P can have in flight to another, see SendTo.
+const uint32 kMailboxSize = 256;
+
+}  // namespace
+
 P::P(int id)
-  : runq_head_(0)
-  , runq_tail_(0)
-  , link_(NULL)
+  : runq_capacity_(kMinRunqCapacity)
+  , runq_(NULL)
   , id_(id)
-  , status_(kPidle)
+  , inbox_(NULL)
+  , epoch_(0)
+  , runq_head_(0)
+  , runq_tail_(0)
   , sched_tick_(0)
-  , m_(NULL) {
+  , runq_overflow_size_(0)
+  , sudog_count_(0)
+  , arena_chunks_(NULL)
+  , arena_chunk_count_(0)
+  , cpu_(0)
+  , spawns_(0)
+  , exits_(0)
+  , parks_(0)
+  , contention_tick_(0)
+  , m_(NULL)
+  , limbo_(NULL)
+  , status_(kPidle)
+  , syscall_tick_(0)
+  , preempt_(0)
+  , mail_pending_(0)
+  , link_(NULL)
+  , batch_size_(0)
+  , sticky_size_(0)
+  , all_head_(NULL)
+  , sched_latency_(NULL) {
   runq_head_ = runq_tail_ = 0;
+  // power of 2, so indices keep consistent when uint32 wraps.
+  while (runq_capacity_ < static_cast<uint32>(rtm_conf->RunqCapacity()) &&
+         runq_capacity_ < static_cast<uint32>(kMaxRunqCapacity)) {
+    runq_capacity_ *= 2;
+  }
+  runq_ = new GUintptr[runq_capacity_];
+  inbox_ = new Mailbox*[kTinProcsLimit];
+  for (int i = 0; i < kTinProcsLimit; i++) {
+    inbox_[i] = NULL;
+  }
+  for (int i = 0; i < kNumStackSizeClasses; i++) {
+    gfree_count_[i] = 0;
+  }
+  for (int i = 0; i < kNumDistances; i++) {
+    steal_count_[i] = 0;
+  }
+  if (rtm_conf->IsSchedLatencyEnabled()) {
+    sched_latency_ = new uint64[kLatencyHistogramSize];
+    for (int i = 0; i < kLatencyHistogramSize; i++) {
+      sched_latency_[i] = 0;
+    }
+  }
+}
+
+void P::RecordSchedLatency(int64 ns) {
+  if (sched_latency_ == NULL) {
+    return;
+  }
+  RecordLatency(sched_latency_, ns);
+}
+
+void P::AddSchedLatency(SchedLatencyStats* stats) const {
+  if (sched_latency_ == NULL) {
+    return;
+  }
+  AddLatency(sched_latency_, stats);
 }
 
 bool P::RunqEmpty() {
-  return runq_head_ == runq_tail_ && run_next_.Integer() == 0;
+  return runq_head_ == runq_tail_ && run_next_.Integer() == 0 &&
+         atomic::relaxed_load32(&runq_overflow_size_) == 0 &&
+         atomic::relaxed_load32(&batch_size_) == 0;
+}
+
+int32 P::RunqSize() {
+  // head first, so a racing RunqGet cannot make it negative.
+  uint32 h = atomic::acquire_load32(&runq_head_);
+  uint32 t = atomic::acquire_load32(&runq_tail_);
+  int32 n = static_cast<int32>(t - h);
+  if (atomic::relaxed_load(run_next_.Address()) != 0) {
+    n++;
+  }
+  return n + atomic::relaxed_load32(&runq_overflow_size_) +
+         atomic::relaxed_load32(&batch_size_) +
+         atomic::relaxed_load32(&sticky_size_);
+}
+
+int32 P::RunqRoom() {
+  if (atomic::relaxed_load32(&runq_overflow_size_) != 0) {
+    return 0;
+  }
+  uint32 h = atomic::acquire_load32(&runq_head_);
+  uint32 t = runq_tail_;
+  return static_cast<int32>(runq_capacity_ - (t - h));
 }
 
 void P::RunqPut(G* gp, bool next) {
+  if (gp->HomeProc() >= 0) {
+    // starts or resumes on its own P.
+    sched->StickyReady(gp);
+    return;
+  }
+  if (gp->Priority() == kPriorityBatch) {
+    BatchPut(gp);
+    return;
+  }
   if (next) {
     uintptr_t oldnext = atomic::relaxed_load(run_next_.Address());
     while (!atomic::cas(run_next_.Address(), oldnext, GUintptr(gp).Integer())) {
@@ -43,20 +144,23 @@ void P::RunqPut(G* gp, bool next) {
     gp = GpCastBack(oldnext);
   }
 
-  while (true) {
-    uint32 h = atomic::acquire_load32(&runq_head_);
-    uint32 t = atomic::acquire_load32(&runq_tail_);
+  // keep FIFO order, the overflow must drain before runq_ takes more.
+  // thieves only shrink it, a stale size just queues behind what is left.
+  if (atomic::relaxed_load32(&runq_overflow_size_) != 0) {
+    RunqOverflowPut(gp);
+    return;
+  }
 
-    if (t - h < static_cast<uint32>(kRunqCapacity)) {
-      runq_[t % static_cast<uint32>(kRunqCapacity)] = gp;
-      // store-release, makes the item available for consumption
-      atomic::release_store32(&runq_tail_, t + 1);
-      return;
-    }
-    if (RunqPutSlow(gp, h, t)) {
-      return;
-    }
+  uint32 h = atomic::acquire_load32(&runq_head_);
+  uint32 t = runq_tail_;
+  if (t - h < runq_capacity_) {
+    runq_[t % runq_capacity_] = gp;
+    // store-release, makes the item available for consumption
+    atomic::release_store32(&runq_tail_, t + 1);
+    return;
   }
+  // bursts stay local and cache-hot while the overflow has room.
+  RunqOverflowPut(gp);
 }
 
 G* P::RunqGet(bool* inherit_time) {
@@ -73,16 +177,29 @@ G* P::RunqGet(bool* inherit_time) {
     }
   }
 
+  // every other tick the sticky ones go first, so neither queue starves.
+  if (atomic::relaxed_load32(&sticky_size_) != 0 && (sched_tick_ & 1) == 0) {
+    G* gp = StickyGet();
+    if (gp != NULL) {
+      if (inherit_time != NULL)
+        *inherit_time = false;
+      return gp;
+    }
+  }
+
   while (true) {
     // load-acquire, synchronize with other consumers
     uint32 h = atomic::acquire_load32(&runq_head_);
     uint32 t = atomic::relaxed_load32(&runq_tail_);
     if (t == h) {
+      if (RunqRefill()) {
+        continue;
+      }
       if (inherit_time != NULL)
         *inherit_time = false;
-      return NULL;
+      return StickyGet();
     }
-    G* gp = runq_[h % static_cast<uint32>(kRunqCapacity)].Pointer();
+    G* gp = runq_[h % runq_capacity_].Pointer();
     // cas-release, commits consume
     if (atomic::release_cas32(&runq_head_, h, h + 1)) {
       if (inherit_time != NULL)
@@ -92,32 +209,217 @@ G* P::RunqGet(bool* inherit_time) {
   }
 }
 
-bool P::RunqPutSlow(G* gp, uint32 h, uint32 t) {
-  G* batch[kRunqCapacity / 2 + 1];
-  uint32 n = t - h;
-  n = n / 2;
+void P::BatchPut(G* gp) {
+  gp->SetSchedLink(NULL);
+  RawMutexGuard guard(&batch_lock_);
+  if (batch_tail_.IsNull()) {
+    batch_head_ = gp;
+  } else {
+    batch_tail_.Pointer()->SetSchedLink(gp);
+  }
+  batch_tail_ = gp;
+  atomic::relaxed_store32(&batch_size_, batch_size_ + 1);
+}
 
-  if (n != static_cast<uint32>(kRunqCapacity / 2)) {
-    // unreachable code.
-    LOG(FATAL) << "RunqPutSlow: queue is not full";
+G* P::BatchGet() {
+  if (atomic::relaxed_load32(&batch_size_) == 0) {
+    return NULL;
+  }
+  RawMutexGuard guard(&batch_lock_);
+  G* gp = batch_head_.Pointer();
+  if (gp == NULL) {
+    return NULL;
   }
+  batch_head_ = gp->SchedLink();
+  if (batch_head_.IsNull()) {
+    batch_tail_ = static_cast<void*>(0);
+  }
+  atomic::relaxed_store32(&batch_size_, batch_size_ - 1);
+  return gp;
+}
 
-  for (uint32 i = 0; i < n; i++) {
-    batch[i] = runq_[(h + i) % static_cast<uint32>(kRunqCapacity)].Pointer();
+bool P::StickyPut(G* gp) {
+  gp->SetSchedLink(NULL);
+  gp->SetStickySince(CoarseNow());
+  RawMutexGuard guard(&sticky_lock_);
+  bool was_empty = sticky_tail_.IsNull();
+  if (was_empty) {
+    sticky_head_ = gp;
+  } else {
+    sticky_tail_.Pointer()->SetSchedLink(gp);
   }
+  sticky_tail_ = gp;
+  atomic::relaxed_store32(&sticky_size_, sticky_size_ + 1);
+  return was_empty;
+}
 
-  // cas-release, commits consume
-  if (!atomic::release_cas32(&runq_head_, h, h + n)) {
+G* P::StickyGet() {
+  if (atomic::relaxed_load32(&sticky_size_) == 0) {
+    return NULL;
+  }
+  RawMutexGuard guard(&sticky_lock_);
+  G* gp = sticky_head_.Pointer();
+  if (gp == NULL) {
+    return NULL;
+  }
+  sticky_head_ = gp->SchedLink();
+  if (sticky_head_.IsNull()) {
+    sticky_tail_ = static_cast<void*>(0);
+  }
+  atomic::relaxed_store32(&sticky_size_, sticky_size_ - 1);
+  return gp;
+}
+
+G* P::StickySteal(int64 now, bool idle) {
+  if (atomic::relaxed_load32(&sticky_size_) == 0) {
+    return NULL;
+  }
+  RawMutexGuard guard(&sticky_lock_);
+  G* gp = sticky_head_.Pointer();
+  if (gp == NULL || (!idle && now - gp->StickySince() < kStickyStarveNs)) {
+    return NULL;
+  }
+  sticky_head_ = gp->SchedLink();
+  if (sticky_head_.IsNull()) {
+    sticky_tail_ = static_cast<void*>(0);
+  }
+  atomic::relaxed_store32(&sticky_size_, sticky_size_ - 1);
+  return gp;
+}
+
+bool P::MailPut(int from, const base::Closure& closure, bool* wake) {
+  Mailbox* box = inbox_[from];
+  if (box == NULL) {
+    box = new Mailbox(kMailboxSize);
+    // the sender only ever races with another P's first send to another
+    // box, so a plain release store will do.
+    atomic::release_store(reinterpret_cast<uintptr_t*>(&inbox_[from]),
+                          reinterpret_cast<uintptr_t>(box));
+  }
+  if (!box->TryPush(closure)) {
     return false;
   }
-  batch[n] = gp;
+  // after the push, MailDrain clears it before it pops.
+  *wake = atomic::exchange32(&mail_pending_, 1) == 0;
+  return true;
+}
 
-  for (uint32 i = 0; i < n; i++) {
-    batch[i]->SetSchedLink(batch[i + 1]);
+int32 P::MailDrain() {
+  atomic::exchange32(&mail_pending_, 0);
+  int32 n = 0;
+  base::Closure closure;
+  SpawnOptions opts;
+  opts.proc = id_;
+  opts.sticky = true;
+  for (int i = 0; i < kTinProcsLimit; i++) {
+    Mailbox* box = reinterpret_cast<Mailbox*>(
+        atomic::acquire_load(reinterpret_cast<uintptr_t*>(&inbox_[i])));
+    if (box == NULL) {
+      continue;
+    }
+    while (box->TryPop(&closure)) {
+      RuntimeSpawn(&closure, opts);
+      n++;
+    }
   }
+  return n;
+}
 
-  SchedulerLocker guard;
-  sched->GlobalRunqBatch(batch[0], batch[n], n + 1);
+int32 P::MailMove(P* to) {
+  atomic::exchange32(&mail_pending_, 0);
+  int32 n = 0;
+  base::Closure closure;
+  for (int i = 0; i < kTinProcsLimit; i++) {
+    Mailbox* box = inbox_[i];
+    if (box == NULL) {
+      continue;
+    }
+    while (box->TryPop(&closure)) {
+      bool wake = false;
+      if (!to->MailPut(i, closure, &wake)) {
+        // its box from i is full, queue a greenlet there instead.
+        SpawnOptions opts;
+        opts.proc = to->Id();
+        opts.sticky = true;
+        RuntimeSpawn(&closure, opts);
+      }
+      n++;
+    }
+  }
+  return n;
+}
+
+void P::RunqDemoteNext() {
+  uintptr_t next = atomic::relaxed_load(run_next_.Address());
+  // a thief may take it meanwhile.
+  if (next == 0 || !atomic::cas(run_next_.Address(), next, 0)) {
+    return;
+  }
+  RunqPut(GpCastBack(next), false);
+}
+
+void P::RunqOverflowPut(G* gp) {
+  gp->SetSchedLink(NULL);
+  G* spill = NULL;
+  G* spill_tail = NULL;
+  int32 n = 0;
+  {
+    RawMutexGuard guard(&runq_overflow_lock_);
+    if (runq_overflow_tail_.IsNull()) {
+      runq_overflow_head_ = gp;
+    } else {
+      runq_overflow_tail_.Pointer()->SetSchedLink(gp);
+    }
+    runq_overflow_tail_ = gp;
+    int32 size = runq_overflow_size_ + 1;
+    if (size >= static_cast<int32>(runq_capacity_) * kRunqOverflowFactor) {
+      // full, the oldest half a ring goes to the global queue so a long
+      // burst is not stranded on this P.
+      spill = runq_overflow_head_.Pointer();
+      spill_tail = spill;
+      n = 1;
+      while (n < static_cast<int32>(runq_capacity_ / 2)) {
+        spill_tail = GpCastBack(spill_tail->SchedLink());
+        n++;
+      }
+      runq_overflow_head_ = spill_tail->SchedLink();
+      spill_tail->SetSchedLink(NULL);
+      size -= n;
+    }
+    atomic::relaxed_store32(&runq_overflow_size_, size);
+  }
+  if (spill != NULL) {
+    sched->GlobalRunqBatch(spill, spill_tail, n);
+  }
+}
+
+// Move up to half of capacity from overflow to the empty runq_,
+// return false if overflow is empty.
+bool P::RunqRefill() {
+  if (atomic::relaxed_load32(&runq_overflow_size_) == 0) {
+    return false;
+  }
+  RawMutexGuard guard(&runq_overflow_lock_);
+  if (runq_overflow_head_.IsNull()) {
+    return false;
+  }
+  // only the owner puts, thieves just move head forward.
+  uint32 t = runq_tail_;
+  uint32 n = 0;
+  while (n < runq_capacity_ / 2 && !runq_overflow_head_.IsNull()) {
+    G* gp = runq_overflow_head_.Pointer();
+    runq_overflow_head_ = gp->SchedLink();
+    gp->SetSchedLink(NULL);
+    runq_[(t + n) % runq_capacity_] = gp;
+    n++;
+  }
+  if (runq_overflow_head_.IsNull()) {
+    runq_overflow_tail_ = static_cast<void*>(0);
+  }
+  atomic::relaxed_store32(&runq_overflow_size_,
+                          runq_overflow_size_ - static_cast<int32>(n));
+  // store-release, makes the items available for consumption
+  atomic::release_store32(&runq_tail_, t + n);
   return true;
 }
 
@@ -155,12 +457,16 @@ uint32 P::RunqGrab(GUintptr* batch, int batch_size, uint32 batch_head,
     }
 
     // read inconsistent h and t
-    if (n > static_cast<uint32>(kRunqCapacity) / 2) {
+    if (n > runq_capacity_ / 2) {
       continue;
     }
+    // the thief may have a smaller runq.
+    if (n > static_cast<uint32>(batch_size) / 2) {
+      n = static_cast<uint32>(batch_size) / 2;
+    }
 
     for (uint32 i  = 0; i < n; i++) {
-      GUintptr g = runq_[(h + i) % static_cast<uint32>(kRunqCapacity)];
+      GUintptr g = runq_[(h + i) % runq_capacity_];
       batch[(batch_head + i) % static_cast<uint32>(batch_size)] = g;
     }
     // cas-release, commits consume
@@ -173,18 +479,64 @@ uint32 P::RunqGrab(GUintptr* batch, int batch_size, uint32 batch_head,
 // Steal half of elements from local runnable queue of p2
 G* P::RunqSteal(P* p2 , bool steal_nextg ) {
   uint32 t = runq_tail_;
-  uint32 n = p2->RunqGrab(&runq_[0], kRunqCapacity, t, steal_nextg);
+  uint32 n = p2->RunqGrab(&runq_[0], runq_capacity_, t, steal_nextg);
   if (n == 0) {
-    return NULL;
+    return RunqStealOverflow(p2);
   }
   n--;
-  G* gp = runq_[(t + n) % static_cast<uint32>(kRunqCapacity)].Pointer();
+  G* gp = runq_[(t + n) % runq_capacity_].Pointer();
   if (n == 0) {
     return gp;
   }
   // load-acquire, synchronize with consumers
   uint32 h = atomic::acquire_load32(&runq_head_);
-  if (t - h + n >= static_cast<uint32>(kRunqCapacity)) {
+  if (t - h + n >= runq_capacity_) {
+    LOG(FATAL) << "runqsteal: runq overflow";
+  }
+  // store-release, makes the item available for consumption
+  atomic::release_store32(&runq_tail_, t + n);
+  return gp;
+}
+
+// runq_ of p2 is empty but its owner has not refilled it yet, e.g. while
+// it runs a long greenlet. take half of the overflow, the oldest first.
+G* P::RunqStealOverflow(P* p2) {
+  if (atomic::relaxed_load32(&p2->runq_overflow_size_) == 0) {
+    return NULL;
+  }
+  uint32 t = runq_tail_;
+  G* gp = NULL;
+  uint32 n = 0;
+  {
+    RawMutexGuard guard(&p2->runq_overflow_lock_);
+    int32 size = p2->runq_overflow_size_;
+    uint32 want = static_cast<uint32>(size - size / 2);
+    if (want > runq_capacity_ / 2) {
+      want = runq_capacity_ / 2;
+    }
+    for (uint32 i = 0; i < want; i++) {
+      G* g = p2->runq_overflow_head_.Pointer();
+      p2->runq_overflow_head_ = g->SchedLink();
+      g->SetSchedLink(NULL);
+      if (gp == NULL) {
+        gp = g;
+      } else {
+        runq_[(t + n) % runq_capacity_] = g;
+        n++;
+      }
+    }
+    if (p2->runq_overflow_head_.IsNull()) {
+      p2->runq_overflow_tail_ = static_cast<void*>(0);
+    }
+    atomic::relaxed_store32(&p2->runq_overflow_size_,
+                            size - static_cast<int32>(want));
+  }
+  if (n == 0) {
+    return gp;
+  }
+  // load-acquire, synchronize with consumers
+  uint32 h = atomic::acquire_load32(&runq_head_);
+  if (t - h + n >= runq_capacity_) {
     LOG(FATAL) << "runqsteal: runq overflow";
   }
   // store-release, makes the item available for consumption
@@ -199,5 +551,158 @@ bool P::CasStatus(uint32 old_status, uint32 new_status) {
   return atomic::cas32(&status_, old_status, new_status);
 }
 
+void P::AddGreenlet(G* gp) {
+  gp->SetAllLink(all_head_);
+  atomic::release_store(reinterpret_cast<uintptr_t*>(&all_head_),
+                        reinterpret_cast<uintptr_t>(gp));
+}
+
+void P::GFPut(G* gp) {
+  int size_class = StackSizeClass(gp->StackSize());
+  if (size_class < 0) {
+    sched->GShellPutBatch(gp, gp);
+    return;
+  }
+  gp->SetSchedLink(gfree_[size_class].Pointer());
+  gfree_[size_class] = gp;
+  gfree_count_[size_class]++;
+  if (gfree_count_[size_class] < kGFreeLocalMax) {
+    return;
+  }
+
+  // Move a batch of free greenlets to the global list, keep the warm ones.
+  G* ghead = gfree_[size_class].Pointer();
+  G* gtail = ghead;
+  int32 n = 1;
+  while (gfree_count_[size_class] - n > kGFreeLocalKeep) {
+    gtail = GpCastBack(gtail->SchedLink());
+    n++;
+  }
+  gfree_[size_class] = gtail->SchedLink();
+  gfree_count_[size_class] -= n;
+  sched->GFreePutBatch(size_class, ghead, gtail, n);
+}
+
+G* P::GFGet(int size_class) {
+  if (gfree_[size_class].IsNull()) {
+    int32 n = 0;
+    G* glist = sched->GFreeGetBatch(size_class, kGFreeLocalKeep, &n);
+    if (glist == NULL) {
+      return NULL;
+    }
+    gfree_[size_class] = glist;
+    gfree_count_[size_class] = n;
+  }
+  G* gp = gfree_[size_class].Pointer();
+  gfree_[size_class] = gp->SchedLink();
+  gfree_count_[size_class]--;
+  gp->SetSchedLink(NULL);
+  return gp;
+}
+
+void P::GFPurge() {
+  for (int i = 0; i < kNumStackSizeClasses; i++) {
+    if (gfree_[i].IsNull()) {
+      continue;
+    }
+    G* ghead = gfree_[i].Pointer();
+    G* gtail = ghead;
+    while (gtail->SchedLink() != 0) {
+      gtail = GpCastBack(gtail->SchedLink());
+    }
+    sched->GFreePutBatch(i, ghead, gtail, gfree_count_[i]);
+    gfree_[i] = static_cast<void*>(0);
+    gfree_count_[i] = 0;
+  }
+}
+
+Sudog* P::SudogGet() {
+  if (sudog_count_ == 0) {
+    int32 n = 0;
+    Sudog* list = sched->SudogGetBatch(kSudogCacheSize / 2, &n);
+    for ( ; list != NULL; list = list->next) {
+      sudog_cache_[sudog_count_++] = list;
+    }
+    if (sudog_count_ == 0) {
+      return new Sudog;
+    }
+  }
+  Sudog* s = sudog_cache_[--sudog_count_];
+  *s = Sudog();
+  return s;
+}
+
+void P::SudogPut(Sudog* s) {
+  if (sudog_count_ == kSudogCacheSize) {
+    // Move the older half to the global list.
+    Sudog* head = NULL;
+    Sudog* tail = NULL;
+    int32 n = kSudogCacheSize / 2;
+    for (int32 i = 0; i < n; i++) {
+      Sudog* t = sudog_cache_[i];
+      t->next = NULL;
+      if (tail == NULL) {
+        head = t;
+      } else {
+        tail->next = t;
+      }
+      tail = t;
+    }
+    for (int32 i = n; i < sudog_count_; i++) {
+      sudog_cache_[i - n] = sudog_cache_[i];
+    }
+    sudog_count_ -= n;
+    sched->SudogPutBatch(head, tail, n);
+  }
+  sudog_cache_[sudog_count_++] = s;
+}
+
+void P::SudogPurge() {
+  Sudog* head = NULL;
+  Sudog* tail = NULL;
+  for (int32 i = 0; i < sudog_count_; i++) {
+    Sudog* t = sudog_cache_[i];
+    t->next = NULL;
+    if (tail == NULL) {
+      head = t;
+    } else {
+      tail->next = t;
+    }
+    tail = t;
+  }
+  if (head != NULL)
+    sched->SudogPutBatch(head, tail, sudog_count_);
+  sudog_count_ = 0;
+}
+
+ArenaChunk* P::ArenaChunkGet() {
+  ArenaChunk* chunk = arena_chunks_;
+  if (chunk != NULL) {
+    arena_chunks_ = chunk->next;
+    chunk->next = NULL;
+    arena_chunk_count_--;
+  }
+  return chunk;
+}
+
+void P::ArenaChunkPut(ArenaChunk* chunk) {
+  if (arena_chunk_count_ == kArenaChunkCacheMax) {
+    ArenaChunkFree(chunk);
+    return;
+  }
+  chunk->next = arena_chunks_;
+  arena_chunks_ = chunk;
+  arena_chunk_count_++;
+}
+
+void P::ArenaChunkPurge() {
+  while (arena_chunks_ != NULL) {
+    ArenaChunk* chunk = arena_chunks_;
+    arena_chunks_ = chunk->next;
+    ArenaChunkFree(chunk);
+  }
+  arena_chunk_count_ = 0;
+}
+
 }  // namespace runtime
 }  // namespace tin
@@ -6,23 +6,36 @@
 
 #include "base/basictypes.h"
 
+#include "tin/sync/atomic.h"
+#include "tin/runtime/runtime.h"
 #include "tin/runtime/util.h"
 #include "tin/runtime/guintptr.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/topology.h"
+#include "tin/runtime/stack/stack.h"
+#include "tin/runtime/mailbox.h"
 
 namespace tin {
 namespace runtime {
 class M;
+struct Sudog;
+struct ArenaChunk;
+struct EpochLimbo;
 
 // P status
 enum {
   kPidle = 0,
   kPrunning,  // Only this P is allowed to change from _Prunning.
   kPsyscall,
+  kPstopped,  // stopped while the world is, see Scheduler::SetMaxProcs.
   kPdead
 };
 
 typedef class P AliasP;
 
+// a sticky greenlet queued this long on its P may be stolen after all.
+const int64 kStickyStarveNs = 10 * 1000 * 1000;
+
 class P {
  public:
   explicit P(int id);
@@ -31,17 +44,61 @@ class P {
   }
 
   int32 RunqCapacity() const {
-    return kRunqCapacity;
+    return runq_capacity_;
   }
 
   bool RunqEmpty();
 
+  // free slots of local runq, only the owner may call it.
+  int32 RunqRoom();
+
   void RunqPut(G* gp, bool next);
 
   G* RunqGet(bool* inherit_time = NULL);
 
+  // moves run_next to the tail of the local runq, so it does not inherit
+  // the time slice. only the owner may call it.
+  void RunqDemoteNext();
+
   G* RunqSteal(P* p2, bool steal_nextg);
 
+  // the local queue of batch greenlets, any thread may take from it.
+  // RunqPut puts them here, RunqEmpty and RunqSize count them.
+  void BatchPut(G* gp);
+  G* BatchGet();
+
+  int32 BatchSize() const {
+    return atomic::relaxed_load32(&batch_size_);
+  }
+
+  // runnable greenlets homed on this P, see SpawnOptions::proc. any thread
+  // may put, RunqGet takes them in turns with the local runq and thieves
+  // never see them, StickySteal aside. not counted by RunqEmpty, an idle
+  // P with some has to be woken itself. returns true if it was empty.
+  bool StickyPut(G* gp);
+  G* StickyGet();
+  // the head if it waited kStickyStarveNs already or nobody owns this P,
+  // for a thief.
+  G* StickySteal(int64 now, bool idle);
+
+  int32 StickySize() const {
+    return atomic::relaxed_load32(&sticky_size_);
+  }
+
+  // queues closure in the mailbox of P from, only greenlets running on
+  // from may call it. false if that mailbox is full. *wake tells the first
+  // sender since the last MailDrain, which has to wake this P.
+  bool MailPut(int from, const base::Closure& closure, bool* wake);
+  // spawns what was sent as sticky greenlets, only the owner may call it.
+  int32 MailDrain();
+  // hands what was sent to this P over to the mailboxes of to, for a P
+  // ResizeProc removes. the world must be stopped.
+  int32 MailMove(P* to);
+
+  bool MailPending() const {
+    return atomic::relaxed_load32(&mail_pending_) != 0;
+  }
+
   void MoveRunqToGlobal();
 
   void SetLink(P* p) {
@@ -72,6 +129,14 @@ class P {
     return status_;
   }
 
+  uint32 SyscallTick() const {
+    return syscall_tick_;
+  }
+
+  void IncSyscallTick() {
+    syscall_tick_++;
+  }
+
   uint32 SchedTick() const {
     return sched_tick_;
   }
@@ -86,24 +151,206 @@ class P {
 
   bool CasStatus(uint32 old_status, uint32 new_status);
 
+  // set by sysmon when current greenlet ran out of its time slice,
+  // checked at safe points, see tin::MaybeYield.
+  void RequestPreempt() {
+    atomic::relaxed_store32(&preempt_, 1);
+  }
+
+  bool PreemptRequested() const {
+    return atomic::relaxed_load32(&preempt_) != 0;
+  }
+
+  void ClearPreempt() {
+    atomic::relaxed_store32(&preempt_, 0);
+  }
+
+  int Cpu() const {
+    return cpu_;
+  }
+
+  void SetCpu(int cpu) {
+    cpu_ = cpu;
+  }
+
+  // the epoch of the last quiescent point, see epoch.h.
+  uintptr_t* MutableEpoch() {
+    return &epoch_;
+  }
+
+  EpochLimbo* Limbo() {
+    return limbo_;
+  }
+
+  void SetLimbo(EpochLimbo* limbo) {
+    limbo_ = limbo;
+  }
+
+  // greenlets this P stole from Ps at distance, only the owner writes.
+  void CountSteal(int distance) {
+    steal_count_[distance]++;
+  }
+
+  uint64 StealCount(int distance) const {
+    return steal_count_[distance];
+  }
+
+  // greenlets created, exited and parked on this P, only the owner writes.
+  void CountSpawn() {
+    spawns_++;
+  }
+
+  void CountExit() {
+    exits_++;
+  }
+
+  void CountPark() {
+    parks_++;
+  }
+
+  // every greenlet created on this P since it started, exited ones
+  // included, linked by AllLink. push only, so other threads may walk it
+  // without a lock while the owner adds.
+  void AddGreenlet(G* gp);
+
+  G* AllGreenlets() {
+    return reinterpret_cast<G*>(
+        atomic::acquire_load(reinterpret_cast<uintptr_t*>(&all_head_)));
+  }
+
+  // parks that may be sampled for the contention profile.
+  uint32 ContentionTick() {
+    return ++contention_tick_;
+  }
+
+  uint64 Spawns() const {
+    return spawns_;
+  }
+
+  uint64 Exits() const {
+    return exits_;
+  }
+
+  uint64 Parks() const {
+    return parks_;
+  }
+
+  // runnable greenlets queued, may be read by any thread.
+  int32 RunqSize();
+
+  // runnable-to-running delays of greenlets switched to on this P, only
+  // the owner records. a no-op unless Config::EnableSchedLatency was set.
+  void RecordSchedLatency(int64 ns);
+  void AddSchedLatency(SchedLatencyStats* stats) const;
+
+  // Put an exited greenlet on the local free list of its stack size class.
+  void GFPut(G* gp);
+
+  // Get a free greenlet in size_class, refill from global list if needed.
+  G* GFGet(int size_class);
+
+  // Move all local free greenlets to the global free list.
+  void GFPurge();
+
+  // Sudog cache, half of it spills to or refills from the global list.
+  Sudog* SudogGet();
+  void SudogPut(Sudog* s);
+  void SudogPurge();
+
+  // kArenaChunkSize chunks of exited greenlets' arenas, NULL if empty.
+  ArenaChunk* ArenaChunkGet();
+  void ArenaChunkPut(ArenaChunk* chunk);
+  void ArenaChunkPurge();
+
  private:
-  bool RunqPutSlow(G* gp, uint32 h, uint32 t);
+  void RunqOverflowPut(G* gp);
+  bool RunqRefill();
+  G* RunqStealOverflow(P* p2);
   uint32 RunqGrab(GUintptr* batch, int batch_size, uint32 batch_head,
                   bool steal_nextg);
 
  private:
   enum {
-    kRunqCapacity = 256
+    kMinRunqCapacity = 16,
+    kMaxRunqCapacity = 64 * 1024,
+    // overflow holds at most this many times of runq capacity.
+    kRunqOverflowFactor = 8,
+    kGFreeLocalMax = 64,
+    kGFreeLocalKeep = 32,
+    kSudogCacheSize = 128,
+    // 512k per P.
+    kArenaChunkCacheMax = 32,
+    kCacheLineSize = 64
   };
+  // fields are grouped by who writes them, a pad line apart so stealers
+  // and wakers on other threads do not bounce the lines the owner runs on.
+  // P is allocated 64 aligned, see Scheduler::ResizeProc.
+  //
+  // read mostly.
+  uint32 runq_capacity_;
+  GUintptr* runq_;
+  int id_;
+  // kTinProcsLimit mailboxes by sending P, made on first use.
+  Mailbox** inbox_;
+  // written when the epoch moves, read by every P that retires.
+  uintptr_t epoch_;
+  char pad0_[kCacheLineSize];
+  // cas'ed by stealers.
   uint32 runq_head_;
+  char pad1_[kCacheLineSize - sizeof(uint32)];
+  // written by the owner, read by stealers, run_next_ is also cas'ed by
+  // stealers that take it.
   uint32 runq_tail_;
-  GUintptr runq_[kRunqCapacity];
   GUintptr run_next_;
-  P* link_;
-  int id_;
-  uint32 status_;
+  char pad2_[kCacheLineSize - sizeof(uint32) - sizeof(GUintptr)];
+  // owner only.
   uint32 sched_tick_;
+  // FIFO of G's that did not fit in runq_, linked by schedlink, guarded
+  // by runq_overflow_lock_. the owner puts, it and thieves take, see
+  // RunqStealOverflow. runq_overflow_size_ may be read without the lock.
+  RawMutex runq_overflow_lock_;
+  GUintptr runq_overflow_head_;
+  GUintptr runq_overflow_tail_;
+  int32 runq_overflow_size_;
+  GUintptr gfree_[kNumStackSizeClasses];
+  int32 gfree_count_[kNumStackSizeClasses];
+  int32 sudog_count_;
+  ArenaChunk* arena_chunks_;
+  int32 arena_chunk_count_;
+  int cpu_;
+  uint64 spawns_;
+  uint64 exits_;
+  uint64 parks_;
+  uint32 contention_tick_;
   tin::runtime::M* m_;
+  // what this P retired, NULL until it does.
+  EpochLimbo* limbo_;
+  Sudog* sudog_cache_[kSudogCacheSize];
+  char pad3_[kCacheLineSize];
+  // written by other threads, sysmon, wakers and senders.
+  uint32 status_;
+  uint32 syscall_tick_;
+  uint32 preempt_;
+  uint32 mail_pending_;
+  P* link_;
+  // batch greenlets linked by schedlink, guarded by batch_lock_. they are
+  // not worth a lock free queue.
+  RawMutex batch_lock_;
+  GUintptr batch_head_;
+  GUintptr batch_tail_;
+  int32 batch_size_;
+  char pad4_[kCacheLineSize];
+  // sticky greenlets linked by schedlink, guarded by sticky_lock_.
+  RawMutex sticky_lock_;
+  GUintptr sticky_head_;
+  GUintptr sticky_tail_;
+  int32 sticky_size_;
+  char pad5_[kCacheLineSize];
+  // cold.
+  uint64 steal_count_[kNumDistances];
+  G* all_head_;
+  // kSchedLatencyBuckets counts then sum and max, NULL if not enabled.
+  uint64* sched_latency_;
   DISALLOW_COPY_AND_ASSIGN(P);
 };
 
@@ -0,0 +1,212 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "build/build_config.h"
+
+#if defined(OS_POSIX)
+#include <execinfo.h>
+#elif defined(OS_WIN)
+#include <windows.h>
+#endif
+
+#include "tin/runtime/pprof.h"
+
+namespace tin {
+namespace runtime {
+
+void ProtoBuffer::Varint(uint64 v) {
+  while (v >= 0x80) {
+    data_.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  data_.push_back(static_cast<char>(v));
+}
+
+void ProtoBuffer::Int(int field, uint64 v) {
+  Varint(static_cast<uint64>(field) << 3);
+  Varint(v);
+}
+
+void ProtoBuffer::Bytes(int field, const std::string& s) {
+  Varint((static_cast<uint64>(field) << 3) | 2);
+  Varint(s.size());
+  data_.append(s);
+}
+
+void ProtoBuffer::Packed(int field, const std::vector<uint64>& values) {
+  ProtoBuffer packed;
+  for (size_t i = 0; i < values.size(); i++)
+    packed.Varint(values[i]);
+  Bytes(field, packed.data_);
+}
+
+void ProtoBuffer::Message(int field, const ProtoBuffer& message) {
+  Bytes(field, message.data_);
+}
+
+PprofBuilder::PprofBuilder() {
+  StringIndex("");
+  ReadMappings();
+  for (size_t i = 0; i < mappings_.size(); i++) {
+    ProtoBuffer m;
+    m.Int(1, i + 1);
+    m.Int(2, mappings_[i].start);
+    m.Int(3, mappings_[i].limit);
+    m.Int(4, mappings_[i].offset);
+    m.Int(5, StringIndex(mappings_[i].file));
+    head_.Message(3, m);
+  }
+}
+
+void PprofBuilder::AddSampleType(const char* type, const char* unit) {
+  head_.Message(1, ValueType(type, unit));
+}
+
+void PprofBuilder::SetPeriod(const char* type, const char* unit,
+                             int64 period) {
+  tail_.Message(11, ValueType(type, unit));
+  tail_.Int(12, period);
+}
+
+void PprofBuilder::SetTime(int64 time_ns, int64 duration_ns) {
+  tail_.Int(9, time_ns);
+  tail_.Int(10, duration_ns);
+}
+
+void PprofBuilder::AddSample(const std::vector<uintptr_t>& pcs,
+                             const std::vector<int64>& values,
+                             const std::vector<PprofLabel>& labels) {
+  std::vector<uint64> ids;
+  for (size_t i = 0; i < pcs.size(); i++) {
+    // callers point past the call instruction.
+    ids.push_back(LocationId(pcs[i] - (i > 0 ? 1 : 0)));
+  }
+  ProtoBuffer sample;
+  sample.Packed(1, ids);
+  std::vector<uint64> v(values.begin(), values.end());
+  sample.Packed(2, v);
+  for (size_t i = 0; i < labels.size(); i++) {
+    ProtoBuffer label;
+    label.Int(1, StringIndex(labels[i].key));
+    if (!labels[i].str.empty()) {
+      label.Int(2, StringIndex(labels[i].str));
+    } else {
+      label.Int(3, labels[i].num);
+    }
+    sample.Message(3, label);
+  }
+  samples_.Message(2, sample);
+}
+
+std::string PprofBuilder::Encode() {
+  std::string out = head_.data();
+  out.append(samples_.data());
+  out.append(location_msgs_.data());
+  out.append(tail_.data());
+  // last, every string is interned by now.
+  ProtoBuffer strings;
+  for (size_t i = 0; i < strings_.size(); i++)
+    strings.Bytes(6, strings_[i]);
+  out.append(strings.data());
+  return out;
+}
+
+uint64 PprofBuilder::StringIndex(const std::string& s) {
+  std::map<std::string, uint64>::iterator it = string_index_.find(s);
+  if (it != string_index_.end())
+    return it->second;
+  uint64 i = strings_.size();
+  strings_.push_back(s);
+  string_index_[s] = i;
+  return i;
+}
+
+ProtoBuffer PprofBuilder::ValueType(const char* type, const char* unit) {
+  ProtoBuffer vt;
+  vt.Int(1, StringIndex(type));
+  vt.Int(2, StringIndex(unit));
+  return vt;
+}
+
+uint64 PprofBuilder::LocationId(uintptr_t addr) {
+  std::map<uintptr_t, uint64>::iterator it = locations_.find(addr);
+  if (it != locations_.end())
+    return it->second;
+  uint64 id = locations_.size() + 1;
+  locations_[addr] = id;
+  ProtoBuffer l;
+  l.Int(1, id);
+  for (size_t j = 0; j < mappings_.size(); j++) {
+    if (addr >= mappings_[j].start && addr < mappings_[j].limit) {
+      l.Int(2, j + 1);
+      break;
+    }
+  }
+  l.Int(3, addr);
+  location_msgs_.Message(4, l);
+  return id;
+}
+
+void PprofBuilder::ReadMappings() {
+#if defined(OS_LINUX)
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (maps == NULL)
+    return;
+  char line[4096];
+  while (fgets(line, sizeof(line), maps) != NULL) {
+    unsigned long start = 0;
+    unsigned long limit = 0;
+    unsigned long long offset = 0;
+    char perms[8] = {0};
+    int path_at = 0;
+    if (sscanf(line, "%lx-%lx %7s %llx %*s %*s %n",
+               &start, &limit, perms, &offset, &path_at) < 4) {
+      continue;
+    }
+    if (strchr(perms, 'x') == NULL)
+      continue;
+    Mapping m;
+    m.start = start;
+    m.limit = limit;
+    m.offset = offset;
+    if (path_at > 0) {
+      m.file = line + path_at;
+      if (!m.file.empty() && m.file[m.file.size() - 1] == '\n')
+        m.file.erase(m.file.size() - 1);
+    }
+    mappings_.push_back(m);
+  }
+  fclose(maps);
+#endif
+}
+
+int CaptureStack(void** pcs, int max, int skip) {
+  const int kMaxFrames = 64;
+  void* frames[kMaxFrames];
+  int n = 0;
+#if defined(OS_POSIX)
+  n = backtrace(frames, kMaxFrames);
+#elif defined(OS_WIN)
+  n = CaptureStackBackTrace(0, kMaxFrames, frames, NULL);
+#endif
+  int depth = 0;
+  for (int i = skip + 1; i < n && depth < max; i++)
+    pcs[depth++] = frames[i];
+  return depth;
+}
+
+bool WriteProfileFile(const char* path, const std::string& data) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  ok = fclose(file) == 0 && ok;
+  return ok;
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,101 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/basictypes.h"
+
+namespace tin {
+namespace runtime {
+
+// just enough of the protobuf wire format for profile.proto.
+class ProtoBuffer {
+ public:
+  void Varint(uint64 v);
+  void Int(int field, uint64 v);
+  void Bytes(int field, const std::string& s);
+  void Packed(int field, const std::vector<uint64>& values);
+  void Message(int field, const ProtoBuffer& message);
+
+  const std::string& data() const {
+    return data_;
+  }
+
+ private:
+  std::string data_;
+};
+
+struct PprofLabel {
+  PprofLabel(const std::string& k, const std::string& s)
+    : key(k)
+    , str(s)
+    , num(0) {
+  }
+
+  PprofLabel(const std::string& k, int64 n)
+    : key(k)
+    , num(n) {
+  }
+
+  std::string key;
+  // str if not empty, num else.
+  std::string str;
+  int64 num;
+};
+
+// builds a profile.proto, what pprof reads. mappings of the executable
+// and shared objects are read on Linux so pprof can symbolize.
+class PprofBuilder {
+ public:
+  PprofBuilder();
+
+  // one value per type in every sample, in this order.
+  void AddSampleType(const char* type, const char* unit);
+  void SetPeriod(const char* type, const char* unit, int64 period);
+  void SetTime(int64 time_ns, int64 duration_ns);
+
+  // pcs are return addresses, leaf first.
+  void AddSample(const std::vector<uintptr_t>& pcs,
+                 const std::vector<int64>& values,
+                 const std::vector<PprofLabel>& labels);
+
+  std::string Encode();
+
+ private:
+  struct Mapping {
+    uintptr_t start;
+    uintptr_t limit;
+    uint64 offset;
+    std::string file;
+  };
+
+  uint64 StringIndex(const std::string& s);
+  ProtoBuffer ValueType(const char* type, const char* unit);
+  uint64 LocationId(uintptr_t addr);
+  void ReadMappings();
+
+  std::vector<std::string> strings_;
+  std::map<std::string, uint64> string_index_;
+  std::vector<Mapping> mappings_;
+  std::map<uintptr_t, uint64> locations_;
+  ProtoBuffer head_;
+  ProtoBuffer samples_;
+  ProtoBuffer location_msgs_;
+  ProtoBuffer tail_;
+  DISALLOW_COPY_AND_ASSIGN(PprofBuilder);
+};
+
+// return addresses of the caller's stack, leaf first, without the skip
+// innermost frames and this one.
+int CaptureStack(void** pcs, int max, int skip);
+
+// false if path can not be written.
+bool WriteProfileFile(const char* path, const std::string& data);
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,48 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+
+namespace tin {
+
+// samples the native stack of whatever runs on a thread hz times per
+// second of cpu time, driven by SIGPROF. every sample carries the name and
+// id of the current greenlet as pprof labels. posix only, false if a
+// profile is already running or the timer can not be set.
+bool StartCpuProfile(const char* path, int hz = 100);
+
+// stops sampling and writes the profile.proto (pprof) file given to
+// StartCpuProfile, `pprof -tagfocus greenlet=name` narrows it down.
+bool StopCpuProfile();
+
+// samples one in rate parks of a greenlet waiting on a Mutex, Cond, Sema,
+// WaitGroup or Chan with the stack and how long it waited. 0 stops, the
+// waits sampled so far are kept.
+void SetContentionProfileRate(int rate);
+
+// writes the sampled waits, scaled up by the rate, as a pprof
+// contentions/delay profile.
+bool WriteContentionProfile(const char* path);
+
+void ResetContentionProfile();
+
+// samples about one in rate bytes of malloc, operator new included, with
+// the stack and the name of the current greenlet, and keeps each sample
+// until it is freed. needs a build with TIN_ENABLE_HEAP_PROFILER, which
+// hooks malloc, false else. 0 stops sampling, what was sampled stays
+// tracked until freed.
+bool SetHeapProfileRate(int64 rate);
+
+// writes the live samples, scaled up to the objects and bytes they stand
+// for, as a pprof inuse_objects/inuse_space profile labeled with the
+// greenlet name, `pprof -tagfocus greenlet=name` again.
+bool WriteHeapProfile(const char* path);
+
+// on every sig writes path.<n>.heap from a thread of its own. posix
+// only, once.
+bool WriteHeapProfileOnSignal(int sig, const char* path);
+
+}  // namespace tin
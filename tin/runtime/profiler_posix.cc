@@ -0,0 +1,307 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/platform_thread.h"
+#include "build/build_config.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/pprof.h"
+#include "tin/runtime/util.h"
+
+#include "tin/runtime/profiler.h"
+
+namespace tin {
+namespace runtime {
+
+namespace {
+
+const int kMaxFrames = 48;
+// the handler and the signal trampoline.
+const int kSkipFrames = 2;
+const int kRingSize = 256;
+// threads that get a ring, samples of later ones are dropped.
+const int kMaxRings = 256;
+const int kDrainIntervalMs = 20;
+
+struct ProfSample {
+  uintptr_t g;
+  int depth;
+  char name[32];
+  void* pcs[kMaxFrames];
+};
+
+// written by the SIGPROF handler of the owning thread only, drained by
+// the collector.
+struct ProfRing {
+  uintptr_t owner;
+  uint32 head;
+  uint32 tail;
+  ProfSample samples[kRingSize];
+};
+
+struct ProfKey {
+  std::string name;
+  uintptr_t g;
+  std::vector<uintptr_t> pcs;
+
+  bool operator<(const ProfKey& other) const {
+    if (g != other.g)
+      return g < other.g;
+    if (name != other.name)
+      return name < other.name;
+    return pcs < other.pcs;
+  }
+};
+
+typedef std::map<ProfKey, int64> ProfCounts;
+
+int32 profiling = 0;
+int32 in_handler = 0;
+int32 dropped = 0;
+ProfRing* rings = NULL;
+
+void CopyName(char* dst, const char* src, size_t size) {
+  size_t i = 0;
+  for (; src != NULL && src[i] != '\0' && i + 1 < size; i++)
+    dst[i] = src[i];
+  dst[i] = '\0';
+}
+
+ProfRing* RingOfThread() {
+  uintptr_t self = reinterpret_cast<uintptr_t>(pthread_self());
+  for (int i = 0; i < kMaxRings; i++) {
+    uintptr_t owner = atomic::acquire_load(&rings[i].owner);
+    if (owner == self)
+      return &rings[i];
+    if (owner == 0 && atomic::cas(&rings[i].owner, 0, self))
+      return &rings[i];
+  }
+  return NULL;
+}
+
+void RecordSample() {
+  ProfRing* ring = RingOfThread();
+  if (ring == NULL) {
+    atomic::Inc32(&dropped, 1);
+    return;
+  }
+  uint32 t = ring->tail;
+  if (t - atomic::acquire_load32(&ring->head) >=
+      static_cast<uint32>(kRingSize)) {
+    atomic::Inc32(&dropped, 1);
+    return;
+  }
+  ProfSample* s = &ring->samples[t % kRingSize];
+  void* pcs[kMaxFrames + kSkipFrames];
+  int n = backtrace(pcs, arraysize(pcs)) - kSkipFrames;
+  s->depth = 0;
+  for (int i = 0; i < n; i++)
+    s->pcs[s->depth++] = pcs[i + kSkipFrames];
+  G* gp = GetG();
+  s->g = reinterpret_cast<uintptr_t>(gp);
+  CopyName(s->name, gp != NULL ? gp->GetName() : "(thread)",
+           sizeof(s->name));
+  atomic::release_store32(&ring->tail, t + 1);
+}
+
+void ProfHandler(int sig, siginfo_t* info, void* ucontext) {
+  int saved_errno = errno;
+  // before the check, so StopCpuProfile can wait for us.
+  atomic::Inc32(&in_handler, 1);
+  if (atomic::acquire_load32(&profiling) != 0)
+    RecordSample();
+  atomic::Inc32(&in_handler, -1);
+  errno = saved_errno;
+}
+
+void DrainRings(ProfCounts* counts) {
+  for (int i = 0; i < kMaxRings; i++) {
+    ProfRing* ring = &rings[i];
+    uint32 h = ring->head;
+    uint32 t = atomic::acquire_load32(&ring->tail);
+    for (; h != t; h++) {
+      const ProfSample& s = ring->samples[h % kRingSize];
+      ProfKey key;
+      key.name = s.name;
+      key.g = s.g;
+      for (int j = 0; j < s.depth; j++)
+        key.pcs.push_back(reinterpret_cast<uintptr_t>(s.pcs[j]));
+      (*counts)[key]++;
+    }
+    atomic::release_store32(&ring->head, h);
+  }
+}
+
+// folds the rings into counts while the profile runs, so a ring only has
+// to hold kDrainIntervalMs worth of samples.
+class ProfCollector : public base::PlatformThread::Delegate {
+ public:
+  ProfCollector()
+    : stopping_(0) {
+  }
+
+  virtual ~ProfCollector() {
+  }
+
+  bool Start() {
+    return base::PlatformThread::Create(0, this, &handle_);
+  }
+
+  // the counts are complete once no handler runs anymore.
+  void Stop() {
+    atomic::release_store32(&stopping_, 1);
+    base::PlatformThread::Join(handle_);
+    DrainRings(&counts_);
+  }
+
+  const ProfCounts& Counts() const {
+    return counts_;
+  }
+
+ private:
+  virtual void ThreadMain() {
+    base::PlatformThread::SetName("TinProfile");
+    while (atomic::acquire_load32(&stopping_) == 0) {
+      base::PlatformThread::Sleep(
+          base::TimeDelta::FromMilliseconds(kDrainIntervalMs));
+      DrainRings(&counts_);
+    }
+  }
+
+  base::PlatformThreadHandle handle_;
+  int32 stopping_;
+  ProfCounts counts_;
+  DISALLOW_COPY_AND_ASSIGN(ProfCollector);
+};
+
+std::string EncodeProfile(const ProfCounts& counts, int64 period_ns,
+                          int64 start_ns, int64 duration_ns) {
+  PprofBuilder builder;
+  builder.AddSampleType("samples", "count");
+  builder.AddSampleType("cpu", "nanoseconds");
+  for (ProfCounts::const_iterator it = counts.begin(); it != counts.end();
+       ++it) {
+    std::vector<int64> values;
+    values.push_back(it->second);
+    values.push_back(it->second * period_ns);
+    std::vector<PprofLabel> labels;
+    labels.push_back(PprofLabel("greenlet", it->first.name));
+    labels.push_back(
+        PprofLabel("greenlet_id", static_cast<int64>(it->first.g)));
+    builder.AddSample(it->first.pcs, values, labels);
+  }
+  builder.SetPeriod("cpu", "nanoseconds", period_ns);
+  builder.SetTime(start_ns, duration_ns);
+  return builder.Encode();
+}
+
+base::Lock control_lock;
+ProfCollector* collector = NULL;
+FILE* profile_file = NULL;
+int profile_hz = 0;
+int64 start_mono = 0;
+int64 start_wall = 0;
+
+}  // namespace
+}  // namespace runtime
+
+bool StartCpuProfile(const char* path, int hz) {
+  base::AutoLock guard(runtime::control_lock);
+  if (runtime::collector != NULL || hz <= 0 || hz > 1000000)
+    return false;
+  FILE* file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+
+  // the first call may load the unwinder, not in the signal handler.
+  void* pcs[1];
+  backtrace(pcs, 1);
+
+  runtime::rings = new runtime::ProfRing[runtime::kMaxRings];
+  memset(runtime::rings, 0, sizeof(runtime::ProfRing) * runtime::kMaxRings);
+  runtime::collector = new runtime::ProfCollector;
+  if (!runtime::collector->Start()) {
+    delete runtime::collector;
+    runtime::collector = NULL;
+    delete [] runtime::rings;
+    runtime::rings = NULL;
+    fclose(file);
+    return false;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = runtime::ProfHandler;
+  sa.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+
+  runtime::profile_file = file;
+  runtime::profile_hz = hz;
+  runtime::start_mono = MonoNow();
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  runtime::start_wall = tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+  runtime::dropped = 0;
+  atomic::release_store32(&runtime::profiling, 1);
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / hz;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    atomic::release_store32(&runtime::profiling, 0);
+    LOG(WARNING) << "StartCpuProfile: setitimer failed";
+  }
+  return true;
+}
+
+bool StopCpuProfile() {
+  base::AutoLock guard(runtime::control_lock);
+  if (runtime::collector == NULL)
+    return false;
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  // the handler stays installed, a late SIGPROF must not kill us.
+  atomic::exchange32(&runtime::profiling, 0);
+  while (atomic::acquire_load32(&runtime::in_handler) != 0)
+    runtime::YieldLogicProcessor();
+
+  runtime::collector->Stop();
+  int64 period_ns = 1000000000LL / runtime::profile_hz;
+  std::string data = runtime::EncodeProfile(
+      runtime::collector->Counts(), period_ns, runtime::start_wall,
+      MonoNow() - runtime::start_mono);
+  delete runtime::collector;
+  runtime::collector = NULL;
+  delete [] runtime::rings;
+  runtime::rings = NULL;
+
+  int32 dropped = atomic::acquire_load32(&runtime::dropped);
+  if (dropped != 0)
+    LOG(WARNING) << "cpu profile: " << dropped << " samples dropped";
+  bool ok = fwrite(data.data(), 1, data.size(), runtime::profile_file) ==
+            data.size();
+  ok = fclose(runtime::profile_file) == 0 && ok;
+  runtime::profile_file = NULL;
+  return ok;
+}
+
+}  // namespace tin
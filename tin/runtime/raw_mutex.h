@@ -5,6 +5,7 @@
 #pragma once
 #include <stdlib.h>
 #include "base/basictypes.h"
+#include "tin/runtime/spin.h"
 
 namespace tin {
 namespace runtime {
@@ -20,6 +21,7 @@ class RawMutex {
  private:
   uintptr_t key;
   M* owner_;
+  spin::Adaptive spin_;
   DISALLOW_COPY_AND_ASSIGN(RawMutex);
 };
 
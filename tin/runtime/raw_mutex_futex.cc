@@ -0,0 +1,236 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "base/logging.h"
+#include "base/threading/platform_thread.h"
+#include "build/build_config.h"
+
+#include "tin/sync/atomic.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/scheduler.h"
+#include "tin/runtime/spin.h"
+
+#include "tin/runtime/raw_mutex.h"
+
+// This implementation depends on OS-specific implementations of
+//
+//  FutexSleep(addr, val, ns)
+//    Atomically,
+//      if(*addr == val) sleep
+//    Might be woken up spuriously; that's allowed.
+//    Don't sleep longer than ns; ns < 0 means forever.
+//
+//  FutexWakeup(addr, cnt)
+//    If any procs are sleeping on addr, wake up at most cnt.
+//
+// key holds the futex word in its low 32 bits, the rest stays zero.
+
+#if !defined(ARCH_CPU_LITTLE_ENDIAN)
+#error "raw_mutex_futex.cc expects a little endian cpu"
+#endif
+
+namespace {
+const uint32 kMutexUnlocked = 0;
+const uint32 kMutexLocked = 1;
+const uint32 kMutexSleeping = 2;
+}
+
+namespace tin {
+namespace runtime {
+
+namespace {
+
+uint32* Key32(uintptr_t* key) {
+  return reinterpret_cast<uint32*>(key);
+}
+
+void FutexSleep(uint32* addr, uint32 val, int64 ns) {
+  struct timespec ts;
+  struct timespec* tsp = NULL;
+  if (ns >= 0) {
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    tsp = &ts;
+  }
+  // EAGAIN, EINTR and ETIMEDOUT are all fine, the caller checks again.
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, tsp, NULL, 0);
+}
+
+void FutexWakeup(uint32* addr, uint32 cnt) {
+  long ret = syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, cnt, NULL, NULL, 0);
+  if (ret < 0) {
+    LOG(FATAL) << "futexwakeup addr=" << addr << " returned " << errno;
+  }
+}
+
+}  // namespace
+
+RawMutex::RawMutex()
+  : key(0)
+  , owner_(NULL) {
+}
+
+RawMutex::~RawMutex() {
+}
+
+void RawMutex::Lock() {
+  uint32* key32 = Key32(&key);
+  // Speculative grab for lock.
+  uint32 v = atomic::exchange32(key32, kMutexLocked);
+  if (v == kMutexUnlocked) {
+    owner_ = GetM();
+    return;
+  }
+
+  // wait is either kMutexLocked or kMutexSleeping
+  // depending on whether there is a thread sleeping
+  // on this mutex. If we ever change key from
+  // kMutexSleeping to some other value, we must be
+  // careful to change it back to kMutexSleeping before
+  // returning, to ensure that the sleeping thread gets
+  // its wakeup call.
+  uint32 wait = v;
+
+  // On uniprocessors, no point spinning.
+  // On multiprocessors, spin as long as it paid lately.
+  int spin = 0;
+  if (rtm_env->NumberOfProcessors() > 1) {
+    spin = spin_.Limit();
+  }
+  while (true) {
+    // Try for lock, spinning.
+    for (int i = 0; i < spin; i++) {
+      while (atomic::load32(key32) == kMutexUnlocked) {
+        if (atomic::cas32(key32, kMutexUnlocked, wait)) {
+          owner_ = GetM();
+          spin_.Update(i, true);
+          return;
+        }
+      }
+      YieldLogicProcessor(spin::kActiveSpinCount);
+    }
+    if (spin > 0)
+      spin_.Update(spin, false);
+
+    // Try for lock, rescheduling, unless the lock is held too long for it.
+    int passive = spin_.Pays() ? spin::kPassiveSpin : 0;
+    for (int i = 0; i < passive; i++) {
+      while (atomic::load32(key32) == kMutexUnlocked) {
+        if (atomic::cas32(key32, kMutexUnlocked, wait)) {
+          owner_ = GetM();
+          return;
+        }
+      }
+      base::PlatformThread::YieldCurrentThread();
+    }
+
+    // Sleep.
+    v = atomic::exchange32(key32, kMutexSleeping);
+    if (v == kMutexUnlocked) {
+      owner_ = GetM();
+      return;
+    }
+    wait = kMutexSleeping;
+    FutexSleep(key32, kMutexSleeping, -1);
+  }
+}
+
+void RawMutex::Unlock() {
+  owner_ = NULL;
+  uint32 v = atomic::exchange32(Key32(&key), kMutexUnlocked);
+  if (v == kMutexUnlocked) {
+    LOG(FATAL) << "unlock of unlocked lock";
+  }
+  if (v == kMutexSleeping) {
+    FutexWakeup(Key32(&key), 1);
+  }
+}
+
+Note::Note()
+  : key(0) {
+}
+
+void Note::Wakeup() {
+  uint32 old = atomic::exchange32(Key32(&key), 1);
+  if (old != 0) {
+    LOG(FATAL) << "Wakeup - double wakeup";
+  }
+  FutexWakeup(Key32(&key), 1);
+}
+
+// g0 sleep.
+void Note::Sleep() {
+  G* gp = GetG();
+  if (!gp->IsG0()) {
+    LOG(FATAL) << "Sleep not on g0";
+  }
+  while (atomic::load32(Key32(&key)) == 0) {
+    FutexSleep(Key32(&key), 0, -1);
+  }
+}
+
+void Note::Clear() {
+  atomic::relaxed_store(&key, 0);
+}
+
+// g0 timed sleep.
+bool Note::TimedSleep(int64 ns) {
+  G* gp = GetG();
+  if (!gp->IsG0()) {
+    LOG(FATAL) << "TimedSleep on g0";
+  }
+  return SleepInternal(ns);
+}
+
+bool Note::TimedSleepG(int64 ns) {
+  G* gp = GetG();
+  if (gp->IsG0()) {
+    LOG(FATAL) << "TimedSleepG on g0";
+  }
+  EnterSyscallBlock();
+  bool woken = SleepInternal(ns);
+  ExitSyscall();
+  return woken;
+}
+
+bool Note::SleepInternal(int64 ns) {
+  uint32* key32 = Key32(&key);
+  if (ns < 0) {
+    while (atomic::load32(key32) == 0) {
+      FutexSleep(key32, 0, -1);
+    }
+    return true;
+  }
+
+  if (atomic::load32(key32) != 0) {
+    return true;
+  }
+
+  int64 deadline = MonoNow() + ns;
+  while (true) {
+    FutexSleep(key32, 0, ns);
+    if (atomic::load32(key32) != 0) {
+      break;
+    }
+    int64 now = MonoNow();
+    if (now >= deadline) {
+      break;
+    }
+    ns = deadline - now;
+  }
+  return atomic::load32(key32) != 0;
+}
+
+}  // namespace runtime
+}  // namespace tin
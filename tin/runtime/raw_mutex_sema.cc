@@ -50,7 +50,7 @@ void RawMutex::Lock() {
 
   int spin = 0;
   if (rtm_env->NumberOfProcessors() > 1) {
-    spin = spin::kActiveSpin;
+    spin = spin_.Limit();
   }
 
   while (true) {
@@ -60,13 +60,17 @@ void RawMutex::Lock() {
         // Unlocked. Try to lock.
         if (atomic::acquire_cas(&key, v, v | kLocked)) {
           owner_ = GetM();
+          if (i < spin)
+            spin_.Update(i, true);
           return;
         }
         i = 0;
       }
+      if (i == spin && spin > 0)
+        spin_.Update(spin, false);
       if (i < spin) {
         YieldLogicProcessor(spin::kActiveSpinCount);
-      } else if (i < spin + spin::kPassiveSpin) {
+      } else if (i < spin + (spin_.Pays() ? spin::kPassiveSpin : 0)) {
         base::PlatformThread::YieldCurrentThread();
       } else {
         // Someone else has it.
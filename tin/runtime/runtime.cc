@@ -2,35 +2,79 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
+
+#include <algorithm>
 #include <iostream>
 
 #include "base/debug/debugger.h"
+#include "build/build_config.h"
 #include "tin/error/error.h"
+#include "tin/config/config.h"
+#include "tin/sync/atomic.h"
 #include "tin/runtime/util.h"
+#include "tin/runtime/async_log.h"
+#include "tin/runtime/env.h"
 #include "tin/runtime/greenlet.h"
 #include "tin/runtime/m.h"
 #include "tin/runtime/p.h"
 #include "tin/runtime/scheduler.h"
+#include "tin/runtime/sysmon.h"
+#include "tin/runtime/threadpoll.h"
 #include "tin/runtime/timer/timer_queue.h"
 
 #include "tin/runtime/runtime.h"
 
 namespace tin {
 
+namespace {
+#if defined(ARCH_CPU_64_BITS)
+// word sized so readers need no lock, 0 until first published.
+volatile intptr_t coarse_now = 0;
+#endif
+}  // namespace
+
 namespace runtime {
 
+void UpdateCoarseNow(int64 now) {
+#if defined(ARCH_CPU_64_BITS)
+  // several Ms may publish at once, never go backwards.
+  while (true) {
+    intptr_t old = atomic::relaxed_load(&coarse_now);
+    if (now <= old || atomic::cas(&coarse_now, old, now))
+      break;
+  }
+#endif
+}
+
+int64 DeadlineNow() {
+  return rtm_conf->IsCoarseDeadlineEnabled() ? CoarseNow() : MonoNow();
+}
+
 void InternalLockOSThread() {
   G* curg = GetG();
-  curg->SetLockedM(curg->M());
-  curg->M()->SetLockedG(curg);
+  M* m = curg->M();
+  uint32* locked = m->MutableLocked();
+  if ((*locked)++ != 0) {
+    // nested, already wired.
+    return;
+  }
+  curg->SetLockedM(m);
+  m->SetLockedG(curg);
 }
 
 void InternalUnlockOSThread() {
   G* curg = GetG();
-  if (curg->M()->MutableLocked() != 0) {
+  M* m = curg->M();
+  uint32* locked = m->MutableLocked();
+  if (*locked == 0) {
+    // not locked, like Go it's a no-op.
+    return;
+  }
+  if (--(*locked) != 0) {
     return;
   }
-  curg->M()->SetLockedG(NULL);
+  m->SetLockedG(NULL);
   curg->SetLockedM(NULL);
 }
 
@@ -38,7 +82,6 @@ bool YieldUnlockFn(void* arg1, void* arg2) {
   G* g = static_cast<G*>(arg1);
 
   // global queue.
-  SchedulerLocker guard;
   sched->GlobalRunqPut(g);
 
   return true;
@@ -46,7 +89,7 @@ bool YieldUnlockFn(void* arg1, void* arg2) {
 
 void InternalYield() {
   G* me = GetG();
-  Park(YieldUnlockFn, me, NULL);
+  Park(YieldUnlockFn, me, NULL, runtime::kParkYield);
 }
 
 }  // namespace runtime
@@ -69,6 +112,10 @@ void UnlockOSThread() {
   runtime::InternalUnlockOSThread();
 }
 
+void SetFixedFpModes(bool fixed) {
+  runtime::GetG()->SetFixedFp(fixed);
+}
+
 void SetErrorCode(int error_code) {
   runtime::GetG()->SetErrorCode(error_code);
 }
@@ -85,16 +132,156 @@ const char* GetErrorStr() {
   return TinErrorName(GetErrorCode());
 }
 
+bool Canceled() {
+  return runtime::GetG()->Canceled();
+}
+
 void Sched() {
   tin::runtime::InternalYield();
 }
 
+void MaybeYield() {
+  runtime::G* gp = runtime::GetG();
+  if (gp == NULL || gp->M() == NULL) {
+    return;
+  }
+  runtime::P* p = gp->M()->P();
+  if (p != NULL && p->PreemptRequested()) {
+    p->ClearPreempt();
+    tin::runtime::InternalYield();
+  }
+}
+
+int SetMaxProcs(int n) {
+  return runtime::sched->SetMaxProcs(n);
+}
+
+int64 CoarseNow() {
+#if defined(ARCH_CPU_64_BITS)
+  int64 now = atomic::relaxed_load(&coarse_now);
+  if (now != 0)
+    return now;
+#endif
+  return MonoNow();
+}
+
 void NanoSleep(int64 ns) {
   return tin::runtime::InternalNanoSleep(ns);
 }
 
+void SleepWithSlack(int64 ns, int64 slack) {
+  return tin::runtime::InternalNanoSleep(ns, slack);
+}
+
 void Sleep(int64 ms) {
   return NanoSleep(ms * 1000 * 1000);
 }
 
+void GetSysMonStats(SysMonStats* stats) {
+  runtime::SysMonGetStats(stats);
+}
+
+void EnterSyscall() {
+  runtime::EnterSyscall();
+}
+
+void ExitSyscall() {
+  runtime::ExitSyscall();
+}
+
+void GetMSpinStats(MSpinStats* stats) {
+  runtime::sched->GetMSpinStats(stats);
+}
+
+void ReadRuntimeStats(RuntimeStats* stats) {
+  runtime::sched->GetRuntimeStats(stats);
+  stats->timers = runtime::timer_q != NULL ? runtime::timer_q->NumTimers() : 0;
+  stats->blocking_queued =
+    runtime::ThreadPoll::GetInstance()->Pending() +
+    runtime::ThreadPoll::GetResolverInstance()->Pending();
+  stats->log_dropped = runtime::AsyncLogDropped();
+  stats->startup_ns = runtime::rtm_env->StartupNs();
+}
+
+int32 GetLocalRunqSize(int proc_id) {
+  runtime::P* p = runtime::sched->Proc(proc_id);
+  if (p == NULL) {
+    return -1;
+  }
+  return p->RunqSize();
+}
+
+bool Overloaded() {
+  return runtime::SysMonOverloaded();
+}
+
+int ProcOfCpu(int cpu) {
+  int nprocs = runtime::rtm_conf->MaxProcs();
+  for (int i = 0; cpu >= 0 && i < nprocs; i++) {
+    runtime::P* p = runtime::sched->Proc(i);
+    if (p != NULL && p->Cpu() == cpu) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool GetSchedLatencyStats(SchedLatencyStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (!runtime::rtm_conf->IsSchedLatencyEnabled()) {
+    return false;
+  }
+  runtime::sched->AddSchedLatency(stats);
+  return true;
+}
+
+void GetTimerLagStats(SchedLatencyStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (runtime::timer_q != NULL)
+    runtime::timer_q->GetLagStats(stats);
+}
+
+void GetNetPollGapStats(SchedLatencyStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  runtime::sched->GetNetPollGapStats(stats);
+}
+
+int64 SchedLatencyBucketLower(int i) {
+  if (i < 4) {
+    return i;
+  }
+  int e = i / 4 + 1;
+  return static_cast<int64>(4 + i % 4) << (e - 2);
+}
+
+int64 SchedLatencyPercentile(const SchedLatencyStats& stats, double q) {
+  if (stats.count == 0) {
+    return 0;
+  }
+  uint64 rank = static_cast<uint64>(q * stats.count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64 seen = 0;
+  for (int i = 0; i < kSchedLatencyBuckets - 1; i++) {
+    seen += stats.buckets[i];
+    if (seen >= rank) {
+      return std::min(SchedLatencyBucketLower(i + 1) - 1,
+                      static_cast<int64>(stats.max_ns));
+    }
+  }
+  return static_cast<int64>(stats.max_ns);
+}
+
+bool GetStealStats(int proc_id, StealStats* stats) {
+  runtime::P* p = runtime::sched->Proc(proc_id);
+  if (p == NULL) {
+    return false;
+  }
+  stats->same_cache = p->StealCount(runtime::kSameCache);
+  stats->same_node = p->StealCount(runtime::kSameNode);
+  stats->remote_node = p->StealCount(runtime::kRemoteNode);
+  return true;
+}
+
 }  // namespace tin
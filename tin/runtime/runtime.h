@@ -11,10 +11,21 @@ void Throw(const char* str);
 
 void Panic(const char* str = 0);
 
+// wires the calling greenlet to its OS thread, it only runs there and no
+// other greenlet runs on that thread until UnlockOSThread. for thread
+// affine C libraries. calls nest, as many UnlockOSThread calls as
+// LockOSThread calls undo it, a greenlet exiting locked is unwired.
 void LockOSThread();
 
 void UnlockOSThread();
 
+// declares the current greenlet never changes the fp modes, rounding and
+// exception masks in mxcsr and the x87 control word, so switches between
+// two such greenlets skip restoring them. on x86-64 posix only, a no-op
+// elsewhere. a greenlet that changes them must call it with false first.
+// see TIN_ENABLE_FIXED_FP_MODES to declare it for every greenlet.
+void SetFixedFpModes(bool fixed);
+
 void SetErrorCode(int error_code);
 
 int GetErrorCode();
@@ -23,11 +34,28 @@ bool ErrorOccured();
 
 const char* GetErrorStr();
 
+// true once the current greenlet is canceled, e.g. by its TaskGroup. its
+// NanoSleep, io waits and SemAcquireFor end early with TIN_ECANCELED then.
+bool Canceled();
+
 // Yield conflicts with Windows macro Yield.
 void Sched();
 
+// a safe point, yield if sysmon found the current greenlet has been
+// monopolizing its P for longer than a time slice. cheap when it has not.
+void MaybeYield();
+
+// like GOMAXPROCS, stops the world to run n Ps from now on and returns the
+// old count, n <= 0 only queries it. greenlets of removed Ps move to the
+// global queue. a greenlet that neither parks nor yields holds the stop up.
+int SetMaxProcs(int n);
+
 void NanoSleep(int64 ns);
 
+// sleep ns nano seconds, the wakeup may be deferred by up to slack nano
+// seconds so that sleepers due at about the same time wake as one batch.
+void SleepWithSlack(int64 ns, int64 slack);
+
 // sleep for ms milliseconds.
 void Sleep(int64 ms);
 
@@ -37,7 +65,155 @@ int64 Now();
 // monotonic time, system up time, in nano seconds.
 int64 MonoNow();
 
+// MonoNow() as last seen by sysmon or the scheduler, cheap to read but may
+// lag by up to a sysmon tick. falls back to MonoNow() on 32 bits targets.
+int64 CoarseNow();
+
 // unix time, posix time, in seconds.
 int32 NowSeconds();
 
+// greenlets stolen by a P from other Ps, by distance.
+struct StealStats {
+  uint64 same_cache;
+  uint64 same_node;
+  uint64 remote_node;
+};
+
+// false if proc_id is not a running P.
+bool GetStealStats(int proc_id, StealStats* stats);
+
+struct SysMonStats {
+  // rounds sysmon has run.
+  uint64 ticks;
+  // current sleep between two rounds, grows while the process is idle.
+  int64 delay_us;
+  // Ps taken back from M's blocked in syscalls.
+  uint64 syscall_retakes;
+  // greenlets asked to yield at next safe point.
+  uint64 preempt_requests;
+};
+
+void GetSysMonStats(SysMonStats* stats);
+
+struct MSpinStats {
+  // time Ms spent spinning for work past their first round, nano seconds.
+  uint64 spin_ns;
+  // spins that found work before the budget ran out.
+  uint64 spin_hits;
+  // parked Ms woken up again.
+  uint64 wakeups;
+};
+
+void GetMSpinStats(MSpinStats* stats);
+
+// a snapshot of the scheduler. every field is read on its own without
+// locks, so the gauges need not add up exactly while the runtime is busy.
+struct RuntimeStats {
+  int32 procs;
+  int32 idle_procs;
+  // Ms spinning for work, parked idle, and created in all.
+  int32 spinning_ms;
+  int32 idle_ms;
+  int32 ms;
+  // runnable greenlets on the global runq and summed over the local ones,
+  // see GetLocalRunqSize for a single P.
+  int32 global_runq;
+  int32 local_runq;
+  // timers pending over all buckets.
+  int32 timers;
+  // blocking works queued and not yet taken by a thread pool worker.
+  int32 blocking_queued;
+  // spawned and not yet exited.
+  int64 live_greenlets;
+  // greenlet stacks allocated, exited ones kept for reuse included. see
+  // Config::SetStackBudget.
+  int64 stack_bytes;
+
+  // cumulative counters.
+  uint64 spawns;
+  // see GetStealStats for them by distance.
+  uint64 steals;
+  // greenlets parked to wait, exits not included.
+  uint64 parks;
+  // greenlets made runnable by netpoll.
+  uint64 netpoll_ready;
+  // Ps handed to another M because of a blocking syscall or a retake.
+  uint64 syscall_handoffs;
+  // spawns that had to wait for stack budget, and that failed for it.
+  uint64 stack_budget_waits;
+  uint64 stack_budget_fails;
+  // messages the async log dropped, see Config::SetAsyncLogBufferSize.
+  uint64 log_dropped;
+  // nano seconds from PowerOn until TinMain was called, see
+  // Config::SetPrewarmGreenlets.
+  int64 startup_ns;
+};
+
+void ReadRuntimeStats(RuntimeStats* stats);
+
+// runnable greenlets queued on P proc_id, -1 if it does not exist.
+int32 GetLocalRunqSize(int proc_id);
+
+// the P bound to cpu, see Config::SetCpuAffinity, -1 if none is.
+int ProcOfCpu(int cpu);
+
+// true while the runtime falls behind, see Config::SetOverloadDelayUs and
+// SetOverloadRunqDepth. new work should be refused then rather than slow
+// down all of it. updated by sysmon every few milli seconds.
+bool Overloaded();
+
+// log-linear buckets, four per power of two, the last one takes all
+// longer delays.
+const int kSchedLatencyBuckets = 160;
+
+// runnable-to-running delay of greenlets, nano seconds.
+struct SchedLatencyStats {
+  uint64 count;
+  uint64 sum_ns;
+  uint64 max_ns;
+  uint64 buckets[kSchedLatencyBuckets];
+};
+
+// merged over all Ps, false unless Config::EnableSchedLatency was set.
+bool GetSchedLatencyStats(SchedLatencyStats* stats);
+
+// smallest delay counted in bucket i.
+int64 SchedLatencyBucketLower(int i);
+
+// upper bound of the bucket holding the q quantile, 0 < q <= 1.
+int64 SchedLatencyPercentile(const SchedLatencyStats& stats, double q);
+
+// how late timers fired after their when, nano seconds, in the buckets of
+// SchedLatencyStats. a timer is late while its P and the timer_queue
+// greenlet are busy, coarse ones also by up to a slot of their wheel.
+void GetTimerLagStats(SchedLatencyStats* stats);
+
+// the time between two netpolls no poll was on, nano seconds. a
+// descriptor ready within such a gap waits until its end, e.g. up to the
+// 10ms of sysmon while every P is busy.
+void GetNetPollGapStats(SchedLatencyStats* stats);
+
+// stack use of the exited greenlets of one name, see
+// Config::EnableStackHighWater.
+struct StackUsageStats {
+  char name[32];
+  // largest stack one of them had, bytes.
+  int64 stack_size;
+  uint64 exits;
+  // deepest use seen and the sum over all exits, bytes.
+  int64 max_used;
+  uint64 sum_used;
+};
+
+// fills up to max entries ordered by name, returns how many names there
+// are. empty unless Config::EnableStackHighWater was set.
+int GetStackUsageStats(StackUsageStats* stats, int max);
+
+void ResetStackUsageStats();
+
+// wrap a system call that may block for a while, the P is kept for the
+// caller but sysmon hands it to another M if the call takes too long.
+void EnterSyscall();
+void ExitSyscall();
+
 }  // namespace tin
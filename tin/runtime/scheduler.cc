@@ -2,28 +2,65 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
+
 #include "base/logging.h"
 #include "base/memory/aligned_memory.h"
 #include "base/threading/platform_thread.h"
 
 #include "context/zcontext.h"
 #include "tin/sync/atomic.h"
+#include "tin/runtime/fast_switch.h"
 #include "tin/runtime/greenlet.h"
 #include "tin/runtime/p.h"
 #include "tin/runtime/m.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/buffer_pool.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/runtime/spin.h"
 #include "tin/runtime/net/netpoll.h"
+#include "tin/runtime/contention.h"
+#include "tin/runtime/epoch.h"
+#include "tin/runtime/spawn.h"
+#include "tin/runtime/timer/timer_queue.h"
 
 #include "tin/runtime/scheduler.h"
 
 namespace tin {
 namespace runtime {
-const int kTinProcsLimit = 256;
+// free greenlets beyond this limit(per size class) are really released.
+const int32 kGFreeGlobalMax = 1024;
+// free greenlets per size class TrimGFree leaves their stacks.
+const int32 kGFreeTrimKeep = 32;
+const int32 kSudogGlobalMax = 4096;
+// one in so many picks of a P prefers batch greenlets.
+const uint32 kBatchPickTicks = 16;
+
+// Scheduler::poller_state_.
+enum PollerState {
+  kPollerIdle = 0,
+  // an M blocks in netpoll without a P.
+  kPollerBlocked,
+  // WakeupP broke the poll and made that M its spinning one.
+  kPollerWoken,
+};
+
+void CounterAdd(uintptr_t* counter, uintptr_t n) {
+  uintptr_t old = atomic::relaxed_load(counter);
+  while (!atomic::cas(counter, old, old + n)) {
+    old = atomic::relaxed_load(counter);
+  }
+}
 
 bool ExitSyscallUnlockFunc(void* arg1, void* arg2);
 
 Scheduler::Scheduler()
-  : runq_size_(0)
+  : runq_shards_(NULL)
+  , runq_size_(0)
+  , runq_put_seq_(0)
+  , batch_size_(0)
+  , batch_used_(0)
+  , posted_(0)
   , idlep_(0)
   , nr_idlep_(0)
   , nr_spinning_(0)
@@ -32,7 +69,25 @@ Scheduler::Scheduler()
   , nr_idlem_locked_(0)
   , mcount_(0)
   , max_mcount_(10000)
-  , last_poll_(0) {
+  , last_poll_(0)
+  , poller_state_(kPollerIdle)
+  , poller_deadline_(0)
+  , polls_active_(0)
+  , poll_end_ns_(0)
+  , poll_gap_max_(0)
+  , spin_ns_(0)
+  , spin_hits_(0)
+  , wakeups_(0)
+  , netpoll_ready_(0)
+  , handoffs_(0)
+  , stack_bytes_(0)
+  , stack_budget_waits_(0)
+  , stack_budget_fails_(0)
+  , world_stopping_(0)
+  , stop_waiting_(0)
+  , stop_wait_(0)
+  , sudog_free_(NULL)
+  , sudog_count_(0) {
   last_poll_ = static_cast<uint32>(MonoNow() / tin::kMillisecond);
   if (last_poll_ == 0)
     last_poll_ = 1;
@@ -40,6 +95,20 @@ Scheduler::Scheduler()
   for (int i = 0; i < kTinProcsLimit; i++) {
     allp_[i] = NULL;
   }
+  for (int i = 0; i < kLatencyHistogramSize; i++) {
+    poll_gap_[i] = 0;
+  }
+  for (int i = 0; i < kNumStackSizeClasses; i++) {
+    gfree_count_[i] = 0;
+    gfree_low_[i] = 0;
+  }
+  // placement new, cache-line alignment.
+  void* ptr = base::AlignedAlloc(sizeof(RunqShard) * kGlobalRunqShards, 64);
+  runq_shards_ = static_cast<RunqShard*>(ptr);
+  for (int i = 0; i < kGlobalRunqShards; i++) {
+    new(&runq_shards_[i]) RunqShard;
+    runq_shards_[i].size = 0;
+  }
 }
 
 // call it after world is stopped.
@@ -56,6 +125,7 @@ P* Scheduler::ResizeProc(int nprocs) {
       // placement new, cache-line alignment.
       void* ptr = base::AlignedAlloc(sizeof(P), 64);
       pp = new(ptr) P(i);
+      pp->SetCpu(rtm_env->CpuForProc(i));
       atomic::store(reinterpret_cast<uintptr_t*>(&allp_[i]),
                     reinterpret_cast<uintptr_t>(pp));
     }
@@ -69,15 +139,31 @@ P* Scheduler::ResizeProc(int nprocs) {
         break;
       GlobalRunqPutHead(gp);
     }
-
+    while (1) {
+      G* gp = p->BatchGet();
+      if (gp == NULL)
+        break;
+      GlobalBatchPut(gp);
+    }
+    // what SendTo queued here goes on to the P that takes over its index.
+    p->MailMove(Allp()[i % nprocs]);
+    // TryAdvance and EpochReclaim only visit the Ps below nprocs.
+    EpochOffline(p);
+    EpochAbandon(p);
+    p->GFPurge();
+    p->SudogPurge();
+    p->ArenaChunkPurge();
+    BufferPurge(p->Id());
     p->SetStatus(kPdead);
   }
 
   if (GetP() != NULL && GetP()->Id() < nprocs) {
     GetP()->SetStatus(kPrunning);
   } else {
+    // our P is gone, go on with P 0.
     if (GetP() != NULL) {
       GetP()->SetM(NULL);
+      GetM()->SetP(NULL);
     }
     P* p = Allp()[0];
     p->SetM(NULL);
@@ -92,10 +178,9 @@ P* Scheduler::ResizeProc(int nprocs) {
       continue;
     }
     p->SetStatus(kPidle);
-    if (p->RunqEmpty()) {
+    if (p->RunqEmpty() && p->StickySize() == 0 && !p->MailPending()) {
       PIdlePut(p);
     } else {
-      p->SetM(MGet());
       p->SetLink(runnable_ps);
       runnable_ps = p;
     }
@@ -106,55 +191,155 @@ P* Scheduler::ResizeProc(int nprocs) {
 
 
 
+// Pick a shard for a producer, prefer the one owned by current P so that
+// Ps do not fight for the same shard lock.
+Scheduler::RunqShard* Scheduler::RunqShardForPut() {
+  G* gp = GetG();
+  if (gp != NULL && gp->M() != NULL && gp->M()->P() != NULL) {
+    return &runq_shards_[gp->M()->P()->Id() % kGlobalRunqShards];
+  }
+  // sysmon, thread pool workers etc.
+  uint32 seq = atomic::relaxed_Inc32(&runq_put_seq_, 1);
+  return &runq_shards_[seq % kGlobalRunqShards];
+}
+
 // Put gp on the global runnable queue.
-// Sched must be locked.
 void Scheduler::GlobalRunqPut(G* gp) {
-  gp->SetSchedLink(NULL);
-  if (!runq_tail_.IsNull()) {
-    runq_tail_.Pointer()->SetSchedLink(gp);
-  } else {
-    runq_head_ = gp;
-  }
-  runq_tail_ = gp;
-  runq_size_++;
+  GlobalRunqBatch(gp, gp, 1);
 }
 
 // Put gp at the head of the global runnable queue.
-// Sched must be locked.
-
 void Scheduler::GlobalRunqPutHead(G* gp) {
-  gp->SetSchedLink(runq_head_.Pointer());
-  runq_head_ = gp;
-  if (runq_tail_.IsNull()) {
-    runq_tail_ = gp;
+  if (gp->Priority() == kPriorityBatch) {
+    GlobalBatchPut(gp);
+    return;
+  }
+  RunqShard* shard = RunqShardForPut();
+  RawMutexGuard guard(&shard->lock);
+  gp->SetSchedLink(shard->head.Pointer());
+  shard->head = gp;
+  if (shard->tail.IsNull()) {
+    shard->tail = gp;
   }
-  runq_size_++;
+  shard->size++;
+  atomic::Inc32(&runq_size_, 1);
 }
 
 // Put a batch of runnable goroutines on the global runnable queue.
-// Sched must be locked.
-
 void Scheduler::GlobalRunqBatch(G* ghead, G* gtail, int32 n) {
+  if (atomic::relaxed_load32(&batch_used_) != 0) {
+    ghead = SplitBatch(ghead, &gtail, &n);
+    if (ghead == NULL) {
+      return;
+    }
+  }
   gtail->SetSchedLink(NULL);
-  if (!runq_tail_.IsNull()) {
-    runq_tail_.Pointer()->SetSchedLink(ghead);
+  RunqShard* shard = RunqShardForPut();
+  RawMutexGuard guard(&shard->lock);
+  if (!shard->tail.IsNull()) {
+    shard->tail.Pointer()->SetSchedLink(ghead);
   } else {
-    runq_head_ = ghead;
+    shard->head = ghead;
   }
-  runq_tail_ = gtail;
-  runq_size_ += n;
+  shard->tail = gtail;
+  shard->size += n;
+  // full barrier, pairs with the runq_size_ check before PIdlePut.
+  atomic::Inc32(&runq_size_, n);
 }
 
-// Try get a batch of G's from the global runnable queue.
-// Sched must be locked.
+G* Scheduler::SplitBatch(G* glist, G** gtail, int32* n) {
+  G* head = NULL;
+  G* tail = NULL;
+  int32 count = 0;
+  G* gp = glist;
+  for (int32 i = 0; i < *n; i++) {
+    G* next = GpCastBack(gp->SchedLink());
+    if (gp->Priority() == kPriorityBatch) {
+      GlobalBatchPut(gp);
+    } else {
+      if (tail == NULL) {
+        head = gp;
+      } else {
+        tail->SetSchedLink(gp);
+      }
+      tail = gp;
+      count++;
+    }
+    gp = next;
+  }
+  *gtail = tail;
+  *n = count;
+  return head;
+}
+
+void Scheduler::GlobalBatchPut(G* gp) {
+  gp->SetSchedLink(NULL);
+  RawMutexGuard guard(&batch_lock_);
+  if (batch_tail_.IsNull()) {
+    batch_head_ = gp;
+  } else {
+    batch_tail_.Pointer()->SetSchedLink(gp);
+  }
+  batch_tail_ = gp;
+  // full barrier, pairs with the batch_size_ check before PIdlePut.
+  atomic::Inc32(&batch_size_, 1);
+}
+
+G* Scheduler::GlobalBatchGet() {
+  if (atomic::relaxed_load32(&batch_size_) == 0) {
+    return NULL;
+  }
+  RawMutexGuard guard(&batch_lock_);
+  G* gp = batch_head_.Pointer();
+  if (gp == NULL) {
+    return NULL;
+  }
+  batch_head_ = gp->SchedLink();
+  if (batch_head_.IsNull()) {
+    batch_tail_ = static_cast<void*>(0);
+  }
+  atomic::Inc32(&batch_size_, -1);
+  return gp;
+}
+
+G* Scheduler::BatchGet(P* p) {
+  G* gp = p->BatchGet();
+  if (gp == NULL) {
+    gp = GlobalBatchGet();
+  }
+  return gp;
+}
+
+// Try get a batch of G's from the global runnable queue, start from the
+// shard owned by p then look around.
 G* Scheduler::GlobalRunqGet(P* p, int32 maximium) {
-  if (runq_size_ == 0) {
+  if (atomic::relaxed_load32(&runq_size_) == 0) {
+    return NULL;
+  }
+  int start = p->Id() % kGlobalRunqShards;
+  for (int i = 0; i < kGlobalRunqShards; i++) {
+    RunqShard* shard = &runq_shards_[(start + i) % kGlobalRunqShards];
+    if (atomic::relaxed_load32(&shard->size) == 0) {
+      continue;
+    }
+    RawMutexGuard guard(&shard->lock);
+    G* gp = RunqShardGet(shard, p, maximium);
+    if (gp != NULL) {
+      return gp;
+    }
+  }
+  return NULL;
+}
+
+// Shard must be locked.
+G* Scheduler::RunqShardGet(RunqShard* shard, P* p, int32 maximium) {
+  if (shard->size == 0) {
     return NULL;
   }
 
-  int32 n = runq_size_ / rtm_conf->MaxProcs() + 1;
-  if (n > runq_size_) {
-    n = runq_size_;
+  int32 n = atomic::relaxed_load32(&runq_size_) / rtm_conf->MaxProcs() + 1;
+  if (n > shard->size) {
+    n = shard->size;
   }
   if (maximium > 0 && n > maximium) {
     n = maximium;
@@ -163,18 +348,24 @@ G* Scheduler::GlobalRunqGet(P* p, int32 maximium) {
     n = p->RunqCapacity() / 2;
   }
 
-  runq_size_ -= n;
-  if (runq_size_ == 0) {
-    runq_tail_ = static_cast<void*>(0);
+  shard->size -= n;
+  if (shard->size == 0) {
+    shard->tail = static_cast<void*>(0);
   }
+  atomic::Inc32(&runq_size_, -n);
 
-  G* gp = runq_head_.Pointer();
-  runq_head_ = gp->SchedLink();
+  G* gp = shard->head.Pointer();
+  shard->head = gp->SchedLink();
   n--;
   for (; n > 0; n--) {
-    G* gp1 = runq_head_.Pointer();
-    runq_head_ = gp1->SchedLink();
-    p->RunqPut(gp1, false);
+    G* gp1 = shard->head.Pointer();
+    shard->head = gp1->SchedLink();
+    if (gp1->HomeProc() >= 0) {
+      // the shard lock and maybe lock_ are held.
+      StickyReady(gp1, false);
+    } else {
+      p->RunqPut(gp1, false);
+    }
   }
 
   return gp;
@@ -184,22 +375,197 @@ void Scheduler::InjectGList(G* glist) {
   if (glist == NULL) {
     return;
   }
-  int n = 0;
-  {
-    RawMutexGuard guard(&lock_);
-    for (n = 0; glist != NULL; n++) {
-      G* gp = glist;
-      glist = GpCastBack(gp->SchedLink());
-      gp->SetState(GLET_RUNNABLE);
-      GlobalRunqPut(gp);
-    }
+  // one shard lock for the whole list.
+  G* gtail = glist;
+  int n = 1;
+  gtail->SetState(GLET_RUNNABLE);
+  while (gtail->SchedLink() != 0) {
+    gtail = GpCastBack(gtail->SchedLink());
+    gtail->SetState(GLET_RUNNABLE);
+    n++;
   }
+  GlobalRunqBatch(glist, gtail, n);
 
   for ( ; n != 0; n--) {
     StartM(NULL, false);
   }
 }
 
+void Scheduler::PostPut(PostedWork* work) {
+  // no lock of ours, the poster may be no M at all.
+  while (true) {
+    uintptr_t head = atomic::relaxed_load(&posted_);
+    work->next = reinterpret_cast<PostedWork*>(head);
+    if (atomic::cas(&posted_, head, reinterpret_cast<uintptr_t>(work)))
+      break;
+  }
+  // the cas is a full barrier, either an idle P is woken or the M giving
+  // its P up sees posted_ when it looks again.
+  WakePIfNecessary();
+}
+
+int32 Scheduler::PostDrain() {
+  PostedWork* work =
+    reinterpret_cast<PostedWork*>(atomic::acquire_exchange(&posted_, 0));
+  // the stack is newest first.
+  PostedWork* fifo = NULL;
+  while (work != NULL) {
+    PostedWork* next = work->next;
+    work->next = fifo;
+    fifo = work;
+    work = next;
+  }
+  int32 n = 0;
+  while (fifo != NULL) {
+    PostedWork* next = fifo->next;
+    fifo->opts.name = fifo->name.empty() ? NULL : fifo->name.c_str();
+    RuntimeSpawn(&fifo->closure, fifo->opts);
+    delete fifo;
+    fifo = next;
+    n++;
+  }
+  return n;
+}
+
+void Scheduler::GFreePutBatch(int size_class, G* ghead, G* gtail, int32 n) {
+  {
+    RawMutexGuard guard(&gfree_lock_);
+    if (gfree_count_[size_class] < kGFreeGlobalMax) {
+      gtail->SetSchedLink(gfree_[size_class].Pointer());
+      gfree_[size_class] = ghead;
+      gfree_count_[size_class] += n;
+      return;
+    }
+  }
+  // global list is full, keep only the greenlets.
+  GShellPutBatch(ghead, gtail);
+}
+
+void Scheduler::GShellPutBatch(G* ghead, G* gtail) {
+  gtail->SetSchedLink(NULL);
+  // free the stacks outside the lock.
+  for (G* gp = ghead; gp != NULL; gp = GpCastBack(gp->SchedLink())) {
+    gp->DropStack();
+    gp->SetState(GLET_EXITED);
+  }
+  RawMutexGuard guard(&gfree_lock_);
+  gtail->SetSchedLink(gshells_.Pointer());
+  gshells_ = ghead;
+}
+
+G* Scheduler::GShellGet() {
+  if (gshells_.IsNull())
+    return NULL;
+  RawMutexGuard guard(&gfree_lock_);
+  G* gp = gshells_.Pointer();
+  if (gp != NULL) {
+    gshells_ = gp->SchedLink();
+    gp->SetSchedLink(NULL);
+  }
+  return gp;
+}
+
+G* Scheduler::GFreeGetBatch(int size_class, int32 maximium, int32* n) {
+  *n = 0;
+  if (atomic::relaxed_load32(&gfree_count_[size_class]) == 0) {
+    return NULL;
+  }
+  RawMutexGuard guard(&gfree_lock_);
+  G* glist = gfree_[size_class].Pointer();
+  if (glist == NULL) {
+    return NULL;
+  }
+  G* gtail = glist;
+  int32 count = 1;
+  while (count < maximium && gtail->SchedLink() != 0) {
+    gtail = GpCastBack(gtail->SchedLink());
+    count++;
+  }
+  gfree_[size_class] = gtail->SchedLink();
+  gfree_count_[size_class] -= count;
+  if (gfree_count_[size_class] < gfree_low_[size_class])
+    gfree_low_[size_class] = gfree_count_[size_class];
+  gtail->SetSchedLink(NULL);
+  *n = count;
+  return glist;
+}
+
+void Scheduler::TrimGFree() {
+  for (int i = 0; i < kNumStackSizeClasses; i++) {
+    G* ghead = NULL;
+    G* gtail = NULL;
+    {
+      RawMutexGuard guard(&gfree_lock_);
+      int32 n = (gfree_low_[i] - kGFreeTrimKeep + 1) / 2;
+      if (n > 0) {
+        ghead = gfree_[i].Pointer();
+        gtail = ghead;
+        for (int32 j = 1; j < n; j++)
+          gtail = GpCastBack(gtail->SchedLink());
+        gfree_[i] = gtail->SchedLink();
+        gfree_count_[i] -= n;
+      }
+      gfree_low_[i] = gfree_count_[i];
+    }
+    if (ghead != NULL)
+      GShellPutBatch(ghead, gtail);
+  }
+}
+
+void Scheduler::SudogPutBatch(Sudog* head, Sudog* tail, int32 n) {
+  {
+    RawMutexGuard guard(&sudog_lock_);
+    if (sudog_count_ < kSudogGlobalMax) {
+      tail->next = sudog_free_;
+      sudog_free_ = head;
+      sudog_count_ += n;
+      return;
+    }
+  }
+  while (head != NULL) {
+    Sudog* s = head;
+    head = s->next;
+    delete s;
+  }
+}
+
+Sudog* Scheduler::SudogGetBatch(int32 maximium, int32* n) {
+  *n = 0;
+  if (atomic::relaxed_load32(&sudog_count_) == 0) {
+    return NULL;
+  }
+  RawMutexGuard guard(&sudog_lock_);
+  Sudog* list = sudog_free_;
+  if (list == NULL) {
+    return NULL;
+  }
+  Sudog* tail = list;
+  int32 count = 1;
+  while (count < maximium && tail->next != NULL) {
+    tail = tail->next;
+    count++;
+  }
+  sudog_free_ = tail->next;
+  sudog_count_ -= count;
+  tail->next = NULL;
+  *n = count;
+  return list;
+}
+
+P* Scheduler::Proc(int proc_id) {
+  if (proc_id < 0 || proc_id >= rtm_conf->MaxProcs()) {
+    return NULL;
+  }
+  return reinterpret_cast<P*>(
+      atomic::acquire_load(reinterpret_cast<uintptr_t*>(&allp_[proc_id])));
+}
+
+G* Scheduler::AllGreenlets(int proc_id) {
+  P* p = reinterpret_cast<P*>(
+      atomic::acquire_load(reinterpret_cast<uintptr_t*>(&allp_[proc_id])));
+  return p != NULL ? p->AllGreenlets() : NULL;
+}
+
 // Put p to on _Pidle list.
 // Sched must be locked.
 void Scheduler::PIdlePut(P* p) {
@@ -209,6 +575,7 @@ void Scheduler::PIdlePut(P* p) {
   p->SetLink(idlep_);
   idlep_ = p;
   atomic::relaxed_Inc32(&nr_idlep_, 1);
+  EpochOffline(p);
 }
 
 P* Scheduler::PIdleGet() {
@@ -223,11 +590,234 @@ P* Scheduler::PIdleGet() {
   return p;
 }
 
+bool Scheduler::PIdleTake(P* p) {
+  P* prev = NULL;
+  P* cur = idlep_;
+  while (cur != NULL && cur != p) {
+    prev = cur;
+    cur = cur->Link();
+  }
+  if (cur == NULL) {
+    return false;
+  }
+  if (prev == NULL) {
+    idlep_ = p->Link();
+  } else {
+    prev->SetLink(p->Link());
+  }
+  atomic::relaxed_Inc32(&nr_idlep_, -1);
+  return true;
+}
+
+void Scheduler::StickyReady(G* gp, bool wake) {
+  P* home = Allp()[gp->HomeProc() % rtm_conf->MaxProcs()];
+  // the first one queued wakes the P, it looks at its queue again before
+  // it goes idle, under lock_.
+  if (!home->StickyPut(gp) || !wake || home == GetP()) {
+    return;
+  }
+  bool idle = false;
+  {
+    RawMutexGuard guard(&lock_);
+    idle = PIdleTake(home);
+  }
+  if (idle) {
+    StartM(home, false);
+  }
+}
+
+bool Scheduler::Misplaced(G* gp, P* p) {
+  if (!gp->IsSticky() || gp->HomeProc() % rtm_conf->MaxProcs() == p->Id()) {
+    return false;
+  }
+  StickyReady(gp);
+  return true;
+}
+
+void Scheduler::MailSend(int proc, const base::Closure& closure) {
+  P* curp = GetP();
+  P* target = Allp()[proc % rtm_conf->MaxProcs()];
+  bool wake = false;
+  if (!target->MailPut(curp->Id(), closure, &wake)) {
+    // the mailbox is full, pay for a greenlet queued there right away.
+    SpawnOptions opts;
+    opts.proc = target->Id();
+    opts.sticky = true;
+    base::Closure copy(closure);
+    RuntimeSpawn(&copy, opts);
+    return;
+  }
+  if (!wake || target == curp) {
+    return;
+  }
+  // it drains before going idle, under lock_.
+  bool idle = false;
+  {
+    RawMutexGuard guard(&lock_);
+    idle = PIdleTake(target);
+  }
+  if (idle) {
+    StartM(target, false);
+  }
+}
+
 G* Scheduler::FindRunnable(bool* inherit_time) {
+  int64 spin_start = 0;
+  G* gp = FindRunnableImpl(inherit_time, &spin_start);
+  if (spin_start != 0) {
+    CounterAdd(&spin_ns_, static_cast<uintptr_t>(MonoNow() - spin_start));
+    CounterAdd(&spin_hits_, 1);
+  }
+  return gp;
+}
+
+void Scheduler::GetMSpinStats(MSpinStats* stats) {
+  stats->spin_ns = atomic::relaxed_load(&spin_ns_);
+  stats->spin_hits = atomic::relaxed_load(&spin_hits_);
+  stats->wakeups = atomic::relaxed_load(&wakeups_);
+}
+
+void Scheduler::GetRuntimeStats(RuntimeStats* stats) {
+  stats->procs = rtm_conf->MaxProcs();
+  stats->idle_procs = static_cast<int32>(atomic::relaxed_load32(&nr_idlep_));
+  stats->spinning_ms =
+    static_cast<int32>(atomic::relaxed_load32(&nr_spinning_));
+  stats->idle_ms = atomic::relaxed_load32(&nr_idlem_);
+  stats->ms = atomic::relaxed_load32(&mcount_);
+  stats->global_runq = atomic::relaxed_load32(&runq_size_);
+  stats->local_runq = 0;
+  stats->spawns = 0;
+  stats->steals = 0;
+  uint64 parks = 0;
+  uint64 exits = 0;
+  // dead Ps keep their counters, so the sums never go back.
+  for (int i = 0; i < kTinProcsLimit; i++) {
+    P* p = reinterpret_cast<P*>(
+        atomic::acquire_load(reinterpret_cast<uintptr_t*>(&allp_[i])));
+    if (p == NULL) {
+      continue;
+    }
+    if (i < stats->procs) {
+      stats->local_runq += p->RunqSize();
+    }
+    stats->spawns += p->Spawns();
+    parks += p->Parks();
+    exits += p->Exits();
+    for (int d = 0; d < kNumDistances; d++) {
+      stats->steals += p->StealCount(d);
+    }
+  }
+  // an exiting greenlet parks one last time.
+  stats->parks = parks > exits ? parks - exits : 0;
+  stats->live_greenlets = static_cast<int64>(stats->spawns - exits);
+  stats->netpoll_ready = atomic::relaxed_load(&netpoll_ready_);
+  stats->syscall_handoffs = atomic::relaxed_load(&handoffs_);
+  stats->stack_bytes = static_cast<intptr_t>(
+      atomic::relaxed_load(&stack_bytes_));
+  stats->stack_budget_waits = atomic::relaxed_load(&stack_budget_waits_);
+  stats->stack_budget_fails = atomic::relaxed_load(&stack_budget_fails_);
+}
+
+bool Scheduler::StackCharge(int size, bool force) {
+  uintptr_t budget = static_cast<uintptr_t>(rtm_conf->StackBudget());
+  while (true) {
+    uintptr_t old = atomic::relaxed_load(&stack_bytes_);
+    if (!force && budget > 0 && old + size > budget) {
+      return false;
+    }
+    if (atomic::cas(&stack_bytes_, old, old + size)) {
+      return true;
+    }
+  }
+}
+
+void Scheduler::StackUncharge(int size) {
+  CounterAdd(&stack_bytes_, -static_cast<uintptr_t>(size));
+}
+
+void Scheduler::CountStackBudgetWait() {
+  CounterAdd(&stack_budget_waits_, 1);
+}
+
+void Scheduler::CountStackBudgetFail() {
+  CounterAdd(&stack_budget_fails_, 1);
+}
+
+void Scheduler::AddSchedLatency(SchedLatencyStats* stats) {
+  for (int i = 0; i < kTinProcsLimit; i++) {
+    P* p = reinterpret_cast<P*>(
+        atomic::acquire_load(reinterpret_cast<uintptr_t*>(&allp_[i])));
+    if (p != NULL) {
+      p->AddSchedLatency(stats);
+    }
+  }
+}
+
+void Scheduler::GetNetPollGapStats(SchedLatencyStats* stats) {
+  RawMutexGuard guard(&poll_gap_lock_);
+  AddLatency(poll_gap_, stats);
+}
+
+int64 Scheduler::TakeMaxNetPollGap() {
+  RawMutexGuard guard(&poll_gap_lock_);
+  int64 gap = poll_gap_max_;
+  poll_gap_max_ = 0;
+  // a gap still open counts too, no poll may come at all.
+  if (atomic::relaxed_load32(&polls_active_) == 0 && poll_end_ns_ != 0) {
+    gap = std::max(gap, MonoNow() - poll_end_ns_);
+  }
+  return gap;
+}
+
+G* Scheduler::PollNet(bool block) {
+  return PollNetWait(block ? -1 : 0);
+}
+
+G* Scheduler::PollNetWait(int64 timeout_ns) {
+  // a poll while another is on closes no gap, so only the first poll in
+  // takes the lock to record one.
+  if (atomic::Inc32(&polls_active_, 1) == 1) {
+    int64 now = MonoNow();
+    RawMutexGuard guard(&poll_gap_lock_);
+    if (poll_end_ns_ != 0) {
+      int64 gap = now - poll_end_ns_;
+      RecordLatency(poll_gap_, gap);
+      poll_gap_max_ = std::max(poll_gap_max_, gap);
+    }
+  }
+  G* gp = NetPollWait(timeout_ns);
+  {
+    // leaving and the end time go together, a poll coming in between
+    // would measure its gap from a stale end.
+    int64 now = MonoNow();
+    RawMutexGuard guard(&poll_gap_lock_);
+    if (atomic::Inc32(&polls_active_, -1) == 0) {
+      poll_end_ns_ = std::max(poll_end_ns_, now);
+    }
+  }
+  uintptr_t n = 0;
+  for (G* g = gp; g != NULL; g = GpCastBack(g->SchedLink())) {
+    TraceEvent(kTraceReady, g);
+    n++;
+  }
+  if (n != 0) {
+    CounterAdd(&netpoll_ready_, n);
+    TraceEvent(kTraceNetPoll, NULL, n);
+  }
+  return gp;
+}
+
+G* Scheduler::FindRunnableImpl(bool* inherit_time, int64* spin_start) {
   G* curg = GetG();
   M* curm = curg->M();
 
 top:
+  if (atomic::acquire_load32(&stop_waiting_) != 0 && StopForWorld()) {
+    if (rtm_env->ExitFlag()) {
+      return NULL;
+    }
+    goto top;
+  }
   P* curp = curm->P();
   G* gp = curp->RunqGet(inherit_time);
   if (gp != NULL) {
@@ -235,30 +825,68 @@ top:
   }
 
   if (atomic::relaxed_load32(&runq_size_) != 0) {
-    {
-      RawMutexGuard guard(&lock_);
-      gp = GlobalRunqGet(curp, 0);
-    }
+    gp = GlobalRunqGet(curp, 0);
     if (gp != NULL) {
       *inherit_time = false;
       return gp;
     }
   }
 
+  // closures posted from other threads land on our runq.
+  if (!PostEmpty() && PostDrain() > 0) {
+    goto top;
+  }
+  if (curp->MailPending() && curp->MailDrain() > 0) {
+    goto top;
+  }
+
   if (rtm_env->ExitFlag()) {
     return NULL;
   }
 
+  if (NetPollInited()) {
+    // descriptors opened on this P first, they stay on the local runq.
+    gp = NetPollShard(NetPollShardOf(curp->Id()));
+    if (gp != NULL) {
+      G* rest = GpCastBack(gp->SchedLink());
+      int32 n = 0;
+      for (G* g = rest; g != NULL; g = GpCastBack(g->SchedLink())) {
+        n++;
+      }
+      MakeReadyBatch(rest, n);
+      gp->SetState(GLET_RUNNABLE);
+      if (Misplaced(gp, curp)) {
+        goto top;
+      }
+      *inherit_time = false;
+      return gp;
+    }
+  }
+
   if (NetPollInited() && last_poll_ != 0) {
-    gp = NetPoll(false);
+    gp = PollNet(false);
     if (gp != 0) {
       InjectGList(GpCastBack(gp->SchedLink()));
       gp->SetState(GLET_RUNNABLE);
+      if (Misplaced(gp, curp)) {
+        goto top;
+      }
       *inherit_time = false;
       return gp;
     }
   }
 
+  // shared nothing, a P neither spins nor steals, it runs its own work or
+  // sleeps.
+  if (rtm_conf->IsSharedNothingEnabled()) {
+    gp = BatchGet(curp);
+    if (gp != NULL) {
+      *inherit_time = false;
+      return gp;
+    }
+    goto stop;
+  }
+
   // If number of spinning M's >= number of busy P's, block.
   // This is necessary to prevent excessive CPU consumption
   // when GOMAXPROCS>>1 but the program parallelism is low.
@@ -266,6 +894,12 @@ top:
   if (!curm->GetSpinning() && (2 * atomic::relaxed_load32(&nr_spinning_)) >=
       (static_cast<uint32>(rtm_conf->MaxProcs()) -
        atomic::relaxed_load32(&nr_idlep_))) {
+    // the spinning ones steal latency greenlets, we do batch work.
+    gp = BatchGet(curp);
+    if (gp != NULL) {
+      *inherit_time = false;
+      return gp;
+    }
     goto stop;
   }
 
@@ -274,15 +908,56 @@ top:
     atomic::Inc32(&nr_spinning_, 1);
   }
 
-  for (int i = 0;
-       i < static_cast<int>(4 * rtm_conf->MaxProcs());
-       i++) {
-    P* p = Allp()[rand() % rtm_conf->MaxProcs()];
-    if (p == curp) {
-      gp = p->RunqGet();
-    } else {
-      bool steal_run_next = i > 2 * static_cast<int>(rtm_conf->MaxProcs());
-      gp = curp->RunqSteal(p, steal_run_next);
+  {
+    // widen the victim set round by round, keep greenlets and their buffers
+    // inside the L3 cache, then the NUMA node, cross node only after backoff.
+    const int kStealRounds = 4;
+    int nprocs = rtm_conf->MaxProcs();
+    int remote_round = rtm_conf->StealBackoffRounds();
+    if (remote_round < 0)
+      remote_round = 0;
+    if (remote_round > kStealRounds - 1)
+      remote_round = kStealRounds - 1;
+    const CpuTopology& topology = rtm_env->Topology();
+    for (int round = 0; round < kStealRounds; round++) {
+      int max_distance = round == 0 ? kSameCache : kSameNode;
+      if (round >= remote_round)
+        max_distance = kRemoteNode;
+      bool steal_run_next = round >= kStealRounds / 2;
+      int start = rand() % nprocs;
+      for (int i = 0; i < nprocs; i++) {
+        P* p = Allp()[(start + i) % nprocs];
+        int distance = topology.Distance(curp->Cpu(), p->Cpu());
+        if (distance > max_distance) {
+          continue;
+        }
+        if (p == curp) {
+          gp = p->RunqGet();
+        } else {
+          gp = curp->RunqSteal(p, steal_run_next);
+          // sticky greenlets only once their P left them waiting.
+          if (gp == NULL && round == kStealRounds - 1) {
+            gp = p->StickySteal(CoarseNow(), p->GetStatus() == kPidle);
+          }
+          if (gp != NULL) {
+            curp->CountSteal(distance);
+            TraceEvent(kTraceSteal, gp, p->Id());
+          }
+        }
+        if (gp != NULL) {
+          *inherit_time = false;
+          return gp;
+        }
+      }
+    }
+
+    // no latency greenlet to be found, batch ones fill the idle cpu.
+    gp = BatchGet(curp);
+    for (int i = 0; gp == NULL && i < nprocs; i++) {
+      P* p = Allp()[i];
+      if (p != curp) {
+        gp = p->BatchGet();
+      }
     }
     if (gp != NULL) {
       *inherit_time = false;
@@ -290,13 +965,59 @@ top:
     }
   }
 
+  if (NetPollInited() && rtm_conf->NetPollBusyPollUs() > 0 &&
+      curm->GetSpinning()) {
+    // busy poll before parking, trades cpu for wakeup latency.
+    int64 deadline = MonoNow() + rtm_conf->NetPollBusyPollUs() * 1000LL;
+    do {
+      gp = PollNet(false);
+      if (gp != NULL) {
+        InjectGList(GpCastBack(gp->SchedLink()));
+        gp->SetState(GLET_RUNNABLE);
+        *inherit_time = false;
+        return gp;
+      }
+      if (!curp->RunqEmpty() || atomic::relaxed_load32(&runq_size_) != 0) {
+        goto top;
+      }
+      YieldLogicProcessor();
+    } while (MonoNow() < deadline);
+  }
+
+  if (curm->GetSpinning() && rtm_conf->MSpinUs() > 0) {
+    // keep spinning within the budget, the Go nmspinning protocol still
+    // caps spinning Ms at half of the busy Ps.
+    int64 now = MonoNow();
+    if (*spin_start == 0)
+      *spin_start = now;
+    if (now - *spin_start < rtm_conf->MSpinUs() * 1000LL) {
+      YieldLogicProcessor(spin::kActiveSpinCount);
+      goto top;
+    }
+    CounterAdd(&spin_ns_, static_cast<uintptr_t>(now - *spin_start));
+    *spin_start = 0;
+  }
+
 stop: {
     RawMutexGuard guard(&lock_);
+    if (stop_waiting_ != 0) {
+      goto top;
+    }
     if (atomic::relaxed_load32(&runq_size_) != 0) {
       gp = GlobalRunqGet(curp, 0);
+      if (gp != NULL) {
+        *inherit_time = false;
+        return gp;
+      }
+    }
+    gp = GlobalBatchGet();
+    if (gp != NULL) {
       *inherit_time = false;
       return gp;
     }
+    if (!PostEmpty() || curp->StickySize() != 0 || curp->MailPending()) {
+      goto top;
+    }
 
     P* p = ReleaseP();
     PIdlePut(p);
@@ -310,9 +1031,27 @@ stop: {
     }
   }
 
+  // a Post that found no idle P and no spinning M left the work to us.
+  bool posted = atomic::acquire_load(&posted_) != 0;
   for (int i = 0; i < rtm_conf->MaxProcs(); i++) {
     P* p = Allp()[i];
-    if (p != NULL && !p->RunqEmpty()) {
+    if (p != NULL && p->StickySize() != 0) {
+      // queued without a wake, only this very P may run it.
+      bool idle = false;
+      {
+        RawMutexGuard guard(&lock_);
+        idle = PIdleTake(p);
+      }
+      if (idle) {
+        AcquireP(p);
+        if (was_spinning) {
+          curm->SetSpinning(true);
+          atomic::Inc32(&nr_spinning_, 1);
+        }
+        goto top;
+      }
+    }
+    if (posted || (p != NULL && !p->RunqEmpty())) {
       {
         RawMutexGuard guard(&lock_);
         p = PIdleGet();
@@ -329,8 +1068,35 @@ stop: {
   }
 
   if (NetPollInited() && atomic::exchange32(&last_poll_, 0) != 0) {
-    gp = NetPoll(true);
-    uint32 now = static_cast<uint32>(MonoNow() / tin::kMillisecond);
+    bool woken = false;
+    bool timers_due = false;
+    while (true) {
+      // the exchanges order us against WakeNetPoller, either it sees us
+      // blocked or we see its timer. it breaks the poll while the deadline
+      // is unknown.
+      atomic::release_store(&poller_deadline_, -1);
+      atomic::exchange32(&poller_state_, kPollerBlocked);
+      // wait no longer than the timer_queue greenlet sleeps, it leaves
+      // waking it to us.
+      int64 until = timer_q->PollUntil();
+      int64 timeout = -1;
+      if (until != 0) {
+        timeout = std::max<int64>(until - MonoNow(), 0);
+      }
+      atomic::release_store(&poller_deadline_, static_cast<intptr_t>(until));
+      gp = PollNetWait(timeout);
+      // woken by WakeupP, which counted this M as its spinning one.
+      woken =
+          atomic::exchange32(&poller_state_, kPollerIdle) == kPollerWoken;
+      until = timer_q->PollUntil();
+      timers_due = until != 0 && MonoNow() >= until;
+      // else broken by WakeNetPoller for an earlier timer.
+      if (gp != NULL || woken || timers_due || rtm_env->ExitFlag())
+        break;
+    }
+    int64 mono_now = MonoNow();
+    UpdateCoarseNow(mono_now);
+    uint32 now = static_cast<uint32>(mono_now / tin::kMillisecond);
     if (now == 0)
       now = 1;
     atomic::relaxed_store32(&last_poll_, now);
@@ -342,6 +1108,10 @@ stop: {
       }
       if (p != NULL) {
         AcquireP(p);
+        if (woken)
+          curm->SetSpinning(true);
+        if (timers_due)
+          timer_q->WakeIfDue(mono_now);
         InjectGList(GpCastBack(gp->SchedLink()));
         gp->SetState(GLET_RUNNABLE);
         *inherit_time = false;
@@ -349,9 +1119,28 @@ stop: {
       }
       InjectGList(gp);
     }
+    if (woken || timers_due) {
+      P* p = NULL;
+      {
+        RawMutexGuard guard(&lock_);
+        p = PIdleGet();
+      }
+      if (p != NULL) {
+        AcquireP(p);
+        if (woken)
+          curm->SetSpinning(true);
+        if (timers_due)
+          timer_q->WakeIfDue(mono_now);
+        goto top;
+      }
+      // every P is busy, one of them runs the new work.
+      if (woken)
+        atomic::Inc32(&nr_spinning_, -1);
+    }
   }
 
   M::Stop();
+  CounterAdd(&wakeups_, 1);
   if (rtm_env->ExitFlag()) {
     return NULL;
   }
@@ -398,29 +1187,103 @@ void Scheduler::Reschedule() {
     return;
   }
 
-  G* nextg = m->G0();
+  // one jump instead of two when the next greenlet is known, it finishes
+  // our park in OnSwitch.
+  P* p = m->P();
+  EpochQuiescent(p);
+  bool inherit_time = false;
+  G* nextg = NextDirect(p, &inherit_time);
+  if (nextg != NULL) {
+    if (!inherit_time) {
+      p->IncSchedTick();
+      p->ClearPreempt();
+    }
+    m->SetDirectSwitch(true);
+  } else {
+    nextg = m->G0();
+  }
   SwitchG(curg, nextg, GpCast(nextg));
   // switch back.
   OnSwitch(GetG());
 }
 
+G* Scheduler::NextDirect(P* p, bool* inherit_time) {
+  // stopping, demoting run_next or looking at the global queue, g0 does
+  // it all.
+  if (atomic::relaxed_load32(&stop_waiting_) != 0 || p->PreemptRequested()) {
+    return NULL;
+  }
+  if (p->SchedTick() % 61 == 0 && (GlobalRunqSize() > 0 || !PostEmpty())) {
+    return NULL;
+  }
+  if (p->MailPending()) {
+    return NULL;
+  }
+  if (p->SchedTick() % kBatchPickTicks == 0 &&
+      (p->BatchSize() != 0 || atomic::relaxed_load32(&batch_size_) != 0)) {
+    return NULL;
+  }
+  G* gp = p->RunqGet(inherit_time);
+  if (gp != NULL && gp->LockedM() != NULL) {
+    // g0 hands the P to the locked M.
+    p->RunqPut(gp, true);
+    return NULL;
+  }
+  return gp;
+}
+
 bool Scheduler::OneRoundSched(G* curg) {
   while (true) {
+    if (atomic::acquire_load32(&stop_waiting_) != 0 && StopForWorld()) {
+      if (rtm_env->ExitFlag()) {
+        return false;
+      }
+      continue;
+    }
     M* m = curg->M();
     P* p = m->P();
     bool inherit_time = false;
     G* nextg = NULL;
 
+    // no greenlet of p runs, so none reads.
+    EpochQuiescent(p);
+    if (p->SchedTick() % 61 == 0) {
+      EpochReclaim(p);
+    }
+
+    // expired timers of p, sleepers they wake go to the local runq.
+    timer_q->CheckTimers(p);
+    // in case no M blocks in netpoll to wake the timer_queue greenlet.
+    timer_q->WakeIfDue();
+    // IO requests queued by the greenlet which just parked.
+    NetPollSubmit();
+    // posted closures, as often as the global queue below is looked at.
+    if (p->SchedTick() % 61 == 0 && !sched->PostEmpty()) {
+      sched->PostDrain();
+    }
+    // closures other Ps sent, every round, SendTo is the only way in.
+    if (p->MailPending()) {
+      p->MailDrain();
+    }
+
     // from global queue.
-    if (p->SchedTick() % 61 == 0 && sched->runq_size_ > 0) {
+    if (p->SchedTick() % 61 == 0 && sched->GlobalRunqSize() > 0) {
       // Check the global runnable queue once in a while to ensure fairness.
       // Otherwise two goroutines can completely occupy the local runqueue
       // by constantly respawning each other.
-      SchedulerLocker guard;
       nextg = sched->GlobalRunqGet(p, 1);
     }
+    // the share of batch greenlets.
+    if (nextg == NULL && p->SchedTick() % kBatchPickTicks == 0) {
+      nextg = BatchGet(p);
+    }
     // from local queue.
     if (nextg == NULL) {
+      // greenlets handing off to each other through run_next share one
+      // time slice, once it is used up the others get their turn.
+      if (p->PreemptRequested()) {
+        p->RunqDemoteNext();
+      }
       nextg = p->RunqGet(&inherit_time);
       if (nextg != NULL && curg->M()->GetSpinning()) {
         LOG(FATAL) << "schedule: spinning with local work";
@@ -448,6 +1311,8 @@ bool Scheduler::OneRoundSched(G* curg) {
 
     if (!inherit_time) {
       p->IncSchedTick();
+      // a new time slice.
+      p->ClearPreempt();
     }
 
     SwitchG(curg, nextg, GpCast(nextg));
@@ -479,28 +1344,203 @@ void Scheduler::G0Loop() {
 }
 
 void Scheduler::OnSwitch(G* curg) {
-  curg->M()->GetUnlockInfo()->Run();
-  curg->M()->ClearDeadQueue();
+  M* m = curg->M();
+  m->GetUnlockInfo()->Run();
+  m->ClearDeadQueue();
+  if (m->DirectSwitch()) {
+    m->SetDirectSwitch(false);
+    // the part of OneRoundSched that must wait for the unlock, timer
+    // callbacks may take the lock the previous greenlet parked with.
+    timer_q->CheckTimers(m->P());
+    timer_q->WakeIfDue();
+    NetPollSubmit();
+  }
 }
 
 int Scheduler::Init() {
-  ResizeProc(8);
+  ResizeProc(rtm_conf->MaxProcs());
   return 0;
 }
 
+int Scheduler::SetMaxProcs(int nprocs) {
+  int old = rtm_conf->MaxProcs();
+  if (nprocs <= 0 || nprocs == old) {
+    return old;
+  }
+  if (nprocs > kTinProcsLimit) {
+    nprocs = kTinProcsLimit;
+  }
+  StopTheWorld();
+  StartTheWorld(nprocs);
+  return old;
+}
+
+void Scheduler::StopTheWorld() {
+  // a stopper which lost lets the winner stop its P.
+  while (!atomic::cas32(&world_stopping_, 0, 1)) {
+    Sched();
+  }
+  P* curp = GetP();
+  int32 wait = 0;
+  {
+    RawMutexGuard guard(&lock_);
+    atomic::release_store32(&stop_waiting_, 1);
+    stop_wait_ = rtm_conf->MaxProcs() - 1;
+    StopIdlePs(curp);
+    wait = stop_wait_;
+  }
+  // running Ps stop once their greenlets park or yield, sysmon's retake
+  // hands us the ones entering syscalls late.
+  while (wait > 0) {
+    for (int i = 0; i < rtm_conf->MaxProcs(); i++) {
+      P* p = Allp()[i];
+      if (p != curp && p->GetStatus() == kPrunning) {
+        p->RequestPreempt();
+      }
+    }
+    base::PlatformThread::Sleep(base::TimeDelta::FromMicroseconds(100));
+    RawMutexGuard guard(&lock_);
+    StopIdlePs(curp);
+    wait = stop_wait_;
+  }
+}
+
+void Scheduler::StartTheWorld(int nprocs) {
+  P* runnable_ps = NULL;
+  {
+    RawMutexGuard guard(&lock_);
+    runnable_ps = ResizeProc(nprocs);
+    atomic::release_store32(&stop_waiting_, 0);
+  }
+  while (runnable_ps != NULL) {
+    P* p = runnable_ps;
+    runnable_ps = p->Link();
+    StartM(p, false);
+  }
+  // the runqs of dead Ps went to the global queue.
+  WakePIfNecessary();
+  atomic::release_store32(&world_stopping_, 0);
+}
+
+void Scheduler::StopIdlePs(P* curp) {
+  for (int i = 0; i < rtm_conf->MaxProcs(); i++) {
+    P* p = Allp()[i];
+    if (p != curp && p->GetStatus() == kPsyscall &&
+        p->CasStatus(kPsyscall, kPstopped)) {
+      p->IncSyscallTick();
+      stop_wait_--;
+    }
+  }
+  while (true) {
+    P* p = PIdleGet();
+    if (p == NULL)
+      break;
+    p->SetStatus(kPstopped);
+    stop_wait_--;
+  }
+}
+
+bool Scheduler::StopForWorld() {
+  M* curm = GetM();
+  {
+    RawMutexGuard guard(&lock_);
+    if (stop_waiting_ == 0) {
+      return false;
+    }
+    if (curm->GetSpinning()) {
+      curm->SetSpinning(false);
+      atomic::Inc32(&nr_spinning_, -1);
+    }
+    P* p = ReleaseP();
+    p->SetStatus(kPstopped);
+    stop_wait_--;
+  }
+  M::Stop();
+  return true;
+}
+
 void Scheduler::MakeReady(G* gp) {
   if (gp->GetState() != GLET_WAITING) {
     LOG(FATAL) << "bad g->status in ready";
   }
   gp->SetState(GLET_RUNNABLE);
+  TraceEvent(kTraceReady, gp);
 
   GetP()->RunqPut(gp, true);
 
-  if (atomic::load32(&nr_idlep_) != 0 && atomic::load32(&nr_spinning_) == 0) {
+  // a greenlet with a home wakes its P itself, see StickyReady.
+  if (gp->HomeProc() < 0 && atomic::load32(&nr_idlep_) != 0 &&
+      atomic::load32(&nr_spinning_) == 0) {
     WakeupP();
   }
 }
 
+void Scheduler::MakeReadyBatch(G* glist, int32 n) {
+  if (n <= 0 || glist == NULL) {
+    return;
+  }
+  if (n == 1) {
+    MakeReady(glist);
+    return;
+  }
+
+  P* p = GetP();
+  // the first one is handed off like Ready does, it runs next.
+  G* first = glist;
+  glist = GpCastBack(first->SchedLink());
+  if (first->GetState() != GLET_WAITING) {
+    LOG(FATAL) << "bad g->status in ready";
+  }
+  first->SetState(GLET_RUNNABLE);
+  TraceEvent(kTraceReady, first);
+  p->RunqPut(first, true);
+
+  int32 room = p->RunqRoom();
+  int32 nlocal = 0;
+  while (glist != NULL && nlocal < room) {
+    G* gp = glist;
+    glist = GpCastBack(gp->SchedLink());
+    if (gp->GetState() != GLET_WAITING) {
+      LOG(FATAL) << "bad g->status in ready";
+    }
+    gp->SetState(GLET_RUNNABLE);
+    TraceEvent(kTraceReady, gp);
+    p->RunqPut(gp, false);
+    nlocal++;
+  }
+
+  // the rest goes to global queue in one batch.
+  if (glist != NULL) {
+    G* gtail = glist;
+    int32 nglobal = 1;
+    while (true) {
+      if (gtail->GetState() != GLET_WAITING) {
+        LOG(FATAL) << "bad g->status in ready";
+      }
+      gtail->SetState(GLET_RUNNABLE);
+      TraceEvent(kTraceReady, gtail);
+      if (gtail->SchedLink() == 0)
+        break;
+      gtail = GpCastBack(gtail->SchedLink());
+      nglobal++;
+    }
+    GlobalRunqBatch(glist, gtail, nglobal);
+  }
+
+  if (rtm_conf->IsSharedNothingEnabled()) {
+    return;
+  }
+  // current P runs one of them, spinning M's will find some others.
+  int32 need = static_cast<int32>(atomic::load32(&nr_idlep_));
+  if (need > n - 1) {
+    need = n - 1;
+  }
+  need -= static_cast<int32>(atomic::load32(&nr_spinning_));
+  for (; need > 0; need--) {
+    StartM(NULL, false);
+  }
+}
+
 void Scheduler::WakePIfNecessary() {
   if (atomic::load32(&nr_idlep_) != 0 && atomic::load32(&nr_spinning_) == 0) {
     WakeupP();
@@ -511,12 +1551,28 @@ void Scheduler::WakeupP() {
   if (!atomic::cas32(&nr_spinning_, 0, 1)) {
     return;
   }
+  // an M blocked in netpoll without a P spins instead of a new one.
+  if (atomic::cas32(&poller_state_, kPollerBlocked, kPollerWoken)) {
+    NetPollBreak();
+    return;
+  }
   StartM(NULL, true);
 }
 
+void Scheduler::WakeNetPoller(int64 when) {
+  if (atomic::acquire_load32(&poller_state_) != kPollerBlocked)
+    return;
+  int64 deadline = atomic::acquire_load(&poller_deadline_);
+  if (deadline <= 0 || deadline > when)
+    NetPollBreak();
+}
+
 void Scheduler::HandoffP(P* p) {
+  CounterAdd(&handoffs_, 1);
+  TraceEvent(kTraceHandoff, GetG(), p->Id());
   // if it has local work, start it straight away
-  if (!p->RunqEmpty() || sched->GlobalRunqSize() != 0) {
+  if (!p->RunqEmpty() || p->StickySize() != 0 ||
+      sched->GlobalRunqSize() != 0) {
     StartM(p, false);
     return;
   }
@@ -530,7 +1586,13 @@ void Scheduler::HandoffP(P* p) {
   }
 
   lock_.Lock();
-  if (runq_size_ != 0) {
+  if (stop_waiting_ != 0) {
+    p->SetStatus(kPstopped);
+    stop_wait_--;
+    lock_.Unlock();
+    return;
+  }
+  if (atomic::relaxed_load32(&runq_size_) != 0 || p->StickySize() != 0) {
     lock_.Unlock();
     StartM(p, false);
     return;
@@ -568,6 +1630,8 @@ void Scheduler::ExitSyscall0(G* gp) {
   } else {
     curm->SetUnlockInfo(ExitSyscallUnlockFunc, gp, NULL, NULL);
     SwitchG(gp, g0, GpCast(g0));
+    // maybe resumed by a parking greenlet, see Reschedule.
+    OnSwitch(GetG());
   }
 }
 
@@ -576,7 +1640,7 @@ bool Scheduler::ExitSyscallFast() {
   M* curm = gp->M();
   P* curp = curm->P();
   // Try to re-acquire the last P.
-  if (curp != 0 && curp->GetStatus() != kPsyscall &&
+  if (curp != 0 && curp->GetStatus() == kPsyscall &&
       curp->CasStatus(kPsyscall, kPrunning)) {
     // There's a cpu for us, so we can run.
     curp->SetM(curm);
@@ -635,6 +1699,7 @@ void Scheduler::DoUnlock(UnLockInfo* info) {
 
 // -------------------------------------------------------------
 
+#if !defined(TIN_NATIVE_TLS)
 P* GetP() {
   return GetG()->M()->P();
 }
@@ -642,6 +1707,7 @@ P* GetP() {
 M* GetM() {
   return GetG()->M();
 }
+#endif
 
 P* ReleaseP() {
   G* curg = GetG();
@@ -664,6 +1730,9 @@ void AcquireP(P* p) {
   curg->M()->SetP(p);
   p->SetStatus(kPrunning);
   p->SetM(curg->M());
+  if (rtm_conf->CpuAffinity() != 0) {
+    curg->M()->BindToCpu(p->Cpu());
+  }
 }
 
 void StartM(P* p, bool spinning) {
@@ -679,25 +1748,48 @@ void DropG() {
   }
 }
 
-void ParkUnlock(RawMutex* lock) {
-  Park(ParkUnlockF, lock, NULL);
+void ParkUnlock(RawMutex* lock, int reason) {
+  Park(ParkUnlockF, lock, NULL, reason);
 }
 
-void Park(UnlockFunc unlockf, void* arg1, void* arg2) {
+void Park(UnlockFunc unlockf, void* arg1, void* arg2, int reason) {
   G* gp = GetG();
   M* mp = gp->M();
   if (gp->GetState() != GLET_RUNNING) {
     LOG(FATAL) << "gopark: bad g status";
   }
   mp->GetUnlockInfo()->Set(unlockf, arg1, arg2, gp);
+  mp->P()->CountPark();
+  TraceEvent(kTracePark, gp, reason);
+  ContentionSample* contention = NULL;
+  if (reason == kParkSema || reason == kParkChan) {
+    contention = StartContention(mp->P());
+  }
+  gp->SetWaitReason(reason);
   gp->SetState(GLET_WAITING);
   sched->Reschedule();
+  if (contention != NULL) {
+    FinishContention(contention);
+  }
 }
 
 void Ready(G* gp) {
   sched->MakeReady(gp);
 }
 
+void ReadyBatch(G* glist, int32 n) {
+  sched->MakeReadyBatch(glist, n);
+}
+
+bool YieldToNextUnlockF(void* arg1, void* arg2) {
+  // DoUnlock puts us at the tail of the local runq.
+  return false;
+}
+
+void YieldToNext() {
+  Park(YieldToNextUnlockF, NULL, NULL, kParkYield);
+}
+
 bool ParkUnlockF(void* arg1, void* arg2) {
   RawMutex* mutex = static_cast<RawMutex*>(arg1);
   mutex->Unlock();
@@ -707,17 +1799,28 @@ bool ParkUnlockF(void* arg1, void* arg2) {
 bool ExitSyscallUnlockFunc(void* arg1, void* arg2) {
   M* curm = GetG()->M();
   G* gp = static_cast<G*>(arg1);
-  {
-    SchedulerLocker guard;
-    sched->GlobalRunqPut(gp);
-  }
+  sched->GlobalRunqPut(gp);
   curm->Stop();
   return true;
 }
 
+void EnterSyscall() {
+  G* gp = GetG();
+  P* p = gp->M()->P();
+  gp->SetState(GLET_SYSCALL);
+  TraceEvent(kTracePark, gp, kParkSyscall);
+  p->IncSyscallTick();
+  // m->p is kept as the P to re-acquire in ExitSyscallFast.
+  p->SetM(NULL);
+  if (!p->CasStatus(kPrunning, kPsyscall)) {
+    LOG(FATAL) << "EnterSyscall: bad p status";
+  }
+}
+
 void EnterSyscallBlock() {
   G* gp = GetG();
   gp->SetState(GLET_SYSCALL);
+  TraceEvent(kTracePark, gp, kParkSyscall);
   sched->HandoffP(ReleaseP());
 }
 
@@ -725,6 +1828,7 @@ void ExitSyscall() {
   G* gp = GetG();
   if (sched->ExitSyscallFast()) {
     gp->SetState(GLET_RUNNING);
+    TraceEvent(kTraceRun, gp);
     return;
   }
   sched->ExitSyscall0(gp);
@@ -735,10 +1839,25 @@ void WakePIfNecessary() {
 }
 
 void SwitchG(Greenlet* from, Greenlet* to, intptr_t args) {
+  int64 since = to->TakeRunnableSince();
+  if (since != 0 && from->M()->P() != NULL) {
+    from->M()->P()->RecordSchedLatency(MonoNow() - since);
+  }
+  if (!to->IsG0()) {
+    TraceEvent(kTraceRun, to);
+  }
   from->M()->SetCurG(to);
   to->SetM(from->M());
   SetG(to);
   to->SetState(GLET_RUNNING);
+#if defined(TIN_FIXED_FP_SWITCH)
+  // neither changes the modes, the ones to saved are loaded already.
+  if (from->HasFixedFp() && to->HasFixedFp()) {
+    tin_jump_zcontext_fixed_fp(from->MutableContext(),
+                               *to->MutableContext(), args);
+    return;
+  }
+#endif
   jump_zcontext(from->MutableContext(), *to->MutableContext(), args);
 }
 
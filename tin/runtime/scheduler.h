@@ -3,16 +3,35 @@
 // found in the LICENSE file.
 
 #pragma once
+#include <string>
+
+#include "tin/sync/atomic.h"
 #include "tin/runtime/util.h"
 #include "tin/runtime/guintptr.h"
 #include "tin/runtime/unlock.h"
 #include "tin/runtime/env.h"
+#include "tin/runtime/runtime.h"
 #include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/trace.h"
+#include "tin/runtime/stack/stack.h"
+#include "tin/runtime/spawn.h"
 
 namespace tin {
 namespace runtime {
 class P;
 class M;
+struct Sudog;
+
+const int kTinProcsLimit = 256;
+
+// a closure handed in by tin::Post, spawned once a P drains it.
+struct PostedWork {
+  base::Closure closure;
+  SpawnOptions opts;
+  // opts.name points here.
+  std::string name;
+  PostedWork* next;
+};
 
 class Scheduler {
  public:
@@ -20,18 +39,75 @@ class Scheduler {
 
   G* FindRunnable(bool* inherit_time);
 
+  // the global run queue is sharded, each shard has its own lock.
+  // Sched lock is not required.
   void GlobalRunqPut(G* gp);
   void GlobalRunqPutHead(G* gp);
   void GlobalRunqBatch(G* ghead, G* gtail, int32 n);
   G*   GlobalRunqGet(P* p, int32 maximium);
   void InjectGList(G* glist);
 
+  // pushes work posted from any thread, foreign ones included, and wakes
+  // an idle P for it.
+  void PostPut(PostedWork* work);
+  bool PostEmpty() {
+    return atomic::relaxed_load(&posted_) == 0;
+  }
+  // spawns whatever was posted onto the current P, in posting order,
+  // returns how many.
+  int32 PostDrain();
+
+  // global free lists of exited greenlets, guarded by gfree_lock_.
+  void GFreePutBatch(int size_class, G* ghead, G* gtail, int32 n);
+  G* GFreeGetBatch(int size_class, int32 maximium, int32* n);
+  // greenlets are registered for good, these replace delete. the stacks
+  // are freed, Create gives the greenlet a new one.
+  void GShellPutBatch(G* ghead, G* gtail);
+  G* GShellGet();
+  // drops the stacks of half the free greenlets no one took since the
+  // last call, beyond a warm reserve. called by sysmon now and then, so a
+  // burst of exits does not keep its stacks for good.
+  void TrimGFree();
+
+  // global list of spare sudogs linked by next, guarded by sudog_lock_.
+  void SudogPutBatch(Sudog* head, Sudog* tail, int32 n);
+  Sudog* SudogGetBatch(int32 maximium, int32* n);
+
   int32 GlobalRunqSize() {
-    return runq_size_;
+    return atomic::relaxed_load32(&runq_size_);
   }
 
+  // the global queue of batch greenlets, GlobalRunqPut and GlobalRunqBatch
+  // move them there.
+  void GlobalBatchPut(G* gp);
+  G* GlobalBatchGet();
+  // a batch greenlet of p or the global queue.
+  G* BatchGet(P* p);
+
+  // called once a batch greenlet has been spawned, lists put on the global
+  // queue are sorted by class from then on.
+  void SetBatchUsed() {
+    atomic::relaxed_store32(&batch_used_, 1);
+  }
+
+  // P proc_id, NULL if it does not exist.
+  P* Proc(int proc_id);
+  // P::AllGreenlets of every P ever started, proc_id below kTinProcsLimit.
+  G* AllGreenlets(int proc_id);
+
   void PIdlePut(P* p);
   P* PIdleGet();
+  // takes p off the idle list, false if it is not there. lock_ held.
+  bool PIdleTake(P* p);
+
+  // queues a runnable greenlet with a home P there, and wakes that P if it
+  // is idle. see P::StickyPut. without wake no lock is taken, an M going
+  // idle or a thief finds the greenlet then.
+  void StickyReady(G* gp, bool wake = true);
+  // gp is sticky to a P other than p, queues it there.
+  bool Misplaced(G* gp, P* p);
+  // see tin::SendTo.
+  void MailSend(int proc, const base::Closure& closure);
 
   void MPut(M* m);
   M* MGet();
@@ -39,10 +115,16 @@ class Scheduler {
 
   void Reschedule();
   bool OneRoundSched(G* curg);
+  // run by the greenlet switched to, finishes the park of the previous one.
+  void OnSwitch(G* curg);
   void G0Loop();
 
   int Init();
+  // stops every P but the caller's, resizes to nprocs and starts them
+  // again, returns the old count. from a greenlet holding a P only.
+  int SetMaxProcs(int nprocs);
   void MakeReady(G* gp);
+  void MakeReadyBatch(G* glist, int32 n);
   void WakePIfNecessary();
   void WakeupP();
   void HandoffP(P* p);
@@ -55,22 +137,87 @@ class Scheduler {
     return nr_spinning_;
   }
 
+  void GetMSpinStats(MSpinStats* stats);
+  // the scheduler part of ReadRuntimeStats.
+  void GetRuntimeStats(RuntimeStats* stats);
+
+  // charges size bytes of a new stack to Config::StackBudget, false if
+  // they do not fit. with force they are charged anyway.
+  bool StackCharge(int size, bool force);
+  void StackUncharge(int size);
+  void CountStackBudgetWait();
+  void CountStackBudgetFail();
+  // adds the latency histograms of every P, dead ones included.
+  void AddSchedLatency(SchedLatencyStats* stats);
+
+  // NetPoll, counting the greenlets it made ready.
+  G* PollNet(bool block);
+  G* PollNetWait(int64 timeout_ns);
+
+  // breaks a poll blocked without a P if it would wait past when.
+  void WakeNetPoller(int64 when);
+
   uint32 LastPollTime();
   uint32* MutableLastPollTime() {
     return &last_poll_;
   }
 
+  // the time no netpoll ran before the next one, see GetNetPollGapStats.
+  void GetNetPollGapStats(SchedLatencyStats* stats);
+  // the largest gap since the last call, for sysmon.
+  int64 TakeMaxNetPollGap();
+
  private:
-  void OnSwitch(G* curg);
+  // *spin_start is set while the M spins past its first round.
+  G* FindRunnableImpl(bool* inherit_time, int64* spin_start);
+  // the greenlet Reschedule may switch to without g0, NULL if g0 has
+  // to decide.
+  G* NextDirect(P* p, bool* inherit_time);
   void DoUnlock(UnLockInfo* info);
   P** Allp() { return allp_;}
   P* ResizeProc(int nprocs);
+  void StopTheWorld();
+  void StartTheWorld(int nprocs);
+  // sets the Ps in syscalls and the idle ones stopped, lock_ held.
+  void StopIdlePs(P* curp);
+  // stops the P of the calling M, false if the world is not stopping.
+  // parks the M with the P released, it has a P again once woken.
+  bool StopForWorld();
+
+  enum {
+    kGlobalRunqShards = 16,
+  };
+
+  struct RunqShard {
+    RawMutex lock;
+    GUintptr head;
+    GUintptr tail;
+    int32 size;
+    // keep shards on separate cache lines.
+    char pad[64 - sizeof(RawMutex) - 2 * sizeof(GUintptr) - sizeof(int32)];
+  };
+
+  RunqShard* RunqShardForPut();
+  G* RunqShardGet(RunqShard* shard, P* p, int32 maximium);
+  // moves the batch greenlets of the n linked at glist to their global
+  // queue, returns the rest.
+  G* SplitBatch(G* glist, G** gtail, int32* n);
 
  private:
   RawMutex lock_;
-  GUintptr runq_head_;
-  GUintptr runq_tail_;
+  RunqShard* runq_shards_;
+  // total number of G's over all shards.
   int32 runq_size_;
+  uint32 runq_put_seq_;
+
+  RawMutex batch_lock_;
+  GUintptr batch_head_;
+  GUintptr batch_tail_;
+  int32 batch_size_;
+  uint32 batch_used_;
+
+  // a lock-free stack of PostedWork, taken all at once.
+  uintptr_t posted_;
 
   P* idlep_;
   uint32 nr_idlep_;
@@ -83,6 +230,46 @@ class Scheduler {
   int32 max_mcount_;      // maximum number of m's allowed (or die)
 
   uint32 last_poll_;
+  // a PollerState, see WakeupP.
+  uint32 poller_state_;
+  // when the blocked poll times out, 0 if it does not, -1 if not known yet.
+  intptr_t poller_deadline_;
+  // polls in PollNetWait, a gap is between the last leaving and the next
+  // entering. poll_gap_lock_ guards the rest.
+  int32 polls_active_;
+  RawMutex poll_gap_lock_;
+  int64 poll_end_ns_;
+  int64 poll_gap_max_;
+  uint64 poll_gap_[kLatencyHistogramSize];
+
+  // bumped by any M with a cas. the stats getters read them without lock_,
+  // so one counter may be ahead of another.
+  uintptr_t spin_ns_;
+  uintptr_t spin_hits_;
+  uintptr_t wakeups_;
+  uintptr_t netpoll_ready_;
+  uintptr_t handoffs_;
+  uintptr_t stack_bytes_;
+  uintptr_t stack_budget_waits_;
+  uintptr_t stack_budget_fails_;
+
+  // the stopper of the world, one at a time.
+  uint32 world_stopping_;
+  // Ps have to stop, set and cleared with lock_ held.
+  uint32 stop_waiting_;
+  // Ps yet to stop, guarded by lock_.
+  int32 stop_wait_;
+
+  RawMutex gfree_lock_;
+  GUintptr gfree_[kNumStackSizeClasses];
+  int32 gfree_count_[kNumStackSizeClasses];
+  // lowest gfree_count_ since the last TrimGFree.
+  int32 gfree_low_[kNumStackSizeClasses];
+  GUintptr gshells_;
+
+  RawMutex sudog_lock_;
+  Sudog* sudog_free_;
+  int32 sudog_count_;
 
   P** allp_;
 
@@ -108,16 +295,30 @@ void AcquireP(P* p);
 
 void StartM(P* p, bool spinning);
 
-void ParkUnlock(RawMutex* lock);
+// reason is a TraceParkReason, for the tracer only.
+void ParkUnlock(RawMutex* lock, int reason = kParkOther);
 
-void Park(UnlockFunc unlockf = NULL, void* arg1 = NULL, void* arg2 = NULL);
+void Park(UnlockFunc unlockf = NULL, void* arg1 = NULL, void* arg2 = NULL,
+          int reason = kParkOther);
 
 void Ready(G* gp);
 
+// Ready n waiting G's linked by schedlink, wake at most as many idle Ps
+// as the batch can keep busy.
+void ReadyBatch(G* glist, int32 n);
+
 bool ParkUnlockF(void* arg1, void* arg2);
 
+// lets the run_next greenlet, one just handed off to, run now. the caller
+// waits at the tail of the local runq, unlike tin::Sched, so it stays on
+// this P.
+void YieldToNext();
+
 void DropG();
 
+// P stays with the M in kPsyscall, sysmon may retake it.
+void EnterSyscall();
+
 void EnterSyscallBlock();
 
 void ExitSyscall();
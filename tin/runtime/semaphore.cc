@@ -2,16 +2,21 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stdlib.h>
+#include <new>
+
 #include "base/logging.h"
 #include "base/compiler_specific.h"
 #include "base/basictypes.h"
 
+#include "tin/error/error.h"
 #include "tin/sync/atomic.h"
 #include "tin/runtime/runtime.h"
 #include "tin/runtime/util.h"
 #include "tin/runtime/raw_mutex.h"
 #include "tin/runtime/greenlet.h"
 #include "tin/runtime/m.h"
+#include "tin/runtime/p.h"
 #include "tin/runtime/scheduler.h"
 #include "tin/runtime/timer/timer_queue.h"
 #include "tin/runtime/env.h"
@@ -22,23 +27,68 @@
 namespace tin {
 namespace runtime {
 
+// waiters hashed to one root. every address waited on has one Sudog in
+// the root list, linked by next and prev, the other waiters for the same
+// address queue behind it through waitlink, so a release walks distinct
+// addresses only and never the waiters of a colliding address.
 struct ALIGNAS(64) SemaRoot {
   RawMutex  lock;
   Sudog* head;
   Sudog* tail;
   uint32 nwait;  // Number of waiters. Read w/o the lock.
 
-  void queue(uint32* addr, Sudog* s);
+  void queue(uint32* addr, Sudog* s, bool lifo);
   void dequeue(Sudog* s);
+  // first waiter for addr, NULL if none.
+  Sudog* find(uint32* addr);
 };
 
-void SemaRoot::queue(uint32* addr, Sudog* s) {
+Sudog* SemaRoot::find(uint32* addr) {
+  Sudog* s = head;
+  while (s != NULL && s->elem != addr)
+    s = s->next;
+  return s;
+}
+
+void SemaRoot::queue(uint32* addr, Sudog* s, bool lifo) {
   s->address = addr;
   s->gp = GetG();
   s->elem = addr;
   s->next = NULL;
-  s->prev = tail;
+  s->prev = NULL;
+  s->waitlink = NULL;
+  s->waittail = NULL;
 
+  Sudog* first = find(addr);
+  if (first != NULL && lifo) {
+    // s takes over the place of first in the root list.
+    s->waittail = first->waittail != NULL ? first->waittail : first;
+    s->waitlink = first;
+    s->prev = first->prev;
+    s->next = first->next;
+    if (s->prev != NULL) {
+      s->prev->next = s;
+    } else {
+      head = s;
+    }
+    if (s->next != NULL) {
+      s->next->prev = s;
+    } else {
+      tail = s;
+    }
+    first->prev = NULL;
+    first->next = NULL;
+    first->waittail = NULL;
+    return;
+  }
+  if (first != NULL) {
+    Sudog* last = first->waittail != NULL ? first->waittail : first;
+    last->waitlink = s;
+    first->waittail = s;
+    return;
+  }
+
+  s->prev = tail;
   if (tail != NULL) {
     tail->next = s;
   } else {
@@ -48,28 +98,66 @@ void SemaRoot::queue(uint32* addr, Sudog* s) {
 }
 
 void SemaRoot::dequeue(Sudog* s) {
-  if (s->next != NULL) {
-    s->next->prev = s->prev;
+  Sudog* first = find(static_cast<uint32*>(s->elem));
+  DCHECK(first != NULL);
+  if (first != s) {
+    // behind the first waiter, e.g. timed out.
+    Sudog* p = first;
+    while (p->waitlink != s)
+      p = p->waitlink;
+    p->waitlink = s->waitlink;
+    if (first->waittail == s)
+      first->waittail = (p == first) ? NULL : p;
+  } else if (s->waitlink != NULL) {
+    // the next waiter for the address takes over its place.
+    Sudog* t = s->waitlink;
+    t->waittail = (s->waittail == t) ? NULL : s->waittail;
+    t->prev = s->prev;
+    t->next = s->next;
+    if (t->prev != NULL) {
+      t->prev->next = t;
+    } else {
+      head = t;
+    }
+    if (t->next != NULL) {
+      t->next->prev = t;
+    } else {
+      tail = t;
+    }
   } else {
-    tail = s->prev;
-  }
+    if (s->next != NULL) {
+      s->next->prev = s->prev;
+    } else {
+      tail = s->prev;
+    }
 
-  if (s->prev != NULL) {
-    s->prev->next = s->next;
-  } else {
-    head = s->next;
+    if (s->prev != NULL) {
+      s->prev->next = s->next;
+    } else {
+      head = s->next;
+    }
   }
   s->elem = NULL;
   s->next = NULL;
   s->prev = NULL;
+  s->waitlink = NULL;
+  s->waittail = NULL;
 }
 
-const int kSemTabSize = 251;
+// used until SemTableInit sized the table for the Ps.
+const int kBootSemTabSize = 256;
+const int kSemRootsPerProc = 64;
+const int kMaxSemTabSize = 1 << 16;
+
+SemaRoot kBootSemTable[kBootSemTabSize];
 
-SemaRoot kSemTable[kSemTabSize];
+SemaRoot* sem_table = kBootSemTable;
+uint32 sem_table_shift = 24;  // 32 - log2(kBootSemTabSize)
 
 SemaRoot* semroot(uint32* addr) {
-  return &kSemTable[(uintptr_t(addr) >> 3) % kSemTabSize];
+  // fibonacci hashing, spreads neighbouring addresses.
+  uint32 h = static_cast<uint32>(uintptr_t(addr) >> 3) * 2654435761U;
+  return &sem_table[h >> sem_table_shift];
 }
 
 bool CanSemAcquire(uint32* addr) {
@@ -87,6 +175,7 @@ bool CanSemAcquire(uint32* addr) {
 namespace {
 const uint32 kWakedUpByReleaser = 1;
 const uint32 kWakedupByTimer = 2;
+const uint32 kWakedupByCancel = 3;
 }
 
 void OnSemDeadlineReached(void* arg, uintptr_t seq) {
@@ -107,15 +196,39 @@ void OnSemDeadlineReached(void* arg, uintptr_t seq) {
     Ready(gp);
 }
 
+// like the deadline, but leaves kWakedupByTimer to the timer callback.
+void OnSemCanceled(void* arg, uintptr_t data) {
+  Sudog* s = static_cast<Sudog*>(arg);
+  SemaRoot* root = semroot(s->address);
+  G* gp = NULL;
+  {
+    RawMutexGuard guard(&root->lock);
+    if (s->wakedup == 0) {
+      atomic::Inc32(&root->nwait, -1);
+      root->dequeue(s);
+      gp = s->gp;
+    }
+    if (s->wakedup != kWakedupByTimer)
+      s->wakedup = kWakedupByCancel;
+  }
+  if (gp != NULL)
+    Ready(gp);
+}
+
 void SemSetDeadline(G* gp, Sudog* s, int64 deadline) {
   Timer* timer = gp->GetTimer();
   timer->f = OnSemDeadlineReached;
   timer->when = NanoFromNow(deadline);
+  timer->slack = 0;
   timer->arg = s;
   timer_q->AddTimer(timer);
 }
 
-bool SemAcquire(uint32* addr) {
+namespace {
+
+// ns < 0 waits without a deadline. a cancelable wait returns false with
+// TIN_ECANCELED once the greenlet is canceled, see Greenlet::InterruptError.
+bool SemAcquireImpl(uint32* addr, int64 ns, bool lifo, bool cancelable) {
   G* gp = GetG();
   if (gp != gp->M()->CurG()) {
     LOG(FATAL) << "SemAcquire not on the G stack";
@@ -128,12 +241,25 @@ bool SemAcquire(uint32* addr) {
   // if interrupted by timer queue.
   bool interruptd = false;
   // timed is true if been added in timer queue.
-  Sudog* s = new Sudog;
+  Sudog* s = AcquireSudog();
   SemaRoot* root = semroot(addr);
+  Timer* timer = NULL;
+  // not queued yet, keep the deadline and Cancel from dequeueing it.
+  s->address = addr;
+  s->wakedup = kWakedUpByReleaser;
+  if (cancelable && !gp->BeginCancelable(OnSemCanceled, s, 0)) {
+    ReleaseSudog(s);
+    gp->SetErrorCode(gp->InterruptError());
+    return false;
+  }
+  if (ns >= 0) {
+    timer = gp->GetTimer();
+    SemSetDeadline(gp, s, ns);
+  }
   while (true) {
     root->lock.Lock();
-    if (s->wakedup == kWakedupByTimer) {
-      // waked up by timer.
+    if (s->wakedup == kWakedupByTimer || s->wakedup == kWakedupByCancel) {
+      // waked up by timer or Cancel.
       interruptd = true;
       root->lock.Unlock();
       break;
@@ -147,19 +273,122 @@ bool SemAcquire(uint32* addr) {
       break;
     }
 
-    root->queue(addr, s);
+    root->queue(addr, s, lifo);
     s->wakedup = 0;
 
-    ParkUnlock(&root->lock);
-    if (CanSemAcquire(addr)) {
+    ParkUnlock(&root->lock, kParkSema);
+    if (s->ticket != 0 || CanSemAcquire(addr)) {
       break;
     }
   }
-  delete s;
+  if (timer != NULL && !timer_q->DelTimer(timer)) {
+    // the deadline fired, wait until its callback is done with s.
+    while (true) {
+      root->lock.Lock();
+      bool done = s->wakedup == kWakedupByTimer;
+      root->lock.Unlock();
+      if (done)
+        break;
+      tin::Sched();
+    }
+  }
+  if (cancelable && gp->EndCancelable() && interruptd)
+    gp->SetErrorCode(gp->InterruptError());
+  ReleaseSudog(s);
   return !interruptd;
 }
 
-void SemRelease(uint32* addr) {
+}  // namespace
+
+bool SemAcquire(uint32* addr) {
+  return SemAcquireImpl(addr, -1, false, false);
+}
+
+bool SemAcquireCancelable(uint32* addr) {
+  return SemAcquireImpl(addr, -1, false, true);
+}
+
+bool SemAcquireFor(uint32* addr, int64 ns) {
+  if (CanSemAcquire(addr)) {
+    return true;
+  }
+  if (ns <= 0) {
+    return false;
+  }
+  return SemAcquireImpl(addr, ns, false, true);
+}
+
+Sudog* AcquireSudog() {
+  P* p = GetP();
+  if (p == NULL)
+    return new Sudog;
+  return p->SudogGet();
+}
+
+void ReleaseSudog(Sudog* s) {
+  P* p = GetP();
+  if (p == NULL) {
+    delete s;
+    return;
+  }
+  p->SudogPut(s);
+}
+
+void SemTableInit(int nprocs) {
+  int size = kBootSemTabSize;
+  uint32 shift = sem_table_shift;
+  while (size < nprocs * kSemRootsPerProc && size < kMaxSemTabSize) {
+    size <<= 1;
+    shift--;
+  }
+  if (size == kBootSemTabSize)
+    return;
+  // nobody waits yet, the boot table can simply be dropped. roots are
+  // cache line aligned by hand, plain new does not honour ALIGNAS.
+  void* mem = malloc(size * sizeof(SemaRoot) + 63);
+  SemaRoot* table = reinterpret_cast<SemaRoot*>(
+    (reinterpret_cast<uintptr_t>(mem) + 63) & ~static_cast<uintptr_t>(63));
+  for (int i = 0; i < size; i++)
+    new (&table[i]) SemaRoot();
+  sem_table = table;
+  sem_table_shift = shift;
+}
+
+bool SemTryAcquire(uint32* addr) {
+  return CanSemAcquire(addr);
+}
+
+uint32 SemTryAcquireN(uint32* addr, uint32 n) {
+  while (n > 0) {
+    uint32 v = atomic::load32(addr);
+    if (v == 0) {
+      return 0;
+    }
+    uint32 take = v < n ? v : n;
+    if (atomic::cas32(addr, v, v - take)) {
+      return take;
+    }
+  }
+  return 0;
+}
+
+void SemAcquireMutex(uint32* addr, bool lifo) {
+  SemAcquireImpl(addr, -1, lifo, false);
+}
+
+bool SemAcquireMutexFor(uint32* addr, bool lifo, int64 ns) {
+  if (CanSemAcquire(addr)) {
+    return true;
+  }
+  if (ns <= 0) {
+    return false;
+  }
+  return SemAcquireImpl(addr, ns, lifo, false);
+}
+
+namespace {
+
+void SemReleaseImpl(uint32* addr, bool handoff) {
   SemaRoot* root = semroot(addr);
   atomic::Inc32(addr, 1);
   if (atomic::load32(&root->nwait) == 0) {
@@ -175,20 +404,66 @@ void SemRelease(uint32* addr) {
     return;
   }
 
-  Sudog* s = root->head;
-  for ( ; s != NULL; s = s->next) {
-    if (s->elem == addr) {
-      atomic::Inc32(&root->nwait, -1);
-      root->dequeue(s);
-      break;
-    }
-  }
-  if (s != NULL)
+  Sudog* s = root->find(addr);
+  if (s != NULL) {
+    atomic::Inc32(&root->nwait, -1);
+    root->dequeue(s);
     s->wakedup = kWakedUpByReleaser;
+    if (handoff && CanSemAcquire(addr))
+      s->ticket = 1;
+  }
   root->lock.Unlock();
   if (s != NULL) {
+    bool yield = s->ticket != 0;
+    // Ready puts it into run_next, yielding lets it run right now.
     Ready(s->gp);
+    if (yield)
+      YieldToNext();
+  }
+}
+
+}  // namespace
+
+void SemRelease(uint32* addr) {
+  SemReleaseImpl(addr, false);
+}
+
+void SemReleaseHandoff(uint32* addr) {
+  SemReleaseImpl(addr, true);
+}
+
+void SemReleaseN(uint32* addr, uint32 n) {
+  if (n == 0) {
+    return;
   }
+  SemaRoot* root = semroot(addr);
+  atomic::Inc32(addr, n);
+  if (atomic::load32(&root->nwait) == 0) {
+    return;
+  }
+
+  G* glist = NULL;
+  G* gtail = NULL;
+  int32 nwake = 0;
+  root->lock.Lock();
+  Sudog* s = NULL;
+  while (static_cast<uint32>(nwake) < n && (s = root->find(addr)) != NULL) {
+    atomic::Inc32(&root->nwait, -1);
+    root->dequeue(s);
+    s->wakedup = kWakedUpByReleaser;
+    // s is freed by its owner once readied, take gp now.
+    G* gp = s->gp;
+    gp->SetSchedLink(NULL);
+    if (gtail == NULL) {
+      glist = gp;
+    } else {
+      gtail->SetSchedLink(gp);
+    }
+    gtail = gp;
+    nwake++;
+  }
+  root->lock.Unlock();
+  ReadyBatch(glist, nwake);
 }
 
 void SyncSema::Acquire() {
@@ -209,7 +484,7 @@ void SyncSema::Acquire() {
       Ready(wake->gp);
     }
   } else {
-    Sudog* w = new Sudog;
+    Sudog* w = AcquireSudog();
     w->gp = GetG();
     w->nrelease = -1;
     w->next = NULL;
@@ -220,12 +495,111 @@ void SyncSema::Acquire() {
       tail_->next = w;
     }
     tail_ = w;
-    ParkUnlock(&lock_);
-    delete w;
+    ParkUnlock(&lock_, kParkSema);
+    ReleaseSudog(w);
   }
 }
 
+bool SyncSema::AcquireFor(int64 ns) {
+  lock_.Lock();
+  if (head_ != NULL && head_->nrelease > 0) {
+    Sudog* wake = NULL;
+    head_->nrelease--;
+    if (head_->nrelease == 0) {
+      wake = head_;
+      head_ = wake->next;
+      if (head_ == NULL) {
+        tail_ = NULL;
+      }
+    }
+    lock_.Unlock();
+    if (wake != NULL) {
+      wake->next = NULL;
+      Ready(wake->gp);
+    }
+    return true;
+  }
+  if (ns <= 0) {
+    lock_.Unlock();
+    return false;
+  }
+  G* gp = GetG();
+  Sudog* w = AcquireSudog();
+  w->gp = gp;
+  w->nrelease = -1;
+  w->next = NULL;
+  w->elem = this;
+
+  if (tail_ == NULL) {
+    head_ = w;
+  } else {
+    tail_->next = w;
+  }
+  tail_ = w;
+  Timer* timer = gp->GetTimer();
+  timer->f = OnDeadline;
+  timer->when = NanoFromNow(ns);
+  timer->slack = 0;
+  timer->arg = w;
+  timer_q->AddTimer(timer);
+  ParkUnlock(&lock_, kParkSema);
+
+  bool acquired = true;
+  if (!timer_q->DelTimer(timer)) {
+    // the deadline fired, wait until its callback is done with w.
+    while (true) {
+      lock_.Lock();
+      uint32 wakedup = w->wakedup;
+      lock_.Unlock();
+      if (wakedup != 0) {
+        acquired = wakedup != kWakedupByTimer;
+        break;
+      }
+      tin::Sched();
+    }
+  }
+  ReleaseSudog(w);
+  return acquired;
+}
+
+void SyncSema::OnDeadline(void* arg, uintptr_t seq) {
+  Sudog* w = static_cast<Sudog*>(arg);
+  SyncSema* sema = static_cast<SyncSema*>(w->elem);
+  G* gp = NULL;
+  {
+    RawMutexGuard guard(&sema->lock_);
+    Sudog* prev = NULL;
+    Sudog* s = sema->head_;
+    while (s != NULL && s != w) {
+      prev = s;
+      s = s->next;
+    }
+    if (s != NULL) {
+      // still waiting, time it out.
+      if (prev == NULL) {
+        sema->head_ = w->next;
+      } else {
+        prev->next = w->next;
+      }
+      if (sema->tail_ == w) {
+        sema->tail_ = prev;
+      }
+      w->next = NULL;
+      w->wakedup = kWakedupByTimer;
+      gp = w->gp;
+    } else {
+      // released just before the deadline.
+      w->wakedup = kWakedUpByReleaser;
+    }
+  }
+  if (gp != NULL)
+    Ready(gp);
+}
+
 void SyncSema::Release(uint32 n) {
+  G* glist = NULL;
+  G* gtail = NULL;
+  int32 nwake = 0;
   lock_.Lock();
   while (n > 0 && head_ != NULL && head_->nrelease < 0) {
     // Have pending acquire, satisfy it.
@@ -235,11 +609,20 @@ void SyncSema::Release(uint32 n) {
       tail_ = NULL;
     }
     wake->next = NULL;
-    Ready(wake->gp);
+    G* gp = wake->gp;
+    gp->SetSchedLink(NULL);
+    if (gtail == NULL) {
+      glist = gp;
+    } else {
+      gtail->SetSchedLink(gp);
+    }
+    gtail = gp;
+    nwake++;
     n--;
   }
+  ReadyBatch(glist, nwake);
   if (n > 0) {
-    Sudog* w = new Sudog;
+    Sudog* w = AcquireSudog();
     w->gp = GetG();
     w->nrelease = static_cast<int32>(n);
     w->next = NULL;
@@ -249,8 +632,8 @@ void SyncSema::Release(uint32 n) {
       tail_->next = w;
     }
     tail_ = w;
-    ParkUnlock(&lock_);
-    delete w;
+    ParkUnlock(&lock_, kParkSema);
+    ReleaseSudog(w);
   } else {
     lock_.Unlock();
   }
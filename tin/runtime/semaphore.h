@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include "base/basictypes.h"
 #include "tin/runtime/util.h"
+#include "tin/runtime/raw_mutex.h"
 
 
 namespace tin {
@@ -19,11 +20,16 @@ struct Sudog {
   void* elem;  // data element
   int32 nrelease;
   Sudog* waitlink;
+  // last waiter queued behind the first one for the same address.
+  Sudog* waittail;
   uint32* address;
   uint32  wakedup;
+  // set when a releaser handed its count straight to this waiter.
+  uint32  ticket;
 
   Sudog() {
     wakedup = 0;
+    ticket = 0;
     gp = NULL;
     selectdone = NULL;
     next = NULL;
@@ -31,14 +37,54 @@ struct Sudog {
     elem = NULL;
     nrelease = 0;
     waitlink = NULL;
+    waittail = NULL;
     address = NULL;
   }
 };
 
+// a cleared Sudog from the cache of the current P, give it back with
+// ReleaseSudog once nobody can reach it any more.
+Sudog* AcquireSudog();
+void ReleaseSudog(Sudog* s);
+
+// sizes the semaphore table for nprocs Ps, called once before any
+// greenlet runs.
+void SemTableInit(int nprocs);
+
+// never fails, Cancel does not end the wait, for the sync primitives
+// that must not return without the count.
 bool SemAcquire(uint32* addr);
 
+// returns false with TIN_ECANCELED if the greenlet is canceled before a
+// count comes in, see Greenlet::Cancel.
+bool SemAcquireCancelable(uint32* addr);
+
+// takes one count if there is one, never parks.
+bool SemTryAcquire(uint32* addr);
+
+// takes up to n counts at once without parking, returns how many.
+uint32 SemTryAcquireN(uint32* addr, uint32 n);
+
+// parks at most ns nano seconds, returns false if no count came in time
+// or the greenlet is canceled.
+bool SemAcquireFor(uint32* addr, int64 ns);
+
+// for tin::Mutex, lifo queues a greenlet that already waited in front of
+// the other waiters for addr.
+void SemAcquireMutex(uint32* addr, bool lifo);
+// SemAcquireMutex for at most ns nano seconds, false if no count came in
+// time. not canceled, like mutexes.
+bool SemAcquireMutexFor(uint32* addr, bool lifo, int64 ns);
+
 void SemRelease(uint32* addr);
 
+// passes the count straight to the first waiter, which runs next on this
+// P in place of the caller. barging acquirers can't steal it meanwhile.
+void SemReleaseHandoff(uint32* addr);
+
+// same as calling SemRelease n times, but readies waiters in one batch.
+void SemReleaseN(uint32* addr, uint32 n);
+
 class SyncSema {
  public:
   SyncSema()
@@ -47,9 +93,13 @@ class SyncSema {
   }
 
   void Acquire();
+  // returns false if nothing was released within ns nano seconds.
+  bool AcquireFor(int64 ns);
   void Release(uint32 n);
 
  private:
+  static void OnDeadline(void* arg, uintptr_t seq);
+
   RawMutex lock_;
   Sudog* head_;
   Sudog* tail_;
@@ -4,17 +4,236 @@
 
 #pragma once
 #include <cstdlib>
+#include "build/build_config.h"
+
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800)
+#define TIN_VARIADIC_SPAWN 1
+#endif
+
+#if defined(TIN_VARIADIC_SPAWN)
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#endif
+
 #include "base/bind.h"
 #include "base/callback.h"
 #include "base/basictypes.h"
+#include "base/strings/string_piece.h"
 
 namespace tin {
+
+// scheduling class of a greenlet, each has its own run queues.
+enum GreenletPriority {
+  kPriorityLatency = 0,
+  // runs when no latency greenlet is runnable, and gets one in
+  // kBatchPickTicks picks of a P else, so it is not starved.
+  kPriorityBatch,
+};
+
+// per greenlet creation options, zero means the configured default.
+struct SpawnOptions {
+  SpawnOptions()
+    : stack_size(0)
+    , name(NULL)
+    , priority(kPriorityLatency)
+    , proc(-1)
+    , sticky(false) {
+  }
+
+  explicit SpawnOptions(int size, const char* glet_name = NULL)
+    : stack_size(size)
+    , name(glet_name)
+    , priority(kPriorityLatency)
+    , proc(-1)
+    , sticky(false) {
+  }
+
+  // rounded up to the stack size class it is recycled in.
+  int stack_size;
+  // copied, need not outlive the call.
+  const char* name;
+  // a GreenletPriority.
+  int priority;
+  // starts on P proc modulo the P count, -1 for the spawning P.
+  int proc;
+  // with proc, it stays there: whoever wakes it queues it on that P and
+  // other Ps steal it only once it has waited kStickyStarveNs, so per P
+  // shard state stays in one cache. a locality hint, not exclusion, two
+  // sticky greenlets of one P may still run at once then.
+  bool sticky;
+};
+
+namespace runtime {
+
+// the callable of an in place spawn, moved from src into the greenlet by
+// construct and run there by run, which destroys it too.
+struct InPlaceEntry {
+  size_t size;
+  void (*construct)(void* storage, void* src);
+  void (*run)(void* storage);
+  void* src;
+};
+
+// callables up to this size live in the greenlet, larger ones on the heap.
+const size_t kInPlaceSpawnSize = 64;
+
+}  // namespace runtime
+
 void RuntimeSpawn(base::Closure* closure);
+void RuntimeSpawn(base::Closure* closure, const SpawnOptions& opts);
+// opts may be NULL for the defaults.
+void RuntimeSpawnInPlace(const runtime::InPlaceEntry& entry,
+                         const SpawnOptions* opts);
+
+// callable from any thread, one not run by tin too, e.g. a completion
+// thread of a database driver. the closure is queued with one atomic push
+// and spawned by the next P looking for work, an idle one is woken for it.
+void Post(const base::Closure& closure);
+void Post(const base::Closure& closure, const SpawnOptions& opts);
+
+// runs closure on P proc as a sticky greenlet, the way Ps talk in shared
+// nothing mode. from a greenlet only. it rides a single producer ring per
+// pair of Ps and costs no lock, or a greenlet when the ring is full.
+void SendTo(int proc, const base::Closure& closure);
 
 inline void DoSpawn(base::Closure closure) {
   RuntimeSpawn(&closure);
 }
 
+inline void DoSpawn(const SpawnOptions& opts, base::Closure closure) {
+  RuntimeSpawn(&closure, opts);
+}
+
+// a sticky greenlet on P proc, see SpawnOptions::sticky.
+inline void SpawnOn(int proc, base::Closure closure) {
+  SpawnOptions opts;
+  opts.proc = proc;
+  opts.sticky = true;
+  RuntimeSpawn(&closure, opts);
+}
+
+// the P key shards onto, Hash64 of key spread over the current Ps. the
+// same for a key until SetMaxProcs.
+int ProcOfKey(const base::StringPiece& key);
+
+// SpawnOn the P of key, so the greenlets of a key share its caches.
+inline void SpawnOnKey(const base::StringPiece& key, base::Closure closure) {
+  SpawnOn(ProcOfKey(key), closure);
+}
+
+#if defined(TIN_VARIADIC_SPAWN)
+namespace internal {
+
+template <size_t... I>
+struct SpawnIndices {
+};
+
+template <size_t N, size_t... I>
+struct MakeSpawnIndices : MakeSpawnIndices<N - 1, N - 1, I...> {
+};
+
+template <size_t... I>
+struct MakeSpawnIndices<0, I...> {
+  typedef SpawnIndices<I...> Type;
+};
+
+// the functor and its arguments, owned by the greenlet.
+template <typename F, typename... Args>
+class SpawnCall {
+ public:
+  template <typename G, typename... A>
+  explicit SpawnCall(G&& f, A&&... args)
+    : f_(std::forward<G>(f))
+    , args_(std::forward<A>(args)...) {
+  }
+
+  static void Construct(void* storage, void* src) {
+    new (storage) SpawnCall(std::move(*static_cast<SpawnCall*>(src)));
+  }
+
+  static void Run(void* storage) {
+    SpawnCall* call = static_cast<SpawnCall*>(storage);
+    call->Invoke(typename MakeSpawnIndices<sizeof...(Args)>::Type());
+    call->~SpawnCall();
+  }
+
+ private:
+  template <size_t... I>
+  void Invoke(SpawnIndices<I...>) {
+    f_(std::move(std::get<I>(args_))...);
+  }
+
+  F f_;
+  std::tuple<Args...> args_;
+};
+
+// plain functions, lambdas and functors called with the moved arguments.
+// member functions, base::Callback and the base::Bind wrappers are not.
+template <typename F, typename... Args>
+struct IsSpawnCallable {
+  template <typename G,
+            typename = decltype(std::declval<G&>()(
+                std::declval<typename std::decay<Args>::type>()...))>
+  static char Test(int);
+  template <typename G>
+  static long Test(...);
+
+  static const bool value =
+      sizeof(Test<typename std::decay<F>::type>(0)) == 1;
+};
+
+template <bool kInPlace>
+struct SpawnImpl {
+  template <typename F, typename... Args>
+  static void Spawn(const SpawnOptions* opts, F&& f, Args&&... args) {
+    typedef SpawnCall<typename std::decay<F>::type,
+                      typename std::decay<Args>::type...> Call;
+    static_assert(std::alignment_of<Call>::value <= 16,
+                  "over aligned spawn arguments");
+    Call call(std::forward<F>(f), std::forward<Args>(args)...);
+    runtime::InPlaceEntry entry = {
+      sizeof(call), &Call::Construct, &Call::Run, &call
+    };
+    RuntimeSpawnInPlace(entry, opts);
+  }
+};
+
+template <>
+struct SpawnImpl<false> {
+  template <typename F, typename... Args>
+  static void Spawn(const SpawnOptions* opts, F&& f, Args&&... args) {
+    if (opts != NULL) {
+      DoSpawn(*opts, base::Bind(f, args...));
+    } else {
+      DoSpawn(base::Bind(f, args...));
+    }
+  }
+};
+
+}  // namespace internal
+
+// the functor and the arguments are moved into the greenlet, which holds
+// up to kInPlaceSpawnSize bytes of them without allocating. what only
+// base::Bind can call, e.g. a member function with base::Unretained or a
+// scoped_refptr, goes through it as before.
+template <typename F, typename... Args>
+typename std::enable_if<
+    !std::is_same<typename std::decay<F>::type, SpawnOptions>::value>::type
+Spawn(F&& f, Args&&... args) {
+  internal::SpawnImpl<internal::IsSpawnCallable<F, Args...>::value>::Spawn(
+      NULL, std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template <typename F, typename... Args>
+void Spawn(const SpawnOptions& opts, F&& f, Args&&... args) {
+  internal::SpawnImpl<internal::IsSpawnCallable<F, Args...>::value>::Spawn(
+      &opts, std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+#else  // TIN_VARIADIC_SPAWN
+
 template <typename Functor>
 void Spawn(Functor functor) {
   DoSpawn(base::Bind(functor));
@@ -62,4 +281,57 @@ void Spawn(Functor functor, const P1& p1, const P2& p2, const P3& p3,
   DoSpawn(base::Bind(functor, p1, p2, p3, p4, p5, p6, p7));
 }
 
+template <typename Functor>
+void Spawn(const SpawnOptions& opts, Functor functor) {
+  DoSpawn(opts, base::Bind(functor));
+}
+
+template <typename Functor, typename P1>
+void Spawn(const SpawnOptions& opts, Functor functor, const P1& p1) {
+  DoSpawn(opts, base::Bind(functor, p1));
+}
+
+template <typename Functor, typename P1, typename P2>
+void Spawn(const SpawnOptions& opts, Functor functor, const P1& p1,
+           const P2& p2) {
+  DoSpawn(opts, base::Bind(functor, p1, p2));
+}
+
+template <typename Functor, typename P1, typename P2, typename P3>
+void Spawn(const SpawnOptions& opts, Functor functor, const P1& p1,
+           const P2& p2, const P3& p3) {
+  DoSpawn(opts, base::Bind(functor, p1, p2, p3));
+}
+
+template <typename Functor, typename P1, typename P2, typename P3, typename P4>
+void Spawn(const SpawnOptions& opts, Functor functor, const P1& p1,
+           const P2& p2, const P3& p3, const P4& p4) {
+  DoSpawn(opts, base::Bind(functor, p1, p2, p3, p4));
+}
+
+template <typename Functor, typename P1, typename P2, typename P3, typename P4,
+          typename P5>
+void Spawn(const SpawnOptions& opts, Functor functor, const P1& p1,
+           const P2& p2, const P3& p3, const P4& p4, const P5& p5) {
+  DoSpawn(opts, base::Bind(functor, p1, p2, p3, p4, p5));
+}
+
+template <typename Functor, typename P1, typename P2, typename P3, typename P4,
+          typename P5, typename P6>
+void Spawn(const SpawnOptions& opts, Functor functor, const P1& p1,
+           const P2& p2, const P3& p3, const P4& p4, const P5& p5,
+           const P6& p6) {
+  DoSpawn(opts, base::Bind(functor, p1, p2, p3, p4, p5, p6));
+}
+
+template <typename Functor, typename P1, typename P2, typename P3, typename P4,
+          typename P5, typename P6, typename P7>
+void Spawn(const SpawnOptions& opts, Functor functor, const P1& p1,
+           const P2& p2, const P3& p3, const P4& p4, const P5& p5, const P6& p6,
+           const P7& p7) {
+  DoSpawn(opts, base::Bind(functor, p1, p2, p3, p4, p5, p6, p7));
+}
+
+#endif  // TIN_VARIADIC_SPAWN
+
 }  // namespace tin
@@ -18,9 +18,9 @@
 namespace tin {
 namespace runtime {
 
-bool CanSpin(int i) {
+bool CanSpin(int i, int limit) {
   int32 max_proc = rtm_conf->MaxProcs();
-  if (i >= spin::kActiveSpin ||
+  if (i >= limit ||
       rtm_env->NumberOfProcessors() <= 1 ||
       max_proc <=
       static_cast<int32>(sched->NrIdleP() + sched->NrSpinning() + 1)) {
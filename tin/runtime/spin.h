@@ -3,6 +3,8 @@
 // found in the LICENSE file.
 
 #pragma once
+#include "base/basictypes.h"
+#include "tin/sync/atomic.h"
 
 namespace tin {
 namespace runtime {
@@ -11,10 +13,54 @@ namespace spin {
 const int kActiveSpin = 4;
 const int kActiveSpinCount = 30;
 const int kPassiveSpin = 1;
+// bounds of Adaptive::Limit, in rounds of kActiveSpinCount.
+const int kAdaptiveSpinMax = 16;
+
+// the spin budget of one lock learned from its recent waits, like the
+// adaptive mutex of glibc. the rounds spinning took to get the lock feed
+// a moving average and a waiter spins up to twice that. spinning that
+// fails shrinks it, so a lock held long spins one round and parks.
+// updated racily by the waiters, a lost update only costs precision.
+class Adaptive {
+ public:
+  Adaptive()
+    : spins_(kActiveSpin << 3) {
+  }
+
+  // rounds worth spinning, at least 1 so a lock can learn again.
+  int Limit() const {
+    int estimate = static_cast<int>(atomic::relaxed_load32(&spins_) >> 3);
+    return estimate * 2 + 1 < kAdaptiveSpinMax ? estimate * 2 + 1
+                                               : kAdaptiveSpinMax;
+  }
+
+  // false once spinning stopped paying, a waiter then skips yielding the
+  // thread too and parks.
+  bool Pays() const {
+    return (atomic::relaxed_load32(&spins_) >> 3) != 0;
+  }
+
+  // after spinning rounds, acquired or not.
+  void Update(int rounds, bool acquired) {
+    uint32 spins = atomic::relaxed_load32(&spins_);
+    if (acquired) {
+      // spins += rounds - spins / 8, an average over about 8 waits in 1/8.
+      spins = spins + static_cast<uint32>(rounds) - (spins >> 3);
+    } else {
+      spins -= spins >> 2;
+    }
+    atomic::relaxed_store32(&spins_, spins);
+  }
+
+ private:
+  // the average rounds in 1/8.
+  uint32 spins_;
+};
 
 }  // namespace spin
 
-bool CanSpin(int i);
+// i rounds spun so far, limit the most a lock allows, see spin::Adaptive.
+bool CanSpin(int i, int limit = spin::kActiveSpin);
 
 void DoSpin();
 
@@ -37,5 +37,9 @@ void* FixedSizeStack::Allocate(size_t size) {
   return sp_;
 }
 
+void* FixedSizeStack::Bottom() {
+  return vaddr_;
+}
+
 }  // namespace runtime
 }   // namespace tin
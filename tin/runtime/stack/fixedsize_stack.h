@@ -21,6 +21,8 @@ class FixedSizeStack : public Stack {
 
   virtual void* Allocate(size_t size);
 
+  virtual void* Bottom();
+
  private:
   void* vaddr_;
   size_t vsize_;
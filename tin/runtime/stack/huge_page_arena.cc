@@ -0,0 +1,73 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/logging.h"
+#include "base/synchronization/lock.h"
+
+#include "tin/runtime/stack/huge_page_arena.h"
+
+namespace tin {
+namespace runtime {
+
+namespace {
+
+const int kMinSlotShift = 12;  // 4 KiB
+const int kMaxSlotShift = 20;  // 1 MiB
+const int kNumSlotSizes = kMaxSlotShift - kMinSlotShift + 1;
+
+// free slots are linked through their first word.
+struct FreeSlot {
+  FreeSlot* next;
+};
+
+// a base::Lock, buffers are also allocated outside of greenlets.
+base::Lock arena_lock;
+FreeSlot* free_slots[kNumSlotSizes];
+
+int SlotShift(size_t size) {
+  for (int shift = kMinSlotShift; shift <= kMaxSlotShift; shift++) {
+    if (size == (static_cast<size_t>(1) << shift))
+      return shift;
+  }
+  return -1;
+}
+
+}  // namespace
+
+bool IsHugePageSlotSize(size_t size) {
+  return SlotShift(size) >= 0;
+}
+
+void* HugePageAlloc(size_t size) {
+  int shift = SlotShift(size);
+  DCHECK(shift >= 0) << "not a huge page slot size " << size;
+  int i = shift - kMinSlotShift;
+  base::AutoLock guard(arena_lock);
+  if (free_slots[i] == NULL) {
+    char* arena = static_cast<char*>(MapHugePageArena(kHugePageArenaSize));
+    if (arena == NULL)
+      return NULL;
+    // lowest slot first, like a bump allocator would hand them out.
+    for (size_t off = kHugePageArenaSize; off >= size; off -= size) {
+      FreeSlot* slot = reinterpret_cast<FreeSlot*>(arena + off - size);
+      slot->next = free_slots[i];
+      free_slots[i] = slot;
+    }
+  }
+  FreeSlot* slot = free_slots[i];
+  free_slots[i] = slot->next;
+  return slot;
+}
+
+void HugePageFree(void* slot, size_t size) {
+  int shift = SlotShift(size);
+  DCHECK(shift >= 0) << "not a huge page slot size " << size;
+  FreeSlot* s = static_cast<FreeSlot*>(slot);
+  base::AutoLock guard(arena_lock);
+  s->next = free_slots[shift - kMinSlotShift];
+  free_slots[shift - kMinSlotShift] = s;
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,32 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <stddef.h>
+
+namespace tin {
+namespace runtime {
+
+// stacks and pooled buffers are carved from arenas of one 2 MiB huge page
+// each, see Config::EnableHugePages. an arena holds slots of one size
+// only, freed slots are kept for reuse and never given back to the OS.
+const size_t kHugePageArenaSize = 2 * 1024 * 1024;
+
+// whether size is a power of two slot size, 4 KiB to 1 MiB.
+bool IsHugePageSlotSize(size_t size);
+
+// a slot of size bytes, maps a new arena if there is none free. NULL if
+// not even normal pages could be mapped.
+void* HugePageAlloc(size_t size);
+
+void HugePageFree(void* slot, size_t size);
+
+// maps size bytes backed by a huge page if the OS gives one, transparent
+// huge pages or normal pages else, with an inaccessible page at either
+// end where the mapping allows it. NULL if it failed.
+void* MapHugePageArena(size_t size);
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,68 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+extern "C" {
+#include <sys/mman.h>
+#include <unistd.h>
+}
+
+#include "base/basictypes.h"
+#include "base/sys_info.h"
+
+#include "tin/runtime/stack/huge_page_arena.h"
+
+namespace tin {
+namespace runtime {
+
+void* MapHugePageArena(size_t size) {
+  size_t page_size = base::SysInfo::PageSize();
+  int flags = MAP_PRIVATE;
+#if defined(MAP_ANON)
+  flags |= MAP_ANON;
+#else
+  flags |= MAP_ANONYMOUS;
+#endif
+  // room to align the arena to size, with a guard page below and above.
+  size_t reserve = 2 * size + 2 * page_size;
+  int reserve_flags = flags;
+#if defined(MAP_NORESERVE)
+  reserve_flags |= MAP_NORESERVE;
+#endif
+  char* base = static_cast<char*>(
+      mmap(0, reserve, PROT_NONE, reserve_flags, -1, 0));
+  if (MAP_FAILED == base)
+    return NULL;
+  char* arena = reinterpret_cast<char*>(
+      (reinterpret_cast<uintptr_t>(base) + page_size + size - 1) &
+      ~(size - 1));
+
+  void* vp = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+  // explicit huge pages, only if some are reserved in the pool.
+  vp = mmap(arena, size, PROT_READ | PROT_WRITE,
+            flags | MAP_FIXED | MAP_HUGETLB, -1, 0);
+#endif
+  if (MAP_FAILED == vp) {
+    vp = mmap(arena, size, PROT_READ | PROT_WRITE, flags | MAP_FIXED, -1, 0);
+    if (MAP_FAILED == vp) {
+      ::munmap(base, reserve);
+      return NULL;
+    }
+#if defined(MADV_HUGEPAGE)
+    ::madvise(arena, size, MADV_HUGEPAGE);
+#endif
+  }
+
+  // the guard pages stay PROT_NONE, the rest of the reservation goes.
+  char* low = arena - page_size;
+  char* high = arena + size + page_size;
+  if (low > base)
+    ::munmap(base, low - base);
+  if (base + reserve > high)
+    ::munmap(high, base + reserve - high);
+  return arena;
+}
+
+}  // namespace runtime
+}  // namespace tin
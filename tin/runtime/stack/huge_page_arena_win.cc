@@ -0,0 +1,41 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <windows.h>
+
+#include "base/basictypes.h"
+#include "base/sys_info.h"
+
+#include "tin/runtime/stack/huge_page_arena.h"
+
+namespace tin {
+namespace runtime {
+
+void* MapHugePageArena(size_t size) {
+  // needs SeLockMemoryPrivilege, large pages can not carry guard pages.
+  SIZE_T large_page = ::GetLargePageMinimum();
+  if (large_page != 0 && size % large_page == 0) {
+    void* vp = ::VirtualAlloc(0, size,
+                              MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                              PAGE_READWRITE);
+    if (vp != NULL)
+      return vp;
+  }
+
+  size_t page_size = base::SysInfo::PageSize();
+  char* base = static_cast<char*>(
+      ::VirtualAlloc(0, size + 2 * page_size, MEM_RESERVE, PAGE_NOACCESS));
+  if (base == NULL)
+    return NULL;
+  // the pages at either end stay reserved only, as guards.
+  if (::VirtualAlloc(base + page_size, size, MEM_COMMIT,
+                     PAGE_READWRITE) == NULL) {
+    ::VirtualFree(base, 0, MEM_RELEASE);
+    return NULL;
+  }
+  return base + page_size;
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,40 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <memory>
+
+#include "base/basictypes.h"
+#include "tin/runtime/stack/huge_page_arena.h"
+
+#include "tin/runtime/stack/huge_page_stack.h"
+
+namespace tin {
+namespace runtime {
+
+HugePageStack::HugePageStack()
+  : vaddr_(NULL)
+  , size_(0)
+  , sp_(NULL) {
+}
+
+HugePageStack::~HugePageStack() {
+  if (vaddr_ != NULL)
+    HugePageFree(vaddr_, size_);
+}
+
+void* HugePageStack::Allocate(size_t size) {
+  vaddr_ = HugePageAlloc(size);
+  if (vaddr_ == NULL)
+    throw std::bad_alloc();
+  size_ = size;
+  sp_ = static_cast<char*>(vaddr_) + size;
+  return sp_;
+}
+
+void* HugePageStack::Bottom() {
+  return vaddr_;
+}
+
+}  // namespace runtime
+}  // namespace tin
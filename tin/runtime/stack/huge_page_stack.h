@@ -0,0 +1,35 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "tin/runtime/stack/stack.h"
+
+namespace tin {
+namespace runtime {
+
+// a slot of a huge page arena, see HugePageAlloc. only the ends of the
+// arena are guarded, an overflow runs into the stack below.
+class HugePageStack : public Stack {
+ public:
+  HugePageStack();
+
+  virtual ~HugePageStack();
+
+  virtual void* Pointer() {
+    return sp_;
+  }
+
+  virtual void* Allocate(size_t size);
+
+  virtual void* Bottom();
+
+ private:
+  void* vaddr_;
+  size_t size_;
+  void* sp_;
+};
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,39 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "tin/runtime/stack/stack.h"
+
+namespace tin {
+namespace runtime {
+
+// LazyStack reserves the whole range up front with a guard page at the
+// bottom, physical pages are committed by the OS on first touch.
+class LazyStack : public Stack {
+ public:
+  LazyStack();
+
+  virtual ~LazyStack();
+
+  virtual void* Pointer() {
+    return sp_;
+  }
+
+  virtual void* Allocate(size_t size);
+
+  virtual void* Bottom();
+
+  // give back physical pages between the guard page and sp.
+  virtual void ReleaseUnused(void* sp);
+
+ private:
+  void* vaddr_;
+  size_t size_;
+  size_t page_size_;
+  void* sp_;
+};
+
+}  // namespace runtime
+}  // namespace tin
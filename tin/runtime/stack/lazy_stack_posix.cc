@@ -0,0 +1,79 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+extern "C" {
+#include <sys/mman.h>
+#include <unistd.h>
+}
+
+#include <memory>
+
+#include "base/basictypes.h"
+#include "base/logging.h"
+#include "base/sys_info.h"
+
+#include "tin/runtime/stack/lazy_stack.h"
+
+namespace tin {
+namespace runtime {
+
+LazyStack::LazyStack()
+  : vaddr_(NULL)
+  , size_(0)
+  , page_size_(0)
+  , sp_(NULL) {
+}
+
+LazyStack::~LazyStack() {
+  if (vaddr_ != NULL) {
+    ::munmap(vaddr_, size_);
+  }
+}
+
+void* LazyStack::Allocate(size_t size) {
+  page_size_ = base::SysInfo::PageSize();
+  // one extra page for guard.
+  size_t num_pages = (size + page_size_ - 1) / page_size_ + 1;
+  if (num_pages < 2)
+    num_pages = 2;
+  size_ = num_pages * page_size_;
+
+  int flags = MAP_PRIVATE;
+#if defined(MAP_ANON)
+  flags |= MAP_ANON;
+#else
+  flags |= MAP_ANONYMOUS;
+#endif
+#if defined(MAP_NORESERVE)
+  // don't account swap for the whole reservation.
+  flags |= MAP_NORESERVE;
+#endif
+  void* vp = mmap(0, size_, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (MAP_FAILED == vp)
+    throw std::bad_alloc();
+  const int result(::mprotect(vp, page_size_, PROT_NONE));
+  DCHECK_EQ(result, 0);
+  vaddr_ = vp;
+  sp_ = static_cast<char*>(vp) + size_;
+  return sp_;
+}
+
+void* LazyStack::Bottom() {
+  return static_cast<char*>(vaddr_) + page_size_;
+}
+
+void LazyStack::ReleaseUnused(void* sp) {
+  char* low = static_cast<char*>(vaddr_) + page_size_;
+  uintptr_t top = reinterpret_cast<uintptr_t>(sp) & ~(page_size_ - 1);
+  // keep the page under sp, red zone and signal frames may live there.
+  char* high = reinterpret_cast<char*>(top) - page_size_;
+  if (high <= low || high > static_cast<char*>(sp_))
+    return;
+#if defined(MADV_DONTNEED)
+  ::madvise(low, high - low, MADV_DONTNEED);
+#endif
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,64 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <windows.h>
+
+#include <memory>
+
+#include "base/basictypes.h"
+#include "base/sys_info.h"
+
+#include "tin/runtime/stack/lazy_stack.h"
+
+namespace tin {
+namespace runtime {
+
+LazyStack::LazyStack()
+  : vaddr_(NULL)
+  , size_(0)
+  , page_size_(0)
+  , sp_(NULL) {
+}
+
+LazyStack::~LazyStack() {
+  if (vaddr_ != NULL) {
+    ::VirtualFree(vaddr_, 0, MEM_RELEASE);
+  }
+}
+
+// Windows only grows the stacks of real threads through guard pages, so the
+// range is committed here and idle pages are handed back with MEM_RESET.
+void* LazyStack::Allocate(size_t size) {
+  page_size_ = base::SysInfo::PageSize();
+  size_t num_pages = (size + page_size_ - 1) / page_size_ + 1;
+  if (num_pages < 2)
+    num_pages = 2;
+  size_ = num_pages * page_size_;
+
+  void* vp = ::VirtualAlloc(0, size_, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  if (!vp)
+    throw std::bad_alloc();
+
+  DWORD old_options;
+  ::VirtualProtect(vp, page_size_, PAGE_READWRITE | PAGE_GUARD, &old_options);
+  vaddr_ = vp;
+  sp_ = static_cast<char*>(vp) + size_;
+  return sp_;
+}
+
+void* LazyStack::Bottom() {
+  return static_cast<char*>(vaddr_) + page_size_;
+}
+
+void LazyStack::ReleaseUnused(void* sp) {
+  char* low = static_cast<char*>(vaddr_) + page_size_;
+  uintptr_t top = reinterpret_cast<uintptr_t>(sp) & ~(page_size_ - 1);
+  char* high = reinterpret_cast<char*>(top) - page_size_;
+  if (high <= low || high > static_cast<char*>(sp_))
+    return;
+  ::VirtualAlloc(low, high - low, MEM_RESET, PAGE_READWRITE);
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -21,6 +21,8 @@ class ProtectedFixedSizeStack : public Stack {
 
   virtual void* Allocate(size_t size);
 
+  virtual void* Bottom();
+
  private:
   size_t size_;
   void* sp_;
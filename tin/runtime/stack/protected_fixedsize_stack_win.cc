@@ -46,5 +46,10 @@ void* ProtectedFixedSizeStack::Allocate(size_t size) {
   return sp_;
 }
 
+void* ProtectedFixedSizeStack::Bottom() {
+  // above the guard page.
+  return static_cast<char*>(sp_) - size_ + base::SysInfo::PageSize();
+}
+
 }  // namespace runtime
 }   // namespace tin
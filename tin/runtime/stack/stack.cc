@@ -7,6 +7,8 @@
 #include "base/logging.h"
 #include "tin/runtime/stack/fixedsize_stack.h"
 #include "tin/runtime/stack/protected_fixedsize_stack.h"
+#include "tin/runtime/stack/lazy_stack.h"
+#include "tin/runtime/stack/huge_page_stack.h"
 
 #include "tin/runtime/stack/stack.h"
 
@@ -22,6 +24,12 @@ Stack* NewStack(int type, int size) {
   case kProtectedFixedStack:
     stack = new ProtectedFixedSizeStack();
     break;
+  case kLazyStack:
+    stack = new LazyStack();
+    break;
+  case kHugePageStack:
+    stack = new HugePageStack();
+    break;
   default:
     LOG(FATAL) << "invalid stack type";
   }
@@ -29,5 +37,18 @@ Stack* NewStack(int type, int size) {
   return stack;
 }
 
+int StackSizeClass(int size) {
+  for (int i = 0; i < kNumStackSizeClasses; i++) {
+    if (size <= (kMinStackClassSize << i))
+      return i;
+  }
+  return -1;
+}
+
+int StackClassSize(int size_class) {
+  DCHECK(size_class >= 0 && size_class < kNumStackSizeClasses);
+  return kMinStackClassSize << size_class;
+}
+
 }  // namespace runtime
 }  // namespace tin
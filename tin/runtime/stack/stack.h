@@ -15,6 +15,12 @@ class Stack {
   virtual void* Pointer() = 0;
   virtual void* Allocate(size_t size) = 0;
 
+  // hint, physical pages below sp are not in use.
+  virtual void ReleaseUnused(void* sp) {}
+
+  // lowest usable address, above the guard page if any.
+  virtual void* Bottom() = 0;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(Stack);
 };
@@ -22,10 +28,23 @@ class Stack {
 enum StackType {
   kFixedStack = 0,
   kProtectedFixedStack = 1,
+  kLazyStack = 2,
+  // size must be IsHugePageSlotSize.
+  kHugePageStack = 3,
 };
 
 Stack* NewStack(int type, int size);
 
+// Exited greenlets are recycled together with their stacks, grouped by
+// power-of-two size classes starting at kMinStackClassSize.
+const int kMinStackClassSize = 8 * 1024;
+const int kNumStackSizeClasses = 8;  // 8 KiB ... 1 MiB.
+
+// returns -1 if size is too large to be pooled.
+int StackSizeClass(int size);
+
+int StackClassSize(int size_class);
+
 }  // namespace runtime
 }  // namespace tin
 
@@ -2,36 +2,270 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include "base/logging.h"
 #include "base/threading/platform_thread.h"
 #include "tin/sync/atomic.h"
+#include "tin/sync/pool.h"
 #include "tin/time/time.h"
 #include "tin/runtime/runtime.h"
+#include "tin/runtime/greenlet_dump.h"
+#include "tin/runtime/p.h"
 #include "tin/runtime/scheduler.h"
 #include "tin/runtime/net/netpoll.h"
+#include "tin/runtime/timer/timer_queue.h"
 
 #include "tin/runtime/sysmon.h"
 
 namespace tin {
 namespace runtime {
 
+namespace {
+// a greenlet running longer than it without rescheduling is asked to yield.
+const int64 kForcePreemptNs = 10 * tin::kMillisecond;
+// a P in syscall is retaken at the latest after it even if no one wants it.
+const int64 kSyscallRetakeNs = 10 * tin::kMillisecond;
+// sleep between two rounds, grows from min to max while idle.
+const int64 kMinDelayUs = 20;
+const int64 kMaxDelayUs = 10 * 1000;
+// idle rounds before the delay starts doubling.
+const int kIdleRoundsBeforeBackoff = 50;
+// free what tin::Pool's cache once all Ps have been idle that long.
+const int64 kPoolDrainIdleNs = 1 * tin::kSecond;
+// how often the stacks of free greenlets unused meanwhile are trimmed.
+const int64 kGFreeTrimIntervalNs = 1 * tin::kSecond;
+// how often tin::Overloaded is brought up to date.
+const int64 kOverloadIntervalNs = 10 * tin::kMillisecond;
+// how often timer lag and netpoll gaps are checked, see Config::
+// SetTimerLagWarnMs.
+const int64 kLagCheckIntervalNs = 1 * tin::kSecond;
+
+// what sysmon saw of a P last time, nothing until seen.
+struct SysMonTick {
+  bool seen;
+  uint32 sched_tick;
+  int64 sched_when;
+  uint32 syscall_tick;
+  int64 syscall_when;
+};
+
+SysMonTick sysmon_ticks[kTinProcsLimit];
+
+// only the sysmon thread writes these, so a relaxed store of the old value
+// plus one is enough. SysMonGetStats may run on any thread.
+struct SysMonCounters {
+  uintptr_t ticks;
+  uintptr_t delay_us;
+  uintptr_t syscall_retakes;
+  uintptr_t preempt_requests;
+};
+
+SysMonCounters counters;
+
+// Preempt long running greenlets and retake Ps blocked in syscalls,
+// return number of Ps retaken.
+int Retake(int64 now) {
+  int n = 0;
+  for (int i = 0; i < rtm_conf->MaxProcs(); i++) {
+    P* p = sched->Proc(i);
+    if (p == NULL) {
+      continue;
+    }
+    SysMonTick* pd = &sysmon_ticks[i];
+    if (!pd->seen) {
+      // zero ticks would look like a P stuck since sysmon started.
+      pd->seen = true;
+      pd->sched_tick = p->SchedTick();
+      pd->sched_when = now;
+      pd->syscall_tick = p->SyscallTick();
+      pd->syscall_when = now;
+      continue;
+    }
+    uint32 status = p->GetStatus();
+    if (status == kPrunning) {
+      uint32 t = p->SchedTick();
+      if (pd->sched_tick != t) {
+        pd->sched_tick = t;
+        pd->sched_when = now;
+      } else if (pd->sched_when + kForcePreemptNs <= now &&
+                 !p->PreemptRequested()) {
+        p->RequestPreempt();
+        atomic::relaxed_store(&counters.preempt_requests,
+                              counters.preempt_requests + 1);
+      }
+    } else if (status == kPsyscall) {
+      // give the syscall at least one sysmon round before retaking.
+      uint32 t = p->SyscallTick();
+      if (pd->syscall_tick != t) {
+        pd->syscall_tick = t;
+        pd->syscall_when = now;
+        continue;
+      }
+      // short calls keep their P, no handoff.
+      if (pd->syscall_when + rtm_conf->SyscallRetakeUs() * 1000LL > now) {
+        continue;
+      }
+      // shared nothing, the P waits for its M unless it is stuck.
+      if (rtm_conf->IsSharedNothingEnabled() &&
+          pd->syscall_when + kSyscallRetakeNs > now) {
+        continue;
+      }
+      // no one needs the P, unless it's been there too long.
+      if (p->RunqEmpty() &&
+          sched->NrSpinning() + sched->NrIdleP() > 0 &&
+          pd->syscall_when + kSyscallRetakeNs > now) {
+        continue;
+      }
+      if (p->CasStatus(kPsyscall, kPidle)) {
+        n++;
+        p->IncSyscallTick();
+        sched->HandoffP(p);
+      }
+    }
+  }
+  return n;
+}
+
+// the scheduling delays counted up to the last CheckOverload.
+SchedLatencyStats last_latency;
+uint32 overloaded = 0;
+
+void CheckOverload() {
+  bool over = false;
+  int depth = rtm_conf->OverloadRunqDepth();
+  int nprocs = rtm_conf->MaxProcs();
+  if (depth > 0) {
+    int64 runnable = sched->GlobalRunqSize();
+    for (int i = 0; i < nprocs; i++) {
+      P* p = sched->Proc(i);
+      if (p != NULL)
+        runnable += p->RunqSize();
+    }
+    over = runnable > static_cast<int64>(depth) * nprocs;
+  }
+  int64 target = rtm_conf->OverloadDelayUs() * 1000LL;
+  SchedLatencyStats now;
+  if (target > 0 && tin::GetSchedLatencyStats(&now)) {
+    // the interval only, the histogram counts from the start.
+    SchedLatencyStats delta = now;
+    delta.count -= last_latency.count;
+    delta.sum_ns -= last_latency.sum_ns;
+    for (int i = 0; i < kSchedLatencyBuckets; i++) {
+      delta.buckets[i] -= last_latency.buckets[i];
+    }
+    last_latency = now;
+    if (tin::SchedLatencyPercentile(delta, 0.99) > target)
+      over = true;
+  }
+  atomic::relaxed_store32(&overloaded, over ? 1 : 0);
+}
+
+// warns of the worst timer lag and netpoll gap of the last interval.
+void CheckLag() {
+  int64 lag = timer_q != NULL ? timer_q->TakeMaxLag() : 0;
+  int64 gap = sched->TakeMaxNetPollGap();
+  int lag_warn_ms = rtm_conf->TimerLagWarnMs();
+  if (lag_warn_ms > 0 && lag > lag_warn_ms * tin::kMillisecond) {
+    LOG(WARNING) << "timers fired up to " << lag / tin::kMillisecond
+                 << "ms late, their Ps and the timer_queue greenlet are "
+                 << "busy, see tin::GetTimerLagStats";
+  }
+  int gap_warn_ms = rtm_conf->NetPollGapWarnMs();
+  if (NetPollInited() && gap_warn_ms > 0 &&
+      gap > gap_warn_ms * tin::kMillisecond) {
+    LOG(WARNING) << "no netpoll for up to " << gap / tin::kMillisecond
+                 << "ms, ready descriptors waited that long, see "
+                 << "tin::GetNetPollGapStats";
+  }
+}
+}  // namespace
+
 void SysMon() {
+  int64 delay_us = 0;
+  int idle = 0;
+  // when all Ps were seen idle first, 0 while some P is busy.
+  int64 procs_idle_since = 0;
+  bool pools_drained = false;
+  int64 last_trim = MonoNow();
+  int64 last_overload_check = last_trim;
+  int64 last_lag_check = last_trim;
   while (!rtm_env->ExitFlag()) {
-    base::PlatformThread::Sleep(base::TimeDelta::FromMilliseconds(8));
+    if (idle == 0) {
+      delay_us = kMinDelayUs;
+    } else if (idle > kIdleRoundsBeforeBackoff) {
+      delay_us *= 2;
+    }
+    if (delay_us > kMaxDelayUs) {
+      delay_us = kMaxDelayUs;
+    }
+    base::PlatformThread::Sleep(base::TimeDelta::FromMicroseconds(delay_us));
+
+    int64 mono_now = MonoNow();
+    UpdateCoarseNow(mono_now);
+    PollSigquitDump();
     uint32 last_poll = sched->LastPollTime();
-    uint32 now = static_cast<uint32>(MonoNow() / tin::kMillisecond);
+    uint32 now = static_cast<uint32>(mono_now / tin::kMillisecond);
     if (now == 0)
       now = 1;
     // no worry about uint32 wrapping, it's well defined in C++ standard.
     if (NetPollInited() && last_poll != 0 && (last_poll + 10 < now)) {
       atomic::cas32(sched->MutableLastPollTime(), last_poll, now);
-      G* gp = NetPoll(false);
+      G* gp = sched->PollNet(false);
       if (gp != NULL) {
         sched->InjectGList(gp);
       }
     }
+
+    if (sched->NrIdleP() == static_cast<uint32>(rtm_conf->MaxProcs())) {
+      if (procs_idle_since == 0)
+        procs_idle_since = mono_now;
+      if (!pools_drained && mono_now - procs_idle_since >= kPoolDrainIdleNs) {
+        tin::DrainPools();
+        pools_drained = true;
+      }
+    } else {
+      procs_idle_since = 0;
+      pools_drained = false;
+    }
+
+    if (mono_now - last_overload_check >= kOverloadIntervalNs) {
+      CheckOverload();
+      last_overload_check = mono_now;
+    }
+
+    if (mono_now - last_lag_check >= kLagCheckIntervalNs) {
+      CheckLag();
+      last_lag_check = mono_now;
+    }
+
+    if (mono_now - last_trim >= kGFreeTrimIntervalNs) {
+      sched->TrimGFree();
+      last_trim = mono_now;
+    }
+
+    int retaken = Retake(MonoNow());
+    if (retaken != 0) {
+      idle = 0;
+    } else {
+      idle++;
+    }
+    atomic::relaxed_store(&counters.ticks, counters.ticks + 1);
+    atomic::relaxed_store(&counters.delay_us, delay_us);
+    atomic::relaxed_store(&counters.syscall_retakes,
+                          counters.syscall_retakes + retaken);
   }
 }
 
+void SysMonGetStats(SysMonStats* stats) {
+  stats->ticks = atomic::relaxed_load(&counters.ticks);
+  stats->delay_us = atomic::relaxed_load(&counters.delay_us);
+  stats->syscall_retakes = atomic::relaxed_load(&counters.syscall_retakes);
+  stats->preempt_requests = atomic::relaxed_load(&counters.preempt_requests);
+}
+
+bool SysMonOverloaded() {
+  return atomic::relaxed_load32(&overloaded) != 0;
+}
+
 void SysMonJoin() {
 }
 
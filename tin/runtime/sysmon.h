@@ -3,11 +3,17 @@
 // found in the LICENSE file.
 
 #pragma once
+#include "tin/runtime/runtime.h"
 
 namespace tin {
 namespace runtime {
 
 void SysMon();
 
+void SysMonGetStats(SysMonStats* stats);
+
+// see tin::Overloaded.
+bool SysMonOverloaded();
+
 }  // namespace runtime
 }  // namespace tin
@@ -4,6 +4,7 @@
 
 #include "base/bind.h"
 #include "base/callback.h"
+#include "base/logging.h"
 #include "tin/error/error.h"
 #include "tin/runtime/m.h"
 #include "tin/runtime/util.h"
@@ -20,10 +21,7 @@ GletWork::GletWork() {
 }
 
 void GletWork::Resume() {
-  {
-    SchedulerLocker guard;
-    sched->GlobalRunqPut(gp_);
-  }
+  sched->GlobalRunqPut(gp_);
   WakePIfNecessary();
 }
 
@@ -34,79 +32,176 @@ void GletWork::Finalize() {
 
 bool SubmitGletWorkUnlockF(void* arg1, void* arg2) {
   GletWork* work = static_cast<GletWork*>(arg1);
-  ThreadPoll::GetInstance()->AddWork(work);
+  ThreadPoll* pool = static_cast<ThreadPoll*>(arg2);
+  pool->AddWork(work);
   return true;
 }
 
 void SubmitGletWork(GletWork* work) {
-  Park(SubmitGletWorkUnlockF, work, NULL);
+  Park(SubmitGletWorkUnlockF, work, ThreadPoll::GetInstance(), kParkBlocking);
   SetErrorCode(TinTranslateSysError(work->LastError()));
 }
 
 void SubmitGetAddrInfoGletWork(GletWork* work) {
-  Park(SubmitGletWorkUnlockF, work, NULL);
+  Park(SubmitGletWorkUnlockF, work, ThreadPoll::GetResolverInstance(),
+       kParkBlocking);
   SetErrorCode(TinGetaddrinfoTranslateError(work->LastError()));
 }
 
+namespace {
+const int kFileMinThreads = 16;
+const int kFileMaxThreads = 128;
+const int kResolverMinThreads = 4;
+const int kResolverMaxThreads = 32;
+}  // namespace
+
 // ThreadPoll implementation.
-ThreadPoll::ThreadPoll()
-  : num_threads_(64)
-  , dry_(true, false) {
+ThreadPoll::ThreadPoll(int min_threads, int max_threads)
+  : min_threads_(min_threads)
+  , max_threads_(max_threads)
+  , workers_(max_threads, static_cast<Worker*>(NULL))
+  , num_threads_(0)
+  , next_worker_(0)
+  , pending_(0)
+  , busy_(0)
+  , idle_(0)
+  , stopping_(0)
+  , idle_cv_(&idle_lock_) {
+  for (int i = 0; i < max_threads_; ++i) {
+    workers_[i] = new Worker;
+  }
+}
+
+ThreadPoll::~ThreadPoll() {
+  for (int i = 0; i < max_threads_; ++i) {
+    delete workers_[i];
+  }
+}
+
+ThreadPoll* ThreadPoll::GetInstance() {
+  static ThreadPoll* pool = new ThreadPoll(kFileMinThreads, kFileMaxThreads);
+  return pool;
+}
+
+ThreadPoll* ThreadPoll::GetResolverInstance() {
+  static ThreadPoll* pool =
+    new ThreadPoll(kResolverMinThreads, kResolverMaxThreads);
+  return pool;
 }
 
 void ThreadPoll::Start() {
-  for (int i = 0; i < num_threads_; ++i) {
-    M* m = M::New(base::Bind(&ThreadPoll::Run, base::Unretained(this)), NULL);
-    threads_.push_back(m);
+  base::AutoLock locked(grow_lock_);
+  while (num_threads_ < min_threads_) {
+    StartWorker();
   }
 }
 
+void ThreadPoll::StartFirst() {
+  base::AutoLock locked(grow_lock_);
+  if (num_threads_ == 0)
+    StartWorker();
+}
+
+void ThreadPoll::StartWorker() {
+  int id = num_threads_;
+  // published before the thread runs, stealers may look at it right away.
+  atomic::release_store32(&num_threads_, id + 1);
+  workers_[id]->m =
+    M::New(base::Bind(&ThreadPoll::Run, base::Unretained(this), id), NULL);
+}
+
 void ThreadPoll::JoinAll() {
-  for (int i = 0; i < num_threads_; ++i) {
-    AddWork(NULL);
+  base::AutoLock grow(grow_lock_);
+  {
+    base::AutoLock locked(idle_lock_);
+    atomic::release_store32(&stopping_, 1);
+    idle_cv_.Broadcast();
   }
 
   // Join and destroy all the worker threads.
   for (int i = 0; i < num_threads_; ++i) {
-    threads_[i]->Join();
-    delete threads_[i];
+    workers_[i]->m->Join();
+    delete workers_[i]->m;
+    workers_[i]->m = NULL;
   }
-  threads_.clear();
+  atomic::release_store32(&num_threads_, 0);
 }
 
 void ThreadPoll::AddWork(Work* work) {
-  base::AutoLock locked(lock_);
-  tasks_.push_back(work);
-  // If we were empty, signal that we have work now.
-  if (!dry_.IsSignaled())
-    dry_.Signal();
+  int n = NumThreads();
+  DCHECK(n > 0) << "ThreadPoll::AddWork before Start";
+  uint32 i = atomic::Inc32(&next_worker_, 1);
+  Worker* w = workers_[i % n];
+  {
+    base::AutoLock locked(w->lock);
+    w->tasks.push_back(work);
+  }
+  // full barrier, pairs with the recheck of a worker going idle.
+  atomic::Inc32(&pending_, 1);
+  if (atomic::load32(&idle_) > 0) {
+    base::AutoLock locked(idle_lock_);
+    idle_cv_.Signal();
+    return;
+  }
+  MaybeGrow();
+}
+
+void ThreadPoll::MaybeGrow() {
+  if (NumThreads() >= max_threads_ ||
+      atomic::load32(&busy_) < NumThreads()) {
+    return;
+  }
+  // all workers are stuck in a work, add one.
+  base::AutoLock locked(grow_lock_);
+  if (atomic::load32(&stopping_) == 0 && num_threads_ < max_threads_ &&
+      atomic::load32(&busy_) >= num_threads_) {
+    StartWorker();
+  }
 }
 
-// consider replace with conditional variable.
-void ThreadPoll::Run() {
-  Work* work = NULL;
+Work* ThreadPoll::NextWork(int id) {
+  Worker* own = workers_[id];
+  {
+    base::AutoLock locked(own->lock);
+    if (!own->tasks.empty()) {
+      Work* work = own->tasks.front();
+      own->tasks.pop_front();
+      return work;
+    }
+  }
+  int n = NumThreads();
+  for (int i = 1; i < n; ++i) {
+    Worker* victim = workers_[(id + i) % n];
+    base::AutoLock locked(victim->lock);
+    if (!victim->tasks.empty()) {
+      Work* work = victim->tasks.back();
+      victim->tasks.pop_back();
+      return work;
+    }
+  }
+  return NULL;
+}
 
+void ThreadPoll::Run(int id) {
   while (true) {
-    dry_.Wait();
-    {
-      base::AutoLock locked(lock_);
-      if (!dry_.IsSignaled())
-        continue;
-
-      DCHECK(!tasks_.empty());
-      work = tasks_.front();
-      tasks_.pop_front();
-
-      // Signal to any other threads that we're currently out of work.
-      if (tasks_.empty())
-        dry_.Reset();
+    Work* work = NextWork(id);
+    if (work != NULL) {
+      atomic::Inc32(&pending_, -1);
+      atomic::Inc32(&busy_, 1);
+      work->Run();
+      atomic::Inc32(&busy_, -1);
+      continue;
     }
 
-    // A NULL delegate pointer signals us to quit.
-    if (!work)
+    base::AutoLock locked(idle_lock_);
+    if (atomic::load32(&stopping_) != 0)
       break;
-
-    work->Run();
+    // full barrier, then look again so that a work added meanwhile is
+    // not missed.
+    atomic::Inc32(&idle_, 1);
+    if (atomic::load32(&pending_) == 0)
+      idle_cv_.Wait();
+    atomic::Inc32(&idle_, -1);
   }
 }
 
@@ -8,10 +8,10 @@
 #include <deque>
 
 #include "base/basictypes.h"
-#include "base/memory/singleton.h"
 #include "base/synchronization/lock.h"
 #include "base/synchronization/waitable_event.h"
 #include "base/synchronization/condition_variable.h"
+#include "tin/sync/atomic.h"
 #include "tin/runtime/env.h"
 
 namespace tin {
@@ -48,25 +48,70 @@ class GletWork : public Work {
 void SubmitGletWork(GletWork* work);
 void SubmitGetAddrInfoGletWork(GletWork* work);
 
+// blocking work runs on pools of OS threads. every worker owns a deque
+// and steals from the others when it runs dry, so workers don't contend
+// on one lock. the pool grows up to max_threads while all workers are
+// busy, e.g. stuck in slow disk reads.
 class ThreadPoll {
  public:
-  ThreadPoll();
+  ThreadPoll(int min_threads, int max_threads);
+  ~ThreadPoll();
 
-  static ThreadPoll* GetInstance() {
-    return Singleton<ThreadPoll>::get();
-  }
+  // file operations.
+  static ThreadPoll* GetInstance();
+  // getaddrinfo, apart from file operations so a slow disk does not hold
+  // up name lookups.
+  static ThreadPoll* GetResolverInstance();
 
   void Start();
+  // one worker only, so the pool takes work. Start adds the rest later.
+  void StartFirst();
   void JoinAll();
   void AddWork(Work* work);
-  void Run();
+
+  int NumThreads() const {
+    return atomic::acquire_load32(&num_threads_);
+  }
+
+  // works queued and not yet taken.
+  int Pending() const {
+    return atomic::relaxed_load32(&pending_);
+  }
 
  private:
-  int num_threads_;
-  std::vector<M*> threads_;
-  std::deque<Work*> tasks_;
-  base::Lock lock_;
-  base::WaitableEvent dry_;
+  struct Worker {
+    Worker()
+      : m(NULL) {
+    }
+
+    base::Lock lock;
+    std::deque<Work*> tasks;
+    M* m;
+  };
+
+  void Run(int id);
+  // own work first from the front, then steal from the back of others.
+  Work* NextWork(int id);
+  // grow_lock_ must be held.
+  void StartWorker();
+  void MaybeGrow();
+
+  const int min_threads_;
+  const int max_threads_;
+  // workers_[0, num_threads_) are running, slots never move.
+  std::vector<Worker*> workers_;
+  int32 num_threads_;
+  uint32 next_worker_;
+  // queued works not yet taken.
+  int32 pending_;
+  // workers running a work.
+  int32 busy_;
+  // workers waiting on idle_cv_, changed under idle_lock_.
+  int32 idle_;
+  int32 stopping_;
+  base::Lock idle_lock_;
+  base::ConditionVariable idle_cv_;
+  base::Lock grow_lock_;
   DISALLOW_COPY_AND_ASSIGN(ThreadPoll);
 };
 
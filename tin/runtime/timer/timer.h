@@ -0,0 +1,71 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include <string.h>
+
+#include "base/basictypes.h"
+
+namespace tin {
+namespace runtime {
+
+typedef void (*TimerCallback)(void* arg, uintptr_t seq);
+
+struct Timer;
+class TimerBucket;
+
+// children of a heap node, the heap of a bucket is 4-ary so it is half as
+// deep as a binary one.
+const int kTimerHeapArity = 4;
+
+// position of a timer in the heap of its bucket.
+struct TimerHeapLink {
+  Timer* parent;
+  Timer* child[kTimerHeapArity];
+};
+
+// Timers are intrusive, the heap and wheel links live in the timer itself so
+// adding one never allocates. A timer is embedded in its owner, see
+// Greenlet::GetTimer and PollDescriptor.
+struct Timer {
+  Timer() {
+    memset(&heap, 0, sizeof(heap));
+    when = period = 0;
+    seq = 0;
+    f = NULL;
+    arg = 0;
+    slack = 0;
+    coarse = false;
+    in_wheel = false;
+    level = 0;
+    next = NULL;
+    pprev = NULL;
+    bucket = NULL;
+  }
+
+  // heap links, valid if pending and not in_wheel. next to when so a sift
+  // reads one cache line per timer.
+  TimerHeapLink heap;
+  int64 when;
+  int64 period;
+  uintptr_t seq;
+  TimerCallback f;
+  void* arg;
+  // may fire up to slack nano seconds after when, so that timers due at
+  // about the same time expire together.
+  int64 slack;
+  // kept in a timing wheel, fires up to kTimerWheelTick late.
+  bool coarse;
+  // timing wheel links, valid if in_wheel.
+  bool in_wheel;
+  int level;
+  Timer* next;
+  Timer** pprev;
+  // bucket the timer is pending in, NULL if none.
+  TimerBucket* bucket;
+};
+
+}  // namespace runtime
+}  // namespace tin
@@ -9,6 +9,9 @@
 #include "tin/runtime/runtime.h"
 #include "tin/runtime/scheduler.h"
 #include "tin/runtime/greenlet.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/net/netpoll.h"
 
 #include "tin/runtime/timer/timer_queue.h"
 
@@ -21,20 +24,100 @@ void WakeupSleeperFn(void* arg, uintptr_t seq) {
   Ready(gp);
 }
 
+namespace {
+// how long the timer_queue greenlet leaves expired timers of a running P
+// to its owner.
+const int64 kOwnerFireGrace = 1000 * 1000;  // 1ms
+
+// the largest lag of a timer fired since TakeMaxLag.
+uintptr_t lag_max = 0;
+
+void UpdateMaxLag(int64 lag) {
+  uintptr_t v = static_cast<uintptr_t>(lag);
+  uintptr_t old = atomic::relaxed_load(&lag_max);
+  while (v > old && !atomic::cas(&lag_max, old, v)) {
+    old = atomic::relaxed_load(&lag_max);
+  }
+}
+
+// rounds when up to the largest power of 2 nano seconds not above slack.
+int64 CoalesceWhen(int64 when, int64 slack) {
+  if (slack <= 0) {
+    return when;
+  }
+  int64 gran = 1;
+  while (gran <= slack / 2) {
+    gran <<= 1;
+  }
+  if (when > kint64max - gran) {
+    return when;
+  }
+  return (when + gran - 1) & ~(gran - 1);
+}
+
+// runs fired callbacks, sleepers are made ready as one batch.
+void RunFired(std::vector<FiredTimer>* fired) {
+  G* ghead = NULL;
+  G* gtail = NULL;
+  int32 n = 0;
+  for (size_t i = 0; i < fired->size(); i++) {
+    FiredTimer& ft = (*fired)[i];
+    if (ft.f != WakeupSleeperFn) {
+      ft.f(ft.arg, ft.seq);
+      continue;
+    }
+    G* gp = static_cast<G*>(ft.arg);
+    gp->SetSchedLink(NULL);
+    if (gtail == NULL) {
+      ghead = gp;
+    } else {
+      gtail->SetSchedLink(gp);
+    }
+    gtail = gp;
+    n++;
+  }
+  ReadyBatch(ghead, n);
+  fired->clear();
+}
+
+// a sleeper is only woken early if its timer did not fire yet.
+void CancelSleepFn(void* arg, uintptr_t data) {
+  Timer* t = static_cast<Timer*>(arg);
+  if (timer_q->DelTimer(t))
+    Ready(reinterpret_cast<G*>(data));
+}
+}  // namespace
+
 void InternalNanoSleep(int64 ns) {
+  InternalNanoSleep(ns, 0);
+}
+
+void InternalNanoSleep(int64 ns, int64 slack) {
   G* gp = GetG();
   Timer* t = gp->GetTimer();
   t->when = MonoNow() + ns;
+  t->slack = slack;
   t->f = WakeupSleeperFn;
   t->arg = gp;
 
-  timer_q->Lock();
-  timer_q->AddTimerLocked(t);
-  Park(TimerQueue::UnlockQueue, timer_q, 0);
+  TimerBucket* bucket = timer_q->LockBucket();
+  timer_q->AddTimerLocked(bucket, t);
+  // registered with the timer pending, CancelSleepFn waits for the bucket
+  // lock so it finds us parked.
+  if (!gp->BeginCancelable(CancelSleepFn, t,
+                           reinterpret_cast<uintptr_t>(gp))) {
+    bucket->Del(t);
+    bucket->Unlock();
+    gp->SetErrorCode(gp->InterruptError());
+    return;
+  }
+  Park(TimerQueue::UnlockBucket, bucket, 0, kParkTimer);
+  if (gp->EndCancelable())
+    gp->SetErrorCode(gp->InterruptError());
 }
 
 int64 NanoFromNow(int64 deadline) {
-  int64 now = MonoNow();
+  int64 now = DeadlineNow();
   int64 when = now + deadline;
   // if infinite or int64 overflow
   if (deadline == -1 || (now > kint64max - deadline)) {
@@ -43,188 +126,469 @@ int64 NanoFromNow(int64 deadline) {
   return when;
 }
 
+TimerBucket::TimerBucket()
+  : heap_min_(NULL)
+  , heap_count_(0)
+  , armed_when_(kint64max)
+  , pending_(0) {
+  for (int i = 0; i < kLatencyHistogramSize; i++) {
+    lag_[i] = 0;
+  }
+}
+
+TimerBucket::~TimerBucket() {
+}
+
+bool TimerBucket::Add(Timer* t) {
+  if (t->when < 0) {
+    t->when = kint64max;
+  }
+  t->when = CoalesceWhen(t->when, t->slack);
+  atomic::release_store(reinterpret_cast<volatile uintptr_t*>(&t->bucket),
+                        reinterpret_cast<uintptr_t>(this));
+  atomic::relaxed_store32(&pending_, pending_ + 1);
+  // slack of a tick or more does not need the precision of the heap.
+  t->in_wheel = t->coarse || t->slack >= kTimerWheelTick;
+  if (t->in_wheel) {
+    wheel_.Add(t);
+  } else {
+    HeapInsert(t);
+  }
+  if (t->when < armed_when_) {
+    armed_when_ = t->when;
+    return true;
+  }
+  return false;
+}
+
+void TimerBucket::Del(Timer* t) {
+  atomic::release_store(reinterpret_cast<volatile uintptr_t*>(&t->bucket), 0);
+  atomic::relaxed_store32(&pending_, pending_ - 1);
+  if (t->in_wheel) {
+    wheel_.Del(t);
+    return;
+  }
+  HeapRemove(t);
+}
+
+bool TimerBucket::Extend(Timer* t, int64 when, uintptr_t seq) {
+  if (!t->in_wheel || when < t->when) {
+    return false;
+  }
+  t->when = when;
+  t->seq = seq;
+  return true;
+}
+
+void TimerBucket::Fire(Timer* t, int64 now, std::vector<FiredTimer>* fired) {
+  // save fields before unlock.
+  FiredTimer ft = {t->f, t->arg, t->seq};
+  fired->push_back(ft);
+  // late by a busy owner or timer_queue greenlet, or a wheel slot.
+  int64 lag = now - t->when;
+  RecordLatency(lag_, lag);
+  if (lag > 0) {
+    UpdateMaxLag(lag);
+  }
+  if (t->period > 0) {
+    t->when += t->period * (1 + (now - t->when) / t->period);
+    Add(t);
+  }
+}
+
+void TimerBucket::PopExpired(int64 now, std::vector<FiredTimer>* fired) {
+  while (heap_min_ != NULL && heap_min_->when <= now) {
+    Timer* t = heap_min_;
+    Del(t);
+    Fire(t, now, fired);
+  }
+
+  Timer* t = wheel_.Advance(now);
+  while (t != NULL) {
+    Timer* next = t->next;
+    t->next = NULL;
+    if (t->when > now) {
+      // later within the same tick or extended.
+      wheel_.Add(t);
+    } else {
+      atomic::release_store(
+          reinterpret_cast<volatile uintptr_t*>(&t->bucket), 0);
+      atomic::relaxed_store32(&pending_, pending_ - 1);
+      Fire(t, now, fired);
+    }
+    t = next;
+  }
+}
+
+int64 TimerBucket::Arm() {
+  armed_when_ = wheel_.NextExpiry();
+  if (heap_min_ != NULL && heap_min_->when < armed_when_) {
+    armed_when_ = heap_min_->when;
+  }
+  return armed_when_;
+}
+
+Timer** TimerBucket::HeapSlot(uint32 i, Timer** parent) {
+  // the child slots on the way up from i, in base 4.
+  int way[16];
+  int depth = 0;
+  for (; i > 0; i = (i - 1) / kTimerHeapArity) {
+    way[depth++] = (i - 1) % kTimerHeapArity;
+  }
+  Timer** slot = &heap_min_;
+  *parent = NULL;
+  while (depth > 0) {
+    *parent = *slot;
+    slot = &(*slot)->heap.child[way[--depth]];
+  }
+  return slot;
+}
+
+Timer** TimerBucket::HeapLinkTo(Timer* t) {
+  Timer* parent = t->heap.parent;
+  if (parent == NULL) {
+    return &heap_min_;
+  }
+  int k = 0;
+  while (parent->heap.child[k] != t) {
+    k++;
+  }
+  return &parent->heap.child[k];
+}
+
+void TimerBucket::HeapInsert(Timer* t) {
+  Timer* parent;
+  Timer** slot = HeapSlot(heap_count_, &parent);
+  memset(&t->heap, 0, sizeof(t->heap));
+  t->heap.parent = parent;
+  *slot = t;
+  heap_count_++;
+  HeapSiftUp(t);
+}
+
+void TimerBucket::HeapRemove(Timer* t) {
+  Timer** link = HeapLinkTo(t);
+  Timer* parent;
+  heap_count_--;
+  Timer** slot = HeapSlot(heap_count_, &parent);
+  Timer* last = *slot;
+  *slot = NULL;
+  if (last != t) {
+    // the last node takes the place of t and sifts from there.
+    last->heap = t->heap;
+    for (int k = 0; k < kTimerHeapArity; k++) {
+      if (last->heap.child[k] != NULL) {
+        last->heap.child[k]->heap.parent = last;
+      }
+    }
+    *link = last;
+    HeapSiftDown(last);
+    HeapSiftUp(last);
+  }
+  memset(&t->heap, 0, sizeof(t->heap));
+}
+
+void TimerBucket::HeapSiftUp(Timer* t) {
+  while (t->heap.parent != NULL && t->when < t->heap.parent->when) {
+    HeapSwap(t->heap.parent, t);
+  }
+}
+
+void TimerBucket::HeapSiftDown(Timer* t) {
+  while (true) {
+    Timer* min = t;
+    for (int k = 0; k < kTimerHeapArity; k++) {
+      Timer* c = t->heap.child[k];
+      if (c == NULL) {
+        // filled in level order, the rest is empty too.
+        break;
+      }
+      if (c->when < min->when) {
+        min = c;
+      }
+    }
+    if (min == t) {
+      break;
+    }
+    HeapSwap(t, min);
+  }
+}
+
+void TimerBucket::HeapSwap(Timer* parent, Timer* child) {
+  Timer** link = HeapLinkTo(parent);
+  TimerHeapLink saved = parent->heap;
+  parent->heap = child->heap;
+  child->heap = saved;
+  parent->heap.parent = child;
+  for (int k = 0; k < kTimerHeapArity; k++) {
+    if (child->heap.child[k] == child) {
+      child->heap.child[k] = parent;
+    } else if (child->heap.child[k] != NULL) {
+      child->heap.child[k]->heap.parent = child;
+    }
+    if (parent->heap.child[k] != NULL) {
+      parent->heap.child[k]->heap.parent = parent;
+    }
+  }
+  *link = child;
+}
+
 TimerQueue::TimerQueue()
   : gp_(NULL)
   , created_(false)
   , rescheduling_(false)
   , sleeping_(false)
+  , kicked_(false)
+  , poll_until_(0)
+  , buckets_(new TimerBucket*[kTinProcsLimit + 1])
   , exit_flag_(false) {
+  for (int i = 0; i <= kTinProcsLimit; i++) {
+    buckets_[i] = NULL;
+  }
 }
 
 TimerQueue::~TimerQueue() {
+  for (int i = 0; i <= kTinProcsLimit; i++) {
+    delete buckets_[i];
+  }
+  delete [] buckets_;
+}
+
+TimerBucket* TimerQueue::CurrentBucket() {
+  int id = kTinProcsLimit;
+  G* gp = GetG();
+  if (gp != NULL && gp->M() != NULL && gp->M()->P() != NULL) {
+    id = gp->M()->P()->Id();
+  }
+  volatile uintptr_t* slot =
+      reinterpret_cast<volatile uintptr_t*>(&buckets_[id]);
+  TimerBucket* bucket =
+      reinterpret_cast<TimerBucket*>(atomic::acquire_load(slot));
+  if (bucket != NULL) {
+    return bucket;
+  }
+  TimerBucket* fresh = new TimerBucket;
+  if (atomic::release_cas(slot, 0, reinterpret_cast<uintptr_t>(fresh))) {
+    return fresh;
+  }
+  delete fresh;
+  return reinterpret_cast<TimerBucket*>(atomic::acquire_load(slot));
 }
 
 void TimerQueue::AddTimer(Timer* t) {
   LOG_IF(FATAL, t->f == NULL) << "timer fn must not be NULL";
-  RawMutexGuard guard(&mutex_);
-  AddTimerLocked(t);
+  TimerBucket* bucket = LockBucket();
+  AddTimerLocked(bucket, t);
+  bucket->Unlock();
 }
 
-void TimerQueue::AddTimerLocked(Timer* t) {
-  if (t->when < 0) {
-    t->when = kint64max;
+TimerBucket* TimerQueue::LockBucket() {
+  TimerBucket* bucket = CurrentBucket();
+  bucket->Lock();
+  return bucket;
+}
+
+void TimerQueue::AddTimerLocked(TimerBucket* bucket, Timer* t) {
+  if (bucket->Add(t)) {
+    // due before the timer_queue greenlet wakes up.
+    Kick();
   }
+}
 
-  t->i = Length();
-  timers_.push_back(t);
-  SiftUp(t->i);
-  if (t->i == 0) {
-    if (sleeping_) {
-      sleeping_ = false;
-      wait_note_.Wakeup();
-    }
-    if (rescheduling_) {
-      rescheduling_ = false;
-      Ready(gp_);
+TimerBucket* TimerQueue::LockTimerBucket(Timer* t) {
+  volatile uintptr_t* slot =
+      reinterpret_cast<volatile uintptr_t*>(&t->bucket);
+  while (true) {
+    TimerBucket* bucket =
+        reinterpret_cast<TimerBucket*>(atomic::acquire_load(slot));
+    if (bucket == NULL) {
+      return NULL;
     }
-    if (!created_) {
-      created_ = true;
-      SpawnSimple(base::Bind(&TimerQueue::Proc, base::Unretained(this)),
-                  "timer_queue");
-      wait_group_.Add(1);
+    bucket->Lock();
+    // the timer may have fired or moved before we got the lock.
+    if (t->bucket == bucket) {
+      return bucket;
     }
+    bucket->Unlock();
   }
 }
 
 bool TimerQueue::DelTimer(Timer* t) {
-  RawMutexGuard guard(&mutex_);
-  int i = t->i;
-  int last = Length() - 1;
-  if (i < 0 || i > last || timers_[i] != t) {
+  TimerBucket* bucket = LockTimerBucket(t);
+  if (bucket == NULL) {
     return false;
   }
-  if (i != last) {
-    timers_[i] = timers_[last];
-    timers_[i]->i = i;
-  }
-  timers_.pop_back();
-  if (i != last) {
-    SiftUp(i);
-    SiftDown(i);
-  }
+  bucket->Del(t);
+  bucket->Unlock();
   return true;
 }
 
-void TimerQueue::Lock() {
-  mutex_.Lock();
+bool TimerQueue::ExtendTimer(Timer* t, int64 when, uintptr_t seq) {
+  TimerBucket* bucket = LockTimerBucket(t);
+  if (bucket == NULL) {
+    return false;
+  }
+  bool extended = bucket->Extend(t, when, seq);
+  bucket->Unlock();
+  return extended;
 }
 
-bool TimerQueue::UnlockQueue(void* arg1, void* arg2) {
-  TimerQueue* self = static_cast<TimerQueue*>(arg1);
-  self->mutex_.Unlock();
+bool TimerQueue::UnlockBucket(void* arg1, void* arg2) {
+  TimerBucket* bucket = static_cast<TimerBucket*>(arg1);
+  bucket->Unlock();
   return true;
 }
 
-void TimerQueue::SiftUp(int i) {
-  int64 when = timers_[i]->when;
-  Timer* tmp = timers_[i];
-  while (i > 0) {
-    int p = (i - 1) / 4;  // parent.
-    if (when >= timers_[p]->when) {
-      break;
+void TimerQueue::GetLagStats(SchedLatencyStats* stats) {
+  for (int i = 0; i <= kTinProcsLimit; i++) {
+    TimerBucket* bucket = reinterpret_cast<TimerBucket*>(
+        atomic::acquire_load(
+            reinterpret_cast<volatile uintptr_t*>(&buckets_[i])));
+    if (bucket != NULL) {
+      bucket->Lock();
+      bucket->AddLag(stats);
+      bucket->Unlock();
     }
-    timers_[i] = timers_[p];
-    timers_[i]->i = i;
-    timers_[p] = tmp;
-    timers_[p]->i = p;
-    i = p;
   }
 }
 
-void TimerQueue::SiftDown(int i) {
-  int n = Length();
-  int64 when = timers_[i]->when;
-  Timer* tmp = timers_[i];
-  while (true) {
-    int c = i * 4 + 1;  // left child
-    int c3 = c + 2;  // mid child
-    if (c >= n) {
-      break;
-    }
-    int64 w = timers_[c]->when;
-    if (c + 1 < n && timers_[c + 1]->when < w) {
-      w = timers_[c + 1]->when;
-      c++;
-    }
-    if (c3 < n) {
-      int64 w3 = timers_[c3]->when;
-      if (c3 + 1 < n && timers_[c3 + 1]->when < w3) {
-        w3 = timers_[c3 + 1]->when;
-        c3++;
-      }
-      if (w3 < w) {
-        w = w3;
-        c = c3;
-      }
-    }
-    if (w >= when) {
-      break;
+int64 TimerQueue::TakeMaxLag() {
+  return static_cast<int64>(atomic::exchange(&lag_max, 0));
+}
+
+int32 TimerQueue::NumTimers() {
+  int32 n = 0;
+  for (int i = 0; i <= kTinProcsLimit; i++) {
+    TimerBucket* bucket = reinterpret_cast<TimerBucket*>(
+        atomic::acquire_load(
+            reinterpret_cast<volatile uintptr_t*>(&buckets_[i])));
+    if (bucket != NULL) {
+      n += bucket->Pending();
     }
-    timers_[i] = timers_[c];
-    timers_[i]->i = i;
-    timers_[c] = tmp;
-    timers_[c]->i = c;
-    i = c;
+  }
+  return n;
+}
+
+void TimerQueue::CheckTimers(P* p) {
+  TimerBucket* bucket = reinterpret_cast<TimerBucket*>(
+      atomic::acquire_load(
+          reinterpret_cast<volatile uintptr_t*>(&buckets_[p->Id()])));
+  if (bucket == NULL || bucket->Pending() == 0) {
+    return;
+  }
+  std::vector<FiredTimer>* fired = bucket->LocalFired();
+  bucket->Lock();
+  bucket->PopExpired(MonoNow(), fired);
+  bucket->Unlock();
+  RunFired(fired);
+}
+
+void TimerQueue::Kick() {
+  RawMutexGuard guard(&mutex_);
+  if (!created_) {
+    created_ = true;
+    SpawnSimple(base::Bind(&TimerQueue::Proc, base::Unretained(this)),
+                "timer_queue");
+    wait_group_.Add(1);
+  } else if (sleeping_) {
+    sleeping_ = false;
+    wait_note_.Wakeup();
+  } else if (rescheduling_) {
+    rescheduling_ = false;
+    atomic::relaxed_store(&poll_until_, 0);
+    Ready(gp_);
+  } else {
+    kicked_ = true;
+  }
+}
+
+void TimerQueue::WakeIfDue(int64 now) {
+  int64 until = PollUntil();
+  if (until == 0)
+    return;
+  if (now == 0)
+    now = MonoNow();
+  if (now < until)
+    return;
+  RawMutexGuard guard(&mutex_);
+  // Kick may have readied it meanwhile.
+  if (rescheduling_ && poll_until_ != 0 && now >= poll_until_) {
+    rescheduling_ = false;
+    atomic::relaxed_store(&poll_until_, 0);
+    Ready(gp_);
   }
 }
 
 void TimerQueue::Proc() {
   gp_ = GetG();
   while (true) {
-    mutex_.Lock();
-    sleeping_ = false;
     int64 now = MonoNow();
-    int64 delta = -1;
-    bool oneshot;
-    (void)oneshot;
-    while (!exit_flag_) {
-      if (timers_.empty()) {
-        delta = -1;
-        break;
+    int64 next = kint64max;
+    for (int i = 0; i <= kTinProcsLimit; i++) {
+      TimerBucket* bucket = reinterpret_cast<TimerBucket*>(
+          atomic::acquire_load(
+              reinterpret_cast<volatile uintptr_t*>(&buckets_[i])));
+      if (bucket == NULL) {
+        continue;
       }
-
-      Timer* t = timers_[0];
-      delta = t->when - now;
-      if (delta > 0)
-        break;
-      if (t->period > 0) {
-        t->when += t->period * (1 + -delta / t->period);
-        SiftDown(0);
-        oneshot = false;
-      } else {
-        // oneshot timer.
-        int last = Length() - 1;
-        if (last > 0) {
-          timers_[0] = timers_[last];
-          timers_[0]->i = 0;
-        }
-        timers_.pop_back();
-        if (last > 0) {
-          SiftDown(0);
-        }
-        t->i = -1;
-        oneshot = true;
+      // a running P fires its own timers from the scheduler.
+      int64 grace = 0;
+      P* p = sched->Proc(i);
+      if (p != NULL && p->GetStatus() == kPrunning) {
+        grace = kOwnerFireGrace;
+      }
+      bucket->Lock();
+      bucket->PopExpired(now - grace, &fired_);
+      int64 when = bucket->Arm();
+      bucket->Unlock();
+      if (when != kint64max) {
+        when += grace;
+      }
+      if (when < next) {
+        next = when;
       }
-      // save fields before unlock.
-      TimerCallback fired_f = t->f;
-      void* fired_arg = t->arg;
-      uintptr_t fired_seq = t->seq;
+      RunFired(&fired_);
+    }
 
+    mutex_.Lock();
+    if (exit_flag_) {
       mutex_.Unlock();
-      fired_f(fired_arg, fired_seq);
-      mutex_.Lock();
+      break;
     }
-
-    if (delta < 0) {
+    if (kicked_) {
+      // a timer was added while we were scanning.
+      kicked_ = false;
+      mutex_.Unlock();
+      continue;
+    }
+    if (next == kint64max) {
       // No timers left - put goroutine to sleep.
       rescheduling_ = true;
-      ParkUnlock(&mutex_);
+      ParkUnlock(&mutex_, kParkTimer);
+      continue;
+    }
+#if defined(ARCH_CPU_64_BITS)
+    if (NetPollInited()) {
+      // parked, the M blocked in netpoll or the next scheduling round
+      // readies us, see WakeIfDue.
+      rescheduling_ = true;
+      // a full barrier, see Scheduler::FindRunnableImpl.
+      atomic::exchange(&poll_until_, static_cast<intptr_t>(next));
+      sched->WakeNetPoller(next);
+      ParkUnlock(&mutex_, kParkTimer);
       continue;
     }
+#endif
     sleeping_ = true;
     wait_note_.Clear();
     mutex_.Unlock();
-    wait_note_.TimedSleepG(delta);
+    int64 delta = next - MonoNow();
+    if (delta > 0) {
+      wait_note_.TimedSleepG(delta);
+    }
+    mutex_.Lock();
+    sleeping_ = false;
+    mutex_.Unlock();
   }
   wait_group_.Done();
 }
@@ -239,6 +603,7 @@ void TimerQueue::Join() {
     }
     if (rescheduling_) {
       rescheduling_ = false;
+      atomic::relaxed_store(&poll_until_, 0);
       Ready(gp_);
     }
   }
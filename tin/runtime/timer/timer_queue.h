@@ -6,67 +6,162 @@
 #include <vector>
 
 #include "base/synchronization/waitable_event.h"
+#include "build/build_config.h"
 
 #include "tin/time/time.h"
 #include "tin/sync/wait_group.h"
+#include "tin/sync/atomic.h"
 #include "tin/runtime/util.h"
 #include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/timer/timer.h"
+#include "tin/runtime/timer/timer_wheel.h"
 
 namespace tin {
 namespace runtime {
 
 void InternalNanoSleep(int64 ns);
-
-typedef void (*TimerCallback)(void* arg, uintptr_t seq);
+// the wakeup may come up to slack nano seconds late.
+void InternalNanoSleep(int64 ns, int64 slack);
 
 int64 NanoFromNow(int64 deadline);
 
-struct Timer {
-  Timer() {
-    i = 0;
-    when = period = 0;
-    seq = 0;
-    f = NULL;
-    arg = 0;
-  }
-
-  int i;
-  int64 when;
-  int64 period;
-  uintptr_t seq;
+struct FiredTimer {
   TimerCallback f;
   void* arg;
+  uintptr_t seq;
+};
+
+// Pending timers of one P, precise ones in a 4-ary heap linked through
+// the timers and coarse ones in a timing wheel. All methods but Lock need
+// the lock held.
+class TimerBucket {
+ public:
+  TimerBucket();
+  ~TimerBucket();
+
+  void Lock() {
+    mutex_.Lock();
+  }
+
+  void Unlock() {
+    mutex_.Unlock();
+  }
+
+  // returns true if t is due before the time the bucket was armed for.
+  bool Add(Timer* t);
+  void Del(Timer* t);
+  // moves a pending coarse timer later without relinking it, it is
+  // rescheduled when its old slot expires.
+  bool Extend(Timer* t, int64 when, uintptr_t seq);
+  // collects expired timers, reschedules the periodic ones.
+  void PopExpired(int64 now, std::vector<FiredTimer>* fired);
+  // returns the earliest time a timer may fire and arms the bucket for it.
+  int64 Arm();
+
+  // may be read without the lock.
+  int32 Pending() const {
+    return atomic::relaxed_load32(&pending_);
+  }
+
+  // scratch of the owning P, see TimerQueue::CheckTimers.
+  std::vector<FiredTimer>* LocalFired() {
+    return &local_fired_;
+  }
+
+  // adds how late the timers of the bucket fired.
+  void AddLag(SchedLatencyStats* stats) const {
+    AddLatency(lag_, stats);
+  }
+
+ private:
+  void Fire(Timer* t, int64 now, std::vector<FiredTimer>* fired);
+  void HeapInsert(Timer* t);
+  void HeapRemove(Timer* t);
+  void HeapSiftDown(Timer* t);
+  void HeapSiftUp(Timer* t);
+  // swaps child and its parent in the tree.
+  void HeapSwap(Timer* parent, Timer* child);
+  // the link to the i-th node, counted from 0 in level order.
+  Timer** HeapSlot(uint32 i, Timer** parent);
+  // the link of its parent to t.
+  Timer** HeapLinkTo(Timer* t);
+
+  RawMutex mutex_;
+  Timer* heap_min_;
+  uint32 heap_count_;
+  TimerWheel wheel_;
+  int64 armed_when_;
+  int32 pending_;
+  std::vector<FiredTimer> local_fired_;
+  // now minus when of the timers fired, see RecordLatency.
+  uint64 lag_[kLatencyHistogramSize];
+  DISALLOW_COPY_AND_ASSIGN(TimerBucket);
 };
 
+// Timers are kept in per-P buckets so adding and removing them only takes
+// the lock of one bucket. The scheduler fires the expired timers of its P so
+// woken greenlets land on the local runq, the timer_queue greenlet sleeps
+// until the earliest armed bucket and fires what the owners did not in
+// time, and everything of idle Ps and threads without a P.
 class TimerQueue {
  public:
   TimerQueue();
   ~TimerQueue();
 
-  void AddTimerLocked(Timer* t);
   void AddTimer(Timer* t);
   bool DelTimer(Timer* t);
-  void Lock();
+  // lazily moves a pending coarse timer to a later when, returns false if
+  // the caller has to DelTimer and AddTimer instead.
+  bool ExtendTimer(Timer* t, int64 when, uintptr_t seq);
+  // locks and returns the bucket of the current P.
+  TimerBucket* LockBucket();
+  void AddTimerLocked(TimerBucket* bucket, Timer* t);
   void Join();
-  static bool UnlockQueue(void* arg1, void* arg2);
+  static bool UnlockBucket(void* arg1, void* arg2);
+  // fires the expired timers of p, called on g0 by the M holding p.
+  void CheckTimers(P* p);
+  // timers pending over all buckets, without locking them.
+  int32 NumTimers();
+
+  // how late timers fired, merged over the buckets, see GetTimerLagStats.
+  void GetLagStats(SchedLatencyStats* stats);
+  // the largest lag since the last call, for sysmon.
+  int64 TakeMaxLag();
+
+  // while the timer_queue greenlet leaves waking it to the M blocked in
+  // netpoll, the time it wants to run again, 0 else. then the poll waits
+  // for IO and timers at once.
+  int64 PollUntil() const {
+#if defined(ARCH_CPU_64_BITS)
+    return atomic::relaxed_load(&poll_until_);
+#else
+    return 0;
+#endif
+  }
+
+  // readies the timer_queue greenlet once PollUntil has passed, needs a P.
+  // now is read only if there is something to check.
+  void WakeIfDue(int64 now = 0);
 
  private:
+  TimerBucket* CurrentBucket();
+  // locks and returns the bucket t is pending in, NULL if none.
+  TimerBucket* LockTimerBucket(Timer* t);
+  void Kick();
   void Proc();
-  void SiftUp(int i);
-  void SiftDown(int i);
-
-  int Length() {
-    return static_cast<int>(timers_.size());
-  }
 
  private:
   G* gp_;
   bool created_;
   bool rescheduling_;
   bool sleeping_;
+  bool kicked_;
+  intptr_t poll_until_;
   RawMutex mutex_;
   Note wait_note_;
-  std::vector<Timer*> timers_;
+  // one per P, the last one for threads without a P.
+  TimerBucket** buckets_;
+  std::vector<FiredTimer> fired_;
   bool exit_flag_;
   tin::WaitGroup wait_group_;
   DISALLOW_COPY_AND_ASSIGN(TimerQueue);
@@ -0,0 +1,154 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/timer/timer_queue.h"
+
+#include "tin/runtime/timer/timer_wheel.h"
+
+namespace tin {
+namespace runtime {
+
+TimerWheel::TimerWheel()
+  : current_tick_(MonoNow() / kTimerWheelTick)
+  , count_(0) {
+  memset(level_count_, 0, sizeof(level_count_));
+  memset(slots_, 0, sizeof(slots_));
+}
+
+TimerWheel::~TimerWheel() {
+}
+
+void TimerWheel::Add(Timer* t) {
+  if (count_ == 0) {
+    // nothing pending, catch up with the clock.
+    int64 now_tick = MonoNow() / kTimerWheelTick;
+    if (now_tick > current_tick_)
+      current_tick_ = now_tick;
+  }
+  Place(t);
+}
+
+void TimerWheel::Place(Timer* t) {
+  int64 tick = t->when / kTimerWheelTick;
+  if (tick < current_tick_)
+    tick = current_tick_;
+  int64 delta = tick - current_tick_;
+  int level = 0;
+  while (level < kLevels - 1 &&
+         delta >= (static_cast<int64>(1) << (kSlotBits * (level + 1)))) {
+    level++;
+  }
+  int64 span = static_cast<int64>(1) << (kSlotBits * kLevels);
+  if (delta >= span) {
+    // park it at the farthest slot, it will be cascaded again.
+    tick = current_tick_ + span - 1;
+  }
+  Link(t, level, static_cast<int>((tick >> (kSlotBits * level)) & kSlotMask));
+}
+
+void TimerWheel::Del(Timer* t) {
+  Unlink(t);
+}
+
+void TimerWheel::Link(Timer* t, int level, int slot) {
+  Timer** head = &slots_[level][slot];
+  t->next = *head;
+  if (t->next != NULL)
+    t->next->pprev = &t->next;
+  t->pprev = head;
+  *head = t;
+  t->level = level;
+  level_count_[level]++;
+  count_++;
+}
+
+void TimerWheel::Unlink(Timer* t) {
+  *t->pprev = t->next;
+  if (t->next != NULL)
+    t->next->pprev = t->pprev;
+  t->next = NULL;
+  t->pprev = NULL;
+  level_count_[t->level]--;
+  count_--;
+}
+
+void TimerWheel::Cascade(int level) {
+  int slot =
+      static_cast<int>((current_tick_ >> (kSlotBits * level)) & kSlotMask);
+  if (slot == 0 && level + 1 < kLevels)
+    Cascade(level + 1);
+  Timer* t = slots_[level][slot];
+  while (t != NULL) {
+    Timer* next = t->next;
+    Unlink(t);
+    Place(t);
+    t = next;
+  }
+}
+
+Timer* TimerWheel::Advance(int64 now) {
+  int64 now_tick = now / kTimerWheelTick;
+  Timer* expired = NULL;
+  while (count_ > 0 && current_tick_ <= now_tick) {
+    // skip the ticks nothing can expire or cascade at.
+    int level = 0;
+    while (level < kLevels && level_count_[level] == 0)
+      level++;
+    if (level > 0) {
+      int64 step = static_cast<int64>(1) << (kSlotBits * level);
+      int64 boundary = (current_tick_ + step - 1) & ~(step - 1);
+      if (boundary > now_tick) {
+        current_tick_ = now_tick + 1;
+        break;
+      }
+      current_tick_ = boundary;
+    }
+    int slot = static_cast<int>(current_tick_ & kSlotMask);
+    if (slot == 0)
+      Cascade(1);
+    Timer* t = slots_[0][slot];
+    while (t != NULL) {
+      Timer* next = t->next;
+      Unlink(t);
+      t->next = expired;
+      expired = t;
+      t = next;
+    }
+    current_tick_++;
+  }
+  if (count_ == 0 && current_tick_ <= now_tick)
+    current_tick_ = now_tick + 1;
+  return expired;
+}
+
+int64 TimerWheel::NextExpiry() const {
+  if (count_ == 0)
+    return kint64max;
+  // nothing in the upper levels fires before their next cascade.
+  int64 next = kint64max;
+  int level = 1;
+  while (level < kLevels && level_count_[level] == 0)
+    level++;
+  if (level < kLevels) {
+    int64 step = static_cast<int64>(1) << (kSlotBits * level);
+    next = ((current_tick_ + step - 1) & ~(step - 1)) * kTimerWheelTick;
+  }
+  if (level_count_[0] != 0) {
+    for (int i = 0; i < kSlots; i++) {
+      if (slots_[0][(current_tick_ + i) & kSlotMask] != NULL) {
+        int64 when = (current_tick_ + i) * kTimerWheelTick;
+        if (when < next)
+          next = when;
+        break;
+      }
+    }
+  }
+  return next;
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,59 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+
+namespace tin {
+namespace runtime {
+
+struct Timer;
+
+// wheel resolution, timers in a wheel fire within one tick after when.
+const int64 kTimerWheelTick = 1000 * 1000;  // 1ms
+
+// Hierarchical timing wheel, kLevels levels of kSlots slots each, a slot of
+// level l spans kSlots^l ticks. Add and Del are O(1) which suits deadlines
+// that are usually cancelled before they fire, Advance cascades timers of
+// the upper levels down as time goes. Not thread safe.
+class TimerWheel {
+ public:
+  TimerWheel();
+  ~TimerWheel();
+
+  void Add(Timer* t);
+  void Del(Timer* t);
+  // unlinks timers whose tick is not after now, returned linked by next.
+  Timer* Advance(int64 now);
+  // earliest time a timer may fire, kint64max if empty.
+  int64 NextExpiry() const;
+
+  bool Empty() const {
+    return count_ == 0;
+  }
+
+ private:
+  enum {
+    kSlotBits = 6,
+    kSlots = 1 << kSlotBits,
+    kSlotMask = kSlots - 1,
+    kLevels = 4
+  };
+
+  void Place(Timer* t);
+  void Link(Timer* t, int level, int slot);
+  void Unlink(Timer* t);
+  void Cascade(int level);
+
+  // first tick not yet processed.
+  int64 current_tick_;
+  int count_;
+  int level_count_[kLevels];
+  Timer* slots_[kLevels][kSlots];
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,48 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/logging.h"
+
+#include "tin/runtime/topology.h"
+
+namespace tin {
+namespace runtime {
+
+CpuTopology::CpuTopology() {
+}
+
+void CpuTopology::Discover(int num_cpus) {
+  if (num_cpus <= 0)
+    num_cpus = 1;
+  node_.assign(num_cpus, 0);
+  cache_.assign(num_cpus, 0);
+  if (!DiscoverCpuTopology(num_cpus, &node_, &cache_)) {
+    // unknown, treat all cpus as one flat domain.
+    node_.assign(num_cpus, 0);
+    cache_.assign(num_cpus, 0);
+  }
+}
+
+int CpuTopology::NodeOf(int cpu) const {
+  if (node_.empty())
+    return 0;
+  return node_[cpu % node_.size()];
+}
+
+int CpuTopology::CacheOf(int cpu) const {
+  if (cache_.empty())
+    return 0;
+  return cache_[cpu % cache_.size()];
+}
+
+int CpuTopology::Distance(int cpu1, int cpu2) const {
+  if (NodeOf(cpu1) != NodeOf(cpu2))
+    return kRemoteNode;
+  if (CacheOf(cpu1) != CacheOf(cpu2))
+    return kSameNode;
+  return kSameCache;
+}
+
+}  // namespace runtime
+}  // namespace tin
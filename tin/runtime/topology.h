@@ -0,0 +1,52 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <vector>
+
+#include "base/basictypes.h"
+
+namespace tin {
+namespace runtime {
+
+// distance between two cpus, work stealing prefers closer victims.
+enum {
+  kSameCache = 0,  // share the last level cache.
+  kSameNode,       // same NUMA node.
+  kRemoteNode,
+  kNumDistances
+};
+
+class CpuTopology {
+ public:
+  CpuTopology();
+
+  void Discover(int num_cpus);
+
+  int NumCpus() const {
+    return static_cast<int>(node_.size());
+  }
+
+  int NodeOf(int cpu) const;
+  int CacheOf(int cpu) const;
+  int Distance(int cpu1, int cpu2) const;
+
+ private:
+  std::vector<int> node_;
+  std::vector<int> cache_;
+  DISALLOW_COPY_AND_ASSIGN(CpuTopology);
+};
+
+// platform specific, fill NUMA node and last level cache id of every cpu.
+// return false if the topology is unknown.
+bool DiscoverCpuTopology(int num_cpus,
+                         std::vector<int>* node,
+                         std::vector<int>* cache);
+
+// the cpus the process may use, its affinity mask (cpusets) and cgroup cpu
+// quota, rounded up, count. at most num_cpus.
+int CpuQuotaLimit(int num_cpus);
+
+}  // namespace runtime
+}  // namespace tin
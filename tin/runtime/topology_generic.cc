@@ -0,0 +1,22 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "tin/runtime/topology.h"
+
+namespace tin {
+namespace runtime {
+
+// not implemented, all cpus are in one flat domain.
+bool DiscoverCpuTopology(int num_cpus,
+                         std::vector<int>* node,
+                         std::vector<int>* cache) {
+  return false;
+}
+
+int CpuQuotaLimit(int num_cpus) {
+  return num_cpus;
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -0,0 +1,153 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tin/runtime/topology.h"
+
+namespace tin {
+namespace runtime {
+
+namespace {
+
+bool ReadIntFile(const char* path, int* value) {
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL)
+    return false;
+  bool ok = fscanf(fp, "%d", value) == 1;
+  fclose(fp);
+  return ok;
+}
+
+// cpuN/nodeM is a symlink to the node the cpu belongs to.
+int CpuNode(int cpu) {
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR* dir = opendir(path);
+  if (dir == NULL)
+    return -1;
+  int node = -1;
+  struct dirent* entry = NULL;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "node", 4) == 0 &&
+        entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+      node = atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+// id of the L3 cache, fall back to the socket.
+int CpuCache(int cpu) {
+  char path[128];
+  int id = -1;
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/cache/index3/id", cpu);
+  if (ReadIntFile(path, &id))
+    return id;
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+  if (ReadIntFile(path, &id))
+    return id;
+  return -1;
+}
+
+// "max 100000" or "200000 100000" in cgroup v2.
+bool ReadCgroup2Quota(int64* quota, int64* period) {
+  FILE* fp = fopen("/sys/fs/cgroup/cpu.max", "r");
+  if (fp == NULL)
+    return false;
+  char max[32] = {0};
+  long long q = -1;
+  long long p = 0;
+  bool ok = false;
+  if (fscanf(fp, "%31s %lld", max, &p) == 2) {
+    if (strcmp(max, "max") != 0)
+      q = atoll(max);
+    ok = true;
+  }
+  fclose(fp);
+  *quota = q;
+  *period = p;
+  return ok;
+}
+
+// cfs_quota_us is -1 without a limit.
+bool ReadCgroup1Quota(int64* quota, int64* period) {
+  static const char* const kDirs[] = {
+    "/sys/fs/cgroup/cpu,cpuacct",
+    "/sys/fs/cgroup/cpu",
+  };
+  for (size_t i = 0; i < sizeof(kDirs) / sizeof(kDirs[0]); i++) {
+    char path[128];
+    long long q = 0;
+    long long p = 0;
+    snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", kDirs[i]);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+      continue;
+    bool ok = fscanf(fp, "%lld", &q) == 1;
+    fclose(fp);
+    snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", kDirs[i]);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+      continue;
+    ok = fscanf(fp, "%lld", &p) == 1 && ok;
+    fclose(fp);
+    if (ok) {
+      *quota = q;
+      *period = p;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+bool DiscoverCpuTopology(int num_cpus,
+                         std::vector<int>* node,
+                         std::vector<int>* cache) {
+  for (int cpu = 0; cpu < num_cpus; cpu++) {
+    int n = CpuNode(cpu);
+    int c = CpuCache(cpu);
+    // non-NUMA kernels have no node link, assume node 0.
+    (*node)[cpu] = n < 0 ? 0 : n;
+    if (c < 0)
+      return false;
+    // cache ids are only unique within a node on some kernels.
+    (*cache)[cpu] = (*node)[cpu] * 1024 + c;
+  }
+  return true;
+}
+
+int CpuQuotaLimit(int num_cpus) {
+  // a cpuset shows up in the affinity mask.
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    int n = CPU_COUNT(&set);
+    if (n > 0 && n < num_cpus)
+      num_cpus = n;
+  }
+  int64 quota = -1;
+  int64 period = 0;
+  if (!ReadCgroup2Quota(&quota, &period) &&
+      !ReadCgroup1Quota(&quota, &period)) {
+    return num_cpus;
+  }
+  if (quota <= 0 || period <= 0)
+    return num_cpus;
+  int64 limit = (quota + period - 1) / period;
+  return limit < num_cpus ? static_cast<int>(limit) : num_cpus;
+}
+
+}  // namespace runtime
+}  // namespace tin
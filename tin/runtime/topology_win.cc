@@ -0,0 +1,56 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <windows.h>
+
+#include "tin/runtime/topology.h"
+
+namespace tin {
+namespace runtime {
+
+bool DiscoverCpuTopology(int num_cpus,
+                         std::vector<int>* node,
+                         std::vector<int>* cache) {
+  DWORD len = 0;
+  GetLogicalProcessorInformation(NULL, &len);
+  if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || len == 0)
+    return false;
+  std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(
+      len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+  if (!GetLogicalProcessorInformation(&infos[0], &len))
+    return false;
+
+  bool found_cache = false;
+  int cache_id = 0;
+  for (size_t i = 0; i < infos.size(); i++) {
+    const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& info = infos[i];
+    bool is_node = info.Relationship == RelationNumaNode;
+    bool is_l3 = info.Relationship == RelationCache && info.Cache.Level == 3;
+    if (!is_node && !is_l3)
+      continue;
+    const int kMaskBits = sizeof(ULONG_PTR) * 8;
+    for (int cpu = 0; cpu < num_cpus && cpu < kMaskBits; cpu++) {
+      if ((info.ProcessorMask & (static_cast<ULONG_PTR>(1) << cpu)) == 0)
+        continue;
+      if (is_node) {
+        (*node)[cpu] = static_cast<int>(info.NumaNode.NodeNumber);
+      } else {
+        (*cache)[cpu] = cache_id;
+      }
+    }
+    if (is_l3) {
+      found_cache = true;
+      cache_id++;
+    }
+  }
+  return found_cache;
+}
+
+// job objects can cap the cpu rate too, not looked at yet.
+int CpuQuotaLimit(int num_cpus) {
+  return num_cpus;
+}
+
+}  // namespace runtime
+}  // namespace tin
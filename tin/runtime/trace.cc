@@ -0,0 +1,413 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/synchronization/condition_variable.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/platform_thread.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/raw_mutex.h"
+
+#include "tin/runtime/trace.h"
+
+namespace tin {
+namespace runtime {
+
+int32 trace_enabled = 0;
+
+struct TraceBuffer;
+
+namespace {
+
+const char kTraceMagic[8] = {'T', 'I', 'N', 'T', 'R', 'A', 'C', 'E'};
+// 64K per chunk.
+const int kChunkRecords = 2047;
+// events are dropped while the writer is this many chunks behind.
+const int kMaxChunks = 256;
+
+struct TraceHeader {
+  char magic[8];
+  int64 start;
+};
+
+struct TraceChunk {
+  TraceChunk* next;
+  int n;
+  TraceRecord records[kChunkRecords];
+};
+
+// writes full chunks to the file on its own OS thread.
+class TraceWriter : public base::PlatformThread::Delegate {
+ public:
+  explicit TraceWriter(FILE* file)
+    : file_(file)
+    , cv_(&lock_)
+    , full_(NULL)
+    , free_(NULL)
+    , chunks_(0)
+    , dropped_(0)
+    , stopping_(false) {
+  }
+
+  virtual ~TraceWriter() {
+    while (free_ != NULL) {
+      TraceChunk* c = free_;
+      free_ = c->next;
+      delete c;
+    }
+  }
+
+  bool Start() {
+    return base::PlatformThread::Create(0, this, &handle_);
+  }
+
+  // NULL if the writer is too far behind.
+  TraceChunk* GetChunk() {
+    base::AutoLock guard(lock_);
+    TraceChunk* c = free_;
+    if (c != NULL) {
+      free_ = c->next;
+    } else if (chunks_ < kMaxChunks) {
+      c = new TraceChunk;
+      chunks_++;
+    } else {
+      dropped_++;
+      return NULL;
+    }
+    c->next = NULL;
+    c->n = 0;
+    return c;
+  }
+
+  void Submit(TraceChunk* c) {
+    base::AutoLock guard(lock_);
+    c->next = full_;
+    full_ = c;
+    cv_.Signal();
+  }
+
+  // writes what was submitted and joins the thread.
+  void Stop() {
+    {
+      base::AutoLock guard(lock_);
+      stopping_ = true;
+      cv_.Signal();
+    }
+    base::PlatformThread::Join(handle_);
+    if (dropped_ != 0)
+      LOG(WARNING) << "trace: " << dropped_ << " chunks of events dropped";
+  }
+
+ private:
+  virtual void ThreadMain() {
+    base::PlatformThread::SetName("TinTrace");
+    base::AutoLock guard(lock_);
+    while (true) {
+      while (full_ == NULL && !stopping_)
+        cv_.Wait();
+      bool stop = stopping_;
+      // oldest first.
+      TraceChunk* list = NULL;
+      while (full_ != NULL) {
+        TraceChunk* c = full_;
+        full_ = c->next;
+        c->next = list;
+        list = c;
+      }
+      TraceChunk* tail = NULL;
+      {
+        base::AutoUnlock unlock(lock_);
+        for (TraceChunk* c = list; c != NULL; c = c->next) {
+          fwrite(c->records, sizeof(TraceRecord), c->n, file_);
+          tail = c;
+        }
+      }
+      if (tail != NULL) {
+        tail->next = free_;
+        free_ = list;
+      }
+      if (stop && full_ == NULL)
+        break;
+    }
+  }
+
+  FILE* file_;
+  base::PlatformThreadHandle handle_;
+  base::Lock lock_;
+  base::ConditionVariable cv_;
+  TraceChunk* full_;
+  TraceChunk* free_;
+  int chunks_;
+  int dropped_;
+  bool stopping_;
+  DISALLOW_COPY_AND_ASSIGN(TraceWriter);
+};
+
+// serializes StartTrace and StopTrace.
+base::Lock control_lock;
+TraceWriter* writer = NULL;
+FILE* trace_file = NULL;
+
+// every buffer ever handed to an M, they are never freed.
+RawMutex buffers_lock;
+std::vector<TraceBuffer*>* buffers = NULL;
+
+}  // namespace
+
+// one per M, the lock is only contended by StopTrace.
+struct TraceBuffer {
+  RawMutex lock;
+  TraceChunk* chunk;
+  uint32 id;
+};
+
+void TraceEventSlow(int type, G* gp, uint64 arg) {
+  G* curg = GetG();
+  if (curg == NULL)
+    return;
+  M* m = curg->M();
+  TraceBuffer* buf = m->TraceBuf();
+  if (buf == NULL) {
+    buf = new TraceBuffer;
+    buf->chunk = NULL;
+    {
+      RawMutexGuard guard(&buffers_lock);
+      if (buffers == NULL)
+        buffers = new std::vector<TraceBuffer*>;
+      buf->id = static_cast<uint32>(buffers->size());
+      buffers->push_back(buf);
+    }
+    m->SetTraceBuf(buf);
+  }
+
+  RawMutexGuard guard(&buf->lock);
+  // StopTrace may have flushed this buffer meanwhile.
+  if (atomic::acquire_load32(&trace_enabled) == 0)
+    return;
+  if (buf->chunk == NULL) {
+    buf->chunk = writer->GetChunk();
+    if (buf->chunk == NULL)
+      return;
+  }
+  TraceRecord* r = &buf->chunk->records[buf->chunk->n++];
+  r->ts = MonoNow();
+  r->g = reinterpret_cast<uintptr_t>(gp);
+  r->arg = arg;
+  r->type = static_cast<uint16>(type);
+  r->p = m->P() != NULL ? static_cast<int16>(m->P()->Id()) : -1;
+  r->m = buf->id;
+  if (buf->chunk->n == kChunkRecords) {
+    writer->Submit(buf->chunk);
+    buf->chunk = NULL;
+  }
+}
+
+const char* TraceParkReasonName(uint64 reason) {
+  switch (reason) {
+    case kParkNetPoll:
+      return "netpoll";
+    case kParkSema:
+      return "sema";
+    case kParkTimer:
+      return "timer";
+    case kParkChan:
+      return "chan";
+    case kParkSyscall:
+      return "syscall";
+    case kParkBlocking:
+      return "blocking";
+    case kParkYield:
+      return "yield";
+    case kParkExit:
+      return "exit";
+    case kParkJoin:
+      return "join";
+    default:
+      return "other";
+  }
+}
+
+}  // namespace runtime
+
+bool StartTrace(const char* path) {
+  base::AutoLock guard(runtime::control_lock);
+  if (runtime::writer != NULL)
+    return false;
+  FILE* file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+  runtime::TraceHeader header;
+  memcpy(header.magic, runtime::kTraceMagic, sizeof(header.magic));
+  header.start = MonoNow();
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    fclose(file);
+    return false;
+  }
+  runtime::TraceWriter* writer = new runtime::TraceWriter(file);
+  if (!writer->Start()) {
+    delete writer;
+    fclose(file);
+    return false;
+  }
+  runtime::writer = writer;
+  runtime::trace_file = file;
+  atomic::release_store32(&runtime::trace_enabled, 1);
+  return true;
+}
+
+void StopTrace() {
+  base::AutoLock guard(runtime::control_lock);
+  if (runtime::writer == NULL)
+    return;
+  atomic::release_store32(&runtime::trace_enabled, 0);
+  {
+    runtime::RawMutexGuard buffers_guard(&runtime::buffers_lock);
+    for (size_t i = 0;
+         runtime::buffers != NULL && i < runtime::buffers->size(); ++i) {
+      runtime::TraceBuffer* buf = (*runtime::buffers)[i];
+      // waits for an append in progress.
+      runtime::RawMutexGuard buf_guard(&buf->lock);
+      if (buf->chunk != NULL) {
+        runtime::writer->Submit(buf->chunk);
+        buf->chunk = NULL;
+      }
+    }
+  }
+  // joining may take a while, let another M run our P.
+  bool on_greenlet = runtime::GetG() != NULL && !runtime::GetG()->IsG0();
+  if (on_greenlet)
+    EnterSyscall();
+  runtime::writer->Stop();
+  if (on_greenlet)
+    ExitSyscall();
+  delete runtime::writer;
+  runtime::writer = NULL;
+  fclose(runtime::trace_file);
+  runtime::trace_file = NULL;
+}
+
+bool IsTracing() {
+  return atomic::relaxed_load32(&runtime::trace_enabled) != 0;
+}
+
+namespace {
+
+const char* TraceEventName(int type) {
+  switch (type) {
+    case runtime::kTraceSpawn:
+      return "spawn";
+    case runtime::kTracePark:
+      return "park";
+    case runtime::kTraceReady:
+      return "ready";
+    case runtime::kTraceSteal:
+      return "steal";
+    case runtime::kTraceHandoff:
+      return "handoff";
+    case runtime::kTraceReap:
+      return "reap";
+    case runtime::kTraceNetPoll:
+      return "netpoll";
+    default:
+      return "unknown";
+  }
+}
+
+struct RunSpan {
+  uint64 g;
+  int64 ts;
+  int p;
+};
+
+void WriteSpan(FILE* out, uint32 m, const RunSpan& span, int64 end,
+               int64 start, bool* first) {
+  fprintf(out, "%s\n{\"name\":\"g 0x%llx\",\"ph\":\"X\",\"pid\":0,"
+          "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"p\":%d}}",
+          *first ? "" : ",",
+          static_cast<unsigned long long>(span.g), m,
+          (span.ts - start) / 1000.0, (end - span.ts) / 1000.0, span.p);
+  *first = false;
+}
+
+}  // namespace
+
+bool ConvertTraceToJson(const char* trace_path, const char* json_path) {
+  FILE* in = fopen(trace_path, "rb");
+  if (in == NULL)
+    return false;
+  runtime::TraceHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, runtime::kTraceMagic, sizeof(header.magic)) != 0) {
+    fclose(in);
+    return false;
+  }
+  FILE* out = fopen(json_path, "w");
+  if (out == NULL) {
+    fclose(in);
+    return false;
+  }
+
+  fprintf(out, "{\"traceEvents\":[");
+  bool first = true;
+  // the greenlet running on each M.
+  std::map<uint32, RunSpan> running;
+  runtime::TraceRecord r;
+  int64 last = header.start;
+  while (fread(&r, sizeof(r), 1, in) == 1) {
+    if (r.ts > last)
+      last = r.ts;
+    std::map<uint32, RunSpan>::iterator it = running.find(r.m);
+    if (r.type == runtime::kTraceRun) {
+      if (it != running.end()) {
+        WriteSpan(out, r.m, it->second, r.ts, header.start, &first);
+      }
+      RunSpan span;
+      span.g = r.g;
+      span.ts = r.ts;
+      span.p = r.p;
+      running[r.m] = span;
+      continue;
+    }
+    if (r.type == runtime::kTracePark && it != running.end() &&
+        it->second.g == r.g) {
+      WriteSpan(out, r.m, it->second, r.ts, header.start, &first);
+      running.erase(it);
+    }
+    fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,"
+            "\"tid\":%u,\"ts\":%.3f,\"args\":{\"g\":\"0x%llx\",\"p\":%d",
+            first ? "" : ",", TraceEventName(r.type), r.m,
+            (r.ts - header.start) / 1000.0,
+            static_cast<unsigned long long>(r.g), r.p);
+    if (r.type == runtime::kTracePark) {
+      fprintf(out, ",\"reason\":\"%s\"", runtime::TraceParkReasonName(r.arg));
+    } else if (r.type != runtime::kTraceSpawn &&
+               r.type != runtime::kTraceReady) {
+      fprintf(out, ",\"arg\":%llu", static_cast<unsigned long long>(r.arg));
+    }
+    fprintf(out, "}}");
+    first = false;
+  }
+  // still running when the trace stopped.
+  for (std::map<uint32, RunSpan>::iterator it = running.begin();
+       it != running.end(); ++it) {
+    WriteSpan(out, it->first, it->second, last, header.start,
+                       &first);
+  }
+  fprintf(out, "\n]}\n");
+  bool ok = ferror(in) == 0 && ferror(out) == 0;
+  fclose(in);
+  ok = fclose(out) == 0 && ok;
+  return ok;
+}
+
+}  // namespace tin
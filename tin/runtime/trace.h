@@ -0,0 +1,86 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+
+#include "tin/sync/atomic.h"
+#include "tin/runtime/util.h"
+
+namespace tin {
+
+// records greenlet lifecycle events of the whole runtime into path, a
+// binary file of fixed size records. each M appends to its own buffer,
+// full buffers are written by a background thread. false if a trace is
+// already running or path can not be opened.
+bool StartTrace(const char* path);
+
+// flushes every buffer and closes the file, blocks until it is written.
+void StopTrace();
+
+bool IsTracing();
+
+// converts a trace file into the Chrome trace event format, for
+// chrome://tracing or Perfetto. runs greenlets as spans on their M, the
+// other events as instants.
+bool ConvertTraceToJson(const char* trace_path, const char* json_path);
+
+namespace runtime {
+
+enum TraceEventType {
+  kTraceSpawn = 1,
+  // switched to on an M, arg is the P.
+  kTraceRun,
+  // arg is a TraceParkReason.
+  kTracePark,
+  kTraceReady,
+  // arg is the victim P, g the first stolen greenlet.
+  kTraceSteal,
+  // arg is the P handed to another M.
+  kTraceHandoff,
+  // g exited and is recycled.
+  kTraceReap,
+  // arg is the number of greenlets netpoll made ready.
+  kTraceNetPoll,
+};
+
+enum TraceParkReason {
+  kParkOther = 0,
+  kParkNetPoll,
+  kParkSema,
+  kParkTimer,
+  kParkChan,
+  kParkSyscall,
+  kParkBlocking,
+  kParkYield,
+  kParkExit,
+  kParkJoin,
+  kNumParkReasons,
+};
+
+const char* TraceParkReasonName(uint64 reason);
+
+// on disk, native byte order after a kTraceMagic header.
+struct TraceRecord {
+  int64 ts;
+  uint64 g;
+  uint64 arg;
+  uint16 type;
+  int16 p;
+  uint32 m;
+};
+
+extern int32 trace_enabled;
+
+void TraceEventSlow(int type, G* gp, uint64 arg);
+
+// cheap enough to leave in hot paths, a relaxed load while not tracing.
+inline void TraceEvent(int type, G* gp, uint64 arg = 0) {
+  if (atomic::relaxed_load32(&trace_enabled) != 0)
+    TraceEventSlow(type, gp, arg);
+}
+
+}  // namespace runtime
+}  // namespace tin
@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
+
 #include "tin/runtime/util.h"
 
 #if defined(OS_WIN)
@@ -11,9 +13,53 @@
 #include <errno.h>
 #endif
 
+#if defined(OS_FREEBSD)
+#include <sys/param.h>
+#include <sys/cpuset.h>
+#endif
+
 namespace tin {
 namespace runtime {
 
+namespace {
+// see kSchedLatencyBuckets, exact below 4 ns.
+int SchedLatencyBucket(int64 ns) {
+  uint64 v = static_cast<uint64>(ns);
+  if (v < 4) {
+    return static_cast<int>(v);
+  }
+  int e = 0;
+  for (int shift = 32; shift > 0; shift >>= 1) {
+    if ((v >> (e + shift)) != 0) {
+      e += shift;
+    }
+  }
+  int i = (e - 1) * 4 + static_cast<int>((v >> (e - 2)) & 3);
+  return std::min(i, kSchedLatencyBuckets - 1);
+}
+}  // namespace
+
+void RecordLatency(uint64* hist, int64 ns) {
+  if (ns < 0) {
+    ns = 0;
+  }
+  hist[SchedLatencyBucket(ns)]++;
+  hist[kSchedLatencyBuckets] += ns;
+  if (static_cast<uint64>(ns) > hist[kSchedLatencyBuckets + 1]) {
+    hist[kSchedLatencyBuckets + 1] = ns;
+  }
+}
+
+void AddLatency(const uint64* hist, SchedLatencyStats* stats) {
+  for (int i = 0; i < kSchedLatencyBuckets; i++) {
+    uint64 n = hist[i];
+    stats->buckets[i] += n;
+    stats->count += n;
+  }
+  stats->sum_ns += hist[kSchedLatencyBuckets];
+  stats->max_ns = std::max(stats->max_ns, hist[kSchedLatencyBuckets + 1]);
+}
+
 void YieldLogicProcessor() {
 #if defined(OS_WIN)
   YieldProcessor();
@@ -47,5 +93,26 @@ int GetLastSystemErrorCode() {
 #endif
 }
 
+bool BindCurrentThreadToCpu(int cpu) {
+#if defined(OS_WIN)
+  DWORD_PTR mask = static_cast<DWORD_PTR>(1) << cpu;
+  return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(OS_LINUX)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(OS_FREEBSD)
+  cpuset_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1,
+                            sizeof(set), &set) == 0;
+#else
+  // Mac OS X has no way to pin a thread.
+  return false;
+#endif
+}
+
 }  // namespace runtime
 }  // namespace tin
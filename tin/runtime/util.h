@@ -8,8 +8,17 @@
 
 #include "base/basictypes.h"
 #include "base/threading/thread_local.h"
+#include "build/build_config.h"
 
 #include "tin/runtime/env.h"
+#include "tin/runtime/runtime.h"
+
+// GetG, GetM and GetP read a native thread local, glet_tls with
+// -DTIN_NO_NATIVE_TLS for toolchains that lack one.
+#if !defined(TIN_NO_NATIVE_TLS) && \
+    (defined(COMPILER_GCC) || defined(COMPILER_MSVC))
+#define TIN_NATIVE_TLS 1
+#endif
 
 namespace tin {
 namespace runtime {
@@ -19,6 +28,51 @@ class P;
 class M;
 typedef Greenlet G;
 
+#if defined(TIN_NATIVE_TLS)
+// what runs on this thread, next to each other so the hot accessors are
+// one TLS relative load.
+struct ThreadState {
+  G* g;
+  M* m;
+  // kept equal to m->P() by M::SetP, which only the M itself calls.
+  P* p;
+};
+
+// &thread_state of the calling thread. out of line and opaque to the
+// optimizer, a greenlet resumes on another M after SwitchG and an inlined
+// TLS address, say a __tls_get_addr result under -fPIC, would be reused
+// across the switch.
+ThreadState* CurrentThreadState();
+
+inline G* GetG() {
+  return CurrentThreadState()->g;
+}
+
+inline void SetG(G* gp) {
+  CurrentThreadState()->g = gp;
+}
+
+// NULL on threads the runtime did not start, or before it is up.
+inline G* GetGOrNull() {
+  return CurrentThreadState()->g;
+}
+
+inline M* GetM() {
+  return CurrentThreadState()->m;
+}
+
+inline void SetCurrentM(M* m) {
+  CurrentThreadState()->m = m;
+}
+
+inline P* GetP() {
+  return CurrentThreadState()->p;
+}
+
+inline void SetCurrentP(P* p) {
+  CurrentThreadState()->p = p;
+}
+#else
 inline G* GetG() {
   return glet_tls->Get();
 }
@@ -27,10 +81,21 @@ inline void SetG(G* gp) {
   glet_tls->Set(gp);
 }
 
+inline G* GetGOrNull() {
+  return glet_tls != NULL ? glet_tls->Get() : NULL;
+}
+
 P* GetP();
 
 M* GetM();
 
+inline void SetCurrentM(M* m) {
+}
+
+inline void SetCurrentP(P* p) {
+}
+#endif
+
 inline uintptr_t GpCast(G* gp) {
   return reinterpret_cast<uintptr_t>(gp);
 }
@@ -42,6 +107,18 @@ inline G* GpCastBack(uintptr_t gp) {
 void YieldLogicProcessor();
 void YieldLogicProcessor(int n);
 int GetLastSystemErrorCode();
+// pin calling OS thread to cpu, false if failed or not supported.
+bool BindCurrentThreadToCpu(int cpu);
+// publish a fresh MonoNow() for CoarseNow().
+void UpdateCoarseNow(int64 now);
+// now for deadline computation, CoarseNow() if configured.
+int64 DeadlineNow();
+
+// a histogram laid out for SchedLatencyStats: kSchedLatencyBuckets counts,
+// then the sum and the max. not synchronized.
+const int kLatencyHistogramSize = kSchedLatencyBuckets + 2;
+void RecordLatency(uint64* hist, int64 ns);
+void AddLatency(const uint64* hist, SchedLatencyStats* stats);
 
 }  // namespace runtime
 }  // namespace tin
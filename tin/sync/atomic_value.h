@@ -0,0 +1,84 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+
+#include "base/basictypes.h"
+
+#include "tin/sync/rwmutex.h"
+
+namespace tin {
+
+// AtomicValue holds a value that is read often and replaced rarely, e.g.
+// configuration. readers only touch the reader slot of their P, Store
+// swaps in a new value and deletes the old one once no reader can see it.
+template <class T>
+class AtomicValue {
+ public:
+  // takes ownership of t, which may be NULL.
+  explicit AtomicValue(T* t = NULL)
+    : value_(t) {
+  }
+
+  ~AtomicValue() {
+    delete value_;
+  }
+
+  // keeps the value alive while in scope. don't block long inside, Store
+  // waits for all readers of the old value.
+  class Reader {
+   public:
+    explicit Reader(const AtomicValue* v)
+      : v_(v) {
+      v_->mu_.RLock();
+      t_ = v_->value_;
+    }
+
+    ~Reader() {
+      v_->mu_.RUnlock();
+    }
+
+    const T* get() const {
+      return t_;
+    }
+
+    const T* operator->() const {
+      return t_;
+    }
+
+    const T& operator*() const {
+      return *t_;
+    }
+
+   private:
+    const AtomicValue* v_;
+    const T* t_;
+    DISALLOW_COPY_AND_ASSIGN(Reader);
+  };
+
+  // a copy of the current value, T() if there is none.
+  T Load() const {
+    Reader r(this);
+    return r.get() != NULL ? *r : T();
+  }
+
+  // takes ownership of t, returns after the old value is deleted.
+  void Store(T* t) {
+    T* old = NULL;
+    {
+      DistributedWriterGuard guard(&mu_);
+      old = value_;
+      value_ = t;
+    }
+    delete old;
+  }
+
+ private:
+  mutable DistributedRWMutex mu_;
+  T* value_;
+  DISALLOW_COPY_AND_ASSIGN(AtomicValue);
+};
+
+}  // namespace tin
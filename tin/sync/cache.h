@@ -0,0 +1,388 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+
+#include "base/basictypes.h"
+#include "base/callback.h"
+#include "tin/sync/mutex.h"
+#include "tin/sync/cond.h"
+#include "tin/sync/concurrent_map.h"
+
+namespace tin {
+
+// a bounded cache, say rows of a database by id. keys hash onto shards,
+// each a chained table under a Mutex so contended callers park, with
+// CLOCK eviction: a hit sets the referenced bit of an entry and the hand
+// passes over, and clears, set bits until it finds an entry to evict.
+//
+// GetOrLoad collapses the misses of a key. the first runs the loader with
+// no lock held, the ones that come while it loads wait for its result,
+// one fetch serves them all.
+//
+// only greenlets may use it. V must be default constructible and
+// copyable, the hashes are ConcurrentMapHash.
+template <typename K, typename V, typename Hash = ConcurrentMapHash<K> >
+class Cache {
+ public:
+  // fills *value for key, false if there is none. runs without a lock of
+  // the cache held, so it may block.
+  typedef base::Callback<bool(const K&, V*)> Loader;
+
+  struct Stats {
+    Stats()
+      : hits(0)
+      , misses(0)
+      , loads(0)
+      , load_waits(0)
+      , evictions(0) {
+    }
+
+    uint64 hits;
+    uint64 misses;
+    // loader runs.
+    uint64 loads;
+    // misses that waited for the load of another.
+    uint64 load_waits;
+    uint64 evictions;
+  };
+
+  // capacity is split between the shards, those are rounded up to a power
+  // of 2.
+  explicit Cache(size_t capacity, int shards = 16)
+    : shard_mask_(RoundUp(shards) - 1)
+    , shards_(new Shard[shard_mask_ + 1]) {
+    size_t per_shard = (capacity + shard_mask_) / (shard_mask_ + 1);
+    if (per_shard == 0)
+      per_shard = 1;
+    for (uint32 i = 0; i <= shard_mask_; i++) {
+      Shard* shard = &shards_[i];
+      shard->capacity = per_shard;
+      // a load factor of at most 1, loads in flight aside.
+      shard->mask = RoundUp(static_cast<uint32>(per_shard)) - 1;
+      shard->buckets = new Entry*[shard->mask + 1];
+      for (uint32 b = 0; b <= shard->mask; b++)
+        shard->buckets[b] = NULL;
+    }
+  }
+
+  // no load may be in flight any more.
+  ~Cache() {
+    Clear();
+    for (uint32 i = 0; i <= shard_mask_; i++)
+      delete[] shards_[i].buckets;
+    delete[] shards_;
+  }
+
+  // copies the value of key to *value if it is cached, value may be NULL.
+  bool Get(const K& key, V* value) {
+    size_t h = hash_(key);
+    Shard* shard = ShardOf(h);
+    MutexGuard guard(&shard->mu);
+    Entry* e = Lookup(shard, h, key);
+    if (e == NULL || e->flight != NULL) {
+      shard->stats.misses++;
+      return false;
+    }
+    shard->stats.hits++;
+    e->referenced = true;
+    if (value != NULL)
+      *value = e->value;
+    return true;
+  }
+
+  // sets the value of key, evicting another one if the shard is full. a
+  // load of key in flight is overtaken, its result is not cached.
+  void Put(const K& key, const V& value) {
+    size_t h = hash_(key);
+    Shard* shard = ShardOf(h);
+    MutexGuard guard(&shard->mu);
+    Entry* e = Lookup(shard, h, key);
+    if (e != NULL && e->flight == NULL) {
+      e->value = value;
+      e->referenced = true;
+      return;
+    }
+    if (e == NULL) {
+      e = new Entry(key, h);
+      LinkBucket(shard, e);
+    }
+    e->flight = NULL;
+    e->value = value;
+    Install(shard, e);
+  }
+
+  // true if key had a value. a load of key in flight is dropped too, so
+  // an invalidation beats a load that read the old value.
+  bool Erase(const K& key) {
+    size_t h = hash_(key);
+    Shard* shard = ShardOf(h);
+    MutexGuard guard(&shard->mu);
+    Entry* e = Lookup(shard, h, key);
+    if (e == NULL)
+      return false;
+    bool cached = e->flight == NULL;
+    Remove(shard, e);
+    return cached;
+  }
+
+  // the value of key, from loader on a miss. the misses of a key while it
+  // loads wait for that load and share its result. false if the loader
+  // failed, nothing is cached then.
+  bool GetOrLoad(const K& key, const Loader& loader, V* value) {
+    size_t h = hash_(key);
+    Shard* shard = ShardOf(h);
+    Flight* flight = NULL;
+    {
+      MutexGuard guard(&shard->mu);
+      Entry* e = Lookup(shard, h, key);
+      if (e != NULL && e->flight == NULL) {
+        shard->stats.hits++;
+        e->referenced = true;
+        *value = e->value;
+        return true;
+      }
+      shard->stats.misses++;
+      if (e != NULL) {
+        flight = e->flight;
+        flight->refs++;
+        shard->stats.load_waits++;
+        while (!flight->done)
+          flight->cond.Wait();
+        bool ok = flight->ok;
+        if (ok)
+          *value = flight->value;
+        Release(flight);
+        return ok;
+      }
+      shard->stats.loads++;
+      flight = new Flight(&shard->mu);
+      e = new Entry(key, h);
+      e->flight = flight;
+      LinkBucket(shard, e);
+    }
+
+    // only we write the value before done is set.
+    bool ok = loader.Run(key, &flight->value);
+
+    MutexGuard guard(&shard->mu);
+    flight->ok = ok;
+    flight->done = true;
+    // unless Put, Erase or Clear came meanwhile.
+    Entry* e = Lookup(shard, h, key);
+    if (e != NULL && e->flight == flight) {
+      if (ok) {
+        e->flight = NULL;
+        e->value = flight->value;
+        Install(shard, e);
+      } else {
+        Remove(shard, e);
+      }
+    }
+    if (ok)
+      *value = flight->value;
+    if (flight->refs > 1)
+      flight->cond.Broascast();
+    Release(flight);
+    return ok;
+  }
+
+  // drops every value and the loads in flight, see Erase.
+  void Clear() {
+    for (uint32 i = 0; i <= shard_mask_; i++) {
+      Shard* shard = &shards_[i];
+      MutexGuard guard(&shard->mu);
+      for (uint32 b = 0; b <= shard->mask; b++) {
+        Entry* e = shard->buckets[b];
+        while (e != NULL) {
+          Entry* next = e->next;
+          delete e;
+          e = next;
+        }
+        shard->buckets[b] = NULL;
+      }
+      shard->hand = NULL;
+      shard->size = 0;
+    }
+  }
+
+  // cached values, loads in flight not counted.
+  size_t Size() {
+    size_t size = 0;
+    for (uint32 i = 0; i <= shard_mask_; i++) {
+      MutexGuard guard(&shards_[i].mu);
+      size += shards_[i].size;
+    }
+    return size;
+  }
+
+  Stats GetStats() {
+    Stats stats;
+    for (uint32 i = 0; i <= shard_mask_; i++) {
+      MutexGuard guard(&shards_[i].mu);
+      const Stats& s = shards_[i].stats;
+      stats.hits += s.hits;
+      stats.misses += s.misses;
+      stats.loads += s.loads;
+      stats.load_waits += s.load_waits;
+      stats.evictions += s.evictions;
+    }
+    return stats;
+  }
+
+ private:
+  // a load in flight, freed by the last of the loader and its waiters.
+  struct Flight {
+    explicit Flight(Mutex* mu)
+      : cond(mu)
+      , done(false)
+      , ok(false)
+      , refs(1)
+      , value() {
+    }
+
+    Cond cond;
+    bool done;
+    bool ok;
+    int refs;
+    V value;
+  };
+
+  struct Entry {
+    Entry(const K& k, size_t h)
+      : key(k)
+      , hash(h)
+      , value()
+      , next(NULL)
+      , prev_clock(NULL)
+      , next_clock(NULL)
+      , referenced(false)
+      , flight(NULL) {
+    }
+
+    const K key;
+    const size_t hash;
+    V value;
+    // the chain of the bucket.
+    Entry* next;
+    // the ring the hand goes round, cached values only.
+    Entry* prev_clock;
+    Entry* next_clock;
+    bool referenced;
+    // set while key loads, the entry holds no value then.
+    Flight* flight;
+  };
+
+  struct Shard {
+    Shard()
+      : buckets(NULL)
+      , mask(0)
+      , hand(NULL)
+      , size(0)
+      , capacity(0) {
+    }
+
+    Mutex mu;
+    Entry** buckets;
+    uint32 mask;
+    // the next entry to look at for eviction, NULL if the ring is empty.
+    Entry* hand;
+    size_t size;
+    size_t capacity;
+    Stats stats;
+    char pad[64];
+  };
+
+  static uint32 RoundUp(uint32 n) {
+    uint32 v = 1;
+    while (v < n)
+      v *= 2;
+    return v;
+  }
+
+  Shard* ShardOf(size_t h) const {
+    // the low bits pick the bucket.
+    return &shards_[static_cast<uint32>(h >> 24) & shard_mask_];
+  }
+
+  static Entry* Lookup(Shard* shard, size_t h, const K& key) {
+    for (Entry* e = shard->buckets[h & shard->mask]; e != NULL; e = e->next) {
+      if (e->hash == h && e->key == key)
+        return e;
+    }
+    return NULL;
+  }
+
+  static void LinkBucket(Shard* shard, Entry* e) {
+    Entry** head = &shard->buckets[e->hash & shard->mask];
+    e->next = *head;
+    *head = e;
+  }
+
+  // puts a new value on the ring behind the hand, the last to be looked
+  // at, after making room for it.
+  static void Install(Shard* shard, Entry* e) {
+    while (shard->size >= shard->capacity)
+      Evict(shard);
+    if (shard->hand == NULL) {
+      e->prev_clock = e;
+      e->next_clock = e;
+      shard->hand = e;
+    } else {
+      Entry* hand = shard->hand;
+      e->next_clock = hand;
+      e->prev_clock = hand->prev_clock;
+      hand->prev_clock->next_clock = e;
+      hand->prev_clock = e;
+    }
+    shard->size++;
+  }
+
+  static void Evict(Shard* shard) {
+    Entry* e = shard->hand;
+    // ends within one round, the bits passed are cleared.
+    while (e->referenced) {
+      e->referenced = false;
+      e = e->next_clock;
+    }
+    shard->hand = e;
+    shard->stats.evictions++;
+    Remove(shard, e);
+  }
+
+  // unlinks e from its bucket, and from the ring if it holds a value, and
+  // frees it.
+  static void Remove(Shard* shard, Entry* e) {
+    Entry** link = &shard->buckets[e->hash & shard->mask];
+    while (*link != e)
+      link = &(*link)->next;
+    *link = e->next;
+    if (e->flight == NULL) {
+      if (e->next_clock == e) {
+        shard->hand = NULL;
+      } else {
+        e->prev_clock->next_clock = e->next_clock;
+        e->next_clock->prev_clock = e->prev_clock;
+        if (shard->hand == e)
+          shard->hand = e->next_clock;
+      }
+      shard->size--;
+    }
+    delete e;
+  }
+
+  // the lock of the shard held.
+  static void Release(Flight* flight) {
+    if (--flight->refs == 0)
+      delete flight;
+  }
+
+  const uint32 shard_mask_;
+  Shard* shards_;
+  Hash hash_;
+  DISALLOW_COPY_AND_ASSIGN(Cache);
+};
+
+}  // namespace tin
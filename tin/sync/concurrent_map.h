@@ -0,0 +1,256 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+#include <string>
+
+#include "base/basictypes.h"
+#include "tin/sync/atomic.h"
+#include "tin/sync/mutex.h"
+#include "tin/runtime/epoch.h"
+#include "tin/util/hash.h"
+
+namespace tin {
+
+// hashes of ConcurrentMap keys, specialize it for keys of your own.
+template <typename K>
+struct ConcurrentMapHash;
+
+#define TIN_CONCURRENT_MAP_INT_HASH(type) \
+  template <> \
+  struct ConcurrentMapHash<type> { \
+    size_t operator()(type key) const { \
+      uint64 h = static_cast<uint64>(key) * GG_UINT64_C(0x9e3779b97f4a7c15); \
+      return static_cast<size_t>(h ^ (h >> 32)); \
+    } \
+  }
+
+TIN_CONCURRENT_MAP_INT_HASH(int32);
+TIN_CONCURRENT_MAP_INT_HASH(uint32);
+TIN_CONCURRENT_MAP_INT_HASH(int64);
+TIN_CONCURRENT_MAP_INT_HASH(uint64);
+
+#undef TIN_CONCURRENT_MAP_INT_HASH
+
+template <>
+struct ConcurrentMapHash<std::string> {
+  size_t operator()(const std::string& key) const {
+    uint64 h = Hash64(key.data(), key.size());
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+};
+
+// a hash map for lookups from many greenlets at once, say sessions by id.
+// Find takes no lock and writes nothing shared, it copies the value out
+// of nodes that are never changed in place: Insert and Erase link new
+// nodes in under the lock of a shard and leave the old ones to
+// runtime::EpochRetire. a shard doubles its buckets once it holds twice
+// as many entries, copying its chains so lookups on the old table go on.
+//
+// only greenlets may use it. the copy constructor of V must not block,
+// a lookup must not switch while it looks.
+template <typename K, typename V, typename Hash = ConcurrentMapHash<K> >
+class ConcurrentMap {
+ public:
+  // shards and initial_buckets per shard are rounded up to powers of 2.
+  explicit ConcurrentMap(int shards = 16, uint32 initial_buckets = 16)
+    : shard_mask_(RoundUp(shards) - 1)
+    , shards_(new Shard[shard_mask_ + 1]) {
+    uint32 buckets = RoundUp(initial_buckets);
+    for (uint32 i = 0; i <= shard_mask_; i++) {
+      shards_[i].table = reinterpret_cast<uintptr_t>(NewTable(buckets));
+    }
+  }
+
+  // nothing may use the map any more, frees what is left at once.
+  ~ConcurrentMap() {
+    for (uint32 i = 0; i <= shard_mask_; i++) {
+      Table* table = reinterpret_cast<Table*>(shards_[i].table);
+      for (uint32 b = 0; b <= table->mask; b++) {
+        Node* node = reinterpret_cast<Node*>(table->buckets[b]);
+        while (node != NULL) {
+          Node* next = reinterpret_cast<Node*>(node->next);
+          delete node;
+          node = next;
+        }
+      }
+      DeleteTable(table);
+    }
+    delete[] shards_;
+  }
+
+  // copies the value of key to *value if there is one, value may be NULL.
+  bool Find(const K& key, V* value) const {
+    size_t h = hash_(key);
+    const Shard* shard = &shards_[ShardOf(h)];
+    const Table* table =
+        reinterpret_cast<const Table*>(atomic::acquire_load(&shard->table));
+    uintptr_t next = atomic::acquire_load(&table->buckets[h & table->mask]);
+    while (next != 0) {
+      const Node* node = reinterpret_cast<const Node*>(next);
+      if (node->key == key) {
+        if (value != NULL)
+          *value = node->value;
+        return true;
+      }
+      next = atomic::acquire_load(&node->next);
+    }
+    return false;
+  }
+
+  bool Contains(const K& key) const {
+    return Find(key, NULL);
+  }
+
+  // sets the value of key, true if key was new.
+  bool Insert(const K& key, const V& value) {
+    size_t h = hash_(key);
+    Shard* shard = &shards_[ShardOf(h)];
+    MutexGuard guard(&shard->mu);
+    Table* table = reinterpret_cast<Table*>(shard->table);
+    uintptr_t* link = &table->buckets[h & table->mask];
+    while (*link != 0) {
+      Node* node = reinterpret_cast<Node*>(*link);
+      if (node->key == key) {
+        Node* fresh = new Node(key, value, node->next);
+        atomic::release_store(link, reinterpret_cast<uintptr_t>(fresh));
+        runtime::EpochRetire(node, &DeleteNode);
+        return false;
+      }
+      link = &node->next;
+    }
+    uintptr_t* head = &table->buckets[h & table->mask];
+    Node* fresh = new Node(key, value, *head);
+    atomic::release_store(head, reinterpret_cast<uintptr_t>(fresh));
+    atomic::relaxed_store(&shard->size, shard->size + 1);
+    if (shard->size > 2 * (table->mask + 1))
+      Grow(shard, table);
+    return true;
+  }
+
+  // true if key was there.
+  bool Erase(const K& key) {
+    size_t h = hash_(key);
+    Shard* shard = &shards_[ShardOf(h)];
+    MutexGuard guard(&shard->mu);
+    Table* table = reinterpret_cast<Table*>(shard->table);
+    uintptr_t* link = &table->buckets[h & table->mask];
+    while (*link != 0) {
+      Node* node = reinterpret_cast<Node*>(*link);
+      if (node->key == key) {
+        atomic::release_store(link, node->next);
+        atomic::relaxed_store(&shard->size, shard->size - 1);
+        runtime::EpochRetire(node, &DeleteNode);
+        return true;
+      }
+      link = &node->next;
+    }
+    return false;
+  }
+
+  // racy, exact only while no one writes.
+  size_t Size() const {
+    uintptr_t size = 0;
+    for (uint32 i = 0; i <= shard_mask_; i++)
+      size += atomic::relaxed_load(&shards_[i].size);
+    return static_cast<size_t>(size);
+  }
+
+ private:
+  struct Node {
+    Node(const K& k, const V& v, uintptr_t n)
+      : key(k)
+      , value(v)
+      , next(n) {
+    }
+
+    const K key;
+    const V value;
+    // the Node after, 0 at the end.
+    uintptr_t next;
+  };
+
+  struct Table {
+    uint32 mask;
+    // heads of the chains, 0 if empty.
+    uintptr_t* buckets;
+  };
+
+  struct Shard {
+    Shard()
+      : table(0)
+      , size(0) {
+    }
+
+    Mutex mu;
+    // the Table, replaced by Grow.
+    uintptr_t table;
+    uintptr_t size;
+    // shards are written by their own writers only.
+    char pad[64];
+  };
+
+  static uint32 RoundUp(uint32 n) {
+    uint32 v = 1;
+    while (v < n)
+      v *= 2;
+    return v;
+  }
+
+  static Table* NewTable(uint32 buckets) {
+    Table* table = new Table;
+    table->mask = buckets - 1;
+    table->buckets = new uintptr_t[buckets];
+    for (uint32 i = 0; i < buckets; i++)
+      table->buckets[i] = 0;
+    return table;
+  }
+
+  static void DeleteTable(void* ptr) {
+    Table* table = static_cast<Table*>(ptr);
+    delete[] table->buckets;
+    delete table;
+  }
+
+  static void DeleteNode(void* ptr) {
+    delete static_cast<Node*>(ptr);
+  }
+
+  uint32 ShardOf(size_t h) const {
+    // the low bits pick the bucket.
+    return static_cast<uint32>(h >> 24) & shard_mask_;
+  }
+
+  // copies every chain into a table twice the size, lookups still on the
+  // old one see it whole until it is retired.
+  void Grow(Shard* shard, Table* old) {
+    Table* table = NewTable(2 * (old->mask + 1));
+    for (uint32 b = 0; b <= old->mask; b++) {
+      for (Node* node = reinterpret_cast<Node*>(old->buckets[b]);
+           node != NULL; node = reinterpret_cast<Node*>(node->next)) {
+        uintptr_t* head = &table->buckets[hash_(node->key) & table->mask];
+        *head = reinterpret_cast<uintptr_t>(
+            new Node(node->key, node->value, *head));
+      }
+    }
+    atomic::release_store(&shard->table, reinterpret_cast<uintptr_t>(table));
+    for (uint32 b = 0; b <= old->mask; b++) {
+      Node* node = reinterpret_cast<Node*>(old->buckets[b]);
+      while (node != NULL) {
+        Node* next = reinterpret_cast<Node*>(node->next);
+        runtime::EpochRetire(node, &DeleteNode);
+        node = next;
+      }
+    }
+    runtime::EpochRetire(old, &DeleteTable);
+  }
+
+  const uint32 shard_mask_;
+  Shard* shards_;
+  Hash hash_;
+  DISALLOW_COPY_AND_ASSIGN(ConcurrentMap);
+};
+
+}  // namespace tin
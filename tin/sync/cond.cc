@@ -17,6 +17,25 @@ void Cond::Wait() {
   lock_->Lock();
 }
 
+bool Cond::WaitFor(int64 ns) {
+  atomic::Inc32(&waiters_, 1);
+  lock_->Unlock();
+  bool signaled = sem_.AcquireFor(ns);
+  while (!signaled) {
+    // take our count back, unless a signaller took it already and its
+    // release is on the way.
+    uint32 old_waiters = atomic::load32(&waiters_);
+    if (old_waiters == 0) {
+      sem_.Acquire();
+      signaled = true;
+    } else if (atomic::cas32(&waiters_, old_waiters, old_waiters - 1)) {
+      break;
+    }
+  }
+  lock_->Lock();
+  return signaled;
+}
+
 void Cond::Signal() {
   SignalImpl(false);
 }
@@ -19,6 +19,9 @@ class Cond {
     , waiters_(0) {
   }
   void Wait();
+  // returns false if not signaled within ns nano seconds, the lock is
+  // held again either way.
+  bool WaitFor(int64 ns);
   void Signal();
   void Broascast();
 
@@ -0,0 +1,133 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+
+#include "base/bind.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/semaphore.h"
+
+#include "tin/sync/executor.h"
+
+namespace tin {
+
+Executor::Executor(const ExecutorOptions& options)
+  : idle_(0)
+  , sema_(0) {
+  int shards = options.shards > 0 ? options.shards
+                                    : runtime::rtm_conf->MaxProcs();
+  for (int i = 0; i < shards; i++)
+    queues_.push_back(new Queue(options.queue_size));
+  int workers = shards * std::max(options.workers_per_shard, 1);
+  for (int i = 0; i < workers; i++) {
+    group_.Spawn(SpawnOptions(0, "executor"),
+                 base::Bind(&Executor::Work, base::Unretained(this),
+                            i % shards));
+  }
+}
+
+Executor::~Executor() {
+  Shutdown();
+  base::Closure task;
+  for (size_t i = 0; i < queues_.size(); i++) {
+    // dropped by Cancel.
+    while (queues_[i]->TryPop(&task)) {
+    }
+    delete queues_[i];
+  }
+}
+
+bool Executor::Submit(const base::Closure& closure) {
+  if (stopping_ || tin::Canceled()) {
+    SetErrorCode(TIN_ECANCELED);
+    return false;
+  }
+  int n = static_cast<int>(queues_.size());
+  int start = runtime::GetP()->Id() % n;
+  for (int i = 0; i < n; i++) {
+    if (queues_[(start + i) % n]->TryPush(closure)) {
+      Wake();
+      return true;
+    }
+  }
+  closure.Run();
+  return true;
+}
+
+void Executor::Shutdown() {
+  stopping_ = true;
+  // full barrier, a worker either sees stopping_ or is counted.
+  runtime::SemReleaseN(&sema_, atomic::exchange32(&idle_, 0));
+  group_.Wait();
+}
+
+void Executor::Cancel() {
+  stopping_ = true;
+  group_.Cancel();
+}
+
+void Executor::Work(int shard) {
+  base::Closure task;
+  while (!tin::Canceled()) {
+    if (Take(shard, &task)) {
+      task.Run();
+      task.Reset();
+      continue;
+    }
+    // announce ourselves, then look again so a Submit in between can't
+    // be missed.
+    atomic::Inc32(&idle_, 1);
+    if (Take(shard, &task)) {
+      CancelIdle();
+      task.Run();
+      task.Reset();
+      continue;
+    }
+    if (stopping_) {
+      CancelIdle();
+      return;
+    }
+    if (!runtime::SemAcquireCancelable(&sema_)) {
+      CancelIdle();
+      return;
+    }
+  }
+}
+
+bool Executor::Take(int shard, base::Closure* task) {
+  int n = static_cast<int>(queues_.size());
+  for (int i = 0; i < n; i++) {
+    if (queues_[(shard + i) % n]->TryPop(task))
+      return true;
+  }
+  return false;
+}
+
+// hands one parked worker a wakeup.
+void Executor::Wake() {
+  // full barrier, orders our push before reading idle_.
+  uint32 v = static_cast<uint32>(atomic::Inc32(&idle_, 0));
+  while (v > 0) {
+    if (atomic::cas32(&idle_, v, v - 1)) {
+      runtime::SemRelease(&sema_);
+      return;
+    }
+    v = atomic::load32(&idle_);
+  }
+}
+
+// we did not park after all. a wakeup already meant for us stays in the
+// semaphore and some later worker looks once more for nothing.
+void Executor::CancelIdle() {
+  uint32 v = atomic::load32(&idle_);
+  while (v > 0 && !atomic::cas32(&idle_, v, v - 1)) {
+    v = atomic::load32(&idle_);
+  }
+}
+
+}  // namespace tin
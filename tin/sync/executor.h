@@ -0,0 +1,71 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+#include <vector>
+
+#include "base/basictypes.h"
+#include "base/callback.h"
+#include "tin/sync/atomic_flag.h"
+#include "tin/sync/task_group.h"
+#include "tin/communication/ring_chan.h"
+
+namespace tin {
+
+struct ExecutorOptions {
+  ExecutorOptions()
+    : shards(0)
+    , workers_per_shard(1)
+    , queue_size(1024) {
+  }
+
+  // queues, 0 for one per P.
+  int shards;
+  int workers_per_shard;
+  // closures a queue holds.
+  uint32 queue_size;
+};
+
+// runs small closures on long lived worker greenlets, a task costs a ring
+// push and pop instead of a greenlet. Submit pushes to the queue of the
+// current P, an idle worker takes from its own queue first and steals
+// from the others after. the workers are children of a TaskGroup, Cancel
+// or a canceled Shutdown caller cancels the closures running and drops
+// the queued ones.
+class Executor {
+ public:
+  explicit Executor(const ExecutorOptions& options = ExecutorOptions());
+  // Shutdown.
+  ~Executor();
+
+  // false with TIN_ECANCELED once stopping or if the caller is canceled.
+  // when every queue is full the caller runs the closure itself, which
+  // holds submitters to the pace of the workers.
+  bool Submit(const base::Closure& closure);
+
+  // runs what is queued and waits for the workers to exit.
+  void Shutdown();
+
+  // stops at once, see TaskGroup::Cancel.
+  void Cancel();
+
+ private:
+  typedef MpmcRing<base::Closure> Queue;
+
+  void Work(int shard);
+  bool Take(int shard, base::Closure* task);
+  void Wake();
+  void CancelIdle();
+
+  std::vector<Queue*> queues_;
+  AtomicFlag stopping_;
+  // workers parked on sema_.
+  uint32 idle_;
+  uint32 sema_;
+  TaskGroup group_;
+  DISALLOW_COPY_AND_ASSIGN(Executor);
+};
+
+}  // namespace tin
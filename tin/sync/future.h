@@ -0,0 +1,103 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+#include "base/basictypes.h"
+#include "base/bind.h"
+#include "base/callback.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/spawn.h"
+
+namespace tin {
+
+// the result of a callback run on its own joinable greenlet. the value is
+// written straight into the future and the joiner parks on the greenlet,
+// no channel or semaphore per result. T must be default constructible,
+// the future must outlive the greenlet, the destructor joins.
+//
+//   tin::Future<int> replies[3];
+//   for (int i = 0; i < 3; i++)
+//     replies[i].Spawn(base::Bind(&Call, backends[i]));
+//   for (int i = 0; i < 3; i++)
+//     sum += replies[i].Join();
+template <typename T>
+class Future {
+ public:
+  Future()
+    : gp_(NULL)
+    , value_() {
+  }
+
+  ~Future() {
+    if (gp_ != NULL)
+      Join();
+  }
+
+  // once per future, or again after Join.
+  void Spawn(const base::Callback<T(void)>& callback,
+             const SpawnOptions& opts = SpawnOptions()) {
+    DCHECK(gp_ == NULL);
+    gp_ = runtime::SpawnJoinable(
+        base::Bind(&Future::Run, base::Unretained(this), callback), opts);
+  }
+
+  bool Valid() const {
+    return gp_ != NULL;
+  }
+
+  // parks until the callback returned, later calls return the value as is.
+  const T& Join() {
+    if (gp_ != NULL) {
+      runtime::JoinGreenlet(gp_);
+      gp_ = NULL;
+    }
+    return value_;
+  }
+
+ private:
+  static void Run(Future* self, const base::Callback<T(void)>& callback) {
+    self->value_ = callback.Run();
+  }
+
+  runtime::G* gp_;
+  T value_;
+  DISALLOW_COPY_AND_ASSIGN(Future);
+};
+
+template <>
+class Future<void> {
+ public:
+  Future()
+    : gp_(NULL) {
+  }
+
+  ~Future() {
+    if (gp_ != NULL)
+      Join();
+  }
+
+  void Spawn(const base::Closure& closure,
+             const SpawnOptions& opts = SpawnOptions()) {
+    DCHECK(gp_ == NULL);
+    gp_ = runtime::SpawnJoinable(closure, opts);
+  }
+
+  bool Valid() const {
+    return gp_ != NULL;
+  }
+
+  void Join() {
+    if (gp_ != NULL) {
+      runtime::JoinGreenlet(gp_);
+      gp_ = NULL;
+    }
+  }
+
+ private:
+  runtime::G* gp_;
+  DISALLOW_COPY_AND_ASSIGN(Future);
+};
+
+}  // namespace tin
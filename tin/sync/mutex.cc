@@ -4,6 +4,8 @@
 
 #include "base/logging.h"
 #include "tin/sync/atomic.h"
+#include "tin/time/time.h"
+#include "tin/runtime/runtime.h"
 #include "tin/runtime/raw_mutex.h"
 #include "tin/runtime/spin.h"
 #include "tin/runtime/semaphore.h"
@@ -15,8 +17,45 @@ namespace tin {
 namespace {
 const int32 kMutexLocked = 1;  // mutex is locked
 const int32 kMutexWoken = 2;
-const int32 kMutexWaiterShift = 2;
+// ownership is handed from Unlock to the first waiter, newcomers queue up
+// behind the waiters instead of grabbing the lock.
+const int32 kMutexStarving = 4;
+const int32 kMutexWaiterShift = 3;
+
+// a waiter parked longer than it switches the mutex to starvation mode.
+const int64 kStarvationThresholdNs = 1 * tin::kMillisecond;
+
+// shared by every Mutex and touched only on the slow path, an uncontended
+// Lock never writes this line. GetMutexStats reads it unlocked.
+struct MutexCounters {
+  uintptr_t contended;
+  uintptr_t wait_ns;
+  uintptr_t max_wait_ns;
+  uintptr_t starving;
+};
+
+MutexCounters counters;
+
+void CounterAdd(uintptr_t* counter, uintptr_t n) {
+  uintptr_t old = atomic::relaxed_load(counter);
+  while (!atomic::cas(counter, old, old + n)) {
+    old = atomic::relaxed_load(counter);
+  }
+}
+
+void CounterMax(uintptr_t* counter, uintptr_t n) {
+  uintptr_t old = atomic::relaxed_load(counter);
+  while (n > old && !atomic::cas(counter, old, n)) {
+    old = atomic::relaxed_load(counter);
+  }
+}
+
+void RecordWait(int64 wait_ns) {
+  CounterAdd(&counters.contended, 1);
+  CounterAdd(&counters.wait_ns, static_cast<uintptr_t>(wait_ns));
+  CounterMax(&counters.max_wait_ns, static_cast<uintptr_t>(wait_ns));
 }
+}  // namespace
 
 Mutex::Mutex()
   : state_(0)
@@ -30,28 +69,62 @@ void Mutex::Lock() {
   if (atomic::cas32(&state_, 0, kMutexLocked)) {
     return;
   }
+  LockSlow(-1);
+}
+
+bool Mutex::TryLock() {
+  int32 old_state = atomic::relaxed_load32(&state_);
+  // a starving mutex belongs to its first waiter.
+  if ((old_state & (kMutexLocked | kMutexStarving)) != 0)
+    return false;
+  return atomic::cas32(&state_, old_state, old_state | kMutexLocked);
+}
+
+bool Mutex::LockFor(int64 ns) {
+  if (atomic::cas32(&state_, 0, kMutexLocked))
+    return true;
+  if (ns <= 0)
+    return TryLock();
+  return LockSlow(MonoNow() + ns);
+}
+
+bool Mutex::LockSlow(int64 deadline) {
+  bool locked = true;
+  int64 wait_start = 0;
+  bool starving = false;
   bool awoke = false;
   int32 iter = 0;
+  int spin_limit = spin_.Limit();
+  int32 old_state = state_;
   while (true) {
-    int32 old_state = state_;
-    int32 new_state = old_state | kMutexLocked;
-    if ((old_state & kMutexLocked) != 0) {
-      if (tin::runtime::CanSpin(iter)) {
-        // Active spinning makes sense.
-        // Try to set mutexWoken flag to inform Unlock
-        // to not wake other blocked goroutines.
-        if ((!awoke) &&
-            ((old_state & kMutexWoken) == 0) &&
-            ((old_state >> kMutexWaiterShift) != 0) &&
-            atomic::cas32(&state_, old_state, old_state | kMutexWoken)) {
-          awoke = true;
-        }
-        tin::runtime::DoSpin();
-        iter++;
-        continue;
+    // Don't spin in starvation mode, ownership is handed off to waiters
+    // so we won't be able to acquire the mutex anyway.
+    if ((old_state & (kMutexLocked | kMutexStarving)) == kMutexLocked &&
+        tin::runtime::CanSpin(iter, spin_limit)) {
+      // Active spinning makes sense.
+      // Try to set mutexWoken flag to inform Unlock
+      // to not wake other blocked goroutines.
+      if ((!awoke) &&
+          ((old_state & kMutexWoken) == 0) &&
+          ((old_state >> kMutexWaiterShift) != 0) &&
+          atomic::cas32(&state_, old_state, old_state | kMutexWoken)) {
+        awoke = true;
       }
-      new_state = old_state + (1 << kMutexWaiterShift);
+      tin::runtime::DoSpin();
+      iter++;
+      old_state = state_;
+      continue;
     }
+    int32 new_state = old_state;
+    // Don't try to acquire starving mutex, new arriving greenlets queue.
+    if ((old_state & kMutexStarving) == 0)
+      new_state |= kMutexLocked;
+    if ((old_state & (kMutexLocked | kMutexStarving)) != 0)
+      new_state += 1 << kMutexWaiterShift;
+    // switch to starvation mode, only if the mutex is still locked.
+    // Unlock expects a starving mutex to have waiters.
+    if (starving && (old_state & kMutexLocked) != 0)
+      new_state |= kMutexStarving;
     if (awoke) {
       // The goroutine has been woken from sleep,
       // so we need to reset the flag in either case.
@@ -61,13 +134,85 @@ void Mutex::Lock() {
       // clear mutexWoken bit.
       new_state &= ~kMutexWoken;
     }
-    if (atomic::cas32(&state_, old_state, new_state)) {
-      if ((old_state & kMutexLocked) == 0)
+    if (!atomic::cas32(&state_, old_state, new_state)) {
+      old_state = state_;
+      continue;
+    }
+    if ((old_state & (kMutexLocked | kMutexStarving)) == 0) {
+      // locked with cas.
+      if (wait_start == 0 && iter > 0)
+        spin_.Update(iter, true);
+      break;
+    }
+    // waited before, queue at the front.
+    bool lifo = wait_start != 0;
+    if (wait_start == 0) {
+      if (iter > 0)
+        spin_.Update(iter, false);
+      wait_start = MonoNow();
+    }
+    if (deadline < 0) {
+      tin::runtime::SemAcquireMutex(&sema_, lifo);
+    } else if (!tin::runtime::SemAcquireMutexFor(&sema_, lifo,
+                                                 deadline - MonoNow())) {
+      if (LeaveWaiters()) {
+        locked = false;
         break;
-      tin::runtime::SemAcquire(&sema_);
-      awoke = true;
-      iter = 0;
+      }
+      // the wakeup owed to us is a moment away, carry on as woken.
+      tin::runtime::SemAcquireMutex(&sema_, true);
+    }
+    int64 waited = MonoNow() - wait_start;
+    if (!starving && waited > kStarvationThresholdNs) {
+      starving = true;
+      CounterAdd(&counters.starving, 1);
+    }
+    old_state = state_;
+    if ((old_state & kMutexStarving) != 0) {
+      // ownership was handed off to us, but the mutex is in somewhat
+      // inconsistent state: locked is not set and we are still accounted
+      // as waiter. fix that.
+      if ((old_state & (kMutexLocked | kMutexWoken)) != 0 ||
+          (old_state >> kMutexWaiterShift) == 0) {
+        LOG(FATAL) << "sync: inconsistent mutex state";
+      }
+      int32 delta = kMutexLocked - (1 << kMutexWaiterShift);
+      if (!starving || (old_state >> kMutexWaiterShift) == 1) {
+        // exit starvation mode when we are the last waiter or waited
+        // shortly, it's much less efficient than normal mode.
+        delta -= kMutexStarving;
+      }
+      atomic::Inc32(&state_, delta);
+      break;
     }
+    awoke = true;
+    iter = 0;
+  }
+  if (wait_start != 0)
+    RecordWait(MonoNow() - wait_start);
+  return locked;
+}
+
+bool Mutex::LeaveWaiters() {
+  while (true) {
+    int32 old_state = atomic::load32(&state_);
+    int32 waiters = old_state >> kMutexWaiterShift;
+    bool owed = false;
+    if ((old_state & kMutexStarving) != 0) {
+      // handed off, and nobody else queued to pass it on.
+      owed = (old_state & kMutexLocked) == 0 && waiters == 1;
+    } else {
+      // Unlock took a waiter off for its wakeup.
+      owed = waiters == 0;
+    }
+    if (owed)
+      return false;
+    int32 new_state = old_state - (1 << kMutexWaiterShift);
+    // Unlock expects a starving mutex to have waiters.
+    if (waiters == 1)
+      new_state &= ~kMutexStarving;
+    if (atomic::cas32(&state_, old_state, new_state))
+      return true;
   }
 }
 
@@ -78,21 +223,38 @@ void Mutex::Unlock() {
     LOG(FATAL) << "sync: unlock of unlocked mutex";
   }
 
+  if ((new_state & kMutexStarving) != 0) {
+    // Starving mode: handoff mutex ownership to the next waiter, it runs
+    // next in place of us. mutexLocked is not set, the waiter sets it
+    // after wakeup, newcomers don't acquire it as mutexStarving is set.
+    tin::runtime::SemReleaseHandoff(&sema_);
+    return;
+  }
+
   int32 old_state = new_state;
   while (true) {
     // If there are no waiters or a goroutine has already
     // been woken or grabbed the lock, no need to wake anyone.
+    // in starvation mode ownership is directly handed off.
     if ((old_state >> kMutexWaiterShift) == 0 ||
-        (old_state & (kMutexLocked | kMutexWoken)) != 0) {
+        (old_state & (kMutexLocked | kMutexWoken | kMutexStarving)) != 0) {
       return;
     }
     // Grab the right to wake someone.
     new_state = (old_state - (1 << kMutexWaiterShift)) | kMutexWoken;
     if (atomic::cas32(&state_, old_state, new_state)) {
       tin::runtime::SemRelease(&sema_);
+      return;
     }
     old_state = state_;
   }
 }
 
+void GetMutexStats(MutexStats* stats) {
+  stats->contended = atomic::relaxed_load(&counters.contended);
+  stats->wait_ns = atomic::relaxed_load(&counters.wait_ns);
+  stats->max_wait_ns = atomic::relaxed_load(&counters.max_wait_ns);
+  stats->starving = atomic::relaxed_load(&counters.starving);
+}
+
 }  // namespace tin
@@ -5,20 +5,37 @@
 #pragma once
 #include <stdlib.h>
 #include "base/basictypes.h"
+#include "tin/runtime/spin.h"
 
 namespace tin {
 
-// Mutex is a Futex implementation.
+// Mutex is a Futex implementation. a waiter parked for more than 1ms
+// switches it to starvation mode, Unlock then hands ownership directly to
+// the first waiter until the queue drains. a contended Lock spins as long
+// as spinning got this mutex lately, see runtime::spin::Adaptive.
 class Mutex {
  public:
   Mutex();
   ~Mutex();
   void Lock();
+  // takes the mutex only if it is free and no waiter is owed it, never
+  // spins or parks.
+  bool TryLock();
+  // false if the mutex was not taken within ns nano seconds. the timeout
+  // rides the timer of the greenlet, like SemAcquireFor.
+  bool LockFor(int64 ns);
   void Unlock();
 
  private:
+  // deadline -1 waits for ever.
+  bool LockSlow(int64 deadline);
+  // takes a waiter that timed out off the count, false if an Unlock
+  // already counted it and its wakeup is on the way.
+  bool LeaveWaiters();
+
   int32 state_;
   uint32 sema_;
+  runtime::spin::Adaptive spin_;
   DISALLOW_COPY_AND_ASSIGN(Mutex);
 };
 
@@ -37,5 +54,17 @@ class  MutexGuard {
   DISALLOW_COPY_AND_ASSIGN(MutexGuard);
 };
 
+// contended Lock calls over all mutexes since start up.
+struct MutexStats {
+  // Lock calls that had to park.
+  uint64 contended;
+  // total and longest time spent in those calls, in nano seconds.
+  uint64 wait_ns;
+  uint64 max_wait_ns;
+  // times a waiter switched a mutex to starvation mode.
+  uint64 starving;
+};
+
+void GetMutexStats(MutexStats* stats);
 
 }  // namespace tin
@@ -0,0 +1,46 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+
+#include "base/basictypes.h"
+
+#include "tin/sync/atomic.h"
+#include "tin/sync/mutex.h"
+
+namespace tin {
+
+// Once runs a function exactly once, like Go's sync.Once. greenlets
+// calling Do meanwhile park on a tin::Mutex instead of blocking the M,
+// and return when the function is done.
+class Once {
+ public:
+  Once()
+    : done_(0) {
+  }
+
+  // f is a function or a functor taking no arguments.
+  template <class F>
+  void Do(F f) {
+    if (atomic::acquire_load32(&done_) != 0)
+      return;
+    MutexGuard guard(&mu_);
+    if (done_ == 0) {
+      f();
+      atomic::release_store32(&done_, 1);
+    }
+  }
+
+  bool Done() const {
+    return atomic::acquire_load32(&done_) != 0;
+  }
+
+ private:
+  uint32 done_;
+  Mutex mu_;
+  DISALLOW_COPY_AND_ASSIGN(Once);
+};
+
+}  // namespace tin
@@ -0,0 +1,93 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/logging.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/scheduler.h"
+#include "tin/runtime/spawn.h"
+
+#include "tin/sync/parallel.h"
+
+namespace tin {
+
+namespace internal {
+
+namespace {
+
+const uintptr_t kParallelDone = 1;
+
+bool ParallelCommit(void* arg1, void* arg2) {
+  uintptr_t* waiter = static_cast<uintptr_t*>(arg2);
+  // fails once the last half is done, the waiter is requeued then.
+  return atomic::release_cas(waiter, 0, reinterpret_cast<uintptr_t>(arg1));
+}
+
+}  // namespace
+
+bool ParallelShouldSplit() {
+  return runtime::sched->NrIdleP() > 0;
+}
+
+void ParallelFork(ParallelJoin* join, const base::Closure& task) {
+  atomic::Inc32(&join->pending, 1);
+  DoSpawn(SpawnOptions(0, "parallel"), task);
+}
+
+void ParallelDone(ParallelJoin* join) {
+  if (atomic::Inc32(&join->pending, -1) != 0)
+    return;
+  // the last touch of join, the waiter may return right after.
+  uintptr_t waiter = atomic::exchange(&join->waiter, kParallelDone);
+  if (waiter != 0)
+    runtime::Ready(runtime::GpCastBack(waiter));
+}
+
+void ParallelWait(ParallelJoin* join) {
+  // nothing forked or all of it done already.
+  if (atomic::Inc32(&join->pending, -1) == 0)
+    return;
+  runtime::G* gp = runtime::GetG();
+  while (atomic::acquire_load(&join->waiter) != kParallelDone)
+    runtime::Park(ParallelCommit, gp, &join->waiter, runtime::kParkJoin);
+}
+
+}  // namespace internal
+
+namespace {
+
+void RunRange(int64 lo, int64 hi, int64 grain, const ParallelRangeFunc* fn,
+              internal::ParallelJoin* join);
+
+void RunForked(int64 lo, int64 hi, int64 grain, const ParallelRangeFunc* fn,
+               internal::ParallelJoin* join) {
+  RunRange(lo, hi, grain, fn, join);
+  internal::ParallelDone(join);
+}
+
+void RunRange(int64 lo, int64 hi, int64 grain, const ParallelRangeFunc* fn,
+              internal::ParallelJoin* join) {
+  // halves go to whoever is idle, the front stays here.
+  while (hi - lo > grain && internal::ParallelShouldSplit()) {
+    int64 mid = lo + (hi - lo) / 2;
+    internal::ParallelFork(join,
+                           base::Bind(&RunForked, mid, hi, grain, fn, join));
+    hi = mid;
+  }
+  if (lo < hi)
+    fn->Run(lo, hi);
+}
+
+}  // namespace
+
+void ParallelFor(int64 begin, int64 end, int64 grain,
+                 const ParallelRangeFunc& fn) {
+  DCHECK(runtime::GetG() != NULL) << "ParallelFor outside of a greenlet";
+  internal::ParallelJoin join;
+  RunRange(begin, end, grain < 1 ? 1 : grain, &fn, &join);
+  internal::ParallelWait(&join);
+}
+
+}  // namespace tin
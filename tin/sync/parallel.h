@@ -0,0 +1,105 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+
+#include "base/basictypes.h"
+#include "base/bind.h"
+#include "base/callback.h"
+
+namespace tin {
+
+// fn(lo, hi) runs the items [lo, hi) of a range.
+typedef base::Callback<void(int64, int64)> ParallelRangeFunc;
+
+// runs fn over [begin, end) in pieces of at least grain items. while a P
+// is idle the range is halved and one half is spawned, which idle Ps
+// steal from the runq of this P and halve again, without idle Ps the
+// rest runs inline. returns once all of it ran. from greenlets only.
+void ParallelFor(int64 begin, int64 end, int64 grain,
+                 const ParallelRangeFunc& fn);
+
+namespace internal {
+
+// a spawned half and the greenlet waiting for it. pending counts the
+// halves running plus one for the waiter, so it reaches 0 only once.
+struct ParallelJoin {
+  ParallelJoin()
+    : pending(1)
+    , waiter(0) {
+  }
+
+  uint32 pending;
+  // the parked waiter, or done.
+  uintptr_t waiter;
+};
+
+// true while an idle P could take half of a range.
+bool ParallelShouldSplit();
+// spawns task, which calls ParallelDone(join) once it finishes.
+void ParallelFork(ParallelJoin* join, const base::Closure& task);
+void ParallelDone(ParallelJoin* join);
+// parks until every task forked on join is done.
+void ParallelWait(ParallelJoin* join);
+
+template <class T>
+struct ParallelReduceTask {
+  typedef base::Callback<T(int64, int64)> MapFunc;
+  typedef base::Callback<T(const T&, const T&)> ReduceFunc;
+
+  ParallelReduceTask(int64 lo, int64 hi, int64 grain, const T* identity,
+                     const MapFunc* map, const ReduceFunc* reduce)
+    : lo(lo)
+    , hi(hi)
+    , grain(grain)
+    , identity(identity)
+    , map(map)
+    , reduce(reduce) {
+  }
+
+  T Run() const {
+    if (hi - lo > grain && ParallelShouldSplit()) {
+      int64 mid = lo + (hi - lo) / 2;
+      ParallelReduceTask right(mid, hi, grain, identity, map, reduce);
+      ParallelFork(&right.join,
+                   base::Bind(&ParallelReduceTask::RunForked,
+                              base::Unretained(&right)));
+      T left = ParallelReduceTask(lo, mid, grain, identity, map,
+                                  reduce).Run();
+      ParallelWait(&right.join);
+      return reduce->Run(left, right.result);
+    }
+    return lo < hi ? map->Run(lo, hi) : *identity;
+  }
+
+  void RunForked() {
+    result = Run();
+    ParallelDone(&join);
+  }
+
+  int64 lo;
+  int64 hi;
+  int64 grain;
+  const T* identity;
+  const MapFunc* map;
+  const ReduceFunc* reduce;
+  T result;
+  ParallelJoin join;
+};
+
+}  // namespace internal
+
+// reduce(map(lo, hi)...) over the pieces of [begin, end), split like
+// ParallelFor. reduce must be associative, the pieces are combined in
+// range order. identity is the result of an empty range.
+template <class T>
+T ParallelReduce(int64 begin, int64 end, int64 grain, const T& identity,
+                 const base::Callback<T(int64, int64)>& map,
+                 const base::Callback<T(const T&, const T&)>& reduce) {
+  internal::ParallelReduceTask<T> task(begin, end, grain < 1 ? 1 : grain,
+                                       &identity, &map, &reduce);
+  return task.Run();
+}
+
+}  // namespace tin
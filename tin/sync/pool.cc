@@ -0,0 +1,85 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <vector>
+
+#include "base/logging.h"
+
+#include "tin/runtime/env.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/scheduler.h"
+
+#include "tin/sync/pool.h"
+
+namespace tin {
+namespace internal {
+
+COMPILE_ASSERT(kPoolProcsLimit == runtime::kTinProcsLimit,
+               pool_procs_limit_mismatch);
+
+namespace {
+// guards the list of pools, TakeCached of each pool is called under it.
+runtime::RawMutex pools_lock;
+PoolBase* pools = NULL;
+}  // namespace
+
+PoolBase::PoolBase()
+  : registered_(true)
+  , prev_(NULL)
+  , next_(NULL) {
+  runtime::RawMutexGuard guard(&pools_lock);
+  next_ = pools;
+  if (pools != NULL)
+    pools->prev_ = this;
+  pools = this;
+}
+
+PoolBase::~PoolBase() {
+  Unregister();
+}
+
+void PoolBase::Unregister() {
+  runtime::RawMutexGuard guard(&pools_lock);
+  if (!registered_)
+    return;
+  registered_ = false;
+  if (prev_ != NULL) {
+    prev_->next_ = next_;
+  } else {
+    pools = next_;
+  }
+  if (next_ != NULL)
+    next_->prev_ = prev_;
+}
+
+int PoolProcId() {
+  runtime::G* gp = runtime::GetGOrNull();
+  if (gp == NULL || gp->M() == NULL || gp->M()->P() == NULL) {
+    return -1;
+  }
+  return gp->M()->P()->Id();
+}
+
+void DrainAllPools() {
+  // the destructors may be slow or take locks, not under the spin lock.
+  std::vector<PoolBase::Batch*> batches;
+  {
+    runtime::RawMutexGuard guard(&pools_lock);
+    for (PoolBase* p = pools; p != NULL; p = p->next_) {
+      PoolBase::Batch* batch = p->TakeCached();
+      if (batch != NULL)
+        batches.push_back(batch);
+    }
+  }
+  for (size_t i = 0; i < batches.size(); i++) {
+    delete batches[i];
+  }
+}
+
+}  // namespace internal
+}  // namespace tin
@@ -0,0 +1,219 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+#include <vector>
+
+#include "base/basictypes.h"
+
+#include "tin/sync/atomic.h"
+#include "tin/runtime/raw_mutex.h"
+
+namespace tin {
+namespace internal {
+
+// same as runtime::kTinProcsLimit.
+const int kPoolProcsLimit = 256;
+
+// every pool is linked into a global list, so DrainPools can find it.
+class PoolBase {
+ public:
+  PoolBase();
+  virtual ~PoolBase();
+
+  // objects taken out of a pool, freed with the batch.
+  class Batch {
+   public:
+    virtual ~Batch() {}
+  };
+
+  // takes what is cached, Ps drop theirs when they use the pool next time.
+  // NULL if there is nothing. frees no object, so it may run under
+  // pools_lock.
+  virtual Batch* TakeCached() = 0;
+
+ protected:
+  // called first thing by the destructor of a pool, so that DrainPools
+  // can't race with it.
+  void Unregister();
+
+ private:
+  friend void DrainAllPools();
+  bool registered_;
+  PoolBase* prev_;
+  PoolBase* next_;
+  DISALLOW_COPY_AND_ASSIGN(PoolBase);
+};
+
+// id of the P running the caller, -1 outside of greenlets.
+int PoolProcId();
+
+void DrainAllPools();
+
+}  // namespace internal
+
+// frees what all pools cache, sysmon calls it when the process has been
+// idle for a while.
+inline void DrainPools() {
+  internal::DrainAllPools();
+}
+
+// Pool caches free objects of type T, like Go's sync.Pool. Get and Put
+// use a small cache of the current P without any locking or atomic RMW,
+// it's refilled from or spilled to a shared list guarded by a RawMutex.
+// cached objects may be deleted any time, don't keep state in them.
+template <class T>
+class Pool : public internal::PoolBase {
+ public:
+  typedef T* (*NewFunc)();
+
+  // new_func makes an object if the pool is empty, with NULL Get returns
+  // NULL then.
+  explicit Pool(NewFunc new_func = NULL)
+    : new_func_(new_func)
+    , gen_(0) {
+    for (int i = 0; i < internal::kPoolProcsLimit; i++) {
+      locals_[i] = NULL;
+    }
+  }
+
+  virtual ~Pool() {
+    Unregister();
+    for (int i = 0; i < internal::kPoolProcsLimit; i++) {
+      if (locals_[i] != NULL) {
+        DropLocal(locals_[i]);
+        delete locals_[i];
+      }
+    }
+    Drain();
+  }
+
+  T* Get() {
+    Local* l = GetLocal();
+    if (l != NULL && l->count > 0)
+      return l->items[--l->count];
+    {
+      runtime::RawMutexGuard guard(&lock_);
+      if (!shared_.empty()) {
+        T* t = shared_.back();
+        shared_.pop_back();
+        // take some more for next time.
+        while (l != NULL && l->count < kLocalSize / 2 && !shared_.empty()) {
+          l->items[l->count++] = shared_.back();
+          shared_.pop_back();
+        }
+        return t;
+      }
+    }
+    return new_func_ != NULL ? new_func_() : NULL;
+  }
+
+  void Put(T* t) {
+    if (t == NULL)
+      return;
+    Local* l = GetLocal();
+    if (l != NULL && l->count < kLocalSize) {
+      l->items[l->count++] = t;
+      return;
+    }
+    T* spill[kLocalSize / 2 + 1];
+    int n = 0;
+    spill[n++] = t;
+    if (l != NULL) {
+      // move the older half to the shared list.
+      for (int i = 0; i < kLocalSize / 2; i++) {
+        spill[n++] = l->items[i];
+      }
+      for (int i = kLocalSize / 2; i < l->count; i++) {
+        l->items[i - kLocalSize / 2] = l->items[i];
+      }
+      l->count -= kLocalSize / 2;
+    }
+    int kept = 0;
+    {
+      runtime::RawMutexGuard guard(&lock_);
+      while (kept < n && shared_.size() < static_cast<size_t>(kSharedMax)) {
+        shared_.push_back(spill[kept++]);
+      }
+    }
+    for (int i = kept; i < n; i++) {
+      delete spill[i];
+    }
+  }
+
+ private:
+  enum {
+    kLocalSize = 16,
+    kSharedMax = 1024
+  };
+
+  struct Local {
+    // gen_ when it was drained last.
+    uint32 gen;
+    int32 count;
+    T* items[kLocalSize];
+  };
+
+  // NULL outside of greenlets, those use the shared list only.
+  Local* GetLocal() {
+    int id = internal::PoolProcId();
+    if (id < 0)
+      return NULL;
+    Local* l = locals_[id];
+    if (l == NULL) {
+      l = new Local;
+      l->count = 0;
+      l->gen = atomic::acquire_load32(&gen_);
+      locals_[id] = l;
+    } else if (l->gen != atomic::acquire_load32(&gen_)) {
+      DropLocal(l);
+      l->gen = atomic::acquire_load32(&gen_);
+    }
+    return l;
+  }
+
+  void DropLocal(Local* l) {
+    for (int32 i = 0; i < l->count; i++) {
+      delete l->items[i];
+    }
+    l->count = 0;
+  }
+
+  class Items : public Batch {
+   public:
+    virtual ~Items() {
+      for (size_t i = 0; i < items.size(); i++) {
+        delete items[i];
+      }
+    }
+
+    std::vector<T*> items;
+  };
+
+  virtual Batch* TakeCached() {
+    Items* batch = NULL;
+    runtime::RawMutexGuard guard(&lock_);
+    atomic::Inc32(&gen_, 1);
+    if (!shared_.empty()) {
+      batch = new Items;
+      batch->items.swap(shared_);
+    }
+    return batch;
+  }
+
+  void Drain() {
+    delete TakeCached();
+  }
+
+  NewFunc new_func_;
+  uint32 gen_;
+  runtime::RawMutex lock_;
+  std::vector<T*> shared_;
+  // only the M owning P i touches locals_[i].
+  Local* locals_[internal::kPoolProcsLimit];
+  DISALLOW_COPY_AND_ASSIGN(Pool);
+};
+
+}  // namespace tin
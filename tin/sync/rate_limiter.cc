@@ -0,0 +1,87 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/time/time.h"
+#include "tin/runtime/runtime.h"
+
+#include "tin/sync/rate_limiter.h"
+
+namespace tin {
+
+namespace {
+
+int64 Interval(int64 per_second) {
+  DCHECK_GT(per_second, 0);
+  return std::max<int64>(kSecond / per_second, 1);
+}
+
+}  // namespace
+
+RateLimiter::RateLimiter(int64 per_second, int64 burst)
+  : interval_(Interval(per_second))
+  , burst_(burst)
+  , tat_(0) {
+}
+
+bool RateLimiter::TryAcquire(int64 n) {
+  return Reserve(n, 0) == 0;
+}
+
+bool RateLimiter::Acquire(int64 n) {
+  return Wait(n, kint64max);
+}
+
+bool RateLimiter::AcquireFor(int64 n, int64 ns) {
+  return Wait(n, ns < 0 ? 0 : ns);
+}
+
+void RateLimiter::SetRate(int64 per_second) {
+  int64 interval = Interval(per_second);
+  runtime::RawMutexGuard guard(&lock_);
+  int64 now = MonoNow();
+  if (tat_ > now)
+    tat_ = now + (tat_ - now) / interval_ * interval;
+  interval_ = interval;
+}
+
+int64 RateLimiter::Reserve(int64 n, int64 max_wait) {
+  runtime::RawMutexGuard guard(&lock_);
+  int64 now = MonoNow();
+  int64 tat = std::max(tat_, now) + n * interval_;
+  int64 wait = std::max<int64>(tat - burst_ * interval_ - now, 0);
+  if (wait > max_wait)
+    return -1;
+  tat_ = tat;
+  return wait;
+}
+
+bool RateLimiter::Wait(int64 n, int64 max_wait) {
+  if (n > burst_) {
+    SetErrorCode(TIN_EINVAL);
+    return false;
+  }
+  int64 wait = Reserve(n, max_wait);
+  if (wait < 0) {
+    SetErrorCode(TIN_ETIMEDOUT);
+    return false;
+  }
+  if (wait == 0)
+    return true;
+  int64 due = MonoNow() + wait;
+  // no slack, the tokens are due at that very moment.
+  SleepWithSlack(wait, 0);
+  if (MonoNow() < due) {
+    // canceled, the sleep has set the error code.
+    runtime::RawMutexGuard guard(&lock_);
+    tat_ -= n * interval_;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace tin
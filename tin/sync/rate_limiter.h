@@ -0,0 +1,51 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+#include "base/basictypes.h"
+#include "tin/runtime/raw_mutex.h"
+
+namespace tin {
+
+// token bucket refilled with per_second tokens, holding at most burst.
+// a waiter reserves its tokens up front and sleeps on one timer until they
+// are due, so waiters are served in order and nobody polls.
+class RateLimiter {
+ public:
+  // per_second is at most one token per nano second. starts full.
+  RateLimiter(int64 per_second, int64 burst);
+
+  // takes n tokens if they are there now.
+  bool TryAcquire(int64 n = 1);
+
+  // parks until n tokens are due. false with TIN_EINVAL if n > burst, or
+  // with TIN_ECANCELED if the greenlet is canceled, the tokens are given
+  // back then.
+  bool Acquire(int64 n = 1);
+
+  // false with TIN_ETIMEDOUT right away, without taking tokens, if n would
+  // not be due within ns nano seconds.
+  bool AcquireFor(int64 n, int64 ns);
+
+  // keeps the tokens there are.
+  void SetRate(int64 per_second);
+
+ private:
+  // reserves n tokens, returns how long until they are due or -1 if that
+  // is later than max_wait.
+  int64 Reserve(int64 n, int64 max_wait);
+  bool Wait(int64 n, int64 max_wait);
+
+  runtime::RawMutex lock_;
+  // nano seconds per token.
+  int64 interval_;
+  int64 burst_;
+  // the bucket lacks (tat_ - now) / interval_ of burst_ tokens, with
+  // every reservation paid for. it is full once tat_ <= now.
+  int64 tat_;
+  DISALLOW_COPY_AND_ASSIGN(RateLimiter);
+};
+
+}  // namespace tin
@@ -2,8 +2,15 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <new>
+
 #include "base/logging.h"
+#include "base/memory/aligned_memory.h"
 #include "tin/sync/atomic.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/env.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/scheduler.h"
 #include "tin/runtime/raw_mutex.h"
 #include "tin/runtime/semaphore.h"
 
@@ -13,6 +20,7 @@ namespace tin {
 
 namespace {
 const int32 kRWMutexMaxReaders = 1 << 30;
+const int kReaderSlotSize = 64;
 }
 
 RWMutex::RWMutex()
@@ -64,4 +72,92 @@ void RWMutex::Unlock() {
   w_.Unlock();
 }
 
+struct DistributedRWMutex::ReaderSlot {
+  // RLock minus RUnlock done on this P, may go below zero.
+  int32 readers;
+  char pad[kReaderSlotSize - sizeof(int32)];
+};
+
+DistributedRWMutex::DistributedRWMutex()
+  : writer_(0)
+  , writer_sem_(0)
+  , nslots_(runtime::kTinProcsLimit)
+  , slots_(NULL) {
+  // Ps may be added later, they share slots then.
+  if (runtime::rtm_conf != NULL)
+    nslots_ = runtime::rtm_conf->MaxProcs();
+  void* ptr = base::AlignedAlloc(sizeof(ReaderSlot) * nslots_,
+                                 kReaderSlotSize);
+  slots_ = static_cast<ReaderSlot*>(ptr);
+  for (int i = 0; i < nslots_; i++) {
+    new(&slots_[i]) ReaderSlot;
+    slots_[i].readers = 0;
+  }
+}
+
+DistributedRWMutex::~DistributedRWMutex() {
+  base::AlignedFree(slots_);
+}
+
+DistributedRWMutex::ReaderSlot* DistributedRWMutex::Slot() {
+  runtime::P* p = runtime::GetP();
+  if (p == NULL)
+    return &slots_[0];
+  return &slots_[p->Id() % nslots_];
+}
+
+int32 DistributedRWMutex::Readers() {
+  int32 r = 0;
+  for (int i = 0; i < nslots_; i++) {
+    r += atomic::load32(&slots_[i].readers);
+  }
+  return r;
+}
+
+void DistributedRWMutex::RLock() {
+  while (true) {
+    ReaderSlot* slot = Slot();
+    // full barrier, the writer sees us or we see the writer.
+    atomic::Inc32(&slot->readers, 1);
+    if (atomic::load32(&writer_) == 0)
+      return;
+    // a writer is in, back out and wait until it's done.
+    atomic::Inc32(&slot->readers, -1);
+    runtime::SemRelease(&writer_sem_);
+    w_.Lock();
+    w_.Unlock();
+  }
+}
+
+void DistributedRWMutex::RUnlock() {
+  atomic::Inc32(&Slot()->readers, -1);
+  if (atomic::load32(&writer_) != 0) {
+    // let the writer count again.
+    runtime::SemRelease(&writer_sem_);
+  }
+}
+
+void DistributedRWMutex::Lock() {
+  w_.Lock();
+  atomic::exchange32(&writer_, 1);
+  int32 r = Readers();
+  while (r != 0) {
+    if (r < 0) {
+      LOG(FATAL) << "sync: RUnlock of unlocked DistributedRWMutex";
+    }
+    runtime::SemAcquire(&writer_sem_);
+    r = Readers();
+  }
+}
+
+void DistributedRWMutex::Unlock() {
+  if (atomic::exchange32(&writer_, 0) == 0) {
+    LOG(FATAL) << "sync: Unlock of unlocked DistributedRWMutex";
+  }
+  // drop wakeups of readers we did not wait for.
+  while (runtime::SemTryAcquire(&writer_sem_)) {
+  }
+  w_.Unlock();
+}
+
 }  // namespace tin
@@ -59,4 +59,62 @@ class MutexWriterGuard {
   DISALLOW_COPY_AND_ASSIGN(MutexWriterGuard);
 };
 
+// RWMutex for read mostly data. every P counts its readers in a slot of
+// its own, so RLock and RUnlock touch no shared cache line unless a
+// writer is in. Lock sweeps all slots and is much slower than
+// RWMutex::Lock, the mutex costs a cache line per P.
+class DistributedRWMutex {
+ public:
+  DistributedRWMutex();
+  ~DistributedRWMutex();
+
+  void RLock();
+  void RUnlock();
+  void Lock();
+  void Unlock();
+
+ private:
+  struct ReaderSlot;
+  ReaderSlot* Slot();
+  // readers over all slots, a greenlet may RUnlock on another P.
+  int32 Readers();
+
+  Mutex  w_;            // held by the writer, readers wait on it.
+  int32  writer_;       // set while a writer is in or waits for readers.
+  uint32 writer_sem_;   // semaphore for writer to wait for departing readers
+  int    nslots_;
+  ReaderSlot* slots_;
+  DISALLOW_COPY_AND_ASSIGN(DistributedRWMutex);
+};
+
+class DistributedReaderGuard {
+ public:
+  inline explicit DistributedReaderGuard(DistributedRWMutex* lock)
+    : lock_(lock) {
+    lock->RLock();
+  }
+  inline ~DistributedReaderGuard() {
+    lock_->RUnlock();
+  }
+
+ private:
+  DistributedRWMutex* lock_;
+  DISALLOW_COPY_AND_ASSIGN(DistributedReaderGuard);
+};
+
+class DistributedWriterGuard {
+ public:
+  inline explicit DistributedWriterGuard(DistributedRWMutex* lock)
+    : lock_(lock) {
+    lock->Lock();
+  }
+  inline ~DistributedWriterGuard() {
+    lock_->Unlock();
+  }
+
+ private:
+  DistributedRWMutex* lock_;
+  DISALLOW_COPY_AND_ASSIGN(DistributedWriterGuard);
+};
+
 }  // namespace tin
@@ -0,0 +1,104 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/memory/aligned_memory.h"
+#include "tin/sync/atomic.h"
+#include "tin/runtime/raw_mutex.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/scheduler.h"
+#include "tin/runtime/util.h"
+
+#include "tin/sync/sharded_counter.h"
+
+namespace tin {
+
+struct ShardedCounter::Slot {
+  intptr_t value;
+  char pad[64 - sizeof(intptr_t)];
+};
+
+namespace {
+
+// the last slot is the one of foreign threads.
+const int kSlots = runtime::kTinProcsLimit + 1;
+
+// guards the list, made before the runtime and usable from any thread.
+runtime::RawMutex counters_lock;
+ShardedCounter* counters_head = NULL;
+ShardedCounter* counters_tail = NULL;
+
+}  // namespace
+
+ShardedCounter::ShardedCounter(const char* name)
+  : name_(name)
+  , slots_(NULL)
+  , prev_(NULL)
+  , next_(NULL) {
+  slots_ = static_cast<Slot*>(base::AlignedAlloc(sizeof(Slot) * kSlots, 64));
+  for (int i = 0; i < kSlots; i++)
+    slots_[i].value = 0;
+  if (name_ == NULL)
+    return;
+  runtime::RawMutexGuard guard(&counters_lock);
+  prev_ = counters_tail;
+  if (counters_tail != NULL)
+    counters_tail->next_ = this;
+  else
+    counters_head = this;
+  counters_tail = this;
+}
+
+ShardedCounter::~ShardedCounter() {
+  if (name_ != NULL) {
+    runtime::RawMutexGuard guard(&counters_lock);
+    if (prev_ != NULL)
+      prev_->next_ = next_;
+    else
+      counters_head = next_;
+    if (next_ != NULL)
+      next_->prev_ = prev_;
+    else
+      counters_tail = prev_;
+  }
+  base::AlignedFree(slots_);
+}
+
+void ShardedCounter::Add(intptr_t n) {
+  runtime::G* gp = runtime::GetGOrNull();
+  runtime::P* p = gp != NULL && gp->M() != NULL ? gp->M()->P() : NULL;
+  if (p == NULL) {
+    intptr_t* value = &slots_[kSlots - 1].value;
+    intptr_t old = atomic::relaxed_load(value);
+    while (!atomic::cas(value, old, old + n))
+      old = atomic::relaxed_load(value);
+    return;
+  }
+  // word sized, so Value never reads it torn.
+  intptr_t* value = &slots_[p->Id()].value;
+  atomic::relaxed_store(value, atomic::relaxed_load(value) + n);
+}
+
+int64 ShardedCounter::Value() const {
+  int64 sum = 0;
+  for (int i = 0; i < kSlots; i++)
+    sum += atomic::relaxed_load(&slots_[i].value);
+  return sum;
+}
+
+int GetShardedCounters(ShardedCounterValue* values, int max) {
+  runtime::RawMutexGuard guard(&counters_lock);
+  int n = 0;
+  for (ShardedCounter* c = counters_head; c != NULL; c = c->next_) {
+    if (n < max) {
+      values[n].name = c->name_;
+      values[n].value = c->Value();
+    }
+    n++;
+  }
+  return n;
+}
+
+}  // namespace tin
@@ -0,0 +1,63 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+
+#include "base/basictypes.h"
+
+namespace tin {
+
+// a counter every P bumps, say requests served or bytes sent. a greenlet
+// adds to the slot of its P, a cache line of its own, with a plain load
+// and store: greenlets of one P never run at once. Value sums the slots.
+// threads that are not greenlets add to one more slot, atomically. Add
+// with a negative n makes it a gauge, say of open connections.
+//
+// a slot per P the runtime can have costs 16k a counter, it is meant for
+// a few long lived ones.
+class ShardedCounter {
+ public:
+  // name, if not NULL, lists it in GetShardedCounters and must outlive
+  // the counter.
+  explicit ShardedCounter(const char* name = NULL);
+  ~ShardedCounter();
+
+  void Add(intptr_t n);
+
+  void Inc() {
+    Add(1);
+  }
+
+  // racy, adds running meanwhile may be missed.
+  int64 Value() const;
+
+  const char* name() const {
+    return name_;
+  }
+
+ private:
+  friend int GetShardedCounters(struct ShardedCounterValue* values,
+                                int max);
+
+  struct Slot;
+
+  const char* name_;
+  Slot* slots_;
+  // the list of named counters.
+  ShardedCounter* prev_;
+  ShardedCounter* next_;
+  DISALLOW_COPY_AND_ASSIGN(ShardedCounter);
+};
+
+struct ShardedCounterValue {
+  const char* name;
+  int64 value;
+};
+
+// fills up to max named counters in the order they were made, returns
+// how many there are. for stats reports, next to ReadRuntimeStats.
+int GetShardedCounters(ShardedCounterValue* values, int max);
+
+}  // namespace tin
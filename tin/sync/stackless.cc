@@ -0,0 +1,165 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/bind.h"
+#include "base/logging.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/semaphore.h"
+#include "tin/runtime/timer/timer_queue.h"
+
+#include "tin/sync/stackless.h"
+
+namespace tin {
+
+namespace {
+
+const uint32 kTaskIdle = 0;
+const uint32 kTaskQueued = 1;
+const uint32 kTaskRunning = 2;
+// woken while running, it is queued again once Resume returns.
+const uint32 kTaskWoken = 3;
+
+}  // namespace
+
+StacklessTask::StacklessTask()
+  : line_(0)
+  , runner_(NULL)
+  , next_(NULL)
+  , state_(kTaskIdle) {
+}
+
+StacklessTask::~StacklessTask() {
+}
+
+void StacklessTask::Wake() {
+  while (true) {
+    uint32 state = atomic::load32(&state_);
+    if (state == kTaskQueued || state == kTaskWoken)
+      return;
+    if (state == kTaskIdle) {
+      if (atomic::cas32(&state_, kTaskIdle, kTaskQueued)) {
+        runner_->Push(this);
+        return;
+      }
+    } else if (atomic::cas32(&state_, kTaskRunning, kTaskWoken)) {
+      return;
+    }
+  }
+}
+
+StacklessTimer::StacklessTimer()
+  : task_(NULL)
+  , armed_(false)
+  , done_(0) {
+}
+
+StacklessTimer::~StacklessTimer() {
+  Stop();
+}
+
+void StacklessTimer::Start(StacklessTask* task, int64 ns) {
+  Stop();
+  task_ = task;
+  timer_.f = OnFire;
+  timer_.arg = this;
+  timer_.when = runtime::NanoFromNow(ns);
+  timer_.slack = 0;
+  armed_ = true;
+  runtime::timer_q->AddTimer(&timer_);
+}
+
+bool StacklessTimer::Stop() {
+  if (!armed_)
+    return false;
+  armed_ = false;
+  if (runtime::timer_q->DelTimer(&timer_))
+    return true;
+  // fired, wait until its callback is done with the task.
+  while (atomic::acquire_load(&done_) != timer_.seq)
+    tin::Sched();
+  return false;
+}
+
+void StacklessTimer::OnFire(void* arg, uintptr_t seq) {
+  StacklessTimer* timer = static_cast<StacklessTimer*>(arg);
+  timer->task_->Wake();
+  atomic::release_store(&timer->done_, seq);
+}
+
+StacklessRunner::StacklessRunner(int proc)
+  : ready_(0)
+  , sema_(0)
+  , live_(0) {
+  SpawnOptions opts(0, "stackless");
+  opts.proc = proc;
+  opts.sticky = proc >= 0;
+  group_.Spawn(opts, base::Bind(&StacklessRunner::Run,
+                                base::Unretained(this)));
+}
+
+StacklessRunner::~StacklessRunner() {
+  Shutdown();
+}
+
+void StacklessRunner::Start(StacklessTask* task) {
+  DCHECK(!stopping_);
+  task->runner_ = this;
+  task->state_ = kTaskQueued;
+  atomic::Inc32(&live_, 1);
+  Push(task);
+}
+
+void StacklessRunner::Shutdown() {
+  stopping_ = true;
+  runtime::SemRelease(&sema_);
+  group_.Wait();
+}
+
+void StacklessRunner::Push(StacklessTask* task) {
+  while (true) {
+    uintptr_t head = atomic::relaxed_load(&ready_);
+    task->next_ = reinterpret_cast<StacklessTask*>(head);
+    if (atomic::cas(&ready_, head, reinterpret_cast<uintptr_t>(task))) {
+      if (head == 0)
+        runtime::SemRelease(&sema_);
+      return;
+    }
+  }
+}
+
+void StacklessRunner::Run() {
+  while (true) {
+    runtime::SemAcquire(&sema_);
+    StacklessTask* task = reinterpret_cast<StacklessTask*>(
+        atomic::acquire_exchange(&ready_, 0));
+    // the stack is newest first.
+    StacklessTask* fifo = NULL;
+    while (task != NULL) {
+      StacklessTask* next = task->next_;
+      task->next_ = fifo;
+      fifo = task;
+      task = next;
+    }
+    while (fifo != NULL) {
+      task = fifo;
+      fifo = task->next_;
+      atomic::release_store32(&task->state_, kTaskRunning);
+      if (!task->Resume()) {
+        delete task;
+        atomic::Inc32(&live_, -1);
+        continue;
+      }
+      if (!atomic::cas32(&task->state_, kTaskRunning, kTaskIdle)) {
+        // woken while it ran.
+        atomic::release_store32(&task->state_, kTaskQueued);
+        Push(task);
+      }
+    }
+    if (stopping_ && atomic::load32(&live_) == 0)
+      return;
+  }
+}
+
+}  // namespace tin
@@ -0,0 +1,131 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+
+#include "base/basictypes.h"
+#include "tin/sync/atomic_flag.h"
+#include "tin/sync/task_group.h"
+#include "tin/runtime/timer/timer.h"
+
+namespace tin {
+
+class StacklessRunner;
+
+// a task without a stack, a state machine resumed by the greenlet of its
+// runner. what it keeps across waits lives in members of the subclass, the
+// resume point in line_, see TIN_TASK_BEGIN. a task costs the object and
+// nothing else, for a million watchers that mostly wait.
+//
+// a task never blocks, it returns from Resume and is resumed again after
+// Wake. greenlets hand it data through channels it polls with the Try ops
+// and then wake it, a task needing a deadline embeds a StacklessTimer.
+class StacklessTask {
+ public:
+  StacklessTask();
+  virtual ~StacklessTask();
+
+  // runs until it has to wait, true to be resumed after the next Wake,
+  // false once done. the runner deletes a task that is done.
+  virtual bool Resume() = 0;
+
+  // queues the task on its runner, more Wakes before it runs count once.
+  // from greenlets and timer callbacks.
+  void Wake();
+
+ protected:
+  // resume point of the TIN_TASK_* macros, 0 at the start.
+  int line_;
+
+ private:
+  friend class StacklessRunner;
+
+  StacklessRunner* runner_;
+  StacklessTask* next_;
+  uint32 state_;
+  DISALLOW_COPY_AND_ASSIGN(StacklessTask);
+};
+
+// wakes a task once ns nano seconds passed, embedded in the task so only
+// the tasks that sleep pay for a timer.
+class StacklessTimer {
+ public:
+  StacklessTimer();
+  // Stop.
+  ~StacklessTimer();
+
+  void Start(StacklessTask* task, int64 ns);
+  // true if it had not fired yet, waits for a firing callback else.
+  bool Stop();
+
+ private:
+  static void OnFire(void* arg, uintptr_t seq);
+
+  runtime::Timer timer_;
+  StacklessTask* task_;
+  bool armed_;
+  uintptr_t done_;
+  DISALLOW_COPY_AND_ASSIGN(StacklessTimer);
+};
+
+// one greenlet running any number of tasks, they share its P and stack.
+// one runner per P spreads them, see proc.
+class StacklessRunner {
+ public:
+  // proc >= 0 keeps the greenlet on that P, see SpawnOn.
+  explicit StacklessRunner(int proc = -1);
+  // Shutdown.
+  ~StacklessRunner();
+
+  // takes task and runs it soon.
+  void Start(StacklessTask* task);
+
+  // waits for every task started to be done and stops the greenlet.
+  void Shutdown();
+
+ private:
+  friend class StacklessTask;
+
+  void Push(StacklessTask* task);
+  void Run();
+
+  // queued tasks, newest first, pushed by any waker.
+  uintptr_t ready_;
+  // one per push onto an empty ready_.
+  uint32 sema_;
+  // tasks started and not done.
+  uint32 live_;
+  AtomicFlag stopping_;
+  TaskGroup group_;
+  DISALLOW_COPY_AND_ASSIGN(StacklessRunner);
+};
+
+}  // namespace tin
+
+// resumable functions in the style of protothreads, for Resume. locals do
+// not survive a wait, keep state in members. one wait per line, and no
+// switch of its own may enclose a wait.
+#define TIN_TASK_BEGIN() switch (line_) { case 0:
+
+// waits until cond holds, looking again after each Wake.
+#define TIN_TASK_AWAIT(cond) \
+  do { \
+    line_ = __LINE__; \
+    case __LINE__: \
+    if (!(cond)) \
+      return true; \
+  } while (0)
+
+// waits for the next Wake.
+#define TIN_TASK_YIELD() \
+  do { \
+    line_ = __LINE__; \
+    return true; \
+    case __LINE__:; \
+  } while (0)
+
+#define TIN_TASK_END() \
+  } \
+  return false
@@ -0,0 +1,94 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/bind.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/util.h"
+
+#include "tin/sync/task_group.h"
+
+namespace tin {
+
+TaskGroup::TaskGroup()
+  : head_(NULL)
+  , canceled_(false) {
+}
+
+TaskGroup::~TaskGroup() {
+  Wait();
+}
+
+void TaskGroup::Spawn(base::Closure closure) {
+  Spawn(SpawnOptions(), closure);
+}
+
+void TaskGroup::Spawn(const SpawnOptions& opts, base::Closure closure) {
+  if (tin::Canceled())
+    Cancel();
+  wait_.Add(1);
+  DoSpawn(opts, base::Bind(&TaskGroup::Run, base::Unretained(this),
+                           closure));
+}
+
+void TaskGroup::Run(base::Closure closure) {
+  Task task;
+  task.gp = runtime::GetG();
+  task.prev = NULL;
+  bool canceled;
+  {
+    MutexGuard guard(&lock_);
+    task.next = head_;
+    if (head_ != NULL)
+      head_->prev = &task;
+    head_ = &task;
+    canceled = canceled_;
+  }
+  if (canceled)
+    task.gp->Cancel();
+
+  closure.Run();
+
+  {
+    // Cancel walks the list under the lock, so gp outlives its Cancel.
+    MutexGuard guard(&lock_);
+    if (task.prev != NULL) {
+      task.prev->next = task.next;
+    } else {
+      head_ = task.next;
+    }
+    if (task.next != NULL)
+      task.next->prev = task.prev;
+  }
+  wait_.Done();
+}
+
+void TaskGroup::Wait() {
+  runtime::G* gp = runtime::GetG();
+  if (!gp->BeginCancelable(OnOwnerCanceled, this, 0)) {
+    Cancel();
+    wait_.Wait();
+    return;
+  }
+  wait_.Wait();
+  gp->EndCancelable();
+}
+
+void TaskGroup::Cancel() {
+  MutexGuard guard(&lock_);
+  canceled_ = true;
+  for (Task* t = head_; t != NULL; t = t->next)
+    t->gp->Cancel();
+}
+
+bool TaskGroup::Canceled() {
+  MutexGuard guard(&lock_);
+  return canceled_;
+}
+
+void TaskGroup::OnOwnerCanceled(void* arg, uintptr_t data) {
+  static_cast<TaskGroup*>(arg)->Cancel();
+}
+
+}  // namespace tin
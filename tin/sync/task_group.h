@@ -0,0 +1,59 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+#include "base/basictypes.h"
+#include "base/callback.h"
+#include "tin/runtime/spawn.h"
+#include "tin/sync/mutex.h"
+#include "tin/sync/wait_group.h"
+
+namespace tin {
+
+namespace runtime {
+class Greenlet;
+}
+
+// spawns children and joins them, Cancel cancels the children still
+// running. a canceled child returns from NanoSleep, io waits and
+// SemAcquireFor with TIN_ECANCELED and should wind up, see tin::Canceled.
+// mutexes, WaitGroup and untimed Chan ops are not interrupted.
+//
+// cancellation propagates down, a greenlet canceled while in Wait cancels
+// the group, and children spawned by a canceled greenlet or after Cancel
+// start out canceled.
+class TaskGroup {
+ public:
+  TaskGroup();
+  // waits for the children, they point to the group.
+  ~TaskGroup();
+
+  void Spawn(base::Closure closure);
+  void Spawn(const SpawnOptions& opts, base::Closure closure);
+
+  void Wait();
+  void Cancel();
+
+  bool Canceled();
+
+ private:
+  struct Task {
+    runtime::Greenlet* gp;
+    Task* prev;
+    Task* next;
+  };
+
+  void Run(base::Closure closure);
+  static void OnOwnerCanceled(void* arg, uintptr_t data);
+
+  Mutex lock_;
+  // children running, linked while their Run is on the stack.
+  Task* head_;
+  bool canceled_;
+  WaitGroup wait_;
+  DISALLOW_COPY_AND_ASSIGN(TaskGroup);
+};
+
+}  // namespace tin
@@ -41,9 +41,7 @@ void WaitGroup::Add(int32 delta) {
     LOG(FATAL) << "sync: WaitGroup misuse: Add called concurrently with Wait";
   }
   state_ = 0;
-  for ( ; w != 0; w--) {
-    runtime::SemRelease(&sem_);
-  }
+  runtime::SemReleaseN(&sem_, w);
 }
 
 void WaitGroup::Done() {
@@ -70,4 +68,36 @@ void WaitGroup::Wait() {
   return;
 }
 
+bool WaitGroup::WaitFor(int64 ns) {
+  while (true) {
+    uint64 state = state_;
+    int32 v = static_cast<int32>(state >> 32);  // high 32 bits: counter.
+    if (v == 0)
+      return true;
+    if (ns <= 0)
+      return false;
+    if (!state_.compare_exchange_strong(state, state + 1))
+      continue;
+    if (runtime::SemAcquireFor(&sem_, ns)) {
+      if (state_ != 0) {
+        LOG(FATAL)
+            << "sync: WaitGroup is reused before previous Wait has returned";
+      }
+      return true;
+    }
+    // take our waiter back, unless the counter reached zero and Add is
+    // releasing every waiter counted, us too.
+    while (true) {
+      state = state_;
+      if (static_cast<int32>(state >> 32) == 0 ||
+          static_cast<uint32>(state) == 0) {
+        runtime::SemAcquire(&sem_);
+        return true;
+      }
+      if (state_.compare_exchange_strong(state, state - 1))
+        return false;
+    }
+  }
+}
+
 }  // namespace tin
@@ -18,6 +18,9 @@ class WaitGroup {
   void Add(int32 delta);
   void Done();
   void Wait();
+  // false if the counter did not reach zero within ns nano seconds or the
+  // greenlet is canceled, see SemAcquireFor.
+  bool WaitFor(int64 ns);
 
  private:
   quark::atomic_uint64_t state_;
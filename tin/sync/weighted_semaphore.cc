@@ -0,0 +1,202 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "base/logging.h"
+#include "tin/error/error.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/scheduler.h"
+#include "tin/runtime/timer/timer_queue.h"
+
+#include "tin/sync/weighted_semaphore.h"
+
+namespace tin {
+
+namespace {
+
+const uint32 kWaiting = 0;
+const uint32 kGranted = 1;
+const uint32 kTimedOut = 2;
+
+}  // namespace
+
+// lives on the stack of the parked greenlet, which waits for a fired
+// deadline to be done with it before returning.
+struct WeightedSemaphore::Waiter {
+  runtime::G* gp;
+  int64 n;
+  uint32 state;
+  bool fired;
+  WeightedSemaphore* sema;
+  Waiter* prev;
+  Waiter* next;
+};
+
+WeightedSemaphore::WeightedSemaphore(int64 size)
+  : size_(size)
+  , used_(0)
+  , head_(NULL)
+  , tail_(NULL) {
+}
+
+WeightedSemaphore::~WeightedSemaphore() {
+  DCHECK(head_ == NULL);
+}
+
+bool WeightedSemaphore::Acquire(int64 n) {
+  return AcquireImpl(n, -1);
+}
+
+bool WeightedSemaphore::AcquireFor(int64 n, int64 ns) {
+  return AcquireImpl(n, ns < 0 ? 0 : ns);
+}
+
+bool WeightedSemaphore::TryAcquire(int64 n) {
+  runtime::RawMutexGuard guard(&lock_);
+  if (head_ != NULL || size_ - used_ < n)
+    return false;
+  used_ += n;
+  return true;
+}
+
+void WeightedSemaphore::Release(int64 n) {
+  int32 nwake = 0;
+  runtime::G* glist = NULL;
+  {
+    runtime::RawMutexGuard guard(&lock_);
+    used_ -= n;
+    DCHECK_GE(used_, 0);
+    glist = GrantLocked(&nwake);
+  }
+  if (nwake > 0)
+    runtime::ReadyBatch(glist, nwake);
+}
+
+int64 WeightedSemaphore::available() {
+  runtime::RawMutexGuard guard(&lock_);
+  return size_ - used_;
+}
+
+bool WeightedSemaphore::AcquireImpl(int64 n, int64 ns) {
+  lock_.Lock();
+  if (head_ == NULL && size_ - used_ >= n) {
+    used_ += n;
+    lock_.Unlock();
+    return true;
+  }
+  if (n > size_ || ns == 0) {
+    lock_.Unlock();
+    SetErrorCode(n > size_ ? TIN_EINVAL : TIN_ETIMEDOUT);
+    return false;
+  }
+  runtime::G* gp = runtime::GetG();
+  Waiter w;
+  w.gp = gp;
+  w.n = n;
+  w.state = kWaiting;
+  w.fired = false;
+  w.sema = this;
+  Enqueue(&w);
+  runtime::Timer* timer = NULL;
+  if (ns > 0) {
+    timer = gp->GetTimer();
+    timer->f = OnDeadline;
+    timer->when = runtime::NanoFromNow(ns);
+    timer->slack = 0;
+    timer->arg = &w;
+    runtime::timer_q->AddTimer(timer);
+  }
+  runtime::ParkUnlock(&lock_, runtime::kParkSema);
+
+  if (timer != NULL && !runtime::timer_q->DelTimer(timer)) {
+    // the deadline fired, wait until its callback is done with w.
+    while (true) {
+      lock_.Lock();
+      bool fired = w.fired;
+      lock_.Unlock();
+      if (fired)
+        break;
+      tin::Sched();
+    }
+  }
+  if (w.state != kGranted) {
+    SetErrorCode(TIN_ETIMEDOUT);
+    return false;
+  }
+  return true;
+}
+
+void WeightedSemaphore::OnDeadline(void* arg, uintptr_t seq) {
+  Waiter* w = static_cast<Waiter*>(arg);
+  WeightedSemaphore* sema = w->sema;
+  runtime::G* gp = NULL;
+  runtime::G* glist = NULL;
+  int32 nwake = 0;
+  {
+    runtime::RawMutexGuard guard(&sema->lock_);
+    if (w->state == kWaiting) {
+      sema->Remove(w);
+      w->state = kTimedOut;
+      gp = w->gp;
+      // it may have been holding back the ones behind it.
+      glist = sema->GrantLocked(&nwake);
+    }
+    w->fired = true;
+  }
+  if (gp != NULL)
+    runtime::Ready(gp);
+  if (nwake > 0)
+    runtime::ReadyBatch(glist, nwake);
+}
+
+void WeightedSemaphore::Enqueue(Waiter* w) {
+  w->next = NULL;
+  w->prev = tail_;
+  if (tail_ != NULL) {
+    tail_->next = w;
+  } else {
+    head_ = w;
+  }
+  tail_ = w;
+}
+
+void WeightedSemaphore::Remove(Waiter* w) {
+  if (w->next != NULL) {
+    w->next->prev = w->prev;
+  } else {
+    tail_ = w->prev;
+  }
+  if (w->prev != NULL) {
+    w->prev->next = w->next;
+  } else {
+    head_ = w->next;
+  }
+  w->next = NULL;
+  w->prev = NULL;
+}
+
+runtime::G* WeightedSemaphore::GrantLocked(int32* n) {
+  runtime::G* glist = NULL;
+  runtime::G* gtail = NULL;
+  *n = 0;
+  while (head_ != NULL && size_ - used_ >= head_->n) {
+    Waiter* w = head_;
+    Remove(w);
+    used_ += w->n;
+    w->state = kGranted;
+    // w is gone once its greenlet runs, keep only the greenlet.
+    runtime::G* gp = w->gp;
+    gp->SetSchedLink(NULL);
+    if (gtail == NULL) {
+      glist = gp;
+    } else {
+      gtail->SetSchedLink(gp);
+    }
+    gtail = gp;
+    (*n)++;
+  }
+  return glist;
+}
+
+}  // namespace tin
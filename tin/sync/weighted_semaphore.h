@@ -0,0 +1,56 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stdlib.h>
+#include "base/basictypes.h"
+#include "tin/runtime/raw_mutex.h"
+
+namespace tin {
+
+// counts a resource of size units, e.g. bytes in flight. waiters are served
+// in order, a large request at the head holds back smaller ones behind it
+// so it can't starve. Release readies everybody it satisfies in one batch.
+class WeightedSemaphore {
+ public:
+  explicit WeightedSemaphore(int64 size);
+  ~WeightedSemaphore();
+
+  // parks until n units are free. false with TIN_EINVAL if n > size, which
+  // could never be satisfied.
+  bool Acquire(int64 n);
+
+  // parks at most ns nano seconds, false with TIN_ETIMEDOUT if n units did
+  // not come in time.
+  bool AcquireFor(int64 n, int64 ns);
+
+  // never parks, fails if anybody is waiting already.
+  bool TryAcquire(int64 n);
+
+  void Release(int64 n);
+
+  int64 available();
+
+ private:
+  struct Waiter;
+
+  static void OnDeadline(void* arg, uintptr_t seq);
+
+  // ns < 0 waits without a deadline.
+  bool AcquireImpl(int64 n, int64 ns);
+  void Enqueue(Waiter* w);
+  void Remove(Waiter* w);
+  // hands units to waiters from the head while they fit, returns their
+  // greenlets linked by schedlink, to be readied after unlocking.
+  runtime::G* GrantLocked(int32* n);
+
+  runtime::RawMutex lock_;
+  const int64 size_;
+  int64 used_;
+  Waiter* head_;
+  Waiter* tail_;
+  DISALLOW_COPY_AND_ASSIGN(WeightedSemaphore);
+};
+
+}  // namespace tin
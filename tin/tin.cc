@@ -52,8 +52,38 @@ Config DefaultConfig() {
   conf.SetMaxProcs(1);
   conf.SetStackSize(kDefaultStackSize);
   conf.SetOsThreadStackSize(kDefaultOSThreadStackSize);
+  conf.SetRunqCapacity(kDefaultRunqCapacity);
+  conf.SetStealBackoffRounds(2);
+  conf.SetCpuAffinity(0);
+  conf.SetNetPollBatch(kDefaultNetPollBatch);
+  conf.SetNetPollBusyPollUs(0);
+  conf.SetMSpinUs(50);
+  conf.SetSyscallRetakeUs(20);
+  conf.SetOverloadDelayUs(0);
+  conf.SetOverloadRunqDepth(0);
+  conf.SetTimerLagWarnMs(100);
+  conf.SetNetPollGapWarnMs(100);
+  conf.SetSocketBusyPollUs(0);
+  conf.SetTcpFastOpenQueue(0);
+  conf.SetTcpDeferAcceptSec(0);
+  conf.SetAcceptExPosted(0);
   conf.SetIgnoreSigpipe(true);
   conf.EnableStackPprotection(false);
+  conf.EnableLazyStack(false);
+  conf.EnableIdleStackRelease(false);
+  conf.EnableCoarseDeadline(false);
+  conf.EnableIoUring(false);
+  conf.EnableRio(false);
+  conf.EnableDnsClient(false);
+  conf.EnableSchedLatency(false);
+  conf.EnableSigquitDump(false);
+  conf.EnableStackHighWater(false);
+  conf.EnableHugePages(false);
+  conf.EnableSharedNothing(false);
+  conf.SetStackBudget(0);
+  conf.EnableStackBudgetFailFast(false);
+  conf.SetAsyncLogBufferSize(0);
+  conf.SetPrewarmGreenlets(0);
   return conf;
 }
 
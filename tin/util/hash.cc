@@ -0,0 +1,308 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <string.h>
+
+#include "build/build_config.h"
+
+#if defined(ARCH_CPU_X86_FAMILY)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <nmmintrin.h>
+#endif
+
+#if defined(ARCH_CPU_ARM64) && defined(OS_LINUX)
+#include <sys/auxv.h>
+#endif
+
+#include "base/synchronization/once.h"
+
+#include "tin/util/hash.h"
+
+namespace tin {
+
+namespace {
+
+typedef uint32 (*Crc32cFunc)(uint32 crc, const uint8* p, size_t n);
+
+// reflected 0x1EDC6F41.
+const uint32 kCrc32cPoly = 0x82f63b78;
+
+uint32 crc_tables[8][256];
+Crc32cFunc crc32c_impl = NULL;
+bool crc32c_hardware = false;
+base::OnceType crc32c_once = ONCE_INIT;
+
+inline uint32 Load32LE(const uint8* p) {
+  return static_cast<uint32>(p[0]) | (static_cast<uint32>(p[1]) << 8) |
+         (static_cast<uint32>(p[2]) << 16) | (static_cast<uint32>(p[3]) << 24);
+}
+
+uint32 Crc32cTables(uint32 crc, const uint8* p, size_t n) {
+  while (n > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    crc = crc_tables[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    n--;
+  }
+  while (n >= 8) {
+    uint32 lo = Load32LE(p) ^ crc;
+    uint32 hi = Load32LE(p + 4);
+    crc = crc_tables[7][lo & 0xff] ^ crc_tables[6][(lo >> 8) & 0xff] ^
+          crc_tables[5][(lo >> 16) & 0xff] ^ crc_tables[4][lo >> 24] ^
+          crc_tables[3][hi & 0xff] ^ crc_tables[2][(hi >> 8) & 0xff] ^
+          crc_tables[1][(hi >> 16) & 0xff] ^ crc_tables[0][hi >> 24];
+    p += 8;
+    n -= 8;
+  }
+  while (n > 0) {
+    crc = crc_tables[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    n--;
+  }
+  return crc;
+}
+
+#if defined(ARCH_CPU_X86_FAMILY)
+#if defined(_MSC_VER)
+#define TIN_TARGET_SSE42
+#else
+#define TIN_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+
+bool HasSse42() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 20)) != 0;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return false;
+  return (ecx & (1 << 20)) != 0;
+#endif
+}
+
+// one dependent crc32 a word, about 8 bytes in 3 cycles.
+TIN_TARGET_SSE42 uint32 Crc32cSse42(uint32 crc, const uint8* p, size_t n) {
+  while (n > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    crc = _mm_crc32_u8(crc, *p++);
+    n--;
+  }
+#if defined(ARCH_CPU_X86_64)
+  uint64 crc64 = crc;
+  while (n >= 8) {
+    uint64 v;
+    memcpy(&v, p, 8);
+    crc64 = _mm_crc32_u64(crc64, v);
+    p += 8;
+    n -= 8;
+  }
+  crc = static_cast<uint32>(crc64);
+#endif
+  while (n >= 4) {
+    uint32 v;
+    memcpy(&v, p, 4);
+    crc = _mm_crc32_u32(crc, v);
+    p += 4;
+    n -= 4;
+  }
+  while (n > 0) {
+    crc = _mm_crc32_u8(crc, *p++);
+    n--;
+  }
+  return crc;
+}
+#endif  // ARCH_CPU_X86_FAMILY
+
+#if defined(ARCH_CPU_ARM64) && defined(__GNUC__) && \
+    (defined(OS_LINUX) || defined(OS_MACOSX))
+#define TIN_ARM_CRC32 1
+
+bool HasArmCrc32() {
+#if defined(OS_LINUX)
+  // HWCAP_CRC32, not in older headers.
+  return (getauxval(AT_HWCAP) & (1 << 7)) != 0;
+#else
+  // every apple arm64 core has it.
+  return true;
+#endif
+}
+
+// the asm enables the extension itself, the file is built for plain v8.
+inline uint32 ArmCrc32cx(uint32 crc, uint64 v) {
+  __asm__(".arch_extension crc\n\tcrc32cx %w0, %w0, %x1"
+          : "+r"(crc) : "r"(v));
+  return crc;
+}
+
+inline uint32 ArmCrc32cb(uint32 crc, uint8 v) {
+  __asm__(".arch_extension crc\n\tcrc32cb %w0, %w0, %w1"
+          : "+r"(crc) : "r"(static_cast<uint32>(v)));
+  return crc;
+}
+
+uint32 Crc32cArm(uint32 crc, const uint8* p, size_t n) {
+  while (n > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    crc = ArmCrc32cb(crc, *p++);
+    n--;
+  }
+  while (n >= 8) {
+    uint64 v;
+    memcpy(&v, p, 8);
+    crc = ArmCrc32cx(crc, v);
+    p += 8;
+    n -= 8;
+  }
+  while (n > 0) {
+    crc = ArmCrc32cb(crc, *p++);
+    n--;
+  }
+  return crc;
+}
+#endif
+
+void InitCrc32c() {
+  for (uint32 i = 0; i < 256; i++) {
+    uint32 crc = i;
+    for (int k = 0; k < 8; k++)
+      crc = (crc >> 1) ^ ((crc & 1) != 0 ? kCrc32cPoly : 0);
+    crc_tables[0][i] = crc;
+  }
+  for (uint32 i = 0; i < 256; i++) {
+    for (int t = 1; t < 8; t++) {
+      uint32 prev = crc_tables[t - 1][i];
+      crc_tables[t][i] = (prev >> 8) ^ crc_tables[0][prev & 0xff];
+    }
+  }
+  crc32c_impl = Crc32cTables;
+#if defined(ARCH_CPU_X86_FAMILY)
+  if (HasSse42()) {
+    crc32c_impl = Crc32cSse42;
+    crc32c_hardware = true;
+  }
+#elif defined(TIN_ARM_CRC32)
+  if (HasArmCrc32()) {
+    crc32c_impl = Crc32cArm;
+    crc32c_hardware = true;
+  }
+#endif
+}
+
+const uint64 kWySecret[4] = {
+  GG_UINT64_C(0x2d358dccaa6c78a5), GG_UINT64_C(0x8bb84b93962eacc9),
+  GG_UINT64_C(0x4b33a62ed433d4a3), GG_UINT64_C(0x4d5a2da51de1aa47)
+};
+
+// the 128 bit product of *a and *b, low half in *a.
+inline void WyMum(uint64* a, uint64* b) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 r = *a;
+  r *= *b;
+  *a = static_cast<uint64>(r);
+  *b = static_cast<uint64>(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  *a = _umul128(*a, *b, b);
+#else
+  uint64 ha = *a >> 32, hb = *b >> 32;
+  uint64 la = static_cast<uint32>(*a), lb = static_cast<uint32>(*b);
+  uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64 t = rl + (rm0 << 32);
+  uint64 c = t < rl ? 1 : 0;
+  uint64 lo = t + (rm1 << 32);
+  c += lo < t ? 1 : 0;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+inline uint64 WyMix(uint64 a, uint64 b) {
+  WyMum(&a, &b);
+  return a ^ b;
+}
+
+inline uint64 WyRead8(const uint8* p) {
+  uint64 v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+inline uint64 WyRead4(const uint8* p) {
+  uint32 v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+// 1 to 3 bytes.
+inline uint64 WyRead3(const uint8* p, size_t n) {
+  return (static_cast<uint64>(p[0]) << 16) |
+         (static_cast<uint64>(p[n >> 1]) << 8) | p[n - 1];
+}
+
+}  // namespace
+
+uint32 Crc32cExtend(uint32 crc, const void* data, size_t n) {
+  base::CallOnce(&crc32c_once, InitCrc32c);
+  return ~crc32c_impl(~crc, static_cast<const uint8*>(data), n);
+}
+
+bool Crc32cHardware() {
+  base::CallOnce(&crc32c_once, InitCrc32c);
+  return crc32c_hardware;
+}
+
+uint64 Hash64(const void* data, size_t n, uint64 seed) {
+  const uint8* p = static_cast<const uint8*>(data);
+  seed ^= WyMix(seed ^ kWySecret[0], kWySecret[1]);
+  uint64 a, b;
+  if (n <= 16) {
+    if (n >= 4) {
+      // two overlapping reads of 4 bytes at each end.
+      size_t off = (n >> 3) << 2;
+      a = (WyRead4(p) << 32) | WyRead4(p + off);
+      b = (WyRead4(p + n - 4) << 32) | WyRead4(p + n - 4 - off);
+    } else if (n > 0) {
+      a = WyRead3(p, n);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = n;
+    if (i > 48) {
+      // three independent lanes.
+      uint64 see1 = seed, see2 = seed;
+      do {
+        seed = WyMix(WyRead8(p) ^ kWySecret[1], WyRead8(p + 8) ^ seed);
+        see1 = WyMix(WyRead8(p + 16) ^ kWySecret[2], WyRead8(p + 24) ^ see1);
+        see2 = WyMix(WyRead8(p + 32) ^ kWySecret[3], WyRead8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = WyMix(WyRead8(p) ^ kWySecret[1], WyRead8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = WyRead8(p + i - 16);
+    b = WyRead8(p + i - 8);
+  }
+  a ^= kWySecret[1];
+  b ^= seed;
+  WyMum(&a, &b);
+  return WyMix(a ^ kWySecret[0] ^ n, b ^ kWySecret[1]);
+}
+
+namespace internal {
+
+uint32 Crc32cPortable(uint32 crc, const void* data, size_t n) {
+  base::CallOnce(&crc32c_once, InitCrc32c);
+  return ~Crc32cTables(~crc, static_cast<const uint8*>(data), n);
+}
+
+}  // namespace internal
+
+}  // namespace tin
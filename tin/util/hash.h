@@ -0,0 +1,44 @@
+// Copyright (c) 2016 Tin Project. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <stddef.h>
+
+#include "base/basictypes.h"
+#include "base/strings/string_piece.h"
+
+namespace tin {
+
+// CRC32C (Castagnoli), the checksum of iSCSI, ext4 and snappy framing.
+// SSE4.2 or the ARMv8 CRC instructions when the cpu has them, chosen on
+// the first call, slicing by 8 tables else.
+uint32 Crc32cExtend(uint32 crc, const void* data, size_t n);
+
+inline uint32 Crc32c(const void* data, size_t n) {
+  return Crc32cExtend(0, data, n);
+}
+
+inline uint32 Crc32c(const base::StringPiece& data) {
+  return Crc32cExtend(0, data.data(), data.size());
+}
+
+// whether Crc32c runs on crc instructions.
+bool Crc32cHardware();
+
+// a fast non cryptographic 64 bit hash, wyhash's multiply and fold: keys
+// up to 16 bytes cost two 64x64->128 bit multiplies. for hash tables and
+// sharding, not for anything an attacker may pick keys of. not stable
+// across byte orders.
+uint64 Hash64(const void* data, size_t n, uint64 seed = 0);
+
+inline uint64 Hash64(const base::StringPiece& data, uint64 seed = 0) {
+  return Hash64(data.data(), data.size(), seed);
+}
+
+namespace internal {
+// the table version, the baseline of the benchmarks.
+uint32 Crc32cPortable(uint32 crc, const void* data, size_t n);
+}  // namespace internal
+
+}  // namespace tin
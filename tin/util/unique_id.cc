@@ -2,14 +2,56 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "base/memory/singleton.h"
-#include "base/atomicops.h"
-#include "tin/sync/mutex.h"
+#include "base/time/time.h"
+#include "tin/runtime/util.h"
+#include "tin/runtime/greenlet.h"
+#include "tin/runtime/m.h"
+#include "tin/runtime/p.h"
+#include "tin/runtime/runtime.h"
+#include "tin/runtime/scheduler.h"
 #include "tin/util/unique_id.h"
 #include "quark/atomic.hpp"
 
 namespace tin {
 
+namespace {
+// ids a P takes from the counter at once.
+const uint64 kIdBlock = 4096;
+// smaller for time ordered ids, a block holds ids of the milli second it
+// was taken in.
+const uint64 kTimeIdBlock = 64;
+
+const int kSequenceBits = 12;
+const int kNodeBits = 10;
+// 2016-01-01 UTC in milli seconds since the unix epoch.
+const int64 kTimeIdEpochMs = 1451606400000LL;
+
+uint32 time_id_node = 0;
+
+// ids from next up to limit are left, only touched by the M that owns P.
+struct IdBlock {
+  uint64 next;
+  uint64 limit;
+  // the time ordered block, milli second and sequence.
+  uint64 time_next;
+  uint64 time_limit;
+  char pad[32];
+};
+
+int IdProcId() {
+  runtime::G* gp = runtime::GetGOrNull();
+  if (gp == NULL || gp->M() == NULL || gp->M()->P() == NULL) {
+    return -1;
+  }
+  return gp->M()->P()->Id();
+}
+}  // namespace
+
 class UniqueIdGenerator {
  public:
   static UniqueIdGenerator* GetInstance() {
@@ -17,22 +59,85 @@ class UniqueIdGenerator {
   }
 
   uint64 Next() {
-    uint64 uid = uid_.fetch_add(1) + 1;
-    return uid;
+    int id = IdProcId();
+    if (id < 0) {
+      return uid_.fetch_add(1) + 1;
+    }
+    IdBlock* block = &blocks_[id];
+    if (block->next == block->limit) {
+      block->next = uid_.fetch_add(kIdBlock) + 1;
+      block->limit = block->next + kIdBlock;
+    }
+    return block->next++;
+  }
+
+  uint64 NextTimeOrdered() {
+    uint64 now = NowMs() << kSequenceBits;
+    uint64 v;
+    int id = IdProcId();
+    if (id < 0) {
+      v = Reserve(now, 1);
+    } else {
+      IdBlock* block = &blocks_[id];
+      // a block of an earlier milli second would give out stale ids.
+      if (block->time_next == block->time_limit || block->time_next < now) {
+        block->time_next = Reserve(now, kTimeIdBlock);
+        block->time_limit = block->time_next + kTimeIdBlock;
+      }
+      v = block->time_next++;
+    }
+    uint64 ms = v >> kSequenceBits;
+    uint64 seq = v & ((1 << kSequenceBits) - 1);
+    return (ms << (kNodeBits + kSequenceBits)) |
+           (static_cast<uint64>(time_id_node) << kSequenceBits) | seq;
   }
 
  private:
   UniqueIdGenerator()
-    : uid_(0) {
+    : uid_(0)
+    , time_state_(0)
+    , wall_base_ms_(base::Time::Now().ToJavaTime() - kTimeIdEpochMs)
+    , mono_base_(MonoNow()) {
+    memset(blocks_, 0, sizeof(blocks_));
+  }
+
+  // monotonic, the wall clock may step back.
+  uint64 NowMs() {
+    return wall_base_ms_ + (MonoNow() - mono_base_) / 1000000;
+  }
+
+  // n values from now or past the last reserved, whichever is larger.
+  uint64 Reserve(uint64 now, uint64 n) {
+    uint64 old = time_state_.load(quark::memory_order_acquire);
+    while (true) {
+      uint64 start = std::max(old, now);
+      if (time_state_.compare_exchange_strong(old, start + n)) {
+        return start;
+      }
+    }
   }
+
  private:
-  mutable tin::Mutex mutex_;
   quark::atomic_uint64_t uid_;
+  // the next free milli second and sequence of time ordered ids.
+  quark::atomic_uint64_t time_state_;
+  int64 wall_base_ms_;
+  int64 mono_base_;
+  IdBlock blocks_[runtime::kTinProcsLimit];
   friend struct DefaultSingletonTraits<UniqueIdGenerator>;
+  DISALLOW_COPY_AND_ASSIGN(UniqueIdGenerator);
 };
 
 uint64 GetUniqueId() {
   return UniqueIdGenerator::GetInstance()->Next();
 }
 
+uint64 GetTimeOrderedId() {
+  return UniqueIdGenerator::GetInstance()->NextTimeOrdered();
+}
+
+void SetTimeOrderedIdNode(uint32 node) {
+  time_id_node = node & ((1 << kNodeBits) - 1);
+}
+
 }  // namespace tin.
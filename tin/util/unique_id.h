@@ -7,6 +7,19 @@
 
 namespace tin {
 
+// never 0 and never the same twice in a process. every P hands out a range
+// of the global counter without atomics, so ids of different Ps are not
+// ordered by time.
 uint64 GetUniqueId();
 
+// snowflake style: 41 bits of milli seconds since 2016-01-01 UTC, 10 bits
+// of the node set below and 12 bits of sequence, so ids sort by the time
+// they were taken within a few milli seconds. more than 4096 a milli
+// second borrow from the next one.
+uint64 GetTimeOrderedId();
+
+// tells the processes sharing an id space apart, 0 to 1023. has to be set
+// before the first GetTimeOrderedId.
+void SetTimeOrderedIdNode(uint32 node);
+
 }  // namespace tin.